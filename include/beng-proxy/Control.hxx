@@ -196,6 +196,22 @@ struct ControlStats {
      */
     uint64_t http_traffic_received;
     uint64_t http_traffic_sent;
+
+    /**
+     * Lookups in the HTTP cache (memory tier) since the server was
+     * started, and the number of items which were evicted to make
+     * room for new ones.
+     */
+    uint64_t http_cache_hits, http_cache_misses;
+    uint64_t http_cache_evictions;
+
+    /**
+     * The fraction of the caches' #Rubber allocators which is
+     * occupied by holes, in units of 1/1000.
+     */
+    uint64_t http_cache_fragmentation;
+    uint64_t filter_cache_fragmentation;
+    uint64_t nfs_cache_fragmentation;
 };
 
 struct ControlHeader {
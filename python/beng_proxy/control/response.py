@@ -14,7 +14,7 @@ class Stats:
         if len(payload) < 48:
             raise MalformedResponseError()
 
-        fmt = '>IIIIQQQQQQQQQQQQQ'
+        fmt = '>IIIIQQQQQQQQQQQQQQQQQQQ'
         expected_length = struct.calcsize(fmt)
 
         if len(payload) > expected_length:
@@ -33,5 +33,9 @@ class Stats:
         self.filter_cache_brutto_size, \
         self.nfs_cache_size, self.nfs_cache_brutto_size, \
         self.io_buffers_size, self.io_buffers_brutto_size, \
-        self.http_traffic_received, self.http_traffic_sent = \
+        self.http_traffic_received, self.http_traffic_sent, \
+        self.http_cache_hits, self.http_cache_misses, \
+        self.http_cache_evictions, \
+        self.http_cache_fragmentation, self.filter_cache_fragmentation, \
+        self.nfs_cache_fragmentation = \
         struct.unpack(fmt, payload)
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENG_PROXY_CACHE_POLICY_HXX
+#define BENG_PROXY_CACHE_POLICY_HXX
+
+#include <stdint.h>
+
+/**
+ * Selects how a #Cache picks the items to be evicted and whether new
+ * items are admitted at all.
+ */
+enum class CachePolicy : uint8_t {
+    /**
+     * Evict the least recently used item.
+     */
+    LRU,
+
+    /**
+     * Segmented LRU: new items are put into the "probation" segment
+     * and are promoted to the "protected" segment on their first
+     * hit.  Items are evicted from the probation segment first, so a
+     * burst of items which are requested only once cannot push out
+     * the popular ones.
+     */
+    SLRU,
+
+    /**
+     * Like #SLRU, but a new item is only admitted if its key has
+     * been requested more often recently than the key of the item
+     * which would be evicted for it (TinyLFU).
+     */
+    TINY_LFU,
+};
+
+#endif
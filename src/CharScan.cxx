@@ -0,0 +1,375 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CharScan.hxx"
+#include "html_chars.hxx"
+#include "css_syntax.hxx"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_CHAR_SCAN_AVX2
+#endif
+
+/* the vector types are only ever used inside this file, and all
+   functions taking them get inlined; the ABI warning about 32 byte
+   vectors is not relevant */
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace {
+
+typedef signed char Vector16 __attribute__((vector_size(16)));
+typedef signed char Vector32 __attribute__((vector_size(32)));
+
+/*
+ * Character classes.  Each one has a scalar Match() and a
+ * vectorized MatchVector() method which returns 0xff for each
+ * matching byte and 0x00 for each mismatch.
+ *
+ */
+
+struct HtmlNameChar {
+    constexpr bool Match(char ch) const noexcept {
+        return is_html_name_char(ch);
+    }
+
+    template<typename V>
+    [[gnu::always_inline]]
+    V MatchVector(const V &c) const noexcept {
+        const V lower = c | 0x20;
+        return ((lower >= 'a') & (lower <= 'z')) |
+            /* '-', '.', digits and ':' (but not '/') */
+            ((c >= '-') & (c <= ':') & (c != '/')) |
+            (c == '_');
+    }
+};
+
+struct WhitespaceOrNull {
+    constexpr bool Match(char ch) const noexcept {
+        return IsWhitespaceOrNull(ch);
+    }
+
+    template<typename V>
+    [[gnu::always_inline]]
+    V MatchVector(const V &c) const noexcept {
+        /* the vector elements are signed */
+        return (c >= 0) & (c <= 0x20);
+    }
+};
+
+struct HtmlUnquotedValueEnd {
+    constexpr bool Match(char ch) const noexcept {
+        return IsWhitespaceOrNull(ch) || ch == '>';
+    }
+
+    template<typename V>
+    [[gnu::always_inline]]
+    V MatchVector(const V &c) const noexcept {
+        return ((c >= 0) & (c <= 0x20)) | (c == '>');
+    }
+};
+
+struct CssNameChar {
+    constexpr bool Match(char ch) const noexcept {
+        return is_css_nmchar(ch);
+    }
+
+    template<typename V>
+    [[gnu::always_inline]]
+    V MatchVector(const V &c) const noexcept {
+        const V lower = c | 0x20;
+        return ((lower >= 'a') & (lower <= 'z')) |
+            ((c >= '0') & (c <= '9')) |
+            (c == '_') | (c == '-') | (c == '\\') |
+            /* non-ASCII */
+            (c < 0);
+    }
+};
+
+class AnyOf {
+    char set[8];
+    unsigned n = 0;
+
+public:
+    explicit AnyOf(const char *_set) noexcept {
+        while (*_set != 0) {
+            assert(n < sizeof(set));
+            set[n++] = *_set++;
+        }
+    }
+
+    bool Match(char ch) const noexcept {
+        return memchr(set, ch, n) != nullptr;
+    }
+
+    template<typename V>
+    [[gnu::always_inline]]
+    V MatchVector(const V &c) const noexcept {
+        V result = c != c;
+        for (unsigned i = 0; i < n; ++i)
+            result |= c == set[i];
+        return result;
+    }
+};
+
+/*
+ * Scanner implementations.  Scan() returns the first character for
+ * which the class's Match() method returns #want.
+ *
+ */
+
+struct ScalarScanner {
+    template<bool want, typename C>
+    static const char *Scan(const char *p, const char *end,
+                            const C &c) noexcept {
+        while (p < end && c.Match(*p) != want)
+            ++p;
+        return p;
+    }
+};
+
+#ifdef __SSE2__
+
+struct Sse2Scanner {
+    template<bool want, typename C>
+    static const char *Scan(const char *p, const char *end,
+                            const C &c) noexcept {
+        while (end - p >= (ptrdiff_t)sizeof(Vector16)) {
+            Vector16 v;
+            memcpy(&v, p, sizeof(v));
+
+            unsigned mask = _mm_movemask_epi8((__m128i)c.MatchVector(v));
+            if (!want)
+                mask ^= 0xffff;
+
+            if (mask != 0)
+                return p + __builtin_ctz(mask);
+
+            p += sizeof(v);
+        }
+
+        return ScalarScanner::Scan<want>(p, end, c);
+    }
+};
+
+#endif
+
+#ifdef HAVE_CHAR_SCAN_AVX2
+
+struct Avx2Scanner {
+    template<bool want, typename C>
+    [[gnu::target("avx2")]]
+    static const char *Scan(const char *p, const char *end,
+                            const C &c) noexcept {
+        while (end - p >= (ptrdiff_t)sizeof(Vector32)) {
+            Vector32 v;
+            memcpy(&v, p, sizeof(v));
+
+            unsigned mask = _mm256_movemask_epi8((__m256i)c.MatchVector(v));
+            if (!want)
+                mask = ~mask;
+
+            if (mask != 0)
+                return p + __builtin_ctz(mask);
+
+            p += sizeof(v);
+        }
+
+#ifdef __SSE2__
+        return Sse2Scanner::Scan<want>(p, end, c);
+#else
+        return ScalarScanner::Scan<want>(p, end, c);
+#endif
+    }
+};
+
+#endif
+
+struct CharScanKernels {
+    CharScanImpl impl;
+
+    const char *(*find_non_html_name_char)(const char *p,
+                                           const char *end) noexcept;
+    const char *(*skip_whitespace_or_null)(const char *p,
+                                           const char *end) noexcept;
+    const char *(*find_html_unquoted_value_end)(const char *p,
+                                                const char *end) noexcept;
+    const char *(*find_non_css_name_char)(const char *p,
+                                          const char *end) noexcept;
+    const char *(*find_any_of)(const char *p, const char *end,
+                               const char *set) noexcept;
+};
+
+template<typename S>
+constexpr CharScanKernels
+MakeKernels(CharScanImpl impl) noexcept
+{
+    return {
+        impl,
+        [](const char *p, const char *end) noexcept {
+            return S::template Scan<false>(p, end, HtmlNameChar());
+        },
+        [](const char *p, const char *end) noexcept {
+            return S::template Scan<false>(p, end, WhitespaceOrNull());
+        },
+        [](const char *p, const char *end) noexcept {
+            return S::template Scan<true>(p, end, HtmlUnquotedValueEnd());
+        },
+        [](const char *p, const char *end) noexcept {
+            return S::template Scan<false>(p, end, CssNameChar());
+        },
+        [](const char *p, const char *end, const char *set) noexcept {
+            return S::template Scan<true>(p, end, AnyOf(set));
+        },
+    };
+}
+
+constexpr CharScanKernels scalar_kernels =
+    MakeKernels<ScalarScanner>(CharScanImpl::SCALAR);
+
+#ifdef __SSE2__
+constexpr CharScanKernels sse2_kernels =
+    MakeKernels<Sse2Scanner>(CharScanImpl::SSE2);
+#endif
+
+#ifdef HAVE_CHAR_SCAN_AVX2
+constexpr CharScanKernels avx2_kernels =
+    MakeKernels<Avx2Scanner>(CharScanImpl::AVX2);
+#endif
+
+gcc_pure
+const CharScanKernels *
+FindKernels(CharScanImpl impl) noexcept
+{
+    switch (impl) {
+    case CharScanImpl::SCALAR:
+        return &scalar_kernels;
+
+    case CharScanImpl::SSE2:
+#ifdef __SSE2__
+        return &sse2_kernels;
+#else
+        break;
+#endif
+
+    case CharScanImpl::AVX2:
+#ifdef HAVE_CHAR_SCAN_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &avx2_kernels;
+#endif
+        break;
+    }
+
+    return nullptr;
+}
+
+const CharScanKernels *
+DetectKernels() noexcept
+{
+    const auto *k = FindKernels(CharScanImpl::AVX2);
+    if (k == nullptr)
+        k = FindKernels(CharScanImpl::SSE2);
+    if (k == nullptr)
+        k = &scalar_kernels;
+    return k;
+}
+
+const CharScanKernels *kernels = DetectKernels();
+
+} // namespace
+
+CharScanImpl
+GetCharScanImpl() noexcept
+{
+    return kernels->impl;
+}
+
+bool
+SetCharScanImpl(CharScanImpl impl) noexcept
+{
+    const auto *k = FindKernels(impl);
+    if (k == nullptr)
+        return false;
+
+    kernels = k;
+    return true;
+}
+
+const char *
+GetCharScanImplName(CharScanImpl impl) noexcept
+{
+    switch (impl) {
+    case CharScanImpl::SCALAR:
+        return "scalar";
+
+    case CharScanImpl::SSE2:
+        return "sse2";
+
+    case CharScanImpl::AVX2:
+        return "avx2";
+    }
+
+    return "?";
+}
+
+const char *
+FindNonHtmlNameChar(const char *p, const char *end) noexcept
+{
+    return kernels->find_non_html_name_char(p, end);
+}
+
+const char *
+SkipWhitespaceOrNull(const char *p, const char *end) noexcept
+{
+    return kernels->skip_whitespace_or_null(p, end);
+}
+
+const char *
+FindHtmlUnquotedValueEnd(const char *p, const char *end) noexcept
+{
+    return kernels->find_html_unquoted_value_end(p, end);
+}
+
+const char *
+FindNonCssNameChar(const char *p, const char *end) noexcept
+{
+    return kernels->find_non_css_name_char(p, end);
+}
+
+const char *
+FindAnyOf(const char *p, const char *end, const char *set) noexcept
+{
+    return kernels->find_any_of(p, end, set);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Character class scanning kernels for the HTML/XML and CSS parsers.
+ * On x86 these are implemented with SSE2 and AVX2; the best variant
+ * is chosen at runtime.
+ */
+
+#pragma once
+
+#include "util/Compiler.h"
+
+enum class CharScanImpl {
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+/**
+ * Returns the implementation which is currently being used.
+ */
+gcc_pure
+CharScanImpl
+GetCharScanImpl() noexcept;
+
+/**
+ * Override the implementation chosen by the CPU feature detection
+ * (for benchmarks and unit tests).
+ *
+ * @return false if the implementation is not supported by this
+ * CPU/build
+ */
+bool
+SetCharScanImpl(CharScanImpl impl) noexcept;
+
+gcc_const
+const char *
+GetCharScanImplName(CharScanImpl impl) noexcept;
+
+/**
+ * Find the first character which does not match
+ * is_html_name_char().  Returns #end if there is none.
+ */
+gcc_pure
+const char *
+FindNonHtmlNameChar(const char *p, const char *end) noexcept;
+
+/**
+ * Skip all characters matching IsWhitespaceOrNull().
+ */
+gcc_pure
+const char *
+SkipWhitespaceOrNull(const char *p, const char *end) noexcept;
+
+/**
+ * Find the end of an unquoted attribute value, i.e. the first
+ * whitespace, null or '>'.
+ */
+gcc_pure
+const char *
+FindHtmlUnquotedValueEnd(const char *p, const char *end) noexcept;
+
+/**
+ * Find the first character which does not match is_css_nmchar().
+ */
+gcc_pure
+const char *
+FindNonCssNameChar(const char *p, const char *end) noexcept;
+
+/**
+ * Find the first occurrence of any character in the given set.
+ *
+ * @param set a null-terminated set of at most 8 characters
+ * @return the position or #end if there is none
+ */
+gcc_pure
+const char *
+FindAnyOf(const char *p, const char *end, const char *set) noexcept;
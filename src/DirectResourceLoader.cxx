@@ -258,7 +258,14 @@ try {
             filter_factory = nullptr;
         }
 
-        http_request(pool, event_loop, fs_balancer, session_sticky,
+        http_request(pool, event_loop, fs_balancer,
+                     /* HTTP/2 is only implemented for plain-text
+                        connections (prior knowledge) */
+                     filter_factory == nullptr ? http2_balancer : nullptr,
+                     /* pipelining is only implemented for plain-text
+                        connections, too */
+                     filter_factory == nullptr ? http_pipeline_balancer : nullptr,
+                     session_sticky,
                      filter_factory,
                      method, address.GetHttp(),
                      HttpHeaders(std::move(headers)), std::move(body),
@@ -43,6 +43,8 @@ struct FcgiStock;
 class NfsCache;
 class TcpBalancer;
 class FilteredSocketBalancer;
+class Http2Balancer;
+class HttpPipelineBalancer;
 
 /**
  * A #ResourceLoader implementation which integrates all client-side
@@ -52,6 +54,8 @@ class DirectResourceLoader final : public ResourceLoader {
     EventLoop &event_loop;
     TcpBalancer *tcp_balancer;
     FilteredSocketBalancer &fs_balancer;
+    Http2Balancer *http2_balancer;
+    HttpPipelineBalancer *http_pipeline_balancer;
     SpawnService &spawn_service;
     LhttpStock *lhttp_stock;
     FcgiStock *fcgi_stock;
@@ -63,6 +67,8 @@ public:
     DirectResourceLoader(EventLoop &_event_loop,
                          TcpBalancer *_tcp_balancer,
                          FilteredSocketBalancer &_fs_balancer,
+                         Http2Balancer *_http2_balancer,
+                         HttpPipelineBalancer *_http_pipeline_balancer,
                          SpawnService &_spawn_service,
                          LhttpStock *_lhttp_stock,
                          FcgiStock *_fcgi_stock, StockMap *_was_stock,
@@ -71,6 +77,8 @@ public:
         :event_loop(_event_loop),
          tcp_balancer(_tcp_balancer),
          fs_balancer(_fs_balancer),
+         http2_balancer(_http2_balancer),
+         http_pipeline_balancer(_http_pipeline_balancer),
          spawn_service(_spawn_service),
          lhttp_stock(_lhttp_stock),
          fcgi_stock(_fcgi_stock), was_stock(_was_stock),
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FrequencySketch.hxx"
+
+#include <algorithm>
+
+static constexpr uint64_t SEEDS[] = {
+    0xc3a5c85c97cb3127ULL,
+    0xb492b66fbe98f273ULL,
+    0x9ae16a3b2f90404fULL,
+    0xcbf29ce484222325ULL,
+};
+
+static constexpr size_t
+NextPowerOfTwo(size_t n) noexcept
+{
+    size_t result = 1;
+    while (result < n)
+        result <<= 1;
+    return result;
+}
+
+/**
+ * Mix the given hash with a seed, to obtain a different hash for
+ * each of the four rows.
+ */
+static constexpr uint64_t
+Spread(size_t hash, unsigned i) noexcept
+{
+    uint64_t h = (uint64_t(hash) + SEEDS[i]) * SEEDS[i];
+    return h ^ (h >> 32);
+}
+
+FrequencySketch::FrequencySketch(size_t capacity) noexcept
+{
+    /* four counters per distinct key, 16 counters per element */
+    const size_t n = NextPowerOfTwo(std::max<size_t>(capacity / 4, 8));
+    table.reset(new uint64_t[n]());
+    mask = n - 1;
+    sample_size = std::max<size_t>(capacity, 1) * 10;
+}
+
+void
+FrequencySketch::Increment(size_t hash) noexcept
+{
+    /* the low bits of the original hash select the counter group
+       (4 counters) inside each element */
+    const unsigned start = (hash & 3) << 2;
+
+    bool added = false;
+    for (unsigned i = 0; i < 4; ++i) {
+        uint64_t &word = table[Spread(hash, i) & mask];
+        const unsigned shift = (start + i) << 2;
+        if (((word >> shift) & 0xf) < 0xf) {
+            word += uint64_t(1) << shift;
+            added = true;
+        }
+    }
+
+    if (added && ++n_increments >= sample_size)
+        Reset();
+}
+
+unsigned
+FrequencySketch::Estimate(size_t hash) const noexcept
+{
+    const unsigned start = (hash & 3) << 2;
+
+    unsigned result = 0xf;
+    for (unsigned i = 0; i < 4; ++i) {
+        const uint64_t word = table[Spread(hash, i) & mask];
+        const unsigned shift = (start + i) << 2;
+        result = std::min(result, unsigned((word >> shift) & 0xf));
+    }
+
+    return result;
+}
+
+void
+FrequencySketch::Reset() noexcept
+{
+    /* halve all counters */
+    std::for_each(table.get(), table.get() + mask + 1, [](uint64_t &word){
+            word = (word >> 1) & 0x7777777777777777ULL;
+        });
+
+    n_increments /= 2;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENG_PROXY_FREQUENCY_SKETCH_HXX
+#define BENG_PROXY_FREQUENCY_SKETCH_HXX
+
+#include "util/Compiler.h"
+
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A compact approximation of how often each key has been seen
+ * recently (a "count-min sketch" with 4 bit counters).  It is used by
+ * #Cache to implement the TinyLFU admission policy.
+ *
+ * All counters are halved after a certain number of increments, so
+ * old popularity fades away.
+ */
+class FrequencySketch {
+    /**
+     * Each element contains 16 counters with 4 bits each.
+     */
+    std::unique_ptr<uint64_t[]> table;
+
+    /**
+     * The number of #table elements minus one (a power of two minus
+     * one).
+     */
+    size_t mask;
+
+    /**
+     * After this number of increments, all counters are halved.
+     */
+    size_t sample_size;
+
+    size_t n_increments = 0;
+
+public:
+    /**
+     * @param capacity the expected number of distinct keys
+     */
+    explicit FrequencySketch(size_t capacity) noexcept;
+
+    FrequencySketch(const FrequencySketch &) = delete;
+    FrequencySketch &operator=(const FrequencySketch &) = delete;
+
+    /**
+     * Record one occurrence of the given key hash.
+     */
+    void Increment(size_t hash) noexcept;
+
+    /**
+     * Estimate how often the given key hash has been seen (0..15).
+     */
+    gcc_pure
+    unsigned Estimate(size_t hash) const noexcept;
+
+private:
+    void Reset() noexcept;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RubberCompressor.hxx"
+#include "rubber.hxx"
+#include "io/Logger.hxx"
+
+/**
+ * How often is the fragmentation checked?
+ */
+static constexpr Event::Duration rubber_compress_check_interval =
+    std::chrono::seconds(10);
+
+/**
+ * Start compressing if this fraction of the brutto size is occupied
+ * by holes ...
+ */
+static constexpr double rubber_compress_fragmentation = 0.25;
+
+/**
+ * ... and if the holes occupy at least this many bytes.
+ */
+static constexpr size_t rubber_compress_min_waste = 4 * 1024 * 1024;
+
+/**
+ * The number of bytes moved by one Rubber::CompressStep() call.
+ */
+static constexpr size_t rubber_compress_step_bytes = 1024 * 1024;
+
+RubberCompressor::RubberCompressor(EventLoop &event_loop,
+                                   Rubber &_rubber) noexcept
+    :rubber(_rubber),
+     check_timer(event_loop, BIND_THIS_METHOD(OnCheckTimer)),
+     step_event(event_loop, BIND_THIS_METHOD(OnStep))
+{
+    ScheduleCheck();
+}
+
+inline void
+RubberCompressor::ScheduleCheck() noexcept
+{
+    check_timer.Schedule(rubber_compress_check_interval);
+}
+
+void
+RubberCompressor::OnCheckTimer() noexcept
+{
+    const size_t waste = rubber.GetBruttoSize() - rubber.GetNettoSize();
+    if (waste < rubber_compress_min_waste ||
+        rubber.GetFragmentation() < rubber_compress_fragmentation) {
+        ScheduleCheck();
+        return;
+    }
+
+    LogConcat(5, "rubber", "compressing ", waste, " bytes of holes");
+    step_event.Schedule();
+}
+
+void
+RubberCompressor::OnStep() noexcept
+{
+    if (rubber.CompressStep(rubber_compress_step_bytes))
+        ScheduleCheck();
+    else
+        step_event.Schedule();
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENG_PROXY_RUBBER_COMPRESSOR_HXX
+#define BENG_PROXY_RUBBER_COMPRESSOR_HXX
+
+#include "event/TimerEvent.hxx"
+#include "event/DeferEvent.hxx"
+
+class Rubber;
+
+/**
+ * Compresses a #Rubber allocator incrementally in the background.
+ * It checks the fragmentation periodically, and if it exceeds a
+ * threshold, Rubber::CompressStep() is called once per event loop
+ * iteration until the allocator is compact, so no single iteration
+ * is blocked for long.
+ */
+class RubberCompressor {
+    Rubber &rubber;
+
+    TimerEvent check_timer;
+
+    DeferEvent step_event;
+
+public:
+    RubberCompressor(EventLoop &event_loop, Rubber &_rubber) noexcept;
+
+    auto &GetEventLoop() const noexcept {
+        return check_timer.GetEventLoop();
+    }
+
+private:
+    void ScheduleCheck() noexcept;
+
+    void OnCheckTimer() noexcept;
+    void OnStep() noexcept;
+};
+
+#endif
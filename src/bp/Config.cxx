@@ -38,6 +38,28 @@
 
 #include <string.h>
 
+static CachePolicy
+ParseCachePolicy(const char *s)
+{
+    if (strcmp(s, "lru") == 0)
+        return CachePolicy::LRU;
+    else if (strcmp(s, "slru") == 0)
+        return CachePolicy::SLRU;
+    else if (strcmp(s, "tinylfu") == 0)
+        return CachePolicy::TINY_LFU;
+    else
+        throw std::runtime_error("Unknown cache policy");
+}
+
+static int
+ParseWindowBits(const char *s, long max)
+{
+    long value = ParsePositiveLong(s, max);
+    if (value < 10)
+        throw std::runtime_error("Window size too small");
+    return value;
+}
+
 void
 BpConfig::HandleSet(StringView name, const char *value)
 {
@@ -45,6 +67,46 @@ BpConfig::HandleSet(StringView name, const char *value)
         max_connections = ParsePositiveLong(value, 1024 * 1024);
     } else if (name.Equals("tcp_stock_limit")) {
         tcp_stock_limit = ParseUnsignedLong(value);
+    } else if (name.Equals("http2_upstream")) {
+#ifdef HAVE_NGHTTP2
+        http2_upstream = ParseBool(value);
+#else
+        throw std::runtime_error("HTTP/2 support is disabled");
+#endif
+    } else if (name.Equals("http_pipelining")) {
+        http_pipelining = ParseBool(value);
+    } else if (name.Equals("io_uring")) {
+#ifdef HAVE_URING
+        io_uring = ParseBool(value);
+#else
+        throw std::runtime_error("io_uring support is disabled");
+#endif
+    } else if (name.Equals("compress_gzip_level")) {
+        compress_gzip_level = ParsePositiveLong(value, 9);
+    } else if (name.Equals("compress_brotli")) {
+#ifdef HAVE_BROTLI
+        compress_brotli = ParseBool(value);
+#else
+        throw std::runtime_error("Brotli support is disabled");
+#endif
+    } else if (name.Equals("compress_brotli_quality")) {
+        compress_brotli_quality = ParsePositiveLong(value, 11);
+    } else if (name.Equals("compress_brotli_window")) {
+        compress_brotli_window = ParseWindowBits(value, 24);
+    } else if (name.Equals("compress_zstd")) {
+#ifdef HAVE_ZSTD
+        compress_zstd = ParseBool(value);
+#else
+        throw std::runtime_error("zstd support is disabled");
+#endif
+    } else if (name.Equals("compress_zstd_level")) {
+        compress_zstd_level = ParsePositiveLong(value, 22);
+    } else if (name.Equals("compress_zstd_window")) {
+        compress_zstd_window = ParseWindowBits(value, 31);
+    } else if (name.Equals("precompressed_brotli")) {
+        precompressed_brotli = ParseBool(value);
+    } else if (name.Equals("precompressed_zstd")) {
+        precompressed_zstd = ParseBool(value);
     } else if (name.Equals("fastcgi_stock_limit")) {
         fcgi_stock_limit = ParseUnsignedLong(value);
     } else if (name.Equals("fcgi_stock_max_idle")) {
@@ -56,12 +118,28 @@ BpConfig::HandleSet(StringView name, const char *value)
     } else if (name.Equals("http_cache_size")) {
         http_cache_size = ParseSize(value);
         http_cache_size_set = true;
+    } else if (name.Equals("http_cache_shared_size")) {
+        http_cache_shared_size = ParseSize(value);
+    } else if (name.Equals("http_cache_disk_path")) {
+        http_cache_disk_path = value;
+    } else if (name.Equals("http_cache_disk_size")) {
+        http_cache_disk_size = ParseSize(value);
+    } else if (name.Equals("http_cache_policy")) {
+        http_cache_policy = ParseCachePolicy(value);
     } else if (name.Equals("filter_cache_size")) {
         filter_cache_size = ParseSize(value);
+    } else if (name.Equals("filter_cache_policy")) {
+        filter_cache_policy = ParseCachePolicy(value);
     } else if (name.Equals("nfs_cache_size")) {
         nfs_cache_size = ParseSize(value);
+    } else if (name.Equals("processor_cache_size")) {
+        processor_cache_size = ParseSize(value);
+    } else if (name.Equals("yaml_subst_cache_size")) {
+        yaml_subst_cache_size = ParseSize(value);
     } else if (name.Equals("translate_cache_size")) {
         translate_cache_size = ParseUnsignedLong(value);
+    } else if (name.Equals("translate_cache_sweep_budget")) {
+        translate_cache_sweep_budget = std::chrono::milliseconds(ParsePositiveLong(value));
     } else if (name.Equals("translate_stock_limit")) {
         translate_stock_limit = ParseUnsignedLong(value);
     } else if (name.Equals("stopwatch")) {
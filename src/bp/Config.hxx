@@ -32,6 +32,7 @@
 
 #pragma once
 
+#include "CachePolicy.hxx"
 #include "access_log/Config.hxx"
 #include "ssl/Config.hxx"
 #include "net/SocketConfig.hxx"
@@ -61,6 +62,13 @@ struct BpConfig {
 
         bool auth_alt_host = false;
 
+        /**
+         * Accept HTTP/2 connections?  On SSL listeners, "h2" is
+         * offered via ALPN; on all others, clients need "prior
+         * knowledge".
+         */
+        bool http2 = false;
+
         bool ssl = false;
 
         SslConfig ssl_config;
@@ -115,15 +123,111 @@ struct BpConfig {
 
     size_t http_cache_size = 512 * 1024 * 1024;
 
+    /**
+     * The size of the HTTP cache in shared memory (shared by all
+     * workers); 0 disables it.
+     */
+    size_t http_cache_shared_size = 0;
+
+    /**
+     * The directory of the second-tier HTTP cache on disk; empty
+     * disables it.
+     */
+    std::string http_cache_disk_path;
+
+    size_t http_cache_disk_size = size_t(1024) * 1024 * 1024;
+
     size_t filter_cache_size = 128 * 1024 * 1024;
 
+    CachePolicy http_cache_policy = CachePolicy::LRU;
+    CachePolicy filter_cache_policy = CachePolicy::LRU;
+
     size_t nfs_cache_size = 256 * 1024 * 1024;
 
+    /**
+     * The size of the cache for parsed XML processor templates; 0
+     * disables it.
+     */
+    size_t processor_cache_size = 16 * 1024 * 1024;
+
+    /**
+     * The size of the cache for #SubstTree instances loaded from
+     * YAML files; 0 disables it.
+     */
+    size_t yaml_subst_cache_size = 4 * 1024 * 1024;
+
     unsigned translate_cache_size = 131072;
+
+    /**
+     * The maximum duration of one step of the incremental sweep
+     * after all translation cache items have been invalidated.
+     */
+    std::chrono::milliseconds translate_cache_sweep_budget{1};
+
     unsigned translate_stock_limit = 64;
 
     unsigned tcp_stock_limit = 0;
 
+    /**
+     * Speak HTTP/2 (prior knowledge) to plain-text HTTP servers?
+     */
+    bool http2_upstream = false;
+
+    /**
+     * Pipeline idempotent requests to HTTP servers?
+     */
+    bool http_pipelining = false;
+
+    /**
+     * Read files with io_uring instead of read()?
+     */
+    bool io_uring = false;
+
+    /**
+     * The zlib compression level for #TRANSLATE_AUTO_DEFLATE and
+     * #TRANSLATE_AUTO_GZIP; -1 means the zlib default.
+     */
+    int compress_gzip_level = -1;
+
+    /**
+     * Prefer Brotli over gzip for #TRANSLATE_AUTO_GZIP (if the client
+     * accepts it)?
+     */
+    bool compress_brotli = false;
+
+    int compress_brotli_quality = 5;
+
+    /**
+     * The base-2 logarithm of the Brotli window size; 0 means the
+     * library default.
+     */
+    int compress_brotli_window = 0;
+
+    /**
+     * Like #compress_brotli, but for Zstandard (".zst").
+     */
+    bool compress_zstd = false;
+
+    int compress_zstd_level = 3;
+
+    /**
+     * The base-2 logarithm of the zstd window size; 0 means the
+     * library default.
+     */
+    int compress_zstd_window = 0;
+
+    /**
+     * Look for precompressed ".br" files for
+     * #TRANSLATE_AUTO_GZIPPED?  This does not need the Brotli
+     * library.
+     */
+    bool precompressed_brotli = false;
+
+    /**
+     * Like #precompressed_brotli, but for Zstandard (".zst").
+     */
+    bool precompressed_zstd = false;
+
     unsigned fcgi_stock_limit = 0, fcgi_stock_max_idle = 16;
 
     unsigned was_stock_limit = 0, was_stock_max_idle = 16;
@@ -171,6 +171,31 @@ BpConfigParser::Listener::ParseLine(FileLineParser &line)
         line.ExpectEnd();
 
         config.ssl_config.cert_key.emplace_back(path, key_path);
+    } else if (strcmp(word, "http2") == 0) {
+#ifdef HAVE_NGHTTP2
+        config.http2 = line.NextBool();
+        line.ExpectEnd();
+#else
+        throw LineParser::Error("HTTP/2 support is disabled");
+#endif
+    } else if (strcmp(word, "ssl_ticket_key_file") == 0) {
+        if (!config.ssl)
+            throw LineParser::Error("SSL is not enabled");
+
+        if (!config.ssl_config.ticket_key_file.empty())
+            throw LineParser::Error("Ticket key file already configured");
+
+        config.ssl_config.ticket_key_file = line.ExpectValueAndEnd();
+    } else if (strcmp(word, "ktls") == 0) {
+        if (!config.ssl)
+            throw LineParser::Error("SSL is not enabled");
+
+#ifdef HAVE_LINUX_TLS_H
+        config.ssl_config.ktls = line.NextBool();
+        line.ExpectEnd();
+#else
+        throw LineParser::Error("Kernel TLS support is disabled");
+#endif
     } else
         throw LineParser::Error("Unknown option");
 }
@@ -184,6 +209,9 @@ BpConfigParser::Listener::Finish()
     if (config.ssl && config.ssl_config.cert_key.empty())
         throw LineParser::Error("No SSL certificates ");
 
+    /* offer "h2" via ALPN */
+    config.ssl_config.http2 = config.http2;
+
     parent.config.listen.emplace_front(std::move(config));
 
     ConfigParser::Finish();
@@ -127,19 +127,22 @@ HttpServerLogLevel(std::exception_ptr e) noexcept
  *
  */
 
-inline void
-BpConnection::PerRequest::Begin(std::chrono::steady_clock::time_point now) noexcept
+BpConnection::PerRequest &
+BpConnection::GetPerRequest(const HttpServerRequest &request) noexcept
 {
-    start_time = now;
-    site_name = nullptr;
+    assert(request.handler_data != nullptr);
+
+    return *(PerRequest *)request.handler_data;
 }
 
 void
-BpConnection::RequestHeadersFinished(const HttpServerRequest &) noexcept
+BpConnection::RequestHeadersFinished(HttpServerRequest &request) noexcept
 {
     ++instance.http_request_counter;
 
-    per_request.Begin(instance.event_loop.SteadyNow());
+    request.handler_data =
+        NewFromPool<PerRequest>(request.pool,
+                                instance.event_loop.SteadyNow());
 }
 
 void
@@ -156,7 +159,8 @@ BpConnection::LogHttpRequest(HttpServerRequest &request,
 {
     instance.http_traffic_received_counter += bytes_received;
     instance.http_traffic_sent_counter += bytes_sent;
-    if (instance.access_log != nullptr)
+    if (instance.access_log != nullptr) {
+        const auto &per_request = GetPerRequest(request);
         instance.access_log->Log(instance.event_loop.SystemNow(),
                                  request, per_request.site_name,
                                  nullptr,
@@ -165,6 +169,7 @@ BpConnection::LogHttpRequest(HttpServerRequest &request,
                                  status, length,
                                  bytes_received, bytes_sent,
                                  per_request.GetDuration(instance.event_loop.SteadyNow()));
+    }
 }
 
 void
@@ -194,7 +199,8 @@ void
 new_connection(BpInstance &instance,
                UniqueSocketDescriptor &&fd, SocketAddress address,
                SslFactory *ssl_factory,
-               const char *listener_tag, bool auth_alt_host) noexcept
+               const char *listener_tag, bool auth_alt_host,
+               bool http2) noexcept
 {
     if (instance.connections.size() >= instance.config.max_connections) {
         unsigned num_dropped = drop_some_connections(&instance);
@@ -235,6 +241,6 @@ new_connection(BpInstance &instance,
                                    ? (SocketAddress)local_address
                                    : nullptr,
                                    address,
-                                   true,
+                                   true, http2,
                                    *connection);
 }
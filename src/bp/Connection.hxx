@@ -36,6 +36,7 @@
 #include "http_server/Handler.hxx"
 #include "io/Logger.hxx"
 #include "pool/Ptr.hxx"
+#include "util/Compiler.h"
 
 #include <boost/intrusive/list.hpp>
 
@@ -49,6 +50,7 @@ class UniqueSocketDescriptor;
 class SocketAddress;
 struct SslFactory;
 struct HttpServerConnection;
+struct HttpServerRequest;
 
 /*
  * A connection from a HTTP client.
@@ -75,10 +77,10 @@ struct BpConnection final
     HttpServerConnection *http;
 
     /**
-     * Attributes which are specific to the current request.  They are
-     * only valid while a request is being handled (i.e. during the
-     * lifetime of the #HttpServerRequest instance).  Strings are
-     * allocated from the request pool.
+     * Attributes which are specific to one request.  An instance is
+     * allocated from the request pool and attached to
+     * HttpServerRequest::handler_data by RequestHeadersFinished().
+     * Strings are allocated from the request pool.
      */
     struct PerRequest {
         /**
@@ -94,12 +96,20 @@ struct BpConnection final
          */
         const char *site_name;
 
-        void Begin(std::chrono::steady_clock::time_point now) noexcept;
+        explicit PerRequest(std::chrono::steady_clock::time_point now) noexcept
+            :start_time(now), site_name(nullptr) {}
 
         std::chrono::steady_clock::duration GetDuration(std::chrono::steady_clock::time_point now) const noexcept {
             return now - start_time;
         }
-    } per_request;
+    };
+
+    /**
+     * Obtain the #PerRequest instance which was attached to the
+     * given request by RequestHeadersFinished().
+     */
+    gcc_pure
+    static PerRequest &GetPerRequest(const HttpServerRequest &request) noexcept;
 
     BpConnection(PoolPtr &&_pool, BpInstance &_instance,
                  const char *_listener_tag, bool _auth_alt_host,
@@ -111,7 +121,7 @@ struct BpConnection final
     };
 
     /* virtual methods from class HttpServerConnectionHandler */
-    void RequestHeadersFinished(const HttpServerRequest &request) noexcept override;
+    void RequestHeadersFinished(HttpServerRequest &request) noexcept override;
     void HandleHttpRequest(HttpServerRequest &request,
                            CancellablePointer &cancel_ptr) noexcept override;
 
@@ -128,7 +138,8 @@ void
 new_connection(BpInstance &instance,
                UniqueSocketDescriptor &&fd, SocketAddress address,
                SslFactory *ssl_factory,
-               const char *listener_tag, bool auth_alt_host) noexcept;
+               const char *listener_tag, bool auth_alt_host,
+               bool http2) noexcept;
 
 void
 close_connection(BpConnection *connection) noexcept;
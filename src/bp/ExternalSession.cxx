@@ -59,6 +59,8 @@ public:
 
     void SendRequest(BpInstance &instance, const SessionId session_id) {
         http_request(pool, instance.event_loop, *instance.fs_balancer,
+                     instance.http2_balancer,
+                     instance.http_pipeline_balancer,
                      session_id.GetClusterHash(),
                      nullptr,
                      HTTP_METHOD_GET, address,
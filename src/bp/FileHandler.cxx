@@ -300,6 +300,14 @@ file_callback(Request &request2, const FileAddress &address)
         !request2.IsTransformationEnabled() &&
         (file_check_compressed(request2, st, *body, "deflate",
                                address.deflated) ||
+         (address.auto_gzipped &&
+          request2.instance.config.precompressed_brotli &&
+          file_check_auto_compressed(request2, st, *body, "br",
+                                     address.path, ".br")) ||
+         (address.auto_gzipped &&
+          request2.instance.config.precompressed_zstd &&
+          file_check_auto_compressed(request2, st, *body, "zstd",
+                                     address.path, ".zst")) ||
          (address.auto_gzipped &&
           file_check_auto_compressed(request2, st, *body, "gzip",
                                      address.path, ".gz")) ||
@@ -35,3 +35,7 @@
 TranslationService *global_translation_service;
 
 PipeStock *global_pipe_stock;
+
+ProcessorCache *global_processor_cache;
+
+YamlSubstCache *global_yaml_subst_cache;
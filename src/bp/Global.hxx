@@ -38,7 +38,13 @@
 
 class TranslationService;
 class PipeStock;
+class ProcessorCache;
+class YamlSubstCache;
 
 extern TranslationService *global_translation_service;
 
 extern PipeStock *global_pipe_stock;
+
+extern ProcessorCache *global_processor_cache;
+
+extern YamlSubstCache *global_yaml_subst_cache;
@@ -45,6 +45,8 @@
 #include "BufferedResourceLoader.hxx"
 #include "http_cache.hxx"
 #include "fcache.hxx"
+#include "ProcessorCache.hxx"
+#include "YamlSubstCache.hxx"
 #include "translation/Stock.hxx"
 #include "translation/Cache.hxx"
 #include "lhttp_stock.hxx"
@@ -54,6 +56,12 @@
 #include "tcp_stock.hxx"
 #include "fs/Stock.hxx"
 #include "fs/Balancer.hxx"
+#ifdef HAVE_NGHTTP2
+#include "http2_stock.hxx"
+#include "http2_balancer.hxx"
+#endif
+#include "http_pipeline_stock.hxx"
+#include "http_pipeline_balancer.hxx"
 #include "stock/MapStock.hxx"
 #include "session/Save.hxx"
 #include "nfs/Stock.hxx"
@@ -109,6 +117,9 @@ BpInstance::FreeStocksAndCaches() noexcept
         filter_cache = nullptr;
     }
 
+    delete std::exchange(processor_cache, nullptr);
+    delete std::exchange(yaml_subst_cache, nullptr);
+
     if (lhttp_stock != nullptr) {
         lhttp_stock_free(lhttp_stock);
         lhttp_stock = nullptr;
@@ -124,6 +135,14 @@ BpInstance::FreeStocksAndCaches() noexcept
         was_stock = nullptr;
     }
 
+#ifdef HAVE_NGHTTP2
+    delete std::exchange(http2_balancer, nullptr);
+    delete std::exchange(http2_stock, nullptr);
+#endif
+
+    delete std::exchange(http_pipeline_balancer, nullptr);
+    delete std::exchange(http_pipeline_stock, nullptr);
+
     delete std::exchange(fs_balancer, nullptr);
     delete std::exchange(fs_stock, nullptr);
 
@@ -58,6 +58,10 @@ class TcpStock;
 class TcpBalancer;
 class FilteredSocketStock;
 class FilteredSocketBalancer;
+class Http2Stock;
+class Http2Balancer;
+class HttpPipelineStock;
+class HttpPipelineBalancer;
 class SpawnService;
 class ControlDistribute;
 class ControlServer;
@@ -72,6 +76,8 @@ struct NfsStock;
 class NfsCache;
 class HttpCache;
 class FilterCache;
+class ProcessorCache;
+class YamlSubstCache;
 struct BpWorker;
 class BPListener;
 struct BpConnection;
@@ -148,11 +154,21 @@ struct BpInstance final : PInstance, ControlHandler {
     FilteredSocketStock *fs_stock = nullptr;
     FilteredSocketBalancer *fs_balancer = nullptr;
 
+    Http2Stock *http2_stock = nullptr;
+    Http2Balancer *http2_balancer = nullptr;
+
+    HttpPipelineStock *http_pipeline_stock = nullptr;
+    HttpPipelineBalancer *http_pipeline_balancer = nullptr;
+
     /* cache */
     HttpCache *http_cache = nullptr;
 
     FilterCache *filter_cache = nullptr;
 
+    ProcessorCache *processor_cache = nullptr;
+
+    YamlSubstCache *yaml_subst_cache = nullptr;
+
     LhttpStock *lhttp_stock = nullptr;
     FcgiStock *fcgi_stock = nullptr;
 
@@ -40,11 +40,11 @@
 #include "util/Exception.hxx"
 
 BPListener::BPListener(BpInstance &_instance, const char *_tag,
-                       bool _auth_alt_host,
+                       bool _auth_alt_host, bool _http2,
                        const SslConfig *ssl_config)
     :ServerSocket(_instance.event_loop), instance(_instance),
      tag(_tag),
-     auth_alt_host(_auth_alt_host)
+     auth_alt_host(_auth_alt_host), http2(_http2)
 {
     if (ssl_config != nullptr)
         ssl_factory = ssl_factory_new_server(*ssl_config, nullptr);
@@ -61,7 +61,7 @@ BPListener::OnAccept(UniqueSocketDescriptor &&_fd,
                      SocketAddress address) noexcept
 {
     new_connection(instance, std::move(_fd), address, ssl_factory,
-                   tag, auth_alt_host);
+                   tag, auth_alt_host, http2);
 }
 
 void
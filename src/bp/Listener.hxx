@@ -49,11 +49,13 @@ class BPListener final : public ServerSocket {
 
     const bool auth_alt_host;
 
+    const bool http2;
+
     SslFactory *ssl_factory = nullptr;
 
 public:
     BPListener(BpInstance &_instance, const char *_tag,
-               bool _auth_alt_host,
+               bool _auth_alt_host, bool _http2,
                const SslConfig *ssl_config);
     ~BPListener();
 
@@ -48,6 +48,15 @@
 #include "cluster/TcpBalancer.hxx"
 #include "fs/Stock.hxx"
 #include "fs/Balancer.hxx"
+#ifdef HAVE_URING
+#include "uring_glue.hxx"
+#endif
+#ifdef HAVE_NGHTTP2
+#include "http2_stock.hxx"
+#include "http2_balancer.hxx"
+#endif
+#include "http_pipeline_stock.hxx"
+#include "http_pipeline_balancer.hxx"
 #include "stock/MapStock.hxx"
 #include "http_cache.hxx"
 #include "lhttp_stock.hxx"
@@ -55,6 +64,8 @@
 #include "was/Stock.hxx"
 #include "delegate/Stock.hxx"
 #include "fcache.hxx"
+#include "ProcessorCache.hxx"
+#include "YamlSubstCache.hxx"
 #include "thread_pool.hxx"
 #include "stopwatch.hxx"
 #include "pipe_stock.hxx"
@@ -161,6 +172,10 @@ BpInstance::ShutdownCallback() noexcept
 
     FreeStocksAndCaches();
 
+#ifdef HAVE_URING
+    uring_glue_deinit();
+#endif
+
     local_control_handler_deinit(this);
     global_control_handler_deinit(this);
 
@@ -187,6 +202,12 @@ BpInstance::ReloadEventCallback(int) noexcept
     if (nfs_cache != nullptr)
         nfs_cache_flush(*nfs_cache);
 
+    if (processor_cache != nullptr)
+        processor_cache->Flush();
+
+    if (yaml_subst_cache != nullptr)
+        yaml_subst_cache->Flush();
+
     Compress();
 }
 
@@ -208,7 +229,7 @@ void
 BpInstance::AddListener(const BpConfig::Listener &c)
 {
     listeners.emplace_front(*this, c.tag.empty() ? nullptr : c.tag.c_str(),
-                            c.auth_alt_host,
+                            c.auth_alt_host, c.http2,
                             c.ssl ? &c.ssl_config : nullptr);
     auto &listener = listeners.front();
 
@@ -232,7 +253,7 @@ BpInstance::AddListener(const BpConfig::Listener &c)
 void
 BpInstance::AddTcpListener(int port)
 {
-    listeners.emplace_front(*this, nullptr, false, nullptr);
+    listeners.emplace_front(*this, nullptr, false, false, nullptr);
     auto &listener = listeners.front();
     listener.ListenTCP(port);
     listener.SetTcpDeferAccept(10);
@@ -356,6 +377,24 @@ try {
     instance.fs_balancer = new FilteredSocketBalancer(*instance.fs_stock,
                                                       instance.failure_manager);
 
+#ifdef HAVE_NGHTTP2
+    if (instance.config.http2_upstream) {
+        instance.http2_stock = new Http2Stock(*instance.fs_stock,
+                                              instance.config.tcp_stock_limit);
+        instance.http2_balancer = new Http2Balancer(*instance.http2_stock,
+                                                    instance.failure_manager);
+    }
+#endif
+
+    if (instance.config.http_pipelining) {
+        instance.http_pipeline_stock =
+            new HttpPipelineStock(*instance.fs_stock,
+                                  instance.config.tcp_stock_limit);
+        instance.http_pipeline_balancer =
+            new HttpPipelineBalancer(*instance.http_pipeline_stock,
+                                     instance.failure_manager);
+    }
+
     if (instance.config.translation_socket != nullptr) {
         instance.translation_stock =
             new TranslationStock(instance.event_loop,
@@ -369,6 +408,7 @@ try {
                                      instance.event_loop,
                                      *instance.translation_stock,
                                      instance.config.translate_cache_size,
+                                     instance.config.translate_cache_sweep_budget,
                                      false);
             instance.translation_service = instance.translation_cache;
         }
@@ -403,6 +443,8 @@ try {
         new DirectResourceLoader(instance.event_loop,
                                  instance.tcp_balancer,
                                  *instance.fs_balancer,
+                                 instance.http2_balancer,
+                                 instance.http_pipeline_balancer,
                                  *instance.spawn_service,
                                  instance.lhttp_stock,
                                  instance.fcgi_stock,
@@ -411,8 +453,14 @@ try {
                                  instance.nfs_cache);
 
     if (instance.config.http_cache_size > 0) {
+        const auto &disk_path = instance.config.http_cache_disk_path;
         instance.http_cache = http_cache_new(instance.root_pool,
                                              instance.config.http_cache_size,
+                                             instance.config.http_cache_policy,
+                                             instance.config.http_cache_shared_size,
+                                             disk_path.empty()
+                                             ? nullptr : disk_path.c_str(),
+                                             instance.config.http_cache_disk_size,
                                              instance.event_loop,
                                              *instance.direct_resource_loader);
 
@@ -426,6 +474,7 @@ try {
     if (instance.config.filter_cache_size > 0) {
         instance.filter_cache = filter_cache_new(instance.root_pool,
                                                  instance.config.filter_cache_size,
+                                                 instance.config.filter_cache_policy,
                                                  instance.event_loop,
                                                  *instance.direct_resource_loader);
         instance.filter_resource_loader =
@@ -438,8 +487,20 @@ try {
                                    *instance.filter_resource_loader,
                                    instance.pipe_stock);
 
+    if (instance.config.processor_cache_size > 0)
+        instance.processor_cache =
+            new ProcessorCache(instance.root_pool, instance.event_loop,
+                               instance.config.processor_cache_size);
+
+    if (instance.config.yaml_subst_cache_size > 0)
+        instance.yaml_subst_cache =
+            new YamlSubstCache(instance.root_pool, instance.event_loop,
+                               instance.config.yaml_subst_cache_size);
+
     global_translation_service = instance.translation_service;
     global_pipe_stock = instance.pipe_stock;
+    global_processor_cache = instance.processor_cache;
+    global_yaml_subst_cache = instance.yaml_subst_cache;
 
     /* daemonize II */
 
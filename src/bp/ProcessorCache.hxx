@@ -0,0 +1,82 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "cache.hxx"
+#include "pool/Ptr.hxx"
+
+struct pool;
+class EventLoop;
+
+/**
+ * A cache for "compiled" templates of the XML processor, i.e. the
+ * list of substitutions found by the parser in a template document.
+ * The key is the resource tag of the template (which includes its
+ * ETag), so a template which is delivered unmodified (e.g. from the
+ * HTTP cache) does not need to be parsed again.
+ */
+class ProcessorCache {
+    const PoolPtr pool;
+
+    Cache cache;
+
+public:
+    ProcessorCache(struct pool &_pool, EventLoop &event_loop,
+                   size_t max_size) noexcept;
+    ~ProcessorCache() noexcept;
+
+    ProcessorCache(const ProcessorCache &) = delete;
+    ProcessorCache &operator=(const ProcessorCache &) = delete;
+
+    /**
+     * Create a new pool for a #CacheItem which will be passed to
+     * Put().
+     */
+    PoolPtr NewItemPool() noexcept;
+
+    std::chrono::steady_clock::time_point SteadyNow() const noexcept {
+        return cache.SteadyNow();
+    }
+
+    CacheItem *Get(const char *key) noexcept {
+        return cache.Get(key);
+    }
+
+    void Put(const char *key, CacheItem &item) noexcept {
+        cache.Put(key, item);
+    }
+
+    void Flush() noexcept {
+        cache.Flush();
+    }
+};
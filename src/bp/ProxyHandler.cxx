@@ -138,6 +138,14 @@ proxy_handler(Request &request2)
         ? *request2.instance.direct_resource_loader
         : *request2.instance.cached_resource_loader;
 
+    if (!tr.uncached && request2.instance.http_cache != nullptr) {
+        request2.http_cache_address =
+            NewFromPool<ResourceAddress>(pool, ShallowCopy(), address);
+        request2.http_cache_request_headers =
+            NewFromPool<StringMap>(pool, ShallowCopy(), pool,
+                                   forward.headers);
+    }
+
     rl.SendRequest(pool,
                    request2.session_id.GetClusterHash(),
                    nullptr, tr.site,
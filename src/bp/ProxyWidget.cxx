@@ -328,7 +328,7 @@ void
 proxy_widget(Request &request2,
              UnusedIstreamPtr body,
              Widget &widget, const struct widget_ref *proxy_ref,
-             unsigned options)
+             unsigned options, const char *source_tag)
 {
     assert(!widget.from_request.frame);
     assert(proxy_ref != nullptr);
@@ -341,6 +341,6 @@ proxy_widget(Request &request2,
 
     processor_lookup_widget(request2.pool, std::move(body),
                             widget, proxy_ref->id,
-                            request2.env, options,
+                            request2.env, options, source_tag,
                             *proxy, proxy->cancel_ptr);
 }
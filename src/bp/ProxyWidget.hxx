@@ -47,4 +47,4 @@ void
 proxy_widget(Request &request2,
              UnusedIstreamPtr body,
              Widget &widget, const struct widget_ref *proxy_ref,
-             unsigned options);
+             unsigned options, const char *source_tag);
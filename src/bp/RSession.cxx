@@ -323,10 +323,12 @@ Request::ApplyTranslateSession(const TranslateResponse &response)
             if (session)
                 session->SetSite(response.session_site);
 
-            connection.per_request.site_name = response.session_site;
+            BpConnection::GetPerRequest(request).site_name =
+                response.session_site;
         }
     } else if (session && session->site != nullptr)
-        connection.per_request.site_name = p_strdup(&pool, session->site);
+        BpConnection::GetPerRequest(request).site_name =
+            p_strdup(&pool, session->site);
 
     if (response.user != nullptr) {
         if (*response.user == 0) {
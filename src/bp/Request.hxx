@@ -223,6 +223,21 @@ struct Request final : HttpResponseHandler, DelegateHandler,
 
     struct processor_env env;
 
+    /**
+     * The address of the resource which was requested through the
+     * #HttpCache, or nullptr if the response did not come from the
+     * cache.  AutoDeflate() uses this to store the compressed
+     * response in the cache.
+     */
+    const ResourceAddress *http_cache_address = nullptr;
+
+    /**
+     * The request headers which were passed to the #HttpCache
+     * together with #http_cache_address; they select the "Vary"
+     * variant.
+     */
+    const StringMap *http_cache_request_headers = nullptr;
+
     /**
      * A pointer to the request body, or nullptr if there is none.  Once
      * the request body has been "used", this pointer gets cleared.
@@ -417,13 +432,15 @@ public:
                           const char *msg);
 
 private:
-    UnusedIstreamPtr AutoDeflate(HttpHeaders &response_headers,
+    UnusedIstreamPtr AutoDeflate(http_status_t status,
+                                 HttpHeaders &response_headers,
                                  UnusedIstreamPtr response_body);
 
     void InvokeXmlProcessor(http_status_t status,
                             StringMap &response_headers,
                             UnusedIstreamPtr response_body,
-                            const Transformation &transformation);
+                            const Transformation &transformation,
+                            const char *source_tag);
 
     void InvokeCssProcessor(http_status_t status,
                             StringMap &response_headers,
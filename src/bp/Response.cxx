@@ -52,6 +52,7 @@
 #include "session/Session.hxx"
 #include "GrowingBuffer.hxx"
 #include "ResourceLoader.hxx"
+#include "http_cache.hxx"
 #include "resource_tag.hxx"
 #include "hostname.hxx"
 #include "errdoc.hxx"
@@ -60,8 +61,11 @@
 #include "XmlProcessor.hxx"
 #include "CssProcessor.hxx"
 #include "TextProcessor.hxx"
+#include "YamlSubstCache.hxx"
 #include "istream/istream.hxx"
 #include "istream/istream_deflate.hxx"
+#include "istream/BrotliEncoderIstream.hxx"
+#include "istream/ZstdEncoderIstream.hxx"
 #include "istream/AutoPipeIstream.hxx"
 #include "istream/YamlSubstIstream.hxx"
 #include "istream/istream_string.hxx"
@@ -75,6 +79,8 @@
 #include "relocate_uri.hxx"
 #include "FilterStatus.hxx"
 
+#include <string.h>
+
 static const char *
 request_absolute_uri(const HttpServerRequest &request,
                      const char *scheme, const char *host, const char *uri)
@@ -131,10 +137,72 @@ session_drop_widgets(RealmSession &session, const char *uri,
     }
 }
 
+/**
+ * Choose the best encoding for #TRANSLATE_AUTO_GZIP which is
+ * accepted by the client.
+ *
+ * @return the "Content-Encoding" value or nullptr if the client does
+ * not accept any of them
+ */
+gcc_pure
+static const char *
+SelectAutoCompression(const BpConfig &config,
+                      const StringMap &request_headers) noexcept
+{
+#ifdef HAVE_BROTLI
+    if (config.compress_brotli &&
+        http_client_accepts_encoding(request_headers, "br"))
+        return "br";
+#endif
+
+#ifdef HAVE_ZSTD
+    if (config.compress_zstd &&
+        http_client_accepts_encoding(request_headers, "zstd"))
+        return "zstd";
+#endif
+
+    (void)config;
+
+    if (http_client_accepts_encoding(request_headers, "gzip"))
+        return "gzip";
+
+    return nullptr;
+}
+
+static UnusedIstreamPtr
+NewAutoCompressIstream(struct pool &pool, UnusedIstreamPtr input,
+                       EventLoop &event_loop, const BpConfig &config,
+                       const char *encoding) noexcept
+{
+#ifdef HAVE_BROTLI
+    if (strcmp(encoding, "br") == 0)
+        return NewBrotliEncoderIstream(pool, std::move(input), event_loop,
+                                       config.compress_brotli_quality,
+                                       config.compress_brotli_window);
+#endif
+
+#ifdef HAVE_ZSTD
+    if (strcmp(encoding, "zstd") == 0)
+        return NewZstdEncoderIstream(pool, std::move(input), event_loop,
+                                     config.compress_zstd_level,
+                                     config.compress_zstd_window);
+#endif
+
+    assert(strcmp(encoding, "gzip") == 0);
+
+    return istream_deflate_new(pool, std::move(input), event_loop, true,
+                               config.compress_gzip_level);
+}
+
 inline UnusedIstreamPtr
-Request::AutoDeflate(HttpHeaders &response_headers,
+Request::AutoDeflate(http_status_t status, HttpHeaders &response_headers,
                      UnusedIstreamPtr response_body)
 {
+    const char *encoding;
+
+    /* the encoding which was applied here, or nullptr */
+    const char *applied = nullptr;
+
     if (compressed) {
         /* already compressed */
     } else if (response_body &&
@@ -144,23 +212,44 @@ Request::AutoDeflate(HttpHeaders &response_headers,
         auto available = response_body.GetAvailable(false);
         if (available < 0 || available >= 512) {
             compressed = true;
+            applied = "deflate";
             response_headers.Write("content-encoding", "deflate");
             response_body = istream_deflate_new(pool, std::move(response_body),
-                                                instance.event_loop);
+                                                instance.event_loop, false,
+                                                instance.config.compress_gzip_level);
         }
     } else if (response_body &&
                translate.response->auto_gzip &&
-        http_client_accepts_encoding(request.headers, "gzip") &&
+               (encoding = SelectAutoCompression(instance.config,
+                                                 request.headers)) != nullptr &&
         response_headers.Get("content-encoding") == nullptr) {
         auto available = response_body.GetAvailable(false);
         if (available < 0 || available >= 512) {
             compressed = true;
-            response_headers.Write("content-encoding", "gzip");
-            response_body = istream_deflate_new(pool, std::move(response_body),
-                                                instance.event_loop, true);
+            applied = encoding;
+            response_headers.Write("content-encoding", encoding);
+            response_body = NewAutoCompressIstream(pool,
+                                                   std::move(response_body),
+                                                   instance.event_loop,
+                                                   instance.config,
+                                                   encoding);
         }
     }
 
+    if (applied != nullptr && http_cache_address != nullptr &&
+        !transformed)
+        /* keep a copy of the compressed body in the HTTP cache, so
+           the next request can be served without compressing it
+           again */
+        response_body = http_cache_put_encoded(*instance.http_cache, pool,
+                                               *http_cache_address,
+                                               *http_cache_request_headers,
+                                               status,
+                                               response_headers.Get("etag"),
+                                               response_headers.Get("last-modified"),
+                                               applied,
+                                               std::move(response_body));
+
     return response_body;
 }
 
@@ -173,7 +262,8 @@ inline void
 Request::InvokeXmlProcessor(http_status_t status,
                             StringMap &response_headers,
                             UnusedIstreamPtr response_body,
-                            const Transformation &transformation)
+                            const Transformation &transformation,
+                            const char *source_tag)
 {
     const char *uri;
 
@@ -269,7 +359,7 @@ Request::InvokeXmlProcessor(http_status_t status,
     env = processor_env(instance.event_loop,
                         *instance.cached_resource_loader,
                         *instance.buffered_filter_resource_loader,
-                        connection.per_request.site_name,
+                        BpConnection::GetPerRequest(request).site_name,
                         translate.response->untrusted,
                         request.local_host_and_port, request.remote_host,
                         uri,
@@ -287,12 +377,14 @@ Request::InvokeXmlProcessor(http_status_t status,
         /* the client requests a widget in proxy mode */
 
         proxy_widget(*this, std::move(response_body),
-                     *widget, proxy_ref, transformation.u.processor.options);
+                     *widget, proxy_ref, transformation.u.processor.options,
+                     source_tag);
     } else {
         /* the client requests the whole template */
         response_body = processor_process(pool, std::move(response_body),
                                           *widget, env,
-                                          transformation.u.processor.options);
+                                          transformation.u.processor.options,
+                                          source_tag);
         assert(response_body);
 
         if (instance.config.dump_widget_tree)
@@ -461,9 +553,15 @@ Request::InvokeSubst(http_status_t status,
 {
     try {
         InvokeResponse(status, std::move(response_headers),
-                       NewYamlSubstIstream(pool, std::move(response_body),
-                                           alt_syntax,
-                                           prefix, yaml_file, yaml_map_path));
+                       instance.yaml_subst_cache != nullptr
+                       ? instance.yaml_subst_cache->NewIstream(pool,
+                                                               std::move(response_body),
+                                                               alt_syntax,
+                                                               prefix, yaml_file,
+                                                               yaml_map_path)
+                       : NewYamlSubstIstream(pool, std::move(response_body),
+                                             alt_syntax,
+                                             prefix, yaml_file, yaml_map_path));
     } catch (...) {
         LogDispatchError(std::current_exception());
     }
@@ -657,13 +755,17 @@ Request::ApplyTransformation(http_status_t status, StringMap &&headers,
                     transformation.u.filter);
         break;
 
-    case Transformation::Type::PROCESS:
-        /* processor responses cannot be cached */
+    case Transformation::Type::PROCESS: {
+        /* the template may be cached by the processor, but processor
+           responses cannot be cached */
+        const char *source_tag = resource_tag_append_etag(&pool, resource_tag,
+                                                          headers);
         resource_tag = nullptr;
 
         InvokeXmlProcessor(status, headers, std::move(response_body),
-                           transformation);
+                           transformation, source_tag);
         break;
+    }
 
     case Transformation::Type::PROCESS_CSS:
         /* processor responses cannot be cached */
@@ -731,7 +833,8 @@ Request::DispatchResponse(http_status_t status, HttpHeaders &&headers,
                             std::move(response_body),
                             *transformation);
     } else {
-        response_body = AutoDeflate(headers, std::move(response_body));
+        response_body = AutoDeflate(status, headers,
+                                    std::move(response_body));
         DispatchResponseDirect(status, std::move(headers),
                                std::move(response_body));
     }
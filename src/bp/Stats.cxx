@@ -39,6 +39,7 @@
 #include "SlicePool.hxx"
 #include "translation/Cache.hxx"
 #include "http_cache.hxx"
+#include "cache.hxx"
 #include "fcache.hxx"
 #include "nfs/Cache.hxx"
 #include "session/Manager.hxx"
@@ -46,6 +47,15 @@
 #include "beng-proxy/Control.hxx"
 #include "util/ByteOrder.hxx"
 
+/**
+ * Convert a fraction to a big-endian number of 1/1000 units.
+ */
+static uint64_t
+ToPermille(double fraction) noexcept
+{
+    return ToBE64(uint64_t(fraction * 1000 + 0.5));
+}
+
 BengProxy::ControlStats
 BpInstance::GetStats() const noexcept
 {
@@ -85,10 +95,28 @@ BpInstance::GetStats() const noexcept
     stats.http_cache_brutto_size = ToBE64(http_cache_stats.brutto_size);
     stats.filter_cache_brutto_size = ToBE64(fcache_stats.brutto_size);
 
+    if (http_cache != nullptr) {
+        const auto &counters = http_cache_get_counters(*http_cache);
+        stats.http_cache_hits = ToBE64(counters.hits);
+        stats.http_cache_misses = ToBE64(counters.misses);
+        stats.http_cache_evictions = ToBE64(counters.evictions);
+    } else
+        stats.http_cache_hits = stats.http_cache_misses =
+            stats.http_cache_evictions = 0;
+
     const auto nfs_cache_stats = nfs_cache_get_stats(*nfs_cache);
     stats.nfs_cache_size = ToBE64(nfs_cache_stats.netto_size);
     stats.nfs_cache_brutto_size = ToBE64(nfs_cache_stats.brutto_size);
 
+    stats.http_cache_fragmentation = http_cache != nullptr
+        ? ToPermille(http_cache_get_fragmentation(*http_cache))
+        : 0;
+    stats.filter_cache_fragmentation = filter_cache != nullptr
+        ? ToPermille(filter_cache_get_fragmentation(*filter_cache))
+        : 0;
+    stats.nfs_cache_fragmentation =
+        ToPermille(nfs_cache_get_fragmentation(*nfs_cache));
+
     const auto io_buffers_stats = fb_pool_get().GetStats();
     stats.io_buffers_size = ToBE64(io_buffers_stats.netto_size);
     stats.io_buffers_brutto_size = ToBE64(io_buffers_stats.brutto_size);
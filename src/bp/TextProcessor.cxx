@@ -101,8 +101,10 @@ processor_subst_beng_widget(struct pool &pool,
 
 UnusedIstreamPtr
 text_processor(struct pool &pool, UnusedIstreamPtr input,
-               const Widget &widget, const struct processor_env &env)
+               const Widget &widget, const struct processor_env &env,
+               bool *matched_r)
 {
     return istream_subst_new(&pool, std::move(input),
-                             processor_subst_beng_widget(pool, widget, env));
+                             processor_subst_beng_widget(pool, widget, env),
+                             matched_r);
 }
@@ -52,7 +52,10 @@ text_processor_allowed(const StringMap &headers);
  * Process the specified istream, and return the processed stream.
  *
  * @param widget the widget that represents the template
+ * @param matched_r if not nullptr, then this flag is set to true as
+ * soon as an entity has been found in the input
  */
 UnusedIstreamPtr
 text_processor(struct pool &pool, UnusedIstreamPtr istream,
-               const Widget &widget, const struct processor_env &env);
+               const Widget &widget, const struct processor_env &env,
+               bool *matched_r=nullptr);
@@ -34,12 +34,16 @@
 #include "Connection.hxx"
 #include "Control.hxx"
 #include "Instance.hxx"
+#include "http_cache.hxx"
 #include "http_server/http_server.hxx"
 #include "session/Manager.hxx"
 #include "spawn/Client.hxx"
 #include "event/net/ServerSocket.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
 #include "io/Logger.hxx"
+#ifdef HAVE_URING
+#include "uring_glue.hxx"
+#endif
 #include "util/DeleteDisposer.hxx"
 #include "util/PrintException.hxx"
 
@@ -76,7 +80,21 @@ BpInstance::ScheduleSpawnWorker() noexcept
 void
 BpWorker::OnChildProcessExit(int status) noexcept
 {
-    const bool safe = crash_is_safe(&crash);
+    bool safe = crash_is_safe(&crash);
+
+    if (instance.http_cache != nullptr)
+        /* release the shared HTTP cache items which were being read
+           by the worker when it died */
+        http_cache_remove_worker(*instance.http_cache, pid);
+
+    if (WIFSIGNALED(status) && !instance.should_exit &&
+        instance.http_cache != nullptr &&
+        http_cache_renew_shared(*instance.http_cache, !safe))
+        /* the worker has died while holding the lock of the shared
+           HTTP cache, or it has crashed in a way which may have
+           corrupted it; the other workers are still using the old
+           one and need to be replaced */
+        safe = false;
 
     instance.workers.erase(instance.workers.iterator_to(*this));
 
@@ -110,6 +128,19 @@ BpInstance::InitWorker()
 {
     ForkCow(false);
     ScheduleCompress();
+
+#ifdef HAVE_URING
+    /* the io_uring instance must not be shared with other
+       processes, therefore it is created in each worker */
+    if (config.io_uring) {
+        try {
+            uring_glue_init(event_loop);
+        } catch (...) {
+            LogConcat(1, "worker", "Failed to initialize io_uring: ",
+                      std::current_exception());
+        }
+    }
+#endif
 }
 
 pid_t
@@ -160,6 +191,9 @@ BpInstance::SpawnWorker() noexcept
         child_process_registry.Clear();
         session_manager_event_del();
 
+        if (http_cache != nullptr)
+            http_cache_fork_worker(*http_cache);
+
         session_manager_init(event_loop,
                              config.session_idle_timeout,
                              config.cluster_size,
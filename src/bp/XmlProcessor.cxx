@@ -35,6 +35,7 @@
 #include "CssProcessor.hxx"
 #include "CssRewrite.hxx"
 #include "Global.hxx"
+#include "ProcessorCache.hxx"
 #include "penv.hxx"
 #include "xml_parser.hxx"
 #include "uri/Escape.hxx"
@@ -64,6 +65,7 @@
 #include "istream/istream_tee.hxx"
 #include "pool/pool.hxx"
 #include "pool/Holder.hxx"
+#include "AllocatorPtr.hxx"
 #include "util/CharUtil.hxx"
 #include "util/Macros.hxx"
 #include "util/RuntimeError.hxx"
@@ -88,6 +90,8 @@ struct uri_rewrite {
     char view[64];
 };
 
+struct CompiledTemplate;
+
 struct XmlProcessor final : PoolHolder, XmlParserHandler, Cancellable {
     class CdataIstream final : public Istream {
         friend struct XmlProcessor;
@@ -109,7 +113,7 @@ struct XmlProcessor final : PoolHolder, XmlParserHandler, Cancellable {
 
     SharedPoolPtr<ReplaceIstreamControl> replace;
 
-    XmlParser *parser;
+    XmlParser *parser = nullptr;
     bool had_input;
 
     enum class Tag {
@@ -157,6 +161,122 @@ struct XmlProcessor final : PoolHolder, XmlParserHandler, Cancellable {
 
     Tag tag = Tag::NONE;
 
+    struct CompiledWidgetAttribute {
+        CompiledWidgetAttribute *next = nullptr;
+
+        StringView name, value;
+    };
+
+    /**
+     * The parsed attributes of a "c:widget" element and its child
+     * elements.
+     */
+    struct CompiledWidget {
+        const CompiledWidgetAttribute *attributes;
+
+        const char *path_info, *view_name, *params;
+
+        const StringMap *headers;
+    };
+
+    /**
+     * A substitution found by the parser, recorded in a
+     * #CompiledTemplate.  It describes only the input of the
+     * substitution; the (request specific) replacement is generated
+     * each time the template is replayed.
+     */
+    struct CompiledOp {
+        CompiledOp *next = nullptr;
+
+        enum class Type {
+            /**
+             * Delete the range.
+             */
+            DELETE,
+
+            /**
+             * Rewrite the URI in the attribute value, see
+             * TransformUriAttribute().
+             */
+            URI,
+
+            /**
+             * See HandleClassAttribute().
+             */
+            CLASS,
+
+            /**
+             * See HandleIdAttribute().
+             */
+            ID,
+
+            /**
+             * See HandleStyleAttribute().
+             */
+            STYLE,
+
+            /**
+             * Embed a widget.
+             */
+            WIDGET,
+        } type;
+
+        /**
+         * The #Tag which contained the URI (only #Type::URI).
+         */
+        Tag tag;
+
+        off_t start, end;
+
+        /**
+         * The original attribute value.
+         */
+        StringView value;
+
+        /**
+         * Only #Type::URI.
+         */
+        struct uri_rewrite uri_rewrite;
+
+        /**
+         * Only #Type::WIDGET.
+         */
+        const CompiledWidget *widget;
+
+        CompiledOp(Type _type, off_t _start, off_t _end) noexcept
+            :type(_type), start(_start), end(_end) {}
+    };
+
+    /**
+     * Collects the #CompiledOp list while parsing a template which
+     * shall be stored in the #ProcessorCache.
+     */
+    struct Compiler {
+        /**
+         * The pool of the new #CompiledTemplate.  nullptr if the
+         * template is not being compiled.
+         */
+        PoolPtr pool;
+
+        const char *key;
+
+        CompiledOp *head = nullptr, **tail = &head;
+
+        /**
+         * The "c:widget" attributes of #CurrentWidget.
+         */
+        CompiledWidgetAttribute *widget_attributes, **widget_attributes_tail;
+
+        /**
+         * Set by the text processor if it has substituted an entity.
+         * In that case, the parser offsets are not valid for the
+         * original document, and the template cannot be cached.  This
+         * is allocated from the processor pool, because the text
+         * processor may outlive this object.
+         */
+        bool *text_matched = nullptr;
+    } compiler;
+
     struct uri_rewrite uri_rewrite;
 
     /**
@@ -279,7 +399,8 @@ private:
     }
 
     void Close() noexcept {
-        parser_close(parser);
+        if (parser != nullptr)
+            parser_close(parser);
         Destroy();
     }
 
@@ -287,6 +408,43 @@ private:
         replace->Add(start, end, std::move(istream));
     }
 
+    void Delete(off_t start, off_t end) noexcept {
+        Record(CompiledOp::Type::DELETE, start, end);
+        Replace(start, end, nullptr);
+    }
+
+public:
+    bool IsCompiling() const noexcept {
+        return compiler.pool;
+    }
+
+    void StartCompiling(const char *source_tag) noexcept;
+
+    /**
+     * Replay a #CompiledTemplate instead of parsing the document.
+     * The object is destroyed by this method.
+     */
+    void Replay(const CompiledTemplate &t) noexcept;
+
+private:
+    /**
+     * Discard the #CompiledOp list; this template will not be cached.
+     */
+    void AbandonCompiling() noexcept {
+        compiler.pool.reset();
+    }
+
+    void FinishCompiling() noexcept;
+
+    CompiledOp *Record(CompiledOp::Type type, off_t start, off_t end,
+                       StringView value=nullptr) noexcept;
+
+    void RecordWidgetAttribute(const XmlParserAttribute &attr) noexcept;
+    void RecordWidget(off_t start, off_t end,
+                      const Widget &child_widget) noexcept;
+
+    Widget &ReplayWidget(const CompiledWidget &src) noexcept;
+
     void ReplaceAttributeValue(const XmlParserAttribute &attr,
                                UnusedIstreamPtr value) noexcept {
         Replace(attr.value_start, attr.value_end, std::move(value));
@@ -371,6 +529,64 @@ private:
     }
 };
 
+/**
+ * The "compiled" representation of a template: the list of all
+ * substitutions which were found by the parser.  It is stored in the
+ * #ProcessorCache and allows processing the same template document
+ * again without parsing it.
+ */
+struct CompiledTemplate final : PoolHolder, CacheItem {
+    const XmlProcessor::CompiledOp *const ops;
+
+    CompiledTemplate(PoolPtr &&_pool,
+                     std::chrono::steady_clock::time_point now,
+                     size_t _size,
+                     const XmlProcessor::CompiledOp *_ops) noexcept
+        :PoolHolder(std::move(_pool)),
+         CacheItem(now, std::chrono::hours(1), _size),
+         ops(_ops) {}
+
+    /* virtual methods from class CacheItem */
+    void Destroy() noexcept override {
+        pool_trash(pool);
+        this->~CompiledTemplate();
+    }
+};
+
+static const char *
+MakeTemplateCacheKey(struct pool &pool, const char *source_tag,
+                     unsigned options) noexcept
+{
+    return p_sprintf(&pool, "%s|processor=%x", source_tag, options);
+}
+
+/**
+ * May a template with this source tag be stored in the
+ * #ProcessorCache?  A weak ETag does not guarantee that the document
+ * is byte-for-byte identical, and thus the parser offsets may not be
+ * valid.
+ */
+gcc_pure
+static bool
+IsCompilableSourceTag(const char *source_tag) noexcept
+{
+    return source_tag != nullptr && global_processor_cache != nullptr &&
+        strstr(source_tag, "|etag=W/") == nullptr;
+}
+
+static CompiledTemplate *
+LookupCompiledTemplate(const char *source_tag, unsigned options) noexcept
+{
+    if (!IsCompilableSourceTag(source_tag))
+        return nullptr;
+
+    const AutoRewindPool auto_rewind(*tpool);
+    auto *item = global_processor_cache->Get(MakeTemplateCacheKey(*tpool,
+                                                                  source_tag,
+                                                                  options));
+    return static_cast<CompiledTemplate *>(item);
+}
+
 bool
 processable(const StringMap &headers)
 {
@@ -446,16 +662,38 @@ UnusedIstreamPtr
 processor_process(struct pool &caller_pool, UnusedIstreamPtr input,
                   Widget &widget,
                   struct processor_env &env,
-                  unsigned options)
+                  unsigned options,
+                  const char *source_tag)
 {
     auto *processor = processor_new(caller_pool, widget, env, options);
     processor->lookup_id = nullptr;
 
+    auto *t = LookupCompiledTemplate(source_tag, options);
+    if (t != nullptr) {
+        /* this template has been parsed before; replay the
+           substitutions without parsing it again; the text processor
+           is skipped, because the template was only compiled if it
+           did not contain any entities */
+        auto r = istream_replace_new(*env.event_loop, processor->GetPool(),
+                                     std::move(input));
+        processor->replace = std::move(r.second);
+
+        t->Lock();
+        processor->Replay(*t);
+        t->Unlock();
+
+        return std::move(r.first);
+    }
+
+    if (IsCompilableSourceTag(source_tag))
+        processor->StartCompiling(source_tag);
+
     /* the text processor will expand entities */
     auto tee = istream_tee_new(processor->GetPool(),
                                text_processor(processor->GetPool(),
                                               std::move(input),
-                                              widget, env),
+                                              widget, env,
+                                              processor->compiler.text_matched),
                                *env.event_loop,
                                true, true);
 
@@ -486,6 +724,7 @@ processor_lookup_widget(struct pool &caller_pool,
                         Widget &widget, const char *id,
                         struct processor_env &env,
                         unsigned options,
+                        const char *source_tag,
                         WidgetLookupHandler &handler,
                         CancellablePointer &cancel_ptr)
 {
@@ -501,10 +740,21 @@ processor_lookup_widget(struct pool &caller_pool,
     auto *processor = processor_new(caller_pool, widget, env, options);
 
     processor->lookup_id = id;
+    processor->handler = &handler;
 
-    processor->InitParser(std::move(istream));
+    auto *t = LookupCompiledTemplate(source_tag, options);
+    if (t != nullptr) {
+        /* this template has been parsed before; find the widget in
+           the compiled template */
+        istream.Clear();
 
-    processor->handler = &handler;
+        t->Lock();
+        processor->Replay(*t);
+        t->Unlock();
+        return;
+    }
+
+    processor->InitParser(std::move(istream));
 
     cancel_ptr = *processor;
     processor->cancel_ptr = &cancel_ptr;
@@ -547,7 +797,7 @@ XmlProcessor::DeleteUriRewrite(off_t start, off_t end) noexcept
 {
     if (!postponed_rewrite.pending) {
         /* no URI attribute found yet: delete immediately */
-        Replace(start, end, nullptr);
+        Delete(start, end);
         return;
     }
 
@@ -600,6 +850,17 @@ XmlProcessor::CommitUriRewrite() noexcept
     /* rewrite the URI */
 
     uri_attribute.value = postponed_rewrite.value.ReadStringView();
+
+    if (IsCompiling()) {
+        auto *op = Record(CompiledOp::Type::URI,
+                          uri_attribute.value_start, uri_attribute.value_end,
+                          uri_attribute.value);
+        if (op != nullptr) {
+            op->tag = tag;
+            op->uri_rewrite = uri_rewrite;
+        }
+    }
+
     TransformUriAttribute(uri_attribute,
                           uri_rewrite.base,
                           uri_rewrite.mode,
@@ -611,7 +872,7 @@ XmlProcessor::CommitUriRewrite() noexcept
 
     for (const auto &i : postponed_rewrite.delete_)
         if (i.start > 0)
-            Replace(i.start, i.end, nullptr);
+            Delete(i.start, i.end);
 }
 
 /*
@@ -736,6 +997,9 @@ XmlProcessor::OnXmlTagStart(const XmlParserTag &xml_tag) noexcept
         widget.widget = NewFromPool<Widget>(widget.pool, widget.pool, nullptr);
         widget.params.Clear();
 
+        compiler.widget_attributes = nullptr;
+        compiler.widget_attributes_tail = &compiler.widget_attributes;
+
         widget.widget->parent = &container;
 
         return true;
@@ -1003,6 +1267,9 @@ XmlProcessor::HandleClassAttribute(const XmlParserAttribute &attr) noexcept
     if (u == nullptr)
         return;
 
+    Record(CompiledOp::Type::CLASS, attr.value_start, attr.value_end,
+           attr.value);
+
     buffer.Clear();
 
     do {
@@ -1053,6 +1320,10 @@ XmlProcessor::HandleIdAttribute(const XmlParserAttribute &attr) noexcept
     const auto end = attr.value.end();
 
     const unsigned n = underscore_prefix(p, end);
+    if (n == 2 || n == 3)
+        Record(CompiledOp::Type::ID, attr.value_start, attr.value_end,
+               attr.value);
+
     if (n == 3) {
         /* triple underscore: add widget path prefix */
 
@@ -1077,6 +1348,9 @@ XmlProcessor::HandleIdAttribute(const XmlParserAttribute &attr) noexcept
 void
 XmlProcessor::HandleStyleAttribute(const XmlParserAttribute &attr) noexcept
 {
+    Record(CompiledOp::Type::STYLE, attr.value_start, attr.value_end,
+           attr.value);
+
     auto result =
         css_rewrite_block_uris(pool, env,
                                *global_translation_service,
@@ -1173,6 +1447,8 @@ XmlProcessor::OnXmlAttributeFinished(const XmlParserAttribute &attr) noexcept
     case Tag::WIDGET:
         assert(widget.widget != nullptr);
 
+        RecordWidgetAttribute(attr);
+
         try {
             parser_widget_attr_finished(widget.widget,
                                         attr.name, attr.value);
@@ -1385,6 +1661,7 @@ XmlProcessor::WidgetElementFinished(const XmlParserTag &widget_tag,
                                     Widget &child_widget) noexcept
 {
     if (replace) {
+        RecordWidget(widget.start_offset, widget_tag.end, child_widget);
         Replace(widget.start_offset, widget_tag.end, OpenWidgetElement(child_widget));
         return true;
     } else
@@ -1498,7 +1775,7 @@ XmlProcessor::OnXmlTagFinished(const XmlParserTag &xml_tag) noexcept
         /* the settings of this tag become the new default */
         default_uri_rewrite = uri_rewrite;
 
-        Replace(xml_tag.start, xml_tag.end, nullptr);
+        Delete(xml_tag.start, xml_tag.end);
     } else if (tag == Tag::STYLE) {
         if (xml_tag.type == XmlParserTagType::OPEN && !IsQuiet() && HasOptionStyle()) {
             /* create a CSS processor for the contents of this style
@@ -1506,6 +1783,10 @@ XmlProcessor::OnXmlTagFinished(const XmlParserTag &xml_tag) noexcept
 
             tag = Tag::STYLE_PROCESS;
 
+            /* the CSS processor consumes CDATA from the parser; this
+               cannot be replayed */
+            AbandonCompiling();
+
             unsigned css_options = 0;
             if (options & PROCESSOR_REWRITE_URL)
                 css_options |= CSS_PROCESSOR_REWRITE_URL;
@@ -1557,6 +1838,9 @@ XmlProcessor::OnXmlEof(gcc_unused off_t length) noexcept
        because we didn't find it; dispose it now */
     container.DiscardForFocused();
 
+    if (IsCompiling())
+        FinishCompiling();
+
     if (replace)
         replace->Finish();
 
@@ -1586,3 +1870,198 @@ XmlProcessor::OnXmlError(std::exception_ptr ep) noexcept
 
     Destroy();
 }
+
+/*
+ * compiled templates
+ *
+ */
+
+inline void
+XmlProcessor::StartCompiling(const char *source_tag) noexcept
+{
+    assert(global_processor_cache != nullptr);
+    assert(!IsCompiling());
+
+    compiler.pool = global_processor_cache->NewItemPool();
+    compiler.key = MakeTemplateCacheKey(compiler.pool, source_tag, options);
+    compiler.text_matched = NewFromPool<bool>(pool, false);
+}
+
+inline void
+XmlProcessor::FinishCompiling() noexcept
+{
+    assert(IsCompiling());
+
+    if (*compiler.text_matched) {
+        /* the text processor has modified the document, and the
+           parser offsets refer to its output, not to the template */
+        AbandonCompiling();
+        return;
+    }
+
+    const size_t size = pool_netto_size(compiler.pool);
+    const char *key = compiler.key;
+    auto *t = NewFromPool<CompiledTemplate>(std::move(compiler.pool),
+                                            global_processor_cache->SteadyNow(),
+                                            size, compiler.head);
+    global_processor_cache->Put(key, *t);
+}
+
+XmlProcessor::CompiledOp *
+XmlProcessor::Record(CompiledOp::Type type, off_t start, off_t end,
+                     StringView value) noexcept
+{
+    if (!IsCompiling())
+        return nullptr;
+
+    struct pool &p = compiler.pool;
+    auto *op = NewFromPool<CompiledOp>(p, type, start, end);
+    op->value = AllocatorPtr(p).Dup(value);
+
+    *compiler.tail = op;
+    compiler.tail = &op->next;
+    return op;
+}
+
+void
+XmlProcessor::RecordWidgetAttribute(const XmlParserAttribute &attr) noexcept
+{
+    if (!IsCompiling())
+        return;
+
+    struct pool &p = compiler.pool;
+    const AllocatorPtr alloc(p);
+    auto *a = NewFromPool<CompiledWidgetAttribute>(p);
+    a->name = alloc.Dup(attr.name);
+    a->value = alloc.Dup(attr.value);
+
+    *compiler.widget_attributes_tail = a;
+    compiler.widget_attributes_tail = &a->next;
+}
+
+void
+XmlProcessor::RecordWidget(off_t start, off_t end,
+                           const Widget &child_widget) noexcept
+{
+    auto *op = Record(CompiledOp::Type::WIDGET, start, end);
+    if (op == nullptr)
+        return;
+
+    struct pool &p = compiler.pool;
+    auto *w = NewFromPool<CompiledWidget>(p);
+    w->attributes = compiler.widget_attributes;
+    w->path_info = p_strdup(&p, child_widget.from_template.path_info);
+    w->view_name = p_strdup_checked(&p, child_widget.from_template.view_name);
+    w->params = widget.params.IsEmpty()
+        ? nullptr
+        : widget.params.StringDup(p);
+    w->headers = child_widget.from_template.headers != nullptr
+        ? NewFromPool<StringMap>(p, p, *child_widget.from_template.headers)
+        : nullptr;
+    op->widget = w;
+}
+
+Widget &
+XmlProcessor::ReplayWidget(const CompiledWidget &src) noexcept
+{
+    auto *child_widget = NewFromPool<Widget>(widget.pool, widget.pool,
+                                             nullptr);
+    child_widget->parent = &container;
+
+    for (const auto *a = src.attributes; a != nullptr; a = a->next) {
+        try {
+            parser_widget_attr_finished(child_widget, a->name, a->value);
+        } catch (...) {
+            container.logger(2, std::current_exception());
+        }
+    }
+
+    child_widget->from_template.path_info =
+        p_strdup(&widget.pool, src.path_info);
+
+    if (src.view_name != nullptr)
+        child_widget->from_template.view_name =
+            p_strdup(&widget.pool, src.view_name);
+
+    if (src.headers != nullptr)
+        child_widget->from_template.headers =
+            NewFromPool<StringMap>(widget.pool, widget.pool, *src.headers);
+
+    if (src.params != nullptr)
+        widget.params.Set(src.params);
+    else
+        widget.params.Clear();
+
+    return *child_widget;
+}
+
+void
+XmlProcessor::Replay(const CompiledTemplate &t) noexcept
+{
+    for (const auto *op = t.ops; op != nullptr; op = op->next) {
+        if (op->type == CompiledOp::Type::WIDGET) {
+            auto &child_widget = ReplayWidget(*op->widget);
+
+            if (replace)
+                Replace(op->start, op->end, OpenWidgetElement(child_widget));
+            else if (!CheckWidgetLookup(child_widget))
+                /* the widget was found, and this object has been
+                   destroyed */
+                return;
+
+            continue;
+        }
+
+        if (!replace)
+            /* only widgets are interesting for a lookup */
+            continue;
+
+        XmlParserAttribute attr;
+        attr.value_start = op->start;
+        attr.value_end = op->end;
+        attr.value = op->value;
+
+        switch (op->type) {
+        case CompiledOp::Type::DELETE:
+            Replace(op->start, op->end, nullptr);
+            break;
+
+        case CompiledOp::Type::URI:
+            tag = op->tag;
+            TransformUriAttribute(attr,
+                                  op->uri_rewrite.base,
+                                  op->uri_rewrite.mode,
+                                  op->uri_rewrite.view[0] != 0
+                                  ? op->uri_rewrite.view : nullptr);
+            break;
+
+        case CompiledOp::Type::CLASS:
+            HandleClassAttribute(attr);
+            break;
+
+        case CompiledOp::Type::ID:
+            HandleIdAttribute(attr);
+            break;
+
+        case CompiledOp::Type::STYLE:
+            HandleStyleAttribute(attr);
+            break;
+
+        case CompiledOp::Type::WIDGET:
+            break;
+        }
+    }
+
+    /* the request body could not be submitted to the focused widget,
+       because we didn't find it; dispose it now */
+    container.DiscardForFocused();
+
+    if (replace)
+        replace->Finish();
+
+    if (lookup_id != nullptr)
+        /* widget was not found */
+        handler->WidgetNotFound();
+
+    Destroy();
+}
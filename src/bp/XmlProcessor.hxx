@@ -81,23 +81,30 @@ processable(const StringMap &headers);
  * Process the specified istream, and return the processed stream.
  *
  * @param widget the widget that represents the template
+ * @param source_tag a tag which identifies the template document
+ * (see resource_tag_append_etag()); if not nullptr, then the parsed
+ * template is stored in the #ProcessorCache, and it will not be
+ * parsed again if the same document is processed again
  */
 UnusedIstreamPtr
 processor_process(struct pool &pool, UnusedIstreamPtr istream,
                   Widget &widget,
                   struct processor_env &env,
-                  unsigned options);
+                  unsigned options,
+                  const char *source_tag);
 
 /**
  * Process the specified istream, and find the specified widget.
  *
  * @param widget the widget that represents the template
  * @param id the id of the widget to be looked up
+ * @param source_tag see processor_process()
  */
 void
 processor_lookup_widget(struct pool &pool, UnusedIstreamPtr istream,
                         Widget &widget, const char *id,
                         struct processor_env &env,
                         unsigned options,
+                        const char *source_tag,
                         WidgetLookupHandler &handler,
                         CancellablePointer &cancel_ptr);
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "YamlSubstCache.hxx"
+#include "istream/YamlSubstIstream.hxx"
+#include "istream/SubstIstream.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "pool/pool.hxx"
+#include "pool/Holder.hxx"
+#include "system/Error.hxx"
+
+#include <sys/stat.h>
+
+struct YamlSubstCache::Item final : PoolHolder, CacheItem {
+    const char *const path;
+
+    /**
+     * Attributes of the YAML file at the time it was loaded.
+     */
+    const dev_t dev;
+    const ino_t ino;
+    const struct timespec mtime;
+
+    const SubstTree tree;
+
+    Item(PoolPtr &&_pool, std::chrono::steady_clock::time_point now,
+         const char *_path, const struct stat &st,
+         SubstTree &&_tree) noexcept
+        :PoolHolder(std::move(_pool)),
+         CacheItem(now, std::chrono::hours(1), pool_netto_size(pool)),
+         path(_path),
+         dev(st.st_dev), ino(st.st_ino), mtime(st.st_mtim),
+         tree(std::move(_tree)) {}
+
+    PoolPtr GetPoolRef() const noexcept {
+        return pool;
+    }
+
+    /* virtual methods from class CacheItem */
+    bool Validate() const noexcept override {
+        struct stat st;
+        return stat(path, &st) == 0 &&
+            st.st_dev == dev && st.st_ino == ino &&
+            st.st_mtim.tv_sec == mtime.tv_sec &&
+            st.st_mtim.tv_nsec == mtime.tv_nsec;
+    }
+
+    void Destroy() noexcept override {
+        pool_trash(pool);
+        this->~Item();
+    }
+};
+
+YamlSubstCache::YamlSubstCache(struct pool &_pool, EventLoop &event_loop,
+                               size_t max_size) noexcept
+    :pool(pool_new_libc(&_pool, "yaml_subst_cache")),
+     cache(event_loop, 1021, max_size) {}
+
+YamlSubstCache::~YamlSubstCache() noexcept = default;
+
+UnusedIstreamPtr
+YamlSubstCache::NewIstream(struct pool &caller_pool, UnusedIstreamPtr input,
+                           bool alt_syntax, const char *prefix,
+                           const char *yaml_file, const char *yaml_map_path)
+{
+    const char *key = p_strcat(&caller_pool,
+                               alt_syntax ? "1" : "0", "\n",
+                               prefix != nullptr ? prefix : "", "\n",
+                               yaml_map_path != nullptr ? yaml_map_path : "",
+                               "\n", yaml_file,
+                               nullptr);
+
+    auto *item = (Item *)cache.Get(key);
+    if (item != nullptr)
+        return istream_subst_new_shared(caller_pool, std::move(input),
+                                        item->tree, item->GetPoolRef());
+
+    /* obtain the file attributes before loading it, so a
+       modification during loading invalidates the item */
+    struct stat st;
+    if (stat(yaml_file, &st) < 0)
+        throw FormatErrno("Failed to access YAML file '%s'", yaml_file);
+
+    auto item_pool = pool_new_libc(pool, "YamlSubstItem");
+
+    auto tree = LoadYamlSubstTree(item_pool, alt_syntax, prefix,
+                                  yaml_file, yaml_map_path);
+    tree.Compile(item_pool);
+
+    key = p_strdup(item_pool, key);
+    const char *path = p_strdup(item_pool, yaml_file);
+
+    item = NewFromPool<Item>(std::move(item_pool), cache.SteadyNow(),
+                             path, st, std::move(tree));
+
+    /* create the istream before passing the item to the cache,
+       because Cache::Put() may decide to destroy it right away */
+    auto result = istream_subst_new_shared(caller_pool, std::move(input),
+                                           item->tree, item->GetPoolRef());
+    cache.Put(key, *item);
+    return result;
+}
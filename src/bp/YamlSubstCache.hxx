@@ -0,0 +1,78 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "cache.hxx"
+#include "pool/Ptr.hxx"
+
+struct pool;
+class EventLoop;
+class UnusedIstreamPtr;
+
+/**
+ * A cache for #SubstTree instances loaded from YAML files (see
+ * #TranslationCommand::SUBST_YAML_FILE).  Each one is compiled only
+ * once and then shared by all requests which use the same file.  An
+ * item is discarded as soon as the file gets modified.
+ */
+class YamlSubstCache {
+    struct Item;
+
+    const PoolPtr pool;
+
+    Cache cache;
+
+public:
+    YamlSubstCache(struct pool &_pool, EventLoop &event_loop,
+                   size_t max_size) noexcept;
+    ~YamlSubstCache() noexcept;
+
+    YamlSubstCache(const YamlSubstCache &) = delete;
+    YamlSubstCache &operator=(const YamlSubstCache &) = delete;
+
+    /**
+     * Like NewYamlSubstIstream(), but use a cached #SubstTree if
+     * possible.
+     *
+     * Throws on error (if the YAML file could not be loaded).
+     */
+    UnusedIstreamPtr NewIstream(struct pool &caller_pool,
+                                UnusedIstreamPtr input,
+                                bool alt_syntax, const char *prefix,
+                                const char *yaml_file,
+                                const char *yaml_map_path);
+
+    void Flush() noexcept {
+        cache.Flush();
+    }
+};
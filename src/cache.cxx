@@ -31,6 +31,7 @@
  */
 
 #include "cache.hxx"
+#include "FrequencySketch.hxx"
 #include "event/Loop.hxx"
 #include "util/djbhash.h"
 
@@ -64,10 +65,15 @@ CacheItem::Release() noexcept
 }
 
 Cache::Cache(EventLoop &event_loop,
-             unsigned hashtable_capacity, size_t _max_size) noexcept
+             unsigned hashtable_capacity, size_t _max_size,
+             CachePolicy _policy) noexcept
     :max_size(_max_size),
+     policy(_policy),
      buckets(new ItemSet::bucket_type[hashtable_capacity]),
      items(ItemSet::bucket_traits(buckets.get(), hashtable_capacity)),
+     sketch(policy == CachePolicy::TINY_LFU
+            ? new FrequencySketch(hashtable_capacity)
+            : nullptr),
      cleanup_timer(event_loop, std::chrono::minutes(1),
                    BIND_THIS_METHOD(ExpireCallback)) {}
 
@@ -79,7 +85,8 @@ Cache::~Cache() noexcept
             size -= item->size;
 
 #ifndef NDEBUG
-            sorted_items.erase(sorted_items.iterator_to(*item));
+            auto &list = GetList(*item);
+            list.erase(list.iterator_to(*item));
 #endif
 
             item->Destroy();
@@ -87,6 +94,7 @@ Cache::~Cache() noexcept
 
     assert(size == 0);
     assert(sorted_items.empty());
+    assert(protected_items.empty());
 }
 
 std::chrono::steady_clock::time_point
@@ -109,7 +117,15 @@ Cache::ItemRemoved(CacheItem *item) noexcept
     assert(item->lock > 0 || !item->removed);
     assert(size >= item->size);
 
-    sorted_items.erase(sorted_items.iterator_to(*item));
+    SkipSweepCursor(*item);
+
+    auto &list = GetList(*item);
+    list.erase(list.iterator_to(*item));
+
+    if (item->in_protected) {
+        assert(protected_size >= item->size);
+        protected_size -= item->size;
+    }
 
     size -= item->size;
 
@@ -132,8 +148,45 @@ Cache::RefreshItem(CacheItem &item,
     item.last_accessed = now;
 
     /* move to the front of the linked list */
-    sorted_items.erase(sorted_items.iterator_to(item));
-    sorted_items.push_back(item);
+    SkipSweepCursor(item);
+
+    auto &list = GetList(item);
+    list.erase(list.iterator_to(item));
+
+    if (policy != CachePolicy::LRU && !item.in_protected) {
+        /* the first hit promotes the item to the protected
+           segment */
+        item.in_protected = true;
+        protected_size += item.size;
+        protected_items.push_back(item);
+        TrimProtected();
+    } else
+        list.push_back(item);
+}
+
+void
+Cache::TrimProtected() noexcept
+{
+    /* the protected segment may occupy 80% of the cache */
+    const size_t max_protected_size = max_size / 5 * 4;
+
+    while (protected_size > max_protected_size &&
+           std::next(protected_items.begin()) != protected_items.end()) {
+        CacheItem &item = protected_items.front();
+        SkipSweepCursor(item);
+        protected_items.pop_front();
+
+        item.in_protected = false;
+        protected_size -= item.size;
+        sorted_items.push_back(item);
+
+        if (sweep_cursor != nullptr && sweep_cursor->in_protected)
+            /* the sweep has already passed the probationary
+               segment; rewind it to the demoted item, or it would
+               never be visited (the following protected items are
+               visited again) */
+            sweep_cursor = &item;
+    }
 }
 
 void
@@ -145,12 +198,26 @@ Cache::RemoveItem(CacheItem &item) noexcept
                             ItemRemover(*this));
 }
 
+void
+Cache::RecordAccess(const char *key, bool hit) noexcept
+{
+    if (hit)
+        ++counters.hits;
+    else
+        ++counters.misses;
+
+    if (sketch)
+        sketch->Increment(CacheItem::KeyHasher(key));
+}
+
 CacheItem *
 Cache::Get(const char *key) noexcept
 {
     auto i = items.find(key, CacheItem::KeyHasher, CacheItem::KeyValueEqual);
-    if (i == items.end())
+    if (i == items.end()) {
+        RecordAccess(key, false);
         return nullptr;
+    }
 
     CacheItem *item = &*i;
 
@@ -158,10 +225,12 @@ Cache::Get(const char *key) noexcept
 
     if (!item->Validate(now)) {
         RemoveItem(*item);
+        RecordAccess(key, false);
         return nullptr;
     }
 
     RefreshItem(*item, now);
+    RecordAccess(key, true);
     return item;
 }
 
@@ -169,6 +238,16 @@ CacheItem *
 Cache::GetMatch(const char *key,
                 bool (*match)(const CacheItem *, void *),
                 void *ctx) noexcept
+{
+    auto *item = LookupMatch(key, match, ctx);
+    RecordAccess(key, item != nullptr);
+    return item;
+}
+
+CacheItem *
+Cache::LookupMatch(const char *key,
+                   bool (*match)(const CacheItem *, void *),
+                   void *ctx) noexcept
 {
     const auto now = SteadyNow();
 
@@ -192,16 +271,62 @@ Cache::GetMatch(const char *key,
     return nullptr;
 }
 
+const CacheItem *
+Cache::GetVictim() const noexcept
+{
+    /* evict from the probation segment first */
+    if (!sorted_items.empty())
+        return &sorted_items.front();
+
+    if (!protected_items.empty())
+        return &protected_items.front();
+
+    return nullptr;
+}
+
 void
 Cache::DestroyOldestItem() noexcept
 {
-    if (sorted_items.empty())
+    auto *victim = GetVictim();
+    if (victim == nullptr)
         return;
 
-    CacheItem &item = sorted_items.front();
+    CacheItem &item = const_cast<CacheItem &>(*victim);
+
+    if (evict_handler && item.Validate(SteadyNow()))
+        evict_handler(item);
+
+    ++counters.evictions;
     RemoveItem(item);
 }
 
+bool
+Cache::WouldAdmit(const char *key, size_t _size) const noexcept
+{
+    if (!sketch || size + _size <= max_size)
+        /* no admission policy, or no eviction necessary */
+        return true;
+
+    const auto *victim = GetVictim();
+    if (victim == nullptr)
+        return true;
+
+    /* TinyLFU: admit the new item only if its key is more popular
+       than the one it would replace */
+    return sketch->Estimate(CacheItem::KeyHasher(key)) >
+        sketch->Estimate(CacheItem::KeyHasher(victim->key));
+}
+
+bool
+Cache::Admit(const char *key, size_t _size) noexcept
+{
+    if (WouldAdmit(key, _size))
+        return true;
+
+    ++counters.rejections;
+    return false;
+}
+
 bool
 Cache::NeedRoom(size_t _size) noexcept
 {
@@ -216,8 +341,46 @@ Cache::NeedRoom(size_t _size) noexcept
     }
 }
 
+bool
+Cache::Grow(CacheItem &item, size_t delta) noexcept
+{
+    assert(!item.removed);
+
+    if (item.size + delta > max_size)
+        return false;
+
+    /* lock the item so NeedRoom() cannot destroy it while evicting
+       other items */
+    item.Lock();
+
+    const bool success = NeedRoom(delta) && !item.removed;
+    if (success) {
+        item.size += delta;
+        size += delta;
+
+        if (item.in_protected) {
+            protected_size += delta;
+            TrimProtected();
+        }
+    }
+
+    item.Unlock();
+    return success;
+}
+
 bool
 Cache::Add(const char *key, CacheItem &item) noexcept
+{
+    if (!Admit(key, item.size)) {
+        item.Destroy();
+        return false;
+    }
+
+    return DoAdd(key, item);
+}
+
+bool
+Cache::DoAdd(const char *key, CacheItem &item) noexcept
 {
     /* XXX size constraints */
     if (!NeedRoom(item.size)) {
@@ -231,6 +394,7 @@ Cache::Add(const char *key, CacheItem &item) noexcept
 
     size += item.size;
     item.last_accessed = SteadyNow();
+    ++counters.admissions;
 
     cleanup_timer.Enable();
     return true;
@@ -245,6 +409,14 @@ Cache::Put(const char *key, CacheItem &item) noexcept
     assert(item.lock == 0);
     assert(!item.removed);
 
+    /* replacing an existing item is always allowed */
+    if (items.find(key, CacheItem::KeyHasher,
+                   CacheItem::KeyValueEqual) == items.end() &&
+        !Admit(key, item.size)) {
+        item.Destroy();
+        return false;
+    }
+
     if (!NeedRoom(item.size)) {
         item.Destroy();
         return false;
@@ -259,6 +431,7 @@ Cache::Put(const char *key, CacheItem &item) noexcept
 
     size += item.size;
     item.last_accessed = SteadyNow();
+    ++counters.admissions;
 
     items.insert(item);
     sorted_items.push_back(item);
@@ -271,16 +444,21 @@ bool
 Cache::PutMatch(const char *key, CacheItem &item,
                 bool (*match)(const CacheItem *, void *), void *ctx) noexcept
 {
-    auto *old = GetMatch(key, match, ctx);
+    auto *old = LookupMatch(key, match, ctx);
 
     assert(item.size > 0);
     assert(item.lock == 0);
     assert(!item.removed);
 
     if (old != nullptr)
+        /* replacing an existing item is always allowed */
         RemoveItem(*old);
+    else if (!Admit(key, item.size)) {
+        item.Destroy();
+        return false;
+    }
 
-    return Add(key, item);
+    return DoAdd(key, item);
 }
 
 void
@@ -326,21 +504,64 @@ Cache::RemoveAllMatch(bool (*match)(const CacheItem *, void *),
 {
     unsigned removed = 0;
 
-    for (auto i = sorted_items.begin(), end = sorted_items.end();
-         i != end;) {
-        CacheItem &item = *i++;
+    for (auto *list : {&sorted_items, &protected_items}) {
+        for (auto i = list->begin(), end = list->end(); i != end;) {
+            CacheItem &item = *i++;
 
-        if (!match(&item, ctx))
-            continue;
+            if (!match(&item, ctx))
+                continue;
 
-        items.erase(items.iterator_to(item));
-        ItemRemoved(&item);
-        ++removed;
+            items.erase(items.iterator_to(item));
+            ItemRemoved(&item);
+            ++removed;
+        }
     }
 
     return removed;
 }
 
+inline void
+Cache::SkipSweepCursor(CacheItem &item) noexcept
+{
+    if (&item != sweep_cursor)
+        return;
+
+    auto &list = GetList(item);
+    auto i = std::next(list.iterator_to(item));
+    if (i != list.end())
+        sweep_cursor = &*i;
+    else if (&list == &sorted_items && !protected_items.empty())
+        /* continue with the protected segment */
+        sweep_cursor = &protected_items.front();
+    else
+        sweep_cursor = nullptr;
+}
+
+void
+Cache::StartSweep() noexcept
+{
+    sweep_cursor = const_cast<CacheItem *>(GetVictim());
+}
+
+bool
+Cache::SweepStep(unsigned max_items,
+                 bool (*match)(const CacheItem *, void *), void *ctx,
+                 unsigned &n_removed_r) noexcept
+{
+    for (; sweep_cursor != nullptr && max_items > 0; --max_items) {
+        CacheItem &item = *sweep_cursor;
+
+        if (match(&item, ctx)) {
+            /* this moves the cursor to the next item */
+            RemoveItem(item);
+            ++n_removed_r;
+        } else
+            SkipSweepCursor(item);
+    }
+
+    return sweep_cursor == nullptr;
+}
+
 static std::chrono::steady_clock::time_point
 ToSteady(std::chrono::steady_clock::time_point steady_now,
          std::chrono::system_clock::time_point system_now,
@@ -381,14 +602,16 @@ Cache::ExpireCallback() noexcept
 {
     const auto now = SteadyNow();
 
-    for (auto i = sorted_items.begin(), end = sorted_items.end(); i != end;) {
-        CacheItem &item = *i++;
+    for (auto *list : {&sorted_items, &protected_items}) {
+        for (auto i = list->begin(), end = list->end(); i != end;) {
+            CacheItem &item = *i++;
 
-        if (item.expires > now)
-            /* not yet expired */
-            continue;
+            if (item.expires > now)
+                /* not yet expired */
+                continue;
 
-        RemoveItem(item);
+            RemoveItem(item);
+        }
     }
 
     return size > 0;
@@ -33,8 +33,10 @@
 #ifndef BENG_PROXY_CACHE_HXX
 #define BENG_PROXY_CACHE_HXX
 
+#include "CachePolicy.hxx"
 #include "event/CleanupTimer.hxx"
 
+#include "util/BindMethod.hxx"
 #include "util/Compiler.h"
 
 #include <boost/intrusive/list.hpp>
@@ -44,8 +46,34 @@
 #include <memory>
 
 #include <stddef.h>
+#include <stdint.h>
 
 class EventLoop;
+class FrequencySketch;
+
+/**
+ * Statistics about the effectiveness of a #Cache.
+ */
+struct CacheCounters {
+    uint64_t hits = 0, misses = 0;
+
+    /**
+     * The number of new items which were added to the cache.
+     */
+    uint64_t admissions = 0;
+
+    /**
+     * The number of new items which were refused by the admission
+     * policy.
+     */
+    uint64_t rejections = 0;
+
+    /**
+     * The number of items which were evicted to make room for new
+     * ones.
+     */
+    uint64_t evictions = 0;
+};
 
 class CacheItem {
     friend class Cache;
@@ -56,7 +84,9 @@ class CacheItem {
     using SetHook = boost::intrusive::unordered_set_member_hook<LinkMode>;
 
     /**
-     * This item's siblings, sorted by #last_accessed.
+     * This item's siblings, sorted by #last_accessed.  This is an
+     * element of either Cache::sorted_items or
+     * Cache::protected_items, depending on #in_protected.
      */
     SiblingsHook sorted_siblings;
 
@@ -69,7 +99,7 @@ class CacheItem {
 
     const std::chrono::steady_clock::time_point expires;
 
-    const size_t size;
+    size_t size;
 
     std::chrono::steady_clock::time_point last_accessed{};
 
@@ -85,6 +115,11 @@ class CacheItem {
      */
     bool removed = false;
 
+    /**
+     * Is this item in the protected segment (see CachePolicy::SLRU)?
+     */
+    bool in_protected = false;
+
 public:
     CacheItem(std::chrono::steady_clock::time_point _expires,
               size_t _size) noexcept
@@ -162,6 +197,8 @@ class Cache {
     const size_t max_size;
     size_t size = 0;
 
+    const CachePolicy policy;
+
     using ItemSet =
         boost::intrusive::unordered_multiset<CacheItem,
                                              boost::intrusive::member_hook<CacheItem,
@@ -175,21 +212,60 @@ class Cache {
 
     ItemSet items;
 
+    using ItemList =
+        boost::intrusive::list<CacheItem,
+                               boost::intrusive::member_hook<CacheItem,
+                                                             CacheItem::SiblingsHook,
+                                                             &CacheItem::sorted_siblings>,
+                               boost::intrusive::constant_time_size<false>>;
+
+    /**
+     * A linked list of cache items, sorted by last_accessed, oldest
+     * first.  With CachePolicy::LRU, this contains all items; else
+     * this is the "probation" segment which contains all items which
+     * have not been hit yet.
+     */
+    ItemList sorted_items;
+
+    /**
+     * The "protected" segment (see CachePolicy::SLRU), sorted by
+     * last_accessed, oldest first.  Always empty with
+     * CachePolicy::LRU.
+     */
+    ItemList protected_items;
+
     /**
-     * A linked list of all cache items, sorted by last_accessed,
-     * oldest first.
+     * The total size of all items in #protected_items.
      */
-    boost::intrusive::list<CacheItem,
-                           boost::intrusive::member_hook<CacheItem,
-                                                         CacheItem::SiblingsHook,
-                                                         &CacheItem::sorted_siblings>,
-                           boost::intrusive::constant_time_size<false>> sorted_items;
+    size_t protected_size = 0;
+
+    /**
+     * The access frequency of recently requested keys; only used by
+     * CachePolicy::TINY_LFU.
+     */
+    std::unique_ptr<FrequencySketch> sketch;
+
+    CacheCounters counters;
 
     CleanupTimer cleanup_timer;
 
+    /**
+     * An optional callback which gets invoked before a valid item
+     * gets evicted to make room for a new one.  It is not invoked for
+     * items which have expired or which are removed explicitly.
+     */
+    BoundMethod<void(CacheItem &item) noexcept> evict_handler = nullptr;
+
+    /**
+     * The next item to be visited by SweepStep().  nullptr if no
+     * traversal is in progress.
+     */
+    CacheItem *sweep_cursor = nullptr;
+
 public:
     Cache(EventLoop &event_loop,
-          unsigned hashtable_capacity, size_t _max_size) noexcept;
+          unsigned hashtable_capacity, size_t _max_size,
+          CachePolicy _policy=CachePolicy::LRU) noexcept;
 
     ~Cache() noexcept;
 
@@ -206,6 +282,23 @@ public:
     void EventAdd() noexcept;
     void EventDel() noexcept;
 
+    void SetEvictHandler(BoundMethod<void(CacheItem &item) noexcept> _handler)
+        noexcept {
+        evict_handler = _handler;
+    }
+
+    const CacheCounters &GetCounters() const noexcept {
+        return counters;
+    }
+
+    /**
+     * Ask the admission policy whether a new item with the given key
+     * and size shall be added right now.  This can be used to avoid
+     * allocating a new item which would be rejected anyway.  A
+     * refusal is counted in CacheCounters::rejections.
+     */
+    bool Admit(const char *key, size_t _size) noexcept;
+
     gcc_pure
     CacheItem *Get(const char *key) noexcept;
 
@@ -222,6 +315,22 @@ public:
                         bool (*match)(const CacheItem *, void *),
                         void *ctx) noexcept;
 
+    /**
+     * Like GetMatch(), but doesn't count as an access.
+     */
+    CacheItem *LookupMatch(const char *key,
+                           bool (*match)(const CacheItem *, void *),
+                           void *ctx) noexcept;
+
+    /**
+     * Account for additional memory which was attached to an
+     * existing item, evicting other items to make room for it.
+     *
+     * @return false if there is not enough room; the item size is
+     * unmodified then (and the item may have been evicted, too)
+     */
+    bool Grow(CacheItem &item, size_t delta) noexcept;
+
     /**
      * Add an item to this cache.  Item with the same key are preserved.
      *
@@ -268,12 +377,66 @@ public:
 
     void Flush() noexcept;
 
+    /**
+     * Begin an incremental traversal of all items, to be continued
+     * with SweepStep().  A traversal which is already in progress
+     * is restarted.
+     */
+    void StartSweep() noexcept;
+
+    /**
+     * Continue the traversal started by StartSweep(), and remove all
+     * visited items which match.  Items which are added during the
+     * traversal will be visited as well.
+     *
+     * @param max_items the maximum number of items to be visited
+     * @param n_removed_r incremented by the number of items which
+     * were removed
+     * @return true if the traversal is complete
+     */
+    bool SweepStep(unsigned max_items,
+                   bool (*match)(const CacheItem *, void *), void *ctx,
+                   unsigned &n_removed_r) noexcept;
+
 private:
     /** clean up expired cache items every 60 seconds */
     bool ExpireCallback() noexcept;
 
     void ItemRemoved(CacheItem *item) noexcept;
 
+    ItemList &GetList(CacheItem &item) noexcept {
+        return item.in_protected ? protected_items : sorted_items;
+    }
+
+    /**
+     * Returns the item which will be evicted next, or nullptr if the
+     * cache is empty.
+     */
+    gcc_pure
+    const CacheItem *GetVictim() const noexcept;
+
+    /**
+     * Move items from the protected segment back to the probation
+     * segment until it fits into its size limit.
+     */
+    void TrimProtected() noexcept;
+
+    void RecordAccess(const char *key, bool hit) noexcept;
+
+    gcc_pure
+    bool WouldAdmit(const char *key, size_t _size) const noexcept;
+
+    /**
+     * Add the item without consulting the admission policy.
+     */
+    bool DoAdd(const char *key, CacheItem &item) noexcept;
+
+    /**
+     * Move #sweep_cursor away from the given item because it is
+     * going to be removed from (or moved inside) #sorted_items.
+     */
+    void SkipSweepCursor(CacheItem &item) noexcept;
+
     class ItemRemover {
         Cache &cache;
 
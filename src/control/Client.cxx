@@ -358,6 +358,12 @@ Stats(const char *server, ConstBuffer<const char *> args)
     PrintStatsAttribute("io_buffers_brutto_size", stats.io_buffers_brutto_size);
     PrintStatsAttribute("http_traffic_received", stats.http_traffic_received);
     PrintStatsAttribute("http_traffic_sent", stats.http_traffic_sent);
+    PrintStatsAttribute("http_cache_hits", stats.http_cache_hits);
+    PrintStatsAttribute("http_cache_misses", stats.http_cache_misses);
+    PrintStatsAttribute("http_cache_evictions", stats.http_cache_evictions);
+    PrintStatsAttribute("http_cache_fragmentation", stats.http_cache_fragmentation);
+    PrintStatsAttribute("filter_cache_fragmentation", stats.filter_cache_fragmentation);
+    PrintStatsAttribute("nfs_cache_fragmentation", stats.nfs_cache_fragmentation);
 }
 
 static void
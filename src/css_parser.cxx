@@ -32,6 +32,7 @@
 
 #include "css_parser.hxx"
 #include "css_syntax.hxx"
+#include "CharScan.hxx"
 #include "pool/pool.hxx"
 #include "istream/Sink.hxx"
 #include "istream/UnusedPtr.hxx"
@@ -58,6 +59,20 @@ class CssParser final : PoolHolder, IstreamSink, DestructAnchor {
             this->the_size += n;
         }
 
+        /**
+         * Like AppendTruncated(), but leave room for a null
+         * terminator.
+         */
+        void AppendTruncatedZ(StringView p) {
+            const size_t space = GetRemainingSpace();
+            if (space <= 1)
+                return;
+
+            size_t n = std::min(p.size, space - 1);
+            std::copy_n(p.data, n, end());
+            this->the_size += n;
+        }
+
         constexpr operator StringView() const {
             return {raw(), size()};
         }
@@ -172,6 +187,11 @@ CssParser::Feed(const char *start, size_t length) noexcept
         switch (state) {
         case State::NONE:
             do {
+                /* skip quickly to the next interesting character */
+                buffer = FindAnyOf(buffer, end, "{.#@");
+                if (buffer == end)
+                    break;
+
                 switch (*buffer) {
                 case '{':
                     /* start of block */
@@ -230,10 +250,9 @@ CssParser::Feed(const char *start, size_t length) noexcept
                     break;
                 }
 
-                if (name_buffer.size() < name_buffer.capacity() - 1)
-                    name_buffer.push_back(*buffer);
-
-                ++buffer;
+                p = FindNonCssNameChar(buffer + 1, end);
+                name_buffer.AppendTruncatedZ({buffer, p});
+                buffer = p;
             } while (buffer < end);
 
             break;
@@ -255,16 +274,23 @@ CssParser::Feed(const char *start, size_t length) noexcept
                     break;
                 }
 
-                if (name_buffer.size() < name_buffer.capacity() - 1)
-                    name_buffer.push_back(*buffer);
-
-                ++buffer;
+                p = FindNonCssNameChar(buffer + 1, end);
+                name_buffer.AppendTruncatedZ({buffer, p});
+                buffer = p;
             } while (buffer < end);
 
             break;
 
         case State::BLOCK:
             do {
+                if (handler.property_keyword == nullptr) {
+                    /* no identifiers to look for; skip quickly to
+                       the next interesting character */
+                    buffer = FindAnyOf(buffer, end, "}:'\"");
+                    if (buffer == end)
+                        break;
+                }
+
                 switch (*buffer) {
                 case '}':
                     /* end of block */
@@ -313,17 +339,12 @@ CssParser::Feed(const char *start, size_t length) noexcept
             break;
 
         case State::PROPERTY:
-            while (buffer < end) {
-                if (!is_css_ident_char(*buffer)) {
-                    state = State::POST_PROPERTY;
-                    break;
-                }
-
-                if (name_buffer.size() < name_buffer.capacity() - 1)
-                    name_buffer.push_back(*buffer);
+            p = FindNonCssNameChar(buffer, end);
+            name_buffer.AppendTruncatedZ({buffer, p});
+            buffer = p;
 
-                ++buffer;
-            }
+            if (buffer < end)
+                state = State::POST_PROPERTY;
 
             break;
 
@@ -382,6 +403,15 @@ CssParser::Feed(const char *start, size_t length) noexcept
 
         case State::VALUE:
             do {
+                /* copy everything up to the next interesting
+                   character; '(' is interesting because it may
+                   complete a "url(" */
+                p = FindAnyOf(buffer, end, "};'\"(");
+                value_buffer.AppendTruncatedZ({buffer, p});
+                buffer = p;
+                if (buffer == end)
+                    break;
+
                 switch (*buffer) {
                 case '}':
                     /* end of block */
@@ -497,10 +527,9 @@ CssParser::Feed(const char *start, size_t length) noexcept
                     break;
                 }
 
-                if (name_buffer.size() < name_buffer.capacity() - 1)
-                    name_buffer.push_back(*buffer);
-
-                ++buffer;
+                p = FindNonCssNameChar(buffer + 1, end);
+                name_buffer.AppendTruncatedZ({buffer, p});
+                buffer = p;
             } while (buffer < end);
 
             break;
@@ -47,6 +47,7 @@
 #include "istream_unlock.hxx"
 #include "istream_rubber.hxx"
 #include "rubber.hxx"
+#include "RubberCompressor.hxx"
 #include "SlicePool.hxx"
 #include "sink_rubber.hxx"
 #include "AllocatorStats.hxx"
@@ -240,6 +241,7 @@ class FilterCache final : LeakDetector {
     PoolPtr pool;
     SlicePool slice_pool;
     Rubber rubber;
+    RubberCompressor rubber_compressor;
     Cache cache;
 
     using PerTagHook =
@@ -271,7 +273,7 @@ class FilterCache final : LeakDetector {
                            boost::intrusive::constant_time_size<false>> requests;
 
 public:
-    FilterCache(struct pool &_pool, size_t max_size,
+    FilterCache(struct pool &_pool, size_t max_size, CachePolicy policy,
                 EventLoop &_event_loop, ResourceLoader &_resource_loader);
 
     ~FilterCache() noexcept;
@@ -289,6 +291,17 @@ public:
         return slice_pool.GetStats() + rubber.GetStats();
     }
 
+    double GetFragmentation() const noexcept {
+        return rubber.GetFragmentation();
+    }
+
+    /**
+     * @see Cache::Admit()
+     */
+    bool Admit(const char *key, off_t size) noexcept {
+        return cache.Admit(key, size > 0 ? size_t(size) : 1);
+    }
+
     void Flush() noexcept {
         cache.Flush();
         Compress();
@@ -332,7 +345,9 @@ private:
     }
 
     void OnCompressTimer() noexcept {
-        Compress();
+        /* the Rubber allocator is compressed incrementally by
+           #rubber_compressor */
+        slice_pool.Compress();
         compress_timer.Schedule(fcache_compress_interval);
     }
 };
@@ -555,6 +570,16 @@ FilterCacheRequest::OnHttpResponse(http_status_t status, StringMap &&headers,
         return;
     }
 
+    if (!cache.Admit(info.key, available)) {
+        /* the admission policy predicts that this response won't be
+           requested again soon; don't waste Rubber memory on it */
+        LogConcat(4, "FilterCache", "reject ", info.key);
+
+        handler.InvokeResponse(status, std::move(headers), std::move(body));
+        Destroy();
+        return;
+    }
+
     /* copy the HttpResponseHandler reference to the stack, because
        the sink_rubber_new() call may destroy this object */
     auto &_handler = handler;
@@ -615,28 +640,30 @@ FilterCacheRequest::OnHttpError(std::exception_ptr ep) noexcept
  */
 
 FilterCache::FilterCache(struct pool &_pool, size_t max_size,
+                         CachePolicy policy,
                          EventLoop &_event_loop,
                          ResourceLoader &_resource_loader)
     :pool(pool_new_libc(&_pool, "filter_cache")),
      slice_pool(1024, 65536),
      rubber(max_size),
+     rubber_compressor(_event_loop, rubber),
      /* leave 12.5% of the rubber allocator empty, to increase the
         chances that a hole can be found for a new allocation, to
         reduce the pressure that rubber_compress() creates */
-     cache(_event_loop, 65521, max_size * 7 / 8),
+     cache(_event_loop, 65521, max_size * 7 / 8, policy),
      compress_timer(_event_loop, BIND_THIS_METHOD(OnCompressTimer)),
      resource_loader(_resource_loader) {
     compress_timer.Schedule(fcache_compress_interval);
 }
 
 FilterCache *
-filter_cache_new(struct pool *pool, size_t max_size,
+filter_cache_new(struct pool *pool, size_t max_size, CachePolicy policy,
                  EventLoop &event_loop,
                  ResourceLoader &resource_loader)
 {
     assert(max_size > 0);
 
-    return new FilterCache(*pool, max_size,
+    return new FilterCache(*pool, max_size, policy,
                            event_loop, resource_loader);
 }
 
@@ -663,6 +690,12 @@ filter_cache_get_stats(const FilterCache &cache) noexcept
     return cache.GetStats();
 }
 
+double
+filter_cache_get_fragmentation(const FilterCache &cache) noexcept
+{
+    return cache.GetFragmentation();
+}
+
 void
 filter_cache_flush(FilterCache &cache) noexcept
 {
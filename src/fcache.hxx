@@ -33,6 +33,7 @@
 #ifndef BENG_FILTER_CACHE_HXX
 #define BENG_FILTER_CACHE_HXX
 
+#include "CachePolicy.hxx"
 #include "http/Status.h"
 #include "util/Compiler.h"
 
@@ -49,9 +50,11 @@ class CancellablePointer;
 
 /**
  * Caching filter responses.
+ *
+ * @param policy the eviction/admission policy
  */
 FilterCache *
-filter_cache_new(struct pool *pool, size_t max_size,
+filter_cache_new(struct pool *pool, size_t max_size, CachePolicy policy,
                  EventLoop &event_loop,
                  ResourceLoader &resource_loader);
 
@@ -65,6 +68,13 @@ gcc_pure
 AllocatorStats
 filter_cache_get_stats(const FilterCache &cache) noexcept;
 
+/**
+ * @see Rubber::GetFragmentation()
+ */
+gcc_pure
+double
+filter_cache_get_fragmentation(const FilterCache &cache) noexcept;
+
 void
 filter_cache_flush(FilterCache &cache) noexcept;
 
@@ -64,6 +64,9 @@ FilteredSocket::OnBufferedRemaining(size_t remaining) noexcept
 bool
 FilteredSocket::OnBufferedWrite()
 {
+    if (filter->IsOutputOffloaded())
+        return handler->OnBufferedWrite();
+
     return filter->InternalWrite();
 }
 
@@ -226,7 +229,7 @@ FilteredSocket::Read(bool expect_more) noexcept
 ssize_t
 FilteredSocket::Write(const void *data, size_t length) noexcept
 {
-    return filter != nullptr
+    return HasFilteredOutput()
         ? filter->Write(data, length)
         : base.Write(data, length);
 }
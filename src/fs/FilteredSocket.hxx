@@ -91,6 +91,16 @@ struct FilteredSocket final : private BufferedSocketHandler {
         return filter != nullptr;
     }
 
+    /**
+     * Does output pass through the filter?  If not (either because
+     * there is no filter or because the filter has offloaded its
+     * output to the kernel), then WriteV() and WriteFrom() may be
+     * used.
+     */
+    bool HasFilteredOutput() const noexcept {
+        return filter != nullptr && !filter->IsOutputOffloaded();
+    }
+
     FdType GetType() const noexcept {
         return filter == nullptr
             ? base.GetType()
@@ -98,6 +108,16 @@ struct FilteredSocket final : private BufferedSocketHandler {
             : FdType::FD_NONE;
     }
 
+    /**
+     * Like GetType(), but for writing to the socket with
+     * WriteFrom().
+     */
+    FdType GetWriteType() const noexcept {
+        return HasFilteredOutput()
+            ? FdType::FD_NONE
+            : base.GetType();
+    }
+
     /**
      * Install a callback that will be invoked as soon as the filter's
      * protocol "handshake" is complete.  Before this time, no data
@@ -255,20 +275,20 @@ struct FilteredSocket final : private BufferedSocketHandler {
     ssize_t Write(const void *data, size_t length) noexcept;
 
     ssize_t WriteV(const struct iovec *v, size_t n) noexcept {
-        assert(filter == nullptr);
+        assert(!HasFilteredOutput());
 
         return base.WriteV(v, n);
     }
 
     ssize_t WriteFrom(int fd, FdType fd_type, size_t length) noexcept {
-        assert(filter == nullptr);
+        assert(!HasFilteredOutput());
 
         return base.WriteFrom(fd, fd_type, length);
     }
 
     gcc_pure
     bool IsReadyForWriting() const noexcept {
-        assert(filter == nullptr);
+        assert(!HasFilteredOutput());
 
         return base.IsReadyForWriting();
     }
@@ -293,14 +313,14 @@ struct FilteredSocket final : private BufferedSocketHandler {
     }
 
     void ScheduleWrite() noexcept {
-        if (filter != nullptr)
+        if (HasFilteredOutput())
             filter->ScheduleWrite();
         else
             base.ScheduleWrite();
     }
 
     void UnscheduleWrite() noexcept {
-        if (filter != nullptr)
+        if (HasFilteredOutput())
             filter->UnscheduleWrite();
         else
             base.UnscheduleWrite();
@@ -352,6 +372,12 @@ struct FilteredSocket final : private BufferedSocketHandler {
         return base.Read(expect_more);
     }
 
+    SocketDescriptor InternalGetSocket() const noexcept {
+        assert(filter != nullptr);
+
+        return base.GetSocket();
+    }
+
     ssize_t InternalDirectWrite(const void *data, size_t length) noexcept {
         assert(filter != nullptr);
 
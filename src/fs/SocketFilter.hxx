@@ -84,6 +84,16 @@ public:
      */
     virtual ssize_t Write(const void *data, size_t length) noexcept = 0;
 
+    /**
+     * Has the kernel taken over filtering the output (e.g. kTLS),
+     * and has all output which was filtered in user space been
+     * written already?  From then on, #FilteredSocket writes directly
+     * to the socket, bypassing this object, which allows splice().
+     */
+    virtual bool IsOutputOffloaded() const noexcept {
+        return false;
+    }
+
     /**
      * The client is willing to read, but does not expect it yet.  The
      * filter processes the call, and may then call
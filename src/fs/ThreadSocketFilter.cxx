@@ -48,6 +48,7 @@ ThreadSocketFilter::ThreadSocketFilter(EventLoop &_event_loop,
     :queue(_queue),
      handler(_handler),
      defer_event(_event_loop, BIND_THIS_METHOD(OnDeferred)),
+     inline_event(_event_loop, BIND_THIS_METHOD(OnInline)),
      handshake_timeout_event(_event_loop,
                              BIND_THIS_METHOD(HandshakeTimeoutCallback))
 {
@@ -59,6 +60,7 @@ ThreadSocketFilter::~ThreadSocketFilter() noexcept
     delete handler;
 
     defer_event.Cancel();
+    inline_event.Cancel();
     handshake_timeout_event.Cancel();
 
     unprotected_decrypted_input.FreeIfDefined();
@@ -75,11 +77,49 @@ ThreadSocketFilter::Schedule() noexcept
 {
     assert(!postponed_destroy);
 
+    if (inline_pending)
+        /* OnInline() will decide */
+        return;
+
+    if (IsIdle() && CanRunInline()) {
+        inline_pending = true;
+        inline_event.Schedule();
+        return;
+    }
+
     PreRun();
 
     thread_queue_add(queue, *this);
 }
 
+bool
+ThreadSocketFilter::CanRunInline() const noexcept
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return !handshaking && !offload_output_pending &&
+        encrypted_input.GetAvailable() + plain_output.GetAvailable() <= INLINE_THRESHOLD;
+}
+
+void
+ThreadSocketFilter::OnInline() noexcept
+{
+    assert(inline_pending);
+    assert(IsIdle());
+
+    inline_pending = false;
+
+    if (!CanRunInline()) {
+        /* more data has arrived in the meantime; let a worker
+           thread handle it */
+        Schedule();
+        return;
+    }
+
+    PreRun();
+    Run();
+    Done();
+}
+
 void
 ThreadSocketFilter::SetHandshakeCallback(BoundMethod<void() noexcept> callback) noexcept
 {
@@ -188,6 +228,39 @@ ThreadSocketFilter::CheckWrite(std::unique_lock<std::mutex> &lock) noexcept
     return true;
 }
 
+bool
+ThreadSocketFilter::CheckOffloadOutput() noexcept
+{
+    if (offload_output_pending) {
+        if (!encrypted_output.empty())
+            /* wait until InternalWrite() has flushed it */
+            return false;
+
+        offload_output_pending = false;
+        output_offloaded =
+            handler->OffloadOutput(socket->InternalGetSocket());
+        if (!output_offloaded)
+            return true;
+    }
+
+    if (output_offloaded && !direct_output) {
+        if (!plain_output.empty()) {
+            /* the kernel filters it now */
+            encrypted_output.MoveFromAllowBothNull(plain_output);
+            socket->InternalScheduleWrite();
+        } else if (encrypted_output.empty()) {
+            direct_output = true;
+
+            if (want_write)
+                /* let CheckWrite() invoke the handler, which will
+                   then write directly to the socket */
+                defer_event.Schedule();
+        }
+    }
+
+    return false;
+}
+
 void
 ThreadSocketFilter::OnDeferred() noexcept
 {
@@ -387,6 +460,9 @@ ThreadSocketFilter::Done() noexcept
     if (connected) {
         // TODO: timeouts?
 
+        if (CheckOffloadOutput())
+            again = true;
+
         if (!handshaking && handshake_callback) {
             auto callback = handshake_callback;
             handshake_callback = nullptr;
@@ -604,9 +680,17 @@ ThreadSocketFilter::InternalWrite() noexcept
 
     auto r = encrypted_output.Read();
     if (r.empty()) {
-        lock.unlock();
-        socket->InternalUnscheduleWrite();
-        return true;
+        const bool schedule = CheckOffloadOutput();
+        r = encrypted_output.Read();
+        if (r.empty()) {
+            lock.unlock();
+
+            if (schedule)
+                Schedule();
+
+            socket->InternalUnscheduleWrite();
+            return true;
+        }
     }
 
     /* copy to stack, unlock */
@@ -620,11 +704,12 @@ ThreadSocketFilter::InternalWrite() noexcept
         const bool add = encrypted_output.IsFull();
         encrypted_output.Consume(nbytes);
         encrypted_output.FreeIfEmpty();
+        const bool schedule = CheckOffloadOutput();
         const bool empty = encrypted_output.empty();
         const bool _drained = empty && drained && plain_output.empty();
         lock.unlock();
 
-        if (add)
+        if (add || schedule)
             /* the filter job may be stalled because the output buffer
                was full; try again, now that it's not full anymore */
             Schedule();
@@ -749,6 +834,8 @@ void
 ThreadSocketFilter::Close() noexcept
 {
     defer_event.Cancel();
+    inline_event.Cancel();
+    inline_pending = false;
 
     if (!thread_queue_cancel(queue, *this)) {
         /* postpone the destruction */
@@ -37,6 +37,7 @@
 #include "event/DeferEvent.hxx"
 #include "event/TimerEvent.hxx"
 #include "SliceFifoBuffer.hxx"
+#include "net/SocketDescriptor.hxx"
 
 #include <mutex>
 
@@ -67,6 +68,20 @@ public:
      * finished successfully.
      */
     virtual void PostRun(ThreadSocketFilterInternal &) noexcept {}
+
+    /**
+     * Called in the main thread after Run() has set
+     * ThreadSocketFilterInternal::offload_output_pending and all
+     * output produced by the handler has been written to the socket.
+     * The handler shall configure the kernel to filter all further
+     * output written to the socket.
+     *
+     * @return false if that failed; the handler shall then continue
+     * to filter output in user space
+     */
+    virtual bool OffloadOutput(SocketDescriptor) noexcept {
+        return false;
+    }
 };
 
 struct ThreadSocketFilterInternal : ThreadJob {
@@ -108,6 +123,27 @@ struct ThreadSocketFilterInternal : ThreadJob {
      */
     bool handshaking = true;
 
+    /**
+     * Set by the #ThreadSocketFilterHandler when the kernel shall
+     * take over filtering the output (see
+     * ThreadSocketFilterHandler::OffloadOutput()) as soon as
+     * #encrypted_output has been written to the socket.  Until then,
+     * #plain_output is left alone.  The handler may clear it again
+     * to cancel the offload before it has happened.
+     *
+     * Protected by #mutex.
+     */
+    bool offload_output_pending = false;
+
+    /**
+     * True after ThreadSocketFilterHandler::OffloadOutput() has
+     * succeeded.  The handler does not touch #plain_output anymore;
+     * the main thread moves it to #encrypted_output unmodified.
+     *
+     * Protected by #mutex.
+     */
+    bool output_offloaded = false;
+
     mutable std::mutex mutex;
 
     /**
@@ -145,6 +181,14 @@ struct ThreadSocketFilterInternal : ThreadJob {
  * pool (see #thread_job).
  */
 class ThreadSocketFilter final : public SocketFilter, ThreadSocketFilterInternal {
+    /**
+     * If no more than this number of bytes is waiting to be filtered
+     * (after the handshake), the handler is run in the main thread
+     * instead of a worker thread; for small records, the round trip
+     * through the #ThreadQueue costs more than the filter itself.
+     */
+    static constexpr size_t INLINE_THRESHOLD = 4096;
+
     ThreadQueue &queue;
 
     FilteredSocket *socket;
@@ -164,6 +208,13 @@ class ThreadSocketFilter final : public SocketFilter, ThreadSocketFilterInternal
      */
     DeferEvent defer_event;
 
+    /**
+     * Runs the handler in the main thread; see #INLINE_THRESHOLD.
+     * Deferring this call collects all Schedule() calls of one event
+     * loop iteration into one Run() call.
+     */
+    DeferEvent inline_event;
+
     /**
      *
      */
@@ -171,6 +222,12 @@ class ThreadSocketFilter final : public SocketFilter, ThreadSocketFilterInternal
 
     bool busy = false, done_pending = false;
 
+    /**
+     * Has #inline_event been scheduled?  While this is set, the job
+     * is not added to the #ThreadQueue.
+     */
+    bool inline_pending = false;
+
     bool connected = true;
 
     /**
@@ -207,6 +264,14 @@ class ThreadSocketFilter final : public SocketFilter, ThreadSocketFilterInternal
      */
     bool want_write = false;
 
+    /**
+     * True when #output_offloaded is set and all buffered output has
+     * been written to the socket.  From now on, #FilteredSocket
+     * bypasses this object for writing.  This is only accessed by
+     * the main thread.
+     */
+    bool direct_output = false;
+
     /**
      * Data from ThreadSocketFilterInternal::decrypted_input gets
      * moved here to be submitted.  This buffer is not protected by
@@ -237,6 +302,17 @@ private:
      */
     void Schedule() noexcept;
 
+    /**
+     * Is the pending work small enough to be done in the main
+     * thread?  See #INLINE_THRESHOLD.
+     */
+    bool CanRunInline() const noexcept;
+
+    /**
+     * Callback for #inline_event.
+     */
+    void OnInline() noexcept;
+
     /**
      * @return true if ThreadSocketFilterInternal::decrypted_input was
      * full.
@@ -264,6 +340,17 @@ private:
     bool CheckRead(std::unique_lock<std::mutex> &lock) noexcept;
     bool CheckWrite(std::unique_lock<std::mutex> &lock) noexcept;
 
+    /**
+     * Hand output filtering over to the kernel if the handler has
+     * asked for it and #encrypted_output is empty, and move
+     * #plain_output to #encrypted_output after that.  Caller must
+     * hold the mutex.
+     *
+     * @return true if the handler has refused and needs to be
+     * scheduled to resume filtering #plain_output
+     */
+    bool CheckOffloadOutput() noexcept;
+
     void HandshakeTimeoutCallback() noexcept;
 
     /**
@@ -304,6 +391,11 @@ public:
     void Consumed(size_t nbytes) noexcept override;
     bool Read(bool expect_more) noexcept override;
     ssize_t Write(const void *data, size_t length) noexcept override;
+
+    bool IsOutputOffloaded() const noexcept override {
+        return direct_output;
+    }
+
     void ScheduleRead(bool expect_more,
                       Event::Duration timeout) noexcept override;
     void ScheduleWrite() noexcept override;
@@ -44,6 +44,67 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Find the first colon or newline character.
+ *
+ * @return the position or nullptr if there is none
+ */
+gcc_pure
+static const char *
+FindColonOrNewline(const char *p, const char *end) noexcept
+{
+#ifdef __SSE2__
+    /* header names are short, therefore 16 byte vectors are a good
+       fit; SSE2 is always available on x86_64, and there is no need
+       for runtime CPU feature detection */
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)p);
+        const unsigned mask =
+            _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, colon),
+                                           _mm_cmpeq_epi8(v, newline)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+
+        p += 16;
+    }
+#endif
+
+    for (; p < end; ++p)
+        if (*p == ':' || *p == '\n')
+            return p;
+
+    return nullptr;
+}
+
+/**
+ * Add a header to the map.
+ *
+ * @param colon the colon after the header name
+ * @param end the end of the line (without trailing whitespace)
+ */
+static void
+AddHeader(struct pool &pool, StringMap &headers,
+          const char *name, const char *colon, const char *end) noexcept
+{
+    assert(name < colon);
+    assert(colon < end);
+
+    const char *value = colon + 1;
+    if (gcc_likely(value < end && *value == ' '))
+        ++value;
+    value = StripLeft(value, end);
+
+    headers.Add(p_strdup_lower(pool, StringView(name, colon)),
+                p_strndup(&pool, value, end - value));
+}
+
 void
 header_parse_line(struct pool &pool, StringMap &headers,
                   StringView line) noexcept
@@ -52,17 +113,52 @@ header_parse_line(struct pool &pool, StringMap &headers,
     if (gcc_unlikely(colon == nullptr || colon == line.data))
         return;
 
-    const char *key_end = colon;
+    AddHeader(pool, headers, line.begin(), colon, line.end());
+}
+
+HeaderParserResult
+header_parse_lines(struct pool &pool, StringMap &headers,
+                   StringView src, size_t &consumed_r,
+                   size_t max_line_length) noexcept
+{
+    const char *p = src.begin();
+    const char *const end = src.end();
+
+    while (true) {
+        const char *colon = FindColonOrNewline(p, end);
+        if (colon == nullptr)
+            break;
+
+        const char *eol;
+        if (*colon == '\n') {
+            /* a line without a colon */
+            eol = colon;
+            colon = nullptr;
+        } else {
+            eol = (const char *)memchr(colon + 1, '\n', end - colon - 1);
+            if (eol == nullptr)
+                break;
+        }
 
-    ++colon;
-    if (gcc_likely(colon < line.end() && *colon == ' '))
-        ++colon;
-    colon = StripLeft(colon, line.end());
+        const char *const line_end = StripRight(p, eol);
+        if (gcc_unlikely(size_t(line_end - p) > max_line_length)) {
+            consumed_r = p - src.begin();
+            return HeaderParserResult::LINE_TOO_LONG;
+        }
 
-    char *key = p_strdup_lower(pool, StringView(line.begin(), key_end));
-    char *value = p_strndup(&pool, colon, line.end() - colon);
+        if (line_end == p) {
+            consumed_r = eol + 1 - src.begin();
+            return HeaderParserResult::END;
+        }
+
+        if (gcc_likely(colon != nullptr && colon != p))
+            AddHeader(pool, headers, p, colon, line_end);
+
+        p = eol + 1;
+    }
 
-    headers.Add(key, value);
+    consumed_r = p - src.begin();
+    return HeaderParserResult::MORE;
 }
 
 void
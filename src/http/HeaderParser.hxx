@@ -36,6 +36,10 @@
 
 #pragma once
 
+#include <cstdint>
+
+#include <stddef.h>
+
 struct pool;
 class StringMap;
 struct StringView;
@@ -45,6 +49,42 @@ void
 header_parse_line(struct pool &pool, StringMap &headers,
                   StringView line) noexcept;
 
+enum class HeaderParserResult {
+    /**
+     * All complete lines have been consumed, and more data is
+     * needed.
+     */
+    MORE,
+
+    /**
+     * The empty line which terminates the header block has been
+     * consumed.
+     */
+    END,
+
+    /**
+     * A line exceeds the given maximum length.
+     */
+    LINE_TOO_LONG,
+};
+
+/**
+ * Parse all complete header lines from the buffer into the map, up
+ * to and including the empty line which terminates the header block.
+ * Each line is scanned only once: the name ends at the first colon,
+ * and the search for the end of the line continues from there.
+ * Lines without a colon are ignored.
+ *
+ * @param consumed_r on return, the number of bytes which have been
+ * consumed
+ * @param max_line_length the maximum length of a line (not counting
+ * trailing whitespace)
+ */
+HeaderParserResult
+header_parse_lines(struct pool &pool, StringMap &headers,
+                   StringView src, size_t &consumed_r,
+                   size_t max_line_length=SIZE_MAX) noexcept;
+
 void
 header_parse_buffer(struct pool &pool, StringMap &headers,
                     GrowingBuffer &&gb) noexcept;
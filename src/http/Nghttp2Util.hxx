@@ -0,0 +1,76 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Helpers for code using libnghttp2.
+ */
+
+#pragma once
+
+#include "util/Compiler.h"
+
+#include <nghttp2/nghttp2.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <string.h>
+
+static inline std::runtime_error
+MakeNgHttp2Error(int error, const char *msg) noexcept
+{
+    return std::runtime_error(std::string(msg) + ": " +
+                              nghttp2_strerror(error));
+}
+
+/**
+ * Construct a #nghttp2_nv referring to the given strings, which must
+ * remain valid until nghttp2 has copied them.
+ */
+gcc_pure
+static inline nghttp2_nv
+MakeNv(const char *name, const char *value, size_t value_length) noexcept
+{
+    return {
+        (uint8_t *)const_cast<char *>(name),
+        (uint8_t *)const_cast<char *>(value),
+        strlen(name), value_length,
+        NGHTTP2_NV_FLAG_NONE,
+    };
+}
+
+gcc_pure
+static inline nghttp2_nv
+MakeNv(const char *name, const char *value) noexcept
+{
+    return MakeNv(name, value, strlen(value));
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http2_balancer.hxx"
+#include "http2_stock.hxx"
+#include "cluster/BalancerRequest.hxx"
+#include "stock/GetHandler.hxx"
+#include "event/Loop.hxx"
+
+class Http2BalancerRequest : public StockGetHandler {
+    Http2Stock &stock;
+
+    const bool ip_transparent;
+    const SocketAddress bind_address;
+
+    const Event::Duration timeout;
+
+    StockGetHandler &handler;
+    struct lease_ref &lease_ref;
+
+public:
+    Http2BalancerRequest(Http2Stock &_stock,
+                         bool _ip_transparent,
+                         SocketAddress _bind_address,
+                         Event::Duration _timeout,
+                         StockGetHandler &_handler,
+                         struct lease_ref &_lease_ref) noexcept
+        :stock(_stock),
+         ip_transparent(_ip_transparent),
+         bind_address(_bind_address),
+         timeout(_timeout),
+         handler(_handler), lease_ref(_lease_ref) {}
+
+    void Send(struct pool &pool, SocketAddress address,
+              CancellablePointer &cancel_ptr) noexcept;
+
+private:
+    /* virtual methods from class StockGetHandler */
+    void OnStockItemReady(StockItem &item) noexcept final;
+    void OnStockItemError(std::exception_ptr ep) noexcept override;
+};
+
+using BR = BalancerRequest<Http2BalancerRequest>;
+
+inline void
+Http2BalancerRequest::Send(struct pool &pool, SocketAddress address,
+                           CancellablePointer &cancel_ptr) noexcept
+{
+    stock.Get(pool,
+              nullptr,
+              ip_transparent, bind_address, address,
+              timeout,
+              *this, lease_ref,
+              cancel_ptr);
+}
+
+/*
+ * stock handler
+ *
+ */
+
+void
+Http2BalancerRequest::OnStockItemReady(StockItem &item) noexcept
+{
+    auto &base = BR::Cast(*this);
+    base.ConnectSuccess();
+
+    handler.OnStockItemReady(item);
+    base.Destroy();
+}
+
+void
+Http2BalancerRequest::OnStockItemError(std::exception_ptr ep) noexcept
+{
+    auto &base = BR::Cast(*this);
+    if (!base.ConnectFailure(stock.GetEventLoop().SteadyNow())) {
+        handler.OnStockItemError(ep);
+        base.Destroy();
+    }
+}
+
+/*
+ * public API
+ *
+ */
+
+EventLoop &
+Http2Balancer::GetEventLoop() noexcept
+{
+    return stock.GetEventLoop();
+}
+
+void
+Http2Balancer::Get(struct pool &pool,
+                   bool ip_transparent,
+                   SocketAddress bind_address,
+                   sticky_hash_t session_sticky,
+                   const AddressList &address_list,
+                   Event::Duration timeout,
+                   StockGetHandler &handler,
+                   struct lease_ref &lease_ref,
+                   CancellablePointer &cancel_ptr) noexcept
+{
+    BR::Start(pool, GetEventLoop().SteadyNow(), balancer,
+              address_list, cancel_ptr,
+              session_sticky,
+              stock,
+              ip_transparent,
+              bind_address, timeout,
+              handler, lease_ref);
+}
@@ -0,0 +1,1386 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * HTTP/2 client implementation on top of libnghttp2.
+ */
+
+#include "http2_client.hxx"
+#include "http_client.hxx"
+#include "HttpResponseHandler.hxx"
+#include "http/Headers.hxx"
+#include "http/HeaderName.hxx"
+#include "http/Nghttp2Util.hxx"
+#include "istream/istream.hxx"
+#include "istream/New.hxx"
+#include "istream/Handler.hxx"
+#include "istream/Pointer.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "fs/FilteredSocket.hxx"
+#include "uri/Verify.hxx"
+#include "strmap.hxx"
+#include "lease.hxx"
+#include "pool/pool.hxx"
+#include "GrowingBuffer.hxx"
+#include "event/DeferEvent.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DestructObserver.hxx"
+#include "util/StringView.hxx"
+#include "util/StringFormat.hxx"
+#include "util/RuntimeError.hxx"
+#include "util/Exception.hxx"
+#include "util/DecimalFormat.h"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr auto http2_client_timeout = std::chrono::seconds(30);
+
+/**
+ * The maximum number of request body bytes buffered per stream while
+ * waiting for the peer's flow control window.
+ */
+static constexpr size_t HTTP2_REQUEST_BUFFER = 32768;
+
+class Http2ClientStream;
+
+/**
+ * The response body of a HTTP/2 stream.  Incoming DATA frames are
+ * buffered, and the server's flow control window is only extended
+ * after our handler has consumed the data.
+ */
+class Http2ResponseBody final : public Istream {
+    Http2ClientStream &stream;
+
+    GrowingBuffer buffer;
+
+    DeferEvent defer_submit;
+
+    bool eof = false;
+
+public:
+    Http2ResponseBody(struct pool &p, EventLoop &event_loop,
+                      Http2ClientStream &_stream) noexcept
+        :Istream(p), stream(_stream),
+         defer_submit(event_loop, BIND_THIS_METHOD(Submit)) {}
+
+    ~Http2ResponseBody() noexcept {
+        defer_submit.Cancel();
+    }
+
+    void Feed(const void *data, size_t length) noexcept {
+        assert(!eof);
+
+        buffer.Write(data, length);
+        defer_submit.Schedule();
+    }
+
+    void SetEof() noexcept {
+        eof = true;
+        defer_submit.Schedule();
+    }
+
+    /**
+     * The stream or the connection has failed.  Unlike _Close(),
+     * this does not call back into the #Http2ClientStream.
+     */
+    void Abort(std::exception_ptr ep) noexcept {
+        DestroyError(ep);
+    }
+
+    /**
+     * Destroy this object before it has been passed to the
+     * #HttpResponseHandler.
+     */
+    void Discard() noexcept {
+        Destroy();
+    }
+
+private:
+    void Submit() noexcept;
+
+    /* virtual methods from class Istream */
+
+    off_t _GetAvailable(bool partial) noexcept override {
+        if (eof || partial)
+            return buffer.GetSize();
+
+        return -1;
+    }
+
+    void _Read() noexcept override {
+        Submit();
+    }
+
+    void _Close() noexcept override;
+};
+
+class Http2ClientStream final
+    : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+      Cancellable, IstreamHandler, DestructAnchor {
+
+    Http2ClientConnection &connection;
+
+    const PoolPtr pool;
+
+    struct lease_ref lease_ref;
+
+    HttpResponseHandler &handler;
+
+    int32_t id = -1;
+
+    enum class State {
+        /**
+         * Waiting for the response headers.
+         */
+        HEADERS,
+
+        /**
+         * The response headers have been received, and
+         * #defer_response will submit them to the
+         * #HttpResponseHandler.
+         */
+        RESPONSE,
+
+        /**
+         * The response has been submitted, and #response_body is
+         * being read by the #HttpResponseHandler.
+         */
+        BODY,
+    } state = State::HEADERS;
+
+    const bool head;
+
+    http_status_t status = http_status_t(0);
+
+    StringMap response_headers;
+
+    Http2ResponseBody *response_body = nullptr;
+
+    IstreamPointer request_body;
+
+    /**
+     * Request body data waiting for the server's flow control
+     * window.
+     */
+    GrowingBuffer request_buffer;
+
+    /**
+     * Submits the response to the #HttpResponseHandler outside of
+     * nghttp2 callbacks.
+     */
+    DeferEvent defer_response;
+
+    /**
+     * Reads more data from #request_body outside of nghttp2
+     * callbacks.
+     */
+    DeferEvent defer_read;
+
+    /**
+     * Handles the end of the stream outside of nghttp2 callbacks.
+     */
+    DeferEvent defer_close;
+
+    uint32_t close_error_code = NGHTTP2_NO_ERROR;
+
+    /**
+     * Has #request_body reported end-of-file?
+     */
+    bool request_eof = false;
+
+    /**
+     * Has the nghttp2 data provider returned NGHTTP2_ERR_DEFERRED?
+     */
+    bool request_deferred = false;
+
+    /**
+     * Has the server finished sending the response (END_STREAM)?
+     */
+    bool end_stream = false;
+
+    /**
+     * Has nghttp2 closed the stream?  No nghttp2 function may be
+     * called for it anymore.
+     */
+    bool closed = false;
+
+public:
+    Http2ClientStream(struct pool &caller_pool,
+                      Http2ClientConnection &_connection,
+                      Lease &_lease,
+                      http_method_t method,
+                      HttpResponseHandler &_handler,
+                      CancellablePointer &cancel_ptr) noexcept;
+
+    ~Http2ClientStream() noexcept;
+
+    /**
+     * Submit the request to nghttp2.
+     */
+    void Submit(http_method_t method, const char *uri,
+                HttpHeaders &&headers, UnusedIstreamPtr body) noexcept;
+
+    /**
+     * @return false if the stream shall be reset
+     */
+    bool OnHeader(StringView name, StringView value) noexcept;
+
+    /**
+     * @return false if the stream shall be reset
+     */
+    bool OnHeadersComplete(bool _end_stream) noexcept;
+
+    void OnResponseData(const uint8_t *data, size_t length) noexcept;
+    void OnEndStream() noexcept;
+    void OnStreamClose(uint32_t error_code) noexcept;
+
+    ssize_t ReadRequest(uint8_t *buf, size_t length,
+                        uint32_t &data_flags) noexcept;
+
+    /**
+     * The connection has failed.  Report the error to our handler
+     * and destroy this object.
+     */
+    void Abort(std::exception_ptr ep) noexcept;
+
+    /**
+     * Our handler has consumed data from #Http2ResponseBody.
+     */
+    void OnResponseBodyConsumed(size_t nbytes) noexcept;
+
+    void OnResponseBodyEof() noexcept;
+
+    /**
+     * Our handler has closed the #Http2ResponseBody.
+     *
+     * @param pending the number of bytes which were still buffered
+     */
+    void OnResponseBodyClosed(size_t pending) noexcept;
+
+private:
+    /**
+     * Release the lease and delete this object.  If nghttp2 has not
+     * yet closed the stream, it is reset.
+     */
+    void Destroy(bool reuse=true) noexcept;
+
+    void AbortResponse(std::exception_ptr ep) noexcept;
+
+    void AbortResponse(HttpClientErrorCode code, const char *msg) noexcept {
+        AbortResponse(std::make_exception_ptr(HttpClientError(code, msg)));
+    }
+
+    void ResetStream(uint32_t error_code) noexcept;
+
+    /**
+     * Tell nghttp2 that more request body data is available.
+     */
+    void ResumeRequest() noexcept;
+
+    void OnDeferredResponse() noexcept;
+    void OnDeferredRead() noexcept;
+    void OnDeferredClose() noexcept;
+
+    static ssize_t ReadCallback(nghttp2_session *session, int32_t stream_id,
+                                uint8_t *buf, size_t length,
+                                uint32_t *data_flags,
+                                nghttp2_data_source *source,
+                                void *user_data) noexcept;
+
+    /* virtual methods from class Cancellable */
+    void Cancel() noexcept override;
+
+    /* virtual methods from class IstreamHandler */
+    size_t OnData(const void *data, size_t length) noexcept override;
+    void OnEof() noexcept override;
+    void OnError(std::exception_ptr ep) noexcept override;
+};
+
+class Http2ClientConnection final : BufferedSocketHandler, DestructAnchor {
+    FilteredSocket &socket;
+
+    const char *const peer_name;
+
+    Http2ClientConnectionHandler &handler;
+
+    nghttp2_session *session;
+
+    /**
+     * Collect frames generated by nghttp2 and write them to the
+     * socket, but not inside a nghttp2 callback.
+     */
+    DeferEvent defer_send;
+
+    /**
+     * Frame data which was generated by nghttp2, but could not yet
+     * be written to the socket.
+     */
+    GrowingBuffer output;
+
+    typedef boost::intrusive::list<Http2ClientStream,
+                                   boost::intrusive::constant_time_size<false>> StreamList;
+
+    StreamList streams;
+
+    /**
+     * May new requests be sent?  This is cleared after GOAWAY was
+     * received and after a socket error.
+     */
+    bool usable = true;
+
+    /**
+     * Has the socket failed?  No more frames will be sent or
+     * received.
+     */
+    bool broken = false;
+
+public:
+    Http2ClientConnection(FilteredSocket &_socket, const char *_peer_name,
+                          Http2ClientConnectionHandler &_handler);
+    ~Http2ClientConnection() noexcept;
+
+    EventLoop &GetEventLoop() noexcept {
+        return defer_send.GetEventLoop();
+    }
+
+    nghttp2_session *GetSession() noexcept {
+        return session;
+    }
+
+    bool IsUsable() const noexcept {
+        return usable;
+    }
+
+    void ScheduleSend() noexcept {
+        if (!broken)
+            defer_send.Schedule();
+    }
+
+    void AddStream(Http2ClientStream &stream) noexcept;
+    void RemoveStream(Http2ClientStream &stream) noexcept;
+
+    std::exception_ptr PrefixError(std::exception_ptr ep) const noexcept {
+        return NestException(ep,
+                             FormatRuntimeError("error on HTTP/2 connection to '%s'",
+                                                peer_name));
+    }
+
+private:
+    /**
+     * Stop accepting new requests and notify the
+     * #Http2ClientConnectionHandler.
+     */
+    void Fade() noexcept;
+
+    /**
+     * The socket has failed: abort all streams.  This object may be
+     * destroyed by this method (indirectly by releasing stream
+     * leases).
+     */
+    void Abort(std::exception_ptr ep) noexcept;
+
+    void Abort(HttpClientErrorCode code, const char *msg) noexcept {
+        Abort(std::make_exception_ptr(HttpClientError(code, msg)));
+    }
+
+    /**
+     * Write pending frames to the socket.
+     *
+     * @return false if the connection has failed
+     */
+    bool Send() noexcept;
+
+    void OnDeferredSend() noexcept {
+        Send();
+    }
+
+    BufferedResult Feed() noexcept;
+
+    static int OnHeaderCallback(nghttp2_session *session,
+                                const nghttp2_frame *frame,
+                                const uint8_t *name, size_t namelen,
+                                const uint8_t *value, size_t valuelen,
+                                uint8_t flags, void *user_data) noexcept;
+
+    static int OnFrameRecvCallback(nghttp2_session *session,
+                                   const nghttp2_frame *frame,
+                                   void *user_data) noexcept;
+
+    static int OnDataChunkRecvCallback(nghttp2_session *session,
+                                       uint8_t flags, int32_t stream_id,
+                                       const uint8_t *data, size_t len,
+                                       void *user_data) noexcept;
+
+    static int OnStreamCloseCallback(nghttp2_session *session,
+                                     int32_t stream_id,
+                                     uint32_t error_code,
+                                     void *user_data) noexcept;
+
+    /* virtual methods from class BufferedSocketHandler */
+    BufferedResult OnBufferedData() override;
+    bool OnBufferedClosed() noexcept override;
+    bool OnBufferedWrite() override;
+    bool OnBufferedTimeout() noexcept override;
+    void OnBufferedError(std::exception_ptr e) noexcept override;
+};
+
+/*
+ * Http2ResponseBody
+ *
+ */
+
+void
+Http2ResponseBody::Submit() noexcept
+{
+    if (!HasHandler())
+        /* our handler has not yet started reading */
+        return;
+
+    while (true) {
+        auto r = buffer.Read();
+        if (r.empty())
+            break;
+
+        size_t nbytes = InvokeData(r.data, r.size);
+        if (nbytes == 0)
+            /* blocking or closed */
+            return;
+
+        buffer.Consume(nbytes);
+        stream.OnResponseBodyConsumed(nbytes);
+
+        if (nbytes < r.size)
+            return;
+    }
+
+    if (eof) {
+        stream.OnResponseBodyEof();
+        DestroyEof();
+    }
+}
+
+void
+Http2ResponseBody::_Close() noexcept
+{
+    stream.OnResponseBodyClosed(buffer.GetSize());
+    Destroy();
+}
+
+/*
+ * Http2ClientStream
+ *
+ */
+
+Http2ClientStream::Http2ClientStream(struct pool &caller_pool,
+                                     Http2ClientConnection &_connection,
+                                     Lease &_lease,
+                                     http_method_t method,
+                                     HttpResponseHandler &_handler,
+                                     CancellablePointer &cancel_ptr) noexcept
+    :connection(_connection),
+     pool(pool_new_linear(&caller_pool, "http2_client_request", 4096)),
+     handler(_handler),
+     head(method == HTTP_METHOD_HEAD),
+     response_headers(pool),
+     request_body(nullptr),
+     defer_response(connection.GetEventLoop(),
+                    BIND_THIS_METHOD(OnDeferredResponse)),
+     defer_read(connection.GetEventLoop(),
+                BIND_THIS_METHOD(OnDeferredRead)),
+     defer_close(connection.GetEventLoop(),
+                 BIND_THIS_METHOD(OnDeferredClose))
+{
+    lease_ref.Set(_lease);
+    cancel_ptr = *this;
+}
+
+Http2ClientStream::~Http2ClientStream() noexcept
+{
+    defer_response.Cancel();
+    defer_read.Cancel();
+    defer_close.Cancel();
+
+    if (request_body.IsDefined())
+        request_body.Close();
+}
+
+void
+Http2ClientStream::Destroy(bool reuse) noexcept
+{
+    connection.RemoveStream(*this);
+
+    if (state != State::BODY && response_body != nullptr)
+        /* the response body was never passed to our handler */
+        response_body->Discard();
+
+    if (!closed && id > 0) {
+        /* detach from nghttp2; late frames for this stream will be
+           discarded */
+        nghttp2_session_set_stream_user_data(connection.GetSession(),
+                                             id, nullptr);
+
+        if (!end_stream || request_body.IsDefined() ||
+            !request_buffer.IsEmpty())
+            ResetStream(NGHTTP2_CANCEL);
+    }
+
+    /* releasing the lease may destroy the connection, therefore do
+       it after this object is gone */
+    auto &_lease_ref = lease_ref;
+    Lease &lease = *_lease_ref.lease;
+    delete this;
+    lease.ReleaseLease(reuse);
+}
+
+void
+Http2ClientStream::AbortResponse(std::exception_ptr ep) noexcept
+{
+    switch (state) {
+    case State::HEADERS:
+    case State::RESPONSE:
+        {
+            auto &_handler = handler;
+            ep = connection.PrefixError(ep);
+            Destroy(false);
+            _handler.InvokeError(ep);
+        }
+        return;
+
+
+    case State::BODY:
+        if (response_body != nullptr)
+            std::exchange(response_body, nullptr)
+                ->Abort(connection.PrefixError(ep));
+
+        Destroy(false);
+        return;
+    }
+}
+
+void
+Http2ClientStream::Abort(std::exception_ptr ep) noexcept
+{
+    closed = true;
+    AbortResponse(ep);
+}
+
+void
+Http2ClientStream::ResetStream(uint32_t error_code) noexcept
+{
+    if (closed)
+        return;
+
+    nghttp2_submit_rst_stream(connection.GetSession(), NGHTTP2_FLAG_NONE,
+                              id, error_code);
+    connection.ScheduleSend();
+}
+
+inline void
+Http2ClientStream::Submit(http_method_t method, const char *uri,
+                          HttpHeaders &&headers,
+                          UnusedIstreamPtr body) noexcept
+{
+    const StringMap map(std::move(headers).ToMap());
+
+    const char *authority = map.Get("host");
+    if (authority == nullptr)
+        authority = "localhost";
+
+    const off_t content_length = body ? body.GetAvailable(false) : -1;
+    char content_length_buffer[32];
+    if (content_length >= 0)
+        format_uint64(content_length_buffer, content_length);
+
+    size_t n = 5;
+    for (gcc_unused const auto &i : map)
+        ++n;
+
+    auto *nva = PoolAlloc<nghttp2_nv>(pool, n);
+    size_t i = 0;
+
+    nva[i++] = MakeNv(":method", http_method_to_string(method));
+    nva[i++] = MakeNv(":scheme", "http");
+    nva[i++] = MakeNv(":authority", authority);
+    nva[i++] = MakeNv(":path", uri);
+
+    if (content_length >= 0)
+        nva[i++] = MakeNv("content-length", content_length_buffer);
+
+    for (const auto &h : map) {
+        if (http_header_is_hop_by_hop(h.key) ||
+            strcmp(h.key, "host") == 0 ||
+            strcmp(h.key, "content-length") == 0 ||
+            strcmp(h.key, "expect") == 0)
+            continue;
+
+        nva[i++] = MakeNv(h.key, h.value);
+    }
+
+    nghttp2_data_provider provider;
+    provider.source.ptr = nullptr;
+    provider.read_callback = ReadCallback;
+
+    id = nghttp2_submit_request(connection.GetSession(), nullptr,
+                                nva, i, body ? &provider : nullptr,
+                                this);
+    if (id < 0) {
+        body.Clear();
+
+        auto &_handler = handler;
+        auto ep = std::make_exception_ptr(MakeNgHttp2Error(id, "nghttp2_submit_request() failed"));
+        Destroy();
+        _handler.InvokeError(ep);
+        return;
+    }
+
+    if (body) {
+        request_body.Set(std::move(body), *this);
+        defer_read.Schedule();
+    }
+
+    connection.ScheduleSend();
+}
+
+gcc_pure
+static http_status_t
+ParseStatus(StringView s) noexcept
+{
+    if (s.size != 3)
+        return http_status_t(0);
+
+    char buffer[4];
+    memcpy(buffer, s.data, 3);
+    buffer[3] = 0;
+
+    char *endptr;
+    const auto status = http_status_t(strtoul(buffer, &endptr, 10));
+    if (endptr != buffer + 3 || !http_status_is_valid(status))
+        return http_status_t(0);
+
+    return status;
+}
+
+bool
+Http2ClientStream::OnHeader(StringView name, StringView value) noexcept
+{
+    if (state != State::HEADERS)
+        /* ignore trailers */
+        return true;
+
+    if (!name.empty() && name.front() == ':') {
+        if (name.Equals(":status")) {
+            status = ParseStatus(value);
+            return status != http_status_t(0);
+        }
+
+        return true;
+    }
+
+    response_headers.Add(p_strndup(pool, name.data, name.size),
+                         p_strndup(pool, value.data, value.size));
+    return true;
+}
+
+bool
+Http2ClientStream::OnHeadersComplete(bool _end_stream) noexcept
+{
+    if (state != State::HEADERS) {
+        /* trailers */
+        if (_end_stream)
+            OnEndStream();
+        return true;
+    }
+
+    if (status == http_status_t(0))
+        return false;
+
+    if (int(status) < 200) {
+        /* ignore "100 Continue" and friends; the final response
+           will follow */
+        status = http_status_t(0);
+        response_headers.Clear();
+        return true;
+    }
+
+    state = State::RESPONSE;
+    end_stream = _end_stream;
+
+    if (!end_stream && !head && !http_status_is_empty(status))
+        response_body = NewIstream<Http2ResponseBody>(pool,
+                                                      connection.GetEventLoop(),
+                                                      *this);
+
+    defer_response.Schedule();
+    return true;
+}
+
+void
+Http2ClientStream::OnResponseData(const uint8_t *data, size_t length) noexcept
+{
+    if (response_body != nullptr)
+        response_body->Feed(data, length);
+    else if (!closed)
+        /* nobody is interested in the response body; discard it */
+        nghttp2_session_consume(connection.GetSession(), id, length);
+}
+
+void
+Http2ClientStream::OnEndStream() noexcept
+{
+    end_stream = true;
+
+    if (response_body != nullptr)
+        response_body->SetEof();
+}
+
+void
+Http2ClientStream::OnStreamClose(uint32_t error_code) noexcept
+{
+    closed = true;
+    close_error_code = error_code;
+    defer_close.Schedule();
+}
+
+void
+Http2ClientStream::OnDeferredClose() noexcept
+{
+    assert(closed);
+
+    switch (state) {
+    case State::HEADERS:
+        if (close_error_code == NGHTTP2_REFUSED_STREAM)
+            /* the server did not process the request (e.g. after
+               GOAWAY); it is safe to retry */
+            AbortResponse(HttpClientErrorCode::REFUSED,
+                          "HTTP/2 stream refused by server");
+        else
+            AbortResponse(HttpClientErrorCode::PREMATURE,
+                          "HTTP/2 stream closed before response");
+        return;
+
+    case State::RESPONSE:
+        /* OnDeferredResponse() will check the state again */
+        return;
+
+    case State::BODY:
+        if (response_body == nullptr)
+            Destroy();
+        else if (!end_stream)
+            AbortResponse(HttpClientErrorCode::PREMATURE,
+                          "HTTP/2 stream closed prematurely");
+        /* else: wait until the response body has been consumed */
+        return;
+    }
+}
+
+void
+Http2ClientStream::OnDeferredResponse() noexcept
+{
+    assert(state == State::RESPONSE);
+
+    state = State::BODY;
+
+    if (response_body == nullptr) {
+        handler.InvokeResponse(status, std::move(response_headers),
+                               UnusedIstreamPtr());
+
+        if (closed || end_stream)
+            /* the response is complete; if the request body is still
+               being sent, Destroy() resets the stream */
+            Destroy();
+        /* else: OnDeferredClose() will destroy this object */
+        return;
+    }
+
+    const DestructObserver destructed(*this);
+
+    handler.InvokeResponse(status, std::move(response_headers),
+                           UnusedIstreamPtr(response_body));
+
+    if (!destructed && closed)
+        /* the stream was closed before the response was submitted;
+           let OnDeferredClose() check the state again */
+        defer_close.Schedule();
+}
+
+void
+Http2ClientStream::OnResponseBodyConsumed(size_t nbytes) noexcept
+{
+    /* this is legal even after the stream has been closed; nghttp2
+       then only extends the connection's window */
+    nghttp2_session_consume(connection.GetSession(), id, nbytes);
+    connection.ScheduleSend();
+}
+
+void
+Http2ClientStream::OnResponseBodyEof() noexcept
+{
+    assert(response_body != nullptr);
+
+    response_body = nullptr;
+
+    if (closed)
+        Destroy();
+    /* else: OnDeferredClose() will destroy this object */
+}
+
+void
+Http2ClientStream::OnResponseBodyClosed(size_t pending) noexcept
+{
+    assert(response_body != nullptr);
+
+    response_body = nullptr;
+
+    if (pending > 0)
+        OnResponseBodyConsumed(pending);
+
+    Destroy();
+}
+
+void
+Http2ClientStream::Cancel() noexcept
+{
+    assert(state != State::BODY);
+
+    Destroy();
+}
+
+void
+Http2ClientStream::ResumeRequest() noexcept
+{
+    if (closed || !request_deferred)
+        return;
+
+    request_deferred = false;
+    nghttp2_session_resume_data(connection.GetSession(), id);
+    connection.ScheduleSend();
+}
+
+void
+Http2ClientStream::OnDeferredRead() noexcept
+{
+    if (request_body.IsDefined() &&
+        request_buffer.GetSize() < HTTP2_REQUEST_BUFFER)
+        request_body.Read();
+}
+
+ssize_t
+Http2ClientStream::ReadRequest(uint8_t *buf, size_t length,
+                               uint32_t &data_flags) noexcept
+{
+    auto r = request_buffer.Read();
+    if (r.empty()) {
+        if (request_eof) {
+            data_flags |= NGHTTP2_DATA_FLAG_EOF;
+            return 0;
+        }
+
+        /* wait for OnData() */
+        request_deferred = true;
+        defer_read.Schedule();
+        return NGHTTP2_ERR_DEFERRED;
+    }
+
+    const size_t nbytes = std::min(length, r.size);
+    memcpy(buf, r.data, nbytes);
+    request_buffer.Consume(nbytes);
+
+    if (request_eof && request_buffer.IsEmpty())
+        data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    else if (request_body.IsDefined())
+        defer_read.Schedule();
+
+    return nbytes;
+}
+
+ssize_t
+Http2ClientStream::ReadCallback(nghttp2_session *session, int32_t stream_id,
+                                uint8_t *buf, size_t length,
+                                uint32_t *data_flags,
+                                nghttp2_data_source *,
+                                void *) noexcept
+{
+    /* look up the stream instead of using the data source pointer,
+       because the stream object may have been destroyed already */
+    auto *stream = (Http2ClientStream *)
+        nghttp2_session_get_stream_user_data(session, stream_id);
+    if (stream == nullptr)
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+
+    return stream->ReadRequest(buf, length, *data_flags);
+}
+
+size_t
+Http2ClientStream::OnData(const void *data, size_t length) noexcept
+{
+    const size_t buffered = request_buffer.GetSize();
+    if (buffered >= HTTP2_REQUEST_BUFFER)
+        return 0;
+
+    const size_t nbytes = std::min(length, HTTP2_REQUEST_BUFFER - buffered);
+    request_buffer.Write(data, nbytes);
+    ResumeRequest();
+    return nbytes;
+}
+
+void
+Http2ClientStream::OnEof() noexcept
+{
+    request_body.Clear();
+    request_eof = true;
+    ResumeRequest();
+}
+
+void
+Http2ClientStream::OnError(std::exception_ptr ep) noexcept
+{
+    request_body.Clear();
+
+    ResetStream(NGHTTP2_INTERNAL_ERROR);
+
+    if (state == State::BODY) {
+        if (response_body != nullptr)
+            std::exchange(response_body, nullptr)->Abort(ep);
+
+        Destroy();
+        return;
+    }
+
+    auto &_handler = handler;
+    Destroy();
+    _handler.InvokeError(NestException(ep,
+                                       std::runtime_error("HTTP/2 request body failed")));
+}
+
+/*
+ * nghttp2 callbacks
+ *
+ */
+
+static Http2ClientStream *
+GetStream(nghttp2_session *session, int32_t stream_id) noexcept
+{
+    return (Http2ClientStream *)
+        nghttp2_session_get_stream_user_data(session, stream_id);
+}
+
+gcc_pure
+static bool
+IsResponseHeaders(const nghttp2_frame &frame) noexcept
+{
+    return frame.hd.type == NGHTTP2_HEADERS &&
+        (frame.headers.cat == NGHTTP2_HCAT_RESPONSE ||
+         frame.headers.cat == NGHTTP2_HCAT_HEADERS);
+}
+
+int
+Http2ClientConnection::OnHeaderCallback(nghttp2_session *session,
+                                        const nghttp2_frame *frame,
+                                        const uint8_t *name, size_t namelen,
+                                        const uint8_t *value, size_t valuelen,
+                                        uint8_t, void *) noexcept
+{
+    if (!IsResponseHeaders(*frame))
+        return 0;
+
+    auto *stream = GetStream(session, frame->hd.stream_id);
+    if (stream == nullptr)
+        return 0;
+
+    return stream->OnHeader({(const char *)name, namelen},
+                            {(const char *)value, valuelen})
+        ? 0
+        : NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+}
+
+int
+Http2ClientConnection::OnFrameRecvCallback(nghttp2_session *session,
+                                           const nghttp2_frame *frame,
+                                           void *user_data) noexcept
+{
+    if (frame->hd.type == NGHTTP2_GOAWAY) {
+        auto &c = *(Http2ClientConnection *)user_data;
+        c.Fade();
+        return 0;
+    }
+
+    if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+        return 0;
+
+    auto *stream = GetStream(session, frame->hd.stream_id);
+    if (stream == nullptr)
+        return 0;
+
+    const bool end_stream = (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0;
+
+    if (IsResponseHeaders(*frame)) {
+        if (!stream->OnHeadersComplete(end_stream))
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE,
+                                      frame->hd.stream_id,
+                                      NGHTTP2_PROTOCOL_ERROR);
+    } else if (end_stream)
+        stream->OnEndStream();
+
+    return 0;
+}
+
+int
+Http2ClientConnection::OnDataChunkRecvCallback(nghttp2_session *session,
+                                               uint8_t, int32_t stream_id,
+                                               const uint8_t *data, size_t len,
+                                               void *) noexcept
+{
+    auto *stream = GetStream(session, stream_id);
+    if (stream == nullptr) {
+        nghttp2_session_consume_connection(session, len);
+        return 0;
+    }
+
+    stream->OnResponseData(data, len);
+    return 0;
+}
+
+int
+Http2ClientConnection::OnStreamCloseCallback(nghttp2_session *session,
+                                             int32_t stream_id,
+                                             uint32_t error_code,
+                                             void *) noexcept
+{
+    auto *stream = GetStream(session, stream_id);
+    if (stream != nullptr)
+        stream->OnStreamClose(error_code);
+
+    return 0;
+}
+
+/*
+ * Http2ClientConnection
+ *
+ */
+
+Http2ClientConnection::Http2ClientConnection(FilteredSocket &_socket,
+                                             const char *_peer_name,
+                                             Http2ClientConnectionHandler &_handler)
+    :socket(_socket), peer_name(_peer_name), handler(_handler),
+     defer_send(socket.GetEventLoop(), BIND_THIS_METHOD(OnDeferredSend))
+{
+    nghttp2_session_callbacks *callbacks;
+    int result = nghttp2_session_callbacks_new(&callbacks);
+    if (result != 0)
+        throw MakeNgHttp2Error(result, "nghttp2_session_callbacks_new() failed");
+
+    nghttp2_session_callbacks_set_on_header_callback(callbacks,
+                                                     OnHeaderCallback);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                         OnFrameRecvCallback);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                              OnDataChunkRecvCallback);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                           OnStreamCloseCallback);
+
+    nghttp2_option *option;
+    result = nghttp2_option_new(&option);
+    if (result != 0) {
+        nghttp2_session_callbacks_del(callbacks);
+        throw MakeNgHttp2Error(result, "nghttp2_option_new() failed");
+    }
+
+    /* flow control follows our response body consumers, see
+       Http2ClientStream::OnResponseBodyConsumed() */
+    nghttp2_option_set_no_auto_window_update(option, 1);
+
+    result = nghttp2_session_client_new2(&session, callbacks, this, option);
+    nghttp2_option_del(option);
+    nghttp2_session_callbacks_del(callbacks);
+    if (result != 0)
+        throw MakeNgHttp2Error(result, "nghttp2_session_client_new2() failed");
+
+    static constexpr nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+    };
+
+    /* this also queues the client connection preface */
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE,
+                            settings, std::size(settings));
+
+    socket.Reinit(Event::Duration(-1), http2_client_timeout, *this);
+    socket.ScheduleReadNoTimeout(false);
+
+    ScheduleSend();
+}
+
+Http2ClientConnection::~Http2ClientConnection() noexcept
+{
+    /* the owner must not free the connection while streams are
+       holding leases on it */
+    assert(streams.empty());
+
+    defer_send.Cancel();
+
+    nghttp2_session_del(session);
+}
+
+void
+Http2ClientConnection::AddStream(Http2ClientStream &stream) noexcept
+{
+    if (streams.empty() && !broken)
+        socket.ScheduleReadTimeout(false, http2_client_timeout);
+
+    streams.push_back(stream);
+}
+
+void
+Http2ClientConnection::RemoveStream(Http2ClientStream &stream) noexcept
+{
+    streams.erase(streams.iterator_to(stream));
+
+    if (streams.empty() && !broken)
+        /* idle: the server may keep the connection open as long as
+           it wishes */
+        socket.ScheduleReadNoTimeout(false);
+}
+
+void
+Http2ClientConnection::Fade() noexcept
+{
+    if (!usable)
+        return;
+
+    usable = false;
+    handler.OnHttp2ClientFade();
+}
+
+void
+Http2ClientConnection::Abort(std::exception_ptr ep) noexcept
+{
+    broken = true;
+    defer_send.Cancel();
+
+    if (socket.IsConnected())
+        socket.UnscheduleWrite();
+
+    const DestructObserver destructed(*this);
+
+    Fade();
+    if (destructed)
+        return;
+
+    while (!streams.empty()) {
+        /* each stream releases its lease, which may destroy this
+           object */
+        streams.front().Abort(ep);
+        if (destructed)
+            return;
+    }
+}
+
+bool
+Http2ClientConnection::Send() noexcept
+{
+    if (broken)
+        return false;
+
+    while (true) {
+        if (output.IsEmpty()) {
+            const uint8_t *data;
+            ssize_t nbytes = nghttp2_session_mem_send(session, &data);
+            if (nbytes < 0) {
+                Abort(std::make_exception_ptr(MakeNgHttp2Error(nbytes, "nghttp2_session_mem_send() failed")));
+                return false;
+            }
+
+            if (nbytes == 0)
+                break;
+
+            output.Write(data, nbytes);
+        }
+
+        const auto r = output.Read();
+        ssize_t nbytes = socket.Write(r.data, r.size);
+        if (nbytes < 0) {
+            if (gcc_likely(nbytes == WRITE_BLOCKING)) {
+                socket.ScheduleWrite();
+                return true;
+            }
+
+            if (nbytes != WRITE_DESTROYED)
+                Abort(std::make_exception_ptr(HttpClientError(HttpClientErrorCode::IO,
+                                                              "write error on HTTP/2 connection")));
+            return false;
+        }
+
+        output.Consume(nbytes);
+
+        if (size_t(nbytes) < r.size) {
+            socket.ScheduleWrite();
+            return true;
+        }
+    }
+
+    socket.UnscheduleWrite();
+    return true;
+}
+
+inline BufferedResult
+Http2ClientConnection::Feed() noexcept
+{
+    auto r = socket.ReadBuffer();
+    assert(!r.empty());
+
+    ssize_t nbytes = nghttp2_session_mem_recv(session,
+                                              (const uint8_t *)r.data,
+                                              r.size);
+    if (nbytes < 0) {
+        Abort(HttpClientErrorCode::GARBAGE, nghttp2_strerror(nbytes));
+        return BufferedResult::CLOSED;
+    }
+
+    socket.DisposeConsumed(nbytes);
+
+    /* send SETTINGS acknowledgements, WINDOW_UPDATE frames etc. */
+    ScheduleSend();
+
+    return BufferedResult::OK;
+}
+
+/*
+ * BufferedSocketHandler
+ *
+ */
+
+BufferedResult
+Http2ClientConnection::OnBufferedData()
+{
+    if (broken)
+        return BufferedResult::CLOSED;
+
+    return Feed();
+}
+
+bool
+Http2ClientConnection::OnBufferedClosed() noexcept
+{
+    socket.UnscheduleWrite();
+    socket.Close();
+
+    Abort(streams.empty()
+          ? HttpClientErrorCode::REFUSED
+          : HttpClientErrorCode::PREMATURE,
+          "HTTP/2 server closed the connection");
+    return false;
+}
+
+bool
+Http2ClientConnection::OnBufferedWrite()
+{
+    return Send();
+}
+
+bool
+Http2ClientConnection::OnBufferedTimeout() noexcept
+{
+    Abort(HttpClientErrorCode::TIMEOUT, "timeout on HTTP/2 connection");
+    return false;
+}
+
+void
+Http2ClientConnection::OnBufferedError(std::exception_ptr e) noexcept
+{
+    Abort(NestException(e,
+                        HttpClientError(HttpClientErrorCode::IO,
+                                        "HTTP/2 client socket error")));
+}
+
+/*
+ * public API
+ *
+ */
+
+Http2ClientConnection *
+http2_client_connection_new(FilteredSocket &socket, const char *peer_name,
+                            Http2ClientConnectionHandler &handler)
+{
+    return new Http2ClientConnection(socket, peer_name, handler);
+}
+
+void
+http2_client_connection_free(Http2ClientConnection *connection) noexcept
+{
+    delete connection;
+}
+
+bool
+http2_client_connection_is_usable(const Http2ClientConnection &connection) noexcept
+{
+    return connection.IsUsable();
+}
+
+void
+http2_client_request(struct pool &caller_pool,
+                     Http2ClientConnection &connection, Lease &lease,
+                     http_method_t method, const char *uri,
+                     HttpHeaders &&headers,
+                     UnusedIstreamPtr body,
+                     HttpResponseHandler &handler,
+                     CancellablePointer &cancel_ptr)
+{
+    assert(http_method_is_valid(method));
+
+    if (!uri_path_verify_quick(uri)) {
+        lease.ReleaseLease(true);
+        body.Clear();
+
+        handler.InvokeError(std::make_exception_ptr(HttpClientError(HttpClientErrorCode::UNSPECIFIED,
+                                                                    StringFormat<256>("malformed request URI '%s'", uri))));
+        return;
+    }
+
+    if (!connection.IsUsable()) {
+        lease.ReleaseLease(false);
+        body.Clear();
+
+        handler.InvokeError(std::make_exception_ptr(HttpClientError(HttpClientErrorCode::REFUSED,
+                                                                    "HTTP/2 connection is shutting down")));
+        return;
+    }
+
+    auto *stream = new Http2ClientStream(caller_pool, connection, lease,
+                                         method, handler, cancel_ptr);
+    connection.AddStream(*stream);
+    stream->Submit(method, uri, std::move(headers), std::move(body));
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * HTTP/2 client implementation on top of libnghttp2.
+ */
+
+#ifndef BENG_PROXY_HTTP2_CLIENT_HXX
+#define BENG_PROXY_HTTP2_CLIENT_HXX
+
+#include "http/Method.h"
+#include "util/Compiler.h"
+
+#include <exception>
+
+struct pool;
+class UnusedIstreamPtr;
+struct FilteredSocket;
+class Lease;
+class HttpResponseHandler;
+class CancellablePointer;
+class HttpHeaders;
+class Http2ClientConnection;
+
+class Http2ClientConnectionHandler {
+public:
+    /**
+     * The connection does not accept new requests anymore, either
+     * because the server has sent GOAWAY or because the socket has
+     * failed.  Streams which are still running will be finished or
+     * aborted.
+     */
+    virtual void OnHttp2ClientFade() noexcept = 0;
+};
+
+/**
+ * Start a HTTP/2 session ("prior knowledge") on the given socket.
+ * The #Http2ClientConnection becomes the socket's handler; the
+ * caller keeps owning the #FilteredSocket and must not destroy it
+ * before calling http2_client_connection_free().
+ *
+ * Throws exception on error.
+ *
+ * @param peer_name the name of the server, used in error messages
+ */
+Http2ClientConnection *
+http2_client_connection_new(FilteredSocket &socket, const char *peer_name,
+                            Http2ClientConnectionHandler &handler);
+
+/**
+ * Close the connection.  All pending streams are aborted.
+ */
+void
+http2_client_connection_free(Http2ClientConnection *connection) noexcept;
+
+/**
+ * May new requests be sent on this connection?
+ */
+gcc_pure
+bool
+http2_client_connection_is_usable(const Http2ClientConnection &connection) noexcept;
+
+/**
+ * Sends a HTTP request on a new HTTP/2 stream, and passes the
+ * response to the handler.  The lease is released when the stream
+ * is finished.
+ *
+ * @param pool the memory pool; this client holds a reference until
+ * the response callback has returned and the response body is closed
+ * @param connection a connection obtained from
+ * http2_client_connection_new()
+ * @param lease the lease for one stream on the connection
+ * @param method the HTTP request method
+ * @param uri the request URI path
+ * @param headers the request headers; the "host" header is
+ * translated to the ":authority" pseudo header
+ * @param body the request body (optional)
+ * @param handler receives the response
+ * @param cancel_ptr a handle which may be used to abort the operation
+ */
+void
+http2_client_request(struct pool &pool,
+                     Http2ClientConnection &connection, Lease &lease,
+                     http_method_t method, const char *uri,
+                     HttpHeaders &&headers,
+                     UnusedIstreamPtr body,
+                     HttpResponseHandler &handler,
+                     CancellablePointer &cancel_ptr);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http2_stock.hxx"
+#include "http2_client.hxx"
+#include "fs/Stock.hxx"
+#include "stock/Stock.hxx"
+#include "stock/GetHandler.hxx"
+#include "stock/Item.hxx"
+#include "pool/pool.hxx"
+#include "net/SocketAddress.hxx"
+#include "net/ToString.hxx"
+#include "util/Cancellable.hxx"
+
+#include <assert.h>
+
+/**
+ * The maximum number of concurrent streams per connection.  RFC 7540
+ * recommends that servers allow at least 100.
+ */
+static constexpr unsigned HTTP2_MAX_STREAMS = 100;
+
+struct Http2StockRequest {
+    const bool ip_transparent;
+
+    const SocketAddress bind_address, address;
+
+    const Event::Duration timeout;
+
+    Http2StockRequest(bool _ip_transparent,
+                      SocketAddress _bind_address,
+                      SocketAddress _address,
+                      Event::Duration _timeout) noexcept
+        :ip_transparent(_ip_transparent),
+         bind_address(_bind_address), address(_address),
+         timeout(_timeout) {}
+};
+
+class Http2StockConnection final
+    : StockItem, StockGetHandler, Cancellable, Http2ClientConnectionHandler {
+
+    Http2Stock &http2_stock;
+
+    /**
+     * To cancel the #FilteredSocketStock request.
+     */
+    CancellablePointer cancel_ptr;
+
+    /**
+     * The #FilteredSocketStock item; it is borrowed for the whole
+     * lifetime of this object.
+     */
+    StockItem *socket_item = nullptr;
+
+    Http2ClientConnection *client = nullptr;
+
+    bool idle = false;
+
+public:
+    Http2StockConnection(CreateStockItem c, Http2Stock &_http2_stock,
+                         CancellablePointer &_cancel_ptr) noexcept
+        :StockItem(c), http2_stock(_http2_stock)
+    {
+        _cancel_ptr = *this;
+    }
+
+    ~Http2StockConnection() noexcept override {
+        if (cancel_ptr)
+            cancel_ptr.Cancel();
+
+        if (client != nullptr)
+            http2_client_connection_free(client);
+
+        if (socket_item != nullptr)
+            /* a HTTP/2 connection cannot be reused for HTTP/1.1 */
+            socket_item->Put(true);
+    }
+
+    void Connect(FilteredSocketStock &fs_stock, struct pool &caller_pool,
+                 const Http2StockRequest &request) noexcept {
+        fs_stock.Get(caller_pool, GetStockName(),
+                     request.ip_transparent, request.bind_address,
+                     request.address, request.timeout,
+                     nullptr,
+                     *this, cancel_ptr);
+    }
+
+    Http2ClientConnection &GetClient() noexcept {
+        assert(client != nullptr);
+
+        return *client;
+    }
+
+    SocketAddress GetAddress() const noexcept {
+        assert(socket_item != nullptr);
+
+        return fs_stock_item_get_address(*socket_item);
+    }
+
+private:
+    /* virtual methods from class Cancellable */
+    void Cancel() noexcept override {
+        assert(cancel_ptr);
+
+        cancel_ptr.CancelAndClear();
+        InvokeCreateAborted();
+    }
+
+    /* virtual methods from class StockGetHandler */
+    void OnStockItemReady(StockItem &item) noexcept override;
+    void OnStockItemError(std::exception_ptr ep) noexcept override;
+
+    /* virtual methods from class Http2ClientConnectionHandler */
+    void OnHttp2ClientFade() noexcept override;
+
+    /* virtual methods from class StockItem */
+    bool Borrow() noexcept override {
+        idle = false;
+        return http2_client_connection_is_usable(*client);
+    }
+
+    bool Release() noexcept override {
+        if (!http2_client_connection_is_usable(*client))
+            return false;
+
+        idle = true;
+        return true;
+    }
+};
+
+void
+Http2StockConnection::OnStockItemReady(StockItem &item) noexcept
+{
+    cancel_ptr = nullptr;
+    socket_item = &item;
+
+    try {
+        client = http2_client_connection_new(fs_stock_item_get(item),
+                                             GetStockName(), *this);
+    } catch (...) {
+        InvokeCreateError(std::current_exception());
+        return;
+    }
+
+    InvokeCreateSuccess();
+}
+
+void
+Http2StockConnection::OnStockItemError(std::exception_ptr ep) noexcept
+{
+    cancel_ptr = nullptr;
+    InvokeCreateError(ep);
+}
+
+void
+Http2StockConnection::OnHttp2ClientFade() noexcept
+{
+    fade = true;
+    http2_stock.Fade(*this);
+
+    if (idle)
+        InvokeIdleDisconnect();
+}
+
+/*
+ * stock class
+ *
+ */
+
+void
+Http2Stock::Create(CreateStockItem c, void *info,
+                   struct pool &caller_pool,
+                   CancellablePointer &cancel_ptr)
+{
+    const auto &request = *(const Http2StockRequest *)info;
+
+    auto *connection = new Http2StockConnection(c, *this, cancel_ptr);
+    connection->Connect(fs_stock, caller_pool, request);
+}
+
+/*
+ * interface
+ *
+ */
+
+Http2Stock::Http2Stock(FilteredSocketStock &_fs_stock,
+                       unsigned limit) noexcept
+    :fs_stock(_fs_stock),
+     hstock(fs_stock.GetEventLoop(), *this, limit, 16),
+     mstock(hstock) {}
+
+void
+Http2Stock::Fade(StockItem &item) noexcept
+{
+    mstock.FadeIf([&item](const StockItem &i){
+            return &i == &item;
+        });
+}
+
+void
+Http2Stock::Get(struct pool &pool, const char *name,
+                bool ip_transparent,
+                SocketAddress bind_address,
+                SocketAddress address,
+                Event::Duration timeout,
+                StockGetHandler &handler,
+                struct lease_ref &lease_ref,
+                CancellablePointer &cancel_ptr) noexcept
+{
+    assert(!address.IsNull());
+
+    auto request =
+        NewFromPool<Http2StockRequest>(pool, ip_transparent,
+                                       bind_address, address,
+                                       timeout);
+
+    if (name == nullptr) {
+        char buffer[1024];
+        if (!ToString(buffer, sizeof(buffer), address))
+            buffer[0] = 0;
+
+        if (!bind_address.IsNull()) {
+            char bind_buffer[1024];
+            if (!ToString(bind_buffer, sizeof(bind_buffer), bind_address))
+                bind_buffer[0] = 0;
+            name = p_strcat(&pool, bind_buffer, ">", buffer, nullptr);
+        } else
+            name = p_strdup(&pool, buffer);
+    }
+
+    /* keep HTTP/2 connections apart from HTTP/1.1 connections in the
+       FilteredSocketStock */
+    name = p_strcat(&pool, name, "|h2", nullptr);
+
+    mstock.Get(pool, name, request, HTTP2_MAX_STREAMS,
+               handler, lease_ref, cancel_ptr);
+}
+
+Http2ClientConnection &
+http2_stock_item_get(StockItem &item) noexcept
+{
+    auto &connection = (Http2StockConnection &)item;
+
+    return connection.GetClient();
+}
+
+SocketAddress
+http2_stock_item_get_address(const StockItem &item) noexcept
+{
+    const auto &connection = (const Http2StockConnection &)item;
+
+    return connection.GetAddress();
+}
@@ -34,12 +34,15 @@
 #include "http_cache_document.hxx"
 #include "http_cache_rfc.hxx"
 #include "http_cache_heap.hxx"
+#include "http_cache_shared.hxx"
+#include "http_cache_disk.hxx"
 #include "strmap.hxx"
 #include "HttpResponseHandler.hxx"
 #include "ResourceLoader.hxx"
 #include "ResourceAddress.hxx"
 #include "cache.hxx"
 #include "sink_rubber.hxx"
+#include "serialize.hxx"
 #include "AllocatorStats.hxx"
 #include "http/Date.hxx"
 #include "http/List.hxx"
@@ -55,12 +58,14 @@
 #include "util/Background.hxx"
 #include "util/Cast.hxx"
 #include "util/Cancellable.hxx"
+#include "util/ConstBuffer.hxx"
 #include "util/Exception.hxx"
 #include "util/RuntimeError.hxx"
 
 #include <boost/intrusive/list.hpp>
 
 #include <functional>
+#include <memory>
 
 #include <string.h>
 #include <time.h>
@@ -183,6 +188,76 @@ private:
     void RubberError(std::exception_ptr ep) noexcept override;
 };
 
+/**
+ * Copies an encoded (i.e. compressed) response body which is being
+ * sent to a client into the cache, to be attached to the item it was
+ * generated from.
+ */
+class HttpCacheEncodeRequest final : PoolHolder, public RubberSinkHandler {
+public:
+    static constexpr auto link_mode = boost::intrusive::normal_link;
+    typedef boost::intrusive::link_mode<link_mode> LinkMode;
+    typedef boost::intrusive::list_member_hook<LinkMode> SiblingsHook;
+    SiblingsHook siblings;
+
+private:
+    HttpCache &cache;
+
+    const char *const key;
+
+    /**
+     * A copy of the request headers, for matching the "Vary" header
+     * of the cache item.
+     */
+    const StringMap request_headers;
+
+    const char *const etag, *const last_modified;
+    const char *const encoding;
+
+public:
+    CancellablePointer cancel_ptr;
+
+    HttpCacheEncodeRequest(PoolPtr &&_pool, HttpCache &_cache,
+                           const char *_key,
+                           const StringMap &_request_headers,
+                           const char *_etag, const char *_last_modified,
+                           const char *_encoding) noexcept
+        :PoolHolder(std::move(_pool)), cache(_cache),
+         key(p_strdup(pool, _key)),
+         request_headers(pool, _request_headers),
+         etag(_etag != nullptr ? p_strdup(pool, _etag) : nullptr),
+         last_modified(_last_modified != nullptr
+                       ? p_strdup(pool, _last_modified)
+                       : nullptr),
+         encoding(p_strdup(pool, _encoding)) {}
+
+    using PoolHolder::GetPool;
+
+    /**
+     * Abort storing the encoded body.  This will not remove the
+     * request from the HttpCache, because this method is supposed to
+     * be used as a "disposer".
+     */
+    void Abort() noexcept {
+        CancellablePointer _cancel_ptr(std::move(cancel_ptr));
+        Destroy();
+        _cancel_ptr.Cancel();
+    }
+
+private:
+    void Destroy() noexcept {
+        this->~HttpCacheEncodeRequest();
+    }
+
+    void Finish() noexcept;
+
+    /* virtual methods from class RubberSinkHandler */
+    void RubberDone(RubberAllocation &&a, size_t size) noexcept override;
+    void RubberOutOfMemory() noexcept override;
+    void RubberTooLarge() noexcept override;
+    void RubberError(std::exception_ptr ep) noexcept override;
+};
+
 class HttpCache {
     const PoolPtr pool;
 
@@ -190,8 +265,22 @@ class HttpCache {
 
     TimerEvent compress_timer;
 
+    /**
+     * The optional second tier on a local disk, which receives items
+     * evicted from the #heap.
+     */
+    const std::unique_ptr<HttpCacheDisk> disk;
+
     HttpCacheHeap heap;
 
+    /**
+     * The optional second tier in shared memory, shared by all
+     * worker processes.
+     */
+    std::unique_ptr<HttpCacheShared> shared;
+
+    const size_t shared_size;
+
     ResourceLoader &resource_loader;
 
     /**
@@ -204,10 +293,21 @@ class HttpCache {
                                                          &HttpCacheRequest::siblings>,
                            boost::intrusive::constant_time_size<false>> requests;
 
+    /**
+     * A list of requests that are currently saving an encoded
+     * variant to the cache.
+     */
+    boost::intrusive::list<HttpCacheEncodeRequest,
+                           boost::intrusive::member_hook<HttpCacheEncodeRequest,
+                                                         HttpCacheEncodeRequest::SiblingsHook,
+                                                         &HttpCacheEncodeRequest::siblings>,
+                           boost::intrusive::constant_time_size<false>> encode_requests;
+
     BackgroundManager background;
 
 public:
-    HttpCache(struct pool &_pool, size_t max_size,
+    HttpCache(struct pool &_pool, size_t max_size, CachePolicy policy,
+              size_t _shared_size, const char *disk_path, size_t disk_size,
               EventLoop &event_loop,
               ResourceLoader &_resource_loader);
 
@@ -232,8 +332,43 @@ public:
         return heap.GetStats();
     }
 
+    const CacheCounters &GetCounters() const noexcept {
+        return heap.GetCounters();
+    }
+
+    double GetFragmentation() const noexcept {
+        return heap.GetFragmentation();
+    }
+
     void Flush() noexcept {
         heap.Flush();
+
+        if (shared)
+            shared->Flush();
+
+        if (disk)
+            disk->Flush();
+    }
+
+    void ForkWorker() noexcept {
+        if (shared)
+            shared->Ref();
+    }
+
+    void RemoveWorker(pid_t pid) noexcept {
+        if (shared)
+            shared->RemoveWorker(pid);
+    }
+
+    bool RenewShared(bool force) noexcept;
+
+    /**
+     * Shall a new response for this URL be stored?  This consults
+     * the admission policy of the memory cache, which is the entry
+     * point for all tiers.
+     */
+    bool Admit(const char *url, off_t size) noexcept {
+        return heap.Admit(url, size > 0 ? size_t(size) : 1);
     }
 
     void AddRequest(HttpCacheRequest &r) noexcept {
@@ -253,7 +388,7 @@ public:
                HttpResponseHandler &handler,
                CancellablePointer &cancel_ptr) noexcept;
 
-    void Put(const char *url,
+    void Put(struct pool &tmp_pool, const char *url,
              const HttpCacheResponseInfo &info,
              StringMap &request_headers,
              http_status_t status,
@@ -261,6 +396,13 @@ public:
              RubberAllocation &&a, size_t size) noexcept {
         LogConcat(4, "HttpCache", "put ", url);
 
+        if (shared)
+            shared->Put(tmp_pool, url, info, request_headers,
+                        status, response_headers,
+                        a
+                        ? ConstBuffer<void>(a.Read(), size)
+                        : ConstBuffer<void>(nullptr, 0));
+
         heap.Put(url, info, request_headers,
                  status, response_headers,
                  std::move(a), size);
@@ -272,6 +414,12 @@ public:
 
     void RemoveURL(const char *url, StringMap &headers) noexcept {
         heap.RemoveURL(url, headers);
+
+        if (shared)
+            shared->Remove(url, headers);
+
+        if (disk)
+            disk->Remove(url);
     }
 
     void Lock(HttpCacheDocument &document) noexcept {
@@ -299,16 +447,78 @@ public:
              CancellablePointer &cancel_ptr) noexcept;
 
     /**
-     * Send the cached document to the caller.
+     * Send the cached document to the caller.  If the client accepts
+     * one of the encoded variants stored with the document, that one
+     * is sent instead of the identity body.
      *
      * Caller pool is left unchanged.
      */
     void Serve(struct pool &caller_pool,
                HttpCacheDocument &document,
                const char *key,
+               const StringMap &request_headers,
                HttpResponseHandler &handler) noexcept;
 
+    /**
+     * @see http_cache_put_encoded()
+     */
+    UnusedIstreamPtr PutEncoded(struct pool &caller_pool,
+                                const ResourceAddress &address,
+                                const StringMap &request_headers,
+                                http_status_t status,
+                                const char *etag,
+                                const char *last_modified,
+                                const char *encoding,
+                                UnusedIstreamPtr body) noexcept;
+
+    void PutEncoded(const char *url,
+                    const StringMap &request_headers,
+                    const char *etag, const char *last_modified,
+                    const char *encoding,
+                    RubberAllocation &&a, size_t size) noexcept {
+        LogConcat(4, "HttpCache", "put ", encoding, " ", url);
+
+        heap.PutEncoded(url, request_headers, etag, last_modified, encoding,
+                        std::move(a), size);
+    }
+
+    void AddEncodeRequest(HttpCacheEncodeRequest &r) noexcept {
+        encode_requests.push_front(r);
+    }
+
+    void RemoveEncodeRequest(HttpCacheEncodeRequest &r) noexcept {
+        encode_requests.erase(encode_requests.iterator_to(r));
+    }
+
 private:
+    /**
+     * Look up the resource in the shared memory cache, and serve it
+     * if it was found.
+     *
+     * Caller pool is left unchanged.
+     *
+     * @return true if the request has been handled
+     */
+    bool ServeShared(struct pool &caller_pool,
+                     HttpCacheRequestInfo &info,
+                     const char *key,
+                     const StringMap &headers,
+                     HttpResponseHandler &handler) noexcept;
+
+    /**
+     * Look up the resource in the disk cache, and serve it if it was
+     * found.
+     *
+     * Caller pool is left unchanged.
+     *
+     * @return true if the request has been handled
+     */
+    bool ServeDisk(struct pool &caller_pool,
+                   HttpCacheRequestInfo &info,
+                   const char *key,
+                   const StringMap &headers,
+                   HttpResponseHandler &handler) noexcept;
+
     /**
      * A resource was not found in the cache.
      *
@@ -408,7 +618,7 @@ HttpCacheRequest::GetEventLoop() const noexcept
 void
 HttpCacheRequest::Put(RubberAllocation &&a, size_t size) noexcept
 {
-    cache.Put(key, info, headers,
+    cache.Put(pool, key, info, headers,
               response.status, *response.headers,
               std::move(a), size);
 }
@@ -526,6 +736,16 @@ HttpCacheRequest::OnHttpResponse(http_status_t status, StringMap &&_headers,
         return;
     }
 
+    if (!cache.Admit(key, available)) {
+        /* the admission policy predicts that this response won't be
+           requested again soon; don't waste Rubber memory on it */
+        LogConcat(4, "HttpCache", "reject ", key);
+
+        handler.InvokeResponse(status, std::move(_headers), std::move(body));
+        Destroy();
+        return;
+    }
+
     response.status = status;
     response.headers = strmap_dup(pool, &_headers);
 
@@ -634,13 +854,19 @@ HttpCacheRequest::HttpCacheRequest(PoolPtr &&_pool,
 }
 
 inline
-HttpCache::HttpCache(struct pool &_pool, size_t max_size,
+HttpCache::HttpCache(struct pool &_pool, size_t max_size, CachePolicy policy,
+                     size_t _shared_size, const char *disk_path, size_t disk_size,
                      EventLoop &_event_loop,
                      ResourceLoader &_resource_loader)
     :pool(pool_new_libc(&_pool, "http_cache")),
      event_loop(_event_loop),
      compress_timer(event_loop, BIND_THIS_METHOD(OnCompressTimer)),
-     heap(pool, event_loop, max_size),
+     disk(disk_path != nullptr
+          ? new HttpCacheDisk(_event_loop, disk_path, disk_size)
+          : nullptr),
+     heap(pool, event_loop, max_size, policy, disk.get()),
+     shared(_shared_size > 0 ? new HttpCacheShared(_shared_size) : nullptr),
+     shared_size(_shared_size),
      resource_loader(_resource_loader)
 {
     assert(max_size > 0);
@@ -649,16 +875,38 @@ HttpCache::HttpCache(struct pool &_pool, size_t max_size,
 }
 
 HttpCache *
-http_cache_new(struct pool &pool, size_t max_size,
+http_cache_new(struct pool &pool, size_t max_size, CachePolicy policy,
+               size_t shared_size, const char *disk_path, size_t disk_size,
                EventLoop &event_loop,
                ResourceLoader &resource_loader)
 {
     assert(max_size > 0);
 
-    return new HttpCache(pool, max_size,
+    return new HttpCache(pool, max_size, policy, shared_size,
+                         disk_path, disk_size,
                          event_loop, resource_loader);
 }
 
+bool
+HttpCache::RenewShared(bool force) noexcept
+{
+    if (!shared || (!force && !shared->IsAbandoned()))
+        return false;
+
+    LogConcat(1, "HttpCache", "abandoning shared memory");
+
+    shared.reset();
+
+    try {
+        shared.reset(new HttpCacheShared(shared_size));
+    } catch (...) {
+        LogConcat(1, "HttpCache", "failed to create shared memory: ",
+                  std::current_exception());
+    }
+
+    return true;
+}
+
 void
 HttpCacheRequest::RubberStoreFinished() noexcept
 {
@@ -680,6 +928,7 @@ inline
 HttpCache::~HttpCache() noexcept
 {
     requests.clear_and_dispose(std::mem_fn(&HttpCacheRequest::AbortRubberStore));
+    encode_requests.clear_and_dispose(std::mem_fn(&HttpCacheEncodeRequest::Abort));
 
     background.AbortAll();
 }
@@ -702,12 +951,42 @@ http_cache_get_stats(const HttpCache &cache) noexcept
     return cache.GetStats();
 }
 
+const CacheCounters &
+http_cache_get_counters(const HttpCache &cache) noexcept
+{
+    return cache.GetCounters();
+}
+
+double
+http_cache_get_fragmentation(const HttpCache &cache) noexcept
+{
+    return cache.GetFragmentation();
+}
+
 void
 http_cache_flush(HttpCache &cache) noexcept
 {
     cache.Flush();
 }
 
+void
+http_cache_fork_worker(HttpCache &cache) noexcept
+{
+    cache.ForkWorker();
+}
+
+void
+http_cache_remove_worker(HttpCache &cache, pid_t pid) noexcept
+{
+    cache.RemoveWorker(pid);
+}
+
+bool
+http_cache_renew_shared(HttpCache &cache, bool force) noexcept
+{
+    return cache.RenewShared(force);
+}
+
 void
 HttpCache::Miss(struct pool &caller_pool,
                 sticky_hash_t session_sticky,
@@ -842,8 +1121,31 @@ void
 HttpCache::Serve(struct pool &caller_pool,
                  HttpCacheDocument &document,
                  const char *key,
+                 const StringMap &request_headers,
                  HttpResponseHandler &handler) noexcept
 {
+    const char *encoding = heap.SelectEncoding(document, request_headers);
+    if (encoding != nullptr) {
+        LogConcat(4, "HttpCache", "serve ", encoding, " ", key);
+
+        StringMap response_headers(ShallowCopy(), caller_pool,
+                                   document.response_headers);
+        response_headers.Add("content-encoding", encoding);
+
+        const char *vary = response_headers.Remove("vary");
+        response_headers.Add("vary",
+                             vary != nullptr
+                             ? p_strcat(&caller_pool, vary,
+                                        ", accept-encoding", nullptr)
+                             : "accept-encoding");
+
+        handler.InvokeResponse(document.status,
+                               std::move(response_headers),
+                               heap.OpenEncodedStream(caller_pool, document,
+                                                      encoding));
+        return;
+    }
+
     LogConcat(4, "HttpCache", "serve ", key);
 
     handler.InvokeResponse(document.status,
@@ -852,6 +1154,108 @@ HttpCache::Serve(struct pool &caller_pool,
                            heap.OpenStream(caller_pool, document));
 }
 
+/*
+ * HttpCacheEncodeRequest
+ *
+ */
+
+inline void
+HttpCacheEncodeRequest::Finish() noexcept
+{
+    assert(cancel_ptr);
+
+    cancel_ptr = nullptr;
+    cache.RemoveEncodeRequest(*this);
+}
+
+void
+HttpCacheEncodeRequest::RubberDone(RubberAllocation &&a, size_t size) noexcept
+{
+    Finish();
+
+    cache.PutEncoded(key, request_headers, etag, last_modified, encoding,
+                     std::move(a), size);
+    Destroy();
+}
+
+void
+HttpCacheEncodeRequest::RubberOutOfMemory() noexcept
+{
+    LogConcat(4, "HttpCache", "nocache oom ", encoding, " ", key);
+
+    Finish();
+    Destroy();
+}
+
+void
+HttpCacheEncodeRequest::RubberTooLarge() noexcept
+{
+    LogConcat(4, "HttpCache", "nocache too large ", encoding, " ", key);
+
+    Finish();
+    Destroy();
+}
+
+void
+HttpCacheEncodeRequest::RubberError(std::exception_ptr ep) noexcept
+{
+    LogConcat(4, "HttpCache", "body_abort ", encoding, " ", key, ": ", ep);
+
+    Finish();
+    Destroy();
+}
+
+UnusedIstreamPtr
+HttpCache::PutEncoded(struct pool &caller_pool,
+                      const ResourceAddress &address,
+                      const StringMap &request_headers,
+                      http_status_t status,
+                      const char *etag, const char *last_modified,
+                      const char *encoding,
+                      UnusedIstreamPtr body) noexcept
+{
+    if (status != HTTP_STATUS_OK ||
+        request_headers.Get("range") != nullptr)
+        /* a partial (or error) body must not replace the encoded
+           variant of the whole resource */
+        return body;
+
+    if (etag == nullptr && last_modified == nullptr)
+        /* without validators, we cannot be sure which cache item
+           this body was generated from */
+        return body;
+
+    const char *key = http_cache_key(caller_pool, address);
+    if (key == nullptr ||
+        !heap.WantEncoded(key, request_headers, etag, last_modified,
+                          encoding))
+        return body;
+
+    auto request_pool = pool_new_linear(pool, "HttpCacheEncodeRequest", 1024);
+    auto request =
+        NewFromPool<HttpCacheEncodeRequest>(std::move(request_pool), *this,
+                                            key, request_headers,
+                                            etag, last_modified,
+                                            encoding);
+
+    auto tee = istream_tee_new(request->GetPool(), std::move(body),
+                               GetEventLoop(),
+                               false, false,
+                               /* just in case our caller closes
+                                  the body without looking at it:
+                                  defer an Istream::Read() call for
+                                  the Rubber sink */
+                               true);
+
+    AddEncodeRequest(*request);
+
+    sink_rubber_new(request->GetPool(), std::move(tee.second),
+                    GetRubber(), cacheable_size_limit,
+                    *request, request->cancel_ptr);
+
+    return std::move(tee.first);
+}
+
 /**
  * Send the cached document to the caller.
  *
@@ -863,7 +1267,7 @@ HttpCacheRequest::Serve() noexcept
     if (!CheckCacheRequest(pool, request_info, *document, handler))
         return;
 
-    cache.Serve(caller_pool, *document, key, handler);
+    cache.Serve(caller_pool, *document, key, headers, handler);
 }
 
 void
@@ -939,7 +1343,7 @@ HttpCache::Found(HttpCacheRequestInfo &info,
     if (http_cache_may_serve(GetEventLoop(), info, document))
         Serve(caller_pool, document,
               http_cache_key(caller_pool, address),
-              handler);
+              headers, handler);
     else
         Revalidate(caller_pool, session_sticky, cache_tag, site_name,
                    info, document,
@@ -947,6 +1351,67 @@ HttpCache::Found(HttpCacheRequestInfo &info,
                    handler, cancel_ptr);
 }
 
+bool
+HttpCache::ServeShared(struct pool &caller_pool,
+                       HttpCacheRequestInfo &info,
+                       const char *key,
+                       const StringMap &headers,
+                       HttpResponseHandler &handler) noexcept
+{
+    auto *item = shared->Get(key, headers, GetEventLoop().SystemNow());
+    if (item == nullptr)
+        return false;
+
+    HttpCacheDocument *document;
+
+    try {
+        document = HttpCacheShared::MakeDocument(caller_pool, *item);
+    } catch (const DeserializeError &) {
+        shared->Unref(*item);
+        return false;
+    }
+
+    if (!CheckCacheRequest(caller_pool, info, *document, handler)) {
+        shared->Unref(*item);
+        return true;
+    }
+
+    LogConcat(4, "HttpCache", "serve shared ", key);
+
+    handler.InvokeResponse(document->status,
+                           StringMap(ShallowCopy(), caller_pool,
+                                     document->response_headers),
+                           shared->OpenStream(caller_pool, *item));
+    return true;
+}
+
+bool
+HttpCache::ServeDisk(struct pool &caller_pool,
+                     HttpCacheRequestInfo &info,
+                     const char *key,
+                     const StringMap &headers,
+                     HttpResponseHandler &handler) noexcept
+{
+    auto item = disk->Get(caller_pool, key, headers,
+                          GetEventLoop().SystemNow());
+    if (!item)
+        return false;
+
+    const auto &document = *item.document;
+    if (!CheckCacheRequest(caller_pool, info, document, handler))
+        return true;
+
+    LogConcat(4, "HttpCache", "serve disk ", key);
+
+    handler.InvokeResponse(document.status,
+                           StringMap(ShallowCopy(), caller_pool,
+                                     document.response_headers),
+                           HttpCacheDisk::OpenStream(GetEventLoop(),
+                                                     caller_pool,
+                                                     std::move(item)));
+    return true;
+}
+
 void
 HttpCache::Use(struct pool &caller_pool, sticky_hash_t session_sticky,
                const char *cache_tag,
@@ -958,7 +1423,16 @@ HttpCache::Use(struct pool &caller_pool, sticky_hash_t session_sticky,
                HttpResponseHandler &handler,
                CancellablePointer &cancel_ptr) noexcept
 {
-    auto *document = heap.Get(http_cache_key(caller_pool, address), headers);
+    const char *key = http_cache_key(caller_pool, address);
+    auto *document = heap.Get(key, headers);
+
+    if (document == nullptr && shared &&
+        ServeShared(caller_pool, info, key, headers, handler))
+        return;
+
+    if (document == nullptr && disk &&
+        ServeDisk(caller_pool, info, key, headers, handler))
+        return;
 
     if (document == nullptr)
         Miss(caller_pool, session_sticky, cache_tag, site_name, info,
@@ -1020,6 +1494,20 @@ HttpCache::Start(struct pool &caller_pool, sticky_hash_t session_sticky,
     }
 }
 
+UnusedIstreamPtr
+http_cache_put_encoded(HttpCache &cache, struct pool &pool,
+                       const ResourceAddress &address,
+                       const StringMap &request_headers,
+                       http_status_t status,
+                       const char *etag, const char *last_modified,
+                       const char *encoding,
+                       UnusedIstreamPtr body) noexcept
+{
+    return cache.PutEncoded(pool, address, request_headers, status,
+                            etag, last_modified,
+                            encoding, std::move(body));
+}
+
 void
 http_cache_request(HttpCache &cache,
                    struct pool &pool, sticky_hash_t session_sticky,
@@ -34,10 +34,13 @@
 #define BENG_PROXY_HTTP_CACHE_H
 
 #include "StickyHash.hxx"
+#include "CachePolicy.hxx"
 #include "http/Method.h"
+#include "http/Status.h"
 #include "util/Compiler.h"
 
 #include <stddef.h>
+#include <sys/types.h>
 
 struct pool;
 class UnusedIstreamPtr;
@@ -47,14 +50,25 @@ struct ResourceAddress;
 class StringMap;
 class HttpResponseHandler;
 struct AllocatorStats;
+struct CacheCounters;
 class HttpCache;
 class CancellablePointer;
 
 /**
  * Caching HTTP responses.
+ *
+ * @param policy the eviction/admission policy of the memory cache
+ * @param shared_size the size of the second-tier cache in shared
+ * memory (which is shared by all worker processes forked from this
+ * one); 0 disables it
+ * @param disk_path the directory of the second-tier cache on disk
+ * which receives items evicted from the memory cache; nullptr
+ * disables it
+ * @param disk_size the maximum size of the disk cache
  */
 HttpCache *
-http_cache_new(struct pool &pool, size_t max_size,
+http_cache_new(struct pool &pool, size_t max_size, CachePolicy policy,
+               size_t shared_size, const char *disk_path, size_t disk_size,
                EventLoop &event_loop,
                ResourceLoader &resource_loader);
 
@@ -68,9 +82,82 @@ gcc_pure
 AllocatorStats
 http_cache_get_stats(const HttpCache &cache) noexcept;
 
+/**
+ * Returns the hit/miss counters of the memory cache.
+ */
+gcc_pure
+const CacheCounters &
+http_cache_get_counters(const HttpCache &cache) noexcept;
+
+/**
+ * Returns the fraction of the memory cache's #Rubber allocator
+ * which is occupied by holes.
+ */
+gcc_pure
+double
+http_cache_get_fragmentation(const HttpCache &cache) noexcept;
+
 void
 http_cache_flush(HttpCache &cache) noexcept;
 
+/**
+ * Notify the cache that the current process is a new worker process
+ * which was just forked.
+ */
+void
+http_cache_fork_worker(HttpCache &cache) noexcept;
+
+/**
+ * Notify the cache that a worker process has exited, to release
+ * all shared resources it may still have held.
+ */
+void
+http_cache_remove_worker(HttpCache &cache, pid_t pid) noexcept;
+
+/**
+ * Check whether the shared memory cache has been abandoned (because a
+ * worker has crashed while holding its lock), and if so, replace it
+ * with a new one.
+ *
+ * @param force replace it even if it has not been abandoned,
+ * because a worker has crashed and may have corrupted it
+ * @return true if the shared memory has been replaced; all workers
+ * still using the old one need to be restarted
+ */
+bool
+http_cache_renew_shared(HttpCache &cache, bool force) noexcept;
+
+/**
+ * Store an encoded variant of a cached response.  The caller has
+ * received the response from this cache and compressed it; this
+ * function copies the compressed body into the cache item with the
+ * given validators, which will then be served to clients accepting
+ * this encoding, without compressing it again.
+ *
+ * Nothing is stored unless the status is "200 OK" and the request
+ * was not a "Range" request, because a partial body is not a
+ * variant of the whole resource.
+ *
+ * @param request_headers the request headers which were passed to
+ * http_cache_request(); they select the variant if the response
+ * has a "Vary" header
+ * @param status the status of the response
+ * @param etag the "ETag" header of the (identity) response
+ * @param last_modified the "Last-Modified" header of the (identity)
+ * response
+ * @param encoding the "Content-Encoding" of the body
+ * @return the body which shall be sent to the client (may be the
+ * given one if there is nothing to store)
+ */
+UnusedIstreamPtr
+http_cache_put_encoded(HttpCache &cache, struct pool &pool,
+                       const ResourceAddress &address,
+                       const StringMap &request_headers,
+                       http_status_t status,
+                       const char *etag, const char *last_modified,
+                       const char *encoding,
+                       UnusedIstreamPtr body) noexcept;
+
 /**
  * @param session_sticky a portion of the session id that is used to
  * select the worker; 0 means disable stickiness
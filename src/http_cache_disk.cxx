@@ -0,0 +1,795 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "http_cache_disk.hxx"
+#include "http_cache_document.hxx"
+#include "http_cache_serialize.hxx"
+#include "serialize.hxx"
+#include "strmap.hxx"
+#include "GrowingBuffer.hxx"
+#include "RobustMutex.hxx"
+#include "thread_pool.hxx"
+#include "thread_queue.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/FileIstream.hxx"
+#include "istream/FailIstream.hxx"
+#include "istream/istream_null.hxx"
+#include "pool/pool.hxx"
+#include "system/Error.hxx"
+#include "io/Logger.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The number of sub directories, to keep the size of each directory
+ * small.  The sub directory name is the first byte of the hash.
+ */
+static constexpr unsigned N_DIRECTORIES = 256;
+
+/**
+ * Objects larger than this fraction of the cache size are not
+ * stored, because they would evict too many other objects.
+ */
+static constexpr unsigned MAX_OBJECT_FRACTION = 16;
+
+/**
+ * An upper limit for the header size, to refuse corrupt files.
+ */
+static constexpr size_t MAX_METADATA_SIZE = 1024 * 1024;
+
+/**
+ * Temporary files older than this are assumed to be left over from a
+ * crashed process.
+ */
+static constexpr time_t STALE_TMP_AGE = 3600;
+
+struct HttpCacheDiskHeader {
+    /**
+     * This value changes whenever the file format changes; files
+     * with a different value are discarded.
+     */
+    static constexpr uint32_t MAGIC = 0x42504332; /* "BPC2" */
+
+    /**
+     * The magic of a "Vary" marker file: the metadata consists of
+     * the key and the "Vary" request headers, and there is no
+     * document and no body.
+     */
+    static constexpr uint32_t VARY_MAGIC = 0x42505631; /* "BPV1" */
+
+    uint32_t magic;
+
+    /**
+     * The size of the serialized key, "Vary" and document following
+     * this header.
+     */
+    uint32_t metadata_size;
+
+    /**
+     * The size of the response body following the metadata.
+     */
+    uint64_t body_size;
+};
+
+/**
+ * The disk usage shared by all processes.
+ */
+struct HttpCacheDiskUsage {
+    /** this lock protects all of the following attributes */
+    RobustMutex mutex;
+
+    /**
+     * The total size of all cache files.
+     */
+    uint64_t size = 0;
+
+    void Add(uint64_t delta) noexcept {
+        size += delta;
+    }
+
+    void Subtract(uint64_t delta) noexcept {
+        size = size > delta ? size - delta : 0;
+    }
+};
+
+class ScopeUsageLock {
+    HttpCacheDiskUsage &usage;
+
+public:
+    explicit ScopeUsageLock(HttpCacheDiskUsage &_usage) noexcept
+        :usage(_usage) {
+        /* if the previous owner has died, the counter may be a bit
+           off, but that is harmless */
+        usage.mutex.Lock();
+    }
+
+    ~ScopeUsageLock() noexcept {
+        usage.mutex.Unlock();
+    }
+
+    ScopeUsageLock(const ScopeUsageLock &) = delete;
+    ScopeUsageLock &operator=(const ScopeUsageLock &) = delete;
+};
+
+static HttpCacheDiskUsage *
+NewUsage()
+{
+    void *p = mmap(nullptr, sizeof(HttpCacheDiskUsage),
+                   PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw MakeErrno("mmap() failed");
+
+    return new(p) HttpCacheDiskUsage();
+}
+
+static void
+DeleteUsage(HttpCacheDiskUsage *usage) noexcept
+{
+    usage->~HttpCacheDiskUsage();
+    munmap(usage, sizeof(*usage));
+}
+
+/**
+ * Delete a file and subtract its size from the total disk usage.
+ */
+static void
+UnlinkAccounted(HttpCacheDiskUsage &usage, int dir_fd,
+                const char *path) noexcept
+{
+    const ScopeUsageLock lock(usage);
+
+    struct stat st;
+    if (fstatat(dir_fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+        unlinkat(dir_fd, path, 0) == 0)
+        usage.Subtract(st.st_size);
+}
+
+static void
+UnlinkAccounted(HttpCacheDiskUsage &usage, const char *path) noexcept
+{
+    UnlinkAccounted(usage, AT_FDCWD, path);
+}
+
+static constexpr char TMP_PREFIX[] = ".tmp-";
+
+static bool
+IsTmpFile(const char *name) noexcept
+{
+    return memcmp(name, TMP_PREFIX, sizeof(TMP_PREFIX) - 1) == 0;
+}
+
+/**
+ * Parse a file name generated by HttpCacheDisk::MakePath().
+ *
+ * @return false if the name is malformed
+ */
+static bool
+ParseHash(const char *name, uint64_t &hash_r) noexcept
+{
+    char *endptr;
+    hash_r = strtoull(name, &endptr, 16);
+    return endptr == name + 16 && *endptr == 0;
+}
+
+/**
+ * Build the key of a "Vary" variant: the plain key followed by the
+ * values of the request headers listed in #vary.
+ *
+ * @param vary the "Vary" request headers; only the names are used
+ */
+static std::string
+MakeVariantKey(const char *key, const StringMap &vary,
+               const StringMap &request_headers) noexcept
+{
+    std::string result(key);
+
+    for (const auto &i : vary) {
+        const char *value = request_headers.Get(i.key);
+        if (value == nullptr)
+            value = "";
+
+        result.push_back('\n');
+        result.append(i.key);
+        result.push_back('=');
+        result.append(value);
+    }
+
+    return result;
+}
+
+/**
+ * Invoke a function for each file in each sub directory.  Errors are
+ * ignored.
+ */
+template<typename F>
+static void
+ForEachFile(const std::string &base, F &&f) noexcept
+{
+    for (unsigned i = 0; i < N_DIRECTORIES; ++i) {
+        char name[4];
+        snprintf(name, sizeof(name), "%02x", i);
+
+        const std::string dir_path = base + "/" + name;
+        DIR *dir = opendir(dir_path.c_str());
+        if (dir == nullptr)
+            continue;
+
+        while (const auto *e = readdir(dir))
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+                f(dirfd(dir), e->d_name);
+
+        closedir(dir);
+    }
+}
+
+static void
+MakeDirectory(const char *path)
+{
+    if (mkdir(path, 0700) < 0 && errno != EEXIST)
+        throw FormatErrno("Failed to create directory %s", path);
+}
+
+static bool
+WriteFull(FileDescriptor fd, ConstBuffer<void> src) noexcept
+{
+    const uint8_t *p = (const uint8_t *)src.data;
+    size_t remaining = src.size;
+
+    while (remaining > 0) {
+        ssize_t nbytes = fd.Write(p, remaining);
+        if (nbytes <= 0)
+            return false;
+
+        p += nbytes;
+        remaining -= nbytes;
+    }
+
+    return true;
+}
+
+/**
+ * Build the contents of a cache file in one buffer.
+ */
+static std::unique_ptr<uint8_t[]>
+MakeFile(uint32_t magic, GrowingBuffer &metadata, ConstBuffer<void> body,
+         size_t &size_r) noexcept
+{
+    HttpCacheDiskHeader header;
+    header.magic = magic;
+    header.metadata_size = metadata.GetSize();
+    header.body_size = body.size;
+
+    size_r = sizeof(header) + header.metadata_size + body.size;
+    std::unique_ptr<uint8_t[]> data(new uint8_t[size_r]);
+
+    uint8_t *p = data.get();
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    while (true) {
+        const auto b = metadata.Read();
+        if (b.IsNull())
+            break;
+
+        memcpy(p, b.data, b.size);
+        p += b.size;
+        metadata.Consume(b.size);
+    }
+
+    if (body.size > 0)
+        memcpy(p, body.data, body.size);
+
+    return data;
+}
+
+HttpCacheDisk::WriteJob::WriteJob(HttpCacheDisk &_disk, uint64_t _hash,
+                                  std::string &&_tmp_path,
+                                  std::string &&_final_path,
+                                  std::unique_ptr<uint8_t[]> &&_data,
+                                  size_t _size) noexcept
+    :disk(&_disk), usage(*_disk.usage), hash(_hash),
+     tmp_path(std::move(_tmp_path)), final_path(std::move(_final_path)),
+     data(std::move(_data)), size(_size) {}
+
+void
+HttpCacheDisk::WriteJob::Run() noexcept
+{
+    /* write to a temporary file first, and rename it when it is
+       complete, so other processes never see a partial file */
+
+    UniqueFileDescriptor fd;
+    if (!fd.Open(tmp_path.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0600)) {
+        LogConcat(2, "HttpCacheDisk", "Failed to create ", tmp_path.c_str(),
+                  ": ", strerror(errno));
+        return;
+    }
+
+    if (!WriteFull(fd, ConstBuffer<void>(data.get(), size))) {
+        LogConcat(2, "HttpCacheDisk", "Failed to write ", tmp_path.c_str(),
+                  ": ", strerror(errno));
+        ::unlink(tmp_path.c_str());
+        return;
+    }
+
+    fd.Close();
+
+    /* the usage lock is held while replacing the old file, so its
+       size is subtracted exactly once, even if other processes
+       replace or delete it at the same time */
+    const ScopeUsageLock lock(usage);
+
+    struct stat st;
+    const off_t old_size = lstat(final_path.c_str(), &st) == 0
+        ? st.st_size
+        : 0;
+
+    if (rename(tmp_path.c_str(), final_path.c_str()) < 0) {
+        LogConcat(2, "HttpCacheDisk", "Failed to rename ", tmp_path.c_str(),
+                  ": ", strerror(errno));
+        ::unlink(tmp_path.c_str());
+        return;
+    }
+
+    usage.Subtract(old_size);
+    usage.Add(size);
+    success = true;
+}
+
+void
+HttpCacheDisk::WriteJob::Done() noexcept
+{
+    if (disk == nullptr) {
+        /* the HttpCacheDisk has been destroyed meanwhile */
+        delete this;
+        return;
+    }
+
+    disk->OnWriteDone(*this);
+}
+
+HttpCacheDisk::HttpCacheDisk(EventLoop &_event_loop, const char *_path,
+                             size_t _max_size)
+    :event_loop(_event_loop), path(_path), max_size(_max_size),
+     usage(NewUsage())
+{
+    try {
+        MakeDirectory(path.c_str());
+
+        for (unsigned i = 0; i < N_DIRECTORIES; ++i) {
+            char name[4];
+            snprintf(name, sizeof(name), "%02x", i);
+            MakeDirectory((path + "/" + name).c_str());
+        }
+    } catch (...) {
+        DeleteUsage(usage);
+        throw;
+    }
+
+    Load();
+}
+
+HttpCacheDisk::~HttpCacheDisk() noexcept
+{
+    bool orphaned = false;
+    writes.clear_and_dispose([this, &orphaned](WriteJob *job){
+            if (thread_queue_cancel(*queue, *job)) {
+                delete job;
+            } else {
+                /* a worker thread is still working on it; it will
+                   delete itself when it is done */
+                job->disk = nullptr;
+                orphaned = true;
+            }
+        });
+
+    sorted_entries.clear();
+    entries.clear_and_dispose([](Entry *entry){
+            delete entry;
+        });
+
+    if (!orphaned)
+        /* (if there are orphaned jobs, the usage object must be kept,
+           because they still access it) */
+        DeleteUsage(usage);
+}
+
+uint64_t
+HttpCacheDisk::GetSize() const noexcept
+{
+    const ScopeUsageLock lock(*usage);
+    return usage->size;
+}
+
+uint64_t
+HttpCacheDisk::Hash(const char *key) noexcept
+{
+    /* 64 bit FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *key != 0; ++key) {
+        hash ^= (uint8_t)*key;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+std::string
+HttpCacheDisk::MakePath(uint64_t hash) const noexcept
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "/%02x/%016llx",
+             unsigned(hash >> 56), (unsigned long long)hash);
+    return path + buffer;
+}
+
+void
+HttpCacheDisk::Load() noexcept
+{
+    struct LoadedEntry {
+        time_t mtime;
+        uint64_t hash;
+
+        bool operator<(const LoadedEntry &other) const noexcept {
+            return mtime < other.mtime;
+        }
+    };
+
+    std::vector<LoadedEntry> loaded;
+    uint64_t total_size = 0;
+    const time_t now = time(nullptr);
+
+    ForEachFile(path, [&loaded, &total_size, now](int dir_fd, const char *name){
+            struct stat st;
+            if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                !S_ISREG(st.st_mode))
+                return;
+
+            uint64_t hash;
+            if (IsTmpFile(name)) {
+                if (st.st_mtime + STALE_TMP_AGE < now)
+                    unlinkat(dir_fd, name, 0);
+            } else if (ParseHash(name, hash)) {
+                loaded.push_back({st.st_mtime, hash});
+                total_size += st.st_size;
+            }
+        });
+
+    /* the least recently modified files will be evicted first */
+    std::sort(loaded.begin(), loaded.end());
+
+    for (const auto &i : loaded)
+        Add(i.hash);
+
+    {
+        const ScopeUsageLock lock(*usage);
+        usage->size = total_size;
+    }
+
+    LogConcat(4, "HttpCacheDisk", "loaded ", unsigned(loaded.size()),
+              " files from ", path.c_str());
+
+    Evict();
+}
+
+void
+HttpCacheDisk::Add(uint64_t hash) noexcept
+{
+    auto *entry = new Entry(hash);
+    entries.insert(*entry);
+    sorted_entries.push_back(*entry);
+}
+
+void
+HttpCacheDisk::Touch(uint64_t hash) noexcept
+{
+    auto i = entries.find(hash, Entry::Compare());
+    if (i == entries.end()) {
+        Add(hash);
+        return;
+    }
+
+    /* move to the end of the list */
+    sorted_entries.erase(sorted_entries.iterator_to(*i));
+    sorted_entries.push_back(*i);
+}
+
+void
+HttpCacheDisk::DisposeEntry(Entry &entry) noexcept
+{
+    entries.erase(entries.iterator_to(entry));
+    sorted_entries.erase(sorted_entries.iterator_to(entry));
+    delete &entry;
+}
+
+void
+HttpCacheDisk::Forget(uint64_t hash) noexcept
+{
+    auto i = entries.find(hash, Entry::Compare());
+    if (i != entries.end())
+        DisposeEntry(*i);
+}
+
+void
+HttpCacheDisk::Unlink(uint64_t hash) noexcept
+{
+    UnlinkAccounted(*usage, MakePath(hash).c_str());
+    Forget(hash);
+}
+
+void
+HttpCacheDisk::Evict() noexcept
+{
+    while (!sorted_entries.empty() && GetSize() > max_size) {
+        auto &entry = sorted_entries.front();
+        UnlinkAccounted(*usage, MakePath(entry.hash).c_str());
+        DisposeEntry(entry);
+    }
+}
+
+void
+HttpCacheDisk::Write(const char *key, std::unique_ptr<uint8_t[]> &&data,
+                     size_t size) noexcept
+{
+    const uint64_t hash = Hash(key);
+
+    char tmp_name[64];
+    snprintf(tmp_name, sizeof(tmp_name), "/%02x/%s%d-%u",
+             unsigned(hash >> 56), TMP_PREFIX,
+             int(getpid()), ++tmp_counter);
+
+    if (queue == nullptr)
+        queue = &thread_pool_get_queue(event_loop);
+
+    auto *job = new WriteJob(*this, hash, path + tmp_name, MakePath(hash),
+                             std::move(data), size);
+    writes.push_back(*job);
+    thread_queue_add(*queue, *job);
+}
+
+void
+HttpCacheDisk::OnWriteDone(WriteJob &job) noexcept
+{
+    writes.erase(writes.iterator_to(job));
+
+    if (job.success) {
+        if (job.discarded)
+            Unlink(job.hash);
+        else
+            Touch(job.hash);
+
+        Evict();
+    }
+
+    delete &job;
+}
+
+void
+HttpCacheDisk::Discard(uint64_t hash) noexcept
+{
+    for (auto &job : writes)
+        if (job.hash == hash)
+            job.discarded = true;
+}
+
+void
+HttpCacheDisk::Put(const char *key, const HttpCacheDocument &document,
+                   ConstBuffer<void> body) noexcept
+{
+    const bool has_vary = !document.vary.IsEmpty();
+    const std::string variant_key = has_vary
+        ? MakeVariantKey(key, document.vary, document.vary)
+        : std::string(key);
+
+    GrowingBuffer gb;
+    serialize_string(gb, variant_key.c_str());
+    serialize_strmap(gb, document.vary);
+    http_cache_serialize_document(gb, document.info, document.status,
+                                  document.response_headers);
+
+    size_t size;
+    auto data = MakeFile(HttpCacheDiskHeader::MAGIC, gb, body, size);
+    if (size > max_size / MAX_OBJECT_FRACTION)
+        return;
+
+    if (has_vary) {
+        /* the marker tells Get() which request headers select the
+           variant */
+        GrowingBuffer marker;
+        serialize_string(marker, key);
+        serialize_strmap(marker, document.vary);
+
+        size_t marker_size;
+        auto marker_data = MakeFile(HttpCacheDiskHeader::VARY_MAGIC, marker,
+                                    nullptr, marker_size);
+        Write(key, std::move(marker_data), marker_size);
+    }
+
+    LogConcat(5, "HttpCacheDisk", "put ", variant_key.c_str());
+
+    Write(variant_key.c_str(), std::move(data), size);
+}
+
+HttpCacheDiskItem
+HttpCacheDisk::Lookup(struct pool &pool, const char *key,
+                      const StringMap &request_headers,
+                      std::chrono::system_clock::time_point now,
+                      bool follow_vary) noexcept
+{
+    HttpCacheDiskItem item;
+
+    const uint64_t hash = Hash(key);
+    const auto file_path = MakePath(hash);
+
+    if (!item.fd.OpenReadOnly(file_path.c_str())) {
+        /* may have been deleted by another process */
+        Forget(hash);
+        return item;
+    }
+
+    struct stat st;
+    HttpCacheDiskHeader header;
+    if (fstat(item.fd.Get(), &st) < 0 ||
+        pread(item.fd.Get(), &header, sizeof(header), 0) != sizeof(header) ||
+        (header.magic != HttpCacheDiskHeader::MAGIC &&
+         header.magic != HttpCacheDiskHeader::VARY_MAGIC) ||
+        header.metadata_size > MAX_METADATA_SIZE ||
+        off_t(sizeof(header) + header.metadata_size +
+              header.body_size) != st.st_size) {
+        /* corrupt or obsolete file */
+        Unlink(hash);
+        return HttpCacheDiskItem();
+    }
+
+    void *metadata = p_malloc(&pool, header.metadata_size);
+    if (pread(item.fd.Get(), metadata, header.metadata_size,
+              sizeof(header)) != ssize_t(header.metadata_size)) {
+        Unlink(hash);
+        return HttpCacheDiskItem();
+    }
+
+    ConstBuffer<void> input(metadata, header.metadata_size);
+    auto *document = NewFromPool<HttpCacheDocument>(pool, pool);
+
+    try {
+        if (strcmp(deserialize_string(input), key) != 0)
+            /* hash collision */
+            return HttpCacheDiskItem();
+
+        deserialize_strmap(input, document->vary);
+
+        if (header.magic == HttpCacheDiskHeader::VARY_MAGIC) {
+            Touch(hash);
+
+            if (!follow_vary)
+                return HttpCacheDiskItem();
+
+            const auto variant_key = MakeVariantKey(key, document->vary,
+                                                    request_headers);
+            return Lookup(pool, variant_key.c_str(), request_headers, now,
+                          false);
+        }
+
+        http_cache_deserialize_document(input, *document);
+    } catch (const DeserializeError &) {
+        Unlink(hash);
+        return HttpCacheDiskItem();
+    }
+
+    if (document->info.expires < now) {
+        Unlink(hash);
+        return HttpCacheDiskItem();
+    }
+
+    Touch(hash);
+
+    if (!document->VaryFits(&request_headers))
+        return HttpCacheDiskItem();
+
+    item.document = document;
+    item.path = p_strdup(&pool, file_path.c_str());
+    item.body_offset = sizeof(header) + header.metadata_size;
+    item.body_size = header.body_size;
+    return item;
+}
+
+HttpCacheDiskItem
+HttpCacheDisk::Get(struct pool &pool, const char *key,
+                   const StringMap &request_headers,
+                   std::chrono::system_clock::time_point now) noexcept
+{
+    return Lookup(pool, key, request_headers, now, true);
+}
+
+UnusedIstreamPtr
+HttpCacheDisk::OpenStream(EventLoop &event_loop, struct pool &pool,
+                          HttpCacheDiskItem &&item) noexcept
+{
+    assert(item);
+
+    if (item.body_size == 0)
+        return istream_null_new(pool);
+
+    const off_t end = item.body_offset + item.body_size;
+    Istream *istream = istream_file_fd_new(event_loop, pool, item.path,
+                                           std::move(item.fd),
+                                           FdType::FD_FILE, end);
+    UnusedIstreamPtr result(istream);
+
+    if (!istream_file_set_range(*istream, item.body_offset, end)) {
+        const int e = errno;
+        result.Clear();
+        return istream_fail_new(pool,
+                                std::make_exception_ptr(MakeErrno(e, "Failed to seek")));
+    }
+
+    return result;
+}
+
+void
+HttpCacheDisk::Remove(const char *key) noexcept
+{
+    const uint64_t hash = Hash(key);
+    Discard(hash);
+    Unlink(hash);
+}
+
+void
+HttpCacheDisk::Flush() noexcept
+{
+    for (auto &job : writes)
+        job.discarded = true;
+
+    ForEachFile(path, [this](int dir_fd, const char *name){
+            if (!IsTmpFile(name))
+                UnlinkAccounted(*usage, dir_fd, name);
+        });
+
+    sorted_entries.clear();
+    entries.clear_and_dispose([](Entry *entry){
+            delete entry;
+        });
+}
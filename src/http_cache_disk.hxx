@@ -0,0 +1,353 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+
+#ifndef BENG_PROXY_HTTP_CACHE_DISK_HXX
+#define BENG_PROXY_HTTP_CACHE_DISK_HXX
+
+#include "thread_job.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/Compiler.h"
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct pool;
+class EventLoop;
+class ThreadQueue;
+class UnusedIstreamPtr;
+class StringMap;
+struct HttpCacheDocument;
+struct HttpCacheDiskUsage;
+template<typename T> struct ConstBuffer;
+
+/**
+ * A cache file which was opened by HttpCacheDisk::Get().
+ */
+struct HttpCacheDiskItem {
+    /**
+     * The document (allocated from the caller's pool); nullptr on
+     * cache miss.
+     */
+    HttpCacheDocument *document = nullptr;
+
+    const char *path;
+
+    UniqueFileDescriptor fd;
+
+    off_t body_offset, body_size;
+
+    operator bool() const noexcept {
+        return document != nullptr;
+    }
+};
+
+/**
+ * Caching HTTP responses in files on a local disk.  This is a second
+ * tier behind #HttpCacheHeap: it receives items which are evicted
+ * from the heap to make room for new ones, and serves them directly
+ * from the file, allowing splice() to the client socket.
+ *
+ * Each item is stored in a file whose name is derived from the hash
+ * of the cache key; the file starts with a header containing the
+ * key, the "Vary" request headers and the serialized
+ * #HttpCacheDocument, followed by the response body.  Files are
+ * written to a temporary name and then renamed, so readers never see
+ * a partial file, and the cache survives process restarts.
+ *
+ * If the response has a "Vary" header, the file for the plain key
+ * is a small "Vary marker" listing the request header names, and the
+ * document is stored under a key which includes the values of those
+ * request headers.  This way, each variant gets its own file.
+ *
+ * Files are written by a worker thread, to keep the blocking I/O
+ * off the event loop.
+ *
+ * The total disk usage is accounted in memory shared by all worker
+ * processes (see #HttpCacheDiskUsage), and the size limit applies to
+ * the sum.  The LRU index used for choosing the files to be evicted
+ * is kept per process; it is rebuilt from the directory contents by
+ * the constructor and then forked to the workers.
+ */
+class HttpCacheDisk {
+    struct Entry {
+        using LinkMode =
+            boost::intrusive::link_mode<boost::intrusive::normal_link>;
+        using SetHook = boost::intrusive::set_member_hook<LinkMode>;
+        using SiblingsHook = boost::intrusive::list_member_hook<LinkMode>;
+
+        SetHook set_hook;
+
+        /**
+         * This entry's siblings, sorted by last access, oldest
+         * first.
+         */
+        SiblingsHook sorted_siblings;
+
+        const uint64_t hash;
+
+        explicit Entry(uint64_t _hash) noexcept
+            :hash(_hash) {}
+
+        struct Compare {
+            bool operator()(const Entry &a, const Entry &b) const noexcept {
+                return a.hash < b.hash;
+            }
+
+            bool operator()(uint64_t a, const Entry &b) const noexcept {
+                return a < b.hash;
+            }
+
+            bool operator()(const Entry &a, uint64_t b) const noexcept {
+                return a.hash < b;
+            }
+        };
+    };
+
+    /**
+     * Writes one file in a worker thread.
+     */
+    class WriteJob final : public ThreadJob {
+    public:
+        using SiblingsHook =
+            boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>;
+        SiblingsHook siblings;
+
+        /**
+         * The owning object; nullptr if it has been destroyed while
+         * this job was running.
+         */
+        HttpCacheDisk *disk;
+
+        HttpCacheDiskUsage &usage;
+
+        const uint64_t hash;
+
+        const std::string tmp_path, final_path;
+
+        /**
+         * The complete file contents.
+         */
+        const std::unique_ptr<uint8_t[]> data;
+        const size_t size;
+
+        /**
+         * Was the file written successfully?  Set by Run().
+         */
+        bool success = false;
+
+        /**
+         * Shall the file be deleted when the job is done, because
+         * Remove() or Flush() has been called meanwhile?
+         */
+        bool discarded = false;
+
+        WriteJob(HttpCacheDisk &_disk, uint64_t _hash,
+                 std::string &&_tmp_path, std::string &&_final_path,
+                 std::unique_ptr<uint8_t[]> &&_data, size_t _size) noexcept;
+
+        /* virtual methods from class ThreadJob */
+        void Run() noexcept override;
+        void Done() noexcept override;
+    };
+
+    EventLoop &event_loop;
+
+    /**
+     * The thread queue which runs #WriteJob instances.  It is
+     * obtained lazily by the first Put() call, because worker threads
+     * must not be launched before the worker processes are forked.
+     */
+    ThreadQueue *queue = nullptr;
+
+    const std::string path;
+
+    const size_t max_size;
+
+    /**
+     * The total disk usage of all processes; allocated in shared
+     * memory.
+     */
+    HttpCacheDiskUsage *const usage;
+
+    boost::intrusive::set<Entry,
+                          boost::intrusive::member_hook<Entry,
+                                                        Entry::SetHook,
+                                                        &Entry::set_hook>,
+                          boost::intrusive::compare<Entry::Compare>,
+                          boost::intrusive::constant_time_size<false>> entries;
+
+    boost::intrusive::list<Entry,
+                           boost::intrusive::member_hook<Entry,
+                                                         Entry::SiblingsHook,
+                                                         &Entry::sorted_siblings>,
+                           boost::intrusive::constant_time_size<false>> sorted_entries;
+
+    /**
+     * The write jobs which have not yet finished.
+     */
+    boost::intrusive::list<WriteJob,
+                           boost::intrusive::member_hook<WriteJob,
+                                                         WriteJob::SiblingsHook,
+                                                         &WriteJob::siblings>,
+                           boost::intrusive::constant_time_size<false>> writes;
+
+    /**
+     * Used to generate unique temporary file names.
+     */
+    unsigned tmp_counter = 0;
+
+public:
+    /**
+     * Create the directory structure (if it does not exist already)
+     * and load the index of existing files.
+     *
+     * Throws std::system_error on error.
+     */
+    HttpCacheDisk(EventLoop &_event_loop, const char *_path,
+                  size_t _max_size);
+
+    ~HttpCacheDisk() noexcept;
+
+    HttpCacheDisk(const HttpCacheDisk &) = delete;
+    HttpCacheDisk &operator=(const HttpCacheDisk &) = delete;
+
+    /**
+     * Are files still being written?
+     */
+    bool IsWriting() const noexcept {
+        return !writes.empty();
+    }
+
+    /**
+     * Returns the total disk usage of all processes.
+     */
+    gcc_pure
+    uint64_t GetSize() const noexcept;
+
+    /**
+     * Schedule writing an item to disk, replacing the existing item
+     * with the same key (and the same "Vary" request headers).  Older
+     * items may be deleted to make room for it.  The document and
+     * the body are copied, and the caller may free them when this
+     * method returns.
+     */
+    void Put(const char *key, const HttpCacheDocument &document,
+             ConstBuffer<void> body) noexcept;
+
+    /**
+     * Look up a matching, not-yet-expired item and open its file.
+     * Errors are treated as cache misses.
+     */
+    HttpCacheDiskItem Get(struct pool &pool, const char *key,
+                          const StringMap &request_headers,
+                          std::chrono::system_clock::time_point now) noexcept;
+
+    /**
+     * Open an #Istream for the response body of an item returned by
+     * Get().
+     */
+    static UnusedIstreamPtr OpenStream(EventLoop &event_loop,
+                                       struct pool &pool,
+                                       HttpCacheDiskItem &&item) noexcept;
+
+    /**
+     * Remove the item with the given key.  If it has "Vary"
+     * variants, only the "Vary" marker is deleted, which makes all
+     * variants unreachable; their files will eventually be evicted.
+     */
+    void Remove(const char *key) noexcept;
+
+    /**
+     * Delete all files (including those which were written by other
+     * processes).
+     */
+    void Flush() noexcept;
+
+private:
+    gcc_pure
+    static uint64_t Hash(const char *key) noexcept;
+
+    /**
+     * Build the file name for the given key hash.
+     */
+    gcc_pure
+    std::string MakePath(uint64_t hash) const noexcept;
+
+    void Load() noexcept;
+
+    /**
+     * Look up one file.
+     *
+     * @param follow_vary follow a "Vary" marker to the variant
+     * matching the request headers?
+     */
+    HttpCacheDiskItem Lookup(struct pool &pool, const char *key,
+                             const StringMap &request_headers,
+                             std::chrono::system_clock::time_point now,
+                             bool follow_vary) noexcept;
+
+    /**
+     * Schedule a #WriteJob for a file with the given contents.
+     */
+    void Write(const char *key, std::unique_ptr<uint8_t[]> &&data,
+               size_t size) noexcept;
+
+    void OnWriteDone(WriteJob &job) noexcept;
+
+    void Discard(uint64_t hash) noexcept;
+
+    void Add(uint64_t hash) noexcept;
+    void Touch(uint64_t hash) noexcept;
+    void Forget(uint64_t hash) noexcept;
+    void Unlink(uint64_t hash) noexcept;
+
+    void DisposeEntry(Entry &entry) noexcept;
+
+    /**
+     * Delete files until the total disk usage fits into the limit
+     * (or until there are no more files in this process's index).
+     */
+    void Evict() noexcept;
+};
+
+#endif
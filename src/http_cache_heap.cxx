@@ -34,6 +34,7 @@
 #include "http_cache_rfc.hxx"
 #include "http_cache_document.hxx"
 #include "http_cache_age.hxx"
+#include "http_cache_disk.hxx"
 #include "AllocatorStats.hxx"
 #include "istream/UnusedPtr.hxx"
 #include "istream/istream_null.hxx"
@@ -42,12 +43,54 @@
 #include "rubber.hxx"
 #include "pool/pool.hxx"
 #include "pool/Holder.hxx"
+#include "http/PHeaderUtil.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <iterator>
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * The content codings which may be stored as variants of a cached
+ * response, in order of preference.
+ */
+static constexpr const char *http_cache_encodings[] = {
+    "br",
+    "zstd",
+    "gzip",
+    "deflate",
+};
+
+static constexpr size_t N_ENCODINGS = std::size(http_cache_encodings);
+
+gcc_pure
+static int
+FindEncoding(const char *encoding) noexcept
+{
+    for (size_t i = 0; i < N_ENCODINGS; ++i)
+        if (strcmp(http_cache_encodings[i], encoding) == 0)
+            return i;
+
+    return -1;
+}
 
 struct HttpCacheItem final : PoolHolder, HttpCacheDocument, CacheItem {
     size_t size;
 
     const RubberAllocation body;
 
+    /**
+     * Encoded variants of #body, indexed like
+     * #http_cache_encodings.  Each one is an unset allocation unless
+     * a compressed copy has been added with
+     * HttpCacheHeap::PutEncoded().
+     */
+    struct {
+        RubberAllocation body;
+        size_t size = 0;
+    } encoded[N_ENCODINGS];
+
     HttpCacheItem(PoolPtr &&_pool,
                   std::chrono::steady_clock::time_point now,
                   std::chrono::system_clock::time_point system_now,
@@ -76,6 +119,21 @@ struct HttpCacheItem final : PoolHolder, HttpCacheDocument, CacheItem {
                                   0, size, false);
     }
 
+    UnusedIstreamPtr OpenEncodedStream(struct pool &_pool,
+                                       size_t i) noexcept {
+        const auto &e = encoded[i];
+        return istream_rubber_new(_pool, e.body.GetRubber(),
+                                  e.body.GetId(),
+                                  0, e.size, false);
+    }
+
+    ConstBuffer<void> GetBody() const noexcept {
+        if (!body)
+            return nullptr;
+
+        return {body.GetRubber().Read(body.GetId()), size};
+    }
+
     /* virtual methods from class CacheItem */
     void Destroy() noexcept override {
         pool_trash(pool);
@@ -92,6 +150,41 @@ http_cache_item_match(const CacheItem *_item, void *ctx) noexcept
     return item.VaryFits(headers);
 }
 
+gcc_pure
+static bool
+StringIsEqualNullable(const char *a, const char *b) noexcept
+{
+    return a == nullptr
+        ? b == nullptr
+        : b != nullptr && strcmp(a, b) == 0;
+}
+
+struct HttpCacheValidators {
+    const StringMap *request_headers;
+
+    const char *etag, *last_modified;
+};
+
+/**
+ * Match a cache item by the request headers (like
+ * http_cache_item_match()) and by its validators ("ETag" and
+ * "Last-Modified"), i.e. find the item which contains exactly the
+ * response which was seen by the caller.  Variants selected by
+ * "Vary" may share the same validators, so the latter alone are not
+ * enough.
+ */
+static bool
+http_cache_item_match_validators(const CacheItem *_item, void *ctx) noexcept
+{
+    const auto &item = *(const HttpCacheItem *)_item;
+    const auto &v = *(const HttpCacheValidators *)ctx;
+
+    return http_cache_item_match(_item,
+                                 const_cast<StringMap *>(v.request_headers)) &&
+        StringIsEqualNullable(item.info.etag, v.etag) &&
+        StringIsEqualNullable(item.info.last_modified, v.last_modified);
+}
+
 HttpCacheDocument *
 HttpCacheHeap::Get(const char *uri, StringMap &request_headers) noexcept
 {
@@ -120,6 +213,71 @@ HttpCacheHeap::Put(const char *url,
                    http_cache_item_match, &request_headers);
 }
 
+bool
+HttpCacheHeap::WantEncoded(const char *url,
+                           const StringMap &request_headers,
+                           const char *etag, const char *last_modified,
+                           const char *encoding) noexcept
+{
+    assert(etag != nullptr || last_modified != nullptr);
+
+    const int i = FindEncoding(encoding);
+    if (i < 0)
+        return false;
+
+    HttpCacheValidators v{&request_headers, etag, last_modified};
+    auto *item = (HttpCacheItem *)
+        cache.LookupMatch(url, http_cache_item_match_validators, &v);
+    return item != nullptr && item->body && !item->encoded[i].body;
+}
+
+void
+HttpCacheHeap::PutEncoded(const char *url,
+                          const StringMap &request_headers,
+                          const char *etag, const char *last_modified,
+                          const char *encoding,
+                          RubberAllocation &&a, size_t size) noexcept
+{
+    assert(etag != nullptr || last_modified != nullptr);
+
+    const int i = FindEncoding(encoding);
+    if (i < 0 || !a)
+        return;
+
+    HttpCacheValidators v{&request_headers, etag, last_modified};
+    auto *item = (HttpCacheItem *)
+        cache.LookupMatch(url, http_cache_item_match_validators, &v);
+    if (item == nullptr || !item->body || item->encoded[i].body)
+        /* the item has been replaced or removed meanwhile, or
+           another request was faster */
+        return;
+
+    if (size >= item->size)
+        /* compression didn't help, don't bother */
+        return;
+
+    if (!cache.Grow(*item, size))
+        return;
+
+    item->encoded[i].body = std::move(a);
+    item->encoded[i].size = size;
+}
+
+const char *
+HttpCacheHeap::SelectEncoding(const HttpCacheDocument &document,
+                              const StringMap &request_headers) noexcept
+{
+    const auto &item = (const HttpCacheItem &)document;
+
+    for (size_t i = 0; i < N_ENCODINGS; ++i)
+        if (item.encoded[i].body &&
+            http_client_accepts_encoding(request_headers,
+                                         http_cache_encodings[i]))
+            return http_cache_encodings[i];
+
+    return nullptr;
+}
+
 void
 HttpCacheHeap::Remove(HttpCacheDocument &document) noexcept
 {
@@ -146,7 +304,6 @@ void
 HttpCacheHeap::Compress() noexcept
 {
     slice_pool.Compress();
-    rubber.Compress();
 }
 
 void
@@ -186,21 +343,49 @@ HttpCacheHeap::OpenStream(struct pool &_pool,
     return istream_unlock_new(_pool, item.OpenStream(_pool), item);
 }
 
+UnusedIstreamPtr
+HttpCacheHeap::OpenEncodedStream(struct pool &_pool,
+                                 HttpCacheDocument &document,
+                                 const char *encoding) noexcept
+{
+    auto &item = (HttpCacheItem &)document;
+
+    const int i = FindEncoding(encoding);
+    assert(i >= 0);
+    assert(item.encoded[i].body);
+
+    return istream_unlock_new(_pool, item.OpenEncodedStream(_pool, i),
+                              item);
+}
+
 /*
  * cache_class
  *
  */
 
 HttpCacheHeap::HttpCacheHeap(struct pool &_pool, EventLoop &event_loop,
-                             size_t max_size) noexcept
+                             size_t max_size, CachePolicy policy,
+                             HttpCacheDisk *_disk) noexcept
     :pool(_pool),
      slice_pool(1024, 65536),
      rubber(max_size),
+     rubber_compressor(event_loop, rubber),
      /* leave 12.5% of the rubber allocator empty, to increase the
         chances that a hole can be found for a new allocation, to
         reduce the pressure that rubber_compress() creates */
-     cache(event_loop, 65521, max_size * 7 / 8)
+     cache(event_loop, 65521, max_size * 7 / 8, policy),
+     disk(_disk)
 {
+    if (disk != nullptr)
+        cache.SetEvictHandler(BIND_THIS_METHOD(OnCacheEvict));
+}
+
+void
+HttpCacheHeap::OnCacheEvict(CacheItem &_item) noexcept
+{
+    const auto &item = (const HttpCacheItem &)_item;
+
+    disk->Put(item.GetKey(), item, item.GetBody());
 }
 
 AllocatorStats
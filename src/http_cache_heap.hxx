@@ -36,6 +36,7 @@
 #include "cache.hxx"
 #include "SlicePool.hxx"
 #include "rubber.hxx"
+#include "RubberCompressor.hxx"
 #include "http/Status.h"
 #include "util/Compiler.h"
 
@@ -46,6 +47,7 @@ class UnusedIstreamPtr;
 class Rubber;
 class EventLoop;
 class Cache;
+class HttpCacheDisk;
 class StringMap;
 struct AllocatorStats;
 struct HttpCacheResponseInfo;
@@ -61,11 +63,20 @@ class HttpCacheHeap {
 
     Rubber rubber;
 
+    RubberCompressor rubber_compressor;
+
     Cache cache;
 
+    /**
+     * If set, then items evicted from this heap are moved to this
+     * disk cache.
+     */
+    HttpCacheDisk *const disk;
+
 public:
     HttpCacheHeap(struct pool &pool, EventLoop &event_loop,
-                  size_t max_size) noexcept;
+                  size_t max_size, CachePolicy policy=CachePolicy::LRU,
+                  HttpCacheDisk *_disk=nullptr) noexcept;
 
     Rubber &GetRubber() noexcept {
         return rubber;
@@ -76,6 +87,18 @@ public:
     gcc_pure
     AllocatorStats GetStats() const noexcept;
 
+    const CacheCounters &GetCounters() const noexcept {
+        return cache.GetCounters();
+    }
+
+    /**
+     * @see Rubber::GetFragmentation()
+     */
+    gcc_pure
+    double GetFragmentation() const noexcept {
+        return rubber.GetFragmentation();
+    }
+
     HttpCacheDocument *Get(const char *uri,
                            StringMap &request_headers) noexcept;
 
@@ -86,10 +109,55 @@ public:
              const StringMap &response_headers,
              RubberAllocation &&a, size_t size) noexcept;
 
+    /**
+     * Is there a cache item matching the request headers (see
+     * "Vary") with the given validators which does not have the
+     * specified encoded variant yet?  At least one of the validators
+     * must be non-nullptr.
+     */
+    bool WantEncoded(const char *url,
+                     const StringMap &request_headers,
+                     const char *etag, const char *last_modified,
+                     const char *encoding) noexcept;
+
+    /**
+     * Attach an encoded variant (e.g. "gzip") to the cache item
+     * matching the request headers with the given validators.  It
+     * is discarded if there is no such item (anymore).
+     */
+    void PutEncoded(const char *url,
+                    const StringMap &request_headers,
+                    const char *etag, const char *last_modified,
+                    const char *encoding,
+                    RubberAllocation &&a, size_t size) noexcept;
+
+    /**
+     * Choose the best encoded variant of the document which is
+     * accepted by the client.
+     *
+     * @return the "Content-Encoding" value or nullptr if there is no
+     * acceptable variant
+     */
+    gcc_pure
+    static const char *SelectEncoding(const HttpCacheDocument &document,
+                                      const StringMap &request_headers) noexcept;
+
+    /**
+     * @see Cache::Admit()
+     */
+    bool Admit(const char *url, size_t size) noexcept {
+        return cache.Admit(url, size);
+    }
+
     void Remove(HttpCacheDocument &document) noexcept;
     void RemoveURL(const char *url, StringMap &headers) noexcept;
 
+    /**
+     * Compress the slice pool.  The #Rubber allocator is compressed
+     * incrementally by #rubber_compressor.
+     */
     void Compress() noexcept;
+
     void Flush() noexcept;
 
     static void Lock(HttpCacheDocument &document) noexcept;
@@ -97,6 +165,16 @@ public:
 
     UnusedIstreamPtr OpenStream(struct pool &_pool,
                                 HttpCacheDocument &document) noexcept;
+
+    /**
+     * Open the encoded variant returned by SelectEncoding().
+     */
+    UnusedIstreamPtr OpenEncodedStream(struct pool &_pool,
+                                       HttpCacheDocument &document,
+                                       const char *encoding) noexcept;
+
+private:
+    void OnCacheEvict(CacheItem &item) noexcept;
 };
 
 #endif
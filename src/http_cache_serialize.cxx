@@ -0,0 +1,90 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "http_cache_serialize.hxx"
+#include "http_cache_document.hxx"
+#include "serialize.hxx"
+#include "strmap.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <string.h>
+
+void
+http_cache_serialize_document(GrowingBuffer &gb,
+                              const HttpCacheResponseInfo &info,
+                              http_status_t status,
+                              const StringMap &response_headers)
+{
+    serialize_uint16(gb, status);
+    serialize_uint64(gb, std::chrono::system_clock::to_time_t(info.expires));
+    serialize_string_null(gb, info.last_modified);
+    serialize_string_null(gb, info.etag);
+    serialize_string_null(gb, info.vary);
+    serialize_strmap(gb, response_headers);
+}
+
+void
+http_cache_deserialize_document(ConstBuffer<void> &input,
+                                HttpCacheDocument &document)
+{
+    document.status = http_status_t(deserialize_uint16(input));
+    document.info.expires =
+        std::chrono::system_clock::from_time_t(deserialize_uint64(input));
+    document.info.last_modified = deserialize_string_null(input);
+    document.info.etag = deserialize_string_null(input);
+    document.info.vary = deserialize_string_null(input);
+    deserialize_strmap(input, document.response_headers);
+}
+
+bool
+http_cache_serialized_vary_fits(ConstBuffer<void> vary,
+                                const StringMap &request_headers) noexcept
+{
+    try {
+        while (true) {
+            const char *name = deserialize_string(vary);
+            if (*name == 0)
+                return true;
+
+            const char *value = deserialize_string(vary);
+            const char *request_value = request_headers.Get(name);
+            if (request_value == nullptr)
+                request_value = "";
+
+            if (strcmp(value, request_value) != 0)
+                return false;
+        }
+    } catch (const DeserializeError &) {
+        return false;
+    }
+}
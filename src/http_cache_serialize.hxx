@@ -0,0 +1,77 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Serialize #HttpCacheDocument objects for the cache tiers which live
+ * outside of the process heap.
+ */
+
+#ifndef BENG_PROXY_HTTP_CACHE_SERIALIZE_HXX
+#define BENG_PROXY_HTTP_CACHE_SERIALIZE_HXX
+
+#include "http/Status.h"
+#include "util/Compiler.h"
+
+class GrowingBuffer;
+class StringMap;
+struct HttpCacheResponseInfo;
+struct HttpCacheDocument;
+template<typename T> struct ConstBuffer;
+
+void
+http_cache_serialize_document(GrowingBuffer &gb,
+                              const HttpCacheResponseInfo &info,
+                              http_status_t status,
+                              const StringMap &response_headers);
+
+/**
+ * Deserialize the data written by http_cache_serialize_document().
+ * The strings in the #HttpCacheDocument will point into the input
+ * buffer.
+ *
+ * Throws #DeserializeError on error.
+ */
+void
+http_cache_deserialize_document(ConstBuffer<void> &input,
+                                HttpCacheDocument &document);
+
+/**
+ * Checks whether the serialized "Vary" request headers (written by
+ * serialize_strmap()) match the current request.
+ */
+gcc_pure
+bool
+http_cache_serialized_vary_fits(ConstBuffer<void> vary,
+                                const StringMap &request_headers) noexcept;
+
+#endif
@@ -0,0 +1,641 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "http_cache_shared.hxx"
+#include "http_cache_document.hxx"
+#include "http_cache_rfc.hxx"
+#include "http_cache_serialize.hxx"
+#include "serialize.hxx"
+#include "strmap.hxx"
+#include "GrowingBuffer.hxx"
+#include "RobustMutex.hxx"
+#include "shm/shm.hxx"
+#include "istream/MemoryIstream.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/New.hxx"
+#include "istream/istream_null.hxx"
+#include "pool/pool.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/WritableBuffer.hxx"
+#include "util/djbhash.h"
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/unordered_set.hpp>
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+static constexpr size_t SHM_PAGE_SIZE = 4096;
+
+/**
+ * Objects larger than this fraction of the shared memory size are
+ * not stored, because they would evict too many other objects.
+ */
+static constexpr unsigned MAX_OBJECT_FRACTION = 16;
+
+/**
+ * The maximum number of processes which may use the shared memory
+ * at the same time.  Additional processes will not use it.
+ */
+static constexpr unsigned MAX_WORKERS = 64;
+
+struct HttpCacheSharedItem {
+    using LinkMode =
+        boost::intrusive::link_mode<boost::intrusive::normal_link>;
+    using SiblingsHook = boost::intrusive::list_member_hook<LinkMode>;
+    using SetHook = boost::intrusive::unordered_set_member_hook<LinkMode>;
+
+    SetHook set_hook;
+
+    /**
+     * This item's siblings, sorted by last access, oldest first.
+     */
+    SiblingsHook sorted_siblings;
+
+    /**
+     * The number of pages allocated for this item (including this
+     * struct).
+     */
+    const unsigned num_pages;
+
+    /**
+     * The number of processes currently reading this item.  It must
+     * not be freed while this is non-zero.
+     */
+    unsigned ref = 0;
+
+    /**
+     * The references held by each worker slot (see
+     * HttpCacheSharedContainer::workers); the sum of all elements
+     * equals #ref.  This allows releasing the references of a
+     * process which has died.
+     */
+    unsigned worker_refs[MAX_WORKERS]{};
+
+    /**
+     * Has this item been removed from the container?  It will be
+     * freed as soon as #ref drops to zero.
+     */
+    bool removed = false;
+
+    std::chrono::system_clock::time_point expires;
+
+    /**
+     * All of these point to memory following this struct, in the
+     * same shared memory allocation.
+     */
+    const char *key;
+
+    /**
+     * The serialized "Vary" request headers.
+     */
+    ConstBuffer<void> vary;
+
+    /**
+     * The serialized #HttpCacheDocument.
+     */
+    ConstBuffer<void> document;
+
+    ConstBuffer<void> body;
+
+    explicit HttpCacheSharedItem(unsigned _num_pages) noexcept
+        :num_pages(_num_pages) {}
+
+    HttpCacheSharedItem(const HttpCacheSharedItem &) = delete;
+    HttpCacheSharedItem &operator=(const HttpCacheSharedItem &) = delete;
+
+    gcc_pure
+    bool VaryFits(const StringMap &request_headers) const noexcept;
+
+    gcc_pure
+    static size_t KeyHasher(const char *key) noexcept {
+        return djb_hash_string(key);
+    }
+
+    gcc_pure
+    static bool KeyValueEqual(const char *a,
+                              const HttpCacheSharedItem &b) noexcept {
+        return strcmp(a, b.key) == 0;
+    }
+
+    struct Hash {
+        gcc_pure
+        size_t operator()(const HttpCacheSharedItem &value) const noexcept {
+            return KeyHasher(value.key);
+        }
+    };
+
+    struct Equal {
+        gcc_pure
+        bool operator()(const HttpCacheSharedItem &a,
+                        const HttpCacheSharedItem &b) const noexcept {
+            return KeyValueEqual(a.key, b);
+        }
+    };
+};
+
+bool
+HttpCacheSharedItem::VaryFits(const StringMap &request_headers) const noexcept
+{
+    return http_cache_serialized_vary_fits(vary, request_headers);
+}
+
+struct HttpCacheSharedContainer {
+    /** this lock protects all of the following attributes */
+    RobustMutex mutex;
+
+    /**
+     * Has this container been abandoned, because a process has died
+     * while holding the lock?  If so, its data structures may be
+     * corrupt and must not be used anymore.
+     */
+    bool abandoned = false;
+
+    /**
+     * The process id which owns each worker slot; 0 means the slot
+     * is free.
+     */
+    pid_t workers[MAX_WORKERS]{};
+
+    using ItemSet =
+        boost::intrusive::unordered_multiset<HttpCacheSharedItem,
+                                             boost::intrusive::member_hook<HttpCacheSharedItem,
+                                                                           HttpCacheSharedItem::SetHook,
+                                                                           &HttpCacheSharedItem::set_hook>,
+                                             boost::intrusive::hash<HttpCacheSharedItem::Hash>,
+                                             boost::intrusive::equal<HttpCacheSharedItem::Equal>,
+                                             boost::intrusive::constant_time_size<false>>;
+
+    ItemSet items;
+
+    /**
+     * A linked list of all cache items, sorted by last access,
+     * oldest first.
+     */
+    boost::intrusive::list<HttpCacheSharedItem,
+                           boost::intrusive::member_hook<HttpCacheSharedItem,
+                                                         HttpCacheSharedItem::SiblingsHook,
+                                                         &HttpCacheSharedItem::sorted_siblings>,
+                           boost::intrusive::constant_time_size<false>> sorted_items;
+
+    /**
+     * Items which have been removed, but are still referenced.
+     * They are kept here so their references can be released when
+     * their reader dies.
+     */
+    boost::intrusive::list<HttpCacheSharedItem,
+                           boost::intrusive::member_hook<HttpCacheSharedItem,
+                                                         HttpCacheSharedItem::SiblingsHook,
+                                                         &HttpCacheSharedItem::sorted_siblings>,
+                           boost::intrusive::constant_time_size<false>> removed_items;
+
+    static constexpr unsigned N_BUCKETS = 16381;
+    ItemSet::bucket_type buckets[N_BUCKETS];
+
+    HttpCacheSharedContainer() noexcept
+        :items(ItemSet::bucket_traits(buckets, N_BUCKETS)) {}
+
+    /**
+     * Obtain the lock.
+     *
+     * @return false if the container has been abandoned (the lock is
+     * not held in this case)
+     */
+    bool Lock() noexcept {
+        if (!mutex.Lock())
+            abandoned = true;
+
+        if (abandoned) {
+            mutex.Unlock();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Unlock() noexcept {
+        mutex.Unlock();
+    }
+
+    class ScopeLock {
+        HttpCacheSharedContainer &container;
+        const bool locked;
+
+    public:
+        explicit ScopeLock(HttpCacheSharedContainer &_container) noexcept
+            :container(_container), locked(container.Lock()) {}
+
+        ~ScopeLock() noexcept {
+            if (locked)
+                container.Unlock();
+        }
+
+        ScopeLock(const ScopeLock &) = delete;
+        ScopeLock &operator=(const ScopeLock &) = delete;
+
+        operator bool() const noexcept {
+            return locked;
+        }
+    };
+
+    /**
+     * Allocate a worker slot for the given process.
+     *
+     * @return the slot index or -1 if all slots are occupied
+     */
+    int AddWorker(pid_t pid) noexcept {
+        for (unsigned i = 0; i < MAX_WORKERS; ++i) {
+            if (workers[i] == 0) {
+                workers[i] = pid;
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    /**
+     * Release the worker slot of the given process and all item
+     * references it still holds.
+     */
+    void RemoveWorker(struct shm &shm, pid_t pid) noexcept {
+        for (unsigned i = 0; i < MAX_WORKERS; ++i) {
+            if (workers[i] != pid)
+                continue;
+
+            workers[i] = 0;
+
+            for (auto &item : sorted_items)
+                ReleaseWorkerRefs(item, i);
+
+            for (auto j = removed_items.begin(); j != removed_items.end();) {
+                auto &item = *j++;
+                ReleaseWorkerRefs(item, i);
+                if (item.ref == 0)
+                    Release(shm, item);
+            }
+        }
+    }
+
+    static void ReleaseWorkerRefs(HttpCacheSharedItem &item,
+                                  unsigned slot) noexcept {
+        assert(item.ref >= item.worker_refs[slot]);
+
+        item.ref -= item.worker_refs[slot];
+        item.worker_refs[slot] = 0;
+    }
+
+    static void Ref(HttpCacheSharedItem &item, unsigned slot) noexcept {
+        ++item.ref;
+        ++item.worker_refs[slot];
+    }
+
+    void Unref(struct shm &shm, HttpCacheSharedItem &item,
+               unsigned slot) noexcept {
+        assert(item.ref > 0);
+        assert(item.worker_refs[slot] > 0);
+
+        --item.worker_refs[slot];
+        if (--item.ref == 0 && item.removed)
+            Release(shm, item);
+    }
+
+    /**
+     * Free the removed item, which is not referenced anymore.
+     */
+    void Release(struct shm &shm, HttpCacheSharedItem &item) noexcept {
+        assert(item.removed);
+        assert(item.ref == 0);
+
+        removed_items.erase(removed_items.iterator_to(item));
+        DeleteFromShm(&shm, &item);
+    }
+
+    /**
+     * Remove the item from the container.  Free it if it is not
+     * referenced anymore; otherwise postpone that until the last
+     * reference has been released.
+     */
+    void Remove(struct shm &shm, HttpCacheSharedItem &item) noexcept {
+        assert(!item.removed);
+
+        items.erase(items.iterator_to(item));
+        sorted_items.erase(sorted_items.iterator_to(item));
+        item.removed = true;
+
+        removed_items.push_back(item);
+        if (item.ref == 0)
+            Release(shm, item);
+    }
+
+    /**
+     * Remove the least recently used item which is not currently
+     * being read.
+     *
+     * @return false if there was no such item
+     */
+    bool EvictOldest(struct shm &shm) noexcept {
+        for (auto &item : sorted_items) {
+            if (item.ref == 0) {
+                Remove(shm, item);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void *Allocate(struct shm &shm, unsigned num_pages) noexcept {
+        while (true) {
+            void *p = shm_alloc(&shm, num_pages);
+            if (p != nullptr)
+                return p;
+
+            if (!EvictOldest(shm))
+                return nullptr;
+        }
+    }
+
+    void Clear(struct shm &shm) noexcept {
+        while (!sorted_items.empty())
+            Remove(shm, sorted_items.front());
+    }
+};
+
+static constexpr unsigned CONTAINER_PAGES =
+    (sizeof(HttpCacheSharedContainer) + SHM_PAGE_SIZE - 1) / SHM_PAGE_SIZE;
+
+HttpCacheShared::HttpCacheShared(size_t max_size)
+    :shm(shm_new(SHM_PAGE_SIZE,
+                 CONTAINER_PAGES + max_size / SHM_PAGE_SIZE)),
+     container(NewFromShm<HttpCacheSharedContainer>(shm, CONTAINER_PAGES)),
+     max_object_size(max_size / MAX_OBJECT_FRACTION)
+{
+    assert(container != nullptr);
+
+    /* the creating process may use the cache, too (e.g. in
+       single-process mode) */
+    slot = container->AddWorker(getpid());
+}
+
+HttpCacheShared::~HttpCacheShared() noexcept
+{
+    shm_close(shm);
+}
+
+void
+HttpCacheShared::Ref() noexcept
+{
+    shm_ref(shm);
+
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    slot = lock ? container->AddWorker(getpid()) : -1;
+}
+
+void
+HttpCacheShared::RemoveWorker(pid_t pid) noexcept
+{
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    if (lock)
+        container->RemoveWorker(*shm, pid);
+}
+
+bool
+HttpCacheShared::IsAbandoned() noexcept
+{
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    return !lock;
+}
+
+HttpCacheSharedItem *
+HttpCacheShared::Get(const char *key, const StringMap &request_headers,
+                     std::chrono::system_clock::time_point now) noexcept
+{
+    if (slot < 0)
+        /* without a worker slot, a reference could not be released
+           after this process has died */
+        return nullptr;
+
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    if (!lock)
+        return nullptr;
+
+    const auto r =
+        container->items.equal_range(key, HttpCacheSharedItem::KeyHasher,
+                                     HttpCacheSharedItem::KeyValueEqual);
+    for (auto i = r.first, end = r.second; i != end;) {
+        auto &item = *i++;
+
+        if (item.expires < now) {
+            container->Remove(*shm, item);
+        } else if (item.VaryFits(request_headers)) {
+            /* move to the end of the linked list */
+            container->sorted_items.erase(container->sorted_items.iterator_to(item));
+            container->sorted_items.push_back(item);
+
+            HttpCacheSharedContainer::Ref(item, slot);
+            return &item;
+        }
+    }
+
+    return nullptr;
+}
+
+void
+HttpCacheShared::Unref(HttpCacheSharedItem &item) noexcept
+{
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    if (!lock)
+        /* the memory has been abandoned, and the item will be freed
+           along with it */
+        return;
+
+    assert(slot >= 0);
+
+    container->Unref(*shm, item, slot);
+}
+
+static ConstBuffer<void>
+CopyTo(uint8_t *&dest, ConstBuffer<void> src) noexcept
+{
+    if (src.size > 0)
+        memcpy(dest, src.data, src.size);
+
+    ConstBuffer<void> result(dest, src.size);
+    dest += src.size;
+    return result;
+}
+
+void
+HttpCacheShared::Put(struct pool &pool, const char *key,
+                     const HttpCacheResponseInfo &info,
+                     const StringMap &request_headers,
+                     http_status_t status,
+                     const StringMap &response_headers,
+                     ConstBuffer<void> body) noexcept
+{
+    StringMap vary(pool);
+    if (info.vary != nullptr)
+        http_cache_copy_vary(vary, pool, info.vary, request_headers);
+
+    GrowingBuffer vary_gb, document_gb;
+    serialize_strmap(vary_gb, vary);
+    http_cache_serialize_document(document_gb, info, status, response_headers);
+
+    const ConstBuffer<void> vary_buffer = vary_gb.Dup(pool);
+    const ConstBuffer<void> document_buffer = document_gb.Dup(pool);
+
+    const size_t key_size = strlen(key) + 1;
+    const size_t total_size = sizeof(HttpCacheSharedItem) + key_size +
+        vary_buffer.size + document_buffer.size + body.size;
+    if (total_size > max_object_size)
+        return;
+
+    const unsigned num_pages = (total_size + SHM_PAGE_SIZE - 1) / SHM_PAGE_SIZE;
+
+    void *p;
+
+    {
+        const HttpCacheSharedContainer::ScopeLock lock(*container);
+        if (!lock)
+            return;
+
+        p = container->Allocate(*shm, num_pages);
+        if (p == nullptr)
+            return;
+    }
+
+    /* fill the new item while not holding the lock; nobody else
+       can see it yet */
+
+    auto *item = ::new(p) HttpCacheSharedItem(num_pages);
+    item->expires = info.expires;
+
+    uint8_t *dest = (uint8_t *)(item + 1);
+    item->key = (const char *)CopyTo(dest, ConstBuffer<void>(key, key_size)).data;
+    item->vary = CopyTo(dest, vary_buffer);
+    item->document = CopyTo(dest, document_buffer);
+    item->body = CopyTo(dest, body);
+
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    if (!lock)
+        return;
+
+    /* replace the existing item */
+    const auto r =
+        container->items.equal_range(key, HttpCacheSharedItem::KeyHasher,
+                                     HttpCacheSharedItem::KeyValueEqual);
+    for (auto i = r.first, end = r.second; i != end;) {
+        auto &old = *i++;
+
+        if (old.VaryFits(request_headers))
+            container->Remove(*shm, old);
+    }
+
+    container->items.insert(*item);
+    container->sorted_items.push_back(*item);
+}
+
+void
+HttpCacheShared::Remove(const char *key,
+                        const StringMap &request_headers) noexcept
+{
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    if (!lock)
+        return;
+
+    const auto r =
+        container->items.equal_range(key, HttpCacheSharedItem::KeyHasher,
+                                     HttpCacheSharedItem::KeyValueEqual);
+    for (auto i = r.first, end = r.second; i != end;) {
+        auto &item = *i++;
+
+        if (item.VaryFits(request_headers))
+            container->Remove(*shm, item);
+    }
+}
+
+void
+HttpCacheShared::Flush() noexcept
+{
+    const HttpCacheSharedContainer::ScopeLock lock(*container);
+    if (lock)
+        container->Clear(*shm);
+}
+
+HttpCacheDocument *
+HttpCacheShared::MakeDocument(struct pool &pool,
+                              const HttpCacheSharedItem &item)
+{
+    /* copy the serialized data to the pool, so the strings pointing
+       into it remain valid after the item has been released */
+    ConstBuffer<void> input(p_memdup(&pool, item.document.data,
+                                     item.document.size),
+                            item.document.size);
+    ConstBuffer<void> vary_input(p_memdup(&pool, item.vary.data,
+                                          item.vary.size),
+                                 item.vary.size);
+
+    auto *document = NewFromPool<HttpCacheDocument>(pool, pool);
+    http_cache_deserialize_document(input, *document);
+    deserialize_strmap(vary_input, document->vary);
+    return document;
+}
+
+class HttpCacheSharedIstream final : public MemoryIstream {
+    HttpCacheShared &cache;
+    HttpCacheSharedItem &item;
+
+public:
+    HttpCacheSharedIstream(struct pool &p, HttpCacheShared &_cache,
+                           HttpCacheSharedItem &_item) noexcept
+        :MemoryIstream(p, _item.body),
+         cache(_cache), item(_item) {}
+
+    virtual ~HttpCacheSharedIstream() noexcept {
+        cache.Unref(item);
+    }
+};
+
+UnusedIstreamPtr
+HttpCacheShared::OpenStream(struct pool &pool,
+                            HttpCacheSharedItem &item) noexcept
+{
+    if (item.body.size == 0) {
+        Unref(item);
+        return istream_null_new(pool);
+    }
+
+    return NewIstreamPtr<HttpCacheSharedIstream>(pool, *this, item);
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENG_PROXY_HTTP_CACHE_SHARED_HXX
+#define BENG_PROXY_HTTP_CACHE_SHARED_HXX
+
+#include "http/Status.h"
+#include "util/Compiler.h"
+
+#include <chrono>
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct pool;
+struct shm;
+class UnusedIstreamPtr;
+class StringMap;
+struct HttpCacheResponseInfo;
+struct HttpCacheDocument;
+struct HttpCacheSharedContainer;
+struct HttpCacheSharedItem;
+template<typename T> struct ConstBuffer;
+
+/**
+ * Caching HTTP responses in shared memory.  Unlike #HttpCacheHeap,
+ * this cache is shared by all worker processes, because the memory
+ * map is created in the master process before the workers are
+ * forked.
+ *
+ * Items are referenced by the workers while their body is being
+ * transferred; items which are removed while being referenced will
+ * be freed by the last reader.
+ */
+class HttpCacheShared {
+    struct shm *shm;
+
+    HttpCacheSharedContainer *container;
+
+    const size_t max_object_size;
+
+    /**
+     * This process's slot in the shared worker table, or -1 if this
+     * process has none (and may not read from the cache).  Item
+     * references are accounted per slot, so the references of a
+     * process which has died can be released by RemoveWorker().
+     */
+    int slot;
+
+public:
+    /**
+     * Throws std::bad_alloc or std::system_error on error.
+     */
+    explicit HttpCacheShared(size_t max_size);
+
+    ~HttpCacheShared() noexcept;
+
+    HttpCacheShared(const HttpCacheShared &) = delete;
+    HttpCacheShared &operator=(const HttpCacheShared &) = delete;
+
+    /**
+     * Obtain another reference to the shared memory.  This must be
+     * called in each new worker process after it has been forked.
+     */
+    void Ref() noexcept;
+
+    /**
+     * A worker process has exited.  Release all item references it
+     * may still have held (e.g. if it was killed by a signal).  This
+     * is called by the master process.
+     */
+    void RemoveWorker(pid_t pid) noexcept;
+
+    /**
+     * Has this instance been abandoned because a process has died
+     * while holding the lock?  The memory may be corrupt, and it will
+     * not be used anymore by any process.
+     */
+    bool IsAbandoned() noexcept;
+
+    /**
+     * Look up a matching, not-yet-expired item and return a
+     * reference to it.  The caller must release it with Unref() (or
+     * pass it to OpenStream()).
+     */
+    HttpCacheSharedItem *Get(const char *key,
+                             const StringMap &request_headers,
+                             std::chrono::system_clock::time_point now) noexcept;
+
+    void Unref(HttpCacheSharedItem &item) noexcept;
+
+    /**
+     * Copy the given response into shared memory, replacing an
+     * existing item with the same key and the same "Vary" request
+     * headers.  Older items may be evicted to make room for it.
+     *
+     * @param pool a pool for temporary allocations
+     */
+    void Put(struct pool &pool, const char *key,
+             const HttpCacheResponseInfo &info,
+             const StringMap &request_headers,
+             http_status_t status,
+             const StringMap &response_headers,
+             ConstBuffer<void> body) noexcept;
+
+    void Remove(const char *key, const StringMap &request_headers) noexcept;
+
+    void Flush() noexcept;
+
+    /**
+     * Copy the item's metadata into a new #HttpCacheDocument
+     * allocated from the given pool.
+     *
+     * Throws #DeserializeError if the item is corrupt.
+     */
+    static HttpCacheDocument *MakeDocument(struct pool &pool,
+                                           const HttpCacheSharedItem &item);
+
+    /**
+     * Open an istream reading the item's body.  This "steals" the
+     * reference obtained by Get().
+     */
+    UnusedIstreamPtr OpenStream(struct pool &pool,
+                                HttpCacheSharedItem &item) noexcept;
+};
+
+#endif
@@ -49,6 +49,7 @@
 #include "istream/DechunkIstream.hxx"
 #include "istream/istream_string.hxx"
 #include "istream/istream_null.hxx"
+#include "istream/istream_memory.hxx"
 #include "GrowingBuffer.hxx"
 #include "uri/Verify.hxx"
 #include "direct.hxx"
@@ -218,6 +219,14 @@ class HttpClient final : PoolHolder, BufferedSocketHandler, IstreamHandler, Canc
     /* connection settings */
     bool keep_alive;
 
+    /**
+     * Is this request part of a #HttpPipeline?  In that mode, the
+     * socket is never released before the response is finished,
+     * because the input buffer may already contain the next
+     * response, which belongs to somebody else.
+     */
+    const bool pipelined;
+
 public:
     HttpClient(PoolPtr &&_pool, struct pool &_caller_pool,
                FilteredSocket &_socket, Lease &lease,
@@ -228,6 +237,19 @@ public:
                HttpResponseHandler &handler,
                CancellablePointer &cancel_ptr);
 
+    /**
+     * Constructor for a pipelined request.  The request head has
+     * already been sent by the #HttpPipeline, except for the portion
+     * in #unsent.
+     */
+    HttpClient(PoolPtr &&_pool, struct pool &_caller_pool,
+               FilteredSocket &_socket, Lease &lease,
+               const char *_peer_name,
+               http_method_t method, const char *uri,
+               ConstBuffer<void> unsent,
+               HttpResponseHandler &handler,
+               CancellablePointer &cancel_ptr);
+
     ~HttpClient() noexcept {
         stopwatch_dump(stopwatch);
 
@@ -309,11 +331,6 @@ private:
      */
     void HeadersFinished();
 
-    /**
-     * Throws on error.
-     */
-    void HandleLine(const char *line, size_t length);
-
     /**
      * Throws on error.
      */
@@ -482,7 +499,7 @@ HttpClient::AsFD()
     assert(response.state == Response::State::BODY);
 
     if (!IsConnected() || !socket.IsEmpty() || socket.HasFilter() ||
-        keep_alive ||
+        keep_alive || pipelined ||
         /* must not be chunked */
         response_body_reader.IsChunked())
         return -1;
@@ -723,20 +740,6 @@ HttpClient::HeadersFinished()
         socket.SetDirect(CheckDirect());
 }
 
-inline void
-HttpClient::HandleLine(const char *line, size_t length)
-{
-    assert(response.state == Response::State::STATUS ||
-           response.state == Response::State::HEADERS);
-
-    if (response.state == Response::State::STATUS)
-        ParseStatusLine(line, length);
-    else if (length > 0)
-        header_parse_line(caller_pool, response.headers, {line, length});
-    else
-        HeadersFinished();
-}
-
 void
 HttpClient::ResponseFinished() noexcept
 {
@@ -744,7 +747,7 @@ HttpClient::ResponseFinished() noexcept
 
     stopwatch_event(stopwatch, "end");
 
-    if (!socket.IsEmpty()) {
+    if (!pipelined && !socket.IsEmpty()) {
         LogConcat(2, peer_name, "excess data after HTTP response");
         keep_alive = false;
     }
@@ -766,29 +769,34 @@ HttpClient::ParseHeaders(ConstBuffer<char> b)
     assert(!b.empty());
 
     const char *const buffer = b.data;
-    const char *buffer_end = buffer + b.size;
+    const char *const buffer_end = buffer + b.size;
+    const char *start = buffer;
 
-    /* parse line by line */
-    const char *start = buffer, *end;
-    while ((end = (const char *)memchr(start, '\n',
-                                       buffer_end - start)) != nullptr) {
-        const char *const next = end + 1;
+    if (response.state == Response::State::STATUS) {
+        const char *eol = (const char *)memchr(buffer, '\n', b.size);
+        if (eol == nullptr)
+            return BufferedResult::MORE;
 
-        /* strip the line */
-        end = StripRight(start, end);
+        const char *end = StripRight(buffer, eol);
+        ParseStatusLine(buffer, end - buffer);
 
-        /* handle this line */
-        HandleLine(start, end - start);
+        start = eol + 1;
+    }
 
-        if (response.state != Response::State::HEADERS) {
-            /* header parsing is finished */
-            socket.DisposeConsumed(next - buffer);
-            return BufferedResult::AGAIN_EXPECT;
-        }
+    size_t consumed;
+    const auto result = header_parse_lines(caller_pool, response.headers,
+                                           {start, buffer_end}, consumed);
+    start += consumed;
 
-        start = next;
+    if (result == HeaderParserResult::END) {
+        /* header parsing is finished */
+        HeadersFinished();
+        socket.DisposeConsumed(start - buffer);
+        return BufferedResult::AGAIN_EXPECT;
     }
 
+    assert(result == HeaderParserResult::MORE);
+
     /* remove the parsed part of the buffer */
     socket.DisposeConsumed(start - buffer);
     return BufferedResult::MORE;
@@ -825,7 +833,8 @@ HttpClient::FeedBody(ConstBuffer<void> b)
 
     socket.DisposeConsumed(nbytes);
 
-    if (IsConnected() && response_body_reader.IsSocketDone(socket))
+    if (!pipelined && IsConnected() &&
+        response_body_reader.IsSocketDone(socket))
         /* we don't need the socket anymore, we've got everything we
            need in the input buffer */
         ReleaseSocket(true, keep_alive);
@@ -897,7 +906,8 @@ HttpClient::FeedHeaders(ConstBuffer<void> b)
         request.pending_body.reset();
     }
 
-    if ((response.state == Response::State::END ||
+    if (!pipelined &&
+        (response.state == Response::State::END ||
          response_body_reader.IsSocketDone(socket)) &&
         IsConnected())
         /* we don't need the socket anymore, we've got everything we
@@ -995,7 +1005,8 @@ HttpClient::OnBufferedData()
         }
 
     case Response::State::BODY:
-        if (IsConnected() && response_body_reader.IsSocketDone(socket))
+        if (!pipelined && IsConnected() &&
+            response_body_reader.IsSocketDone(socket))
             /* we don't need the socket anymore, we've got everything
                we need in the input buffer */
             ReleaseSocket(true, keep_alive);
@@ -1114,6 +1125,17 @@ void
 HttpClient::OnBufferedError(std::exception_ptr ep) noexcept
 {
     stopwatch_event(stopwatch, "error");
+
+    if (pipelined && response.state == Response::State::STATUS) {
+        /* the connection has failed before this pipelined request
+           was answered; it is idempotent, therefore the caller may
+           safely send it again */
+        AbortResponse(NestException(ep,
+                                    HttpClientError(HttpClientErrorCode::REFUSED,
+                                                    "Pipelined request was not answered")));
+        return;
+    }
+
     AbortResponse(NestException(ep,
                                 HttpClientError(HttpClientErrorCode::IO,
                                                 "HTTP client socket error")));
@@ -1260,7 +1282,8 @@ HttpClient::HttpClient(PoolPtr &&_pool, struct pool &_caller_pool,
             *this),
      request(handler),
      response(caller_pool),
-     response_body_reader(pool)
+     response_body_reader(pool),
+     pipelined(false)
 {
     response.state = HttpClient::Response::State::STATUS;
     response.no_body = http_method_is_empty(method);
@@ -1344,6 +1367,56 @@ HttpClient::HttpClient(PoolPtr &&_pool, struct pool &_caller_pool,
     }
 }
 
+inline
+HttpClient::HttpClient(PoolPtr &&_pool, struct pool &_caller_pool,
+                       FilteredSocket &_socket, Lease &lease,
+                       const char *_peer_name,
+                       http_method_t method, const char *uri,
+                       ConstBuffer<void> unsent,
+                       HttpResponseHandler &handler,
+                       CancellablePointer &cancel_ptr)
+    :PoolHolder(std::move(_pool)), caller_pool(_caller_pool),
+     peer_name(_peer_name),
+     stopwatch(stopwatch_new(pool, peer_name, uri)),
+     event_loop(_socket.GetEventLoop()),
+     socket(_socket, lease,
+            Event::Duration(-1), http_client_timeout,
+            *this),
+     request(handler),
+     response(caller_pool),
+     response_body_reader(pool),
+     pipelined(true)
+{
+    response.state = HttpClient::Response::State::STATUS;
+    response.no_body = http_method_is_empty(method);
+
+    cancel_ptr = *this;
+
+    socket.ScheduleReadNoTimeout(true);
+
+    /* note: data which is already in the input buffer is submitted
+       by the #HttpPipeline */
+
+    if (!unsent.empty()) {
+        /* the rest of the request head which the #HttpPipeline was
+           unable to send */
+        request.istream.Set(istream_memory_new(GetPool(), unsent.data,
+                                               unsent.size),
+                            *this);
+
+        switch (TryWriteBuckets()) {
+        case HttpClient::BucketResult::MORE:
+            request.istream.Read();
+            break;
+
+        case HttpClient::BucketResult::BLOCKING:
+        case HttpClient::BucketResult::DEPLETED:
+        case HttpClient::BucketResult::DESTROYED:
+            break;
+        }
+    }
+}
+
 void
 http_client_request(struct pool &caller_pool,
                     FilteredSocket &socket, Lease &lease,
@@ -1374,3 +1447,25 @@ http_client_request(struct pool &caller_pool,
                             std::move(headers), std::move(body), expect_100,
                             handler, cancel_ptr);
 }
+
+void
+http_client_pipelined(struct pool &caller_pool,
+                      FilteredSocket &socket, Lease &lease,
+                      const char *peer_name,
+                      http_method_t method, const char *uri,
+                      ConstBuffer<void> unsent,
+                      HttpResponseHandler &handler,
+                      CancellablePointer &cancel_ptr)
+{
+    assert(http_method_is_valid(method));
+    assert(uri_path_verify_quick(uri));
+
+    NewFromPool<HttpClient>(pool_new_linear(&caller_pool, "http_client_pipelined", 4096),
+                            caller_pool,
+                            socket,
+                            lease,
+                            peer_name,
+                            method, uri,
+                            unsent,
+                            handler, cancel_ptr);
+}
@@ -48,6 +48,7 @@ class Lease;
 class HttpResponseHandler;
 class CancellablePointer;
 class HttpHeaders;
+template<typename T> struct ConstBuffer;
 
 /**
  * Error codes for #HttpClientError.
@@ -128,4 +129,32 @@ http_client_request(struct pool &pool,
                     HttpResponseHandler &handler,
                     CancellablePointer &cancel_ptr);
 
+/**
+ * Receive the response to a request which has been pipelined by
+ * #HttpPipeline.  Unlike http_client_request(), the socket is
+ * released only after the response has been consumed completely,
+ * and data following it remains in the socket's input buffer for
+ * the next pipelined request.
+ *
+ * @param pool the memory pool; this client holds a reference until
+ * the response callback has returned and the response body is closed
+ * @param socket a socket to the HTTP server
+ * @param lease the lease for the socket
+ * @param method the HTTP request method
+ * @param uri the request URI path
+ * @param unsent the portion of the serialized request head which has
+ * not yet been sent; it must remain valid until the request is
+ * finished
+ * @param handler receives the response
+ * @param cancel_ptr a handle which may be used to abort the operation
+ */
+void
+http_client_pipelined(struct pool &pool,
+                      FilteredSocket &socket, Lease &lease,
+                      const char *peer_name,
+                      http_method_t method, const char *uri,
+                      ConstBuffer<void> unsent,
+                      HttpResponseHandler &handler,
+                      CancellablePointer &cancel_ptr);
+
 #endif
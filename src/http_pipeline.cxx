@@ -0,0 +1,794 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http_pipeline.hxx"
+#include "http_client.hxx"
+#include "HttpResponseHandler.hxx"
+#include "http/Headers.hxx"
+#include "http/HeaderWriter.hxx"
+#include "fs/FilteredSocket.hxx"
+#include "uri/Verify.hxx"
+#include "lease.hxx"
+#include "istream/Sink.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
+#include "GrowingBuffer.hxx"
+#include "event/DeferEvent.hxx"
+#include "io/Logger.hxx"
+#include "system/Error.hxx"
+#include "util/Cancellable.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/DestructObserver.hxx"
+#include "util/StringFormat.hxx"
+#include "util/Exception.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+#include <assert.h>
+#include <sys/uio.h>
+
+static constexpr auto http_pipeline_timeout = std::chrono::seconds(30);
+
+class HttpPipeline;
+
+/**
+ * A request which has been queued on a #HttpPipeline.  Its head is
+ * written to the socket as early as possible; its response is
+ * received by a #HttpClient which is created after all previous
+ * responses have been received.  The #HttpClient uses this object
+ * as its #Lease.
+ *
+ * If the caller cancels the request after its head has been sent,
+ * this object stays in the queue and discards the response (as
+ * #HttpResponseHandler and #IstreamSink), so the following requests
+ * can still be answered.
+ */
+struct HttpPipelineRequest final
+    : boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+      Lease, Cancellable, HttpResponseHandler, IstreamSink {
+
+    HttpPipeline &pipeline;
+
+    struct pool &caller_pool;
+
+    /**
+     * The caller's lease for one request on the #HttpPipeline.
+     */
+    Lease &lease;
+
+    HttpResponseHandler &handler;
+
+    CancellablePointer &cancel_ptr;
+
+    const http_method_t method;
+
+    const char *const uri;
+
+    /**
+     * The serialized request head, allocated from the caller's pool.
+     */
+    const ConstBuffer<char> head;
+
+    /**
+     * The number of bytes of #head which have been written to the
+     * socket.
+     */
+    size_t sent = 0;
+
+    /**
+     * A reference to #caller_pool, which keeps #head and the
+     * #HttpClient alive after the caller has canceled this request.
+     * Only defined while the response is being discarded.
+     */
+    PoolPtr drain_pool;
+
+    /**
+     * Cancels the #HttpClient which receives the response to be
+     * discarded, until the response has been delivered.
+     */
+    CancellablePointer drain_cancel_ptr;
+
+    HttpPipelineRequest(HttpPipeline &_pipeline,
+                        struct pool &_caller_pool, Lease &_lease,
+                        http_method_t _method, const char *_uri,
+                        ConstBuffer<char> _head,
+                        HttpResponseHandler &_handler,
+                        CancellablePointer &_cancel_ptr) noexcept
+        :pipeline(_pipeline), caller_pool(_caller_pool), lease(_lease),
+         handler(_handler), cancel_ptr(_cancel_ptr),
+         method(_method), uri(_uri), head(_head)
+    {
+        cancel_ptr = *this;
+    }
+
+    /**
+     * Has the caller canceled this request?  Its response is then
+     * discarded.
+     */
+    bool IsCanceled() const noexcept {
+        return drain_pool;
+    }
+
+    HttpResponseHandler &GetResponseHandler() noexcept {
+        return IsCanceled() ? *this : handler;
+    }
+
+    CancellablePointer &GetCancelPtr() noexcept {
+        return IsCanceled() ? drain_cancel_ptr : cancel_ptr;
+    }
+
+    /**
+     * The caller has canceled this request, but its head has already
+     * been sent: discard the response.  The caller's #lease and
+     * #handler are not used anymore.
+     */
+    void Drain() noexcept {
+        assert(!IsCanceled());
+
+        drain_pool = PoolPtr(caller_pool);
+    }
+
+    /**
+     * Abort the #HttpClient which receives the discarded response.
+     * It releases its lease, i.e. this object is deleted.
+     */
+    void AbortDrain() noexcept {
+        assert(IsCanceled());
+
+        if (HasInput())
+            ClearAndCloseInput();
+        else if (drain_cancel_ptr)
+            drain_cancel_ptr.Cancel();
+    }
+
+    /**
+     * Abort this (unanswered) request and delete this object.
+     */
+    void Abort(std::exception_ptr ep) noexcept {
+        if (IsCanceled()) {
+            delete this;
+            return;
+        }
+
+        auto &_lease = lease;
+        auto &_handler = handler;
+        delete this;
+
+        _lease.ReleaseLease(false);
+        _handler.InvokeError(ep);
+    }
+
+private:
+    /* virtual methods from class Cancellable */
+    void Cancel() noexcept override;
+
+    /* virtual methods from class Lease */
+    void ReleaseLease(bool reuse) noexcept override;
+
+    /* virtual methods from class HttpResponseHandler */
+    void OnHttpResponse(http_status_t, StringMap &&,
+                        UnusedIstreamPtr body) noexcept override {
+        drain_cancel_ptr = nullptr;
+
+        if (body)
+            SetInput(std::move(body));
+    }
+
+    void OnHttpError(std::exception_ptr) noexcept override {
+        drain_cancel_ptr = nullptr;
+    }
+
+    /* virtual methods from class IstreamHandler */
+    size_t OnData(const void *, size_t length) noexcept override {
+        return length;
+    }
+
+    void OnEof() noexcept override {
+        ClearInput();
+    }
+
+    void OnError(std::exception_ptr) noexcept override {
+        ClearInput();
+    }
+};
+
+class HttpPipeline final : BufferedSocketHandler, DestructAnchor {
+    FilteredSocket &socket;
+
+    const char *const peer_name;
+
+    HttpPipelineHandler &handler;
+
+    /**
+     * Starts receiving the next response after the previous
+     * #HttpClient has released the socket.
+     */
+    DeferEvent defer_start;
+
+    typedef boost::intrusive::list<HttpPipelineRequest,
+                                   boost::intrusive::constant_time_size<false>> RequestList;
+
+    /**
+     * All requests which have not yet been answered, in the order
+     * in which they are sent.
+     */
+    RequestList requests;
+
+    /**
+     * The request whose response is currently being received by a
+     * #HttpClient.  It is always the first item of #requests.
+     */
+    HttpPipelineRequest *active = nullptr;
+
+    /**
+     * Is the #HttpClient of the #active request still sending the
+     * rest of its request head?  Until its response has been
+     * received, no other request head may be written.
+     */
+    bool active_sending = false;
+
+    /**
+     * May new requests be sent?  This is cleared as soon as the
+     * connection is known to be unusable for the next response.
+     */
+    bool usable = true;
+
+    /**
+     * Will no more responses be received on this connection?  This
+     * is set after a socket failure and after the server has
+     * disabled keep-alive.
+     */
+    bool broken = false;
+
+public:
+    HttpPipeline(FilteredSocket &_socket, const char *_peer_name,
+                 HttpPipelineHandler &_handler) noexcept
+        :socket(_socket), peer_name(_peer_name), handler(_handler),
+         defer_start(socket.GetEventLoop(),
+                     BIND_THIS_METHOD(OnDeferredStart))
+    {
+        socket.Reinit(Event::Duration(-1), http_pipeline_timeout, *this);
+        socket.ScheduleReadNoTimeout(false);
+    }
+
+    ~HttpPipeline() noexcept {
+        /* the owner must not free the connection while requests are
+           holding leases on it; only canceled requests may be left,
+           whose responses are being discarded */
+        usable = false;
+
+        if (active != nullptr)
+            /* this releases its lease, and OnRequestFinished()
+               deletes the other requests */
+            active->AbortDrain();
+
+        requests.clear_and_dispose([](HttpPipelineRequest *request){
+                assert(request->IsCanceled());
+                delete request;
+            });
+
+        defer_start.Cancel();
+    }
+
+    bool IsUsable() const noexcept {
+        return usable;
+    }
+
+    gcc_pure
+    bool IsReusable() const noexcept {
+        return usable && !broken && requests.empty() &&
+            socket.IsConnected() && socket.IsEmpty();
+    }
+
+    void Enqueue(HttpPipelineRequest &request) noexcept;
+
+    void OnRequestCanceled(HttpPipelineRequest &request) noexcept;
+
+    void OnRequestFinished(HttpPipelineRequest &request,
+                           bool reuse) noexcept;
+
+private:
+    /**
+     * Stop accepting new requests and notify the
+     * #HttpPipelineHandler.
+     */
+    void Fade() noexcept;
+
+    /**
+     * Abort all queued requests with HttpClientErrorCode::REFUSED;
+     * none of them has been answered, and the caller may send them
+     * again.  This object may be destroyed by this method
+     * (indirectly by releasing request leases).
+     */
+    void Abort(std::exception_ptr cause, const char *msg) noexcept;
+
+    void Abort(const char *msg) noexcept {
+        Abort(std::exception_ptr(), msg);
+    }
+
+    /**
+     * Write as many queued request heads as possible.  This object
+     * may be destroyed by this method.
+     */
+    void Flush() noexcept;
+
+    /**
+     * Create a #HttpClient which receives the response to the first
+     * queued request.
+     */
+    void StartNext() noexcept;
+
+    void OnDeferredStart() noexcept;
+
+    /* virtual methods from class BufferedSocketHandler */
+    BufferedResult OnBufferedData() override;
+    bool OnBufferedClosed() noexcept override;
+    bool OnBufferedWrite() override;
+    bool OnBufferedTimeout() noexcept override;
+    void OnBufferedError(std::exception_ptr e) noexcept override;
+};
+
+void
+HttpPipelineRequest::Cancel() noexcept
+{
+    pipeline.OnRequestCanceled(*this);
+}
+
+void
+HttpPipelineRequest::ReleaseLease(bool reuse) noexcept
+{
+    pipeline.OnRequestFinished(*this, reuse);
+}
+
+void
+HttpPipeline::Fade() noexcept
+{
+    if (!usable)
+        return;
+
+    usable = false;
+    handler.OnHttpPipelineFade();
+}
+
+void
+HttpPipeline::Abort(std::exception_ptr cause, const char *msg) noexcept
+{
+    assert(active == nullptr);
+
+    broken = true;
+    defer_start.Cancel();
+
+    if (socket.IsConnected())
+        socket.UnscheduleWrite();
+
+    const DestructObserver destructed(*this);
+
+    Fade();
+    if (destructed)
+        return;
+
+    if (requests.empty())
+        return;
+
+    const HttpClientError error(HttpClientErrorCode::REFUSED,
+                                StringFormat<256>("%s on HTTP connection to '%s'",
+                                                  msg, peer_name));
+    const auto ep = cause
+        ? NestException(cause, error)
+        : std::make_exception_ptr(error);
+
+    while (!requests.empty()) {
+        auto &request = requests.front();
+        requests.pop_front();
+
+        /* each request releases its lease, which may destroy this
+           object */
+        request.Abort(ep);
+        if (destructed)
+            return;
+    }
+}
+
+void
+HttpPipeline::Enqueue(HttpPipelineRequest &request) noexcept
+{
+    assert(usable);
+    assert(!broken);
+
+    requests.push_back(request);
+
+    if (active == nullptr)
+        /* start the HttpClient later, so the caller is not invoked
+           before this function returns */
+        defer_start.Schedule();
+
+    Flush();
+}
+
+void
+HttpPipeline::Flush() noexcept
+{
+    if (broken || active_sending)
+        return;
+
+    while (true) {
+        /* collect all unsent request heads and write them with one
+           system call */
+        struct iovec v[16];
+        size_t n = 0, total = 0;
+
+        for (auto &request : requests) {
+            if (request.sent == request.head.size)
+                continue;
+
+            v[n].iov_base = const_cast<char *>(request.head.data + request.sent);
+            v[n].iov_len = request.head.size - request.sent;
+            total += v[n].iov_len;
+
+            if (++n == std::size(v) || socket.HasFilteredOutput())
+                break;
+        }
+
+        if (n == 0)
+            return;
+
+        const ssize_t nbytes = socket.HasFilteredOutput()
+            ? socket.Write(v[0].iov_base, v[0].iov_len)
+            : socket.WriteV(v, n);
+        if (gcc_likely(nbytes >= 0)) {
+            size_t remaining = nbytes;
+            for (auto &request : requests) {
+                if (remaining == 0)
+                    break;
+
+                const size_t m = std::min(request.head.size - request.sent,
+                                          remaining);
+                request.sent += m;
+                remaining -= m;
+            }
+
+            if (size_t(nbytes) < total)
+                /* the rest will be sent later; the following
+                   request heads must wait for it */
+                return;
+
+            continue;
+        }
+
+        if (nbytes == WRITE_BLOCKING || nbytes == WRITE_DESTROYED)
+            return;
+
+        /* the connection has failed; if a response is being
+           received, the HttpClient will notice; the other requests
+           will be aborted after it has finished */
+        if (active == nullptr)
+            Abort(std::make_exception_ptr(MakeErrno("Write error")),
+                  "write error");
+        else {
+            broken = true;
+            Fade();
+        }
+
+        return;
+    }
+}
+
+void
+HttpPipeline::StartNext() noexcept
+{
+    assert(active == nullptr);
+    assert(!requests.empty());
+    assert(!broken);
+
+    auto &request = requests.front();
+    active = &request;
+
+    /* the HttpClient sends the rest of the request head which we
+       were unable to send */
+    const ConstBuffer<char> unsent(request.head.data + request.sent,
+                                   request.head.size - request.sent);
+    request.sent = request.head.size;
+    active_sending = !unsent.empty();
+
+    /* send more request heads before the HttpClient takes over the
+       socket */
+    const DestructObserver destructed(*this);
+    Flush();
+    if (destructed)
+        return;
+
+    http_client_pipelined(request.caller_pool, socket, request,
+                          peer_name,
+                          request.method, request.uri,
+                          unsent.ToVoid(),
+                          request.GetResponseHandler(),
+                          request.GetCancelPtr());
+}
+
+void
+HttpPipeline::OnDeferredStart() noexcept
+{
+    if (active != nullptr || requests.empty() || broken)
+        return;
+
+    const DestructObserver destructed(*this);
+
+    StartNext();
+    if (destructed)
+        return;
+
+    if (active != nullptr && socket.IsConnected() && !socket.IsEmpty())
+        /* (a part of) the response has been received already while
+           the previous response was being processed; the socket will
+           not report it again */
+        socket.Read(true);
+}
+
+void
+HttpPipeline::OnRequestFinished(HttpPipelineRequest &request,
+                                bool reuse) noexcept
+{
+    assert(&request == active);
+
+    active = nullptr;
+    active_sending = false;
+    requests.erase(requests.iterator_to(request));
+
+    /* the lease of a canceled request has already been released */
+    Lease *lease = request.IsCanceled() ? nullptr : &request.lease;
+    delete &request;
+
+    if (!reuse || !socket.IsConnected())
+        broken = true;
+    else if (requests.empty() && !socket.IsEmpty()) {
+        LogConcat(2, peer_name, "excess data after HTTP response");
+        broken = true;
+    }
+
+    if (socket.IsConnected()) {
+        /* take over the socket until the next response is
+           expected */
+        socket.Reinit(Event::Duration(-1), http_pipeline_timeout, *this);
+        socket.UnscheduleWrite();
+    }
+
+    if (!broken) {
+        socket.ScheduleReadNoTimeout(false);
+
+        if (!requests.empty())
+            defer_start.Schedule();
+
+        if (lease != nullptr)
+            lease->ReleaseLease(true);
+        return;
+    }
+
+    /* no more responses will be received; the remaining requests
+       will be sent again by their callers on another connection */
+
+    const DestructObserver destructed(*this);
+
+    /* if only canceled requests are left, the owner may free this
+       object right away */
+    Fade();
+    if (destructed)
+        return;
+
+    if (lease != nullptr) {
+        lease->ReleaseLease(false);
+        if (destructed)
+            return;
+    }
+
+    Abort("Pipelined request was not answered");
+}
+
+void
+HttpPipeline::OnRequestCanceled(HttpPipelineRequest &request) noexcept
+{
+    assert(&request != active);
+
+    Lease &lease = request.lease;
+
+    if (request.sent > 0 && !broken) {
+        /* the server will respond to the canceled request; keep it
+           in the queue and discard that response, so the following
+           requests on this connection can still be answered */
+        request.Drain();
+        lease.ReleaseLease(true);
+        return;
+    }
+
+    const bool was_sent = request.sent > 0;
+
+    requests.erase(requests.iterator_to(request));
+    delete &request;
+
+    const DestructObserver destructed(*this);
+
+    lease.ReleaseLease(!was_sent);
+    if (destructed)
+        return;
+
+    if (broken && active == nullptr)
+        Abort("Pipelined request was not answered");
+}
+
+/*
+ * BufferedSocketHandler
+ *
+ */
+
+BufferedResult
+HttpPipeline::OnBufferedData()
+{
+    if (broken)
+        return BufferedResult::CLOSED;
+
+    if (requests.empty()) {
+        Abort("Unexpected data in idle connection");
+        return BufferedResult::CLOSED;
+    }
+
+    /* the response is arriving before #defer_start has started the
+       HttpClient; do that now and let it handle the data */
+
+    defer_start.Cancel();
+
+    const DestructObserver destructed(*this);
+
+    StartNext();
+    if (destructed || active == nullptr)
+        return BufferedResult::CLOSED;
+
+    return BufferedResult::AGAIN_EXPECT;
+}
+
+bool
+HttpPipeline::OnBufferedClosed() noexcept
+{
+    socket.UnscheduleWrite();
+    socket.Close();
+
+    Abort("HTTP server closed the connection");
+    return false;
+}
+
+bool
+HttpPipeline::OnBufferedWrite()
+{
+    /* request heads are only written by Flush(); this is just
+       leftover from the HttpClient */
+    socket.UnscheduleWrite();
+    return true;
+}
+
+bool
+HttpPipeline::OnBufferedTimeout() noexcept
+{
+    Abort("Timeout");
+    return false;
+}
+
+void
+HttpPipeline::OnBufferedError(std::exception_ptr e) noexcept
+{
+    Abort(e, "Socket error");
+}
+
+/*
+ * public API
+ *
+ */
+
+HttpPipeline *
+http_pipeline_new(FilteredSocket &socket, const char *peer_name,
+                  HttpPipelineHandler &handler) noexcept
+{
+    return new HttpPipeline(socket, peer_name, handler);
+}
+
+void
+http_pipeline_free(HttpPipeline *pipeline) noexcept
+{
+    delete pipeline;
+}
+
+bool
+http_pipeline_is_usable(const HttpPipeline &pipeline) noexcept
+{
+    return pipeline.IsUsable();
+}
+
+bool
+http_pipeline_is_reusable(const HttpPipeline &pipeline) noexcept
+{
+    return pipeline.IsReusable();
+}
+
+void
+http_pipeline_request(struct pool &caller_pool,
+                      HttpPipeline &pipeline, Lease &lease,
+                      http_method_t method, const char *uri,
+                      HttpHeaders &headers,
+                      HttpResponseHandler &handler,
+                      CancellablePointer &cancel_ptr)
+{
+    assert(http_method_is_valid(method));
+    assert(http_pipeline_is_eligible(method, false));
+
+    if (!uri_path_verify_quick(uri)) {
+        lease.ReleaseLease(true);
+
+        handler.InvokeError(std::make_exception_ptr(HttpClientError(HttpClientErrorCode::UNSPECIFIED,
+                                                                    StringFormat<256>("malformed request URI '%s'", uri))));
+        return;
+    }
+
+    if (!pipeline.IsUsable()) {
+        lease.ReleaseLease(false);
+
+        handler.InvokeError(std::make_exception_ptr(HttpClientError(HttpClientErrorCode::REFUSED,
+                                                                    "HTTP connection is shutting down")));
+        return;
+    }
+
+    /* serialize the request head; unlike http_client_request(), the
+       #HttpHeaders object is left intact, because the request may
+       need to be sent again on another connection */
+
+    GrowingBuffer buffer;
+    buffer.Write(http_method_to_string(method));
+    buffer.Write(" ");
+    buffer.Write(uri);
+    buffer.Write(" HTTP/1.1\r\n");
+
+    const auto raw = headers.GetBuffer().Dup(caller_pool);
+    if (!raw.empty())
+        buffer.Write(raw.data, raw.size);
+
+    headers_copy_most(headers.GetMap(), buffer);
+    buffer.Write("\r\n", 2);
+
+    const auto head = buffer.Dup(caller_pool);
+
+    auto *request =
+        new HttpPipelineRequest(pipeline, caller_pool, lease,
+                                method, uri,
+                                {(const char *)head.data, head.size},
+                                handler, cancel_ptr);
+    pipeline.Enqueue(*request);
+}
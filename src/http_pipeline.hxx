@@ -0,0 +1,139 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * HTTP/1.1 request pipelining: several idempotent requests share one
+ * keep-alive connection, and each request head is sent before the
+ * responses to the previous requests have arrived.
+ */
+
+#pragma once
+
+#include "http/Method.h"
+#include "util/Compiler.h"
+
+struct pool;
+struct FilteredSocket;
+class Lease;
+class HttpResponseHandler;
+class CancellablePointer;
+class HttpHeaders;
+class HttpPipeline;
+
+class HttpPipelineHandler {
+public:
+    /**
+     * The connection does not accept new requests anymore, either
+     * because the server has closed it, because a response has
+     * disabled keep-alive or because the socket has failed.
+     * Requests which have already been answered will be finished;
+     * all others are aborted with HttpClientErrorCode::REFUSED.
+     */
+    virtual void OnHttpPipelineFade() noexcept = 0;
+};
+
+/**
+ * May a request with these properties be pipelined?  Only requests
+ * which are idempotent and have no body are eligible, because they
+ * may be sent again after the connection has failed.
+ */
+constexpr bool
+http_pipeline_is_eligible(http_method_t method, bool has_body) noexcept
+{
+    return !has_body &&
+        (method == HTTP_METHOD_GET || method == HTTP_METHOD_HEAD);
+}
+
+/**
+ * Start pipelining requests on the given socket, which must be an
+ * idle HTTP/1.1 connection.  The #HttpPipeline becomes the socket's
+ * handler while no response is being received; the caller keeps
+ * owning the #FilteredSocket and must not destroy it before calling
+ * http_pipeline_free().
+ *
+ * @param peer_name the name of the server, used in error messages
+ */
+HttpPipeline *
+http_pipeline_new(FilteredSocket &socket, const char *peer_name,
+                  HttpPipelineHandler &handler) noexcept;
+
+void
+http_pipeline_free(HttpPipeline *pipeline) noexcept;
+
+/**
+ * May new requests be sent on this connection?
+ */
+gcc_pure
+bool
+http_pipeline_is_usable(const HttpPipeline &pipeline) noexcept;
+
+/**
+ * Is the connection idle and intact, i.e. may the socket be reused
+ * for unpipelined requests after http_pipeline_free()?
+ */
+gcc_pure
+bool
+http_pipeline_is_reusable(const HttpPipeline &pipeline) noexcept;
+
+/**
+ * Sends a HTTP request on the pipeline, and passes the response to
+ * the handler.  The lease is released when the response is
+ * finished.
+ *
+ * If the connection fails before the server has begun to respond
+ * to this request, the handler receives a #HttpClientError with
+ * HttpClientErrorCode::REFUSED, and the caller may send the request
+ * again on another connection.
+ *
+ * If the request is canceled after its head has been sent, the
+ * lease is released right away, and the pipeline discards the
+ * server's response to it.
+ *
+ * @param pool the memory pool; this client holds a reference until
+ * the response callback has returned and the response body is closed
+ * @param pipeline a connection obtained from http_pipeline_new()
+ * @param lease the lease for one request on the connection
+ * @param method the HTTP request method; must be eligible according
+ * to http_pipeline_is_eligible()
+ * @param uri the request URI path
+ * @param headers the request headers; they are copied, and the
+ * object remains usable for another attempt
+ * @param handler receives the response
+ * @param cancel_ptr a handle which may be used to abort the operation
+ */
+void
+http_pipeline_request(struct pool &pool,
+                      HttpPipeline &pipeline, Lease &lease,
+                      http_method_t method, const char *uri,
+                      HttpHeaders &headers,
+                      HttpResponseHandler &handler,
+                      CancellablePointer &cancel_ptr);
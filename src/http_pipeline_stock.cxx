@@ -0,0 +1,277 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "http_pipeline_stock.hxx"
+#include "http_pipeline.hxx"
+#include "fs/Stock.hxx"
+#include "stock/Stock.hxx"
+#include "stock/GetHandler.hxx"
+#include "stock/Item.hxx"
+#include "pool/pool.hxx"
+#include "net/SocketAddress.hxx"
+#include "net/ToString.hxx"
+#include "util/Cancellable.hxx"
+
+#include <assert.h>
+
+/**
+ * The maximum number of requests queued on one connection.  Deeper
+ * pipelines gain little and make a connection failure more
+ * expensive, because all unanswered requests need to be replayed.
+ */
+static constexpr unsigned HTTP_PIPELINE_DEPTH = 8;
+
+struct HttpPipelineStockRequest {
+    const bool ip_transparent;
+
+    const SocketAddress bind_address, address;
+
+    const Event::Duration timeout;
+
+    HttpPipelineStockRequest(bool _ip_transparent,
+                             SocketAddress _bind_address,
+                             SocketAddress _address,
+                             Event::Duration _timeout) noexcept
+        :ip_transparent(_ip_transparent),
+         bind_address(_bind_address), address(_address),
+         timeout(_timeout) {}
+};
+
+class HttpPipelineStockConnection final
+    : StockItem, StockGetHandler, Cancellable, HttpPipelineHandler {
+
+    HttpPipelineStock &http_pipeline_stock;
+
+    /**
+     * To cancel the #FilteredSocketStock request.
+     */
+    CancellablePointer cancel_ptr;
+
+    /**
+     * The #FilteredSocketStock item; it is borrowed for the whole
+     * lifetime of this object.
+     */
+    StockItem *socket_item = nullptr;
+
+    HttpPipeline *client = nullptr;
+
+    bool idle = false;
+
+public:
+    HttpPipelineStockConnection(CreateStockItem c, HttpPipelineStock &_http_pipeline_stock,
+                                CancellablePointer &_cancel_ptr) noexcept
+        :StockItem(c), http_pipeline_stock(_http_pipeline_stock)
+    {
+        _cancel_ptr = *this;
+    }
+
+    ~HttpPipelineStockConnection() noexcept override {
+        if (cancel_ptr)
+            cancel_ptr.Cancel();
+
+        bool reuse = false;
+        if (client != nullptr) {
+            /* an idle pipeline connection is a plain HTTP/1.1
+               connection which may be used by others */
+            reuse = http_pipeline_is_reusable(*client);
+            http_pipeline_free(client);
+        }
+
+        if (socket_item != nullptr)
+            socket_item->Put(!reuse);
+    }
+
+    void Connect(FilteredSocketStock &fs_stock, struct pool &caller_pool,
+                 const HttpPipelineStockRequest &request) noexcept {
+        fs_stock.Get(caller_pool, GetStockName(),
+                     request.ip_transparent, request.bind_address,
+                     request.address, request.timeout,
+                     nullptr,
+                     *this, cancel_ptr);
+    }
+
+    HttpPipeline &GetClient() noexcept {
+        assert(client != nullptr);
+
+        return *client;
+    }
+
+    SocketAddress GetAddress() const noexcept {
+        assert(socket_item != nullptr);
+
+        return fs_stock_item_get_address(*socket_item);
+    }
+
+private:
+    /* virtual methods from class Cancellable */
+    void Cancel() noexcept override {
+        assert(cancel_ptr);
+
+        cancel_ptr.CancelAndClear();
+        InvokeCreateAborted();
+    }
+
+    /* virtual methods from class StockGetHandler */
+    void OnStockItemReady(StockItem &item) noexcept override;
+    void OnStockItemError(std::exception_ptr ep) noexcept override;
+
+    /* virtual methods from class HttpPipelineHandler */
+    void OnHttpPipelineFade() noexcept override;
+
+    /* virtual methods from class StockItem */
+    bool Borrow() noexcept override {
+        idle = false;
+        return http_pipeline_is_usable(*client);
+    }
+
+    bool Release() noexcept override {
+        if (!http_pipeline_is_usable(*client))
+            return false;
+
+        idle = true;
+        return true;
+    }
+};
+
+void
+HttpPipelineStockConnection::OnStockItemReady(StockItem &item) noexcept
+{
+    cancel_ptr = nullptr;
+    socket_item = &item;
+
+    client = http_pipeline_new(fs_stock_item_get(item),
+                               GetStockName(), *this);
+    InvokeCreateSuccess();
+}
+
+void
+HttpPipelineStockConnection::OnStockItemError(std::exception_ptr ep) noexcept
+{
+    cancel_ptr = nullptr;
+    InvokeCreateError(ep);
+}
+
+void
+HttpPipelineStockConnection::OnHttpPipelineFade() noexcept
+{
+    fade = true;
+    http_pipeline_stock.Fade(*this);
+
+    if (idle)
+        InvokeIdleDisconnect();
+}
+
+/*
+ * stock class
+ *
+ */
+
+void
+HttpPipelineStock::Create(CreateStockItem c, void *info,
+                          struct pool &caller_pool,
+                          CancellablePointer &cancel_ptr)
+{
+    const auto &request = *(const HttpPipelineStockRequest *)info;
+
+    auto *connection = new HttpPipelineStockConnection(c, *this, cancel_ptr);
+    connection->Connect(fs_stock, caller_pool, request);
+}
+
+/*
+ * interface
+ *
+ */
+
+HttpPipelineStock::HttpPipelineStock(FilteredSocketStock &_fs_stock,
+                                     unsigned limit) noexcept
+    :fs_stock(_fs_stock),
+     hstock(fs_stock.GetEventLoop(), *this, limit, 16),
+     mstock(hstock) {}
+
+void
+HttpPipelineStock::Fade(StockItem &item) noexcept
+{
+    mstock.FadeIf([&item](const StockItem &i){
+            return &i == &item;
+        });
+}
+
+void
+HttpPipelineStock::Get(struct pool &pool, const char *name,
+                       bool ip_transparent,
+                       SocketAddress bind_address,
+                       SocketAddress address,
+                       Event::Duration timeout,
+                       StockGetHandler &handler,
+                       struct lease_ref &lease_ref,
+                       CancellablePointer &cancel_ptr) noexcept
+{
+    assert(!address.IsNull());
+
+    auto request =
+        NewFromPool<HttpPipelineStockRequest>(pool, ip_transparent,
+                                              bind_address, address,
+                                              timeout);
+
+    if (name == nullptr) {
+        char buffer[1024];
+        if (!ToString(buffer, sizeof(buffer), address))
+            buffer[0] = 0;
+
+        if (!bind_address.IsNull()) {
+            char bind_buffer[1024];
+            if (!ToString(bind_buffer, sizeof(bind_buffer), bind_address))
+                bind_buffer[0] = 0;
+            name = p_strcat(&pool, bind_buffer, ">", buffer, nullptr);
+        } else
+            name = p_strdup(&pool, buffer);
+    }
+
+    mstock.Get(pool, name, request, HTTP_PIPELINE_DEPTH,
+               handler, lease_ref, cancel_ptr);
+}
+
+HttpPipeline &
+http_pipeline_stock_item_get(StockItem &item) noexcept
+{
+    auto &connection = (HttpPipelineStockConnection &)item;
+
+    return connection.GetClient();
+}
+
+SocketAddress
+http_pipeline_stock_item_get_address(const StockItem &item) noexcept
+{
+    const auto &connection = (const HttpPipelineStockConnection &)item;
+
+    return connection.GetAddress();
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Stock of HTTP/1.1 client connections which pipeline idempotent
+ * requests.
+ */
+
+#pragma once
+
+#include "stock/Class.hxx"
+#include "stock/MapStock.hxx"
+#include "stock/MultiStock.hxx"
+#include "util/Compiler.h"
+
+struct pool;
+struct lease_ref;
+struct StockItem;
+class StockGetHandler;
+class CancellablePointer;
+class FilteredSocketStock;
+class HttpPipeline;
+class EventLoop;
+class SocketAddress;
+
+/**
+ * A stock for pipelining HTTP/1.1 connections.  Each connection is a
+ * #FilteredSocketStock item which is borrowed while the pipeline
+ * exists; several requests share one connection, each holding a
+ * #MultiStock lease for one pipelined request.
+ */
+class HttpPipelineStock final : StockClass {
+    FilteredSocketStock &fs_stock;
+
+    StockMap hstock;
+
+    MultiStock mstock;
+
+public:
+    /**
+     * @param limit the maximum number of connections per host
+     */
+    HttpPipelineStock(FilteredSocketStock &_fs_stock, unsigned limit) noexcept;
+
+    EventLoop &GetEventLoop() noexcept {
+        return hstock.GetEventLoop();
+    }
+
+    void AddStats(StockStats &data) const noexcept {
+        hstock.AddStats(data);
+    }
+
+    void FadeAll() noexcept {
+        hstock.FadeAll();
+        mstock.FadeAll();
+    }
+
+    /**
+     * Don't assign new requests to the given connection.
+     */
+    void Fade(StockItem &item) noexcept;
+
+    /**
+     * Obtain a lease for one pipelined request on a (new or
+     * existing) connection.  On success, the #StockItem passed to
+     * the handler may be used with http_pipeline_stock_item_get(),
+     * and the lease must be released by calling lease_ref.Release().
+     *
+     * @param name the MapStock name; it is auto-generated from the
+     * #address if nullptr is passed here
+     * @param timeout the connect timeout
+     */
+    void Get(struct pool &pool, const char *name,
+             bool ip_transparent,
+             SocketAddress bind_address,
+             SocketAddress address,
+             Event::Duration timeout,
+             StockGetHandler &handler,
+             struct lease_ref &lease_ref,
+             CancellablePointer &cancel_ptr) noexcept;
+
+private:
+    /* virtual methods from class StockClass */
+    void Create(CreateStockItem c, void *info, struct pool &caller_pool,
+                CancellablePointer &cancel_ptr) override;
+};
+
+gcc_pure
+HttpPipeline &
+http_pipeline_stock_item_get(StockItem &item) noexcept;
+
+/**
+ * Returns the (peer) address this object is connected to.
+ */
+gcc_pure
+SocketAddress
+http_pipeline_stock_item_get_address(const StockItem &item) noexcept;
@@ -45,6 +45,14 @@
 #include "fs/Balancer.hxx"
 #include "fs/Factory.hxx"
 #include "fs/SocketFilter.hxx"
+#ifdef HAVE_NGHTTP2
+#include "http2_client.hxx"
+#include "http2_stock.hxx"
+#include "http2_balancer.hxx"
+#endif
+#include "http_pipeline.hxx"
+#include "http_pipeline_stock.hxx"
+#include "http_pipeline_balancer.hxx"
 #include "pool/pool.hxx"
 #include "pool/LeakDetector.hxx"
 #include "event/Loop.hxx"
@@ -70,6 +78,34 @@ class HttpRequest final
 
     FilteredSocketBalancer &fs_balancer;
 
+#ifdef HAVE_NGHTTP2
+    /**
+     * If this is non-nullptr, then the request is sent over a
+     * (shared) HTTP/2 connection obtained from this balancer.
+     */
+    Http2Balancer *const http2_balancer;
+
+    /**
+     * The lease for one HTTP/2 stream; only used if #http2_balancer
+     * is set.
+     */
+    struct lease_ref http2_lease_ref;
+#endif
+
+    /**
+     * If this is non-nullptr, then the request is pipelined on a
+     * (shared) HTTP/1.1 connection obtained from this balancer.  It
+     * is only set for requests which may be sent again after the
+     * connection has failed.
+     */
+    HttpPipelineBalancer *const pipeline_balancer;
+
+    /**
+     * The lease for one pipelined request; only used if
+     * #pipeline_balancer is set.
+     */
+    struct lease_ref pipeline_lease_ref;
+
     const sticky_hash_t session_sticky;
 
     SocketFilterFactory *const filter_factory;
@@ -92,6 +128,8 @@ class HttpRequest final
 public:
     HttpRequest(struct pool &_pool, EventLoop &_event_loop,
                 FilteredSocketBalancer &_fs_balancer,
+                Http2Balancer *_http2_balancer,
+                HttpPipelineBalancer *_pipeline_balancer,
                 sticky_hash_t _session_sticky,
                 SocketFilterFactory *_filter_factory,
                 http_method_t _method,
@@ -102,6 +140,12 @@ public:
                 CancellablePointer &_cancel_ptr)
         :PoolLeakDetector(_pool),
          pool(_pool), event_loop(_event_loop), fs_balancer(_fs_balancer),
+#ifdef HAVE_NGHTTP2
+         http2_balancer(_http2_balancer),
+#endif
+         pipeline_balancer(http_pipeline_is_eligible(_method, (bool)_body)
+                           ? _pipeline_balancer
+                           : nullptr),
          session_sticky(_session_sticky),
          filter_factory(_filter_factory),
          method(_method), address(_address),
@@ -110,6 +154,10 @@ public:
          retries(body ? 0 : 2),
          handler(_handler)
     {
+#ifndef HAVE_NGHTTP2
+        (void)_http2_balancer;
+#endif
+
         _cancel_ptr = *this;
 
         if (address.host_and_port != nullptr)
@@ -117,6 +165,28 @@ public:
     }
 
     void BeginConnect() {
+#ifdef HAVE_NGHTTP2
+        if (http2_balancer != nullptr) {
+            http2_balancer->Get(pool,
+                                false, SocketAddress::Null(),
+                                session_sticky,
+                                address.addresses,
+                                HTTP_CONNECT_TIMEOUT,
+                                *this, http2_lease_ref, cancel_ptr);
+            return;
+        }
+#endif
+
+        if (pipeline_balancer != nullptr) {
+            pipeline_balancer->Get(pool,
+                                   false, SocketAddress::Null(),
+                                   session_sticky,
+                                   address.addresses,
+                                   HTTP_CONNECT_TIMEOUT,
+                                   *this, pipeline_lease_ref, cancel_ptr);
+            return;
+        }
+
         fs_balancer.Get(pool,
                         false, SocketAddress::Null(),
                         session_sticky,
@@ -214,7 +284,12 @@ HttpRequest::OnHttpError(std::exception_ptr ep) noexcept
         --retries;
         BeginConnect();
     } else {
-        if (IsHttpClientServerFailure(ep)) {
+        /* a refused pipelined request was not answered because the
+           connection faded after another request; that is not a
+           failure of this server */
+        if (IsHttpClientServerFailure(ep) &&
+            !(pipeline_balancer != nullptr &&
+              HasHttpClientErrorCode(ep, HttpClientErrorCode::REFUSED))) {
             failure->SetProtocol(event_loop.SteadyNow(),
                                  std::chrono::seconds(20));
         }
@@ -236,6 +311,35 @@ HttpRequest::OnStockItemReady(StockItem &item) noexcept
 
     stock_item = &item;
 
+#ifdef HAVE_NGHTTP2
+    if (http2_balancer != nullptr) {
+        failure = http2_balancer->GetFailureManager()
+            .Make(http2_stock_item_get_address(*stock_item));
+
+        http2_client_request(pool,
+                             http2_stock_item_get(item),
+                             *this,
+                             method, address.path, std::move(headers),
+                             std::move(body),
+                             *this, cancel_ptr);
+        return;
+    }
+#endif
+
+    if (pipeline_balancer != nullptr) {
+        failure = pipeline_balancer->GetFailureManager()
+            .Make(http_pipeline_stock_item_get_address(*stock_item));
+
+        /* the headers are copied, because they are needed again if
+           the pipelined request must be repeated */
+        http_pipeline_request(pool,
+                              http_pipeline_stock_item_get(item),
+                              *this,
+                              method, address.path, headers,
+                              *this, cancel_ptr);
+        return;
+    }
+
     failure = fs_balancer.GetFailureManager()
         .Make(fs_stock_item_get_address(*stock_item));
 
@@ -267,7 +371,17 @@ HttpRequest::ReleaseLease(bool reuse) noexcept
 {
     assert(stock_item != nullptr);
 
-    stock_item->Put(!reuse);
+#ifdef HAVE_NGHTTP2
+    if (http2_balancer != nullptr)
+        /* the stream lease is owned by the MultiStock item; the
+           connection itself stays in the stock */
+        http2_lease_ref.Release(reuse);
+    else
+#endif
+    if (pipeline_balancer != nullptr)
+        pipeline_lease_ref.Release(reuse);
+    else
+        stock_item->Put(!reuse);
     stock_item = nullptr;
 
     if (response_sent) {
@@ -283,6 +397,8 @@ HttpRequest::ReleaseLease(bool reuse) noexcept
 void
 http_request(struct pool &pool, EventLoop &event_loop,
              FilteredSocketBalancer &fs_balancer,
+             Http2Balancer *http2_balancer,
+             HttpPipelineBalancer *pipeline_balancer,
              sticky_hash_t session_sticky,
              SocketFilterFactory *filter_factory,
              http_method_t method,
@@ -296,6 +412,8 @@ http_request(struct pool &pool, EventLoop &event_loop,
     assert(uwa.path != nullptr);
 
     auto hr = NewFromPool<HttpRequest>(pool, pool, event_loop, fs_balancer,
+                                       http2_balancer,
+                                       pipeline_balancer,
                                        session_sticky,
                                        filter_factory,
                                        method, uwa,
@@ -40,6 +40,8 @@ struct pool;
 class EventLoop;
 class UnusedIstreamPtr;
 class FilteredSocketBalancer;
+class Http2Balancer;
+class HttpPipelineBalancer;
 class SocketFilterFactory;
 struct HttpAddress;
 class HttpResponseHandler;
@@ -51,10 +53,19 @@ class HttpHeaders;
  *
  * @param session_sticky a portion of the session id that is used to
  * select the worker; 0 means disable stickiness
+ * @param http2_balancer if not nullptr, then the request is sent over
+ * a HTTP/2 connection from this balancer; #filter_factory is ignored
+ * in this case
+ * @param pipeline_balancer if not nullptr, then GET and HEAD requests
+ * without a body are pipelined on a HTTP/1.1 connection from this
+ * balancer (unless #http2_balancer is set); #filter_factory is
+ * ignored for those
  */
 void
 http_request(struct pool &pool, EventLoop &event_loop,
              FilteredSocketBalancer &fs_balancer,
+             Http2Balancer *http2_balancer,
+             HttpPipelineBalancer *pipeline_balancer,
              sticky_hash_t session_sticky,
              SocketFilterFactory *filter_factory,
              http_method_t method,
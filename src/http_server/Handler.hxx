@@ -48,9 +48,10 @@ public:
      * Called after the empty line after the last header has been
      * parsed.  Several attributes can be evaluated (method, uri,
      * headers; but not the body).  This can be used to collect
-     * metadata for LogHttpRequest().
+     * metadata for LogHttpRequest() in
+     * HttpServerRequest::handler_data.
      */
-    virtual void RequestHeadersFinished(const HttpServerRequest &) noexcept {};
+    virtual void RequestHeadersFinished(HttpServerRequest &) noexcept {};
 
     virtual void HandleHttpRequest(HttpServerRequest &request,
                                    CancellablePointer &cancel_ptr) noexcept = 0;
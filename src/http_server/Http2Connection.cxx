@@ -0,0 +1,1222 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * HTTP/2 server implementation on top of libnghttp2.
+ */
+
+#include "Http2Connection.hxx"
+#include "Internal.hxx"
+#include "Request.hxx"
+#include "Handler.hxx"
+#include "http/Headers.hxx"
+#include "http/HeaderName.hxx"
+#include "http/Nghttp2Util.hxx"
+#include "istream/istream.hxx"
+#include "istream/New.hxx"
+#include "istream/Pointer.hxx"
+#include "pool/pool.hxx"
+#include "GrowingBuffer.hxx"
+#include "event/DeferEvent.hxx"
+#include "io/Logger.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DeleteDisposer.hxx"
+#include "util/StringView.hxx"
+#include "util/Exception.hxx"
+#include "util/DecimalFormat.h"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <assert.h>
+#include <string.h>
+
+/**
+ * The maximum number of concurrent streams announced to the client.
+ */
+static constexpr uint32_t HTTP2_MAX_CONCURRENT_STREAMS = 128;
+
+/**
+ * The maximum number of response body bytes buffered per stream
+ * while waiting for the peer's flow control window.
+ */
+static constexpr size_t HTTP2_RESPONSE_BUFFER = 32768;
+
+static constexpr char http2_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+class Http2ServerConnection;
+class Http2ServerStream;
+
+/**
+ * The request body of a HTTP/2 stream.  Incoming DATA frames are
+ * buffered, and the peer's flow control window is only extended after
+ * our handler has consumed the data.
+ */
+class Http2RequestBody final : public Istream {
+    Http2ServerStream &stream;
+
+    GrowingBuffer buffer;
+
+    DeferEvent defer_submit;
+
+    bool eof = false;
+
+public:
+    Http2RequestBody(struct pool &p, EventLoop &event_loop,
+                     Http2ServerStream &_stream) noexcept
+        :Istream(p), stream(_stream),
+         defer_submit(event_loop, BIND_THIS_METHOD(Submit)) {}
+
+    ~Http2RequestBody() noexcept {
+        defer_submit.Cancel();
+    }
+
+    void Feed(const void *data, size_t length) noexcept {
+        assert(!eof);
+
+        buffer.Write(data, length);
+        defer_submit.Schedule();
+    }
+
+    void SetEof() noexcept {
+        eof = true;
+        defer_submit.Schedule();
+    }
+
+    /**
+     * The stream was closed before the request body was complete.
+     */
+    void Abort() noexcept;
+
+private:
+    void Submit() noexcept;
+
+    /* virtual methods from class Istream */
+
+    off_t _GetAvailable(bool partial) noexcept override {
+        if (eof || partial)
+            return buffer.GetSize();
+
+        return -1;
+    }
+
+    void _Read() noexcept override {
+        Submit();
+    }
+
+    void _Close() noexcept override;
+};
+
+class Http2ServerStream final
+    : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+      public HttpServerResponder, IstreamHandler {
+
+    Http2ServerConnection &connection;
+
+    const int32_t id;
+
+    const PoolPtr pool;
+
+    /* pseudo headers received from the client */
+    http_method_t method = HTTP_METHOD_NULL;
+    const char *path = nullptr, *authority = nullptr;
+
+    HttpServerRequest *request = nullptr;
+
+    /**
+     * The request body, as long as it is still being read by our
+     * handler.
+     */
+    Http2RequestBody *body = nullptr;
+
+    /**
+     * Cancels the #HttpServerConnectionHandler while it is handling
+     * the request.
+     */
+    CancellablePointer cancel_ptr;
+
+    /**
+     * Invokes the #HttpServerConnectionHandler outside of nghttp2
+     * callbacks.
+     */
+    DeferEvent defer_handle;
+
+    /**
+     * Reads more data from #response_body outside of nghttp2
+     * callbacks.
+     */
+    DeferEvent defer_read;
+
+    /**
+     * Destroys this object after nghttp2 has closed the stream.
+     */
+    DeferEvent defer_close;
+
+    IstreamPointer response_body;
+
+    /**
+     * Response body data waiting for the peer's flow control window.
+     */
+    GrowingBuffer response_buffer;
+
+    http_status_t status = http_status_t(0);
+
+    /**
+     * The number of response body bytes sent, or negative if there
+     * is no response body.
+     */
+    off_t response_length = -1;
+
+    uint64_t bytes_received = 0, bytes_sent = 0;
+
+    /**
+     * Has #response_body reported end-of-file?
+     */
+    bool response_eof = false;
+
+    /**
+     * Has the nghttp2 data provider returned NGHTTP2_ERR_DEFERRED?
+     */
+    bool response_deferred = false;
+
+    /**
+     * Has nghttp2 closed the stream?  No nghttp2 function may be
+     * called for it anymore.
+     */
+    bool closed = false;
+
+public:
+    Http2ServerStream(Http2ServerConnection &_connection,
+                      int32_t _id) noexcept;
+
+    ~Http2ServerStream() noexcept;
+
+    /**
+     * @return false if the stream shall be reset
+     */
+    bool OnHeader(StringView name, StringView value) noexcept;
+
+    /**
+     * @return false if the stream shall be reset
+     */
+    bool OnHeadersComplete(bool end_stream) noexcept;
+
+    void OnRequestData(const uint8_t *data, size_t length) noexcept;
+    void OnEndStream() noexcept;
+    void OnStreamClose() noexcept;
+
+    ssize_t ReadResponse(uint8_t *buf, size_t length,
+                         uint32_t &data_flags) noexcept;
+
+    /**
+     * Our handler has consumed data from #Http2RequestBody.
+     */
+    void OnRequestBodyConsumed(size_t nbytes) noexcept;
+
+    void OnRequestBodyEof() noexcept {
+        assert(body != nullptr);
+
+        body = nullptr;
+    }
+
+    /**
+     * Our handler has closed the #Http2RequestBody.
+     *
+     * @param pending the number of bytes which were still buffered
+     */
+    void OnRequestBodyClosed(size_t pending) noexcept;
+
+private:
+    bool MakeRequest() noexcept;
+
+    void Log() noexcept;
+
+    /**
+     * Tell nghttp2 that more response body data is available.
+     */
+    void ResumeResponse() noexcept;
+
+    void ResetStream(uint32_t error_code) noexcept;
+
+    void OnDeferredHandle() noexcept;
+    void OnDeferredRead() noexcept;
+
+    void OnDeferredClose() noexcept;
+
+    static ssize_t ReadCallback(nghttp2_session *session, int32_t stream_id,
+                                uint8_t *buf, size_t length,
+                                uint32_t *data_flags,
+                                nghttp2_data_source *source,
+                                void *user_data) noexcept;
+
+    /* virtual methods from class HttpServerResponder */
+    EventLoop &GetEventLoop() noexcept override;
+
+    void SendResponse(const HttpServerRequest &request,
+                      http_status_t status,
+                      HttpHeaders &&headers,
+                      UnusedIstreamPtr body) noexcept override;
+
+    /* virtual methods from class IstreamHandler */
+    size_t OnData(const void *data, size_t length) noexcept override;
+    void OnEof() noexcept override;
+    void OnError(std::exception_ptr ep) noexcept override;
+};
+
+class Http2ServerConnection final : BufferedSocketHandler {
+    HttpServerConnection &parent;
+
+    nghttp2_session *session;
+
+    /**
+     * Collect frames generated by nghttp2 and write them to the
+     * socket, but not inside a nghttp2 callback.
+     */
+    DeferEvent defer_send;
+
+    /**
+     * Frame data which was generated by nghttp2, but could not yet
+     * be written to the socket.
+     */
+    GrowingBuffer output;
+
+    typedef boost::intrusive::list<Http2ServerStream,
+                                   boost::intrusive::constant_time_size<false>> StreamList;
+
+    StreamList streams;
+
+public:
+    explicit Http2ServerConnection(HttpServerConnection &_parent);
+    ~Http2ServerConnection() noexcept;
+
+    HttpServerConnection &GetParent() noexcept {
+        return parent;
+    }
+
+    EventLoop &GetEventLoop() noexcept {
+        return defer_send.GetEventLoop();
+    }
+
+    nghttp2_session *GetSession() noexcept {
+        return session;
+    }
+
+    void ScheduleSend() noexcept {
+        defer_send.Schedule();
+    }
+
+    void DestroyStream(Http2ServerStream &stream) noexcept;
+
+    void Graceful() noexcept;
+
+    BufferedResult Feed() noexcept;
+
+private:
+    /**
+     * Write pending frames to the socket.
+     *
+     * @return false if the connection has been closed
+     */
+    bool Send() noexcept;
+
+    /**
+     * Like Send(), but also close the connection if nghttp2 has
+     * nothing left to do (after GOAWAY).
+     *
+     * @return false if the connection has been closed
+     */
+    bool Flush() noexcept;
+
+    void OnDeferredSend() noexcept {
+        Flush();
+    }
+
+    static int OnBeginHeadersCallback(nghttp2_session *session,
+                                      const nghttp2_frame *frame,
+                                      void *user_data) noexcept;
+
+    static int OnHeaderCallback(nghttp2_session *session,
+                                const nghttp2_frame *frame,
+                                const uint8_t *name, size_t namelen,
+                                const uint8_t *value, size_t valuelen,
+                                uint8_t flags, void *user_data) noexcept;
+
+    static int OnFrameRecvCallback(nghttp2_session *session,
+                                   const nghttp2_frame *frame,
+                                   void *user_data) noexcept;
+
+    static int OnDataChunkRecvCallback(nghttp2_session *session,
+                                       uint8_t flags, int32_t stream_id,
+                                       const uint8_t *data, size_t len,
+                                       void *user_data) noexcept;
+
+    static int OnStreamCloseCallback(nghttp2_session *session,
+                                     int32_t stream_id,
+                                     uint32_t error_code,
+                                     void *user_data) noexcept;
+
+    /* virtual methods from class BufferedSocketHandler */
+    BufferedResult OnBufferedData() override;
+    bool OnBufferedClosed() noexcept override;
+    bool OnBufferedWrite() override;
+    bool OnBufferedDrained() noexcept override;
+    void OnBufferedError(std::exception_ptr e) noexcept override;
+};
+
+/*
+ * Http2RequestBody
+ *
+ */
+
+void
+Http2RequestBody::Submit() noexcept
+{
+    if (!HasHandler())
+        /* our handler has not yet started reading */
+        return;
+
+    while (true) {
+        auto r = buffer.Read();
+        if (r.empty())
+            break;
+
+        size_t nbytes = InvokeData(r.data, r.size);
+        if (nbytes == 0)
+            /* blocking or closed */
+            return;
+
+        buffer.Consume(nbytes);
+        stream.OnRequestBodyConsumed(nbytes);
+
+        if (nbytes < r.size)
+            return;
+    }
+
+    if (eof) {
+        stream.OnRequestBodyEof();
+        DestroyEof();
+    }
+}
+
+void
+Http2RequestBody::Abort() noexcept
+{
+    stream.OnRequestBodyClosed(buffer.GetSize());
+    DestroyError(std::make_exception_ptr(std::runtime_error("HTTP/2 stream closed prematurely")));
+}
+
+void
+Http2RequestBody::_Close() noexcept
+{
+    stream.OnRequestBodyClosed(buffer.GetSize());
+    Destroy();
+}
+
+/*
+ * Http2ServerStream
+ *
+ */
+
+Http2ServerStream::Http2ServerStream(Http2ServerConnection &_connection,
+                                     int32_t _id) noexcept
+    :connection(_connection), id(_id),
+     pool(pool_new_linear(connection.GetParent().pool,
+                          "http2_server_request", 8192)),
+     defer_handle(connection.GetEventLoop(),
+                  BIND_THIS_METHOD(OnDeferredHandle)),
+     defer_read(connection.GetEventLoop(),
+                BIND_THIS_METHOD(OnDeferredRead)),
+     defer_close(connection.GetEventLoop(),
+                 BIND_THIS_METHOD(OnDeferredClose)),
+     response_body(nullptr)
+{
+    pool_set_major(pool);
+}
+
+Http2ServerStream::~Http2ServerStream() noexcept
+{
+    /* from here on, nghttp2 must not be used for this stream */
+    closed = true;
+
+    defer_handle.Cancel();
+    defer_read.Cancel();
+    defer_close.Cancel();
+
+    if (response_body.IsDefined())
+        response_body.ClearAndClose();
+    else if (cancel_ptr)
+        cancel_ptr.Cancel();
+
+    if (body != nullptr && body->HasHandler())
+        /* the request body is still being read, but the client won't
+           send any more */
+        body->Abort();
+
+    if (status != http_status_t(0))
+        Log();
+
+    if (request != nullptr)
+        /* this closes the request body if it was never used */
+        request->Destroy();
+}
+
+gcc_pure
+static http_method_t
+ParseMethod(StringView s) noexcept
+{
+    for (unsigned i = HTTP_METHOD_NULL + 1; i < HTTP_METHOD_INVALID; ++i) {
+        const auto m = http_method_t(i);
+        if (s.Equals(http_method_to_string(m)))
+            return m;
+    }
+
+    return HTTP_METHOD_NULL;
+}
+
+inline bool
+Http2ServerStream::MakeRequest() noexcept
+{
+    assert(request == nullptr);
+
+    if (method == HTTP_METHOD_NULL || path == nullptr)
+        return false;
+
+    auto &parent = connection.GetParent();
+    request = NewFromPool<HttpServerRequest>(PoolPtr(pool), *this,
+                                             parent.local_address,
+                                             parent.remote_address,
+                                             parent.local_host_and_port,
+                                             parent.remote_host,
+                                             method, path);
+    return true;
+}
+
+bool
+Http2ServerStream::OnHeader(StringView name, StringView value) noexcept
+{
+    bytes_received += name.size + value.size;
+
+    if (!name.empty() && name.front() == ':') {
+        /* nghttp2 has already verified that pseudo headers precede
+           all regular headers */
+        assert(request == nullptr);
+
+        if (name.Equals(":method")) {
+            method = ParseMethod(value);
+            return method != HTTP_METHOD_NULL;
+        } else if (name.Equals(":path"))
+            path = p_strndup(pool, value.data, value.size);
+        else if (name.Equals(":authority"))
+            authority = p_strndup(pool, value.data, value.size);
+
+        return true;
+    }
+
+    if (request == nullptr && !MakeRequest())
+        return false;
+
+    const char *v = p_strndup(pool, value.data, value.size);
+
+    if (name.Equals("cookie")) {
+        /* HTTP/2 allows splitting the Cookie header; concatenate all
+           of them (RFC 7540 8.1.2.5) */
+        const char *old = request->headers.Get("cookie");
+        if (old != nullptr) {
+            request->headers.Set("cookie",
+                                 p_strcat(pool, old, "; ", v, nullptr));
+            return true;
+        }
+    }
+
+    request->headers.Add(p_strndup(pool, name.data, name.size), v);
+    return true;
+}
+
+bool
+Http2ServerStream::OnHeadersComplete(bool end_stream) noexcept
+{
+    if (request == nullptr && !MakeRequest())
+        return false;
+
+    /* our handlers expect the "Host" request header */
+    if (authority != nullptr && !request->headers.Contains("host"))
+        request->headers.Add("host", authority);
+
+    if (!end_stream) {
+        body = NewIstream<Http2RequestBody>(pool, connection.GetEventLoop(),
+                                            *this);
+        request->body = UnusedIstreamPtr(body);
+    }
+
+    defer_handle.Schedule();
+    return true;
+}
+
+void
+Http2ServerStream::OnRequestData(const uint8_t *data, size_t length) noexcept
+{
+    bytes_received += length;
+
+    if (body != nullptr)
+        body->Feed(data, length);
+    else
+        /* nobody is interested in the request body; discard it */
+        nghttp2_session_consume(connection.GetSession(), id, length);
+}
+
+void
+Http2ServerStream::OnEndStream() noexcept
+{
+    if (body != nullptr)
+        body->SetEof();
+}
+
+void
+Http2ServerStream::OnStreamClose() noexcept
+{
+    closed = true;
+    defer_close.Schedule();
+}
+
+inline void
+Http2ServerStream::OnDeferredClose() noexcept
+{
+    connection.DestroyStream(*this);
+}
+
+EventLoop &
+Http2ServerStream::GetEventLoop() noexcept
+{
+    return connection.GetEventLoop();
+}
+
+void
+Http2ServerStream::OnRequestBodyConsumed(size_t nbytes) noexcept
+{
+    /* this is legal even after the stream has been closed; nghttp2
+       then only extends the connection's window */
+    nghttp2_session_consume(connection.GetSession(), id, nbytes);
+    connection.ScheduleSend();
+}
+
+void
+Http2ServerStream::OnRequestBodyClosed(size_t pending) noexcept
+{
+    assert(body != nullptr);
+
+    body = nullptr;
+
+    if (pending > 0)
+        OnRequestBodyConsumed(pending);
+}
+
+void
+Http2ServerStream::Log() noexcept
+{
+    auto *handler = connection.GetParent().handler;
+    if (handler == nullptr)
+        /* this can happen when called via
+           http_server_connection_close() (during daemon shutdown) */
+        return;
+
+    handler->LogHttpRequest(*request, status, response_length,
+                            bytes_received, bytes_sent);
+}
+
+void
+Http2ServerStream::ResetStream(uint32_t error_code) noexcept
+{
+    if (closed)
+        return;
+
+    nghttp2_submit_rst_stream(connection.GetSession(), NGHTTP2_FLAG_NONE,
+                              id, error_code);
+    connection.ScheduleSend();
+}
+
+void
+Http2ServerStream::OnDeferredHandle() noexcept
+{
+    assert(request != nullptr);
+
+    auto *handler = connection.GetParent().handler;
+    assert(handler != nullptr);
+
+    handler->RequestHeadersFinished(*request);
+    handler->HandleHttpRequest(*request, cancel_ptr);
+}
+
+void
+Http2ServerStream::SendResponse(gcc_unused const HttpServerRequest &_request,
+                                http_status_t _status,
+                                HttpHeaders &&headers,
+                                UnusedIstreamPtr response) noexcept
+{
+    assert(&_request == request);
+    assert(http_status_is_valid(_status));
+    assert(status == http_status_t(0));
+    assert(!response_body.IsDefined());
+
+    cancel_ptr = nullptr;
+    status = _status;
+
+    auto &parent = connection.GetParent();
+    if (http_status_is_success(status)) {
+        if (parent.score == HTTP_SERVER_FIRST)
+            parent.score = HTTP_SERVER_SUCCESS;
+    } else {
+        parent.score = HTTP_SERVER_ERROR;
+    }
+
+    if (closed)
+        /* the client has reset the stream meanwhile */
+        return;
+
+    const bool got_body = response;
+    const off_t content_length = got_body ? response.GetAvailable(false) : 0;
+    if (http_method_is_empty(request->method) ||
+        http_status_is_empty(status))
+        response.Clear();
+
+    char content_length_buffer[32];
+    const bool send_content_length = content_length >= 0 &&
+        !http_status_is_empty(status) &&
+        (got_body || !http_method_is_empty(request->method));
+    if (send_content_length)
+        format_uint64(content_length_buffer, content_length);
+
+    const StringMap map(std::move(headers).ToMap());
+
+    size_t n = 2;
+    for (gcc_unused const auto &i : map)
+        ++n;
+
+    auto *nva = PoolAlloc<nghttp2_nv>(pool, n);
+    size_t i = 0;
+
+    /* the first three characters of the status string are the status
+       code */
+    nva[i++] = MakeNv(":status", http_status_to_string(status), 3);
+
+    if (send_content_length)
+        nva[i++] = MakeNv("content-length", content_length_buffer);
+
+    for (const auto &h : map) {
+        if (http_header_is_hop_by_hop(h.key) ||
+            (send_content_length && strcmp(h.key, "content-length") == 0))
+            continue;
+
+        nva[i++] = MakeNv(h.key, h.value);
+    }
+
+    for (size_t j = 0; j < i; ++j)
+        bytes_sent += nva[j].namelen + nva[j].valuelen;
+
+    nghttp2_data_provider provider;
+    provider.source.ptr = this;
+    provider.read_callback = ReadCallback;
+
+    int result = nghttp2_submit_response(connection.GetSession(), id, nva, i,
+                                         response ? &provider : nullptr);
+    if (result != 0) {
+        LogConcat(2, "http2", "nghttp2_submit_response() failed: ",
+                  nghttp2_strerror(result));
+        ResetStream(NGHTTP2_INTERNAL_ERROR);
+        return;
+    }
+
+    if (response) {
+        response_length = 0;
+        response_body.Set(std::move(response), *this);
+        defer_read.Schedule();
+    }
+
+    connection.ScheduleSend();
+}
+
+void
+Http2ServerStream::ResumeResponse() noexcept
+{
+    if (closed || !response_deferred)
+        return;
+
+    response_deferred = false;
+    nghttp2_session_resume_data(connection.GetSession(), id);
+    connection.ScheduleSend();
+}
+
+void
+Http2ServerStream::OnDeferredRead() noexcept
+{
+    if (response_body.IsDefined() &&
+        response_buffer.GetSize() < HTTP2_RESPONSE_BUFFER)
+        response_body.Read();
+}
+
+ssize_t
+Http2ServerStream::ReadResponse(uint8_t *buf, size_t length,
+                                uint32_t &data_flags) noexcept
+{
+    auto r = response_buffer.Read();
+    if (r.empty()) {
+        if (response_eof) {
+            data_flags |= NGHTTP2_DATA_FLAG_EOF;
+            return 0;
+        }
+
+        /* wait for OnData() */
+        response_deferred = true;
+        defer_read.Schedule();
+        return NGHTTP2_ERR_DEFERRED;
+    }
+
+    const size_t nbytes = std::min(length, r.size);
+    memcpy(buf, r.data, nbytes);
+    response_buffer.Consume(nbytes);
+
+    response_length += nbytes;
+    bytes_sent += nbytes;
+
+    if (response_eof && response_buffer.IsEmpty())
+        data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    else if (response_body.IsDefined())
+        defer_read.Schedule();
+
+    return nbytes;
+}
+
+ssize_t
+Http2ServerStream::ReadCallback(nghttp2_session *, int32_t,
+                                uint8_t *buf, size_t length,
+                                uint32_t *data_flags,
+                                nghttp2_data_source *source,
+                                void *) noexcept
+{
+    auto &stream = *(Http2ServerStream *)source->ptr;
+    return stream.ReadResponse(buf, length, *data_flags);
+}
+
+size_t
+Http2ServerStream::OnData(const void *data, size_t length) noexcept
+{
+    const size_t buffered = response_buffer.GetSize();
+    if (buffered >= HTTP2_RESPONSE_BUFFER)
+        return 0;
+
+    const size_t nbytes = std::min(length, HTTP2_RESPONSE_BUFFER - buffered);
+    response_buffer.Write(data, nbytes);
+    ResumeResponse();
+    return nbytes;
+}
+
+void
+Http2ServerStream::OnEof() noexcept
+{
+    response_body.Clear();
+    response_eof = true;
+    ResumeResponse();
+}
+
+void
+Http2ServerStream::OnError(std::exception_ptr ep) noexcept
+{
+    response_body.Clear();
+
+    LogConcat(2, "http2", "error on HTTP/2 response stream: ",
+              GetFullMessage(ep).c_str());
+
+    ResetStream(NGHTTP2_INTERNAL_ERROR);
+}
+
+/*
+ * nghttp2 callbacks
+ *
+ */
+
+static Http2ServerStream *
+GetStream(nghttp2_session *session, int32_t stream_id) noexcept
+{
+    return (Http2ServerStream *)
+        nghttp2_session_get_stream_user_data(session, stream_id);
+}
+
+gcc_pure
+static bool
+IsRequestHeaders(const nghttp2_frame &frame) noexcept
+{
+    return frame.hd.type == NGHTTP2_HEADERS &&
+        frame.headers.cat == NGHTTP2_HCAT_REQUEST;
+}
+
+int
+Http2ServerConnection::OnBeginHeadersCallback(nghttp2_session *session,
+                                              const nghttp2_frame *frame,
+                                              void *user_data) noexcept
+{
+    if (!IsRequestHeaders(*frame))
+        return 0;
+
+    auto &c = *(Http2ServerConnection *)user_data;
+
+    auto *stream = new Http2ServerStream(c, frame->hd.stream_id);
+    c.streams.push_back(*stream);
+    nghttp2_session_set_stream_user_data(session, frame->hd.stream_id,
+                                         stream);
+
+    /* the connection is not idle anymore */
+    c.parent.idle_timeout.Cancel();
+
+    return 0;
+}
+
+int
+Http2ServerConnection::OnHeaderCallback(nghttp2_session *session,
+                                        const nghttp2_frame *frame,
+                                        const uint8_t *name, size_t namelen,
+                                        const uint8_t *value, size_t valuelen,
+                                        uint8_t, void *) noexcept
+{
+    if (!IsRequestHeaders(*frame))
+        /* ignore trailers */
+        return 0;
+
+    auto *stream = GetStream(session, frame->hd.stream_id);
+    if (stream == nullptr)
+        return 0;
+
+    return stream->OnHeader({(const char *)name, namelen},
+                            {(const char *)value, valuelen})
+        ? 0
+        : NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+}
+
+int
+Http2ServerConnection::OnFrameRecvCallback(nghttp2_session *session,
+                                           const nghttp2_frame *frame,
+                                           void *) noexcept
+{
+    if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+        return 0;
+
+    auto *stream = GetStream(session, frame->hd.stream_id);
+    if (stream == nullptr)
+        return 0;
+
+    const bool end_stream = (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0;
+
+    if (IsRequestHeaders(*frame)) {
+        if (!stream->OnHeadersComplete(end_stream))
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE,
+                                      frame->hd.stream_id,
+                                      NGHTTP2_PROTOCOL_ERROR);
+    } else if (end_stream)
+        stream->OnEndStream();
+
+    return 0;
+}
+
+int
+Http2ServerConnection::OnDataChunkRecvCallback(nghttp2_session *session,
+                                               uint8_t, int32_t stream_id,
+                                               const uint8_t *data, size_t len,
+                                               void *) noexcept
+{
+    auto *stream = GetStream(session, stream_id);
+    if (stream == nullptr) {
+        nghttp2_session_consume_connection(session, len);
+        return 0;
+    }
+
+    stream->OnRequestData(data, len);
+    return 0;
+}
+
+int
+Http2ServerConnection::OnStreamCloseCallback(nghttp2_session *session,
+                                             int32_t stream_id,
+                                             uint32_t, void *) noexcept
+{
+    auto *stream = GetStream(session, stream_id);
+    if (stream != nullptr)
+        stream->OnStreamClose();
+
+    return 0;
+}
+
+/*
+ * Http2ServerConnection
+ *
+ */
+
+Http2ServerConnection::Http2ServerConnection(HttpServerConnection &_parent)
+    :parent(_parent),
+     defer_send(parent.GetEventLoop(), BIND_THIS_METHOD(OnDeferredSend))
+{
+    nghttp2_session_callbacks *callbacks;
+    int result = nghttp2_session_callbacks_new(&callbacks);
+    if (result != 0)
+        throw MakeNgHttp2Error(result, "nghttp2_session_callbacks_new() failed");
+
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks,
+                                                            OnBeginHeadersCallback);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks,
+                                                     OnHeaderCallback);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                         OnFrameRecvCallback);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                              OnDataChunkRecvCallback);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                           OnStreamCloseCallback);
+
+    nghttp2_option *option;
+    result = nghttp2_option_new(&option);
+    if (result != 0) {
+        nghttp2_session_callbacks_del(callbacks);
+        throw MakeNgHttp2Error(result, "nghttp2_option_new() failed");
+    }
+
+    /* flow control follows our request body consumers, see
+       Http2ServerStream::OnRequestBodyConsumed() */
+    nghttp2_option_set_no_auto_window_update(option, 1);
+
+    result = nghttp2_session_server_new2(&session, callbacks, this, option);
+    nghttp2_option_del(option);
+    nghttp2_session_callbacks_del(callbacks);
+    if (result != 0)
+        throw MakeNgHttp2Error(result, "nghttp2_session_server_new2() failed");
+
+    static constexpr nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, HTTP2_MAX_CONCURRENT_STREAMS },
+    };
+
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE,
+                            settings, std::size(settings));
+
+    parent.socket.Reinit(Event::Duration(-1), http_server_write_timeout,
+                         *this);
+    parent.socket.ScheduleReadNoTimeout(false);
+}
+
+Http2ServerConnection::~Http2ServerConnection() noexcept
+{
+    streams.clear_and_dispose(DeleteDisposer());
+
+    /* cancel this after destroying the streams, which may have
+       scheduled it again */
+    defer_send.Cancel();
+
+    nghttp2_session_del(session);
+}
+
+void
+Http2ServerConnection::DestroyStream(Http2ServerStream &stream) noexcept
+{
+    streams.erase_and_dispose(streams.iterator_to(stream), DeleteDisposer());
+
+    if (streams.empty())
+        parent.idle_timeout.Schedule(http_server_idle_timeout);
+
+    /* check whether the connection can be closed (after GOAWAY) */
+    ScheduleSend();
+}
+
+inline void
+Http2ServerConnection::Graceful() noexcept
+{
+    nghttp2_submit_goaway(session, NGHTTP2_FLAG_NONE,
+                          nghttp2_session_get_last_proc_stream_id(session),
+                          NGHTTP2_NO_ERROR, nullptr, 0);
+    ScheduleSend();
+}
+
+bool
+Http2ServerConnection::Send() noexcept
+{
+    while (true) {
+        if (output.IsEmpty()) {
+            const uint8_t *data;
+            ssize_t nbytes = nghttp2_session_mem_send(session, &data);
+            if (nbytes < 0) {
+                parent.Error(std::make_exception_ptr(MakeNgHttp2Error(nbytes, "nghttp2_session_mem_send() failed")));
+                return false;
+            }
+
+            if (nbytes == 0)
+                break;
+
+            output.Write(data, nbytes);
+        }
+
+        const auto r = output.Read();
+        ssize_t nbytes = parent.socket.Write(r.data, r.size);
+        if (nbytes < 0) {
+            if (gcc_likely(nbytes == WRITE_BLOCKING)) {
+                parent.socket.ScheduleWrite();
+                return true;
+            }
+
+            if (nbytes != WRITE_DESTROYED)
+                parent.SocketErrorErrno("write error on HTTP/2 connection");
+            return false;
+        }
+
+        output.Consume(nbytes);
+
+        if (size_t(nbytes) < r.size) {
+            parent.socket.ScheduleWrite();
+            return true;
+        }
+    }
+
+    parent.socket.UnscheduleWrite();
+    return true;
+}
+
+bool
+Http2ServerConnection::Flush() noexcept
+{
+    if (!Send())
+        return false;
+
+    if (output.IsEmpty() && streams.empty() &&
+        nghttp2_session_want_read(session) == 0 &&
+        nghttp2_session_want_write(session) == 0) {
+        /* GOAWAY has been exchanged and all streams are finished */
+        parent.Done();
+        return false;
+    }
+
+    return true;
+}
+
+inline BufferedResult
+Http2ServerConnection::Feed() noexcept
+{
+    auto r = parent.socket.ReadBuffer();
+    assert(!r.empty());
+
+    ssize_t nbytes = nghttp2_session_mem_recv(session,
+                                              (const uint8_t *)r.data,
+                                              r.size);
+    if (nbytes < 0) {
+        parent.ProtocolError(nghttp2_strerror(nbytes));
+        return BufferedResult::CLOSED;
+    }
+
+    parent.socket.DisposeConsumed(nbytes);
+
+    /* send SETTINGS acknowledgements, WINDOW_UPDATE frames etc. */
+    ScheduleSend();
+
+    return BufferedResult::OK;
+}
+
+/*
+ * BufferedSocketHandler
+ *
+ */
+
+BufferedResult
+Http2ServerConnection::OnBufferedData()
+{
+    return Feed();
+}
+
+bool
+Http2ServerConnection::OnBufferedClosed() noexcept
+{
+    parent.Cancel();
+    return false;
+}
+
+bool
+Http2ServerConnection::OnBufferedWrite()
+{
+    return Flush();
+}
+
+bool
+Http2ServerConnection::OnBufferedDrained() noexcept
+{
+    return true;
+}
+
+void
+Http2ServerConnection::OnBufferedError(std::exception_ptr e) noexcept
+{
+    parent.SocketError(e);
+}
+
+/*
+ * public API
+ *
+ */
+
+Http2Preface
+http2_check_preface(const void *data, size_t length) noexcept
+{
+    constexpr size_t preface_length = sizeof(http2_preface) - 1;
+    const size_t n = std::min(length, preface_length);
+
+    if (memcmp(data, http2_preface, n) != 0)
+        return Http2Preface::NO;
+
+    return n < preface_length
+        ? Http2Preface::INCOMPLETE
+        : Http2Preface::YES;
+}
+
+Http2ServerConnection *
+http2_server_connection_new(HttpServerConnection &parent)
+{
+    return new Http2ServerConnection(parent);
+}
+
+void
+http2_server_connection_free(Http2ServerConnection *connection) noexcept
+{
+    delete connection;
+}
+
+BufferedResult
+http2_server_connection_feed(Http2ServerConnection &connection) noexcept
+{
+    return connection.Feed();
+}
+
+void
+http2_server_connection_graceful(Http2ServerConnection &connection) noexcept
+{
+    connection.Graceful();
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * HTTP/2 server implementation on top of libnghttp2.
+ */
+
+#ifndef BENG_HTTP_SERVER_HTTP2_CONNECTION_HXX
+#define BENG_HTTP_SERVER_HTTP2_CONNECTION_HXX
+
+#include "util/Compiler.h"
+
+#include <stddef.h>
+
+enum class BufferedResult;
+struct HttpServerConnection;
+class Http2ServerConnection;
+
+enum class Http2Preface {
+    /**
+     * This is not a HTTP/2 connection.
+     */
+    NO,
+
+    /**
+     * The received data is a prefix of the connection preface; wait
+     * for more.
+     */
+    INCOMPLETE,
+
+    /**
+     * The client has sent the full HTTP/2 connection preface.
+     */
+    YES,
+};
+
+/**
+ * Check whether the data received on a new connection begins with
+ * the HTTP/2 client connection preface (RFC 7540 3.5).  This is the
+ * case if the client has negotiated "h2" via ALPN or if it has
+ * "prior knowledge" of HTTP/2 support.
+ */
+gcc_pure
+Http2Preface
+http2_check_preface(const void *data, size_t length) noexcept;
+
+/**
+ * Create a HTTP/2 session which takes over the socket of the given
+ * #HttpServerConnection.  Each stream is mapped to a
+ * #HttpServerRequest and passed to the connection's
+ * #HttpServerConnectionHandler.
+ *
+ * Throws std::runtime_error on error.
+ */
+Http2ServerConnection *
+http2_server_connection_new(HttpServerConnection &parent);
+
+/**
+ * Destroy the HTTP/2 session, aborting all streams.  This does not
+ * touch the socket and does not invoke the handler.
+ */
+void
+http2_server_connection_free(Http2ServerConnection *connection) noexcept;
+
+/**
+ * Feed data from the socket's input buffer into the HTTP/2 session.
+ */
+BufferedResult
+http2_server_connection_feed(Http2ServerConnection &connection) noexcept;
+
+/**
+ * Send GOAWAY; the connection will be closed as soon as all pending
+ * streams are finished.
+ */
+void
+http2_server_connection_graceful(Http2ServerConnection &connection) noexcept;
+
+#endif
@@ -34,6 +34,7 @@
 #define __BENG_HTTP_SERVER_INTERNAL_H
 
 #include "Error.hxx"
+#include "Request.hxx"
 #include "http_server.hxx"
 #include "http_body.hxx"
 #include "fs/FilteredSocket.hxx"
@@ -48,8 +49,13 @@
 #include "util/DestructObserver.hxx"
 #include "util/Exception.hxx"
 
+#ifdef HAVE_NGHTTP2
+class Http2ServerConnection;
+#endif
+
 struct HttpServerConnection final
-    : BufferedSocketHandler, IstreamHandler, DestructAnchor {
+    : BufferedSocketHandler, IstreamHandler, HttpServerResponder,
+      DestructAnchor {
 
     enum class BucketResult {
         /**
@@ -200,16 +206,30 @@ struct HttpServerConnection final
 
     bool date_header;
 
+    /**
+     * Shall the HTTP/2 connection preface be accepted?
+     */
+    const bool http2_enabled;
+
     /* connection settings */
     bool keep_alive;
 
+#ifdef HAVE_NGHTTP2
+    /**
+     * If the client has sent the HTTP/2 connection preface, this
+     * object has taken over the socket; the #request and #response
+     * attributes are unused from then on.
+     */
+    Http2ServerConnection *http2 = nullptr;
+#endif
+
     HttpServerConnection(struct pool &_pool,
                          EventLoop &_loop,
                          UniqueSocketDescriptor &&fd, FdType fd_type,
                          SocketFilterPtr &&filter,
                          SocketAddress _local_address,
                          SocketAddress _remote_address,
-                         bool _date_header,
+                         bool _date_header, bool _http2_enabled,
                          HttpServerConnectionHandler &_handler);
 
     ~HttpServerConnection() {
@@ -218,7 +238,7 @@ struct HttpServerConnection final
 
     void Delete() noexcept;
 
-    EventLoop &GetEventLoop() {
+    EventLoop &GetEventLoop() noexcept override {
         return defer_read.GetEventLoop();
     }
 
@@ -243,11 +263,6 @@ struct HttpServerConnection final
      */
     bool HeadersFinished();
 
-    /**
-     * @return false if the connection has been closed
-     */
-    bool HandleLine(const char *line, size_t length);
-
     BufferedResult FeedHeaders(const void *_data, size_t length);
 
     /**
@@ -300,6 +315,13 @@ struct HttpServerConnection final
                         HttpHeaders &&headers,
                         UnusedIstreamPtr body);
 
+#ifdef HAVE_NGHTTP2
+    /**
+     * Hand the socket over to a #Http2ServerConnection.
+     */
+    BufferedResult UpgradeHttp2();
+#endif
+
     void ScheduleWrite() {
         response.want_write = true;
         socket.ScheduleWrite();
@@ -372,6 +394,12 @@ struct HttpServerConnection final
     ssize_t OnDirect(FdType type, int fd, size_t max_length) noexcept override;
     void OnEof() noexcept override;
     void OnError(std::exception_ptr ep) noexcept override;
+
+    /* virtual methods from class HttpServerResponder */
+    void SendResponse(const HttpServerRequest &request,
+                      http_status_t status,
+                      HttpHeaders &&headers,
+                      UnusedIstreamPtr body) noexcept override;
 };
 
 /**
@@ -40,14 +40,14 @@
 #include "util/StringView.hxx"
 
 HttpServerRequest::HttpServerRequest(PoolPtr &&_pool,
-                                     HttpServerConnection &_connection,
+                                     HttpServerResponder &_responder,
                                      SocketAddress _local_address,
                                      SocketAddress _remote_address,
                                      const char *_local_host_and_port,
                                      const char *_remote_host,
                                      http_method_t _method,
                                      StringView _uri)
-    :pool(std::move(_pool)), connection(_connection),
+    :pool(std::move(_pool)), responder(_responder),
      local_address(_local_address),
      remote_address(_remote_address),
      local_host_and_port(_local_host_and_port),
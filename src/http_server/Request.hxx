@@ -40,6 +40,7 @@
 #include "strmap.hxx"
 #include "net/SocketAddress.hxx"
 #include "http/Method.h"
+#include "http/Status.h"
 #include "pool/Ptr.hxx"
 #include "istream/UnusedPtr.hxx"
 
@@ -47,12 +48,29 @@ struct pool;
 struct StringView;
 class StringMap;
 class Istream;
-struct HttpServerConnection;
+class EventLoop;
+class HttpHeaders;
+struct HttpServerRequest;
+
+/**
+ * The protocol implementation which owns a #HttpServerRequest and
+ * transmits its response: either a HTTP/1.1 connection or a HTTP/2
+ * stream.
+ */
+class HttpServerResponder {
+public:
+    virtual EventLoop &GetEventLoop() noexcept = 0;
+
+    virtual void SendResponse(const HttpServerRequest &request,
+                              http_status_t status,
+                              HttpHeaders &&headers,
+                              UnusedIstreamPtr body) noexcept = 0;
+};
 
 struct HttpServerRequest {
     const PoolPtr pool;
 
-    HttpServerConnection &connection;
+    HttpServerResponder &responder;
 
     const SocketAddress local_address, remote_address;
 
@@ -77,7 +95,16 @@ struct HttpServerRequest {
      */
     UnusedIstreamPtr body;
 
-    HttpServerRequest(PoolPtr &&_pool, HttpServerConnection &_connection,
+    /**
+     * Request-specific data of the #HttpServerConnectionHandler,
+     * e.g. metadata for HttpServerConnectionHandler::LogHttpRequest().
+     * It must be allocated from #pool.  This cannot be stored in the
+     * handler's connection object, because a HTTP/2 connection
+     * handles several requests concurrently.
+     */
+    void *handler_data = nullptr;
+
+    HttpServerRequest(PoolPtr &&_pool, HttpServerResponder &_responder,
                       SocketAddress _local_address,
                       SocketAddress _remote_address,
                       const char *_local_host_and_port,
@@ -33,6 +33,9 @@
 #include "Internal.hxx"
 #include "Handler.hxx"
 #include "Request.hxx"
+#ifdef HAVE_NGHTTP2
+#include "Http2Connection.hxx"
+#endif
 #include "strmap.hxx"
 #include "address_string.hxx"
 #include "pool/pool.hxx"
@@ -97,7 +100,7 @@ HttpServerConnection::TryWriteBuckets2()
     assert(request.request != nullptr);
     assert(response.istream.IsDefined());
 
-    if (socket.HasFilter())
+    if (socket.HasFilteredOutput())
         return BucketResult::UNAVAILABLE;
 
     IstreamBucketList list;
@@ -240,9 +243,46 @@ HttpServerConnection::OnBufferedData()
         return BufferedResult::OK;
     }
 
+#ifdef HAVE_NGHTTP2
+    if (http2_enabled && score == HTTP_SERVER_NEW) {
+        switch (http2_check_preface(r.data, r.size)) {
+        case Http2Preface::NO:
+            break;
+
+        case Http2Preface::INCOMPLETE:
+            return BufferedResult::MORE;
+
+        case Http2Preface::YES:
+            return UpgradeHttp2();
+        }
+    }
+#endif
+
     return Feed(r.data, r.size);
 }
 
+#ifdef HAVE_NGHTTP2
+
+BufferedResult
+HttpServerConnection::UpgradeHttp2()
+{
+    assert(http2 == nullptr);
+    assert(request.read_state == Request::START);
+
+    score = HTTP_SERVER_FIRST;
+
+    try {
+        http2 = http2_server_connection_new(*this);
+    } catch (...) {
+        Error(std::current_exception());
+        return BufferedResult::CLOSED;
+    }
+
+    return http2_server_connection_feed(*http2);
+}
+
+#endif
+
 DirectResult
 HttpServerConnection::OnBufferedDirect(SocketDescriptor fd, FdType fd_type)
 {
@@ -309,6 +349,7 @@ HttpServerConnection::HttpServerConnection(struct pool &_pool,
                                            SocketAddress _local_address,
                                            SocketAddress _remote_address,
                                            bool _date_header,
+                                           bool _http2_enabled,
                                            HttpServerConnectionHandler &_handler)
     :pool(&_pool), socket(_loop),
      idle_timeout(_loop, BIND_THIS_METHOD(IdleTimeoutCallback)),
@@ -318,7 +359,8 @@ HttpServerConnection::HttpServerConnection(struct pool &_pool,
      remote_address(DupAddress(*pool, _remote_address)),
      local_host_and_port(address_to_string(*pool, _local_address)),
      remote_host(address_to_host_string(*pool, _remote_address)),
-     date_header(_date_header)
+     date_header(_date_header),
+     http2_enabled(_http2_enabled)
 {
     socket.Init(fd.Release(), fd_type,
                 Event::Duration(-1), http_server_write_timeout,
@@ -336,6 +378,11 @@ HttpServerConnection::HttpServerConnection(struct pool &_pool,
 void
 HttpServerConnection::Delete() noexcept
 {
+#ifdef HAVE_NGHTTP2
+    if (http2 != nullptr)
+        http2_server_connection_free(http2);
+#endif
+
     this->~HttpServerConnection();
 }
 
@@ -346,7 +393,7 @@ http_server_connection_new(struct pool *pool,
                            SocketFilterPtr filter,
                            SocketAddress local_address,
                            SocketAddress remote_address,
-                           bool date_header,
+                           bool date_header, bool http2,
                            HttpServerConnectionHandler &handler) noexcept
 {
     assert(fd.IsDefined());
@@ -355,7 +402,7 @@ http_server_connection_new(struct pool *pool,
                                              std::move(fd), fd_type,
                                              std::move(filter),
                                              local_address, remote_address,
-                                             date_header,
+                                             date_header, http2,
                                              handler);
 }
 
@@ -508,6 +555,13 @@ http_server_connection_graceful(HttpServerConnection *connection) noexcept
 {
     assert(connection != nullptr);
 
+#ifdef HAVE_NGHTTP2
+    if (connection->http2 != nullptr) {
+        http2_server_connection_graceful(*connection->http2);
+        return;
+    }
+#endif
+
     if (connection->request.read_state == HttpServerConnection::Request::START)
         /* there is no request currently; close the connection
            immediately */
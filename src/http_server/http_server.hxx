@@ -78,6 +78,10 @@ enum http_server_score {
 
 /**
  * @param date_header generate Date response headers?
+ * @param http2 accept HTTP/2 if the client sends the HTTP/2
+ * connection preface (after negotiating "h2" via ALPN or with "prior
+ * knowledge")?  This is ignored if beng-proxy was built without
+ * libnghttp2.
  */
 HttpServerConnection *
 http_server_connection_new(struct pool *pool,
@@ -86,7 +90,7 @@ http_server_connection_new(struct pool *pool,
                            SocketFilterPtr filter,
                            SocketAddress local_address,
                            SocketAddress remote_address,
-                           bool date_header,
+                           bool date_header, bool http2,
                            HttpServerConnectionHandler &handler) noexcept;
 
 void
@@ -42,7 +42,6 @@
 #include "util/StringCompare.hxx"
 #include "util/StringStrip.hxx"
 #include "util/StringView.hxx"
-#include "util/StringFormat.hxx"
 
 #include <limits.h>
 #include <string.h>
@@ -294,41 +293,6 @@ HttpServerConnection::HeadersFinished()
     return true;
 }
 
-/**
- * @return false if the connection has been closed
- */
-inline bool
-HttpServerConnection::HandleLine(const char *line, size_t length)
-{
-    assert(request.read_state == Request::START ||
-           request.read_state == Request::HEADERS);
-
-    if (length >= 8192) {
-        ProtocolError(StringFormat<64>("Request header is too large (%zu)",
-                                       length));
-        return false;
-    }
-
-    if (gcc_unlikely(request.read_state == Request::START)) {
-        assert(request.request == nullptr);
-
-        return ParseRequestLine(line, length);
-    } else if (gcc_likely(length > 0)) {
-        assert(request.read_state == Request::HEADERS);
-        assert(request.request != nullptr);
-
-        header_parse_line(request.request->pool,
-                          request.request->headers,
-                          {line, length});
-        return true;
-    } else {
-        assert(request.read_state == Request::HEADERS);
-        assert(request.request != nullptr);
-
-        return HeadersFinished();
-    }
-}
-
 inline BufferedResult
 HttpServerConnection::FeedHeaders(const void *_data, size_t length)
 {
@@ -340,27 +304,60 @@ HttpServerConnection::FeedHeaders(const void *_data, size_t length)
         return BufferedResult::CLOSED;
     }
 
+    /**
+     * Lines (the request line and header lines, not counting
+     * trailing whitespace) of this length or longer are rejected.
+     */
+    static constexpr size_t LINE_LENGTH_LIMIT = 8192;
+
     const char *const buffer = (const char *)_data;
     const char *const buffer_end = buffer + length;
-    const char *start = buffer, *end, *next = nullptr;
-    while ((end = (const char *)memchr(start, '\n',
-                                       buffer_end - start)) != nullptr) {
-        next = end + 1;
+    const char *start = buffer;
 
-        end = StripRight(start, end);
+    if (gcc_unlikely(request.read_state == Request::START)) {
+        assert(request.request == nullptr);
+
+        const char *eol = (const char *)memchr(buffer, '\n', length);
+        if (eol == nullptr)
+            return BufferedResult::MORE;
+
+        const char *end = StripRight(buffer, eol);
+        if (size_t(end - buffer) >= LINE_LENGTH_LIMIT) {
+            ProtocolError("Request line is too large");
+            return BufferedResult::CLOSED;
+        }
 
-        if (!HandleLine(start, end - start))
+        if (!ParseRequestLine(buffer, end - buffer))
             return BufferedResult::CLOSED;
 
-        if (request.read_state != Request::HEADERS)
-            break;
+        start = eol + 1;
+    }
+
+    assert(request.read_state == Request::HEADERS);
+    assert(request.request != nullptr);
 
-        start = next;
+    size_t consumed;
+    switch (header_parse_lines(request.request->pool,
+                               request.request->headers,
+                               {start, buffer_end}, consumed,
+                               LINE_LENGTH_LIMIT - 1)) {
+    case HeaderParserResult::MORE:
+        break;
+
+    case HeaderParserResult::END:
+        if (!HeadersFinished())
+            return BufferedResult::CLOSED;
+        break;
+
+    case HeaderParserResult::LINE_TOO_LONG:
+        ProtocolError("Request header is too large");
+        return BufferedResult::CLOSED;
     }
 
-    size_t consumed = 0;
-    if (next != nullptr) {
-        consumed = next - buffer;
+    start += consumed;
+
+    if (start > buffer) {
+        consumed = start - buffer;
         request.bytes_received += consumed;
         socket.DisposeConsumed(consumed);
     }
@@ -147,7 +147,7 @@ void
 HttpServerConnection::SetResponseIstream(UnusedIstreamPtr r)
 {
     response.istream.Set(std::move(r), *this,
-                         istream_direct_mask_to(socket.GetType()));
+                         istream_direct_mask_to(socket.GetWriteType()));
 }
 
 bool
@@ -185,16 +185,25 @@ HttpServerConnection::SubmitResponse(http_status_t status,
     TryWrite();
 }
 
+void
+HttpServerConnection::SendResponse(gcc_unused const HttpServerRequest &_request,
+                                   http_status_t status,
+                                   HttpHeaders &&headers,
+                                   UnusedIstreamPtr body) noexcept
+{
+    assert(request.request == &_request);
+
+    SubmitResponse(status, std::move(headers), std::move(body));
+}
+
 void
 http_server_response(const HttpServerRequest *request,
                      http_status_t status,
                      HttpHeaders &&headers,
                      UnusedIstreamPtr body) noexcept
 {
-    auto &connection = request->connection;
-    assert(connection.request.request == request);
-
-    connection.SubmitResponse(status, std::move(headers), std::move(body));
+    request->responder.SendResponse(*request, status, std::move(headers),
+                                    std::move(body));
 }
 
 void
@@ -212,7 +221,7 @@ http_server_simple_response(const HttpServerRequest &request,
     HttpHeaders headers(request.pool);
 
 #ifndef NO_DATE_HEADER
-    headers.Write("date", http_date_format(request.connection.GetEventLoop().SystemNow()));
+    headers.Write("date", http_date_format(request.responder.GetEventLoop().SystemNow()));
 #endif
 
     if (location != nullptr)
@@ -237,7 +246,7 @@ http_server_send_message(const HttpServerRequest *request,
     headers.Write("content-type", "text/plain");
 
 #ifndef NO_DATE_HEADER
-    headers.Write("date", http_date_format(request->connection.GetEventLoop().SystemNow()));
+    headers.Write("date", http_date_format(request->responder.GetEventLoop().SystemNow()));
 #endif
 
     http_server_response(request, status, std::move(headers),
@@ -262,7 +271,7 @@ http_server_send_redirect(const HttpServerRequest *request,
     headers.Write("location", location);
 
 #ifndef NO_DATE_HEADER
-    headers.Write("date", http_date_format(request->connection.GetEventLoop().SystemNow()));
+    headers.Write("date", http_date_format(request->responder.GetEventLoop().SystemNow()));
 #endif
 
     http_server_response(request, status, std::move(headers),
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Manager.hxx"
+#include "io/Logger.hxx"
+
+namespace Uring {
+
+Manager::Manager(EventLoop &event_loop, unsigned entries, unsigned flags)
+    :Queue(entries, flags),
+     event(event_loop, BIND_THIS_METHOD(OnSocketReady),
+           SocketDescriptor::FromFileDescriptor(GetFileDescriptor())),
+     defer_submit_event(event_loop, BIND_THIS_METHOD(DeferredSubmit))
+{
+    event.ScheduleRead();
+}
+
+Manager::~Manager() noexcept
+{
+    event.Cancel();
+    defer_submit_event.Cancel();
+
+    try {
+        if (HasPending())
+            Submit();
+
+        while (HasPending())
+            WaitDispatchCompletions();
+    } catch (...) {
+        LogConcat(1, "uring", std::current_exception());
+    }
+}
+
+void
+Manager::Push(struct io_uring_sqe &sqe, Operation &operation) noexcept
+{
+    Queue::Push(sqe, operation);
+
+    /* postpone the io_uring_submit() call until all other events
+       of this EventLoop iteration have been handled, to submit as
+       many entries as possible at once */
+    defer_submit_event.Schedule();
+}
+
+void
+Manager::OnSocketReady(unsigned) noexcept
+{
+    DispatchCompletions();
+}
+
+void
+Manager::DeferredSubmit() noexcept
+{
+    try {
+        Submit();
+    } catch (...) {
+        LogConcat(1, "uring", std::current_exception());
+    }
+}
+
+} // namespace Uring
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IO_URING_MANAGER_HXX
+#define IO_URING_MANAGER_HXX
+
+#include "Queue.hxx"
+#include "event/SocketEvent.hxx"
+#include "event/DeferEvent.hxx"
+
+namespace Uring {
+
+/**
+ * A #Queue integrated into the #EventLoop: completions are
+ * dispatched when the io_uring file descriptor becomes readable, and
+ * all entries pushed during one #EventLoop iteration are submitted
+ * with a single system call.
+ */
+class Manager final : public Queue {
+    SocketEvent event;
+
+    DeferEvent defer_submit_event;
+
+public:
+    /**
+     * Throws on error.
+     */
+    explicit Manager(EventLoop &event_loop,
+                     unsigned entries=256, unsigned flags=0);
+
+    /**
+     * Waits for all pending operations to complete, because the
+     * kernel may still access their buffers.
+     */
+    ~Manager() noexcept;
+
+    void Push(struct io_uring_sqe &sqe,
+              Operation &operation) noexcept override;
+
+private:
+    void OnSocketReady(unsigned events) noexcept;
+    void DeferredSubmit() noexcept;
+};
+
+} // namespace Uring
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IO_URING_OPERATION_HXX
+#define IO_URING_OPERATION_HXX
+
+#include <assert.h>
+
+namespace Uring {
+
+class CancellableOperation;
+
+/**
+ * An asynchronous operation which was submitted to a #Queue.  The
+ * kernel reports its completion by calling OnUringCompletion().
+ */
+class Operation {
+    friend class CancellableOperation;
+
+    CancellableOperation *cancellable = nullptr;
+
+public:
+    Operation() = default;
+
+    ~Operation() noexcept {
+        CancelUring();
+    }
+
+    Operation(const Operation &) = delete;
+    Operation &operator=(const Operation &) = delete;
+
+    /**
+     * Has this operation been submitted, and is it still waiting
+     * for completion?
+     */
+    bool IsUringPending() const noexcept {
+        return cancellable != nullptr;
+    }
+
+    /**
+     * Cancel the pending operation: the completion will not be
+     * reported to this object.  Note that the kernel may still
+     * access buffers passed to the operation until it really
+     * completes; use ReplaceUring() to hand these buffers over to
+     * another object.
+     */
+    void CancelUring() noexcept;
+
+    /**
+     * Let another #Operation instance receive the completion of
+     * the pending operation instead of this one.
+     */
+    void ReplaceUring(Operation &new_operation) noexcept;
+
+    /**
+     * @param res the result of the operation; a negative value is a
+     * negated errno value
+     */
+    virtual void OnUringCompletion(int res) noexcept = 0;
+};
+
+/**
+ * Indirection between a submitted operation and its (cancellable)
+ * #Operation.  Instances are owned by the #Queue and are deleted
+ * after the kernel has completed the operation.
+ */
+class CancellableOperation {
+    Operation *operation;
+
+public:
+    explicit CancellableOperation(Operation &_operation) noexcept
+        :operation(&_operation)
+    {
+        assert(operation->cancellable == nullptr);
+        operation->cancellable = this;
+    }
+
+    void Cancel(Operation &_operation) noexcept {
+        assert(operation == &_operation);
+        (void)_operation;
+
+        operation = nullptr;
+    }
+
+    void Replace(Operation &old_operation,
+                 Operation &new_operation) noexcept {
+        assert(operation == &old_operation);
+        assert(new_operation.cancellable == nullptr);
+        (void)old_operation;
+
+        operation = &new_operation;
+        new_operation.cancellable = this;
+    }
+
+    void OnUringCompletion(int res) noexcept {
+        if (operation == nullptr)
+            /* cancelled */
+            return;
+
+        assert(operation->cancellable == this);
+        operation->cancellable = nullptr;
+
+        operation->OnUringCompletion(res);
+    }
+};
+
+} // namespace Uring
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Queue.hxx"
+#include "Operation.hxx"
+#include "system/Error.hxx"
+
+namespace Uring {
+
+Queue::Queue(unsigned entries, unsigned flags)
+{
+    struct io_uring_params params{};
+    params.flags = flags;
+
+    int error = io_uring_queue_init_params(entries, &ring, &params);
+    if (error < 0)
+        throw MakeErrno(-error, "io_uring_queue_init_params() failed");
+
+    features = params.features;
+}
+
+Queue::~Queue() noexcept
+{
+    io_uring_queue_exit(&ring);
+}
+
+struct io_uring_sqe *
+Queue::GetSubmitEntry() noexcept
+{
+    auto *sqe = io_uring_get_sqe(&ring);
+    if (sqe == nullptr) {
+        /* the submission queue is full: flush it and try again */
+        if (io_uring_submit(&ring) < 0)
+            return nullptr;
+
+        sqe = io_uring_get_sqe(&ring);
+    }
+
+    return sqe;
+}
+
+void
+Queue::Push(struct io_uring_sqe &sqe, Operation &operation) noexcept
+{
+    io_uring_sqe_set_data(&sqe, new CancellableOperation(operation));
+    ++n_pending;
+}
+
+void
+Queue::Submit()
+{
+    int error = io_uring_submit(&ring);
+    if (error < 0)
+        throw MakeErrno(-error, "io_uring_submit() failed");
+}
+
+inline void
+Queue::DispatchCompletion(struct io_uring_cqe &cqe) noexcept
+{
+    auto *c = (CancellableOperation *)io_uring_cqe_get_data(&cqe);
+    const int res = cqe.res;
+
+    /* mark the entry as "seen" before invoking the handler, because
+       the handler may push new operations */
+    io_uring_cqe_seen(&ring, &cqe);
+
+    assert(n_pending > 0);
+    --n_pending;
+
+    if (c != nullptr) {
+        c->OnUringCompletion(res);
+        delete c;
+    }
+}
+
+bool
+Queue::DispatchCompletions() noexcept
+{
+    bool result = false;
+
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+        DispatchCompletion(*cqe);
+        result = true;
+    }
+
+    return result;
+}
+
+void
+Queue::WaitDispatchCompletions()
+{
+    struct io_uring_cqe *cqe;
+    int error = io_uring_wait_cqe(&ring, &cqe);
+    if (error < 0)
+        throw MakeErrno(-error, "io_uring_wait_cqe() failed");
+
+    DispatchCompletion(*cqe);
+    DispatchCompletions();
+}
+
+} // namespace Uring
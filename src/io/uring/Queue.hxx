@@ -0,0 +1,132 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IO_URING_QUEUE_HXX
+#define IO_URING_QUEUE_HXX
+
+#include "io/FileDescriptor.hxx"
+
+#include <liburing.h>
+
+namespace Uring {
+
+class Operation;
+
+/**
+ * A wrapper for a liburing #io_uring instance.  Submission queue
+ * entries are obtained with GetSubmitEntry(), prepared with the
+ * io_uring_prep_*() functions and then passed to Push() together
+ * with the #Operation which shall receive the completion.
+ */
+class Queue {
+    struct io_uring ring;
+
+    /**
+     * The #io_uring_params.features value returned by the kernel.
+     */
+    unsigned features;
+
+    /**
+     * The number of operations which were pushed, but whose
+     * completion has not yet been dispatched.
+     */
+    unsigned n_pending = 0;
+
+public:
+    /**
+     * Throws on error.
+     */
+    Queue(unsigned entries, unsigned flags);
+    ~Queue() noexcept;
+
+    Queue(const Queue &) = delete;
+    Queue &operator=(const Queue &) = delete;
+
+    FileDescriptor GetFileDescriptor() const noexcept {
+        return FileDescriptor(ring.ring_fd);
+    }
+
+    bool HasFeature(unsigned feature) const noexcept {
+        return (features & feature) != 0;
+    }
+
+    bool HasPending() const noexcept {
+        return n_pending > 0;
+    }
+
+    /**
+     * Obtain a submission queue entry.  If the submission queue is
+     * full, it is submitted to the kernel first.
+     *
+     * @return the entry or nullptr if there is no room in the
+     * submission queue
+     */
+    struct io_uring_sqe *GetSubmitEntry() noexcept;
+
+    /**
+     * Register the #Operation for a prepared submission queue entry.
+     * The entry is submitted to the kernel by the next Submit()
+     * call.
+     */
+    virtual void Push(struct io_uring_sqe &sqe,
+                      Operation &operation) noexcept;
+
+    /**
+     * Submit all prepared entries to the kernel.
+     *
+     * Throws on error.
+     */
+    void Submit();
+
+    /**
+     * Invoke the handlers of all completed operations without
+     * blocking.
+     *
+     * @return true if at least one completion was dispatched
+     */
+    bool DispatchCompletions() noexcept;
+
+    /**
+     * Block until one operation completes, and dispatch it and all
+     * other completions.
+     *
+     * Throws on error.
+     */
+    void WaitDispatchCompletions();
+
+private:
+    void DispatchCompletion(struct io_uring_cqe &cqe) noexcept;
+};
+
+} // namespace Uring
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BrotliEncoderIstream.hxx"
+#include "EncoderIstream.hxx"
+#include "UnusedPtr.hxx"
+#include "New.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/WritableBuffer.hxx"
+
+#include <brotli/encode.h>
+
+#include <stdexcept>
+
+class BrotliEncoderIstream final : public EncoderIstream {
+    const int quality, window_bits;
+
+    BrotliEncoderState *state = nullptr;
+
+public:
+    BrotliEncoderIstream(struct pool &_pool, UnusedIstreamPtr _input,
+                         EventLoop &event_loop,
+                         int _quality, int _window_bits) noexcept
+        :EncoderIstream(_pool, std::move(_input), event_loop),
+         quality(_quality), window_bits(_window_bits)
+    {
+    }
+
+    ~BrotliEncoderIstream() noexcept {
+        if (state != nullptr)
+            BrotliEncoderDestroyInstance(state);
+    }
+
+protected:
+    /* virtual methods from class EncoderIstream */
+    bool Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                Operation operation) override;
+
+private:
+    /**
+     * Throws on error.
+     */
+    void Init();
+};
+
+void
+BrotliEncoderIstream::Init()
+{
+    if (state != nullptr)
+        return;
+
+    state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (state == nullptr)
+        throw std::runtime_error("BrotliEncoderCreateInstance() failed");
+
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, quality);
+    if (window_bits > 0)
+        BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, window_bits);
+}
+
+bool
+BrotliEncoderIstream::Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                             Operation operation)
+{
+    Init();
+
+    BrotliEncoderOperation op = BROTLI_OPERATION_PROCESS;
+    switch (operation) {
+    case Operation::PROCESS:
+        op = BROTLI_OPERATION_PROCESS;
+        break;
+
+    case Operation::FLUSH:
+        op = BROTLI_OPERATION_FLUSH;
+        break;
+
+    case Operation::FINISH:
+        op = BROTLI_OPERATION_FINISH;
+        break;
+    }
+
+    size_t available_in = src.size;
+    auto next_in = (const uint8_t *)src.data;
+    size_t available_out = dest.size;
+    auto next_out = (uint8_t *)dest.data;
+
+    if (!BrotliEncoderCompressStream(state, op,
+                                     &available_in, &next_in,
+                                     &available_out, &next_out,
+                                     nullptr))
+        throw std::runtime_error("BrotliEncoderCompressStream() failed");
+
+    src = {next_in, available_in};
+    dest = {next_out, available_out};
+
+    switch (operation) {
+    case Operation::PROCESS:
+        break;
+
+    case Operation::FLUSH:
+        return !BrotliEncoderHasMoreOutput(state);
+
+    case Operation::FINISH:
+        return BrotliEncoderIsFinished(state);
+    }
+
+    return true;
+}
+
+/*
+ * constructor
+ *
+ */
+
+UnusedIstreamPtr
+NewBrotliEncoderIstream(struct pool &pool, UnusedIstreamPtr input,
+                        EventLoop &event_loop,
+                        int quality, int window_bits) noexcept
+{
+    return NewIstreamPtr<BrotliEncoderIstream>(pool, std::move(input),
+                                               event_loop,
+                                               quality, window_bits);
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "EncoderIstream.hxx"
+#include "UnusedPtr.hxx"
+#include "pool/pool.hxx"
+#include "fb_pool.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/WritableBuffer.hxx"
+
+#include <assert.h>
+
+/**
+ * How long to wait for more input before flushing the encoder?
+ */
+static constexpr Event::Duration encoder_flush_delay =
+    std::chrono::milliseconds(20);
+
+EncoderIstream::EncoderIstream(struct pool &_pool, UnusedIstreamPtr _input,
+                               EventLoop &event_loop) noexcept
+    :FacadeIstream(_pool, std::move(_input)),
+     defer(event_loop, BIND_THIS_METHOD(OnDeferred)),
+     flush_timer(event_loop, BIND_THIS_METHOD(OnFlushTimer))
+{
+}
+
+EncoderIstream::~EncoderIstream() noexcept
+{
+    defer.Cancel();
+    flush_timer.Cancel();
+}
+
+void
+EncoderIstream::Abort(std::exception_ptr ep) noexcept
+{
+    if (HasInput())
+        ClearAndCloseInput();
+
+    DestroyError(ep);
+}
+
+size_t
+EncoderIstream::TryWrite() noexcept
+{
+    auto r = buffer.Read();
+    assert(!r.empty());
+
+    const DestructObserver destructed(*this);
+
+    size_t nbytes = InvokeData(r.data, r.size);
+    if (nbytes == 0 || destructed)
+        return 0;
+
+    buffer.Consume(nbytes);
+    buffer.FreeIfEmpty();
+
+    if (nbytes == r.size && !HasInput() && finished) {
+        DestroyEof();
+        return 0;
+    }
+
+    return nbytes;
+}
+
+WritableBuffer<void>
+EncoderIstream::BufferWrite() noexcept
+{
+    buffer.AllocateIfNull(fb_pool_get());
+    auto w = buffer.Write();
+    if (w.empty() && TryWrite() > 0)
+        w = buffer.Write();
+
+    return w.ToVoid();
+}
+
+inline void
+EncoderIstream::ScheduleFlush() noexcept
+{
+    if (!flush_timer.IsPending())
+        flush_timer.Schedule(encoder_flush_delay);
+}
+
+void
+EncoderIstream::TryFlush() noexcept
+{
+    assert(!finished);
+
+    auto w = BufferWrite();
+    if (w.empty()) {
+        /* our handler is blocking; try again later */
+        if (HasInput())
+            ScheduleFlush();
+        return;
+    }
+
+    const size_t size = w.size;
+    ConstBuffer<void> src(nullptr, 0);
+
+    bool complete;
+    try {
+        complete = Encode(src, w, Operation::FLUSH);
+    } catch (...) {
+        Abort(std::current_exception());
+        return;
+    }
+
+    buffer.Append(size - w.size);
+
+    if (!complete)
+        /* not enough buffer space; try again later */
+        ScheduleFlush();
+
+    if (!buffer.empty())
+        TryWrite();
+}
+
+inline void
+EncoderIstream::ForceRead() noexcept
+{
+    assert(!reading);
+
+    const DestructObserver destructed(*this);
+
+    bool had_input2 = false;
+    had_output = false;
+
+    while (1) {
+        had_input = false;
+        reading = true;
+        input.Read();
+        if (destructed)
+            return;
+
+        reading = false;
+        if (!HasInput() || had_output)
+            return;
+
+        if (!had_input)
+            break;
+
+        had_input2 = true;
+    }
+
+    if (had_input2)
+        /* the input is blocking, and the encoder has swallowed
+           everything so far */
+        ScheduleFlush();
+}
+
+void
+EncoderIstream::TryFinish() noexcept
+{
+    assert(!finished);
+
+    auto w = BufferWrite();
+    if (w.empty())
+        return;
+
+    const size_t size = w.size;
+    ConstBuffer<void> src(nullptr, 0);
+
+    try {
+        finished = Encode(src, w, Operation::FINISH);
+    } catch (...) {
+        Abort(std::current_exception());
+        return;
+    }
+
+    buffer.Append(size - w.size);
+
+    if (finished && buffer.empty())
+        DestroyEof();
+    else
+        TryWrite();
+}
+
+/*
+ * istream implementation
+ *
+ */
+
+void
+EncoderIstream::_Read() noexcept
+{
+    if (!buffer.empty())
+        TryWrite();
+    else if (HasInput())
+        ForceRead();
+    else
+        TryFinish();
+}
+
+void
+EncoderIstream::_Close() noexcept
+{
+    if (HasInput())
+        input.Close();
+
+    Destroy();
+}
+
+/*
+ * istream handler
+ *
+ */
+
+size_t
+EncoderIstream::OnData(const void *data, size_t length) noexcept
+{
+    assert(HasInput());
+
+    auto w = BufferWrite();
+    if (w.size < 64) /* reserve space for end-of-stream marker */
+        return 0;
+
+    had_input = true;
+
+    if (!reading)
+        had_output = false;
+
+    const DestructObserver destructed(*this);
+
+    ConstBuffer<void> src(data, length);
+
+    do {
+        const size_t size = w.size;
+
+        try {
+            Encode(src, w, Operation::PROCESS);
+        } catch (...) {
+            Abort(std::current_exception());
+            return 0;
+        }
+
+        size_t nbytes = size - w.size;
+        if (nbytes > 0) {
+            had_output = true;
+            buffer.Append(nbytes);
+
+            const ScopePoolRef ref(GetPool() TRACE_ARGS);
+            TryWrite();
+
+            if (destructed)
+                return 0;
+        } else
+            break;
+
+        w = BufferWrite();
+        if (w.size < 64) /* reserve space for end-of-stream marker */
+            break;
+    } while (!src.empty());
+
+    if (!reading && !had_output) {
+        /* we received data from our input, but we did not produce any
+           output (and we're not looping inside ForceRead()) - to
+           avoid stalling the stream, trigger the DeferEvent */
+        defer.Schedule();
+
+        /* ... and make sure the data gets submitted eventually even
+           if there is no more input for a while */
+        ScheduleFlush();
+    }
+
+    return length - src.size;
+}
+
+void
+EncoderIstream::OnEof() noexcept
+{
+    ClearInput();
+    defer.Cancel();
+    flush_timer.Cancel();
+
+    TryFinish();
+}
+
+void
+EncoderIstream::OnError(std::exception_ptr ep) noexcept
+{
+    ClearInput();
+
+    DestroyError(ep);
+}
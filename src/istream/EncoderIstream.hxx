@@ -0,0 +1,165 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "FacadeIstream.hxx"
+#include "SliceFifoBuffer.hxx"
+#include "event/DeferEvent.hxx"
+#include "event/TimerEvent.hxx"
+#include "util/DestructObserver.hxx"
+
+#include <assert.h>
+
+template<typename T> struct ConstBuffer;
+template<typename T> struct WritableBuffer;
+
+/**
+ * Base class for istreams which compress their input.  It manages
+ * the output buffer and decides when the encoder needs to be
+ * flushed; the derived class implements the actual encoder.
+ */
+class EncoderIstream : public FacadeIstream, DestructAnchor {
+    bool had_input, had_output;
+    bool reading = false;
+
+    /**
+     * Has the encoder written the end of the stream?
+     */
+    bool finished = false;
+
+    SliceFifoBuffer buffer;
+
+    /**
+     * This callback is used to request more data from the input if an
+     * OnData() call did not produce any output.  This tries to
+     * prevent stalling the stream.
+     */
+    DeferEvent defer;
+
+    /**
+     * Flushes the encoder if the input has stalled.  This is delayed
+     * a bit, so many small writes are combined into one flush block
+     * instead of flushing after each of them.
+     */
+    TimerEvent flush_timer;
+
+protected:
+    enum class Operation {
+        /**
+         * Encode input; the encoder may buffer it internally.
+         */
+        PROCESS,
+
+        /**
+         * Write all data buffered inside the encoder.
+         */
+        FLUSH,
+
+        /**
+         * Write all data buffered inside the encoder and end the
+         * stream.
+         */
+        FINISH,
+    };
+
+    EncoderIstream(struct pool &_pool, UnusedIstreamPtr _input,
+                   EventLoop &event_loop) noexcept;
+
+    ~EncoderIstream() noexcept;
+
+    /**
+     * Feed data into the encoder and collect its output.  Both
+     * buffers are advanced by the number of bytes consumed/produced.
+     *
+     * Throws on error.
+     *
+     * @return true if the #FLUSH or #FINISH operation is complete,
+     * false if it needs more output buffer space
+     */
+    virtual bool Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                        Operation operation) = 0;
+
+private:
+    void Abort(std::exception_ptr ep) noexcept;
+
+    /**
+     * Submit data from the buffer to our istream handler.
+     *
+     * @return the number of bytes which were handled, or 0 if the
+     * stream was closed
+     */
+    size_t TryWrite() noexcept;
+
+    /**
+     * Starts to write to the buffer.
+     *
+     * @return a pointer to the writable buffer, or nullptr if there is no
+     * room (our istream handler blocks) or if the stream was closed
+     */
+    WritableBuffer<void> BufferWrite() noexcept;
+
+    void ScheduleFlush() noexcept;
+
+    void TryFlush() noexcept;
+
+    /**
+     * Read from our input until we have submitted some bytes to our
+     * istream handler.
+     */
+    void ForceRead() noexcept;
+
+    void TryFinish() noexcept;
+
+    void OnDeferred() noexcept {
+        assert(HasInput());
+
+        ForceRead();
+    }
+
+    void OnFlushTimer() noexcept {
+        assert(HasInput());
+
+        TryFlush();
+    }
+
+public:
+    /* virtual methods from class Istream */
+
+    void _Read() noexcept override;
+    void _Close() noexcept override;
+
+    /* virtual methods from class IstreamHandler */
+    size_t OnData(const void *data, size_t length) noexcept override;
+    void OnEof() noexcept override;
+    void OnError(std::exception_ptr ep) noexcept override;
+};
@@ -44,6 +44,14 @@
 #include "event/TimerEvent.hxx"
 #include "util/RuntimeError.hxx"
 
+#ifdef HAVE_URING
+#include "uring_glue.hxx"
+#include "io/uring/Queue.hxx"
+#include "io/uring/Operation.hxx"
+#endif
+
+#include <algorithm>
+
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -73,6 +81,48 @@ class FileIstream final : public Istream {
     SliceFifoBuffer buffer;
     const char *path;
 
+#ifdef HAVE_URING
+    /**
+     * If not nullptr, then reads into #buffer are submitted to this
+     * io_uring instead of calling read() synchronously.
+     */
+    Uring::Queue *const uring;
+
+    class UringRead final : public Uring::Operation {
+        FileIstream &parent;
+
+    public:
+        explicit UringRead(FileIstream &_parent) noexcept
+            :parent(_parent) {}
+
+        /* virtual methods from class Uring::Operation */
+        void OnUringCompletion(int res) noexcept override {
+            parent.OnUringRead(res);
+        }
+    };
+
+    UringRead uring_read{*this};
+
+    /**
+     * Owns the buffer of a read which was still pending when the
+     * #FileIstream was closed, because the kernel may still write
+     * into it.
+     */
+    class UringOrphanRead final : public Uring::Operation {
+        SliceFifoBuffer buffer;
+
+    public:
+        explicit UringOrphanRead(SliceFifoBuffer &&_buffer) noexcept
+            :buffer(std::move(_buffer)) {}
+
+        /* virtual methods from class Uring::Operation */
+        void OnUringCompletion(int) noexcept override {
+            buffer.Free();
+            delete this;
+        }
+    };
+#endif
+
 public:
     FileIstream(struct pool &p, EventLoop &event_loop,
                 UniqueFileDescriptor &&_fd, FdType _fd_type, off_t _length,
@@ -81,7 +131,12 @@ public:
          fd(_fd.Steal()), fd_type(_fd_type),
          retry_event(event_loop, BIND_THIS_METHOD(EventCallback)),
          rest(_length),
-         path(_path) {}
+         path(_path)
+#ifdef HAVE_URING
+       , uring(fd_type == FdType::FD_FILE ? uring_glue_get() : nullptr)
+#endif
+    {
+    }
 
     ~FileIstream() noexcept {
         retry_event.Cancel();
@@ -116,9 +171,36 @@ private:
 
         fd.Close();
 
+#ifdef HAVE_URING
+        if (IsUringPending()) {
+            uring_read.ReplaceUring(*new UringOrphanRead(std::move(buffer)));
+            return;
+        }
+#endif
+
         buffer.FreeIfDefined();
     }
 
+#ifdef HAVE_URING
+    bool IsUringPending() const noexcept {
+        return uring_read.IsUringPending();
+    }
+
+    /**
+     * Submit an asynchronous read into #buffer to the io_uring.
+     *
+     * @return false if no read was submitted (the caller shall fall
+     * back to read())
+     */
+    bool StartUringRead() noexcept;
+
+    void OnUringRead(int res) noexcept;
+#else
+    constexpr bool IsUringPending() const noexcept {
+        return false;
+    }
+#endif
+
     void Abort(std::exception_ptr ep) noexcept {
         CloseHandle();
         DestroyError(ep);
@@ -150,6 +232,11 @@ private:
     void TryDirect() noexcept;
 
     void TryRead() noexcept {
+        if (IsUringPending())
+            /* wait for the completion, which will submit the new
+               data */
+            return;
+
         if (CheckDirect(fd_type))
             TryDirect();
         else
@@ -202,6 +289,11 @@ FileIstream::TryData() noexcept
         return;
     }
 
+#ifdef HAVE_URING
+    if (uring != nullptr && StartUringRead())
+        return;
+#endif
+
     ssize_t nbytes = read_to_buffer(fd.Get(), buffer, GetMaxRead());
     if (nbytes == 0) {
         if (rest == (off_t)-1) {
@@ -276,6 +368,78 @@ FileIstream::TryDirect() noexcept
     }
 }
 
+#ifdef HAVE_URING
+
+bool
+FileIstream::StartUringRead() noexcept
+{
+    assert(!IsUringPending());
+    assert(buffer.IsDefined());
+    assert(rest != 0);
+
+    auto w = buffer.Write();
+    if (w.empty())
+        return false;
+
+    auto *sqe = uring->GetSubmitEntry();
+    if (sqe == nullptr)
+        return false;
+
+    /* offset -1 means "current file position", just like read();
+       this keeps the file position consistent for SetRange(),
+       _Skip(), splice() and _AsFd() */
+    io_uring_prep_read(sqe, fd.Get(), w.data,
+                       std::min(w.size, GetMaxRead()), -1);
+    uring->Push(*sqe, uring_read);
+    return true;
+}
+
+void
+FileIstream::OnUringRead(int res) noexcept
+{
+    assert(fd.IsDefined());
+
+    if (res < 0) {
+        Abort(std::make_exception_ptr(FormatErrno(-res,
+                                                  "Failed to read from '%s'",
+                                                  path)));
+        return;
+    }
+
+    if (res == 0) {
+        if (rest == (off_t)-1) {
+            rest = 0;
+            if (buffer.empty())
+                EofDetected();
+        } else {
+            Abort(std::make_exception_ptr(FormatRuntimeError("premature end of file in '%s'",
+                                                             path)));
+        }
+        return;
+    }
+
+    buffer.Append(res);
+
+    if (rest != (off_t)-1) {
+        rest -= (off_t)res;
+        assert(rest >= 0);
+    }
+
+    if (SubmitBuffer() > 0)
+        /* the handler is blocking (or we have been closed); wait for
+           the next _Read() call */
+        return;
+
+    if (rest == 0)
+        EofDetected();
+    else
+        /* read ahead; if that fails, the next _Read() call will
+           fall back to read() */
+        StartUringRead();
+}
+
+#endif
+
 /*
  * istream implementation
  *
@@ -301,7 +465,7 @@ FileIstream::_Skip(off_t length) noexcept
 {
     retry_event.Cancel();
 
-    if (rest == (off_t)-1)
+    if (rest == (off_t)-1 || IsUringPending())
         return (off_t)-1;
 
     if (length == 0)
@@ -338,6 +502,10 @@ FileIstream::_Skip(off_t length) noexcept
 int
 FileIstream::_AsFd() noexcept
 {
+    if (IsUringPending())
+        /* the file position will be modified by the pending read */
+        return -1;
+
     int result_fd = fd.Steal();
 
     Destroy();
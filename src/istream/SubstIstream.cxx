@@ -1,5 +1,5 @@
 /*
- * Copyright 2007-2018 Content Management AG
+ * Copyright 2007-2019 Content Management AG
  * All rights reserved.
  *
  * author: Max Kellermann <mk@cm4all.com>
@@ -34,78 +34,224 @@
 #include "FacadeIstream.hxx"
 #include "UnusedPtr.hxx"
 #include "New.hxx"
+#include "CharScan.hxx"
 #include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
 #include "util/DestructObserver.hxx"
 #include "util/StringView.hxx"
 
+#include <algorithm>
+#include <iterator>
+
 #include <assert.h>
 #include <string.h>
 
-/* ternary search tree */
+/* a node in the Aho-Corasick automaton */
 struct SubstNode {
-    SubstNode *parent, *left, *right, *equals;
+    /**
+     * The node of the longest proper suffix of this node's string
+     * which is also in the tree (the "failure link").  Only the root
+     * has none.
+     */
+    const SubstNode *fail;
+
+    /**
+     * The nearest node in the #fail chain (not including this one)
+     * which ends a word; nullptr if there is none.
+     */
+    const SubstNode *output;
+
+    /**
+     * The children, as a linked list while the tree is being built.
+     */
+    SubstNode *first_child, *next_sibling;
+
+    /**
+     * After SubstTree::Compile(): the characters of all children
+     * and (at the same index) the child nodes.
+     */
+    char *child_chars;
+    const SubstNode **children;
+    size_t n_children;
+
+    /**
+     * A word beginning with this node's string; its first #depth
+     * characters are this node's string.  This is used to
+     * reconstruct input which was held back while matching.
+     */
+    const char *word;
+
+    size_t depth;
+
     char ch;
 
-    struct {
-        const char *a;
-        size_t b_length;
-        char b[1];
-    } leaf;
+    /**
+     * Does a word end at this node?
+     */
+    bool is_word;
+
+    /**
+     * The replacement of the word ending here.
+     */
+    const char *b;
+    size_t b_length;
+
+    gcc_pure
+    const SubstNode *FindChild(char _ch) const noexcept {
+        const char *i = (const char *)memchr(child_chars, _ch, n_children);
+        return i != nullptr
+            ? children[i - child_chars]
+            : nullptr;
+    }
+
+    StringView GetString(size_t length) const noexcept {
+        assert(length <= depth);
+
+        return {word, length};
+    }
 };
 
 class SubstIstream final : public FacadeIstream, DestructAnchor {
     bool had_input, had_output;
 
-    bool send_first;
+    /**
+     * Holds a reference to the pool which owns a shared #tree.
+     */
+    const PoolPtr tree_pool;
 
-    SubstTree tree;
+    const SubstTree tree;
 
-    const SubstNode *match;
-    StringView mismatch = nullptr;
+    const SubstNode *const root;
 
-    enum class State {
-        /** searching the first matching character */
-        NONE,
+    /**
+     * If not nullptr, then this flag is set as soon as a word has
+     * been matched.
+     */
+    bool *const matched_r;
 
-        /** at least the first character was found, checking for the
-            rest */
-        MATCH,
+    /**
+     * The current state of the automaton.  The last #depth
+     * characters of the input lead to this node; they have been
+     * consumed, but not yet forwarded.
+     */
+    const SubstNode *node;
 
-        /** inserting the substitution */
-        INSERT,
-    } state = State::NONE;
-    size_t a_match, b_sent;
+    /**
+     * A complete match which cannot be submitted yet, because a
+     * longer partial match in #node started earlier and may still
+     * complete.  It ends #candidate_tail characters before the end
+     * of #node's string.
+     */
+    const SubstNode *candidate = nullptr;
+    size_t candidate_tail;
+
+    /**
+     * Characters which have been consumed already, but need to be
+     * fed into the automaton again after a held-back match has been
+     * submitted.  They live in #replay_buffer, which is large enough
+     * for the longest word.
+     */
+    char *const replay_buffer;
+    const char *replay_position, *replay_end;
 
- public:
-    SubstIstream(struct pool &p, UnusedIstreamPtr &&_input, SubstTree &&_tree) noexcept
-        :FacadeIstream(p, std::move(_input)), tree(std::move(_tree)) {}
+    /**
+     * Output which has been generated but not yet been accepted by
+     * our handler.  All of these point to memory owned by the tree
+     * or to #replay_buffer.
+     */
+    StringView pending[4];
+    unsigned n_pending = 0;
+
+    enum class StepResult {
+        /**
+         * The character has been consumed.
+         */
+        CONSUMED,
+
+        /**
+         * The character is not part of a match and must be forwarded
+         * by the caller (after #pending).
+         */
+        LITERAL,
+
+        /**
+         * The character has not been consumed; it must be fed again
+         * after the replay.
+         */
+        RETRY,
+    };
+
+public:
+    SubstIstream(struct pool &p, UnusedIstreamPtr &&_input,
+                 PoolPtr &&_tree_pool, const SubstTree &_tree,
+                 bool *_matched_r) noexcept
+        :FacadeIstream(p, std::move(_input)),
+         tree_pool(std::move(_tree_pool)), tree(_tree),
+         root(tree.GetRoot()),
+         matched_r(_matched_r),
+         node(root),
+         replay_buffer(PoolAlloc<char>(p, tree.GetMaxLength())),
+         replay_position(replay_buffer), replay_end(replay_buffer) {
+        assert(tree.IsCompiled());
+        assert(root != nullptr);
+    }
 
 private:
-    /** find the first occurence of a "first character" in the buffer */
-    const char *FindFirstChar(const char *data, size_t length) noexcept;
+    void PushPending(StringView s) noexcept;
+
+    void PushPrefix(const SubstNode &n, size_t length) noexcept {
+        if (length > 0)
+            PushPending(n.GetString(length));
+    }
+
+    void PushReplacement(const SubstNode &n) noexcept;
+
+    /**
+     * Submit the #candidate and schedule the characters after it for
+     * replay.
+     */
+    void CommitCandidate() noexcept;
+
+    /**
+     * Feed one character into the automaton.  Output is added to
+     * #pending.
+     */
+    StepResult Step(char ch) noexcept;
+
+    /**
+     * Send #pending to our handler.
+     *
+     * @return true if everything has been consumed, false if the
+     * handler is blocking or if this object has been destroyed
+     */
+    bool FlushPending() noexcept;
 
     /**
-     * Write data from "b".
+     * Feed the characters in #replay_buffer into the automaton.
      *
-     * @return the number of bytes remaining
+     * @return true if the replay is finished, false if the handler is
+     * blocking or if this object has been destroyed
      */
-    size_t TryWriteB() noexcept;
+    bool ProcessReplay() noexcept;
 
-    bool FeedMismatch() noexcept;
-    bool WriteMismatch() noexcept;
+    /**
+     * The input has ended: submit all held-back data.
+     *
+     * @return true if everything has been consumed, false if the
+     * handler is blocking or if this object has been destroyed
+     */
+    bool Finish() noexcept;
 
     /**
-     * Forwards source data to the istream handler.
+     * Forward source data to the handler.
      *
      * @return (size_t)-1 when everything has been consumed, or the
-     * correct return value for the data() callback.
+     * correct return value for the data() callback
      */
     size_t ForwardSourceData(const char *start,
                              const char *p, size_t length) noexcept;
-    size_t ForwardSourceDataFinal(const char *start,
-                                  const char *end, const char *p) noexcept;
 
-    size_t Feed(const void *data, size_t length) noexcept;
+    size_t Feed(const char *data, size_t length) noexcept;
 
 public:
     /* virtual methods from class Istream */
@@ -121,263 +267,219 @@ public:
     void OnError(std::exception_ptr ep) noexcept override;
 };
 
-/*
- * helper functions
- *
- */
-
-/** find a character in the tree */
-gcc_pure
-static const SubstNode *
-subst_find_char(const SubstNode *node, char ch) noexcept
+inline const char *
+SubstTree::FindFirstChar(const char *p, const char *end) const noexcept
 {
-    assert(node != nullptr);
+    assert(compiled);
 
-    if (ch == 0)
-        /* we cannot support null bytes */
-        return nullptr;
+    if (first_char_table != nullptr) {
+        while (p < end && !first_char_table[(unsigned char)*p])
+            ++p;
+        return p;
+    }
 
-    do {
-        if (node->ch == ch) {
-            assert(node->equals != nullptr);
-            return node->equals;
-        }
+    switch (root->n_children) {
+    case 0:
+        return end;
 
-        if (ch < node->ch)
-            node = node->left;
-        else
-            node = node->right;
-    } while (node != nullptr);
+    case 1:
+        p = (const char *)memchr(p, first_chars[0], end - p);
+        return p != nullptr ? p : end;
 
-    return nullptr;
+    default:
+        return FindAnyOf(p, end, first_chars);
+    }
 }
 
-/** find the leaf ending the current search word */
-gcc_pure
-static const SubstNode *
-subst_find_leaf(const SubstNode *node) noexcept
+void
+SubstIstream::PushPending(StringView s) noexcept
 {
-    assert(node != nullptr);
-
-    do {
-        if (node->ch == 0)
-            return node;
+    assert(!s.empty());
 
-        if (0 < node->ch)
-            node = node->left;
-        else
-            node = node->right;
-    } while (node != nullptr);
+    if (n_pending > 0) {
+        /* merge adjacent chunks */
+        auto &last = pending[n_pending - 1];
+        if (last.data + last.size == s.data) {
+            last.size += s.size;
+            return;
+        }
+    }
 
-    return nullptr;
+    assert(n_pending < std::size(pending));
+    pending[n_pending++] = s;
 }
 
-/**
- * Check whether the given input can possibly be a match.
- *
- * @param match the current match (usually found with memchr() by
- * SubstTree::FindFirstChar())
- * @param input the remaining input
- * @param true if the remaining input matches so far (but may not be
- * complete yet), false if the input cannot match
- */
-gcc_pure
-static bool
-CheckMatch(const SubstNode *match, ConstBuffer<char> input) noexcept
+void
+SubstIstream::PushReplacement(const SubstNode &n) noexcept
 {
-    const char *p = input.data, *const end = p + input.size;
-
-    while (p < end) {
-        if (subst_find_leaf(match) != nullptr)
-            return true;
+    assert(n.is_word);
 
-        match = subst_find_char(match, *p++);
-        if (match == nullptr)
-            return false;
-    }
+    if (matched_r != nullptr)
+        *matched_r = true;
 
-    return true;
+    if (n.b_length > 0)
+        PushPending({n.b, n.b_length});
 }
 
-/** find any leaf which begins with the current partial match, used to
-    find a buffer which is partially re-inserted into the data
-    stream */
-gcc_pure
-static const SubstNode *
-subst_find_any_leaf(const SubstNode *node) noexcept
+void
+SubstIstream::CommitCandidate() noexcept
 {
-    while (true) {
-        assert(node != nullptr);
-
-        if (node->ch == 0)
-            return node;
-
-        node = node->equals;
-    }
+    assert(candidate != nullptr);
+    assert(candidate->is_word);
+    assert(node->depth >= candidate_tail + candidate->depth);
+
+    const size_t end = node->depth - candidate_tail;
+
+    PushPrefix(*node, end - candidate->depth);
+    PushReplacement(*candidate);
+
+    /* the characters after the match must be fed into the
+       automaton again, before the rest of the replay (if any) */
+    const size_t rest = replay_end - replay_position;
+    assert(candidate_tail + rest <= tree.GetMaxLength());
+    memmove(replay_buffer + candidate_tail, replay_position, rest);
+    memcpy(replay_buffer, node->word + end, candidate_tail);
+    replay_position = replay_buffer;
+    replay_end = replay_buffer + candidate_tail + rest;
+
+    node = root;
+    candidate = nullptr;
 }
 
-/** iterates over the current depth */
-gcc_pure
-static const SubstNode *
-subst_next_non_leaf_node(const SubstNode *node, const SubstNode *root) noexcept
+SubstIstream::StepResult
+SubstIstream::Step(char ch) noexcept
 {
-    /* dive into left wing first */
-    if (node->left != nullptr && node->left->ch != 0)
-        return node->left;
-
-    /* if left does not exist, go right */
-    if (node->right != nullptr && node->right->ch != 0)
-        return node->right;
-
-    /* this subtree is finished, go up */
-    while (true) {
-        /* don't go above our root */
-        if (node == root)
-            return nullptr;
+    /* we can only get here with an empty queue, because the replay
+       buffer may be modified by CommitCandidate() */
+    assert(n_pending == 0);
+
+    const SubstNode *const old = node;
+
+    const SubstNode *n = old, *next;
+    while ((next = n->FindChild(ch)) == nullptr && n != root)
+        n = n->fail;
+
+    if (candidate != nullptr &&
+        (next == nullptr ||
+         next->depth <= candidate_tail + 1 + candidate->depth)) {
+        /* there is no partial match left which started before the
+           candidate: submit it, and feed this character again
+           later */
+        CommitCandidate();
+        return StepResult::RETRY;
+    }
 
-        assert(node->parent != nullptr);
+    if (next == nullptr) {
+        /* nothing matches: all of the old node's string and this
+           character are just data */
+        assert(candidate == nullptr);
 
-        if (node->parent->left == node) {
-            node = node->parent;
+        PushPrefix(*old, old->depth);
+        node = root;
+        return StepResult::LITERAL;
+    }
 
-            /* only go to parent->right if we came from
-               parent->left */
-            if (node->right != nullptr && node->right->ch != 0)
-                return node;
-        } else {
-            node = node->parent;
-        }
+    /* the beginning of the old node's string which is not part of
+       the new one is just data */
+    PushPrefix(*old, old->depth + 1 - next->depth);
+
+    if (next->is_word) {
+        /* nothing can start earlier than the new node's string:
+           this is a match */
+        PushReplacement(*next);
+        node = root;
+        candidate = nullptr;
+        return StepResult::CONSUMED;
     }
+
+    node = next;
+
+    const SubstNode *const output = next->output;
+    if (output != nullptr &&
+        (candidate == nullptr ||
+         output->depth > candidate_tail + 1 + candidate->depth)) {
+        /* a shorter word which ends here is the new candidate (the
+           first one or one which starts earlier than the old
+           candidate) */
+        candidate = output;
+        candidate_tail = 0;
+    } else if (candidate != nullptr)
+        ++candidate_tail;
+
+    return StepResult::CONSUMED;
 }
 
-inline std::pair<const SubstNode *, const char *>
-SubstTree::FindFirstChar(const char *data, size_t length) const noexcept
+bool
+SubstIstream::FlushPending() noexcept
 {
-    const char *const end = data + length;
-    const SubstNode *n = root;
-    const SubstNode *match = nullptr;
-    const char *min = nullptr;
-
-    while (n != nullptr) {
-        assert(n->ch != 0);
-
-        /* loop to find all instances of this start character, until
-           there is one where the rest also matches */
-        const char *p = data;
-        while (true) {
-            p = (const char *)memchr(p, n->ch, end - p);
-            if (p != nullptr && (min == nullptr || p < min)) {
-                if (!CheckMatch(n->equals, {p + 1, end})) {
-                    /* late mismatch; continue the loop to check if
-                       there are more of the current start
-                       character */
-                    ++p;
-                    continue;
-                }
-
-                assert(n->equals != nullptr);
-                match = n->equals;
-                min = p;
-            }
+    const DestructObserver destructed(*this);
 
-            break;
-        }
+    while (n_pending > 0) {
+        auto &p = pending[0];
 
-        /* check the next start character in the #SubstTree */
-        n = subst_next_non_leaf_node(n, root);
-    }
+        had_output = true;
 
-    return std::make_pair(match, min);
-}
+        size_t nbytes = InvokeData(p.data, p.size);
+        if (destructed)
+            return false;
 
-inline const char *
-SubstIstream::FindFirstChar(const char *data, size_t length) noexcept
-{
-    auto x = tree.FindFirstChar(data, length);
-    match = x.first;
-    return x.second;
-}
+        p.skip_front(nbytes);
+        if (!p.empty())
+            return false;
 
-size_t
-SubstIstream::TryWriteB() noexcept
-{
-    assert(state == State::INSERT);
-    assert(a_match > 0);
-    assert(match != nullptr);
-    assert(match->ch == 0);
-    assert(a_match == strlen(match->leaf.a));
-
-    const size_t length = match->leaf.b_length - b_sent;
-    assert(length > 0);
-
-    const size_t nbytes = InvokeData(match->leaf.b + b_sent, length);
-    assert(nbytes <= length);
-    if (nbytes > 0) {
-        /* note progress */
-        b_sent += nbytes;
-
-        /* finished sending substitution? */
-        if (nbytes == length)
-            state = State::NONE;
+        std::move(pending + 1, pending + n_pending, pending);
+        --n_pending;
     }
 
-    return length - nbytes;
+    return true;
 }
 
 bool
-SubstIstream::FeedMismatch() noexcept
+SubstIstream::ProcessReplay() noexcept
 {
-    assert(state == State::NONE);
-    assert(input.IsDefined());
-    assert(!mismatch.empty());
+    while (replay_position < replay_end) {
+        const char *p = replay_position;
 
-    if (send_first) {
-        const size_t nbytes = InvokeData(mismatch.data, 1);
-        if (nbytes == 0)
-            return true;
+        switch (Step(*p)) {
+        case StepResult::CONSUMED:
+            ++replay_position;
+            break;
 
-        mismatch.skip_front(1);
+        case StepResult::LITERAL:
+            ++replay_position;
+            PushPending({p, 1});
+            break;
 
-        if (mismatch.empty())
-            return false;
+        case StepResult::RETRY:
+            break;
+        }
 
-        send_first = false;
+        if (!FlushPending())
+            return false;
     }
 
-    const size_t nbytes = Feed(mismatch.data, mismatch.size);
-    if (nbytes == 0)
-        return true;
-
-    assert(nbytes <= mismatch.size);
-
-    mismatch.skip_front(nbytes);
-
-    return !mismatch.empty();
+    return true;
 }
 
 bool
-SubstIstream::WriteMismatch() noexcept
+SubstIstream::Finish() noexcept
 {
-    assert(!input.IsDefined() || state == State::NONE);
-    assert(!mismatch.empty());
-
-    size_t nbytes = InvokeData(mismatch.data, mismatch.size);
-    if (nbytes == 0)
-        return true;
-
-    assert(nbytes <= mismatch.size);
-
-    mismatch.skip_front(nbytes);
+    assert(!input.IsDefined());
 
-    if (!mismatch.empty())
-        return true;
+    while (true) {
+        if (!FlushPending() || !ProcessReplay())
+            return false;
 
-    if (!input.IsDefined()) {
-        DestroyEof();
-        return true;
+        if (candidate != nullptr)
+            CommitCandidate();
+        else if (node != root) {
+            /* a partial match at the end of the input: it's just
+               data */
+            PushPrefix(*node, node->depth);
+            node = root;
+        } else
+            return true;
     }
-
-    return false;
 }
 
 size_t
@@ -386,6 +488,8 @@ SubstIstream::ForwardSourceData(const char *start,
 {
     const DestructObserver destructed(*this);
 
+    had_output = true;
+
     size_t nbytes = InvokeData(p, length);
     if (destructed) {
         /* stream has been closed - we must return 0 */
@@ -393,209 +497,74 @@ SubstIstream::ForwardSourceData(const char *start,
         return 0;
     }
 
-    had_output = true;
-
-    if (nbytes < length) {
+    if (nbytes < length)
         /* blocking */
-        state = State::NONE;
         return (p - start) + nbytes;
-    } else
+    else
         /* everything has been consumed */
         return (size_t)-1;
 }
 
-inline size_t
-SubstIstream::ForwardSourceDataFinal(const char *start,
-                                     const char *end, const char *p) noexcept
-{
-    const DestructObserver destructed(*this);
-
-    size_t nbytes = InvokeData(p, end - p);
-    if (nbytes > 0 || !destructed) {
-        had_output = true;
-        nbytes += (p - start);
-    }
-
-    return nbytes;
-}
-
 size_t
-SubstIstream::Feed(const void *_data, size_t length) noexcept
+SubstIstream::Feed(const char *const data, size_t length) noexcept
 {
     assert(input.IsDefined());
+    assert(replay_position == replay_end);
+    assert(n_pending == 0);
 
     const DestructObserver destructed(*this);
 
-    const char *const data0 = (const char *)_data, *data = data0, *p = data0,
-        *const end = p + length, *first = nullptr;
-    const SubstNode *n;
+    const char *const end = data + length, *p = data;
 
-    had_input = true;
-
-    /* find new match */
-
-    do {
-        assert(data >= data0);
-        assert(p >= data);
-        assert(p <= end);
+    /* the beginning of input data which has not yet been
+       forwarded */
+    const char *literal = data;
 
-        switch (state) {
-        case State::NONE:
-            /* find matching first char */
-
-            assert(first == nullptr);
-
-            first = FindFirstChar(p, end - p);
-            if (first == nullptr)
-                /* no match, try to write and return */
-                return ForwardSourceDataFinal(data0, end, data);
+    while (p < end) {
+        if (node == root) {
+            /* skip quickly to the next character which may start a
+               word */
+            p = tree.FindFirstChar(p, end);
+            if (p == end)
+                break;
+        }
 
-            state = State::MATCH;
-            a_match = 1;
+        if (literal < p) {
+            const size_t nbytes =
+                ForwardSourceData(data, literal, p - literal);
+            if (nbytes != (size_t)-1)
+                return nbytes;
 
-            p = first + 1;
+            literal = p;
+        }
 
-            /* XXX check if match is full */
+        switch (Step(*p)) {
+        case StepResult::CONSUMED:
+            literal = ++p;
             break;
 
-        case State::MATCH:
-            /* now see if the rest matches; note that max_compare may be
-               0, but that isn't a problem */
-
-            n = subst_find_char(match, *p);
-            if (n != nullptr) {
-                /* next character matches */
-
-                ++a_match;
-                ++p;
-                match = n;
-
-                n = subst_find_leaf(n);
-                if (n != nullptr) {
-                    /* full match */
-
-                    match = n;
-
-                    if (first != nullptr && first > data) {
-                        /* write the data chunk before the match */
-
-                        had_output = true;
-
-                        const size_t chunk_length = first - data;
-                        const size_t nbytes =
-                            ForwardSourceData(data0, data, chunk_length);
-                        if (nbytes != (size_t)-1)
-                            return nbytes;
-                    }
-
-                    /* move data pointer */
-
-                    data = p;
-                    first = nullptr;
-
-                    /* switch state */
-
-                    if (n->leaf.b_length > 0) {
-                        state = State::INSERT;
-                        b_sent = 0;
-                    } else {
-                        state = State::NONE;
-                    }
-                }
-            } else {
-                /* mismatch. reset match indicator and find new one */
-
-                if (first != nullptr && (first > data ||
-                                         !mismatch.empty())) {
-                    /* write the data chunk before the (mis-)match */
-
-                    had_output = true;
-
-                    size_t chunk_length = first - data;
-                    if (!mismatch.empty())
-                        ++chunk_length;
-
-                    const size_t nbytes =
-                        ForwardSourceData(data0, data, chunk_length);
-                    if (nbytes != (size_t)-1)
-                        return nbytes;
-                } else {
-                    /* when re-parsing a mismatch, "first" must not be
-                       nullptr because we entered this function with
-                       state=NONE */
-                    assert(mismatch.empty());
-                }
-
-                /* move data pointer */
-
-                data = p;
-                first = nullptr;
-
-                /* switch state */
-
-                /* seek any leaf to get a valid match->leaf.a which we
-                   can use to re-insert the partial match into the
-                   stream */
-
-                state = State::NONE;
-
-                if (mismatch.empty()) {
-                    send_first = true;
-
-                    n = subst_find_any_leaf(match);
-                    assert(n != nullptr);
-                    assert(n->ch == 0);
-                    mismatch = {n->leaf.a, a_match};
-
-                    if (FeedMismatch())
-                        return destructed ? 0 : data - data0;
-                }
-            }
-
+        case StepResult::LITERAL:
+            /* this character will be forwarded with the next
+               chunk */
+            ++p;
             break;
 
-        case State::INSERT:
-            /* there is a previous full match, copy data from b */
-
-            const size_t nbytes = TryWriteB();
-            if (nbytes > 0) {
-                if (destructed)
-                    return 0;
-
-                assert(state == State::INSERT);
-                /* blocking */
-                return data - data0;
-            }
-
-            assert(state == State::NONE);
-
+        case StepResult::RETRY:
             break;
         }
-    } while (p < end || state == State::INSERT);
-
-    size_t chunk_length;
-    if (first != nullptr)
-        /* we have found a partial match which we discard now, instead
-           we will write the chunk right before this match */
-        chunk_length = first - data;
-    else if (state == State::MATCH || state == State::INSERT)
-        chunk_length = 0;
-    else
-        /* there was no match (maybe a partial match which mismatched
-           at a later stage): pass everything */
-        chunk_length = end - data;
 
-    if (chunk_length > 0) {
-        /* write chunk */
-
-        had_output = true;
+        if (!FlushPending() || !ProcessReplay())
+            return destructed ? 0 : literal - data;
+    }
 
-        const size_t nbytes = ForwardSourceData(data0, data, chunk_length);
+    if (literal < end) {
+        const size_t nbytes =
+            ForwardSourceData(data, literal, end - literal);
         if (nbytes != (size_t)-1)
             return nbytes;
     }
 
-    return p - data0;
+    return length;
 }
 
 /*
@@ -606,11 +575,14 @@ SubstIstream::Feed(const void *_data, size_t length) noexcept
 inline size_t
 SubstIstream::OnData(const void *data, size_t length) noexcept
 {
-    if (!mismatch.empty() && FeedMismatch())
-        return 0;
+    had_input = true;
 
     const ScopePoolRef ref(GetPool() TRACE_ARGS);
-    return Feed(data, length);
+
+    if (!FlushPending() || !ProcessReplay())
+        return 0;
+
+    return Feed((const char *)data, length);
 }
 
 void
@@ -620,35 +592,7 @@ SubstIstream::OnEof() noexcept
 
     input.Clear();
 
-    switch (state) {
-        size_t nbytes;
-
-    case State::NONE:
-        break;
-
-    case State::MATCH:
-        /* we're in the middle of a match, technically making this a
-           mismatch because we reach end of file before end of
-           match */
-        if (mismatch.empty()) {
-            const SubstNode *n = subst_find_any_leaf(match);
-            assert(n != nullptr);
-            assert(n->ch == 0);
-
-            mismatch = {n->leaf.a, a_match};
-            WriteMismatch();
-            return;
-        }
-        break;
-
-    case State::INSERT:
-        nbytes = TryWriteB();
-        if (nbytes > 0)
-            return;
-        break;
-    }
-
-    if (state == State::NONE)
+    if (Finish())
         DestroyEof();
 }
 
@@ -669,46 +613,24 @@ SubstIstream::OnError(std::exception_ptr ep) noexcept
 void
 SubstIstream::_Read() noexcept
 {
-    if (!mismatch.empty()) {
-        bool ret = input.IsDefined()
-            ? FeedMismatch()
-            : WriteMismatch();
-
-        if (ret || !input.IsDefined())
-            return;
-    } else {
-        assert(input.IsDefined());
+    if (!input.IsDefined()) {
+        if (Finish())
+            DestroyEof();
+        return;
     }
 
-    switch (state) {
-        size_t nbytes;
-
-    case State::NONE:
-    case State::MATCH: {
-        assert(input.IsDefined());
-
-        had_output = false;
-
-        const DestructObserver destructed(*this);
+    const DestructObserver destructed(*this);
 
-        do {
-            had_input = false;
-            input.Read();
-        } while (!destructed && input.IsDefined() && had_input &&
-                 !had_output && state != State::INSERT);
+    had_output = false;
 
+    if (!FlushPending() || !ProcessReplay() || had_output)
         return;
-    }
-
-    case State::INSERT:
-        nbytes = TryWriteB();
-        if (nbytes > 0)
-            return;
-        break;
-    }
 
-    if (state == State::NONE && !input.IsDefined())
-        DestroyEof();
+    do {
+        had_input = false;
+        input.Read();
+    } while (!destructed && input.IsDefined() && had_input &&
+             !had_output);
 }
 
 void
@@ -727,69 +649,166 @@ SubstIstream::_Close() noexcept
 
 UnusedIstreamPtr
 istream_subst_new(struct pool *pool, UnusedIstreamPtr input,
-                  SubstTree tree) noexcept
+                  SubstTree tree, bool *matched_r) noexcept
 {
+    if (!tree.IsCompiled())
+        tree.Compile(*pool);
+
     return NewIstreamPtr<SubstIstream>(*pool, std::move(input),
-                                       std::move(tree));
+                                       PoolPtr(), tree, matched_r);
+}
+
+UnusedIstreamPtr
+istream_subst_new_shared(struct pool &pool, UnusedIstreamPtr input,
+                         const SubstTree &tree, PoolPtr tree_pool) noexcept
+{
+    return NewIstreamPtr<SubstIstream>(pool, std::move(input),
+                                       std::move(tree_pool), tree,
+                                       nullptr);
+}
+
+/*
+ * SubstTree
+ *
+ */
+
+static SubstNode *
+NewSubstNode(struct pool &pool, const char *word, size_t depth,
+             char ch) noexcept
+{
+    auto *n = PoolAlloc<SubstNode>(pool);
+    n->fail = n->output = nullptr;
+    n->first_child = n->next_sibling = nullptr;
+    n->child_chars = nullptr;
+    n->children = nullptr;
+    n->n_children = 0;
+    n->word = word;
+    n->depth = depth;
+    n->ch = ch;
+    n->is_word = false;
+    n->b = nullptr;
+    n->b_length = 0;
+    return n;
 }
 
 bool
 SubstTree::Add(struct pool &pool, const char *a0, StringView b) noexcept
 {
-    SubstNode *parent = nullptr;
-    const char *a = a0;
-
     assert(a0 != nullptr);
     assert(*a0 != 0);
+    assert(!compiled);
 
-    auto **pp = &root;
-    do {
-        auto *p = *pp;
-        if (p == nullptr) {
-            /* create new tree node */
-
-            p = (SubstNode *)p_malloc(&pool, sizeof(*p) - sizeof(p->leaf));
-            p->parent = parent;
-            p->left = nullptr;
-            p->right = nullptr;
-            p->equals = nullptr;
-            p->ch = *a++;
-
-            *pp = parent = p;
-            pp = &p->equals;
-        } else if (*a < p->ch) {
-            pp = &p->left;
-            parent = p;
-        } else if (*a > p->ch) {
-            pp = &p->right;
-            parent = p;
-        } else {
-            /* tree node exists and matches, enter new level (next
-               character) */
-            pp = &p->equals;
-            parent = p;
-            ++a;
+    if (root == nullptr) {
+        root = NewSubstNode(pool, "", 0, 0);
+        ++n_nodes;
+    }
+
+    /* the new nodes refer to a copy of the word, because the
+       caller's string may not live as long as the pool; it is only
+       allocated if a new node is needed */
+    const char *word = nullptr;
+
+    SubstNode *n = root;
+    size_t depth = 0;
+    for (const char *a = a0; *a != 0; ++a) {
+        ++depth;
+
+        SubstNode *child = n->first_child;
+        while (child != nullptr && child->ch != *a)
+            child = child->next_sibling;
+
+        if (child == nullptr) {
+            if (word == nullptr)
+                word = p_strdup(&pool, a0);
+
+            child = NewSubstNode(pool, word, depth, *a);
+            child->next_sibling = n->first_child;
+            n->first_child = child;
+            ++n_nodes;
         }
-    } while (*a);
+
+        n = child;
+    }
 
     /* this keyword already exists */
-    if (*pp != nullptr)
+    if (n->is_word)
         return false;
 
-    /* create new leaf node */
-
-    SubstNode *p = (SubstNode *)
-        p_malloc(&pool, sizeof(*p) + b.size - sizeof(p->leaf.b));
-    p->parent = parent;
-    p->left = nullptr;
-    p->right = nullptr;
-    p->equals = nullptr;
-    p->ch = 0;
-    p->leaf.a = a0;
-    p->leaf.b_length = b.size;
-    memcpy(p->leaf.b, b.data, b.size);
+    n->is_word = true;
+    n->b = b.size > 0 ? (const char *)p_memdup(&pool, b.data, b.size) : nullptr;
+    n->b_length = b.size;
 
-    *pp = p;
+    max_length = std::max(max_length, depth);
 
     return true;
 }
+
+void
+SubstTree::Compile(struct pool &pool) noexcept
+{
+    assert(!compiled);
+
+    compiled = true;
+
+    if (root == nullptr) {
+        root = NewSubstNode(pool, "", 0, 0);
+        ++n_nodes;
+    }
+
+    /* breadth-first traversal, so the failure links of all
+       shallower nodes are known when they are needed */
+    auto **const queue = PoolAlloc<SubstNode *>(pool, n_nodes);
+    size_t head = 0, tail = 0;
+    queue[tail++] = root;
+
+    while (head < tail) {
+        SubstNode &n = *queue[head++];
+
+        /* convert the linked list of children to arrays */
+        for (const auto *i = n.first_child; i != nullptr; i = i->next_sibling)
+            ++n.n_children;
+
+        n.child_chars = PoolAlloc<char>(pool, n.n_children + 1);
+        n.children = PoolAlloc<const SubstNode *>(pool, n.n_children);
+
+        size_t i = 0;
+        for (auto *child = n.first_child; child != nullptr;
+             child = child->next_sibling, ++i) {
+            n.child_chars[i] = child->ch;
+            n.children[i] = child;
+
+            if (&n == root)
+                child->fail = root;
+            else {
+                const SubstNode *f = n.fail, *next;
+                while ((next = f->FindChild(child->ch)) == nullptr &&
+                       f != root)
+                    f = f->fail;
+
+                child->fail = next != nullptr ? next : root;
+            }
+
+            child->output = child->fail->is_word
+                ? child->fail
+                : child->fail->output;
+
+            assert(tail < n_nodes);
+            queue[tail++] = child;
+        }
+
+        n.child_chars[n.n_children] = 0;
+    }
+
+    p_free(&pool, queue);
+
+    /* prepare the first character prefilter */
+    first_chars = root->child_chars;
+
+    if (root->n_children > 8) {
+        auto *table = PoolAlloc<bool>(pool, 256);
+        std::fill_n(table, 256, false);
+        for (size_t i = 0; i < root->n_children; ++i)
+            table[(unsigned char)first_chars[i]] = true;
+        first_char_table = table;
+    }
+}
@@ -35,39 +35,137 @@
 #include "util/Compiler.h"
 
 #include <algorithm>
+#include <utility>
 
 #include <stddef.h>
 
 struct pool;
 class UnusedIstreamPtr;
+class PoolPtr;
 struct SubstNode;
 struct StringView;
 
+/**
+ * A set of words and their replacements.  After all words have been
+ * added, Compile() turns it into an Aho-Corasick automaton, which
+ * finds all words in one pass over the input, no matter how many
+ * words there are.
+ */
 class SubstTree {
     SubstNode *root = nullptr;
 
+    /**
+     * The number of nodes (including the root), used to size the
+     * queue in Compile().
+     */
+    size_t n_nodes = 0;
+
+    /**
+     * The length of the longest word.
+     */
+    size_t max_length = 0;
+
+    /**
+     * The set of characters which may start a word; only valid after
+     * Compile().  It is null-terminated if there are only few of
+     * them, to be able to use FindAnyOf().
+     */
+    const char *first_chars = nullptr;
+
+    /**
+     * A lookup table for #first_chars if there are many of them.
+     */
+    const bool *first_char_table = nullptr;
+
+    bool compiled = false;
+
 public:
     SubstTree() = default;
 
+    /**
+     * Copy a compiled tree.  Both copies refer to the same nodes,
+     * which are owned by the pool passed to Add().
+     */
+    SubstTree(const SubstTree &src) noexcept = default;
+
     SubstTree(SubstTree &&src) noexcept
-        :root(std::exchange(src.root, nullptr)) {}
+        :root(std::exchange(src.root, nullptr)),
+         n_nodes(src.n_nodes), max_length(src.max_length),
+         first_chars(src.first_chars),
+         first_char_table(src.first_char_table),
+         compiled(src.compiled) {}
 
     SubstTree &operator=(SubstTree &&src) noexcept {
         using std::swap;
         swap(root, src.root);
+        swap(n_nodes, src.n_nodes);
+        swap(max_length, src.max_length);
+        swap(first_chars, src.first_chars);
+        swap(first_char_table, src.first_char_table);
+        swap(compiled, src.compiled);
         return *this;
     }
 
+    /**
+     * Add a word.  Must not be called after Compile().  Both strings
+     * are copied to the pool.
+     *
+     * @return false if the word already exists (the existing
+     * replacement is kept)
+     */
     bool Add(struct pool &pool, const char *a0, StringView b) noexcept;
 
+    bool IsCompiled() const noexcept {
+        return compiled;
+    }
+
+    /**
+     * Build the automaton.  After that, the tree is immutable and may
+     * be shared by many #SubstIstream instances (see
+     * istream_subst_new_shared()).
+     *
+     * @param pool the pool which was passed to Add()
+     */
+    void Compile(struct pool &pool) noexcept;
+
+    const SubstNode *GetRoot() const noexcept {
+        return root;
+    }
+
+    size_t GetMaxLength() const noexcept {
+        return max_length;
+    }
+
+    /**
+     * Find the first character which may start a word.
+     *
+     * @return the position or #end if there is none
+     */
     gcc_pure
-    std::pair<const SubstNode *, const char *> FindFirstChar(const char *data,
-                                                             size_t length) const noexcept;
+    const char *FindFirstChar(const char *p,
+                              const char *end) const noexcept;
 };
 
 /**
- * This istream filter substitutes a word with another string.
+ * This istream filter substitutes a word with another string.  If
+ * words overlap, the one which starts first wins; if several words
+ * start at the same position, the shortest one wins.
+ *
+ * @param matched_r if not nullptr, then this flag is set to true as
+ * soon as a word has been matched (even if its replacement is empty);
+ * it must remain valid as long as the istream exists
  */
 UnusedIstreamPtr
 istream_subst_new(struct pool *pool, UnusedIstreamPtr input,
-                  SubstTree tree) noexcept;
+                  SubstTree tree, bool *matched_r=nullptr) noexcept;
+
+/**
+ * Like istream_subst_new(), but use a compiled #SubstTree which is
+ * shared with other istreams (e.g. one owned by a cache).
+ *
+ * @param tree_pool the pool which owns the tree; the istream holds a
+ * reference to it
+ */
+UnusedIstreamPtr
+istream_subst_new_shared(struct pool &pool, UnusedIstreamPtr input,
+                         const SubstTree &tree, PoolPtr tree_pool) noexcept;
@@ -149,10 +149,10 @@ NewYamlSubstIstream(struct pool &pool, UnusedIstreamPtr input,
                                                         yaml_map_path)));
 }
 
-static SubstTree
-LoadYamlFile(struct pool &pool, bool alt_syntax,
-             const char *prefix,
-             const char *file_path, const char *map_path)
+SubstTree
+LoadYamlSubstTree(struct pool &pool, bool alt_syntax,
+                  const char *prefix,
+                  const char *file_path, const char *map_path)
 try {
     return LoadYamlMap(pool, alt_syntax, prefix,
                        ResolveYamlMap(YAML::LoadFile(file_path), map_path));
@@ -168,6 +168,6 @@ NewYamlSubstIstream(struct pool &pool, UnusedIstreamPtr input,
                     const char *yaml_file, const char *yaml_map_path)
 {
     return istream_subst_new(&pool, std::move(input),
-                             LoadYamlFile(pool, alt_syntax, prefix,
-                                          yaml_file, yaml_map_path));
+                             LoadYamlSubstTree(pool, alt_syntax, prefix,
+                                               yaml_file, yaml_map_path));
 }
@@ -34,6 +34,7 @@
 
 struct pool;
 class UnusedIstreamPtr;
+class SubstTree;
 namespace YAML { class Node; }
 
 UnusedIstreamPtr
@@ -51,3 +52,14 @@ UnusedIstreamPtr
 NewYamlSubstIstream(struct pool &pool, UnusedIstreamPtr input, bool alt_syntax,
                     const char *prefix,
                     const char *yaml_file, const char *yaml_map_path);
+
+/**
+ * Load the given YAML file into a #SubstTree (not yet compiled).
+ * All of its memory is allocated from the given pool.  This can be
+ * used to share the result among several requests.
+ *
+ * Throws on error (if the YAML file could not be loaded).
+ */
+SubstTree
+LoadYamlSubstTree(struct pool &pool, bool alt_syntax, const char *prefix,
+                  const char *yaml_file, const char *yaml_map_path);
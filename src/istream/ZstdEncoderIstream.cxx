@@ -0,0 +1,149 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ZstdEncoderIstream.hxx"
+#include "EncoderIstream.hxx"
+#include "UnusedPtr.hxx"
+#include "New.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/WritableBuffer.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <zstd.h>
+
+#include <stdexcept>
+
+class ZstdEncoderIstream final : public EncoderIstream {
+    const int level, window_log;
+
+    ZSTD_CCtx *cctx = nullptr;
+
+public:
+    ZstdEncoderIstream(struct pool &_pool, UnusedIstreamPtr _input,
+                       EventLoop &event_loop,
+                       int _level, int _window_log) noexcept
+        :EncoderIstream(_pool, std::move(_input), event_loop),
+         level(_level), window_log(_window_log)
+    {
+    }
+
+    ~ZstdEncoderIstream() noexcept {
+        if (cctx != nullptr)
+            ZSTD_freeCCtx(cctx);
+    }
+
+protected:
+    /* virtual methods from class EncoderIstream */
+    bool Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                Operation operation) override;
+
+private:
+    /**
+     * Throws on error.
+     */
+    void Init();
+};
+
+static void
+CheckZstd(size_t result, const char *msg)
+{
+    if (ZSTD_isError(result))
+        throw FormatRuntimeError("%s: %s", msg, ZSTD_getErrorName(result));
+}
+
+void
+ZstdEncoderIstream::Init()
+{
+    if (cctx != nullptr)
+        return;
+
+    cctx = ZSTD_createCCtx();
+    if (cctx == nullptr)
+        throw std::runtime_error("ZSTD_createCCtx() failed");
+
+    CheckZstd(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level),
+              "Failed to set the zstd compression level");
+
+    if (window_log > 0)
+        CheckZstd(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, window_log),
+                  "Failed to set the zstd window size");
+}
+
+bool
+ZstdEncoderIstream::Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                           Operation operation)
+{
+    Init();
+
+    ZSTD_EndDirective directive = ZSTD_e_continue;
+    switch (operation) {
+    case Operation::PROCESS:
+        directive = ZSTD_e_continue;
+        break;
+
+    case Operation::FLUSH:
+        directive = ZSTD_e_flush;
+        break;
+
+    case Operation::FINISH:
+        directive = ZSTD_e_end;
+        break;
+    }
+
+    ZSTD_inBuffer in{src.data, src.size, 0};
+    ZSTD_outBuffer out{dest.data, dest.size, 0};
+
+    const size_t remaining = ZSTD_compressStream2(cctx, &out, &in, directive);
+    CheckZstd(remaining, "ZSTD_compressStream2() failed");
+
+    src = {(const char *)src.data + in.pos, src.size - in.pos};
+    dest = {(char *)dest.data + out.pos, dest.size - out.pos};
+
+    /* for ZSTD_e_flush and ZSTD_e_end, the return value is the
+       number of bytes still buffered inside the encoder */
+    return remaining == 0;
+}
+
+/*
+ * constructor
+ *
+ */
+
+UnusedIstreamPtr
+NewZstdEncoderIstream(struct pool &pool, UnusedIstreamPtr input,
+                      EventLoop &event_loop,
+                      int level, int window_log) noexcept
+{
+    return NewIstreamPtr<ZstdEncoderIstream>(pool, std::move(input),
+                                             event_loop,
+                                             level, window_log);
+}
@@ -31,14 +31,10 @@
  */
 
 #include "istream_deflate.hxx"
+#include "EncoderIstream.hxx"
 #include "UnusedPtr.hxx"
 #include "New.hxx"
-#include "FacadeIstream.hxx"
 #include "pool/pool.hxx"
-#include "fb_pool.hxx"
-#include "SliceFifoBuffer.hxx"
-#include "event/DeferEvent.hxx"
-#include "util/Cast.hxx"
 #include "util/ConstBuffer.hxx"
 #include "util/WritableBuffer.hxx"
 
@@ -46,8 +42,6 @@
 
 #include <stdexcept>
 
-#include <assert.h>
-
 class ZlibError : public std::runtime_error {
     int code;
 
@@ -60,125 +54,39 @@ public:
     }
 };
 
-class DeflateIstream final : public FacadeIstream {
+class DeflateIstream final : public EncoderIstream {
     const bool gzip;
-    bool z_initialized = false, z_stream_end = false;
+    const int level;
+    bool z_initialized = false;
     z_stream z;
-    bool had_input, had_output;
-    bool reading;
-    SliceFifoBuffer buffer;
-
-    /**
-     * This callback is used to request more data from the input if an
-     * OnData() call did not produce any output.  This tries to
-     * prevent stalling the stream.
-     */
-    DeferEvent defer;
 
 public:
     DeflateIstream(struct pool &_pool, UnusedIstreamPtr _input,
-                   EventLoop &event_loop, bool _gzip)
-        :FacadeIstream(_pool, std::move(_input)),
-         gzip(_gzip),
-         reading(false),
-         defer(event_loop, BIND_THIS_METHOD(OnDeferred))
+                   EventLoop &event_loop, bool _gzip, int _level) noexcept
+        :EncoderIstream(_pool, std::move(_input), event_loop),
+         gzip(_gzip), level(_level)
     {
     }
 
-    ~DeflateIstream() {
-        defer.Cancel();
-    }
-
-    bool InitZlib() noexcept;
-
-    void DeinitZlib() noexcept {
-        if (z_initialized) {
-            z_initialized = false;
+    ~DeflateIstream() noexcept {
+        if (z_initialized)
             deflateEnd(&z);
-        }
-    }
-
-    void Abort(std::exception_ptr ep) noexcept {
-        DeinitZlib();
-
-        if (HasInput())
-            ClearAndCloseInput();
-
-        DestroyError(ep);
-    }
-
-    void Abort(int code, const char *msg) noexcept {
-        Abort(std::make_exception_ptr(ZlibError(code, msg)));
-    }
-
-    /**
-     * Submit data from the buffer to our istream handler.
-     *
-     * @return the number of bytes which were handled, or 0 if the
-     * stream was closed
-     */
-    size_t TryWrite() noexcept;
-
-    /**
-     * Starts to write to the buffer.
-     *
-     * @return a pointer to the writable buffer, or nullptr if there is no
-     * room (our istream handler blocks) or if the stream was closed
-     */
-    WritableBuffer<void> BufferWrite() noexcept {
-        buffer.AllocateIfNull(fb_pool_get());
-        auto w = buffer.Write();
-        if (w.empty() && TryWrite() > 0)
-            w = buffer.Write();
-
-        return w.ToVoid();
     }
 
-    void TryFlush() noexcept;
-
-    /**
-     * Read from our input until we have submitted some bytes to our
-     * istream handler.
-     */
-    void ForceRead() noexcept;
-
-    void TryFinish() noexcept;
-
-    /* virtual methods from class Istream */
-
-    void _Read() noexcept override {
-        if (!buffer.empty())
-            TryWrite();
-        else if (HasInput())
-            ForceRead();
-        else
-            TryFinish();
-    }
-
-    void _Close() noexcept override {
-        DeinitZlib();
-
-        if (HasInput())
-            input.Close();
-
-        Destroy();
-    }
-
-    /* virtual methods from class IstreamHandler */
-    size_t OnData(const void *data, size_t length) noexcept override;
-    void OnEof() noexcept override;
-    void OnError(std::exception_ptr ep) noexcept override;
+protected:
+    /* virtual methods from class EncoderIstream */
+    bool Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                Operation operation) override;
 
 private:
     int GetWindowBits() const noexcept {
         return MAX_WBITS + gzip * 16;
     }
 
-    void OnDeferred() noexcept {
-        assert(HasInput());
-
-        ForceRead();
-    }
+    /**
+     * Throws #ZlibError on error.
+     */
+    void InitZlib();
 };
 
 static voidpf
@@ -196,223 +104,67 @@ z_free(voidpf opaque, voidpf address) noexcept
     (void)address;
 }
 
-bool
-DeflateIstream::InitZlib() noexcept
+void
+DeflateIstream::InitZlib()
 {
     if (z_initialized)
-        return true;
+        return;
 
     z.zalloc = z_alloc;
     z.zfree = z_free;
     z.opaque = &GetPool();
 
-    int err = deflateInit2(&z, Z_DEFAULT_COMPRESSION,
+    int err = deflateInit2(&z, level,
                            Z_DEFLATED, GetWindowBits(), 8,
                            Z_DEFAULT_STRATEGY);
-    if (err != Z_OK) {
-        Abort(err, "deflateInit(Z_FINISH) failed");
-        return false;
-    }
+    if (err != Z_OK)
+        throw ZlibError(err, "deflateInit() failed");
 
     z_initialized = true;
-    return true;
 }
 
-size_t
-DeflateIstream::TryWrite() noexcept
-{
-    auto r = buffer.Read();
-    assert(!r.empty());
-
-    size_t nbytes = InvokeData(r.data, r.size);
-    if (nbytes == 0)
-        return 0;
-
-    buffer.Consume(nbytes);
-    buffer.FreeIfEmpty();
-
-    if (nbytes == r.size && !HasInput() && z_stream_end) {
-        DeinitZlib();
-        DestroyEof();
-        return 0;
-    }
-
-    return nbytes;
-}
-
-inline void
-DeflateIstream::TryFlush() noexcept
-{
-    assert(!z_stream_end);
-
-    auto w = BufferWrite();
-    if (w.empty())
-        return;
-
-    z.next_out = (Bytef *)w.data;
-    z.avail_out = (uInt)w.size;
-
-    z.next_in = nullptr;
-    z.avail_in = 0;
-
-    int err = deflate(&z, Z_SYNC_FLUSH);
-    if (err != Z_OK) {
-        Abort(err, "deflate(Z_SYNC_FLUSH) failed");
-        return;
-    }
-
-    buffer.Append(w.size - (size_t)z.avail_out);
-
-    if (!buffer.empty())
-        TryWrite();
-}
-
-inline void
-DeflateIstream::ForceRead() noexcept
-{
-    assert(!reading);
-
-    const ScopePoolRef ref(GetPool() TRACE_ARGS);
-
-    bool had_input2 = false;
-    had_output = false;
-
-    while (1) {
-        had_input = false;
-        reading = true;
-        input.Read();
-        reading = false;
-        if (!HasInput() || had_output)
-            return;
-
-        if (!had_input)
-            break;
-
-        had_input2 = true;
-    }
-
-    if (had_input2)
-        TryFlush();
-}
-
-void
-DeflateIstream::TryFinish() noexcept
-{
-    assert(!z_stream_end);
-
-    auto w = BufferWrite();
-    if (w.empty())
-        return;
-
-    z.next_out = (Bytef *)w.data;
-    z.avail_out = (uInt)w.size;
-
-    z.next_in = nullptr;
-    z.avail_in = 0;
-
-    int err = deflate(&z, Z_FINISH);
-    if (err == Z_STREAM_END)
-        z_stream_end = true;
-    else if (err != Z_OK) {
-        Abort(err, "deflate(Z_FINISH) failed");
-        return;
-    }
-
-    buffer.Append(w.size - (size_t)z.avail_out);
-
-    if (z_stream_end && buffer.empty()) {
-        DeinitZlib();
-        DestroyEof();
-    } else
-        TryWrite();
-}
-
-
-/*
- * istream handler
- *
- */
-
-size_t
-DeflateIstream::OnData(const void *data, size_t length) noexcept
-{
-    assert(HasInput());
-
-    auto w = BufferWrite();
-    if (w.size < 64) /* reserve space for end-of-stream marker */
-        return 0;
-
-    if (!InitZlib())
-        return 0;
-
-    had_input = true;
-
-    if (!reading)
-        had_output = false;
-
-    z.next_out = (Bytef *)w.data;
-    z.avail_out = (uInt)w.size;
-
-    z.next_in = (Bytef *)const_cast<void *>(data);
-    z.avail_in = (uInt)length;
-
-    do {
-        auto err = deflate(&z, Z_NO_FLUSH);
-        if (err != Z_OK) {
-            Abort(err, "deflate() failed");
-            return 0;
-        }
-
-        size_t nbytes = w.size - (size_t)z.avail_out;
-        if (nbytes > 0) {
-            had_output = true;
-            buffer.Append(nbytes);
-
-            const ScopePoolRef ref(GetPool() TRACE_ARGS);
-            TryWrite();
-
-            if (!z_initialized)
-                return 0;
-        } else
-            break;
-
-        w = BufferWrite();
-        if (w.size < 64) /* reserve space for end-of-stream marker */
-            break;
-
-        z.next_out = (Bytef *)w.data;
-        z.avail_out = (uInt)w.size;
-    } while (z.avail_in > 0);
-
-    if (!reading && !had_output)
-        /* we received data from our input, but we did not produce any
-           output (and we're not looping inside ForceRead()) - to
-           avoid stalling the stream, trigger the DeferEvent */
-        defer.Schedule();
-
-    return length - (size_t)z.avail_in;
-}
-
-void
-DeflateIstream::OnEof() noexcept
-{
-    ClearInput();
-    defer.Cancel();
-
-    if (!InitZlib())
-        return;
-
-    TryFinish();
-}
-
-void
-DeflateIstream::OnError(std::exception_ptr ep) noexcept
+bool
+DeflateIstream::Encode(ConstBuffer<void> &src, WritableBuffer<void> &dest,
+                       Operation operation)
 {
-    ClearInput();
-
-    DeinitZlib();
-
-    DestroyError(ep);
+    InitZlib();
+
+    z.next_in = (Bytef *)const_cast<void *>(src.data);
+    z.avail_in = (uInt)src.size;
+
+    z.next_out = (Bytef *)dest.data;
+    z.avail_out = (uInt)dest.size;
+
+    bool complete = true;
+    int err;
+
+    switch (operation) {
+    case Operation::PROCESS:
+        err = deflate(&z, Z_NO_FLUSH);
+        if (err != Z_OK)
+            throw ZlibError(err, "deflate() failed");
+        break;
+
+    case Operation::FLUSH:
+        err = deflate(&z, Z_SYNC_FLUSH);
+        if (err == Z_OK)
+            complete = z.avail_out > 0;
+        else if (err != Z_BUF_ERROR) /* Z_BUF_ERROR: nothing to flush */
+            throw ZlibError(err, "deflate(Z_SYNC_FLUSH) failed");
+        break;
+
+    case Operation::FINISH:
+        err = deflate(&z, Z_FINISH);
+        if (err == Z_OK)
+            complete = false;
+        else if (err != Z_STREAM_END)
+            throw ZlibError(err, "deflate(Z_FINISH) failed");
+        break;
+    }
+
+    src = {z.next_in, z.avail_in};
+    dest = {z.next_out, z.avail_out};
+    return complete;
 }
 
 /*
@@ -422,8 +174,8 @@ DeflateIstream::OnError(std::exception_ptr ep) noexcept
 
 UnusedIstreamPtr
 istream_deflate_new(struct pool &pool, UnusedIstreamPtr input,
-                    EventLoop &event_loop, bool gzip) noexcept
+                    EventLoop &event_loop, bool gzip, int level) noexcept
 {
     return NewIstreamPtr<DeflateIstream>(pool, std::move(input),
-                                         event_loop, gzip);
+                                         event_loop, gzip, level);
 }
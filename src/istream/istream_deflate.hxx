@@ -39,9 +39,12 @@ class EventLoop;
 
 /**
  * @param gzip use the gzip format instead of the zlib format?
+ * @param level the compression level (0..9); -1 means zlib's
+ * default (Z_DEFAULT_COMPRESSION)
  */
 UnusedIstreamPtr
 istream_deflate_new(struct pool &pool, UnusedIstreamPtr input,
-                    EventLoop &event_loop, bool gzip=false) noexcept;
+                    EventLoop &event_loop, bool gzip=false,
+                    int level=-1) noexcept;
 
 #endif
@@ -94,6 +94,12 @@ struct LbClusterConfig {
 
     bool mangle_via = false;
 
+    /**
+     * Speak HTTP/2 (prior knowledge) to the members of this cluster?
+     * Only valid with #LbProtocol::HTTP.
+     */
+    bool http2 = false;
+
     /**
      * Enable the #StickyCache for Zeroconf?  By default, consistent
      * hashing using #HashRing is used.
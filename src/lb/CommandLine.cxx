@@ -77,6 +77,10 @@ PrintUsage()
          " --logger-user name\n"
 #endif
          " -U name        execute the access logger program with this user id\n"
+#ifdef __GLIBC__
+         " --workers COUNT\n"
+#endif
+         " -w COUNT       set the number of worker processes; 0=don't fork\n"
 #ifdef __GLIBC__
          " --set NAME=VALUE  tweak an internal variable, see manual for details\n"
 #endif
@@ -158,21 +162,23 @@ ParseCommandLine(LbCmdLine &cmdline, LbConfig &config,
         {"access-logger", 1, NULL, 'A'},
         {"user", 1, NULL, 'u'},
         {"logger-user", 1, NULL, 'U'},
+        {"workers", 1, NULL, 'w'},
         {"set", 1, NULL, 's'},
         {NULL,0,NULL,0}
     };
 #endif
     const char *user_name = NULL;
     unsigned verbose = 1;
+    char *endptr;
 
     while (1) {
 #ifdef __GLIBC__
         int option_index = 0;
 
-        ret = getopt_long(argc, argv, "hVvqf:CA:u:U:B:s:",
+        ret = getopt_long(argc, argv, "hVvqf:CA:u:U:B:s:w:",
                           long_options, &option_index);
 #else
-        ret = getopt(argc, argv, "hVvqf:CA:u:U:B:s:");
+        ret = getopt(argc, argv, "hVvqf:CA:u:U:B:s:w:");
 #endif
         if (ret == -1)
             break;
@@ -214,6 +220,14 @@ ParseCommandLine(LbCmdLine &cmdline, LbConfig &config,
             cmdline.logger_user.Lookup(optarg);
             break;
 
+        case 'w':
+            cmdline.num_workers = (unsigned)strtoul(optarg, &endptr, 10);
+            if (*endptr != 0)
+                arg_error(argv[0], "invalid number after --workers");
+            if (cmdline.num_workers > 1024)
+                arg_error(argv[0], "too many workers configured");
+            break;
+
         case 's':
             HandleSet(cmdline, argv[0], optarg);
             break;
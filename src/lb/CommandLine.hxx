@@ -48,6 +48,12 @@ struct LbCmdLine {
 
     unsigned tcp_stock_limit = 256;
 
+    /**
+     * The number of worker processes; 0 means no workers, i.e. the
+     * master process handles all connections.
+     */
+    unsigned num_workers = 0;
+
     /**
      * If true, then the environment (e.g. the configuration file) is
      * checked, and the process exits.
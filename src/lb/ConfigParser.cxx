@@ -663,6 +663,14 @@ LbConfigParser::Cluster::ParseLine(FileLineParser &line)
         config.mangle_via = line.NextBool();
 
         line.ExpectEnd();
+    } else if (strcmp(word, "http2") == 0) {
+#ifdef HAVE_NGHTTP2
+        config.http2 = line.NextBool();
+
+        line.ExpectEnd();
+#else
+        throw LineParser::Error("HTTP/2 support is disabled");
+#endif
     } else if (strcmp(word, "fallback") == 0) {
         if (config.fallback.IsDefined())
             throw LineParser::Error("Duplicate fallback");
@@ -712,6 +720,9 @@ LbConfigParser::Cluster::Finish()
     if (!validate_protocol_sticky(config.protocol, config.sticky_mode))
         throw LineParser::Error("The selected sticky mode not available for this protocol");
 
+    if (config.http2 && config.protocol != LbProtocol::HTTP)
+        throw LineParser::Error("HTTP/2 requires protocol \"http\"");
+
     if (config.HasZeroConf() &&
         !ValidateZeroconfSticky(config.sticky_mode))
         throw LineParser::Error("The selected sticky mode not compatible with Zeroconf");
@@ -1148,6 +1159,31 @@ LbConfigParser::Listener::ParseLine(FileLineParser &line)
         if (config.ssl_config.verify != SslVerify::NO &&
             config.cert_db != nullptr)
             throw LineParser::Error("ssl_cert_db and ssl_verify are mutually exclusive");
+    } else if (strcmp(word, "http2") == 0) {
+#ifdef HAVE_NGHTTP2
+        config.http2 = line.NextBool();
+        line.ExpectEnd();
+#else
+        throw LineParser::Error("HTTP/2 support is disabled");
+#endif
+    } else if (strcmp(word, "ssl_ticket_key_file") == 0) {
+        if (!config.ssl)
+            throw LineParser::Error("SSL is not enabled");
+
+        if (!config.ssl_config.ticket_key_file.empty())
+            throw LineParser::Error("Ticket key file already configured");
+
+        config.ssl_config.ticket_key_file = line.ExpectValueAndEnd();
+    } else if (strcmp(word, "ktls") == 0) {
+        if (!config.ssl)
+            throw LineParser::Error("SSL is not enabled");
+
+#ifdef HAVE_LINUX_TLS_H
+        config.ssl_config.ktls = line.NextBool();
+        line.ExpectEnd();
+#else
+        throw LineParser::Error("Kernel TLS support is disabled");
+#endif
     } else
         throw LineParser::Error("Unknown option");
 }
@@ -1164,6 +1200,13 @@ LbConfigParser::Listener::Finish()
     if (config.ssl && config.ssl_config.cert_key.empty())
         throw LineParser::Error("No SSL certificates ");
 
+    if (config.http2 &&
+        config.destination.GetProtocol() != LbProtocol::HTTP)
+        throw LineParser::Error("HTTP/2 requires protocol \"http\"");
+
+    /* offer "h2" via ALPN */
+    config.ssl_config.http2 = config.http2;
+
     if (config.destination.GetProtocol() == LbProtocol::HTTP ||
         config.ssl)
         config.tcp_defer_accept = 10;
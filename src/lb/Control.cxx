@@ -290,19 +290,24 @@ LbControl::OnControlPacket(ControlServer &control_server,
 
     case ControlCommand::TCACHE_INVALIDATE:
         InvalidateTranslationCache(payload, address);
+        instance.ForwardControl(command, payload);
         break;
 
     case ControlCommand::FADE_CHILDREN:
         break;
 
     case ControlCommand::ENABLE_NODE:
-        if (is_privileged)
+        if (is_privileged) {
             EnableNode((const char *)payload.data, payload.size);
+            instance.ForwardControl(command, payload);
+        }
         break;
 
     case ControlCommand::FADE_NODE:
-        if (is_privileged)
+        if (is_privileged) {
             FadeNode((const char *)payload.data, payload.size);
+            instance.ForwardControl(command, payload);
+        }
         break;
 
     case ControlCommand::NODE_STATUS:
@@ -323,6 +328,7 @@ LbControl::OnControlPacket(ControlServer &control_server,
     case ControlCommand::VERBOSE:
         if (is_privileged && payload.size == 1) {
             SetLogLevel(*(const uint8_t *)payload.data);
+            instance.ForwardControl(command, payload);
         }
 
         break;
@@ -336,6 +342,37 @@ LbControl::OnControlPacket(ControlServer &control_server,
     }
 }
 
+void
+LbControl::OnForwardedPacket(BengProxy::ControlCommand command,
+                             ConstBuffer<void> payload) noexcept
+{
+    /* the master process has already verified the client's
+       privileges */
+
+    switch (command) {
+    case ControlCommand::TCACHE_INVALIDATE:
+        InvalidateTranslationCache(payload, nullptr);
+        break;
+
+    case ControlCommand::ENABLE_NODE:
+        EnableNode((const char *)payload.data, payload.size);
+        break;
+
+    case ControlCommand::FADE_NODE:
+        FadeNode((const char *)payload.data, payload.size);
+        break;
+
+    case ControlCommand::VERBOSE:
+        if (payload.size == 1)
+            SetLogLevel(*(const uint8_t *)payload.data);
+        break;
+
+    default:
+        /* not applicable */
+        break;
+    }
+}
+
 void
 LbControl::OnControlError(std::exception_ptr ep) noexcept
 {
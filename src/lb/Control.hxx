@@ -67,6 +67,13 @@ public:
         server.Disable();
     }
 
+    /**
+     * Handle a control packet which was accepted by the master
+     * process and forwarded to this worker process.
+     */
+    void OnForwardedPacket(BengProxy::ControlCommand command,
+                           ConstBuffer<void> payload) noexcept;
+
 private:
     void InvalidateTranslationCache(ConstBuffer<void> payload,
                                     SocketAddress address);
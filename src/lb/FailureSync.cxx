@@ -0,0 +1,88 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FailureSync.hxx"
+
+unsigned
+LbFailureSync::GetFlags(const FailureInfo &info, Expiry now) noexcept
+{
+    unsigned flags = 0;
+    if (!info.CheckMonitor())
+        flags |= MONITOR;
+    if (!info.CheckConnect(now))
+        flags |= CONNECT;
+    if (!info.CheckFade(now))
+        flags |= FADE;
+    return flags;
+}
+
+inline std::string
+LbFailureSync::ToKey(SocketAddress address) noexcept
+{
+    return std::string((const char *)address.GetAddress(), address.GetSize());
+}
+
+void
+LbFailureSync::Apply(Expiry now, SocketAddress address,
+                     unsigned flags) noexcept
+{
+    auto &info = failure_manager.Make(address);
+    auto &k = known[ToKey(address)];
+    const unsigned changed = k ^ flags;
+
+    if (changed & MONITOR) {
+        if (flags & MONITOR)
+            info.SetMonitor();
+        else
+            info.UnsetMonitor();
+    }
+
+    if (changed & CONNECT) {
+        if (flags & CONNECT)
+            info.SetConnect(now, CONNECT_DURATION);
+        else
+            info.UnsetConnect();
+    }
+
+    if (changed & FADE) {
+        if (!(flags & FADE))
+            info.UnsetFade();
+        else if (info.CheckFade(now))
+            /* don't shorten a longer fade which was set locally
+               (e.g. by a FADE_NODE control packet) */
+            info.SetFade(now, FADE_DURATION);
+    }
+
+    /* remember the resulting state, so the next Scan() doesn't
+       publish it again */
+    k = GetFlags(info, now);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "net/FailureManager.hxx"
+#include "net/SocketAddress.hxx"
+#include "util/Compiler.h"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Synchronizes the #FailureManager state between the beng-lb master
+ * and its worker processes.  Each process periodically scans its
+ * #FailureManager for changes (see Scan()) and publishes them; the
+ * receivers apply them with Apply().
+ *
+ * Only the conditions which are of interest to other processes are
+ * transferred: "monitor" (the master runs all monitors), "connect"
+ * (one worker has failed to connect) and "fade".
+ */
+class LbFailureSync {
+    FailureManager &failure_manager;
+
+    /**
+     * The flags which were last published or applied, indexed by
+     * the raw socket address.
+     */
+    std::unordered_map<std::string, unsigned> known;
+
+public:
+    static constexpr unsigned MONITOR = 0x1;
+    static constexpr unsigned CONNECT = 0x2;
+    static constexpr unsigned FADE = 0x4;
+
+    /**
+     * The duration of a "connect" failure received from another
+     * process.
+     */
+    static constexpr std::chrono::seconds CONNECT_DURATION{20};
+
+    /**
+     * The duration of a "fade" received from another process.
+     */
+    static constexpr std::chrono::seconds FADE_DURATION{300};
+
+    explicit LbFailureSync(FailureManager &_failure_manager) noexcept
+        :failure_manager(_failure_manager) {}
+
+    /**
+     * Find all addresses whose flags have changed since the last
+     * call and invoke f(address, flags) for each of them.
+     */
+    template<typename F>
+    void Scan(Expiry now, F &&f) noexcept {
+        failure_manager.ForEach([this, now, &f](SocketAddress address,
+                                                const FailureInfo &info){
+            const unsigned flags = GetFlags(info, now);
+            auto &k = known[ToKey(address)];
+            if (flags != k) {
+                k = flags;
+                f(address, flags);
+            }
+        });
+    }
+
+    /**
+     * Apply flags received from another process.
+     */
+    void Apply(Expiry now, SocketAddress address, unsigned flags) noexcept;
+
+    gcc_pure
+    static unsigned GetFlags(const FailureInfo &info, Expiry now) noexcept;
+
+private:
+    static std::string ToKey(SocketAddress address) noexcept;
+};
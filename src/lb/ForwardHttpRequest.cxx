@@ -49,6 +49,11 @@
 #include "http_client.hxx"
 #include "fs/Stock.hxx"
 #include "fs/Balancer.hxx"
+#ifdef HAVE_NGHTTP2
+#include "http2_client.hxx"
+#include "http2_stock.hxx"
+#include "http2_balancer.hxx"
+#endif
 #include "HttpResponseHandler.hxx"
 #include "http/Headers.hxx"
 #include "stock/GetHandler.hxx"
@@ -82,6 +87,20 @@ class LbRequest final
 
     FilteredSocketBalancer &balancer;
 
+#ifdef HAVE_NGHTTP2
+    /**
+     * If this is non-nullptr, then the request is forwarded over a
+     * (shared) HTTP/2 connection; see LbClusterConfig::http2.
+     */
+    Http2Balancer *const http2_balancer;
+
+    /**
+     * The lease for one HTTP/2 stream; only used if #http2_balancer
+     * is set.
+     */
+    struct lease_ref http2_lease_ref;
+#endif
+
     HttpServerRequest &request;
 
     /**
@@ -114,13 +133,21 @@ class LbRequest final
 public:
     LbRequest(LbHttpConnection &_connection, LbCluster &_cluster,
               FilteredSocketBalancer &_balancer,
+              Http2Balancer *_http2_balancer,
               HttpServerRequest &_request,
               CancellablePointer &_cancel_ptr) noexcept
         :pool(_request.pool), connection(_connection), cluster(_cluster),
          cluster_config(cluster.GetConfig()),
          balancer(_balancer),
+#ifdef HAVE_NGHTTP2
+         http2_balancer(cluster_config.http2 ? _http2_balancer : nullptr),
+#endif
          request(_request),
          body(pool, std::move(request.body)) {
+#ifndef HAVE_NGHTTP2
+        (void)_http2_balancer;
+#endif
+
         _cancel_ptr = *this;
 
         if (cluster_config.HasZeroConf())
@@ -158,7 +185,7 @@ private:
 
     void SetForwardedTo() noexcept {
         // TODO: optimize this operation
-        connection.per_request.forwarded_to =
+        LbHttpConnection::GetPerRequest(request).forwarded_to =
             address_to_string(pool,
                               GetFailureManager().GetAddress(*failure));
     }
@@ -172,7 +199,7 @@ private:
     }
 
     const char *GetCanonicalHost() const noexcept {
-        return connection.per_request.GetCanonicalHost();
+        return LbHttpConnection::GetPerRequest(request).GetCanonicalHost();
     }
 
     sticky_hash_t GetStickyHash() noexcept;
@@ -402,7 +429,12 @@ LbRequest::OnStockItemReady(StockItem &item) noexcept
         /* without the fs_balancer, we have to roll our own failure
            updates */
         failure->UnsetConnect();
-    } else
+    }
+#ifdef HAVE_NGHTTP2
+    else if (http2_balancer != nullptr)
+        failure = GetFailureManager().Make(http2_stock_item_get_address(*stock_item));
+#endif
+    else
         failure = GetFailureManager().Make(fs_stock_item_get_address(*stock_item));
 
     const char *peer_subject = connection.ssl_filter != nullptr
@@ -420,6 +452,19 @@ LbRequest::OnStockItemReady(StockItem &item) noexcept
                                peer_subject, peer_issuer_subject,
                                cluster_config.mangle_via);
 
+#ifdef HAVE_NGHTTP2
+    if (http2_balancer != nullptr) {
+        http2_client_request(pool,
+                             http2_stock_item_get(item),
+                             *this,
+                             request.method, request.uri,
+                             HttpHeaders(std::move(headers)),
+                             std::move(body),
+                             *this, cancel_ptr);
+        return;
+    }
+#endif
+
     http_client_request(pool,
                         fs_stock_item_get(item),
                         *this,
@@ -469,7 +514,14 @@ LbRequest::ReleaseLease(bool reuse) noexcept
 {
     assert(stock_item != nullptr);
 
-    stock_item->Put(!reuse);
+#ifdef HAVE_NGHTTP2
+    if (http2_balancer != nullptr)
+        /* the stream lease is owned by the MultiStock item; the
+           connection itself stays in the stock */
+        http2_lease_ref.Release(reuse);
+    else
+#endif
+        stock_item->Put(!reuse);
     stock_item = nullptr;
 
     if (response_sent) {
@@ -525,6 +577,20 @@ LbRequest::Start() noexcept
 
         current_member = *member;
 
+#ifdef HAVE_NGHTTP2
+        if (http2_balancer != nullptr) {
+            connection.instance.http2_stock->Get(pool,
+                                                 member->GetLogName(),
+                                                 cluster_config.transparent_source,
+                                                 bind_address,
+                                                 member->GetAddress(),
+                                                 LB_HTTP_CONNECT_TIMEOUT,
+                                                 *this, http2_lease_ref,
+                                                 cancel_ptr);
+            return;
+        }
+#endif
+
         connection.instance.fs_stock->Get(pool,
                                           member->GetLogName(),
                                           cluster_config.transparent_source,
@@ -537,6 +603,19 @@ LbRequest::Start() noexcept
         return;
     }
 
+#ifdef HAVE_NGHTTP2
+    if (http2_balancer != nullptr) {
+        http2_balancer->Get(pool,
+                            cluster_config.transparent_source,
+                            bind_address,
+                            GetStickyHash(),
+                            cluster_config.address_list,
+                            LB_HTTP_CONNECT_TIMEOUT,
+                            *this, http2_lease_ref, cancel_ptr);
+        return;
+    }
+#endif
+
     balancer.Get(pool,
                  cluster_config.transparent_source,
                  bind_address,
@@ -557,6 +636,7 @@ ForwardHttpRequest(LbHttpConnection &connection,
         NewFromPool<LbRequest>(request.pool,
                                connection, cluster,
                                *connection.instance.fs_balancer,
+                               connection.instance.http2_balancer,
                                request, cancel_ptr);
     request2->Start();
 }
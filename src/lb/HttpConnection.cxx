@@ -148,7 +148,7 @@ NewLbHttpConnection(LbInstance &instance,
                                                   ? (SocketAddress)local_address
                                                   : nullptr,
                                                   address,
-                                                  false,
+                                                  false, listener.http2,
                                                   *connection);
     return connection;
 }
@@ -209,26 +209,36 @@ SendResponse(HttpServerRequest &request,
  *
  */
 
-inline void
-LbHttpConnection::PerRequest::Begin(const HttpServerRequest &request,
-                                    std::chrono::steady_clock::time_point now)
+inline
+LbHttpConnection::PerRequest::PerRequest(const HttpServerRequest &request,
+                                         std::chrono::steady_clock::time_point now) noexcept
+    :start_time(now),
+     host(request.headers.Get("host")),
+     x_forwarded_for(request.headers.Get("x-forwarded-for")),
+     referer(request.headers.Get("referer")),
+     user_agent(request.headers.Get("user-agent")),
+     canonical_host(nullptr),
+     site_name(nullptr),
+     forwarded_to(nullptr)
+{
+}
+
+LbHttpConnection::PerRequest &
+LbHttpConnection::GetPerRequest(const HttpServerRequest &request) noexcept
 {
-    start_time = now;
-    host = request.headers.Get("host");
-    x_forwarded_for = request.headers.Get("x-forwarded-for");
-    referer = request.headers.Get("referer");
-    user_agent = request.headers.Get("user-agent");
-    canonical_host = nullptr;
-    site_name = nullptr;
-    forwarded_to = nullptr;
+    assert(request.handler_data != nullptr);
+
+    return *(PerRequest *)request.handler_data;
 }
 
 void
-LbHttpConnection::RequestHeadersFinished(const HttpServerRequest &request) noexcept
+LbHttpConnection::RequestHeadersFinished(HttpServerRequest &request) noexcept
 {
     ++instance.http_request_counter;
 
-    per_request.Begin(request, instance.event_loop.SteadyNow());
+    request.handler_data =
+        NewFromPool<PerRequest>(request.pool, request,
+                                instance.event_loop.SteadyNow());
 }
 
 void
@@ -243,7 +253,8 @@ LbHttpConnection::HandleHttpRequest(HttpServerRequest &request,
     }
 
     if (instance.config.global_http_check &&
-        instance.config.global_http_check->Match(request.uri, per_request.host) &&
+        instance.config.global_http_check->Match(request.uri,
+                                                 GetPerRequest(request).host) &&
         instance.config.global_http_check->MatchClientAddress(request.remote_address)) {
         request.body.Clear();
 
@@ -306,7 +317,8 @@ LbHttpConnection::LogHttpRequest(HttpServerRequest &request,
 {
     instance.http_traffic_received_counter += bytes_received;
     instance.http_traffic_sent_counter += bytes_sent;
-    if (instance.access_log != nullptr)
+    if (instance.access_log != nullptr) {
+        const auto &per_request = GetPerRequest(request);
         instance.access_log->Log(instance.event_loop.SystemNow(),
                                  request, per_request.site_name,
                                  per_request.forwarded_to,
@@ -317,6 +329,7 @@ LbHttpConnection::LogHttpRequest(HttpServerRequest &request,
                                  status, length,
                                  bytes_received, bytes_sent,
                                  per_request.GetDuration(instance.event_loop.SteadyNow()));
+    }
 }
 
 void
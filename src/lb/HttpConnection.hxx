@@ -36,6 +36,7 @@
 #include "http_server/Handler.hxx"
 #include "pool/Holder.hxx"
 #include "io/Logger.hxx"
+#include "util/Compiler.h"
 
 #include <boost/intrusive/list.hpp>
 
@@ -48,6 +49,7 @@ struct SslFilter;
 class UniqueSocketDescriptor;
 class SocketAddress;
 struct HttpServerConnection;
+struct HttpServerRequest;
 struct LbListenerConfig;
 class LbCluster;
 class LbLuaHandler;
@@ -79,10 +81,10 @@ struct LbHttpConnection final
     HttpServerConnection *http;
 
     /**
-     * Attributes which are specific to the current request.  They are
-     * only valid while a request is being handled (i.e. during the
-     * lifetime of the #HttpServerRequest instance).  Strings are
-     * allocated from the request pool.
+     * Attributes which are specific to one request.  An instance is
+     * allocated from the request pool and attached to
+     * HttpServerRequest::handler_data by RequestHeadersFinished().
+     * Strings are allocated from the request pool.
      *
      * The request header pointers are here because our
      * http_client_request() call invalidates the original request
@@ -134,8 +136,8 @@ struct LbHttpConnection final
          */
         const char *forwarded_to;
 
-        void Begin(const HttpServerRequest &request,
-                   std::chrono::steady_clock::time_point now);
+        PerRequest(const HttpServerRequest &request,
+                   std::chrono::steady_clock::time_point now) noexcept;
 
         constexpr const char *GetCanonicalHost() const {
             return canonical_host != nullptr
@@ -146,7 +148,14 @@ struct LbHttpConnection final
         std::chrono::steady_clock::duration GetDuration(std::chrono::steady_clock::time_point now) const {
             return now - start_time;
         }
-    } per_request;
+    };
+
+    /**
+     * Obtain the #PerRequest instance which was attached to the
+     * given request by RequestHeadersFinished().
+     */
+    gcc_pure
+    static PerRequest &GetPerRequest(const HttpServerRequest &request) noexcept;
 
     LbHttpConnection(PoolPtr &&_pool, LbInstance &_instance,
                      const LbListenerConfig &_listener,
@@ -166,7 +175,7 @@ struct LbHttpConnection final
     void LogSendError(HttpServerRequest &request, std::exception_ptr ep);
 
     /* virtual methods from class HttpServerConnectionHandler */
-    void RequestHeadersFinished(const HttpServerRequest &request) noexcept override;
+    void RequestHeadersFinished(HttpServerRequest &request) noexcept override;
     void HandleHttpRequest(HttpServerRequest &request,
                            CancellablePointer &cancel_ptr) noexcept override;
 
@@ -36,6 +36,9 @@
 #include "Control.hxx"
 #include "Config.hxx"
 #include "Listener.hxx"
+#include "Worker.hxx"
+#include "Resolver.hxx"
+#include "spawn/Registry.hxx"
 #include "ssl/Cache.hxx"
 #include "fb_pool.hxx"
 #include "access_log/Glue.hxx"
@@ -52,7 +55,11 @@ LbInstance::LbInstance(const LbConfig &_config) noexcept
      goto_map(config, failure_manager, monitors, avahi_client),
      compress_event(event_loop, BIND_THIS_METHOD(OnCompressTimer)),
      shutdown_listener(event_loop, BIND_THIS_METHOD(ShutdownCallback)),
-     sighup_event(event_loop, SIGHUP, BIND_THIS_METHOD(ReloadEventCallback))
+     sighup_event(event_loop, SIGHUP, BIND_THIS_METHOD(ReloadEventCallback)),
+     spawn_worker_event(event_loop,
+                        BIND_THIS_METHOD(RespawnWorkerCallback)),
+     failure_sync(failure_manager),
+     sync_timer(event_loop, BIND_THIS_METHOD(OnSyncTimer))
 {
 }
 
@@ -85,6 +92,15 @@ LbInstance::Compress() noexcept
     logger(3, "flushed ", n_ssl_sessions, " SSL sessions");
 }
 
+LbResolver &
+LbInstance::GetResolver()
+{
+    if (!resolver)
+        resolver.reset(new LbResolver(event_loop));
+
+    return *resolver;
+}
+
 CertCache &
 LbInstance::GetCertCache(const LbCertDatabaseConfig &cert_db_config)
 {
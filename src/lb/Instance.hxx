@@ -36,6 +36,8 @@
 #include "PInstance.hxx"
 #include "GotoMap.hxx"
 #include "MonitorManager.hxx"
+#include "FailureSync.hxx"
+#include "WorkerChannel.hxx"
 #include "event/TimerEvent.hxx"
 #include "event/SignalEvent.hxx"
 #include "event/ShutdownListener.hxx"
@@ -43,15 +45,22 @@
 #include "net/FailureManager.hxx"
 #include "io/Logger.hxx"
 
+#include <boost/intrusive/list.hpp>
+
 #include <forward_list>
 #include <memory>
 #include <map>
 
+#include <sys/types.h>
+
 class AccessLogGlue;
 class PipeStock;
 class BalancerMap;
 class FilteredSocketStock;
 class FilteredSocketBalancer;
+class Http2Stock;
+class Http2Balancer;
+class LbResolver;
 struct LbConfig;
 struct LbCertDatabaseConfig;
 struct LbHttpConnection;
@@ -59,9 +68,14 @@ class LbTcpConnection;
 class LbControl;
 class LbListener;
 class CertCache;
-namespace BengProxy { struct ControlStats; }
-
-struct LbInstance final : PInstance {
+class ChildProcessRegistry;
+struct LbWorker;
+namespace BengProxy {
+enum class ControlCommand;
+struct ControlStats;
+}
+
+struct LbInstance final : PInstance, LbWorkerChannelHandler {
     const LbConfig &config;
 
     const Logger logger;
@@ -98,6 +112,28 @@ struct LbInstance final : PInstance {
     ShutdownListener shutdown_listener;
     SignalEvent sighup_event;
 
+    /**
+     * The number of worker processes to be spawned by this (master)
+     * process.  0 means this process handles connections itself.
+     */
+    unsigned num_workers = 0;
+
+    /* child management (only in the master process) */
+    std::unique_ptr<ChildProcessRegistry> child_process_registry;
+    TimerEvent spawn_worker_event;
+
+    boost::intrusive::list<LbWorker,
+                           boost::intrusive::base_hook<boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>>,
+                           boost::intrusive::constant_time_size<true>> workers;
+
+    /**
+     * In a worker process: the channel to the master process.
+     */
+    std::unique_ptr<LbWorkerChannel> master_channel;
+
+    LbFailureSync failure_sync;
+    TimerEvent sync_timer;
+
     /* stock */
     FailureManager failure_manager;
     BalancerMap *balancer;
@@ -105,8 +141,17 @@ struct LbInstance final : PInstance {
     FilteredSocketStock *fs_stock = nullptr;
     FilteredSocketBalancer *fs_balancer = nullptr;
 
+    Http2Stock *http2_stock = nullptr;
+    Http2Balancer *http2_balancer = nullptr;
+
     PipeStock *pipe_stock;
 
+    /**
+     * The DNS resolver for RESOLVE_CONNECT; created on demand by
+     * GetResolver().
+     */
+    std::unique_ptr<LbResolver> resolver;
+
     explicit LbInstance(const LbConfig &_config) noexcept;
     ~LbInstance() noexcept;
 
@@ -116,6 +161,28 @@ struct LbInstance final : PInstance {
      */
     void InitWorker();
 
+    /**
+     * Start spawning #num_workers worker processes.
+     */
+    void StartWorkers();
+
+    pid_t SpawnWorker(unsigned index);
+    void ScheduleSpawnWorker() noexcept;
+    void KillAllWorkers() noexcept;
+
+    /**
+     * Apply a #LbWorkerCommand::FAILURE packet received from the
+     * given worker and forward it to all other workers.
+     */
+    void OnWorkerFailure(const LbWorker &sender,
+                         ConstBuffer<void> payload) noexcept;
+
+    /**
+     * Forward an accepted control packet to all worker processes.
+     */
+    void ForwardControl(BengProxy::ControlCommand command,
+                        ConstBuffer<void> payload) noexcept;
+
     void InitAllListeners();
     void DeinitAllListeners() noexcept;
 
@@ -132,6 +199,13 @@ struct LbInstance final : PInstance {
      */
     void Compress() noexcept;
 
+    /**
+     * Returns the #LbResolver, creating it on the first call.
+     *
+     * Throws on error.
+     */
+    LbResolver &GetResolver();
+
     CertCache &GetCertCache(const LbCertDatabaseConfig &cert_db_config);
     void ConnectCertCaches();
     void DisconnectCertCaches() noexcept;
@@ -152,6 +226,17 @@ struct LbInstance final : PInstance {
 
 private:
     void OnCompressTimer() noexcept;
+
+    gcc_pure
+    unsigned FindFreeWorkerIndex() const noexcept;
+
+    void RespawnWorkerCallback() noexcept;
+    void OnSyncTimer() noexcept;
+
+    /* virtual methods from class LbWorkerChannelHandler */
+    void OnWorkerPacket(LbWorkerCommand command,
+                        ConstBuffer<void> payload) noexcept override;
+    void OnWorkerChannelClosed() noexcept override;
 };
 
 struct client_connection;
@@ -83,7 +83,7 @@ LbListener::LbListener(LbInstance &_instance,
 }
 
 void
-LbListener::Setup()
+LbListener::Setup(unsigned n_shards)
 {
     assert(ssl_factory == nullptr);
 
@@ -100,7 +100,28 @@ LbListener::Setup()
                                              std::move(sni_callback));
     }
 
-    Listen(config.Create(SOCK_STREAM));
+    if (n_shards == 0) {
+        Listen(config.Create(SOCK_STREAM));
+        return;
+    }
+
+    /* one socket per worker; the kernel distributes incoming
+       connections among them */
+    SocketConfig shard_config(config);
+    shard_config.reuse_port = true;
+
+    shards.reserve(n_shards);
+    for (unsigned i = 0; i < n_shards; ++i)
+        shards.emplace_back(shard_config.Create(SOCK_STREAM));
+}
+
+void
+LbListener::SelectShard(unsigned i)
+{
+    assert(i < shards.size());
+
+    Listen(std::move(shards[i]));
+    shards.clear();
 }
 
 void
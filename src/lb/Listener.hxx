@@ -36,6 +36,9 @@
 #include "Goto.hxx"
 #include "io/Logger.hxx"
 #include "event/net/ServerSocket.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <vector>
 
 struct SslFactory;
 struct LbListenerConfig;
@@ -54,6 +57,14 @@ class LbListener final : public ServerSocket {
 
     SslFactory *ssl_factory = nullptr;
 
+    /**
+     * In multi-worker mode, the master process creates one
+     * SO_REUSEPORT socket per worker and keeps them all, so a
+     * respawned worker can take over the socket (and its pending
+     * connections) of its predecessor.  See SelectShard().
+     */
+    std::vector<UniqueSocketDescriptor> shards;
+
     const Logger logger;
 
 public:
@@ -61,7 +72,17 @@ public:
                const LbListenerConfig &_config);
     ~LbListener();
 
-    void Setup();
+    /**
+     * @param n_shards the number of worker processes; 0 means this
+     * process accepts connections itself
+     */
+    void Setup(unsigned n_shards=0);
+
+    /**
+     * Start accepting connections on the given shard socket and close
+     * all others.  Call this in the new worker process.
+     */
+    void SelectShard(unsigned i);
     void Scan(LbGotoMap &goto_map);
 
     unsigned FlushSSLSessionCache(long tm);
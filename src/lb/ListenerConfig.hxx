@@ -50,6 +50,12 @@ struct LbListenerConfig : SocketConfig {
 
     bool verbose_response = false;
 
+    /**
+     * Accept HTTP/2 connections?  On SSL listeners, "h2" is offered
+     * via ALPN; on all others, clients need "prior knowledge".
+     */
+    bool http2 = false;
+
     bool ssl = false;
 
     SslConfig ssl_config;
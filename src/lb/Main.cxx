@@ -33,12 +33,17 @@
 #include "direct.hxx"
 #include "CommandLine.hxx"
 #include "Instance.hxx"
+#include "Worker.hxx"
 #include "TcpConnection.hxx"
 #include "HttpConnection.hxx"
 #include "Config.hxx"
 #include "lb_check.hxx"
 #include "fs/Stock.hxx"
 #include "fs/Balancer.hxx"
+#ifdef HAVE_NGHTTP2
+#include "http2_stock.hxx"
+#include "http2_balancer.hxx"
+#endif
 #include "pipe_stock.hxx"
 #include "access_log/Glue.hxx"
 #include "ssl/Init.hxx"
@@ -49,6 +54,7 @@
 #include "odbus/Init.hxx"
 #include "odbus/Connection.hxx"
 #include "net/FailureManager.hxx"
+#include "spawn/Registry.hxx"
 #include "system/Isolate.hxx"
 #include "system/SetupProcess.hxx"
 #include "util/PrintException.hxx"
@@ -95,6 +101,16 @@ LbInstance::ShutdownCallback() noexcept
 
     compress_event.Cancel();
 
+    spawn_worker_event.Cancel();
+    sync_timer.Cancel();
+
+    if (child_process_registry)
+        child_process_registry->SetVolatile();
+
+    KillAllWorkers();
+
+    master_channel.reset();
+
     DeinitAllControls();
 
     while (!tcp_connections.empty())
@@ -115,6 +131,13 @@ LbInstance::ShutdownCallback() noexcept
 
     pool_commit();
 
+#ifdef HAVE_NGHTTP2
+    delete std::exchange(http2_balancer, nullptr);
+    delete std::exchange(http2_stock, nullptr);
+#endif
+
+    resolver.reset();
+
     delete std::exchange(fs_balancer, nullptr);
     delete std::exchange(fs_stock, nullptr);
 
@@ -187,6 +210,8 @@ try {
 
     init_signals(&instance);
 
+    instance.num_workers = cmdline.num_workers;
+
     instance.InitAllControls();
     instance.InitAllListeners();
 
@@ -197,6 +222,13 @@ try {
     instance.fs_balancer = new FilteredSocketBalancer(*instance.fs_stock,
                                                       instance.failure_manager);
 
+#ifdef HAVE_NGHTTP2
+    instance.http2_stock = new Http2Stock(*instance.fs_stock,
+                                          cmdline.tcp_stock_limit);
+    instance.http2_balancer = new Http2Balancer(*instance.http2_stock,
+                                                instance.failure_manager);
+#endif
+
     instance.pipe_stock = new PipeStock(instance.event_loop);
 
     /* launch the access logger */
@@ -236,7 +268,12 @@ try {
 
     /* main loop */
 
-    instance.InitWorker();
+    if (instance.num_workers > 0)
+        /* the master process doesn't accept connections; it only
+           runs the monitors and supervises the workers */
+        instance.StartWorkers();
+    else
+        instance.InitWorker();
 
     /* tell systemd we're ready */
     sd_notify(0, "READY=1");
@@ -162,6 +162,16 @@ LbMonitorController::LbMonitorController(EventLoop &_event_loop,
     interval_event.Schedule(std::chrono::seconds(0));
 }
 
+void
+LbMonitorController::Disable() noexcept
+{
+    interval_event.Cancel();
+    timeout_event.Cancel();
+
+    if (cancel_ptr)
+        cancel_ptr.CancelAndClear();
+}
+
 LbMonitorController::~LbMonitorController() noexcept
 {
     if (cancel_ptr)
@@ -96,6 +96,12 @@ public:
         return address;
     }
 
+    /**
+     * Stop monitoring.  This is used by worker processes, which
+     * receive the monitor state from the master process.
+     */
+    void Disable() noexcept;
+
 private:
     void IntervalCallback() noexcept;
     void TimeoutCallback() noexcept;
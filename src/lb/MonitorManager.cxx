@@ -50,14 +50,26 @@ LbMonitorManager::clear()
     monitors.clear();
 }
 
+void
+LbMonitorManager::Disable() noexcept
+{
+    enabled = false;
+
+    for (auto &i : monitors)
+        i.second.Disable();
+}
+
 LbMonitorStock &
 LbMonitorManager::operator[](const LbMonitorConfig &monitor_config)
 {
-    return monitors
+    auto &stock = monitors
         .emplace(std::piecewise_construct,
                  std::forward_as_tuple(&monitor_config),
                  std::forward_as_tuple(event_loop,
                                        failure_manager,
                                        monitor_config))
         .first->second;
+    if (!enabled)
+        stock.Disable();
+    return stock;
 }
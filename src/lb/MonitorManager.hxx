@@ -50,6 +50,8 @@ class LbMonitorManager {
 
     std::map<const LbMonitorConfig *, LbMonitorStock> monitors;
 
+    bool enabled = true;
+
 public:
     LbMonitorManager(EventLoop &_event_loop,
                      FailureManager &_failure_manager);
@@ -61,6 +63,13 @@ public:
 
     void clear();
 
+    /**
+     * Disable all current and future monitors.  This is used by
+     * worker processes, which receive the monitor state from the
+     * master process.
+     */
+    void Disable() noexcept;
+
     gcc_pure
     LbMonitorStock &operator[](const LbMonitorConfig &monitor_config);
 };
@@ -96,6 +96,8 @@ LbMonitorStock::Add(const char *node_name, SocketAddress address)
                                              node_name,
                                              config, address, class_))
         .first->second;
+    if (!enabled)
+        m.Disable();
     return {*this, m};
 }
 
@@ -109,6 +111,15 @@ LbMonitorStock::Add(const LbNodeConfig &node, unsigned port)
     return Add(node.name.c_str(), address);
 }
 
+void
+LbMonitorStock::Disable() noexcept
+{
+    enabled = false;
+
+    for (auto &i : map)
+        i.second.Disable();
+}
+
 void
 LbMonitorStock::Remove(LbMonitorController &m) noexcept
 {
@@ -56,6 +56,8 @@ class LbMonitorStock {
 
     std::map<std::string, LbMonitorController> map;
 
+    bool enabled = true;
+
 public:
     LbMonitorStock(EventLoop &_event_loop,
                    FailureManager &_failure_manager,
@@ -70,4 +72,9 @@ public:
     LbMonitorRef Add(const LbNodeConfig &node, unsigned port);
 
     void Remove(LbMonitorController &m) noexcept;
+
+    /**
+     * Disable all current and future monitors.
+     */
+    void Disable() noexcept;
 };
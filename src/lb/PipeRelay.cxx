@@ -0,0 +1,59 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PipeRelay.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <errno.h>
+#include <fcntl.h>
+
+ssize_t
+PipeRelay::Splice(struct pool &pool, SocketDescriptor src, size_t max_size)
+{
+    assert(in_pipe == 0);
+
+    pipe.EnsureCreated(pool);
+
+    ssize_t nbytes = splice(src.Get(), nullptr,
+                            pipe.GetWriteFd().Get(), nullptr,
+                            max_size, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (nbytes <= 0) {
+        /* nothing was moved into the pipe; don't hold it */
+        const int save_errno = errno;
+        pipe.ReleaseIfStock();
+        errno = save_errno;
+        return nbytes;
+    }
+
+    in_pipe = nbytes;
+    return nbytes;
+}
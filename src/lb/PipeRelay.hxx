@@ -0,0 +1,112 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "PipeLease.hxx"
+#include "io/FdType.hxx"
+
+#include <assert.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct pool;
+class PipeStock;
+class SocketDescriptor;
+
+/**
+ * The pipe of a splice() relay from one socket to another: data is
+ * moved from the source socket into the pipe, and from there to the
+ * destination.  A pipe from the #PipeStock is only held while it
+ * contains data.
+ */
+class PipeRelay {
+    PipeLease pipe;
+
+    /**
+     * The number of bytes in #pipe which have not yet been written
+     * to the destination.
+     */
+    size_t in_pipe = 0;
+
+public:
+    explicit PipeRelay(PipeStock *stock) noexcept
+        :pipe(stock) {}
+
+    ~PipeRelay() noexcept {
+        /* a pipe which still contains data must not be reused */
+        pipe.Release(in_pipe == 0);
+    }
+
+    PipeRelay(const PipeRelay &) = delete;
+    PipeRelay &operator=(const PipeRelay &) = delete;
+
+    bool IsEmpty() const noexcept {
+        return in_pipe == 0;
+    }
+
+    /**
+     * Move data from the source socket into the pipe, which must be
+     * empty.  If nothing was moved, the pipe is returned to the
+     * #PipeStock.
+     *
+     * Throws if no pipe could be obtained.
+     *
+     * @return the number of bytes moved, 0 on end of file or -1 on
+     * error (with errno set; EAGAIN if the socket is empty)
+     */
+    ssize_t Splice(struct pool &pool, SocketDescriptor src, size_t max_size);
+
+    /**
+     * Move data from the pipe to the destination (a class with a
+     * WriteFrom() method like #BufferedSocket's).  Once the pipe is
+     * empty, it is returned to the #PipeStock.
+     *
+     * @return the return value of WriteFrom()
+     */
+    template<typename S>
+    ssize_t Flush(S &dest) noexcept {
+        assert(in_pipe > 0);
+
+        ssize_t nbytes = dest.WriteFrom(pipe.GetReadFd().Get(),
+                                        FdType::FD_PIPE, in_pipe);
+        if (nbytes > 0) {
+            assert(size_t(nbytes) <= in_pipe);
+
+            in_pipe -= nbytes;
+            if (in_pipe == 0)
+                pipe.ReleaseIfStock();
+        }
+
+        return nbytes;
+    }
+};
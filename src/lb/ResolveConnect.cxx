@@ -33,6 +33,8 @@
 #include "HttpConnection.hxx"
 #include "Headers.hxx"
 #include "Instance.hxx"
+#include "Resolver.hxx"
+#include "pool/pool.hxx"
 #include "pool/PSocketAddress.hxx"
 #include "lease.hxx"
 #include "HttpResponseHandler.hxx"
@@ -45,16 +47,20 @@
 #include "fs/Stock.hxx"
 #include "stock/GetHandler.hxx"
 #include "stock/Item.hxx"
-#include "net/Resolver.hxx"
-#include "net/AddressInfo.hxx"
+#include "net/HostParser.hxx"
 #include "util/Cancellable.hxx"
 #include "util/LeakDetector.hxx"
 
+#include <stdexcept>
+
+#include <stdlib.h>
+
 static constexpr Event::Duration LB_HTTP_CONNECT_TIMEOUT =
     std::chrono::seconds(20);
 
 class LbResolveConnectRequest final
-    : LeakDetector, Cancellable, StockGetHandler, Lease, HttpResponseHandler {
+    : LeakDetector, Cancellable, LbResolverHandler, StockGetHandler, Lease,
+      HttpResponseHandler {
 
     struct pool &pool;
 
@@ -62,6 +68,8 @@ class LbResolveConnectRequest final
 
     HttpServerRequest &request;
 
+    const char *const name;
+
     /**
      * The request body.
      */
@@ -82,14 +90,16 @@ class LbResolveConnectRequest final
 public:
     LbResolveConnectRequest(LbHttpConnection &_connection,
                             HttpServerRequest &_request,
+                            const char *_name,
                             CancellablePointer &_cancel_ptr)
         :pool(_request.pool), connection(_connection),
-         request(_request),
+         request(_request), name(_name),
          body(pool, std::move(request.body)) {
         _cancel_ptr = *this;
     }
 
-    void Start(const char *name, SocketAddress address);
+    void Start(LbResolver &resolver, const char *host_name,
+               unsigned port) noexcept;
 
 private:
     void Destroy() {
@@ -129,6 +139,10 @@ private:
         c.Cancel();
     }
 
+    /* virtual methods from class LbResolverHandler */
+    void OnResolverSuccess(SocketAddress address) noexcept override;
+    void OnResolverError(std::exception_ptr ep) noexcept override;
+
     /* virtual methods from class StockGetHandler */
     void OnStockItemReady(StockItem &item) noexcept override;
     void OnStockItemError(std::exception_ptr ep) noexcept override;
@@ -142,6 +156,29 @@ private:
     void OnHttpError(std::exception_ptr ep) noexcept override;
 };
 
+void
+LbResolveConnectRequest::OnResolverSuccess(SocketAddress address) noexcept
+{
+    connection.instance.fs_stock->Get(pool, name, false, nullptr,
+                                      DupAddress(pool, address),
+                                      LB_HTTP_CONNECT_TIMEOUT,
+                                      nullptr,
+                                      *this, cancel_ptr);
+}
+
+void
+LbResolveConnectRequest::OnResolverError(std::exception_ptr ep) noexcept
+{
+    assert(lease_state == LeaseState::NONE);
+    assert(!response_sent);
+
+    connection.logger(2, ep);
+
+    body.Clear();
+    connection.SendError(request, ep);
+    ResponseSent();
+}
+
 void
 LbResolveConnectRequest::OnStockItemReady(StockItem &item) noexcept
 {
@@ -235,14 +272,10 @@ LbResolveConnectRequest::OnHttpError(std::exception_ptr ep) noexcept
 }
 
 inline void
-LbResolveConnectRequest::Start(const char *name, SocketAddress address)
+LbResolveConnectRequest::Start(LbResolver &resolver, const char *host_name,
+                               unsigned port) noexcept
 {
-    connection.instance.fs_stock->Get(pool, name, false, nullptr,
-                                      address,
-                                      LB_HTTP_CONNECT_TIMEOUT,
-                                      nullptr,
-                                      *this, cancel_ptr);
-
+    resolver.Resolve(host_name, port, *this, cancel_ptr);
 }
 
 void
@@ -250,25 +283,27 @@ LbHttpConnection::ResolveConnect(const char *host,
                                  HttpServerRequest &request,
                                  CancellablePointer &cancel_ptr)
 {
-    per_request.forwarded_to = host;
+    GetPerRequest(request).forwarded_to = host;
 
-    SocketAddress address;
+    LbResolver *resolver;
+    const char *host_name;
+    unsigned port = 80;
 
     try {
-        static constexpr struct addrinfo hints = {
-            .ai_flags = AI_ADDRCONFIG,
-            .ai_family = AF_UNSPEC,
-            .ai_socktype = SOCK_STREAM,
-            .ai_protocol = 0,
-            .ai_addrlen = 0,
-            .ai_addr = nullptr,
-            .ai_canonname = nullptr,
-            .ai_next = nullptr,
-        };
-
-        /* TODO: make this lookup non-blocking */
-        address = DupAddress(request.pool,
-                             Resolve(host, 80, &hints).front());
+        const auto eh = ExtractHost(host);
+        if (eh.host.IsNull() || (*eh.end != 0 && *eh.end != ':'))
+            throw std::runtime_error("Malformed host name");
+
+        if (*eh.end == ':') {
+            char *endptr;
+            port = strtoul(eh.end + 1, &endptr, 10);
+            if (endptr == eh.end + 1 || *endptr != 0 ||
+                port == 0 || port > 0xffff)
+                throw std::runtime_error("Malformed port number");
+        }
+
+        host_name = p_strdup(request.pool, eh.host);
+        resolver = &instance.GetResolver();
     } catch (...) {
         SendError(request, std::current_exception());
         return;
@@ -276,6 +311,6 @@ LbHttpConnection::ResolveConnect(const char *host,
 
     const auto request2 =
         NewFromPool<LbResolveConnectRequest>(request.pool, *this,
-                                             request, cancel_ptr);
-    request2->Start(host, address);
+                                             request, host, cancel_ptr);
+    request2->Start(*resolver, host_name, port);
 }
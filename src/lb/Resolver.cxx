@@ -0,0 +1,495 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Resolver.hxx"
+#include "event/Loop.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/IPv6Address.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <assert.h>
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netdb.h>
+
+class LbResolver::Request final
+    : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>,
+      Cancellable {
+
+    const unsigned port;
+
+    LbResolverHandler &handler;
+
+public:
+    Request(unsigned _port, LbResolverHandler &_handler,
+            CancellablePointer &cancel_ptr) noexcept
+        :port(_port), handler(_handler) {
+        cancel_ptr = *this;
+    }
+
+    void Deliver(SocketAddress address, std::exception_ptr error) noexcept {
+        auto &_handler = handler;
+
+        if (error) {
+            delete this;
+            _handler.OnResolverError(std::move(error));
+        } else {
+            AllocatedSocketAddress a(address);
+            a.SetPort(port);
+            delete this;
+            _handler.OnResolverSuccess(a);
+        }
+    }
+
+private:
+    /* virtual methods from class Cancellable */
+    void Cancel() noexcept override {
+        /* the query continues, and its result will be cached */
+        delete this;
+    }
+};
+
+struct LbResolver::Host {
+    LbResolver &resolver;
+
+    const std::string name;
+
+    /**
+     * The cached address (without a port); undefined if #error is
+     * set.
+     */
+    AllocatedSocketAddress address;
+
+    /**
+     * The cached error.
+     */
+    std::exception_ptr error;
+
+    std::chrono::steady_clock::time_point expires;
+
+    /**
+     * Is a query in progress?
+     */
+    bool busy = false;
+
+    RequestList requests;
+
+    Host(LbResolver &_resolver, const std::string &_name) noexcept
+        :resolver(_resolver), name(_name) {}
+
+    bool IsIdle() const noexcept {
+        return !busy && requests.empty();
+    }
+
+    static void OnAReply(void *arg, int status, int,
+                         unsigned char *abuf, int alen) noexcept {
+        auto &host = *(Host *)arg;
+        host.resolver.OnReply(host, false, status, abuf, alen);
+    }
+
+    static void OnAaaaReply(void *arg, int status, int,
+                            unsigned char *abuf, int alen) noexcept {
+        auto &host = *(Host *)arg;
+        host.resolver.OnReply(host, true, status, abuf, alen);
+    }
+};
+
+class LbResolver::Socket {
+    LbResolver &resolver;
+
+    const int fd;
+
+    SocketEvent event;
+
+public:
+    Socket(LbResolver &_resolver, int _fd) noexcept
+        :resolver(_resolver), fd(_fd),
+         event(resolver.event_loop, BIND_THIS_METHOD(OnSocketReady),
+               SocketDescriptor(fd)) {}
+
+    ~Socket() noexcept {
+        /* the socket is owned (and closed) by c-ares */
+        event.Cancel();
+    }
+
+    void Schedule(bool readable, bool writable) noexcept {
+        event.Schedule((readable ? SocketEvent::READ : 0) |
+                       (writable ? SocketEvent::WRITE : 0));
+    }
+
+private:
+    void OnSocketReady(unsigned events) noexcept {
+        /* copy to the stack, because c-ares may close the socket,
+           which destroys this object */
+        auto &_resolver = resolver;
+        const int _fd = fd;
+
+        _resolver.Process((events & ~SocketEvent::WRITE) != 0
+                          ? _fd : ARES_SOCKET_BAD,
+                          (events & SocketEvent::WRITE) != 0
+                          ? _fd : ARES_SOCKET_BAD);
+    }
+};
+
+static std::runtime_error
+MakeAresError(const std::string &name, int status) noexcept
+{
+    return std::runtime_error("Failed to resolve '" + name + "': " +
+                              ares_strerror(status));
+}
+
+/**
+ * Parse a numeric IPv4 or IPv6 address.
+ *
+ * @return an undefined #AllocatedSocketAddress if this is not a
+ * numeric address
+ */
+static AllocatedSocketAddress
+ParseNumericAddress(const char *name) noexcept
+{
+    struct in_addr in;
+    if (inet_pton(AF_INET, name, &in) == 1)
+        return AllocatedSocketAddress(IPv4Address(in, 0));
+
+    struct in6_addr in6;
+    if (inet_pton(AF_INET6, name, &in6) == 1)
+        return AllocatedSocketAddress(IPv6Address(in6, 0));
+
+    return AllocatedSocketAddress();
+}
+
+/**
+ * Look up the name in /etc/hosts.
+ *
+ * @return an undefined #AllocatedSocketAddress if the name was not
+ * found
+ */
+static AllocatedSocketAddress
+LookupHostsFile(ares_channel channel, const char *name) noexcept
+{
+    for (int family : {AF_INET, AF_INET6}) {
+        struct hostent *he;
+        if (ares_gethostbyname_file(channel, name, family,
+                                    &he) != ARES_SUCCESS)
+            continue;
+
+        AllocatedSocketAddress result;
+        if (he->h_addr_list[0] != nullptr) {
+            if (he->h_addrtype == AF_INET)
+                result = IPv4Address(*(const struct in_addr *)he->h_addr_list[0], 0);
+            else if (he->h_addrtype == AF_INET6)
+                result = IPv6Address(*(const struct in6_addr *)he->h_addr_list[0], 0);
+        }
+
+        ares_free_hostent(he);
+
+        if (!result.IsNull())
+            return result;
+    }
+
+    return AllocatedSocketAddress();
+}
+
+static std::chrono::steady_clock::duration
+ClampTtl(int ttl, std::chrono::seconds min,
+         std::chrono::seconds max) noexcept
+{
+    const std::chrono::seconds s(ttl);
+    return s < min ? min : (s > max ? max : s);
+}
+
+LbResolver::LbResolver(EventLoop &_event_loop, const char *servers)
+    :event_loop(_event_loop),
+     timeout_event(event_loop, BIND_THIS_METHOD(OnTimeout))
+{
+    int status = ares_library_init(ARES_LIB_INIT_ALL);
+    if (status != ARES_SUCCESS)
+        throw std::runtime_error(std::string("ares_library_init() failed: ") +
+                                 ares_strerror(status));
+
+    struct ares_options options;
+    options.sock_state_cb = [](void *data, ares_socket_t fd,
+                               int readable, int writable){
+        auto &resolver = *(LbResolver *)data;
+        resolver.OnSocketState(fd, readable, writable);
+    };
+    options.sock_state_cb_data = this;
+
+    status = ares_init_options(&channel, &options, ARES_OPT_SOCK_STATE_CB);
+    if (status != ARES_SUCCESS) {
+        ares_library_cleanup();
+        throw std::runtime_error(std::string("ares_init_options() failed: ") +
+                                 ares_strerror(status));
+    }
+
+    if (servers != nullptr) {
+        status = ares_set_servers_ports_csv(channel, servers);
+        if (status != ARES_SUCCESS) {
+            ares_destroy(channel);
+            ares_library_cleanup();
+            throw std::runtime_error(std::string("Failed to configure DNS servers: ") +
+                                     ares_strerror(status));
+        }
+    }
+}
+
+LbResolver::~LbResolver() noexcept
+{
+    /* this invokes all pending callbacks with ARES_EDESTRUCTION */
+    ares_destroy(channel);
+    ares_library_cleanup();
+
+    timeout_event.Cancel();
+
+    for (auto &i : hosts)
+        i.second.requests.clear_and_dispose(DeleteDisposer());
+}
+
+void
+LbResolver::Resolve(const char *name, unsigned port,
+                    LbResolverHandler &handler,
+                    CancellablePointer &cancel_ptr) noexcept
+{
+    const auto now = event_loop.SteadyNow();
+
+    auto i = hosts.find(name);
+    if (i == hosts.end()) {
+        if (hosts.size() >= MAX_HOSTS)
+            Purge(now);
+
+        i = hosts.emplace(std::piecewise_construct,
+                          std::forward_as_tuple(name),
+                          std::forward_as_tuple(*this, name)).first;
+    }
+
+    auto &host = i->second;
+
+    auto *request = new Request(port, handler, cancel_ptr);
+    host.requests.push_back(*request);
+
+    if (host.busy)
+        /* coalesce with the query which is already in progress */
+        return;
+
+    if (now < host.expires)
+        /* cache hit */
+        Deliver(host);
+    else
+        StartQuery(host);
+}
+
+void
+LbResolver::StartQuery(Host &host) noexcept
+{
+    assert(!host.busy);
+
+    auto address = ParseNumericAddress(host.name.c_str());
+    if (!address.IsNull()) {
+        Complete(host, address, MAX_TTL);
+        return;
+    }
+
+    address = LookupHostsFile(channel, host.name.c_str());
+    if (!address.IsNull()) {
+        Complete(host, address, HOSTS_FILE_TTL);
+        return;
+    }
+
+    host.busy = true;
+    ares_search(channel, host.name.c_str(), ns_c_in, ns_t_a,
+                Host::OnAReply, &host);
+    ScheduleTimeout();
+}
+
+void
+LbResolver::OnReply(Host &host, bool ipv6, int status,
+                    const unsigned char *abuf, int alen) noexcept
+{
+    if (status == ARES_EDESTRUCTION)
+        /* LbResolver is being destructed */
+        return;
+
+    assert(host.busy);
+
+    if (status == ARES_SUCCESS) {
+        static constexpr int MAX_ADDRESSES = 16;
+        int n = MAX_ADDRESSES;
+
+        if (ipv6) {
+            struct ares_addr6ttl ttls[MAX_ADDRESSES];
+            status = ares_parse_aaaa_reply(abuf, alen, nullptr, ttls, &n);
+            if (status == ARES_SUCCESS && n > 0) {
+                int ttl = ttls[0].ttl;
+                for (int i = 1; i < n; ++i)
+                    ttl = std::min(ttl, ttls[i].ttl);
+
+                host.busy = false;
+                Complete(host, IPv6Address(*(const struct in6_addr *)&ttls[0].ip6addr, 0),
+                         ClampTtl(ttl, MIN_TTL, MAX_TTL));
+                return;
+            }
+        } else {
+            struct ares_addrttl ttls[MAX_ADDRESSES];
+            status = ares_parse_a_reply(abuf, alen, nullptr, ttls, &n);
+            if (status == ARES_SUCCESS && n > 0) {
+                int ttl = ttls[0].ttl;
+                for (int i = 1; i < n; ++i)
+                    ttl = std::min(ttl, ttls[i].ttl);
+
+                host.busy = false;
+                Complete(host, IPv4Address(ttls[0].ipaddr, 0),
+                         ClampTtl(ttl, MIN_TTL, MAX_TTL));
+                return;
+            }
+        }
+
+        if (status == ARES_SUCCESS)
+            /* no address records in the answer (e.g. only a
+               CNAME) */
+            status = ARES_ENODATA;
+    }
+
+    if (!ipv6 && status == ARES_ENODATA) {
+        /* no IPv4 address; try IPv6 */
+        ares_search(channel, host.name.c_str(), ns_c_in, ns_t_aaaa,
+                    Host::OnAaaaReply, &host);
+        return;
+    }
+
+    host.busy = false;
+    Fail(host, status);
+}
+
+void
+LbResolver::Complete(Host &host, SocketAddress address,
+                     std::chrono::steady_clock::duration ttl) noexcept
+{
+    assert(!host.busy);
+
+    host.address = address;
+    host.error = nullptr;
+    host.expires = event_loop.SteadyNow() + ttl;
+
+    Deliver(host);
+}
+
+void
+LbResolver::Fail(Host &host, int status) noexcept
+{
+    assert(!host.busy);
+
+    host.address.Clear();
+    host.error = std::make_exception_ptr(MakeAresError(host.name, status));
+
+    if (status == ARES_ENOTFOUND || status == ARES_ENODATA)
+        host.expires = event_loop.SteadyNow() + NEGATIVE_TTL;
+    else
+        /* don't cache temporary errors */
+        host.expires = {};
+
+    Deliver(host);
+}
+
+void
+LbResolver::Deliver(Host &host) noexcept
+{
+    /* copy everything to the stack, because the handlers may modify
+       the #hosts map */
+    RequestList requests;
+    requests.swap(host.requests);
+
+    const AllocatedSocketAddress address(host.address);
+    const auto error = host.error;
+
+    while (!requests.empty()) {
+        auto &request = requests.front();
+        requests.pop_front();
+        request.Deliver(address, error);
+    }
+}
+
+void
+LbResolver::Purge(std::chrono::steady_clock::time_point now) noexcept
+{
+    for (auto i = hosts.begin(); i != hosts.end();) {
+        if (i->second.IsIdle() && now >= i->second.expires)
+            i = hosts.erase(i);
+        else
+            ++i;
+    }
+}
+
+void
+LbResolver::ScheduleTimeout() noexcept
+{
+    struct timeval tv;
+    if (ares_timeout(channel, nullptr, &tv) != nullptr)
+        timeout_event.Schedule(std::chrono::seconds(tv.tv_sec) +
+                               std::chrono::microseconds(tv.tv_usec));
+    else
+        timeout_event.Cancel();
+}
+
+void
+LbResolver::OnTimeout() noexcept
+{
+    Process(ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+}
+
+void
+LbResolver::OnSocketState(int fd, bool readable, bool writable) noexcept
+{
+    if (!readable && !writable) {
+        sockets.erase(fd);
+        return;
+    }
+
+    auto i = sockets.find(fd);
+    if (i == sockets.end())
+        i = sockets.emplace(std::piecewise_construct,
+                            std::forward_as_tuple(fd),
+                            std::forward_as_tuple(*this, fd)).first;
+
+    i->second.Schedule(readable, writable);
+}
+
+void
+LbResolver::Process(int read_fd, int write_fd) noexcept
+{
+    ares_process_fd(channel, read_fd, write_fd);
+    ScheduleTimeout();
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/SocketEvent.hxx"
+#include "event/TimerEvent.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "util/Compiler.h"
+
+#include <ares.h>
+
+#include <boost/intrusive/list.hpp>
+
+#include <chrono>
+#include <exception>
+#include <map>
+#include <string>
+
+class CancellablePointer;
+
+class LbResolverHandler {
+public:
+    virtual void OnResolverSuccess(SocketAddress address) noexcept = 0;
+    virtual void OnResolverError(std::exception_ptr ep) noexcept = 0;
+};
+
+/**
+ * A non-blocking DNS resolver (based on c-ares) with a cache.  The
+ * first address of each host name is remembered until its TTL
+ * expires; "not found" errors are remembered for a fixed duration.
+ * Concurrent lookups of the same name share one query.
+ */
+class LbResolver {
+    class Request;
+    struct Host;
+    class Socket;
+
+    typedef boost::intrusive::list<Request,
+                                   boost::intrusive::constant_time_size<false>> RequestList;
+
+    /**
+     * The maximum number of cached host names; when this is
+     * exceeded, expired entries are removed.
+     */
+    static constexpr std::size_t MAX_HOSTS = 4096;
+
+    static constexpr std::chrono::seconds MIN_TTL{1};
+    static constexpr std::chrono::seconds MAX_TTL{3600};
+
+    /**
+     * How long are "not found" errors remembered?
+     */
+    static constexpr std::chrono::seconds NEGATIVE_TTL{10};
+
+    /**
+     * How long are entries from /etc/hosts remembered?
+     */
+    static constexpr std::chrono::seconds HOSTS_FILE_TTL{60};
+
+    EventLoop &event_loop;
+
+    ares_channel channel;
+
+    TimerEvent timeout_event;
+
+    /**
+     * The sockets opened by c-ares, indexed by file descriptor.
+     */
+    std::map<int, Socket> sockets;
+
+    std::map<std::string, Host> hosts;
+
+public:
+    /**
+     * Throws on error.
+     *
+     * @param servers a comma-separated list of DNS servers (with
+     * optional ports) overriding /etc/resolv.conf; may be nullptr
+     */
+    explicit LbResolver(EventLoop &_event_loop,
+                        const char *servers=nullptr);
+
+    ~LbResolver() noexcept;
+
+    LbResolver(const LbResolver &) = delete;
+    LbResolver &operator=(const LbResolver &) = delete;
+
+    /**
+     * Look up the address of a host name (or parse a numeric
+     * address).  The handler may be invoked before this method
+     * returns.
+     */
+    void Resolve(const char *name, unsigned port,
+                 LbResolverHandler &handler,
+                 CancellablePointer &cancel_ptr) noexcept;
+
+private:
+    void StartQuery(Host &host) noexcept;
+
+    void OnReply(Host &host, bool ipv6, int status,
+                 const unsigned char *abuf, int alen) noexcept;
+
+    void Complete(Host &host, SocketAddress address,
+                  std::chrono::steady_clock::duration ttl) noexcept;
+    void Fail(Host &host, int status) noexcept;
+
+    /**
+     * Invoke the handlers of all requests waiting for the given
+     * host.
+     */
+    void Deliver(Host &host) noexcept;
+
+    /**
+     * Remove expired cache entries which are not being used.
+     */
+    void Purge(std::chrono::steady_clock::time_point now) noexcept;
+
+    void ScheduleTimeout() noexcept;
+    void OnTimeout() noexcept;
+
+    void OnSocketState(int fd, bool readable, bool writable) noexcept;
+    void Process(int read_fd, int write_fd) noexcept;
+};
@@ -42,7 +42,7 @@ LbInstance::InitAllListeners()
     for (const auto &i : config.listeners) {
         listeners.emplace_front(*this, i);
         auto &listener = listeners.front();
-        listener.Setup();
+        listener.Setup(num_workers);
     }
 }
 
@@ -31,6 +31,7 @@
  */
 
 #include "Instance.hxx"
+#include "Worker.hxx"
 #include "fs/Stock.hxx"
 #include "stock/Stats.hxx"
 #include "fb_pool.hxx"
@@ -39,6 +40,34 @@
 #include "beng-proxy/Control.hxx"
 #include "util/ByteOrder.hxx"
 
+static void
+Add(uint32_t &dest, uint32_t src) noexcept
+{
+    dest = ToBE32(FromBE32(dest) + FromBE32(src));
+}
+
+static void
+Add(uint64_t &dest, uint64_t src) noexcept
+{
+    dest = ToBE64(FromBE64(dest) + FromBE64(src));
+}
+
+static void
+Add(BengProxy::ControlStats &dest,
+    const BengProxy::ControlStats &src) noexcept
+{
+    Add(dest.incoming_connections, src.incoming_connections);
+    Add(dest.outgoing_connections, src.outgoing_connections);
+    Add(dest.http_requests, src.http_requests);
+    Add(dest.http_traffic_received, src.http_traffic_received);
+    Add(dest.http_traffic_sent, src.http_traffic_sent);
+    Add(dest.translation_cache_size, src.translation_cache_size);
+    Add(dest.translation_cache_brutto_size,
+        src.translation_cache_brutto_size);
+    Add(dest.io_buffers_size, src.io_buffers_size);
+    Add(dest.io_buffers_brutto_size, src.io_buffers_brutto_size);
+}
+
 BengProxy::ControlStats
 LbInstance::GetStats() const noexcept
 {
@@ -56,7 +85,7 @@ LbInstance::GetStats() const noexcept
     stats.outgoing_connections = ToBE32(tcp_stock_stats.busy
                                         + tcp_stock_stats.idle
                                         + tcp_connections.size());
-    stats.children = 0;
+    stats.children = ToBE32(workers.size());
     stats.sessions = 0;
     stats.http_requests = ToBE64(http_request_counter);
     stats.http_traffic_received = ToBE64(http_traffic_received_counter);
@@ -68,10 +97,19 @@ LbInstance::GetStats() const noexcept
     stats.http_cache_brutto_size = 0;
     stats.filter_cache_brutto_size = 0;
     stats.nfs_cache_size = stats.nfs_cache_brutto_size = 0;
+    stats.http_cache_hits = stats.http_cache_misses =
+        stats.http_cache_evictions = 0;
+    stats.http_cache_fragmentation = stats.filter_cache_fragmentation =
+        stats.nfs_cache_fragmentation = 0;
 
     const auto io_buffers_stats = fb_pool_get().GetStats();
     stats.io_buffers_size = ToBE64(io_buffers_stats.netto_size);
     stats.io_buffers_brutto_size = ToBE64(io_buffers_stats.brutto_size);
 
+    /* in multi-worker mode, the master sums up the most recent
+       statistics reported by all workers */
+    for (const auto &worker : workers)
+        Add(stats, worker.stats);
+
     return stats;
 }
@@ -44,6 +44,7 @@
 #include "net/SocketAddress.hxx"
 #include "net/UniqueSocketDescriptor.hxx"
 #include "address_string.hxx"
+#include "direct.hxx"
 
 #include <assert.h>
 
@@ -52,6 +53,12 @@ static constexpr Event::Duration LB_TCP_CONNECT_TIMEOUT =
 
 static constexpr auto write_timeout = std::chrono::seconds(30);
 
+/**
+ * The maximum number of bytes moved into a pipe with one splice()
+ * call; the kernel limits this to the free pipe capacity anyway.
+ */
+static constexpr size_t MAX_SPLICE = 1024 * 1024;
+
 gcc_pure
 static sticky_hash_t
 lb_tcp_sticky(StickyMode sticky_mode,
@@ -77,6 +84,91 @@ lb_tcp_sticky(StickyMode sticky_mode,
     return 0;
 }
 
+/*
+ * splice() relay
+ *
+ */
+
+template<typename S>
+bool
+LbTcpConnection::FlushPipe(PipeRelay &pipe, S &dest) noexcept
+{
+    ssize_t nbytes = pipe.Flush(dest);
+    if (nbytes > 0) {
+        if (!pipe.IsEmpty())
+            dest.ScheduleWrite();
+        return true;
+    }
+
+    switch ((enum write_result)nbytes) {
+        int save_errno;
+
+    case WRITE_SOURCE_EOF:
+        /* the pipe is not empty */
+        assert(false);
+        gcc_unreachable();
+
+    case WRITE_ERRNO:
+        save_errno = errno;
+        OnTcpErrno("Send failed", save_errno);
+        return false;
+
+    case WRITE_BLOCKING:
+        dest.ScheduleWrite();
+        return true;
+
+    case WRITE_DESTROYED:
+        return false;
+
+    case WRITE_BROKEN:
+        OnTcpEnd();
+        return false;
+    }
+
+    assert(false);
+    gcc_unreachable();
+}
+
+template<typename S>
+DirectResult
+LbTcpConnection::SpliceRelay(PipeRelay &pipe,
+                             SocketDescriptor src, S &dest) noexcept
+{
+    if (!pipe.IsEmpty()) {
+        /* first flush the data left over from the last call */
+        if (!FlushPipe(pipe, dest))
+            return DirectResult::CLOSED;
+
+        if (!pipe.IsEmpty())
+            return DirectResult::BLOCKING;
+    }
+
+    ssize_t nbytes;
+    try {
+        nbytes = pipe.Splice(pool, src, MAX_SPLICE);
+    } catch (...) {
+        OnTcpError("Pipe error", std::current_exception());
+        return DirectResult::CLOSED;
+    }
+
+    if (nbytes < 0)
+        /* the pipe is empty, so EAGAIN can only mean that the
+           socket is empty */
+        return errno == EAGAIN
+            ? DirectResult::EMPTY
+            : DirectResult::ERRNO;
+
+    if (nbytes == 0)
+        return DirectResult::END;
+
+    if (!FlushPipe(pipe, dest))
+        return DirectResult::CLOSED;
+
+    return pipe.IsEmpty()
+        ? DirectResult::OK
+        : DirectResult::BLOCKING;
+}
+
 /*
  * inbound BufferedSocketHandler
  *
@@ -135,6 +227,28 @@ LbTcpConnection::Inbound::OnBufferedData()
     gcc_unreachable();
 }
 
+DirectResult
+LbTcpConnection::Inbound::OnBufferedDirect(SocketDescriptor fd, FdType)
+{
+    auto &tcp = LbTcpConnection::FromInbound(*this);
+
+    if (tcp.cancel_connect) {
+        /* outbound is not yet connected */
+        tcp.got_inbound_data = true;
+        return DirectResult::BLOCKING;
+    }
+
+    if (!tcp.outbound.socket.IsValid()) {
+        tcp.OnTcpError("Send error", "Broken socket");
+        return DirectResult::CLOSED;
+    }
+
+    const auto result = tcp.SpliceRelay(pipe, fd, tcp.outbound.socket);
+    if (result == DirectResult::OK || result == DirectResult::BLOCKING)
+        tcp.got_inbound_data = true;
+    return result;
+}
+
 bool
 LbTcpConnection::Inbound::OnBufferedClosed() noexcept
 {
@@ -149,6 +263,23 @@ LbTcpConnection::Inbound::OnBufferedWrite()
 {
     auto &tcp = LbTcpConnection::FromInbound(*this);
 
+    if (!tcp.outbound.pipe.IsEmpty()) {
+        if (!tcp.FlushPipe(tcp.outbound.pipe, socket))
+            return false;
+
+        if (!tcp.outbound.pipe.IsEmpty())
+            /* still not empty; wait for the next call */
+            return true;
+
+        if (!tcp.outbound.socket.IsValid()) {
+            /* the outbound socket has already ended (see
+               Outbound::OnBufferedEnd()), and now that the pipe is
+               empty, we're done */
+            tcp.OnTcpEnd();
+            return false;
+        }
+    }
+
     tcp.got_outbound_data = false;
 
     if (!tcp.outbound.socket.Read(false))
@@ -164,7 +295,7 @@ LbTcpConnection::Inbound::OnBufferedDrained() noexcept
 {
     auto &tcp = LbTcpConnection::FromInbound(*this);
 
-    if (!tcp.outbound.socket.IsValid()) {
+    if (!tcp.outbound.socket.IsValid() && tcp.outbound.pipe.IsEmpty()) {
         /* now that inbound's output buffers are drained, we can
            finally close the connection (postponed from
            outbound_buffered_socket_end()) */
@@ -241,6 +372,17 @@ LbTcpConnection::Outbound::OnBufferedData()
     gcc_unreachable();
 }
 
+DirectResult
+LbTcpConnection::Outbound::OnBufferedDirect(SocketDescriptor fd, FdType)
+{
+    auto &tcp = LbTcpConnection::FromOutbound(*this);
+
+    const auto result = tcp.SpliceRelay(pipe, fd, tcp.inbound.socket);
+    if (result == DirectResult::OK || result == DirectResult::BLOCKING)
+        tcp.got_outbound_data = true;
+    return result;
+}
+
 bool
 LbTcpConnection::Outbound::OnBufferedClosed() noexcept
 {
@@ -255,6 +397,10 @@ LbTcpConnection::Outbound::OnBufferedEnd() noexcept
 
     socket.Destroy();
 
+    if (!pipe.IsEmpty())
+        /* wait for Inbound::OnBufferedWrite() to flush the pipe */
+        return true;
+
     tcp.inbound.socket.UnscheduleWrite();
 
     if (tcp.inbound.socket.IsDrained()) {
@@ -275,6 +421,15 @@ LbTcpConnection::Outbound::OnBufferedWrite()
 {
     auto &tcp = LbTcpConnection::FromOutbound(*this);
 
+    if (!tcp.inbound.pipe.IsEmpty()) {
+        if (!tcp.FlushPipe(tcp.inbound.pipe, socket))
+            return false;
+
+        if (!tcp.inbound.pipe.IsEmpty())
+            /* still not empty; wait for the next call */
+            return true;
+    }
+
     tcp.got_inbound_data = false;
 
     if (!tcp.inbound.socket.Read(false))
@@ -394,11 +549,8 @@ LbTcpConnection::OnSocketConnectSuccess(UniqueSocketDescriptor &&fd) noexcept
                          Event::Duration(-1), write_timeout,
                          outbound);
 
-    /* TODO
-    outbound.direct = pipe_stock != nullptr &&
-        (ISTREAM_TO_TCP & FdType::FD_PIPE) != 0 &&
-        (istream_direct_mask_to(inbound.base.base.fd_type) & FdType::FD_PIPE) != 0;
-    */
+    if (outbound.direct)
+        outbound.socket.SetDirect(true);
 
     if (inbound.socket.Read(false))
         outbound.socket.Read(false);
@@ -467,19 +619,17 @@ LbTcpConnection::ConnectOutbound()
 inline
 LbTcpConnection::Inbound::Inbound(EventLoop &event_loop,
                                   UniqueSocketDescriptor &&fd, FdType fd_type,
-                                  SocketFilterPtr &&filter)
-    :socket(event_loop)
+                                  SocketFilterPtr &&filter,
+                                  PipeStock *pipe_stock)
+    :socket(event_loop), pipe(pipe_stock)
 {
     socket.Init(fd.Release(), fd_type,
                 Event::Duration(-1), write_timeout,
                 std::move(filter),
                 *this);
-    /* TODO
-    socket.base.direct = pipe_stock != nullptr &&
-       (ISTREAM_TO_PIPE & fd_type) != 0 &&
-       (ISTREAM_TO_TCP & FdType::FD_PIPE) != 0;
-    */
 
+    if (pipe_stock != nullptr)
+        socket.SetDirect(true);
 }
 
 inline
@@ -488,6 +638,7 @@ LbTcpConnection::LbTcpConnection(PoolPtr &&_pool, LbInstance &_instance,
                                  LbCluster &_cluster,
                                  UniqueSocketDescriptor &&fd, FdType fd_type,
                                  SocketFilterPtr &&filter,
+                                 PipeStock *pipe_stock,
                                  SocketAddress _client_address)
     :PoolHolder(std::move(_pool)),
      instance(_instance), listener(_listener), cluster(_cluster),
@@ -495,8 +646,9 @@ LbTcpConnection::LbTcpConnection(PoolPtr &&_pool, LbInstance &_instance,
      session_sticky(lb_tcp_sticky(cluster.GetConfig().sticky_mode,
                                   _client_address)),
      logger(*this),
-     inbound(instance.event_loop, std::move(fd), fd_type, std::move(filter)),
-     outbound(instance.event_loop),
+     inbound(instance.event_loop, std::move(fd), fd_type, std::move(filter),
+             pipe_stock),
+     outbound(instance.event_loop, pipe_stock),
      defer_connect(instance.event_loop, BIND_THIS_METHOD(OnDeferredHandshake))
 {
     if (client_address == nullptr)
@@ -542,6 +694,14 @@ LbTcpConnection::New(LbInstance &instance,
                                             &ssl_filter_get_handler(*ssl_filter)));
     }
 
+    /* without a filter, data can be relayed with splice(), without
+       copying it to user space */
+    PipeStock *pipe_stock = !filter &&
+        (ISTREAM_TO_PIPE & fd_type) != 0 &&
+        (ISTREAM_TO_TCP & FdType::FD_PIPE) != 0
+        ? instance.pipe_stock
+        : nullptr;
+
     auto pool = pool_new_linear(instance.root_pool, "client_connection", 2048);
     pool_set_major(pool);
 
@@ -549,6 +709,7 @@ LbTcpConnection::New(LbInstance &instance,
                                         listener, cluster,
                                         std::move(fd), fd_type,
                                         std::move(filter),
+                                        pipe_stock,
                                         address);
 }
 
@@ -35,6 +35,7 @@
 
 #include "fs/FilteredSocket.hxx"
 #include "StickyHash.hxx"
+#include "PipeRelay.hxx"
 #include "pool/Holder.hxx"
 #include "event/DeferEvent.hxx"
 #include "io/Logger.hxx"
@@ -52,6 +53,7 @@
 
 struct SslFactory;
 struct SslFilter;
+class PipeStock;
 class UniqueSocketDescriptor;
 class SocketAddress;
 struct LbListenerConfig;
@@ -82,9 +84,21 @@ public:
     struct Inbound final : BufferedSocketHandler {
         FilteredSocket socket;
 
+        /**
+         * The pipe which transfers data from this socket to
+         * #outbound with splice().  Only used if there is no
+         * #SocketFilter.
+         */
+        PipeRelay pipe;
+
+        /**
+         * @param pipe_stock if not nullptr, then splice() is used to
+         * transfer data
+         */
         Inbound(EventLoop &event_loop,
                 UniqueSocketDescriptor &&fd, FdType fd_type,
-                SocketFilterPtr &&filter);
+                SocketFilterPtr &&filter,
+                PipeStock *pipe_stock);
 
         void Destroy();
 
@@ -96,7 +110,7 @@ public:
     private:
         /* virtual methods from class BufferedSocketHandler */
         BufferedResult OnBufferedData() override;
-        // TODO: DirectResult OnBufferedDirect(SocketDescriptor fd, FdType fd_type) override;
+        DirectResult OnBufferedDirect(SocketDescriptor fd, FdType fd_type) override;
         bool OnBufferedClosed() noexcept override;
         bool OnBufferedWrite() override;
         bool OnBufferedDrained() noexcept override;
@@ -111,15 +125,27 @@ public:
     struct Outbound final : BufferedSocketHandler {
         BufferedSocket socket;
 
-        explicit Outbound(EventLoop &event_loop)
-            :socket(event_loop) {}
+        /**
+         * The pipe which transfers data from this socket to
+         * #inbound with splice().
+         */
+        PipeRelay pipe;
+
+        /**
+         * Use splice() to transfer data?
+         */
+        const bool direct;
+
+        Outbound(EventLoop &event_loop, PipeStock *pipe_stock)
+            :socket(event_loop), pipe(pipe_stock),
+             direct(pipe_stock != nullptr) {}
 
         void Destroy();
 
     private:
         /* virtual methods from class BufferedSocketHandler */
         BufferedResult OnBufferedData() override;
-        // TODO: DirectResult OnBufferedDirect(SocketDescriptor fd, FdType fd_type) override;
+        DirectResult OnBufferedDirect(SocketDescriptor fd, FdType fd_type) override;
         bool OnBufferedClosed() noexcept override;
         bool OnBufferedEnd() noexcept override;
         bool OnBufferedWrite() override;
@@ -149,6 +175,7 @@ public:
                     LbCluster &_cluster,
                     UniqueSocketDescriptor &&fd, FdType fd_type,
                     SocketFilterPtr &&filter,
+                    PipeStock *pipe_stock,
                     SocketAddress _client_address);
 
     ~LbTcpConnection();
@@ -177,6 +204,24 @@ private:
 
     void ConnectOutbound();
 
+    /**
+     * Move data from the pipe to the destination socket.  Once the
+     * pipe is empty, it is returned to the #PipeStock.
+     *
+     * @return false if the connection has been destroyed
+     */
+    template<typename S>
+    bool FlushPipe(PipeRelay &pipe, S &dest) noexcept;
+
+    /**
+     * Transfer data from the source socket through the pipe to the
+     * destination socket with splice(), bypassing the user-space
+     * buffers.
+     */
+    template<typename S>
+    DirectResult SpliceRelay(PipeRelay &pipe,
+                             SocketDescriptor src, S &dest) noexcept;
+
 public:
     void DestroyBoth();
 
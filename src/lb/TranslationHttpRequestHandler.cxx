@@ -95,12 +95,13 @@ lb_http_translate_response(TranslateResponse &response, void *ctx)
     auto &request = r.request;
 
     if (response.site != nullptr)
-        c.per_request.site_name = p_strdup(request.pool, response.site);
+        LbHttpConnection::GetPerRequest(request).site_name =
+            p_strdup(request.pool, response.site);
 
     if (response.https_only != 0 && !c.IsEncrypted()) {
         r.Destroy();
 
-        const char *host = c.per_request.host;
+        const char *host = LbHttpConnection::GetPerRequest(request).host;
         if (host == nullptr) {
             http_server_send_message(&request, HTTP_STATUS_BAD_REQUEST,
                                      "No Host header");
@@ -139,7 +140,8 @@ lb_http_translate_response(TranslateResponse &response, void *ctx)
         }
 
         if (response.canonical_host != nullptr)
-            c.per_request.canonical_host = response.canonical_host;
+            LbHttpConnection::GetPerRequest(request).canonical_host =
+                response.canonical_host;
 
         request.body = std::move(r.request_body);
 
@@ -0,0 +1,354 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Worker.hxx"
+#include "Instance.hxx"
+#include "Listener.hxx"
+#include "Control.hxx"
+#include "spawn/Registry.hxx"
+#include "net/SocketAddress.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/ByteOrder.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * How often are failure state changes and statistics exchanged
+ * between master and workers?
+ */
+static constexpr Event::Duration SYNC_INTERVAL = std::chrono::seconds(1);
+
+static void
+SendFailure(LbWorkerChannel &channel, SocketAddress address,
+            unsigned flags) noexcept
+{
+    /* the address comes first to keep it aligned in the receive
+       buffer */
+    const uint8_t flags8 = flags;
+    channel.Send(LbWorkerCommand::FAILURE,
+                 {address.GetAddress(), address.GetSize()},
+                 {&flags8, sizeof(flags8)});
+}
+
+/**
+ * Parse a #LbWorkerCommand::FAILURE payload.
+ *
+ * @return false if the payload is malformed
+ */
+static bool
+ParseFailure(ConstBuffer<void> payload,
+             SocketAddress &address_r, unsigned &flags_r) noexcept
+{
+    if (payload.size <= sizeof(sa_family_t))
+        return false;
+
+    const auto *p = (const uint8_t *)payload.data;
+    address_r = SocketAddress((const struct sockaddr *)p, payload.size - 1);
+    flags_r = p[payload.size - 1];
+    return true;
+}
+
+LbWorker::LbWorker(LbInstance &_instance, unsigned _index, pid_t _pid,
+                   UniqueSocketDescriptor &&_channel) noexcept
+    :instance(_instance), index(_index), pid(_pid),
+     channel(instance.event_loop, std::move(_channel), *this)
+{
+}
+
+void
+LbWorker::OnChildProcessExit(int status) noexcept
+{
+    if (WIFSIGNALED(status) && !instance.should_exit)
+        instance.logger(1, "worker ", (int)pid, " died from signal ",
+                        WTERMSIG(status));
+
+    /* keep the worker's counters, or else the total would go
+       backwards */
+    instance.http_request_counter += FromBE64(stats.http_requests);
+    instance.http_traffic_received_counter +=
+        FromBE64(stats.http_traffic_received);
+    instance.http_traffic_sent_counter += FromBE64(stats.http_traffic_sent);
+
+    instance.workers.erase(instance.workers.iterator_to(*this));
+    instance.ScheduleSpawnWorker();
+
+    delete this;
+}
+
+void
+LbWorker::OnWorkerPacket(LbWorkerCommand command,
+                         ConstBuffer<void> payload) noexcept
+{
+    switch (command) {
+    case LbWorkerCommand::FAILURE:
+        instance.OnWorkerFailure(*this, payload);
+        break;
+
+    case LbWorkerCommand::STATS:
+        if (payload.size == sizeof(stats))
+            memcpy(&stats, payload.data, sizeof(stats));
+        break;
+
+    case LbWorkerCommand::CONTROL:
+        /* not applicable */
+        break;
+    }
+}
+
+void
+LbWorker::OnWorkerChannelClosed() noexcept
+{
+    /* the worker is exiting; wait for OnChildProcessExit() */
+}
+
+void
+LbInstance::StartWorkers()
+{
+    assert(num_workers > 0);
+
+    child_process_registry.reset(new ChildProcessRegistry(event_loop));
+
+    /* spawn the workers really soon */
+    spawn_worker_event.Schedule(std::chrono::milliseconds(10));
+
+    sync_timer.Schedule(SYNC_INTERVAL);
+}
+
+unsigned
+LbInstance::FindFreeWorkerIndex() const noexcept
+{
+    for (unsigned i = 0;; ++i) {
+        bool found = false;
+        for (const auto &worker : workers) {
+            if (worker.index == i) {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+            return i;
+    }
+}
+
+void
+LbInstance::RespawnWorkerCallback() noexcept
+{
+    while (!should_exit && workers.size() < num_workers) {
+        const unsigned index = FindFreeWorkerIndex();
+        logger(3, "spawning worker ", index);
+
+        try {
+            if (SpawnWorker(index) == 0)
+                /* this is the new worker process */
+                return;
+        } catch (...) {
+            logger(1, std::current_exception());
+            ScheduleSpawnWorker();
+            return;
+        }
+    }
+}
+
+void
+LbInstance::ScheduleSpawnWorker() noexcept
+{
+    if (!should_exit && workers.size() < num_workers &&
+        !spawn_worker_event.IsPending())
+        spawn_worker_event.Schedule(std::chrono::seconds(1));
+}
+
+pid_t
+LbInstance::SpawnWorker(unsigned index)
+{
+    assert(index < num_workers);
+    assert(!master_channel);
+
+    UniqueSocketDescriptor master_socket, worker_socket;
+    LbWorkerChannel::CreatePair(master_socket, worker_socket);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw MakeErrno("fork() failed");
+
+    event_loop.Reinit();
+
+    if (pid == 0) {
+        master_socket.Close();
+
+        num_workers = 0;
+        spawn_worker_event.Cancel();
+
+        /* these belong to the master process */
+        workers.clear_and_dispose(DeleteDisposer());
+        child_process_registry->Clear();
+        child_process_registry.reset();
+
+        for (auto &control : controls)
+            control.Disable();
+
+        /* the master runs all monitors and sends us their state */
+        monitors.Disable();
+
+        for (auto &listener : listeners)
+            listener.SelectShard(index);
+
+        master_channel.reset(new LbWorkerChannel(event_loop,
+                                                 std::move(worker_socket),
+                                                 *this));
+        sync_timer.Schedule(SYNC_INTERVAL);
+
+        InitWorker();
+    } else {
+        worker_socket.Close();
+
+        auto *worker = new LbWorker(*this, index, pid,
+                                    std::move(master_socket));
+        workers.push_back(*worker);
+
+        child_process_registry->Add(pid, "worker", worker);
+    }
+
+    return pid;
+}
+
+void
+LbInstance::KillAllWorkers() noexcept
+{
+    for (auto &worker : workers) {
+        if (kill(worker.pid, SIGTERM) < 0)
+            logger(1, "failed to kill worker ", (int)worker.pid, ": ",
+                   strerror(errno));
+    }
+}
+
+void
+LbInstance::OnWorkerFailure(const LbWorker &sender,
+                            ConstBuffer<void> payload) noexcept
+{
+    SocketAddress address;
+    unsigned flags;
+    if (!ParseFailure(payload, address, flags))
+        return;
+
+    failure_sync.Apply(event_loop.SteadyNow(), address, flags);
+
+    for (auto &worker : workers)
+        if (&worker != &sender)
+            SendFailure(worker.channel, address, flags);
+}
+
+void
+LbInstance::ForwardControl(BengProxy::ControlCommand command,
+                           ConstBuffer<void> payload) noexcept
+{
+    const uint16_t command16 = uint16_t(command);
+
+    for (auto &worker : workers)
+        worker.channel.Send(LbWorkerCommand::CONTROL,
+                            {&command16, sizeof(command16)}, payload);
+}
+
+void
+LbInstance::OnSyncTimer() noexcept
+{
+    const auto now = event_loop.SteadyNow();
+
+    if (master_channel) {
+        /* worker: publish local failures (e.g. connect errors) and
+           statistics to the master */
+        failure_sync.Scan(now, [this](SocketAddress address, unsigned flags){
+                SendFailure(*master_channel, address, flags);
+            });
+
+        const auto stats = GetStats();
+        master_channel->Send(LbWorkerCommand::STATS, {&stats, sizeof(stats)});
+    } else {
+        /* master: publish monitor results and control commands to
+           all workers */
+        failure_sync.Scan(now, [this](SocketAddress address, unsigned flags){
+                for (auto &worker : workers)
+                    SendFailure(worker.channel, address, flags);
+            });
+    }
+
+    sync_timer.Schedule(SYNC_INTERVAL);
+}
+
+void
+LbInstance::OnWorkerPacket(LbWorkerCommand command,
+                           ConstBuffer<void> payload) noexcept
+{
+    switch (command) {
+    case LbWorkerCommand::FAILURE:
+        {
+            SocketAddress address;
+            unsigned flags;
+            if (ParseFailure(payload, address, flags))
+                failure_sync.Apply(event_loop.SteadyNow(), address, flags);
+        }
+
+        break;
+
+    case LbWorkerCommand::STATS:
+        /* not applicable */
+        break;
+
+    case LbWorkerCommand::CONTROL:
+        if (payload.size >= sizeof(uint16_t) && !controls.empty()) {
+            uint16_t command16;
+            memcpy(&command16, payload.data, sizeof(command16));
+
+            const auto *p = (const uint8_t *)payload.data;
+            controls.front().OnForwardedPacket(BengProxy::ControlCommand(command16),
+                                               {p + sizeof(command16),
+                                                payload.size - sizeof(command16)});
+        }
+
+        break;
+    }
+}
+
+void
+LbInstance::OnWorkerChannelClosed() noexcept
+{
+    logger(1, "master process has exited");
+
+    master_channel.reset();
+    ShutdownCallback();
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "WorkerChannel.hxx"
+#include "spawn/ExitListener.hxx"
+#include "beng-proxy/Control.hxx"
+
+#include <boost/intrusive/list.hpp>
+
+#include <unistd.h>
+
+struct LbInstance;
+
+/**
+ * The master's view on one beng-lb worker process.
+ */
+struct LbWorker final
+    : boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+      ExitListener, LbWorkerChannelHandler {
+
+    LbInstance &instance;
+
+    /**
+     * The index of the listener shard used by this worker.
+     */
+    const unsigned index;
+
+    const pid_t pid;
+
+    LbWorkerChannel channel;
+
+    /**
+     * The most recent statistics reported by this worker (in network
+     * byte order).
+     */
+    BengProxy::ControlStats stats{};
+
+    LbWorker(LbInstance &_instance, unsigned _index, pid_t _pid,
+             UniqueSocketDescriptor &&_channel) noexcept;
+
+    /* virtual methods from class ExitListener */
+    void OnChildProcessExit(int status) noexcept override;
+
+    /* virtual methods from class LbWorkerChannelHandler */
+    void OnWorkerPacket(LbWorkerCommand command,
+                        ConstBuffer<void> payload) noexcept override;
+    void OnWorkerChannelClosed() noexcept override;
+};
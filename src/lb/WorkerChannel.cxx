@@ -0,0 +1,116 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "WorkerChannel.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <sys/socket.h>
+#include <errno.h>
+
+/**
+ * The maximum size of a packet; control packets are UDP datagrams,
+ * so this is enough for all of them.
+ */
+static constexpr size_t MAX_PACKET_SIZE = 65536;
+
+LbWorkerChannel::LbWorkerChannel(EventLoop &event_loop,
+                                 UniqueSocketDescriptor &&_fd,
+                                 LbWorkerChannelHandler &_handler) noexcept
+    :fd(std::move(_fd)),
+     event(event_loop, BIND_THIS_METHOD(OnSocketReady), fd),
+     handler(_handler)
+{
+    event.ScheduleRead();
+}
+
+LbWorkerChannel::~LbWorkerChannel() noexcept
+{
+    event.Cancel();
+}
+
+void
+LbWorkerChannel::CreatePair(UniqueSocketDescriptor &a,
+                            UniqueSocketDescriptor &b)
+{
+    if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_SEQPACKET, 0,
+                                                  a, b))
+        throw MakeErrno("socketpair() failed");
+}
+
+bool
+LbWorkerChannel::Send(LbWorkerCommand command,
+                      ConstBuffer<void> payload1,
+                      ConstBuffer<void> payload2) noexcept
+{
+    const uint32_t header = uint32_t(command);
+
+    struct iovec iov[] = {
+        { const_cast<uint32_t *>(&header), sizeof(header) },
+        { const_cast<void *>(payload1.data), payload1.size },
+        { const_cast<void *>(payload2.data), payload2.size },
+    };
+
+    struct msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    return sendmsg(fd.Get(), &msg, MSG_DONTWAIT|MSG_NOSIGNAL) >= 0 ||
+        errno == EAGAIN;
+}
+
+bool
+LbWorkerChannel::Send(LbWorkerCommand command,
+                      ConstBuffer<void> payload) noexcept
+{
+    return Send(command, payload, nullptr);
+}
+
+void
+LbWorkerChannel::OnSocketReady(unsigned) noexcept
+{
+    uint32_t buffer[MAX_PACKET_SIZE / sizeof(uint32_t)];
+
+    ssize_t nbytes = recv(fd.Get(), buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (nbytes < 0 && errno == EAGAIN)
+        return;
+
+    if (nbytes < (ssize_t)sizeof(buffer[0])) {
+        /* error or end of file (the peer has exited) */
+        event.Cancel();
+        handler.OnWorkerChannelClosed();
+        return;
+    }
+
+    handler.OnWorkerPacket(LbWorkerCommand(buffer[0]),
+                           {buffer + 1, size_t(nbytes) - sizeof(buffer[0])});
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "net/UniqueSocketDescriptor.hxx"
+#include "event/SocketEvent.hxx"
+
+#include <stdint.h>
+
+template<typename T> struct ConstBuffer;
+
+/**
+ * Commands exchanged between the beng-lb master process and its
+ * workers.
+ */
+enum class LbWorkerCommand : uint32_t {
+    /**
+     * The failure state of a node has changed.  Payload is one byte
+     * containing #LbFailureSync flags, followed by the socket
+     * address.  Sent in both directions; the master forwards these
+     * packets to all other workers.
+     */
+    FAILURE = 1,
+
+    /**
+     * A worker reports its statistics to the master.  Payload is a
+     * #BengProxy::ControlStats.
+     */
+    STATS = 2,
+
+    /**
+     * The master forwards a control packet it has accepted.  Payload
+     * is the #BengProxy::ControlCommand (16 bit, host byte order)
+     * followed by the control payload.
+     */
+    CONTROL = 3,
+};
+
+class LbWorkerChannelHandler {
+public:
+    virtual void OnWorkerPacket(LbWorkerCommand command,
+                                ConstBuffer<void> payload) noexcept = 0;
+
+    /**
+     * The peer has closed the channel (or an error has occurred).
+     * The #LbWorkerChannel may be destructed by this method.
+     */
+    virtual void OnWorkerChannelClosed() noexcept = 0;
+};
+
+/**
+ * A SOCK_SEQPACKET connection between the beng-lb master process and
+ * one worker process.
+ */
+class LbWorkerChannel final {
+    UniqueSocketDescriptor fd;
+    SocketEvent event;
+
+    LbWorkerChannelHandler &handler;
+
+public:
+    LbWorkerChannel(EventLoop &event_loop, UniqueSocketDescriptor &&_fd,
+                    LbWorkerChannelHandler &_handler) noexcept;
+    ~LbWorkerChannel() noexcept;
+
+    LbWorkerChannel(const LbWorkerChannel &) = delete;
+    LbWorkerChannel &operator=(const LbWorkerChannel &) = delete;
+
+    /**
+     * Create a new socket pair.  Throws on error.
+     */
+    static void CreatePair(UniqueSocketDescriptor &a,
+                           UniqueSocketDescriptor &b);
+
+    /**
+     * Send a packet to the peer.  This never blocks; if the socket
+     * buffer is full, the packet is discarded.
+     *
+     * @return false on error
+     */
+    bool Send(LbWorkerCommand command,
+              ConstBuffer<void> payload1,
+              ConstBuffer<void> payload2) noexcept;
+
+    bool Send(LbWorkerCommand command, ConstBuffer<void> payload) noexcept;
+
+private:
+    void OnSocketReady(unsigned events) noexcept;
+};
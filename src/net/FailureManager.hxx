@@ -129,6 +129,16 @@ public:
     gcc_pure
     bool Check(Expiry now, SocketAddress address,
                bool allow_fade=false) const noexcept;
+
+    /**
+     * Invoke the given function for each known address.  It gets the
+     * #SocketAddress and a reference to the #FailureInfo.
+     */
+    template<typename F>
+    void ForEach(F &&f) {
+        for (auto &i : failures)
+            f(i.GetAddress(), (FailureInfo &)i);
+    }
 };
 
 #endif
@@ -39,6 +39,7 @@
 #include "pool/pool.hxx"
 #include "pool/Holder.hxx"
 #include "rubber.hxx"
+#include "RubberCompressor.hxx"
 #include "sink_rubber.hxx"
 #include "istream_unlock.hxx"
 #include "istream_rubber.hxx"
@@ -61,8 +62,6 @@
 #include <string.h>
 #include <errno.h>
 
-static constexpr Event::Duration nfs_cache_compress_interval = std::chrono::minutes(10);
-
 class NfsCache;
 struct NfsCacheItem;
 struct NfsCacheStore;
@@ -124,9 +123,9 @@ class NfsCache {
 
     Rubber rubber;
 
-    Cache cache;
+    RubberCompressor rubber_compressor;
 
-    TimerEvent compress_timer;
+    Cache cache;
 
     /**
      * A list of requests that are currently saving their contents to
@@ -164,6 +163,10 @@ public:
         return pool_children_stats(pool) + rubber.GetStats();
     }
 
+    double GetFragmentation() const noexcept {
+        return rubber.GetFragmentation();
+    }
+
     void Put(const char *key, CacheItem &item) noexcept {
         cache.Put(key, item);
     }
@@ -177,12 +180,6 @@ public:
                               const char *key,
                               NfsFileHandle &file, const struct stat &st,
                               uint64_t start, uint64_t end) noexcept;
-
-private:
-    void OnCompressTimer() noexcept {
-        rubber.Compress();
-        compress_timer.Schedule(nfs_cache_compress_interval);
-    }
 };
 
 struct NfsCacheRequest final : NfsStockGetHandler, NfsClientOpenFileHandler {
@@ -399,10 +396,8 @@ NfsCache::NfsCache(struct pool &_pool, size_t max_size,
      stock(_stock),
      event_loop(_event_loop),
      rubber(max_size),
-     cache(event_loop, 65521, max_size * 7 / 8),
-     compress_timer(event_loop, BIND_THIS_METHOD(OnCompressTimer)) {
-    compress_timer.Schedule(nfs_cache_compress_interval);
-}
+     rubber_compressor(event_loop, rubber),
+     cache(event_loop, 65521, max_size * 7 / 8) {}
 
 NfsCache *
 nfs_cache_new(struct pool &_pool, size_t max_size,
@@ -425,6 +420,12 @@ nfs_cache_get_stats(const NfsCache &cache) noexcept
     return cache.GetStats();
 }
 
+double
+nfs_cache_get_fragmentation(const NfsCache &cache) noexcept
+{
+    return cache.GetFragmentation();
+}
+
 void
 nfs_cache_fork_cow(NfsCache &cache, bool inherit) noexcept
 {
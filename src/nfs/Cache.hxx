@@ -73,6 +73,13 @@ gcc_pure
 AllocatorStats
 nfs_cache_get_stats(const NfsCache &cache) noexcept;
 
+/**
+ * @see Rubber::GetFragmentation()
+ */
+gcc_pure
+double
+nfs_cache_get_fragmentation(const NfsCache &cache) noexcept;
+
 void
 nfs_cache_fork_cow(NfsCache &cache, bool inherit) noexcept;
 
@@ -71,6 +71,27 @@ UniqueRegex::Compile(const char *pattern, bool anchored, bool capture)
         n_capture = n;
 }
 
+const char *
+RegexPointer::MatchMark(const char *s) const
+{
+    /* pass a copy of the pcre_extra with PCRE_EXTRA_MARK, because
+       "extra" is shared by all callers */
+    pcre_extra e{};
+    if (extra != nullptr)
+        e = *extra;
+
+    unsigned char *mark = nullptr;
+    e.flags |= PCRE_EXTRA_MARK;
+    e.mark = &mark;
+
+    int ovector[MatchInfo::OVECTOR_SIZE];
+    if (pcre_exec(re, &e, s, strlen(s),
+                  0, 0, ovector, MatchInfo::OVECTOR_SIZE) < 0)
+        return nullptr;
+
+    return (const char *)mark;
+}
+
 size_t
 ExpandStringLength(const char *src, const MatchInfo &match_info)
 {
@@ -102,6 +102,15 @@ public:
                          0, 0, ovector, MatchInfo::OVECTOR_SIZE) >= 0;
     }
 
+    /**
+     * Like Match(), but return the name of the last "(*MARK:NAME)"
+     * which was passed on the matching path.
+     *
+     * @return the mark name, or nullptr if there was no match (or
+     * no mark)
+     */
+    const char *MatchMark(const char *s) const;
+
     MatchInfo MatchCapture(const char *s) const {
         MatchInfo mi(s);
         mi.n = pcre_exec(re, extra, s, strlen(s),
@@ -876,6 +876,10 @@ Rubber::Remove(unsigned id) noexcept
     const unsigned previous_id = o.previous;
     const unsigned next_id = o.next;
 
+    if (id == compress_cursor)
+        /* let CompressStep() continue at the previous object */
+        compress_cursor = previous_id;
+
     size_t size = table->Remove(id);
     assert(netto_size >= size);
 
@@ -918,6 +922,24 @@ Rubber::GetStats() const noexcept
     return stats;
 }
 
+double
+Rubber::GetFragmentation() const noexcept
+{
+    const size_t brutto_size = GetBruttoSize();
+    if (brutto_size == 0)
+        return 0;
+
+    return double(brutto_size - netto_size) / double(brutto_size);
+}
+
+inline void
+Rubber::DiscardTail() noexcept
+{
+    const size_t allocated = AlignHugePageUp(table->GetTailOffset());
+    if (allocated < table.size())
+        mmap_discard_pages(WriteAt(allocated), table.size() - allocated);
+}
+
 void
 Rubber::Compress() noexcept
 {
@@ -949,9 +971,71 @@ Rubber::Compress() noexcept
     assert(offset == netto_size + table->GetSize());
     assert(netto_size == GetBruttoSize());
 
-    /* tell the kernel that we won't need the data after our last
-       allocation */
-    const size_t allocated = AlignHugePageUp(offset);
-    if (allocated < table.size())
-        mmap_discard_pages(WriteAt(allocated), table.size() - allocated);
+    compress_cursor = 0;
+
+    DiscardTail();
+}
+
+inline size_t
+Rubber::MoveDown(RubberObject &a, RubberObject &b) noexcept
+{
+    assert(a.next == table->IdOf(b));
+
+    auto *hole = FindHoleBetween(a, b);
+    assert(hole != nullptr);
+    assert(hole->next_id == a.next);
+
+    size_t hole_size = hole->size;
+    RemoveHole(*hole);
+
+    const unsigned next_id = b.next;
+    if (next_id != 0) {
+        /* the hole after "b" (if any) will be merged */
+        auto *next_hole = FindHoleBetween(b, table->entries[next_id]);
+        if (next_hole != nullptr) {
+            hole_size += next_hole->size;
+            RemoveHole(*next_hole);
+        }
+    }
+
+    MoveData(b, a.GetEndOffset());
+
+    if (next_id != 0)
+        AddHole(b.GetEndOffset(), hole_size, a.next, next_id);
+
+    return b.size;
+}
+
+bool
+Rubber::CompressStep(size_t max_bytes) noexcept
+{
+    assert(netto_size + GetTotalHoleSize() == GetBruttoSize());
+
+    /* visiting objects which don't need to be moved is cheap, but
+       not free */
+    constexpr unsigned MAX_VISITS = 4096;
+
+    size_t moved = 0;
+    for (unsigned n_visits = 0; n_visits < MAX_VISITS; ++n_visits) {
+        auto &a = table->entries[compress_cursor];
+        if (a.next == 0) {
+            /* done */
+            compress_cursor = 0;
+            DiscardTail();
+            return true;
+        }
+
+        if (moved >= max_bytes)
+            break;
+
+        auto &b = table->entries[a.next];
+        if (a.GetEndOffset() < b.offset)
+            moved += MoveDown(a, b);
+
+        compress_cursor = a.next;
+    }
+
+    assert(netto_size + GetTotalHoleSize() == GetBruttoSize());
+
+    return false;
 }
@@ -107,6 +107,12 @@ class Rubber {
      */
     std::array<HoleList, N_HOLE_THRESHOLDS> holes;
 
+    /**
+     * The object after which CompressStep() will continue; 0 means
+     * start at the beginning.
+     */
+    unsigned compress_cursor = 0;
+
 public:
     /**
      * Throws std::bad_alloc on error.
@@ -144,8 +150,27 @@ public:
     gcc_pure
     AllocatorStats GetStats() const noexcept;
 
+    /**
+     * Returns the fraction of the brutto size which is occupied by
+     * holes, i.e. 0 means no fragmentation, and values close to 1
+     * mean that most of the memory is wasted.
+     */
+    gcc_pure
+    double GetFragmentation() const noexcept;
+
     void Compress() noexcept;
 
+    /**
+     * Perform one step of an incremental Compress(): move objects to
+     * lower offsets to eliminate holes, but stop after moving
+     * approximately the specified number of bytes.  The next call
+     * continues where this one stopped.
+     *
+     * @return true if compression is complete (then the next call
+     * starts over)
+     */
+    bool CompressStep(size_t max_bytes) noexcept;
+
     /**
      * Add a new object with the specified size.  Use Write() to
      * actually copy data to the object.
@@ -281,6 +306,20 @@ private:
 
     void MoveData(RubberObject &o, size_t new_offset) noexcept;
 
+    /**
+     * Move object "b" down into the hole between "a" and "b",
+     * merging the hole with the one after "b" (if any).
+     *
+     * @return the number of bytes which were moved
+     */
+    size_t MoveDown(RubberObject &a, RubberObject &b) noexcept;
+
+    /**
+     * Tell the kernel that we won't need the data after the last
+     * allocation.
+     */
+    void DiscardTail() noexcept;
+
     HoleList &GetHoleList(size_t size) noexcept {
         return holes[LookupHoleThreshold(size)];
     }
@@ -105,6 +105,31 @@ verify_callback(int ok, gcc_unused X509_STORE_CTX *ctx)
     return ok;
 }
 
+/**
+ * Select "h2" if the client supports it, and fall back to
+ * "http/1.1".
+ */
+static int
+alpn_select_http2_callback(gcc_unused SSL *ssl,
+                           const unsigned char **out, unsigned char *outlen,
+                           const unsigned char *in, unsigned int inlen,
+                           gcc_unused void *arg)
+{
+    static constexpr unsigned char protos[] = {
+        2, 'h', '2',
+        8, 'h', 't', 't', 'p', '/', '1', '.', '1',
+    };
+
+    unsigned char *selected;
+    if (SSL_select_next_proto(&selected, outlen,
+                              protos, sizeof(protos),
+                              in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
 void
 ApplyServerConfig(SSL_CTX &ssl_ctx, const SslConfig &config)
 {
@@ -138,4 +163,8 @@ ApplyServerConfig(SSL_CTX &ssl_ctx, const SslConfig &config)
 
         SSL_CTX_set_verify(&ssl_ctx, mode, verify_callback);
     }
+
+    if (config.http2)
+        SSL_CTX_set_alpn_select_cb(&ssl_ctx, alpn_select_http2_callback,
+                                   nullptr);
 }
@@ -42,13 +42,38 @@
 
 #include <openssl/err.h>
 
+thread_local std::unordered_map<unsigned, CertCache::ThreadCache> CertCache::thread_caches;
+
+unsigned
+CertCache::MakeId() noexcept
+{
+    static std::atomic_uint next_id{0};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+CertCache::ThreadCache &
+CertCache::GetThreadCache() noexcept
+{
+    auto &tc = thread_caches[id];
+
+    const unsigned g = generation.load(std::memory_order_acquire);
+    if (tc.generation != g) {
+        tc.map.clear();
+        tc.generation = g;
+    }
+
+    return tc;
+}
+
 unsigned
 CertCache::FlushSessionCache(long tm) noexcept
 {
+    const std::unique_lock<std::mutex> lock(mutex);
+
     unsigned n = 0;
 
     for (auto &i : map)
-        n += ::FlushSessionCache(*i.second.ssl_ctx, tm);
+        n += ::FlushSessionCache(*i.second->ssl_ctx, tm);
 
     return n;
 }
@@ -58,13 +83,21 @@ CertCache::Expire() noexcept
 {
     const auto now = GetEventLoop().SteadyNow();
 
+    const std::unique_lock<std::mutex> lock(mutex);
+
+    bool modified = false;
+
     for (auto i = map.begin(), end = map.end(); i != end;) {
-        if (now >= i->second.expires) {
+        if (now >= i->second->expires.load(std::memory_order_relaxed)) {
             logger(5, "flushed certificate '", i->first, "'");
             i = map.erase(i);
+            modified = true;
         } else
             ++i;
     }
+
+    if (modified)
+        Invalidate();
 }
 
 void
@@ -114,10 +147,9 @@ CertCache::Add(UniqueX509 &&cert, UniqueEVP_PKEY &&key)
 
     if (name != nullptr) {
         const std::unique_lock<std::mutex> lock(mutex);
-        map.emplace(std::piecewise_construct,
-                    std::forward_as_tuple(name.c_str()),
-                    std::forward_as_tuple(ssl_ctx,
-                                          GetEventLoop().SteadyNow()));
+        map.emplace(name.c_str(),
+                    std::make_shared<Item>(ssl_ctx,
+                                           GetEventLoop().SteadyNow()));
     }
 
     return ssl_ctx;
@@ -139,12 +171,23 @@ CertCache::Query(const char *host)
 SslCtx
 CertCache::GetNoWildCard(const char *host)
 {
+    const auto now = GetEventLoop().SteadyNow();
+
+    auto &tc = GetThreadCache();
+    auto i = tc.map.find(host);
+    if (i != tc.map.end()) {
+        /* fast path: this thread has used the certificate before */
+        i->second->Refresh(now);
+        return i->second->ssl_ctx;
+    }
+
     {
         const std::unique_lock<std::mutex> lock(mutex);
-        auto i = map.find(host);
-        if (i != map.end()) {
-            i->second.expires = GetEventLoop().SteadyNow() + std::chrono::hours(24);
-            return i->second.ssl_ctx;
+        auto j = map.find(host);
+        if (j != map.end()) {
+            j->second->Refresh(now);
+            tc.map.emplace(j->first, j->second);
+            return j->second->ssl_ctx;
         }
     }
 
@@ -178,6 +221,7 @@ CertCache::OnCertModified(const std::string &name, bool deleted) noexcept
     auto i = map.find(name);
     if (i != map.end()) {
         map.erase(i);
+        Invalidate();
 
         logger.Format(5, "flushed %s certificate '%s'",
                       deleted ? "deleted" : "modified",
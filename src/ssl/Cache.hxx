@@ -46,8 +46,10 @@
 #include <unordered_map>
 #include <map>
 #include <forward_list>
+#include <memory>
 #include <string>
 #include <mutex>
+#include <atomic>
 #include <chrono>
 
 #include <string.h>
@@ -58,6 +60,11 @@ class CertDatabase;
  * A frontend for #CertDatabase which caches results as SSL_CTX
  * instance.  It is thread-safe, designed to be called synchronously
  * by worker threads (via #SslFilter).
+ *
+ * Each worker thread has its own copy of the map, which it can query
+ * without taking a lock; the shared map (and its mutex) is only
+ * needed for cache misses.  Removing an item invalidates all
+ * per-thread copies.
  */
 class CertCache final : CertNameCacheHandler {
     const LLogger logger;
@@ -84,9 +91,13 @@ class CertCache final : CertNameCacheHandler {
     std::mutex mutex;
 
     struct Item {
-        SslCtx ssl_ctx;
+        const SslCtx ssl_ctx;
 
-        std::chrono::steady_clock::time_point expires;
+        /**
+         * This is updated by worker threads without holding the
+         * mutex.
+         */
+        std::atomic<std::chrono::steady_clock::time_point> expires;
 
         template<typename T>
         Item(T &&_ssl_ctx, std::chrono::steady_clock::time_point now) noexcept
@@ -94,19 +105,51 @@ class CertCache final : CertNameCacheHandler {
              /* the initial expiration is 6 hours; it will be raised
                 to 24 hours if the certificate is used again */
              expires(now + std::chrono::hours(6)) {}
+
+        void Refresh(std::chrono::steady_clock::time_point now) noexcept {
+            expires.store(now + std::chrono::hours(24),
+                          std::memory_order_relaxed);
+        }
     };
 
+    typedef std::unordered_map<std::string, std::shared_ptr<Item>> Map;
+
     /**
      * Map host names to SSL_CTX instances.  The key may be a
-     * wildcard.
+     * wildcard.  Protected by #mutex.
+     */
+    Map map;
+
+    /**
+     * Incremented each time items are removed from #map.  A
+     * #ThreadCache which was filled with an older generation is
+     * discarded.
+     */
+    std::atomic_uint generation{0};
+
+    /**
+     * A unique identifier of this instance which addresses its
+     * #ThreadCache.  Unlike the address, it is never reused.
+     */
+    const unsigned id;
+
+    /**
+     * The portion of #map which has been used by one worker thread.
      */
-    std::unordered_map<std::string, Item> map;
+    struct ThreadCache {
+        unsigned generation = 0;
+
+        Map map;
+    };
+
+    static thread_local std::unordered_map<unsigned, ThreadCache> thread_caches;
 
 public:
     explicit CertCache(EventLoop &event_loop,
                        const CertDatabaseConfig &_config) noexcept
         :logger("CertCache"), config(_config),
-         name_cache(event_loop, _config, *this) {}
+         name_cache(event_loop, _config, *this),
+         id(MakeId()) {}
 
     auto &GetEventLoop() const noexcept {
         return name_cache.GetEventLoop();
@@ -139,6 +182,22 @@ public:
     SslCtx Get(const char *host);
 
 private:
+    static unsigned MakeId() noexcept;
+
+    /**
+     * Obtain the #ThreadCache of the current thread, and clear it if
+     * it is outdated.
+     */
+    ThreadCache &GetThreadCache() noexcept;
+
+    /**
+     * Remove all items from the per-thread caches.  Caller must hold
+     * the mutex.
+     */
+    void Invalidate() noexcept {
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
     SslCtx Add(UniqueX509 &&cert, UniqueEVP_PKEY &&key);
     SslCtx Query(const char *host);
     SslCtx GetNoWildCard(const char *host);
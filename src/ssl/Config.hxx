@@ -61,7 +61,24 @@ struct SslConfig {
 
     std::string ca_cert_file;
 
+    /**
+     * A file containing a secret shared by all cluster nodes, from
+     * which session ticket keys are derived.  If empty, each process
+     * uses its own random ticket keys.
+     */
+    std::string ticket_key_file;
+
     SslVerify verify = SslVerify::NO;
+
+    /**
+     * Offer HTTP/2 ("h2") via ALPN?
+     */
+    bool http2 = false;
+
+    /**
+     * Offload encryption to the kernel (kTLS) after the handshake?
+     */
+    bool ktls = false;
 };
 
 struct NamedSslCertKeyConfig : SslCertKeyConfig {
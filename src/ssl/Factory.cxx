@@ -34,6 +34,7 @@
 #include "Config.hxx"
 #include "SessionCache.hxx"
 #include "SniCallback.hxx"
+#include "TicketKeys.hxx"
 #include "ssl/Error.hxx"
 #include "ssl/Basic.hxx"
 #include "ssl/Ctx.hxx"
@@ -123,8 +124,19 @@ struct SslFactory {
 
     const std::unique_ptr<SslSniCallback> sni;
 
-    SslFactory(std::unique_ptr<SslSniCallback> &&_sni)
-        :sni(std::move(_sni)) {}
+    /**
+     * Session ticket keys shared with other cluster nodes; nullptr
+     * if not configured.
+     */
+    std::unique_ptr<SslTicketKeys> ticket_keys;
+
+    /**
+     * @see SslConfig::ktls
+     */
+    const bool ktls;
+
+    SslFactory(std::unique_ptr<SslSniCallback> &&_sni, bool _ktls)
+        :sni(std::move(_sni)), ktls(_ktls) {}
 
     gcc_pure
     const SslFactoryCertKey *FindCommonName(StringView host_name) const;
@@ -252,6 +264,9 @@ SslFactory::Make()
 {
     auto ssl = cert_key.front().Make();
 
+    if (ticket_keys)
+        ticket_keys->Apply(*ssl);
+
     SSL_set_accept_state(ssl.get());
 
     return ssl;
@@ -303,10 +318,18 @@ ssl_factory_new_server(const SslConfig &config,
 {
     assert(!config.cert_key.empty());
 
-    std::unique_ptr<SslFactory> factory(new SslFactory(std::move(sni)));
+    std::unique_ptr<SslFactory> factory(new SslFactory(std::move(sni),
+                                                       config.ktls));
 
     load_certs_keys(*factory, config);
 
+    if (!config.ticket_key_file.empty()) {
+        factory->ticket_keys.reset(new SslTicketKeys(config.ticket_key_file.c_str()));
+
+        for (auto &ck : factory->cert_key)
+            SslTicketKeys::Install(*ck.ssl_ctx);
+    }
+
     if (factory->cert_key.size() > 1 || factory->sni)
         factory->EnableSNI();
 
@@ -325,6 +348,12 @@ ssl_factory_make(SslFactory &factory)
     return factory.Make();
 }
 
+bool
+ssl_factory_get_ktls(const SslFactory &factory) noexcept
+{
+    return factory.ktls;
+}
+
 unsigned
 ssl_factory_flush(SslFactory &factory, long tm)
 {
@@ -33,6 +33,7 @@
 #pragma once
 
 #include "ssl/Unique.hxx"
+#include "util/Compiler.h"
 
 struct pool;
 struct SslConfig;
@@ -49,6 +50,14 @@ ssl_factory_free(SslFactory *factory);
 UniqueSSL
 ssl_factory_make(SslFactory &factory);
 
+/**
+ * Shall connections created by this factory offload encryption to
+ * the kernel (kTLS) after the handshake?
+ */
+gcc_pure
+bool
+ssl_factory_get_ktls(const SslFactory &factory) noexcept;
+
 /**
  * Flush expired sessions from the session cache.
  *
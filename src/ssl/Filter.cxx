@@ -42,6 +42,11 @@
 #include "SliceFifoBuffer.hxx"
 #include "util/AllocatedString.hxx"
 
+#ifdef HAVE_LINUX_TLS_H
+#include "Ktls.hxx"
+#include "net/SocketDescriptor.hxx"
+#endif
+
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
@@ -61,10 +66,29 @@ struct SslFilter final : ThreadSocketFilterHandler {
 
     bool handshaking = true;
 
+#ifdef HAVE_LINUX_TLS_H
+    /**
+     * Shall encryption be offloaded to the kernel after the
+     * handshake?
+     */
+    const bool ktls;
+
+    /**
+     * Filled by Run() after the handshake; from then on, OpenSSL
+     * must not encrypt anything.  Applied to the socket by
+     * OffloadOutput().
+     */
+    KtlsTxParams ktls_tx;
+#endif
+
     AllocatedString<> peer_subject = nullptr, peer_issuer_subject = nullptr;
 
-    SslFilter(UniqueSSL &&_ssl)
-        :ssl(std::move(_ssl)) {
+    SslFilter(UniqueSSL &&_ssl, gcc_unused bool _ktls)
+        :ssl(std::move(_ssl))
+#ifdef HAVE_LINUX_TLS_H
+        , ktls(_ktls)
+#endif
+    {
         SSL_set_bio(ssl.get(),
                     NewFifoBufferBio(encrypted_input),
                     NewFifoBufferBio(encrypted_output));
@@ -72,10 +96,22 @@ struct SslFilter final : ThreadSocketFilterHandler {
 
     void Encrypt();
 
+    /**
+     * Called after the handshake has completed: prepare offloading
+     * encryption to the kernel.
+     *
+     * @return true if ThreadSocketFilterHandler::OffloadOutput()
+     * shall be called
+     */
+    bool PrepareKtls() noexcept;
+
     /* virtual methods from class ThreadSocketFilterHandler */
     void PreRun(ThreadSocketFilterInternal &f) noexcept override;
     void Run(ThreadSocketFilterInternal &f) override;
     void PostRun(ThreadSocketFilterInternal &f) noexcept override;
+#ifdef HAVE_LINUX_TLS_H
+    bool OffloadOutput(SocketDescriptor s) noexcept override;
+#endif
 };
 
 static std::runtime_error
@@ -196,6 +232,22 @@ SslFilter::Encrypt()
     ssl_encrypt(ssl.get(), plain_output);
 }
 
+inline bool
+SslFilter::PrepareKtls() noexcept
+{
+#ifdef HAVE_LINUX_TLS_H
+    if (!ktls || !plain_output.empty() || !ktls_tx.Extract(*ssl))
+        return false;
+
+    /* OpenSSL would reply to a renegotiation attempt with records
+       the kernel doesn't know about */
+    SSL_set_options(ssl.get(), SSL_OP_NO_RENEGOTIATION);
+    return true;
+#else
+    return false;
+#endif
+}
+
 /*
  * thread_socket_filter_handler
  *
@@ -213,11 +265,17 @@ SslFilter::PreRun(ThreadSocketFilterInternal &f) noexcept
 void
 SslFilter::Run(ThreadSocketFilterInternal &f)
 {
+    /* once output has been offloaded to the kernel (or is about to
+       be), OpenSSL does not encrypt anymore */
+    bool kernel_output;
+
     /* copy input (and output to make room for more output) */
 
     {
         std::unique_lock<std::mutex> lock(f.mutex);
 
+        kernel_output = f.offload_output_pending || f.output_offloaded;
+
         if (f.decrypted_input.IsNull() || f.encrypted_output.IsNull()) {
             /* retry, let PreRun() allocate the missing buffer */
             f.again = true;
@@ -226,7 +284,8 @@ SslFilter::Run(ThreadSocketFilterInternal &f)
 
         f.decrypted_input.MoveFromAllowNull(decrypted_input);
 
-        plain_output.MoveFromAllowNull(f.plain_output);
+        if (!kernel_output)
+            plain_output.MoveFromAllowNull(f.plain_output);
         encrypted_input.MoveFromAllowSrcNull(f.encrypted_input);
         if (!f.encrypted_input.empty())
             /* the destination buffer is full, and data still remains
@@ -248,10 +307,18 @@ SslFilter::Run(ThreadSocketFilterInternal &f)
 
     ERR_clear_error();
 
+    /* offload output to the kernel after this iteration? */
+    bool offload_output = false;
+
+    /* has OpenSSL produced a record (e.g. an alert) although the
+       kernel has taken over (or is about to take over) encryption? */
+    bool unexpected_output = false;
+
     if (gcc_unlikely(handshaking)) {
         int result = SSL_do_handshake(ssl.get());
         if (result == 1) {
             handshaking = false;
+            offload_output = kernel_output = PrepareKtls();
 
             UniqueX509 cert(SSL_get_peer_certificate(ssl.get()));
             if (cert != nullptr) {
@@ -271,7 +338,10 @@ SslFilter::Run(ThreadSocketFilterInternal &f)
     }
 
     if (gcc_likely(!handshaking)) {
-        Encrypt();
+        if (!kernel_output)
+            Encrypt();
+
+        const size_t output_before = encrypted_output.GetAvailable();
 
         switch (ssl_decrypt(ssl.get(), decrypted_input)) {
         case SslDecryptResult::SUCCESS:
@@ -290,6 +360,9 @@ SslFilter::Run(ThreadSocketFilterInternal &f)
             }
             break;
         }
+
+        unexpected_output = kernel_output &&
+            encrypted_output.GetAvailable() > output_before;
     }
 
     /* copy output */
@@ -297,11 +370,33 @@ SslFilter::Run(ThreadSocketFilterInternal &f)
     {
         std::unique_lock<std::mutex> lock(f.mutex);
 
+        if (unexpected_output) {
+            if (f.output_offloaded)
+                /* the kernel has already continued the record
+                   sequence; this record cannot be sent anymore */
+                throw std::runtime_error("TLS record after kTLS offload");
+
+            /* the record has already been encrypted by OpenSSL and
+               must be sent, but the kernel would then continue
+               with the wrong sequence number: cancel the offload,
+               and keep encrypting in user space */
+            f.offload_output_pending = false;
+            offload_output = kernel_output = false;
+
+            /* encrypt the plain output which was left in
+               ThreadSocketFilterInternal::plain_output */
+            f.again = true;
+        }
+
         f.decrypted_input.MoveFromAllowNull(decrypted_input);
         f.encrypted_output.MoveFromAllowNull(encrypted_output);
         f.drained = plain_output.empty() && encrypted_output.empty();
 
-        if (!f.plain_output.empty() && !plain_output.IsDefinedAndFull() &&
+        if (offload_output)
+            f.offload_output_pending = true;
+
+        if (!kernel_output &&
+            !f.plain_output.empty() && !plain_output.IsDefinedAndFull() &&
             !encrypted_output.IsDefinedAndFull())
             /* there's more data, and we're ready to handle it: try
                again */
@@ -322,21 +417,36 @@ SslFilter::PostRun(ThreadSocketFilterInternal &f) noexcept
     }
 }
 
+#ifdef HAVE_LINUX_TLS_H
+
+bool
+SslFilter::OffloadOutput(SocketDescriptor s) noexcept
+{
+    /* no locking needed: Run() has finished writing #ktls_tx before
+       it set ThreadSocketFilterInternal::offload_output_pending; if
+       this fails (e.g. because the "tls" kernel module is not
+       available), OpenSSL continues to encrypt */
+    return ktls_tx.Apply(s);
+}
+
+#endif
+
 /*
  * constructor
  *
  */
 
 SslFilter *
-ssl_filter_new(UniqueSSL &&ssl)
+ssl_filter_new(UniqueSSL &&ssl, bool ktls)
 {
-    return new SslFilter(std::move(ssl));
+    return new SslFilter(std::move(ssl), ktls);
 }
 
 SslFilter *
 ssl_filter_new(SslFactory &factory)
 {
-    return new SslFilter(ssl_factory_make(factory));
+    return new SslFilter(ssl_factory_make(factory),
+                         ssl_factory_get_ktls(factory));
 }
 
 ThreadSocketFilterHandler &
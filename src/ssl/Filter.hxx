@@ -42,9 +42,12 @@ class ThreadSocketFilterHandler;
 
 /**
  * Create a new SSL filter.
+ *
+ * @param ktls offload encryption to the kernel after the handshake
+ * (see SslConfig::ktls)
  */
 SslFilter *
-ssl_filter_new(UniqueSSL &&ssl);
+ssl_filter_new(UniqueSSL &&ssl, bool ktls=false);
 
 /**
  * Create a new SSL filter.
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Ktls.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/crypto.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/**
+ * Calculate the TLS 1.2 "key_block" (RFC 5246 6.3) with the PRF of
+ * the given cipher suite.
+ */
+static bool
+DeriveKeyBlock(const EVP_MD *md,
+               const uint8_t *master_key, size_t master_key_length,
+               const uint8_t *server_random, const uint8_t *client_random,
+               uint8_t *key_block, size_t key_block_length) noexcept
+{
+    static constexpr char label[] = "key expansion";
+
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, nullptr);
+    if (ctx == nullptr)
+        return false;
+
+    bool success = EVP_PKEY_derive_init(ctx) > 0 &&
+        EVP_PKEY_CTX_set_tls1_prf_md(ctx, md) > 0 &&
+        EVP_PKEY_CTX_set1_tls1_prf_secret(ctx, master_key,
+                                          master_key_length) > 0 &&
+        EVP_PKEY_CTX_add1_tls1_prf_seed(ctx,
+                                        (const unsigned char *)label,
+                                        sizeof(label) - 1) > 0 &&
+        EVP_PKEY_CTX_add1_tls1_prf_seed(ctx, server_random,
+                                        SSL3_RANDOM_SIZE) > 0 &&
+        EVP_PKEY_CTX_add1_tls1_prf_seed(ctx, client_random,
+                                        SSL3_RANDOM_SIZE) > 0 &&
+        EVP_PKEY_derive(ctx, key_block, &key_block_length) > 0;
+
+    EVP_PKEY_CTX_free(ctx);
+    return success;
+}
+
+/**
+ * Store a record sequence number in network byte order.
+ */
+static void
+StoreSequence(unsigned char *dest, uint64_t value) noexcept
+{
+    for (unsigned i = 8; i-- > 0;) {
+        dest[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+template<typename T>
+static void
+FillAesGcm(T &dest, unsigned cipher_type,
+           const uint8_t *key, const uint8_t *salt,
+           uint64_t sequence) noexcept
+{
+    dest.info.version = TLS_1_2_VERSION;
+    dest.info.cipher_type = cipher_type;
+    memcpy(dest.key, key, sizeof(dest.key));
+    memcpy(dest.salt, salt, sizeof(dest.salt));
+
+    /* the explicit nonce only needs to be unique; use the sequence
+       number, just like OpenSSL does */
+    StoreSequence(dest.iv, sequence);
+    StoreSequence(dest.rec_seq, sequence);
+}
+
+KtlsTxParams::~KtlsTxParams() noexcept
+{
+    OPENSSL_cleanse(&crypto, sizeof(crypto));
+}
+
+bool
+KtlsTxParams::Extract(SSL &ssl) noexcept
+{
+    if (SSL_version(&ssl) != TLS1_2_VERSION)
+        /* TLS 1.3 would require tracking the traffic secrets and
+           key updates */
+        return false;
+
+    const SSL_CIPHER *cipher = SSL_get_current_cipher(&ssl);
+    if (cipher == nullptr)
+        return false;
+
+    size_t key_length;
+    switch (SSL_CIPHER_get_cipher_nid(cipher)) {
+    case NID_aes_128_gcm:
+        key_length = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+        break;
+
+#ifdef TLS_CIPHER_AES_GCM_256
+    case NID_aes_256_gcm:
+        key_length = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+        break;
+#endif
+
+    default:
+        return false;
+    }
+
+    static constexpr size_t salt_length = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+
+    const EVP_MD *md = SSL_CIPHER_get_handshake_digest(cipher);
+    const SSL_SESSION *session = SSL_get_session(&ssl);
+    if (md == nullptr || session == nullptr)
+        return false;
+
+    uint8_t master_key[SSL_MAX_MASTER_KEY_LENGTH];
+    const size_t master_key_length =
+        SSL_SESSION_get_master_key(session, master_key, sizeof(master_key));
+
+    uint8_t client_random[SSL3_RANDOM_SIZE], server_random[SSL3_RANDOM_SIZE];
+    SSL_get_client_random(&ssl, client_random, sizeof(client_random));
+    SSL_get_server_random(&ssl, server_random, sizeof(server_random));
+
+    /* AEAD ciphers have no MAC keys: client_write_key,
+       server_write_key, client_write_IV, server_write_IV */
+    uint8_t key_block[2 * 32 + 2 * salt_length];
+    const size_t key_block_length = 2 * (key_length + salt_length);
+
+    bool success = DeriveKeyBlock(md, master_key, master_key_length,
+                                  server_random, client_random,
+                                  key_block, key_block_length);
+    OPENSSL_cleanse(master_key, sizeof(master_key));
+
+    if (success) {
+        const bool server = SSL_is_server(&ssl);
+        const uint8_t *key = key_block + (server ? key_length : 0);
+        const uint8_t *salt = key_block + 2 * key_length +
+            (server ? salt_length : 0);
+
+        /* the "Finished" message was the first record encrypted with
+           these keys; the kernel continues with the next one */
+        static constexpr uint64_t sequence = 1;
+
+        if (key_length == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+            FillAesGcm(crypto.aes_gcm_128, TLS_CIPHER_AES_GCM_128,
+                       key, salt, sequence);
+            size = sizeof(crypto.aes_gcm_128);
+        } else {
+#ifdef TLS_CIPHER_AES_GCM_256
+            FillAesGcm(crypto.aes_gcm_256, TLS_CIPHER_AES_GCM_256,
+                       key, salt, sequence);
+            size = sizeof(crypto.aes_gcm_256);
+#endif
+        }
+    }
+
+    OPENSSL_cleanse(key_block, sizeof(key_block));
+    return success;
+}
+
+bool
+KtlsTxParams::Apply(SocketDescriptor s) const noexcept
+{
+    static constexpr char ulp[] = "tls";
+
+    return IsDefined() &&
+        s.SetOption(SOL_TCP, TCP_ULP, ulp, sizeof(ulp)) &&
+        s.SetOption(SOL_TLS, TLS_TX, &crypto, size);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <linux/tls.h>
+
+#include <stddef.h>
+
+typedef struct ssl_st SSL;
+class SocketDescriptor;
+
+/**
+ * Kernel TLS (kTLS) parameters for the transmit direction of a TLS
+ * connection, extracted from an OpenSSL session after the handshake.
+ * Once they are applied to the socket, the kernel encrypts all data
+ * written to it, including splice() and sendfile().
+ *
+ * Only TLS 1.2 with AES-GCM is supported.  The OpenSSL object must
+ * not write any more records after Extract() has succeeded, because
+ * the kernel continues the record sequence.
+ */
+class KtlsTxParams {
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+#ifdef TLS_CIPHER_AES_GCM_256
+        struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#endif
+    } crypto;
+
+    size_t size = 0;
+
+public:
+    ~KtlsTxParams() noexcept;
+
+    bool IsDefined() const noexcept {
+        return size > 0;
+    }
+
+    /**
+     * Derive the transmit key from the master secret of the given
+     * connection, whose handshake must be complete.
+     *
+     * @return false if the protocol version or the cipher is not
+     * supported
+     */
+    bool Extract(SSL &ssl) noexcept;
+
+    /**
+     * Enable kTLS on the given socket.  All data which has been
+     * encrypted by OpenSSL must have been written to the socket
+     * already.
+     *
+     * @return false on error (e.g. the "tls" kernel module is not
+     * available), with errno set
+     */
+    bool Apply(SocketDescriptor s) const noexcept;
+};
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TicketKeys.hxx"
+#include "ssl/Error.hxx"
+#include "io/Open.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/ByteOrder.hxx"
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#include <stdexcept>
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+static_assert(sizeof(SslTicketKeys::Key) == 64,
+              "Key must be filled by one SHA512 HMAC");
+
+SslTicketKeys::SslTicketKeys(const char *path)
+{
+    auto fd = OpenReadOnly(path);
+
+    char buffer[4096];
+    ssize_t nbytes = fd.Read(buffer, sizeof(buffer));
+    if (nbytes < 0)
+        throw FormatErrno("Failed to read %s", path);
+
+    if (nbytes < 32)
+        throw std::runtime_error(std::string("Ticket key file is too small: ") +
+                                 path);
+
+    secret.assign(buffer, nbytes);
+    OPENSSL_cleanse(buffer, sizeof(buffer));
+}
+
+SslTicketKeys::Key
+SslTicketKeys::Derive(uint64_t period) const noexcept
+{
+    static constexpr char label[] = "beng-proxy session ticket key";
+
+    uint8_t input[sizeof(label) + sizeof(uint64_t)];
+    memcpy(input, label, sizeof(label));
+    const uint64_t be_period = ToBE64(period);
+    memcpy(input + sizeof(label), &be_period, sizeof(be_period));
+
+    Key key;
+    unsigned length = sizeof(key);
+    HMAC(EVP_sha512(), secret.data(), secret.size(),
+         input, sizeof(input),
+         (unsigned char *)&key, &length);
+    assert(length == sizeof(key));
+
+    return key;
+}
+
+bool
+SslTicketKeys::Find(const uint8_t *name, uint64_t now_period,
+                    Key &key_r, bool &current_r) const noexcept
+{
+    /* the current key first, because it is the most likely one */
+    static constexpr int offsets[] = { 0, -1, 1 };
+
+    for (int offset : offsets) {
+        if (offset < 0 && now_period < uint64_t(-offset))
+            continue;
+
+        key_r = Derive(now_period + offset);
+        if (CRYPTO_memcmp(key_r.name, name, sizeof(key_r.name)) == 0) {
+            current_r = offset == 0;
+            return true;
+        }
+    }
+
+    OPENSSL_cleanse(&key_r, sizeof(key_r));
+    return false;
+}
+
+static int
+GetExDataIndex() noexcept
+{
+    static const int index =
+        SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+static uint64_t
+GetCurrentPeriod() noexcept
+{
+    return uint64_t(time(nullptr)) / SslTicketKeys::PERIOD;
+}
+
+static int
+TicketKeyCallback(SSL *ssl, unsigned char *name, unsigned char *iv,
+                  EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx, int enc)
+{
+    const auto *keys = (const SslTicketKeys *)
+        SSL_get_ex_data(ssl, GetExDataIndex());
+    if (keys == nullptr)
+        /* not created by SslFactory; fall back to a full
+           handshake */
+        return enc ? -1 : 0;
+
+    const uint64_t now_period = GetCurrentPeriod();
+
+    SslTicketKeys::Key key;
+    int result;
+
+    if (enc) {
+        key = keys->Derive(now_period);
+        memcpy(name, key.name, sizeof(key.name));
+
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1 ||
+            EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr,
+                               key.aes_key, iv) != 1)
+            result = -1;
+        else
+            result = 1;
+    } else {
+        bool current;
+        if (!keys->Find(name, now_period, key, current))
+            /* unknown key: full handshake */
+            return 0;
+
+        /* ask OpenSSL to issue a new ticket if this one was
+           encrypted with an older key */
+        result = EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr,
+                                    key.aes_key, iv) == 1
+            ? (current ? 1 : 2)
+            : -1;
+    }
+
+    if (result > 0 &&
+        HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof(key.hmac_key),
+                     EVP_sha256(), nullptr) != 1)
+        result = -1;
+
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
+
+void
+SslTicketKeys::Install(SSL_CTX &ssl_ctx)
+{
+    /* make sure the index is allocated before the first handshake */
+    if (GetExDataIndex() < 0)
+        throw SslError("SSL_get_ex_new_index() failed");
+
+    SSL_CTX_clear_options(&ssl_ctx, SSL_OP_NO_TICKET);
+
+    if (SSL_CTX_set_tlsext_ticket_key_cb(&ssl_ctx, TicketKeyCallback) != 1)
+        throw SslError("SSL_CTX_set_tlsext_ticket_key_cb() failed");
+}
+
+void
+SslTicketKeys::Apply(SSL &ssl) const noexcept
+{
+    SSL_set_ex_data(&ssl, GetExDataIndex(), const_cast<SslTicketKeys *>(this));
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <string>
+
+#include <stdint.h>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+/**
+ * TLS session ticket keys (RFC 5077) derived from a secret shared by
+ * all nodes of a cluster.  The keys are rotated on a fixed schedule
+ * (based on the wall clock), so all nodes (and all worker processes)
+ * which have the same secret encrypt tickets with the same key
+ * without having to exchange any messages, and a session established
+ * on one node can be resumed on all others.
+ *
+ * Keys are derived on demand; this class has no mutable state, and
+ * may be used by any number of threads.
+ *
+ * Derived keys provide no forward secrecy: whoever obtains the
+ * secret can compute the keys of all past and future periods and
+ * decrypt every recorded session which was resumed with a ticket.
+ * The secret must therefore be replaced regularly (on all nodes,
+ * followed by a restart), and old copies must be destroyed.
+ */
+class SslTicketKeys {
+    std::string secret;
+
+public:
+    /**
+     * How long is one key used for encrypting new tickets?
+     */
+    static constexpr unsigned PERIOD = 12 * 3600;
+
+    /**
+     * Load the secret from a file.  It must contain at least 32
+     * bytes (preferably random data); throws on error.
+     */
+    explicit SslTicketKeys(const char *path);
+
+    /**
+     * Enable session tickets with the shared keys on the given
+     * #SSL_CTX.  Each #SSL object created from it must be passed to
+     * Apply().
+     */
+    static void Install(SSL_CTX &ssl_ctx);
+
+    void Apply(SSL &ssl) const noexcept;
+
+    struct Key {
+        uint8_t name[16];
+        uint8_t hmac_key[16];
+        uint8_t aes_key[32];
+    };
+
+    /**
+     * Derive the key for the given period number (i.e. seconds since
+     * the epoch divided by #PERIOD).
+     */
+    Key Derive(uint64_t period) const noexcept;
+
+    /**
+     * Find the key with the given name, which was used in the
+     * current period or in the previous one (to be able to decrypt
+     * older tickets), or in the next one (to tolerate clock skew
+     * between nodes).
+     *
+     * @param current_r set to true if this is the current key
+     * @return false if no such key was found
+     */
+    bool Find(const uint8_t *name, uint64_t now_period,
+              Key &key_r, bool &current_r) const noexcept;
+};
@@ -34,6 +34,8 @@
 #include "MapStock.hxx"
 #include "GetHandler.hxx"
 #include "Item.hxx"
+#include "pool/pool.hxx"
+#include "util/Cancellable.hxx"
 
 bool
 MultiStock::Item::Compare::Less(const char *a, const char *b) const
@@ -77,21 +79,46 @@ MultiStock::Item::DeleteLease(Lease *lease, bool _reuse)
         delete this;
 }
 
-MultiStock::Item &
-MultiStock::MakeItem(struct pool &caller_pool, const char *uri, void *info,
-                     unsigned max_leases)
+MultiStock::~MultiStock() noexcept
+{
+    /* the #StockMap would otherwise invoke the deleted #Create
+       objects after the pending items have been created */
+    creates.clear_and_dispose([](Create *create){
+            create->Dispose();
+        });
+}
+
+MultiStock::Item *
+MultiStock::FindUsable(const char *uri) noexcept
 {
     auto i = items.lower_bound(uri, items.key_comp());
     for (; i != items.end() && !items.key_comp()(uri, *i); ++i)
         if (i->CanUse())
-            return *i;
+            return &*i;
+
+    return nullptr;
+}
+
+MultiStock::Item &
+MultiStock::InsertItem(unsigned max_leases, StockItem &stock_item) noexcept
+{
+    auto *item = new Item(max_leases, stock_item);
+    items.insert(*item);
+    return *item;
+}
+
+MultiStock::Item &
+MultiStock::MakeItem(struct pool &caller_pool, const char *uri, void *info,
+                     unsigned max_leases)
+{
+    auto *item = FindUsable(uri);
+    if (item != nullptr)
+        return *item;
 
     auto *stock_item = hstock.GetNow(caller_pool, uri, info);
     assert(stock_item != nullptr);
 
-    auto *item = new Item(max_leases, *stock_item);
-    items.insert(i, *item);
-    return *item;
+    return InsertItem(max_leases, *stock_item);
 }
 
 StockItem *
@@ -101,3 +128,156 @@ MultiStock::GetNow(struct pool &caller_pool, const char *uri, void *info,
 {
     return MakeItem(caller_pool, uri, info, max_leases).AddLease(lease_ref);
 }
+
+void
+MultiStock::GetRequest::Resume() noexcept
+{
+    assert(create == nullptr);
+
+    auto *item = stock.FindUsable(uri);
+    if (item == nullptr) {
+        stock.Enqueue(*this);
+        return;
+    }
+
+    auto &_handler = handler;
+    auto &_lease_ref = lease_ref;
+    Destroy();
+
+    item->AddLease(_handler, _lease_ref);
+}
+
+void
+MultiStock::GetRequest::Fail(std::exception_ptr ep) noexcept
+{
+    assert(create == nullptr);
+
+    auto &_handler = handler;
+    Destroy();
+
+    _handler.OnStockItemError(ep);
+}
+
+void
+MultiStock::GetRequest::Cancel() noexcept
+{
+    auto *_create = create;
+
+    /* this unlinks it from Create::waiters (or from the list being
+       dispatched) */
+    Destroy();
+
+    if (_create != nullptr)
+        _create->OnRequestCanceled();
+}
+
+void
+MultiStock::Create::Start(void *info) noexcept
+{
+    stock.hstock.Get(pool, uri.c_str(), info, *this, cancel_ptr);
+}
+
+void
+MultiStock::Create::OnRequestCanceled() noexcept
+{
+    assert(n_waiters > 0);
+
+    if (--n_waiters > 0)
+        return;
+
+    cancel_ptr.Cancel();
+    stock.creates.erase(stock.creates.iterator_to(*this));
+    delete this;
+}
+
+void
+MultiStock::Create::Dispose() noexcept
+{
+    for (auto &request : waiters)
+        request.create = nullptr;
+    waiters.clear();
+
+    cancel_ptr.Cancel();
+    delete this;
+}
+
+void
+MultiStock::Create::Finish(GetRequestList &dest) noexcept
+{
+    stock.creates.erase(stock.creates.iterator_to(*this));
+
+    for (auto &request : waiters)
+        request.create = nullptr;
+
+    dest.swap(waiters);
+}
+
+void
+MultiStock::Create::OnStockItemReady(StockItem &item) noexcept
+{
+    auto &_stock = stock;
+    _stock.InsertItem(max_leases, item);
+
+    GetRequestList list;
+    Finish(list);
+    delete this;
+
+    /* hand out leases in the order of the Get() calls; requests
+       which do not fit into the new item (e.g. because a handler has
+       faded it) will wait for another #Create */
+    while (!list.empty()) {
+        auto &request = list.front();
+        list.pop_front();
+        request.Resume();
+    }
+}
+
+void
+MultiStock::Create::OnStockItemError(std::exception_ptr ep) noexcept
+{
+    GetRequestList list;
+    Finish(list);
+    delete this;
+
+    while (!list.empty()) {
+        auto &request = list.front();
+        list.pop_front();
+        request.Fail(ep);
+    }
+}
+
+void
+MultiStock::Enqueue(GetRequest &request) noexcept
+{
+    for (auto &i : creates) {
+        if (i.CanAdd(request.GetUri())) {
+            i.Add(request);
+            return;
+        }
+    }
+
+    auto *create = new Create(*this, request.GetPool(), request.GetUri(),
+                              request.GetMaxLeases());
+    creates.push_back(*create);
+    create->Add(request);
+    create->Start(request.GetInfo());
+}
+
+void
+MultiStock::Get(struct pool &caller_pool, const char *uri, void *info,
+                unsigned max_leases,
+                StockGetHandler &handler,
+                struct lease_ref &lease_ref,
+                CancellablePointer &cancel_ptr) noexcept
+{
+    auto *item = FindUsable(uri);
+    if (item != nullptr) {
+        item->AddLease(handler, lease_ref);
+        return;
+    }
+
+    auto *request = NewFromPool<GetRequest>(caller_pool, *this, caller_pool,
+                                            uri, info, max_leases,
+                                            handler, lease_ref, cancel_ptr);
+    Enqueue(*request);
+}
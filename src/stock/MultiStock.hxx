@@ -34,12 +34,17 @@
 #define BENG_PROXY_MULTI_STOCK_HXX
 
 #include "lease.hxx"
+#include "stock/GetHandler.hxx"
+#include "pool/Ptr.hxx"
+#include "util/Cancellable.hxx"
 #include "util/DeleteDisposer.hxx"
 #include "util/Compiler.h"
 
 #include <boost/intrusive/set.hpp>
 #include <boost/intrusive/list.hpp>
 
+#include <string>
+
 struct pool;
 struct lease_ref;
 class StockMap;
@@ -163,10 +168,172 @@ class MultiStock {
 
     StockMap &hstock;
 
+    class Create;
+
+    /**
+     * A Get() call which waits for a #Create to finish.
+     */
+    class GetRequest final
+        : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>,
+          Cancellable {
+        MultiStock &stock;
+
+        struct pool &caller_pool;
+        const char *const uri;
+        void *const info;
+
+        const unsigned max_leases;
+
+        StockGetHandler &handler;
+        struct lease_ref &lease_ref;
+
+    public:
+        /**
+         * The #Create this request is waiting for; nullptr while it
+         * is being dispatched.
+         */
+        Create *create = nullptr;
+
+        GetRequest(MultiStock &_stock, struct pool &_caller_pool,
+                   const char *_uri, void *_info,
+                   unsigned _max_leases,
+                   StockGetHandler &_handler,
+                   struct lease_ref &_lease_ref,
+                   CancellablePointer &_cancel_ptr) noexcept
+            :stock(_stock), caller_pool(_caller_pool),
+             uri(_uri), info(_info), max_leases(_max_leases),
+             handler(_handler), lease_ref(_lease_ref)
+        {
+            _cancel_ptr = *this;
+        }
+
+        struct pool &GetPool() const noexcept {
+            return caller_pool;
+        }
+
+        const char *GetUri() const noexcept {
+            return uri;
+        }
+
+        void *GetInfo() const noexcept {
+            return info;
+        }
+
+        unsigned GetMaxLeases() const noexcept {
+            return max_leases;
+        }
+
+        /**
+         * Try again after the #Create has finished: obtain a lease
+         * on an existing item or wait for another #Create.
+         */
+        void Resume() noexcept;
+
+        void Fail(std::exception_ptr ep) noexcept;
+
+    private:
+        void Destroy() noexcept {
+            this->~GetRequest();
+        }
+
+        /* virtual methods from class Cancellable */
+        void Cancel() noexcept override;
+    };
+
+    using GetRequestList =
+        boost::intrusive::list<GetRequest,
+                               boost::intrusive::constant_time_size<false>>;
+
+    /**
+     * A new #StockItem being created by the #StockMap.  All Get()
+     * calls for the same URI wait for it (up to "max_leases"), instead
+     * of creating one item each.
+     */
+    class Create final
+        : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+          StockGetHandler {
+        MultiStock &stock;
+
+        /**
+         * A reference to the pool passed to StockMap::Get(), to keep
+         * it alive even if the request which started this has been
+         * canceled.
+         */
+        PoolPtr pool;
+
+        const std::string uri;
+
+        const unsigned max_leases;
+
+        GetRequestList waiters;
+        unsigned n_waiters = 0;
+
+        CancellablePointer cancel_ptr;
+
+    public:
+        Create(MultiStock &_stock, struct pool &_pool, const char *_uri,
+               unsigned _max_leases) noexcept
+            :stock(_stock), pool(_pool), uri(_uri),
+             max_leases(_max_leases) {}
+
+        Create(const Create &) = delete;
+        Create &operator=(const Create &) = delete;
+
+        /**
+         * Can this #Create accept another #GetRequest for the given
+         * URI?
+         */
+        gcc_pure
+        bool CanAdd(const char *_uri) const noexcept {
+            return n_waiters < max_leases && uri == _uri;
+        }
+
+        void Add(GetRequest &request) noexcept {
+            request.create = this;
+            waiters.push_back(request);
+            ++n_waiters;
+        }
+
+        void Start(void *info) noexcept;
+
+        /**
+         * A #GetRequest has been canceled.  Cancel the #StockMap
+         * request if there are no more waiters.
+         */
+        void OnRequestCanceled() noexcept;
+
+        /**
+         * Cancel the #StockMap request and delete this object.  The
+         * waiters are detached without being notified; their callers
+         * may still cancel them.  The caller is responsible for
+         * removing this object from MultiStock::creates.
+         */
+        void Dispose() noexcept;
+
+    private:
+        /**
+         * Remove this object from the #MultiStock and move all
+         * waiters to the given list.
+         */
+        void Finish(GetRequestList &dest) noexcept;
+
+        /* virtual methods from class StockGetHandler */
+        void OnStockItemReady(StockItem &item) noexcept override;
+        void OnStockItemError(std::exception_ptr ep) noexcept override;
+    };
+
+    boost::intrusive::list<Create,
+                           boost::intrusive::constant_time_size<false>> creates;
+
 public:
     explicit MultiStock(StockMap &_hstock)
         :hstock(_hstock) {}
 
+    /**
+     * Cancels all pending #StockMap requests.
+     */
+    ~MultiStock() noexcept;
+
     MultiStock(const MultiStock &) = delete;
     MultiStock &operator=(const MultiStock &) = delete;
 
@@ -200,9 +367,40 @@ public:
                       unsigned max_leases,
                       struct lease_ref &lease_ref);
 
+    /**
+     * Obtains an item from the stock asynchronously.  If there is an
+     * existing item with a free lease slot, the handler is invoked
+     * right away; otherwise a new #StockItem is requested from the
+     * #StockMap.
+     *
+     * @param max_leases the maximum number of leases per stock_item
+     * @param lease_ref receives the lease before the handler is
+     * invoked
+     */
+    void Get(struct pool &caller_pool, const char *uri, void *info,
+             unsigned max_leases,
+             StockGetHandler &handler,
+             struct lease_ref &lease_ref,
+             CancellablePointer &cancel_ptr) noexcept;
+
 private:
+    /**
+     * Find an existing item which can accept another lease.
+     *
+     * @return nullptr if there is none
+     */
+    Item *FindUsable(const char *uri) noexcept;
+
+    Item &InsertItem(unsigned max_leases, StockItem &stock_item) noexcept;
+
     Item &MakeItem(struct pool &caller_pool, const char *uri, void *info,
                    unsigned max_leases);
+
+    /**
+     * Let the request wait for a pending #Create with a free slot,
+     * or start a new one.
+     */
+    void Enqueue(GetRequest &request) noexcept;
 };
 
 #endif
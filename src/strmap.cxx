@@ -35,72 +35,342 @@
 #include "util/StringCompare.hxx"
 #include "util/StringView.hxx"
 
-#include <iterator>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 
+#include <assert.h>
 #include <string.h>
 
-bool
-StringMap::Item::Compare::Less(const char *a, const char *b) const noexcept
+/**
+ * Well-known (lower-case) header names which are interned as
+ * integer tokens.  The token of a name is its index plus one; 0
+ * means "not interned".  This list must be sorted (strcmp()), so
+ * comparing two tokens yields the same result as comparing the
+ * strings.
+ */
+static constexpr const char *well_known_keys[] = {
+    "accept",
+    "accept-charset",
+    "accept-encoding",
+    "accept-language",
+    "accept-ranges",
+    "access-control-allow-origin",
+    "age",
+    "allow",
+    "authorization",
+    "cache-control",
+    "connection",
+    "content-disposition",
+    "content-encoding",
+    "content-language",
+    "content-length",
+    "content-location",
+    "content-range",
+    "content-type",
+    "cookie",
+    "cookie2",
+    "date",
+    "dnt",
+    "etag",
+    "expect",
+    "expires",
+    "from",
+    "host",
+    "if-match",
+    "if-modified-since",
+    "if-none-match",
+    "if-range",
+    "if-unmodified-since",
+    "keep-alive",
+    "last-modified",
+    "location",
+    "origin",
+    "pragma",
+    "proxy-authenticate",
+    "proxy-authorization",
+    "range",
+    "referer",
+    "retry-after",
+    "sec-fetch-dest",
+    "sec-fetch-mode",
+    "sec-fetch-site",
+    "sec-fetch-user",
+    "server",
+    "set-cookie",
+    "set-cookie2",
+    "te",
+    "trailer",
+    "transfer-encoding",
+    "upgrade",
+    "upgrade-insecure-requests",
+    "user-agent",
+    "vary",
+    "via",
+    "www-authenticate",
+    "x-cm4all-beng-user",
+    "x-cm4all-docroot",
+    "x-cm4all-generator",
+    "x-cm4all-https",
+    "x-cm4all-view",
+    "x-forwarded-for",
+    "x-requested-with",
+};
+
+static constexpr std::size_t n_well_known_keys = std::size(well_known_keys);
+
+static constexpr int
+ConstStrcmp(const char *a, const char *b) noexcept
 {
-    return strcmp(a, b) < 0;
+    while (*a != 0 && *a == *b) {
+        ++a;
+        ++b;
+    }
+
+    return (unsigned char)*a - (unsigned char)*b;
 }
 
-StringMap::Item *
-StringMap::Item::Cloner::operator()(const Item &src) const noexcept
+static constexpr bool
+IsSorted(const char *const*keys, std::size_t n) noexcept
 {
-    return NewFromPool<Item>(pool,
-                             p_strdup(&pool, src.key),
-                             p_strdup(&pool, src.value));
+    for (std::size_t i = 1; i < n; ++i)
+        if (ConstStrcmp(keys[i - 1], keys[i]) >= 0)
+            return false;
+
+    return true;
 }
 
-StringMap::Item *
-StringMap::Item::ShallowCloner::operator()(const Item &src) const noexcept
+static_assert(IsSorted(well_known_keys, n_well_known_keys),
+              "well_known_keys must be sorted");
+
+/**
+ * FNV-1a.
+ */
+static constexpr uint32_t
+HashKey(const char *key) noexcept
 {
-    return NewFromPool<Item>(pool, ShallowCopy(), src);
+    uint32_t hash = 2166136261u;
+    for (; *key != 0; ++key)
+        hash = (hash ^ (unsigned char)*key) * 16777619u;
+    return hash;
+}
+
+/**
+ * Open-addressing hash table mapping a header name to its token;
+ * must be a power of two, and must be considerably larger than
+ * #n_well_known_keys to keep probe sequences short.
+ */
+static constexpr std::size_t TOKEN_TABLE_SIZE = 256;
+static_assert(n_well_known_keys < TOKEN_TABLE_SIZE / 2);
+
+using TokenTable = std::array<uint8_t, TOKEN_TABLE_SIZE>;
+static_assert(n_well_known_keys < 256, "token does not fit in uint8_t");
+
+static constexpr TokenTable
+MakeTokenTable() noexcept
+{
+    TokenTable table{};
+
+    for (std::size_t i = 0; i < n_well_known_keys; ++i) {
+        std::size_t slot = HashKey(well_known_keys[i]) & (TOKEN_TABLE_SIZE - 1);
+        while (table[slot] != 0)
+            slot = (slot + 1) & (TOKEN_TABLE_SIZE - 1);
+        table[slot] = i + 1;
+    }
+
+    return table;
+}
+
+static constexpr TokenTable token_table = MakeTokenTable();
+
+/**
+ * Look up the token of the given header name.
+ *
+ * @return the token or 0 if this is not a well-known header name
+ */
+gcc_pure
+static unsigned
+LookupToken(const char *key) noexcept
+{
+    std::size_t slot = HashKey(key) & (TOKEN_TABLE_SIZE - 1);
+    while (true) {
+        const unsigned token = token_table[slot];
+        if (token == 0)
+            return 0;
+
+        if (strcmp(well_known_keys[token - 1], key) == 0)
+            return token;
+
+        slot = (slot + 1) & (TOKEN_TABLE_SIZE - 1);
+    }
+}
+
+/**
+ * Compare two keys, using the tokens if both are known.
+ */
+gcc_pure
+static inline int
+CompareKeys(unsigned a_token, const char *a,
+            unsigned b_token, const char *b) noexcept
+{
+    if (a_token != 0 && b_token != 0)
+        return int(a_token) - int(b_token);
+
+    return strcmp(a, b);
 }
 
 StringMap::StringMap(struct pool &_pool, const StringMap &src) noexcept
-    :pool(_pool) {
-    map.clone_from(src.map, Item::Cloner(pool), [](Item *){});
+    :pool(_pool)
+{
+    Reserve(src.n_items);
+
+    for (const auto &i : src)
+        items[n_items++] = {p_strdup(&pool, i.key),
+                            p_strdup(&pool, i.value),
+                            i.token};
 }
 
 StringMap::StringMap(struct pool &_pool, const StringMap *src) noexcept
-    :pool(_pool) {
-    if (src != nullptr)
-        map.clone_from(src->map, Item::Cloner(pool), [](Item *){});
+    :pool(_pool)
+{
+    if (src != nullptr) {
+        Reserve(src->n_items);
+
+        for (const auto &i : *src)
+            items[n_items++] = {p_strdup(&pool, i.key),
+                                p_strdup(&pool, i.value),
+                                i.token};
+    }
 }
 
 StringMap::StringMap(ShallowCopy, struct pool &_pool,
                      const StringMap &src) noexcept
     :pool(_pool)
 {
-    map.clone_from(src.map, Item::ShallowCloner(pool), [](Item *){});
+    CopyItems(src);
+}
+
+void
+StringMap::CopyItems(const StringMap &src) noexcept
+{
+    assert(n_items == 0);
+
+    Reserve(src.n_items);
+    std::copy_n(src.items, src.n_items, items);
+    n_items = src.n_items;
+}
+
+void
+StringMap::Reserve(unsigned n) noexcept
+{
+    if (n <= capacity)
+        return;
+
+    unsigned new_capacity = std::max(capacity * 2, 16u);
+    while (new_capacity < n)
+        new_capacity *= 2;
+
+    Item *new_items = PoolAlloc<Item>(pool, new_capacity);
+    std::copy_n(items, n_items, new_items);
+
+    if (items != nullptr)
+        p_free(&pool, items);
+
+    items = new_items;
+    capacity = new_capacity;
+}
+
+unsigned
+StringMap::LowerBound(unsigned token, const char *key) const noexcept
+{
+    unsigned first = 0, count = n_items;
+    while (count > 0) {
+        const unsigned step = count / 2;
+        const Item &i = items[first + step];
+        if (CompareKeys(i.token, i.key, token, key) < 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else
+            count = step;
+    }
+
+    return first;
+}
+
+unsigned
+StringMap::UpperBound(unsigned token, const char *key) const noexcept
+{
+    unsigned first = 0, count = n_items;
+    while (count > 0) {
+        const unsigned step = count / 2;
+        const Item &i = items[first + step];
+        if (CompareKeys(token, key, i.token, i.key) >= 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else
+            count = step;
+    }
+
+    return first;
+}
+
+void
+StringMap::Insert(unsigned position, const Item &item) noexcept
+{
+    assert(position <= n_items);
+
+    Reserve(n_items + 1);
+    std::copy_backward(items + position, items + n_items,
+                       items + n_items + 1);
+    items[position] = item;
+    ++n_items;
+}
+
+void
+StringMap::Erase(unsigned begin, unsigned end) noexcept
+{
+    assert(begin <= end);
+    assert(end <= n_items);
+
+    std::copy(items + end, items + n_items, items + begin);
+    n_items -= end - begin;
 }
 
 void
 StringMap::Clear() noexcept
 {
-    map.clear_and_dispose(PoolDisposer(pool));
+    n_items = 0;
 }
 
 void
 StringMap::Add(const char *key, const char *value) noexcept
 {
-    Item *item = NewFromPool<Item>(pool, key, value);
-    map.insert(*item);
+    const unsigned token = LookupToken(key);
+
+    /* fast path: append if the new key sorts after the last one */
+    if (n_items == 0 ||
+        CompareKeys(items[n_items - 1].token, items[n_items - 1].key,
+                    token, key) <= 0) {
+        Reserve(n_items + 1);
+        items[n_items++] = {key, value, token};
+        return;
+    }
+
+    Insert(UpperBound(token, key), {key, value, token});
 }
 
 const char *
 StringMap::Set(const char *key, const char *value) noexcept
 {
-    auto i = map.upper_bound(key, Item::Compare());
-    if (i != map.begin() && strcmp(std::prev(i)->key, key) == 0) {
-        --i;
-        const char *old_value = i->value;
-        i->value = value;
+    const unsigned token = LookupToken(key);
+    const unsigned i = UpperBound(token, key);
+    if (i > 0 && CompareKeys(items[i - 1].token, items[i - 1].key,
+                             token, key) == 0) {
+        const char *old_value = items[i - 1].value;
+        items[i - 1].value = value;
         return old_value;
     } else {
-        map.insert_before(i, *NewFromPool<Item>(pool, key, value));
+        Insert(i, {key, value, token});
         return nullptr;
     }
 }
@@ -108,52 +378,70 @@ StringMap::Set(const char *key, const char *value) noexcept
 const char *
 StringMap::Remove(const char *key) noexcept
 {
-    auto i = map.find(key, Item::Compare());
-    if (i == map.end())
+    const unsigned token = LookupToken(key);
+    const unsigned i = LowerBound(token, key);
+    if (i == n_items ||
+        CompareKeys(items[i].token, items[i].key, token, key) != 0)
         return nullptr;
 
-    const char *value = i->value;
-    map.erase_and_dispose(i, PoolDisposer(pool));
+    const char *value = items[i].value;
+    Erase(i, i + 1);
     return value;
 }
 
 void
 StringMap::RemoveAll(const char *key) noexcept
 {
-    map.erase_and_dispose(key, Item::Compare(), PoolDisposer(pool));
+    const unsigned token = LookupToken(key);
+    Erase(LowerBound(token, key), UpperBound(token, key));
 }
 
 void
 StringMap::SecureSet(const char *key, const char *value) noexcept
 {
-    auto r = map.equal_range(key, Item::Compare());
-    if (r.first != r.second) {
+    const unsigned token = LookupToken(key);
+    unsigned first = LowerBound(token, key);
+    const unsigned last = UpperBound(token, key);
+    if (first != last) {
         if (value != nullptr) {
             /* replace the first value */
-            r.first->value = value;
-            ++r.first;
+            items[first].value = value;
+            ++first;
         }
 
         /* and erase all other values with the same key */
-        map.erase_and_dispose(r.first, r.second, PoolDisposer(pool));
+        Erase(first, last);
     } else if (value != nullptr)
-        map.insert_before(r.second, *NewFromPool<Item>(pool, key, value));
+        Insert(last, {key, value, token});
 }
 
 const char *
 StringMap::Get(const char *key) const noexcept
 {
-    auto i = map.find(key, Item::Compare());
-    if (i == map.end())
+    const unsigned token = LookupToken(key);
+    const unsigned i = LowerBound(token, key);
+    if (i == n_items ||
+        CompareKeys(items[i].token, items[i].key, token, key) != 0)
         return nullptr;
 
-    return i->value;
+    return items[i].value;
 }
 
 std::pair<StringMap::const_iterator, StringMap::const_iterator>
 StringMap::EqualRange(const char *key) const noexcept
 {
-    return map.equal_range(key, Item::Compare());
+    const unsigned token = LookupToken(key);
+    return {items + LowerBound(token, key), items + UpperBound(token, key)};
+}
+
+void
+StringMap::Merge(StringMap &&src) noexcept
+{
+    Reserve(n_items + src.n_items);
+    for (const auto &i : src)
+        Insert(UpperBound(i.token, i.key), i);
+
+    src.Clear();
 }
 
 void
@@ -37,77 +37,42 @@
 
 #include "util/Compiler.h"
 
-#include <boost/intrusive/set.hpp>
-
+#include <initializer_list>
 #include <utility>
 
 struct pool;
 
 /**
- * String hash map.
+ * A multi-map of strings, sorted by key.  The items are stored in
+ * one flat array allocated from the pool.  Well-known HTTP header
+ * names are interned as integer tokens (see strmap.cxx) which are
+ * compared instead of the strings.
+ *
+ * Items are iterated in strcmp() order of their keys; values with
+ * the same key are kept in the order in which they were added.
+ * Since the array may be reallocated and items are shifted, all
+ * methods which add or remove items (Add(), Set(), Remove(),
+ * SecureSet(), Merge() etc.) invalidate all iterators and references
+ * to items.
  */
 class StringMap {
-    struct Item : boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+    struct Item {
         const char *key, *value;
 
-        Item(const char *_key, const char *_value) noexcept
-            :key(_key), value(_value) {}
-
-        Item(ShallowCopy, const Item &src) noexcept
-            :key(src.key), value(src.value) {}
-
-        Item(const Item &) = delete;
-        Item &operator=(const Item &) = delete;
-
-        class Compare {
-            gcc_pure
-            bool Less(const char *a, const char *b) const noexcept;
-
-        public:
-            gcc_pure
-            bool operator()(const char *a, const Item &b) const noexcept {
-                return Less(a, b.key);
-            }
-
-            gcc_pure
-            bool operator()(const Item &a, const char *b) const noexcept {
-                return Less(a.key, b);
-            }
-
-            gcc_pure
-            bool operator()(const Item &a, const Item &b) const noexcept {
-                return Less(a.key, b.key);
-            }
-        };
-
-        class Cloner {
-            struct pool &pool;
-
-        public:
-            explicit Cloner(struct pool &_pool) noexcept:pool(_pool) {}
-
-            Item *operator()(const Item &src) const noexcept;
-        };
-
-        class ShallowCloner {
-            struct pool &pool;
-
-        public:
-            explicit ShallowCloner(struct pool &_pool) noexcept:pool(_pool) {}
-
-            Item *operator()(const Item &src) const noexcept;
-        };
+        /**
+         * The token of #key if it is a well-known header name, 0
+         * otherwise.  Tokens are ordered like the strings they
+         * represent.
+         */
+        unsigned token;
     };
 
     struct pool &pool;
 
-    typedef boost::intrusive::multiset<Item,
-                                       boost::intrusive::compare<Item::Compare>,
-                                       boost::intrusive::constant_time_size<false>> Map;
-
-    typedef Map::const_iterator const_iterator;
+    Item *items = nullptr;
+    unsigned n_items = 0, capacity = 0;
 
-    Map map;
+    typedef const Item *const_iterator;
 
 public:
     explicit StringMap(struct pool &_pool) noexcept
@@ -131,7 +96,11 @@ public:
 
     StringMap(const StringMap &) = delete;
 
-    StringMap(StringMap &&src) = default;
+    StringMap(StringMap &&src) noexcept
+        :pool(src.pool),
+         items(std::exchange(src.items, nullptr)),
+         n_items(std::exchange(src.n_items, 0)),
+         capacity(std::exchange(src.capacity, 0)) {}
 
     /**
      * Move-assign all items.  Note that this does not touch the pool;
@@ -139,7 +108,9 @@ public:
      * pool.
      */
     StringMap &operator=(StringMap &&src) noexcept {
-        map.swap(src.map);
+        std::swap(items, src.items);
+        std::swap(n_items, src.n_items);
+        std::swap(capacity, src.capacity);
         return *this;
     }
 
@@ -148,22 +119,39 @@ public:
     }
 
     const_iterator begin() const noexcept {
-        return map.begin();
+        return items;
     }
 
     const_iterator end() const noexcept {
-        return map.end();
+        return items + n_items;
     }
 
     gcc_pure
     bool IsEmpty() const noexcept {
-        return map.empty();
+        return n_items == 0;
     }
 
     void Clear() noexcept;
 
+    /**
+     * Add a value after all existing values with the same key.
+     * Invalidates all iterators.
+     */
     void Add(const char *key, const char *value) noexcept;
+
+    /**
+     * Replace the last value with the specified key, or add a new
+     * item if there is none.  Invalidates all iterators.
+     *
+     * @return the old value or nullptr
+     */
     const char *Set(const char *key, const char *value) noexcept;
+
+    /**
+     * Remove the first value with the specified key.
+     *
+     * @return the removed value or nullptr
+     */
     const char *Remove(const char *key) noexcept;
 
     /**
@@ -211,11 +199,28 @@ public:
     /**
      * Move items from #src, merging it into this object.
      */
-    void Merge(StringMap &&src) noexcept {
-        src.map.clear_and_dispose([this](Item *item){
-                map.insert(*item);
-            });
-    }
+    void Merge(StringMap &&src) noexcept;
+
+private:
+    /**
+     * Copy the items of #src (which must be empty) without
+     * duplicating the strings.
+     */
+    void CopyItems(const StringMap &src) noexcept;
+
+    /**
+     * Make room for at least the given number of items.
+     */
+    void Reserve(unsigned n) noexcept;
+
+    gcc_pure
+    unsigned LowerBound(unsigned token, const char *key) const noexcept;
+
+    gcc_pure
+    unsigned UpperBound(unsigned token, const char *key) const noexcept;
+
+    void Insert(unsigned position, const Item &item) noexcept;
+    void Erase(unsigned begin, unsigned end) noexcept;
 };
 
 StringMap *gcc_malloc
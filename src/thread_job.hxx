@@ -35,6 +35,8 @@
 
 #include <boost/intrusive/list.hpp>
 
+#include <atomic>
+
 /*8
  * A job that shall be executed in a worker thread.
  */
@@ -65,7 +67,17 @@ public:
         DONE,
     };
 
-    State state = State::INITIAL;
+    /**
+     * Modified by worker threads, therefore atomic; only the main
+     * thread may switch back to #State::INITIAL.
+     */
+    std::atomic<State> state{State::INITIAL};
+
+    /**
+     * The #ThreadQueue shard this job has been added to.  Only valid
+     * while the job is in #State::WAITING.
+     */
+    unsigned shard;
 
     /**
      * Shall this job be enqueued again instead of invoking its done()
@@ -50,7 +50,8 @@ static std::array<struct thread_worker, 8> worker_threads;
 static void
 thread_pool_init(EventLoop &event_loop)
 {
-    global_thread_queue = thread_queue_new(event_loop);
+    global_thread_queue = thread_queue_new(event_loop,
+                                           worker_threads.size());
 }
 
 static void
@@ -58,8 +59,8 @@ thread_pool_start(void)
 try {
     assert(global_thread_queue != nullptr);
 
-    for (auto &i : worker_threads)
-        thread_worker_create(i, *global_thread_queue);
+    for (unsigned i = 0; i < worker_threads.size(); ++i)
+        thread_worker_create(worker_threads[i], *global_thread_queue, i);
 } catch (...) {
     LogConcat(1, "thread_pool", "Failed to launch worker thread: ",
               std::current_exception());
@@ -36,91 +36,208 @@
 
 #include "util/Compiler.h"
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 
 #include <assert.h>
 
+typedef boost::intrusive::list<ThreadJob,
+                               boost::intrusive::constant_time_size<false>> ThreadJobList;
+
+/**
+ * The list of waiting jobs owned by one worker thread.  Other
+ * workers may steal from it when their own list is empty.
+ */
+struct alignas(64) ThreadQueueShard {
+    std::mutex mutex;
+
+    ThreadJobList waiting;
+};
+
 class ThreadQueue {
 public:
-    std::mutex mutex;
-    std::condition_variable cond;
+    const unsigned n_shards;
+    const std::unique_ptr<ThreadQueueShard[]> shards;
+
+    /**
+     * The shard which gets the next new job (round-robin).  Only
+     * accessed by the main thread.
+     */
+    unsigned next_shard = 0;
 
-    bool alive = true;
+    /**
+     * The number of jobs in all #shards.  Modified only while
+     * holding the respective shard's mutex.
+     */
+    std::atomic_uint n_waiting{0};
 
     /**
-     * Was the #wakeup_event triggered?  This avoids duplicate events.
+     * The number of workers waiting on #park_cond.
      */
-    bool pending = false;
+    std::atomic_uint n_sleeping{0};
 
-    typedef boost::intrusive::list<ThreadJob,
-                                   boost::intrusive::constant_time_size<false>> JobList;
+    std::atomic_bool alive{true};
+
+    /**
+     * Idle workers sleep on this; it is only signalled if there is
+     * at least one (#n_sleeping), so adding a job to a busy queue
+     * does not need to lock #park_mutex.
+     */
+    std::mutex park_mutex;
+    std::condition_variable park_cond;
+
+    /**
+     * Protects #done.
+     */
+    std::mutex done_mutex;
 
-    JobList waiting, busy, done;
+    ThreadJobList done;
+
+    /**
+     * The number of jobs which are not in #ThreadJob::State::INITIAL.
+     * Only accessed by the main thread.
+     */
+    unsigned n_jobs = 0;
 
     Notify notify;
 
-    explicit ThreadQueue(EventLoop &event_loop) noexcept
-        :notify(event_loop, BIND_THIS_METHOD(WakeupCallback)) {}
+    ThreadQueue(EventLoop &event_loop, unsigned _n_shards) noexcept
+        :n_shards(_n_shards), shards(new ThreadQueueShard[n_shards]),
+         notify(event_loop, BIND_THIS_METHOD(WakeupCallback)) {}
 
     ~ThreadQueue() noexcept {
         assert(!alive);
     }
 
     bool IsEmpty() const noexcept {
-        return waiting.empty() && busy.empty() && done.empty();
+        return n_jobs == 0;
     }
 
+    /**
+     * Append a job to the next shard and wake up a sleeping worker.
+     * Must be called from the main thread.
+     */
+    void Push(ThreadJob &job) noexcept;
+
+    /**
+     * Remove the first job from the given shard.
+     */
+    ThreadJob *Pop(ThreadQueueShard &shard) noexcept;
+
+    /**
+     * Remove a job from the worker's own shard or, if that is empty,
+     * steal one from the other shards.
+     */
+    ThreadJob *Take(unsigned worker) noexcept;
+
     void WakeupCallback() noexcept;
 };
 
+void
+ThreadQueue::Push(ThreadJob &job) noexcept
+{
+    const unsigned i = next_shard;
+    next_shard = (i + 1) % n_shards;
+
+    auto &shard = shards[i];
+
+    {
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        job.state = ThreadJob::State::WAITING;
+        job.shard = i;
+        shard.waiting.push_back(job);
+        ++n_waiting;
+    }
+
+    /* this pairs with the n_sleeping/n_waiting check in
+       thread_queue_wait(): either the worker sees our job, or we see
+       the sleeping worker */
+    if (n_sleeping > 0) {
+        const std::lock_guard<std::mutex> lock(park_mutex);
+        park_cond.notify_one();
+    }
+}
+
+inline ThreadJob *
+ThreadQueue::Pop(ThreadQueueShard &shard) noexcept
+{
+    const std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.waiting.empty())
+        return nullptr;
+
+    auto &job = shard.waiting.front();
+    assert(job.state == ThreadJob::State::WAITING);
+
+    shard.waiting.pop_front();
+    job.state = ThreadJob::State::BUSY;
+    --n_waiting;
+    return &job;
+}
+
+ThreadJob *
+ThreadQueue::Take(unsigned worker) noexcept
+{
+    assert(worker < n_shards);
+
+    for (unsigned i = 0; i < n_shards; ++i) {
+        auto *job = Pop(shards[(worker + i) % n_shards]);
+        if (job != nullptr)
+            return job;
+    }
+
+    return nullptr;
+}
+
 void
 ThreadQueue::WakeupCallback() noexcept
 {
-    mutex.lock();
+    /* collect all finished jobs at once, so the workers have to
+       contend for #done_mutex only briefly */
+    ThreadJobList list;
 
-    pending = false;
+    {
+        const std::lock_guard<std::mutex> lock(done_mutex);
+        list.swap(done);
+    }
 
-    for (auto i = done.begin(), end = done.end(); i != end;) {
-        ThreadJob *job = &*i;
-        assert(job->state == ThreadJob::State::DONE);
+    while (!list.empty()) {
+        ThreadJob &job = list.front();
+        assert(job.state == ThreadJob::State::DONE);
 
-        i = done.erase(i);
+        list.pop_front();
 
-        if (job->again) {
+        if (job.again) {
             /* schedule this job again */
-            job->state = ThreadJob::State::WAITING;
-            job->again = false;
-            waiting.push_back(*job);
-            cond.notify_one();
+            job.again = false;
+            Push(job);
         } else {
-            job->state = ThreadJob::State::INITIAL;
-            mutex.unlock();
-            job->Done();
-            mutex.lock();
+            job.state = ThreadJob::State::INITIAL;
+            --n_jobs;
+            job.Done();
         }
     }
 
-    const bool empty = IsEmpty();
-
-    mutex.unlock();
-
-    if (empty)
+    if (IsEmpty())
         notify.Disable();
 }
 
 ThreadQueue *
-thread_queue_new(EventLoop &event_loop) noexcept
+thread_queue_new(EventLoop &event_loop, unsigned n_workers) noexcept
 {
-    return new ThreadQueue(event_loop);
+    assert(n_workers > 0);
+
+    return new ThreadQueue(event_loop, n_workers);
 }
 
 void
 thread_queue_stop(ThreadQueue &q) noexcept
 {
-    std::unique_lock<std::mutex> lock(q.mutex);
+    const std::lock_guard<std::mutex> lock(q.park_mutex);
     q.alive = false;
-    q.cond.notify_all();
+    q.park_cond.notify_all();
 }
 
 void
@@ -132,45 +249,40 @@ thread_queue_free(ThreadQueue *q) noexcept
 void
 thread_queue_add(ThreadQueue &q, ThreadJob &job) noexcept
 {
-    q.mutex.lock();
     assert(q.alive);
 
     if (job.state == ThreadJob::State::INITIAL) {
-        job.state = ThreadJob::State::WAITING;
         job.again = false;
-        q.waiting.push_back(job);
-        q.cond.notify_one();
-    } else if (job.state != ThreadJob::State::WAITING) {
-        job.again = true;
+        ++q.n_jobs;
+        q.Push(job);
+    } else {
+        /* lock the shard so a worker can't start running the job
+           between our check and the caller's next access */
+        const std::lock_guard<std::mutex> lock(q.shards[job.shard].mutex);
+        if (job.state != ThreadJob::State::WAITING)
+            job.again = true;
     }
 
-    q.mutex.unlock();
-
     q.notify.Enable();
 }
 
 ThreadJob *
-thread_queue_wait(ThreadQueue &q) noexcept
+thread_queue_wait(ThreadQueue &q, unsigned worker) noexcept
 {
-    std::unique_lock<std::mutex> lock(q.mutex);
-
     while (true) {
         if (!q.alive)
             return nullptr;
 
-        auto i = q.waiting.begin();
-        if (i != q.waiting.end()) {
-            auto &job = *i;
-            assert(job.state == ThreadJob::State::WAITING);
+        auto *job = q.Take(worker);
+        if (job != nullptr)
+            return job;
 
-            job.state = ThreadJob::State::BUSY;
-            q.waiting.erase(i);
-            q.busy.push_back(job);
-            return &job;
-        }
-
-        /* queue is empty, wait for a new job to be added */
-        q.cond.wait(lock);
+        /* all shards are empty, wait for a new job to be added */
+        std::unique_lock<std::mutex> lock(q.park_mutex);
+        ++q.n_sleeping;
+        while (q.alive && q.n_waiting == 0)
+            q.park_cond.wait(lock);
+        --q.n_sleeping;
     }
 }
 
@@ -179,34 +291,42 @@ thread_queue_done(ThreadQueue &q, ThreadJob &job) noexcept
 {
     assert(job.state == ThreadJob::State::BUSY);
 
-    q.mutex.lock();
-
-    job.state = ThreadJob::State::DONE;
-    q.busy.erase(q.busy.iterator_to(job));
-    q.done.push_back(job);
-
-    q.pending = true;
-
-    q.mutex.unlock();
+    {
+        const std::lock_guard<std::mutex> lock(q.done_mutex);
+        job.state = ThreadJob::State::DONE;
+        q.done.push_back(job);
+    }
 
+    /* this does nothing if the main thread has already been notified
+       and has not yet handled it, so several finished jobs are
+       collected with one wakeup */
     q.notify.Signal();
 }
 
 bool
 thread_queue_cancel(ThreadQueue &q, ThreadJob &job) noexcept
 {
-    std::unique_lock<std::mutex> lock(q.mutex);
-
     switch (job.state) {
     case ThreadJob::State::INITIAL:
         /* already idle */
         return true;
 
     case ThreadJob::State::WAITING:
-        /* cancel it */
-        q.waiting.erase(q.waiting.iterator_to(job));
-        job.state = ThreadJob::State::INITIAL;
-        return true;
+        {
+            auto &shard = q.shards[job.shard];
+            const std::lock_guard<std::mutex> lock(shard.mutex);
+
+            if (job.state != ThreadJob::State::WAITING)
+                /* a worker has just taken it */
+                return false;
+
+            /* cancel it */
+            shard.waiting.erase(shard.waiting.iterator_to(job));
+            --q.n_waiting;
+            job.state = ThreadJob::State::INITIAL;
+            --q.n_jobs;
+            return true;
+        }
 
     case ThreadJob::State::BUSY:
         /* no chance */
@@ -41,8 +41,15 @@ class EventLoop;
 class ThreadQueue;
 class ThreadJob;
 
+/**
+ * Create a new queue.
+ *
+ * @param n_workers the number of worker threads which will call
+ * thread_queue_wait(); each one gets its own list of waiting jobs,
+ * and idle workers steal jobs from the others
+ */
 ThreadQueue *
-thread_queue_new(EventLoop &event_loop) noexcept;
+thread_queue_new(EventLoop &event_loop, unsigned n_workers) noexcept;
 
 /**
  * Cancel all thread_queue_wait() calls and refuse all further calls.
@@ -64,10 +71,12 @@ thread_queue_add(ThreadQueue &q, ThreadJob &job) noexcept;
 /**
  * Dequeue an existing job or wait for a new job, and reserve it.
  *
+ * @param worker the index of the calling worker thread (less than
+ * the "n_workers" parameter passed to thread_queue_new())
  * @return NULL if thread_queue_stop() has been called
  */
 ThreadJob *
-thread_queue_wait(ThreadQueue &q) noexcept;
+thread_queue_wait(ThreadQueue &q, unsigned worker) noexcept;
 
 /**
  * Mark the specified job (returned by thread_queue_wait()) as "done".
@@ -47,7 +47,7 @@ thread_worker_run(void *ctx) noexcept
     ThreadQueue &q = *w.queue;
 
     ThreadJob *job;
-    while ((job = thread_queue_wait(q)) != nullptr) {
+    while ((job = thread_queue_wait(q, w.index)) != nullptr) {
         job->Run();
         thread_queue_done(q, *job);
     }
@@ -58,9 +58,11 @@ thread_worker_run(void *ctx) noexcept
 }
 
 void
-thread_worker_create(struct thread_worker &w, ThreadQueue &q)
+thread_worker_create(struct thread_worker &w, ThreadQueue &q,
+                     unsigned index)
 {
     w.queue = &q;
+    w.index = index;
 
     pthread_attr_t attr;
     pthread_attr_init(&attr);
@@ -44,13 +44,19 @@ struct thread_worker {
     pthread_t thread;
 
     ThreadQueue *queue;
+
+    /**
+     * The index passed to thread_queue_wait().
+     */
+    unsigned index;
 };
 
 /**
  * Throws exception on error.
  */
 void
-thread_worker_create(struct thread_worker &w, ThreadQueue &q);
+thread_worker_create(struct thread_worker &w, ThreadQueue &q,
+                     unsigned index);
 
 /**
  * Wait for the thread to exit.  You must call thread_queue_stop()
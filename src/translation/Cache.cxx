@@ -53,6 +53,7 @@
 #include "AllocatorStats.hxx"
 #include "load_file.hxx"
 #include "io/Logger.hxx"
+#include "event/DeferEvent.hxx"
 #include "util/djbhash.h"
 #include "util/RuntimeError.hxx"
 #include "util/StringView.hxx"
@@ -60,6 +61,8 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/unordered_set.hpp>
 
+#include <vector>
+
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
@@ -74,7 +77,8 @@ static constexpr size_t MAX_FILE_NOT_FOUND = 256;
 static constexpr size_t MAX_DIRECTORY_INDEX = 256;
 static constexpr size_t MAX_READ_FILE = 256;
 
-struct TranslateCachePerHost;
+struct TranslateCacheTagLink;
+struct TranslateCachePerTag;
 struct TranslateCachePerSite;
 
 struct TranslateCacheItem final : PoolHolder, CacheItem {
@@ -83,13 +87,10 @@ struct TranslateCacheItem final : PoolHolder, CacheItem {
     using SiblingsHook = boost::intrusive::list_member_hook<LinkMode>;
 
     /**
-     * A doubly linked list of cache items with the same HOST request
-     * string.  Only those that had VARY=HOST in the response are
-     * added to the list.  Check per_host!=nullptr to check whether
-     * this item lives in such a list.
+     * A linked list of this item's entries in #TranslateCachePerTag
+     * lists (allocated from this item's pool).
      */
-    SiblingsHook per_host_siblings;
-    TranslateCachePerHost *per_host = nullptr;
+    TranslateCacheTagLink *tags = nullptr;
 
     /**
      * A doubly linked list of cache items with the same SITE response
@@ -126,11 +127,22 @@ struct TranslateCacheItem final : PoolHolder, CacheItem {
 
     UniqueRegex regex, inverse_regex;
 
-    TranslateCacheItem(PoolPtr &&_pool,
+    const struct tcache &tcache;
+
+    /**
+     * The value of tcache::generation when this item was created.
+     * The item is invalid if this is older than
+     * tcache::flush_generation.
+     */
+    const uint64_t generation;
+
+    TranslateCacheItem(PoolPtr &&_pool, const struct tcache &_tcache,
+                       uint64_t _generation,
                        std::chrono::steady_clock::time_point now,
                        std::chrono::seconds max_age)
         :PoolHolder(std::move(_pool)),
-         CacheItem(now, max_age, 1) {}
+         CacheItem(now, max_age, 1),
+         tcache(_tcache), generation(_generation) {}
 
     TranslateCacheItem(const TranslateCacheItem &) = delete;
 
@@ -183,74 +195,204 @@ struct TranslateCacheItem final : PoolHolder, CacheItem {
     void Destroy() noexcept override;
 };
 
-struct TranslateCachePerHost
-    : boost::intrusive::unordered_set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
-    using MemberHook =
-        boost::intrusive::member_hook<TranslateCacheItem,
-                                      TranslateCacheItem::SiblingsHook,
-                                      &TranslateCacheItem::per_host_siblings>;
-    using ItemList =
-        boost::intrusive::list<TranslateCacheItem, MemberHook,
-                               boost::intrusive::constant_time_size<false>>;
+/**
+ * Returns the request value which is compared by
+ * TranslateCacheItem::VaryMatch() for the given command, as long as
+ * it can be compared byte-by-byte.  Returns nullptr if the value is
+ * missing or if the command cannot be indexed by
+ * #TranslateCachePerTag.
+ */
+template<typename R>
+gcc_pure
+static ConstBuffer<void>
+GetTagValue(const R &request, TranslationCommand command) noexcept
+{
+    switch (command) {
+    case TranslationCommand::PARAM:
+        return StringView(request.param).ToVoid();
+
+    case TranslationCommand::SESSION:
+        return request.session;
+
+    case TranslationCommand::LISTENER_TAG:
+        return StringView(request.listener_tag).ToVoid();
+
+    case TranslationCommand::LOCAL_ADDRESS:
+    case TranslationCommand::LOCAL_ADDRESS_STRING:
+        if (request.local_address.IsNull())
+            return nullptr;
+
+        return {request.local_address.GetAddress(),
+                request.local_address.GetSize()};
+
+    case TranslationCommand::REMOTE_HOST:
+        return StringView(request.remote_host).ToVoid();
+
+    case TranslationCommand::HOST:
+        return StringView(request.host).ToVoid();
+
+    case TranslationCommand::LANGUAGE:
+        return StringView(request.accept_language).ToVoid();
+
+    case TranslationCommand::USER_AGENT:
+        return StringView(request.user_agent).ToVoid();
+
+    case TranslationCommand::UA_CLASS:
+        return StringView(request.ua_class).ToVoid();
+
+    case TranslationCommand::QUERY_STRING:
+        return StringView(request.query_string).ToVoid();
+
+    case TranslationCommand::INTERNAL_REDIRECT:
+        return request.internal_redirect;
+
+    case TranslationCommand::ENOTDIR_:
+        return request.enotdir;
+
+    case TranslationCommand::USER:
+        return StringView(request.user).ToVoid();
+
+    default:
+        return nullptr;
+    }
+}
+
+/**
+ * Can GetTagValue() obtain a value for this command?
+ */
+static constexpr bool
+IsTagCommand(TranslationCommand command) noexcept
+{
+    return command == TranslationCommand::PARAM ||
+        command == TranslationCommand::SESSION ||
+        command == TranslationCommand::LISTENER_TAG ||
+        command == TranslationCommand::LOCAL_ADDRESS ||
+        command == TranslationCommand::LOCAL_ADDRESS_STRING ||
+        command == TranslationCommand::REMOTE_HOST ||
+        command == TranslationCommand::HOST ||
+        command == TranslationCommand::LANGUAGE ||
+        command == TranslationCommand::USER_AGENT ||
+        command == TranslationCommand::UA_CLASS ||
+        command == TranslationCommand::QUERY_STRING ||
+        command == TranslationCommand::INTERNAL_REDIRECT ||
+        command == TranslationCommand::ENOTDIR_ ||
+        command == TranslationCommand::USER;
+}
+
+/**
+ * Both LOCAL_ADDRESS variants compare the same value, so they share
+ * one index.
+ */
+static constexpr TranslationCommand
+NormalizeTagCommand(TranslationCommand command) noexcept
+{
+    return command == TranslationCommand::LOCAL_ADDRESS_STRING
+        ? TranslationCommand::LOCAL_ADDRESS
+        : command;
+}
+
+struct TranslateCacheTagKey {
+    TranslationCommand command;
+    ConstBuffer<void> value;
+};
+
+/**
+ * An entry in a #TranslateCachePerTag list.  Each
+ * #TranslateCacheItem has one of these for each #TranslationCommand
+ * in its VARY list which can be indexed (see GetTagValue()), and
+ * one for the URI.
+ */
+struct TranslateCacheTagLink {
+    using LinkMode =
+        boost::intrusive::link_mode<boost::intrusive::normal_link>;
+    using SiblingsHook = boost::intrusive::list_member_hook<LinkMode>;
+
+    SiblingsHook siblings;
+
+    TranslateCacheItem &item;
+
+    TranslateCachePerTag &tag;
 
     /**
-     * A double-linked list of #TranslateCacheItems (by its attribute
-     * per_host_siblings).
-     *
-     * This must be the first attribute in the struct.
+     * The next link of the same #TranslateCacheItem.
      */
-    ItemList items;
+    TranslateCacheTagLink *next;
+
+    TranslateCacheTagLink(TranslateCacheItem &_item,
+                          TranslateCachePerTag &_tag) noexcept
+        :item(_item), tag(_tag), next(_item.tags) {}
+};
+
+/**
+ * A list of cache items which have the same value for one
+ * #TranslationCommand.  This is used to find the candidates for an
+ * INVALIDATE without traversing the whole cache.
+ */
+struct TranslateCachePerTag
+    : boost::intrusive::unordered_set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>> {
+    using MemberHook =
+        boost::intrusive::member_hook<TranslateCacheTagLink,
+                                      TranslateCacheTagLink::SiblingsHook,
+                                      &TranslateCacheTagLink::siblings>;
+    using LinkList =
+        boost::intrusive::list<TranslateCacheTagLink, MemberHook,
+                               boost::intrusive::constant_time_size<true>>;
+
+    LinkList links;
 
     struct tcache &tcache;
 
-    /**
-     * A pointer to the hashmap key, for use with p_free().
-     */
-    const std::string host;
+    const TranslationCommand command;
 
-    TranslateCachePerHost(struct tcache &_tcache, const char *_host)
-        :tcache(_tcache), host(_host) {
+    const std::string value;
+
+    TranslateCachePerTag(struct tcache &_tcache,
+                         const TranslateCacheTagKey &key)
+        :tcache(_tcache), command(key.command),
+         value((const char *)key.value.data, key.value.size) {
     }
 
-    TranslateCachePerHost(const TranslateCachePerHost &) = delete;
+    TranslateCachePerTag(const TranslateCachePerTag &) = delete;
 
     void Dispose();
-    void Erase(TranslateCacheItem &item);
+    void Erase(TranslateCacheTagLink &link);
 
     unsigned Invalidate(const TranslateRequest &request,
                         ConstBuffer<TranslationCommand> vary);
 
     gcc_pure
-    static size_t KeyHasher(const char *key) {
-        assert(key != nullptr);
-
-        return djb_hash_string(key);
+    static size_t KeyHasher(const TranslateCacheTagKey &key) {
+        return djb_hash(key.value.data, key.value.size) ^
+            size_t(key.command);
     }
 
     gcc_pure
-    static size_t ValueHasher(const TranslateCachePerHost &value) {
-        return KeyHasher(value.host.c_str());
+    static size_t ValueHasher(const TranslateCachePerTag &value) {
+        return KeyHasher({value.command,
+                          {value.value.data(), value.value.size()}});
     }
 
     gcc_pure
-    static bool KeyValueEqual(const char *a, const TranslateCachePerHost &b) {
-        assert(a != nullptr);
-
-        return a == b.host;
+    static bool KeyValueEqual(const TranslateCacheTagKey &a,
+                              const TranslateCachePerTag &b) {
+        return a.command == b.command && a.value.size == b.value.size() &&
+            memcmp(a.value.data, b.value.data(), a.value.size) == 0;
     }
 
     struct Hash {
         gcc_pure
-        size_t operator()(const TranslateCachePerHost &value) const {
+        size_t operator()(const TranslateCachePerTag &value) const {
             return ValueHasher(value);
         }
     };
 
     struct Equal {
         gcc_pure
-        bool operator()(const TranslateCachePerHost &a,
-                        const TranslateCachePerHost &b) const {
-            return KeyValueEqual(a.host.c_str(), b);
+        bool operator()(const TranslateCachePerTag &a,
+                        const TranslateCachePerTag &b) const {
+            return KeyValueEqual({b.command,
+                                  {b.value.data(), b.value.size()}},
+                                 a);
         }
     };
 };
@@ -334,16 +476,17 @@ struct tcache {
     Cache cache;
 
     /**
-     * This hash table maps each host name to a
-     * #TranslateCachePerHost.  This is used to optimize the common
-     * INVALIDATE=HOST response, to avoid traversing the whole cache.
+     * This hash table maps each (command, value) pair to a
+     * #TranslateCachePerTag.  This is used to find the candidates
+     * for INVALIDATE (e.g. INVALIDATE=HOST) without traversing the
+     * whole cache.
      */
-    using PerHostSet =
-        boost::intrusive::unordered_set<TranslateCachePerHost,
-                                        boost::intrusive::hash<TranslateCachePerHost::Hash>,
-                                        boost::intrusive::equal<TranslateCachePerHost::Equal>,
+    using PerTagSet =
+        boost::intrusive::unordered_set<TranslateCachePerTag,
+                                        boost::intrusive::hash<TranslateCachePerTag::Hash>,
+                                        boost::intrusive::equal<TranslateCachePerTag::Equal>,
                                         boost::intrusive::constant_time_size<false>>;
-    PerHostSet per_host;
+    PerTagSet per_tag;
 
     /**
      * This hash table maps each site name to a
@@ -366,22 +509,66 @@ struct tcache {
      */
     bool active;
 
+    /**
+     * Incremented for each new item.
+     */
+    uint64_t generation = 0;
+
+    /**
+     * All items whose #TranslateCacheItem::generation is older than
+     * this have been invalidated by an INVALIDATE which matches all
+     * items; they are invalid, and #sweep_event removes them
+     * incrementally.
+     */
+    uint64_t flush_generation = 0;
+
+    /**
+     * Removes items older than #flush_generation in small portions,
+     * to avoid blocking the event loop for too long.
+     */
+    DeferEvent sweep_event;
+
+    /**
+     * The maximum duration of one #sweep_event run.
+     */
+    const Event::Duration sweep_budget;
+
     static constexpr size_t N_BUCKETS = 3779;
-    PerHostSet::bucket_type per_host_buckets[N_BUCKETS];
+    PerTagSet::bucket_type per_tag_buckets[N_BUCKETS * 4];
     PerSiteSet::bucket_type per_site_buckets[N_BUCKETS];
 
     tcache(struct pool &_pool, EventLoop &event_loop,
            TranslationService &_next, unsigned max_size,
+           Event::Duration _sweep_budget,
            bool handshake_cacheable);
     tcache(struct tcache &) = delete;
 
     ~tcache() = default;
 
-    TranslateCachePerHost &MakePerHost(const char *host);
+    TranslateCachePerTag &MakePerTag(const TranslateCacheTagKey &key);
     TranslateCachePerSite &MakePerSite(const char *site);
 
-    unsigned InvalidateHost(const TranslateRequest &request,
-                            ConstBuffer<TranslationCommand> vary);
+    void AddTag(TranslateCacheItem &item,
+                TranslationCommand command, ConstBuffer<void> value);
+    void AddTags(TranslateCacheItem &item, const char *key);
+
+    /**
+     * Find the smallest #TranslateCachePerTag which contains all
+     * items which may match the given (non-empty) INVALIDATE.
+     *
+     * @return nullptr if no item can match
+     */
+    gcc_pure
+    TranslateCachePerTag *FindInvalidateTag(const TranslateRequest &request,
+                                            ConstBuffer<TranslationCommand> vary) noexcept;
+
+    /**
+     * Invalidate all items.  They will be removed incrementally by
+     * #sweep_event.
+     */
+    void InvalidateAll() noexcept;
+
+    void OnSweep() noexcept;
 
     unsigned InvalidateSite(const TranslateRequest &request,
                             ConstBuffer<TranslationCommand> vary,
@@ -424,57 +611,81 @@ struct TranslateCacheRequest {
     TranslateCacheRequest(TranslateCacheRequest &) = delete;
 };
 
-inline TranslateCachePerHost &
-tcache::MakePerHost(const char *host)
+inline TranslateCachePerTag &
+tcache::MakePerTag(const TranslateCacheTagKey &key)
 {
-    assert(host != nullptr);
-
-    PerHostSet::insert_commit_data commit_data;
-    auto result = per_host.insert_check(host, TranslateCachePerHost::KeyHasher,
-                                        TranslateCachePerHost::KeyValueEqual,
-                                        commit_data);
+    PerTagSet::insert_commit_data commit_data;
+    auto result = per_tag.insert_check(key, TranslateCachePerTag::KeyHasher,
+                                       TranslateCachePerTag::KeyValueEqual,
+                                       commit_data);
     if (!result.second)
         return *result.first;
 
-    auto ph = new TranslateCachePerHost(*this, host);
-    per_host.insert_commit(*ph, commit_data);
+    auto pt = new TranslateCachePerTag(*this, key);
+    per_tag.insert_commit(*pt, commit_data);
 
-    return *ph;
+    return *pt;
 }
 
-static void
-tcache_add_per_host(struct tcache &tcache, TranslateCacheItem *item)
+inline void
+tcache::AddTag(TranslateCacheItem &item,
+               TranslationCommand command, ConstBuffer<void> value)
 {
-    assert(item->response.VaryContains(TranslationCommand::HOST));
+    assert(!value.IsNull());
 
-    const char *host = item->request.host;
-    if (host == nullptr)
-        host = "";
+    auto &tag = MakePerTag({command, value});
 
-    TranslateCachePerHost &per_host = tcache.MakePerHost(host);
-    per_host.items.push_back(*item);
-    item->per_host = &per_host;
+    for (const auto *i = item.tags; i != nullptr; i = i->next)
+        if (&i->tag == &tag)
+            /* duplicate VARY command */
+            return;
+
+    auto *link = NewFromPool<TranslateCacheTagLink>(item.GetPool(),
+                                                    item, tag);
+    tag.links.push_back(*link);
+    item.tags = link;
+}
+
+inline void
+tcache::AddTags(TranslateCacheItem &item, const char *key)
+{
+    /* see tcache_uri_match() */
+    const char *uri = strchr(key, '/');
+    if (uri != nullptr)
+        AddTag(item, TranslationCommand::URI, StringView(uri).ToVoid());
+
+    for (const auto command : item.response.vary) {
+        if (!IsTagCommand(command))
+            continue;
+
+        const auto value = GetTagValue(item.request, command);
+        if (value.IsNull())
+            /* this item cannot match any INVALIDATE with this
+               command */
+            continue;
+
+        AddTag(item, NormalizeTagCommand(command), value);
+    }
 }
 
 void
-TranslateCachePerHost::Dispose()
+TranslateCachePerTag::Dispose()
 {
-    assert(items.empty());
+    assert(links.empty());
 
-    tcache.per_host.erase(tcache.per_host.iterator_to(*this));
+    tcache.per_tag.erase(tcache.per_tag.iterator_to(*this));
 
     delete this;
 }
 
 void
-TranslateCachePerHost::Erase(TranslateCacheItem &item)
+TranslateCachePerTag::Erase(TranslateCacheTagLink &link)
 {
-    assert(item.per_host == this);
-    assert(item.response.VaryContains(TranslationCommand::HOST));
+    assert(&link.tag == this);
 
-    items.erase(items.iterator_to(item));
+    links.erase(links.iterator_to(link));
 
-    if (items.empty())
+    if (links.empty())
         Dispose();
 }
 
@@ -1011,63 +1222,96 @@ tcache_lookup(struct pool &pool, struct tcache &tcache,
     return nullptr;
 }
 
-struct tcache_invalidate_data {
-    const TranslateRequest *request;
+inline TranslateCachePerTag *
+tcache::FindInvalidateTag(const TranslateRequest &request,
+                          ConstBuffer<TranslationCommand> vary) noexcept
+{
+    TranslateCachePerTag *best = nullptr;
+
+    for (const auto command : vary) {
+        ConstBuffer<void> value;
+        if (command == TranslationCommand::URI)
+            value = StringView(request.uri).ToVoid();
+        else if (IsTagCommand(command))
+            value = GetTagValue(request, command);
+        else {
+            /* unknown commands never match in strict mode (see
+               TranslateCacheItem::VaryMatch()) */
+            return nullptr;
+        }
 
-    ConstBuffer<TranslationCommand> vary;
+        if (value.IsNull()) {
+            /* nullptr values never match in strict mode */
+            return nullptr;
+        }
 
-    const char *site;
- };
+        const TranslateCacheTagKey key{NormalizeTagCommand(command), value};
+        auto i = per_tag.find(key, TranslateCachePerTag::KeyHasher,
+                              TranslateCachePerTag::KeyValueEqual);
+        if (i == per_tag.end()) {
+            /* no item has this value */
+            return nullptr;
+        }
 
-static bool
-tcache_invalidate_match(const CacheItem *_item, void *ctx)
-{
-    const TranslateCacheItem &item = *(const TranslateCacheItem *)_item;
-    const tcache_invalidate_data &data = *(const tcache_invalidate_data *)ctx;
+        if (best == nullptr || i->links.size() < best->links.size())
+            best = &*i;
+    }
 
-    return item.InvalidateMatch(data.vary, *data.request, data.site);
+    return best;
 }
 
 inline unsigned
-tcache::InvalidateHost(const TranslateRequest &request,
-                       ConstBuffer<TranslationCommand> vary)
+TranslateCachePerTag::Invalidate(const TranslateRequest &request,
+                                 ConstBuffer<TranslationCommand> vary)
 {
-    const char *host = request.host;
-    if (host == nullptr)
-        host = "";
+    /* collect the matching items first, because removing them may
+       dispose this object */
+    std::vector<TranslateCacheItem *> matches;
+    for (auto &link : links)
+        if (link.item.InvalidateMatch(vary, request))
+            matches.push_back(&link.item);
 
-    auto ph = per_host.find(host, TranslateCachePerHost::KeyHasher,
-                            TranslateCachePerHost::KeyValueEqual);
-    if (ph == per_host.end())
-        return 0;
+    for (auto *item : matches)
+        tcache.cache.Remove(*item);
 
-    assert(&ph->tcache == this);
-    assert(ph->host == host);
+    return matches.size();
+}
 
-    return ph->Invalidate(request, vary);
+void
+tcache::InvalidateAll() noexcept
+{
+    /* invalidate all existing items immediately (see
+       TranslateCacheItem::Validate()), but remove them later */
+    flush_generation = generation;
+
+    cache.StartSweep();
+    sweep_event.Schedule();
 }
 
-inline unsigned
-TranslateCachePerHost::Invalidate(const TranslateRequest &request,
-                                  ConstBuffer<TranslationCommand> vary)
+static bool
+tcache_sweep_match(const CacheItem *_item, void *ctx) noexcept
 {
-    unsigned n_removed = 0;
+    const auto &item = *(const TranslateCacheItem *)_item;
+    const auto &tcache = *(const struct tcache *)ctx;
 
-    items.remove_and_dispose_if([&request, vary](const TranslateCacheItem &item){
-            return item.InvalidateMatch(vary, request);
-        },
-        [&n_removed, this](TranslateCacheItem *item){
-            assert(item->per_host == this);
-            item->per_host = nullptr;
+    return item.generation < tcache.flush_generation;
+}
 
-            tcache.cache.Remove(*item);
-            ++n_removed;
-        });
+void
+tcache::OnSweep() noexcept
+{
+    const auto start = std::chrono::steady_clock::now();
+    unsigned n_removed = 0;
 
-    if (items.empty())
-        Dispose();
+    while (!cache.SweepStep(256, tcache_sweep_match, this, n_removed)) {
+        if (std::chrono::steady_clock::now() - start >= sweep_budget) {
+            /* continue in the next event loop iteration */
+            sweep_event.Schedule();
+            break;
+        }
+    }
 
-    return n_removed;
+    LogConcat(5, "TranslationCache", "swept ", n_removed, " cache items");
 }
 
 inline unsigned
@@ -1116,18 +1360,23 @@ tcache::Invalidate(const TranslateRequest &request,
                    ConstBuffer<TranslationCommand> vary,
                    const char *site) noexcept
 {
-    struct tcache_invalidate_data data = {
-        .request = &request,
-        .vary = vary,
-        .site = site,
-    };
+    if (site == nullptr && vary.empty()) {
+        LogConcat(4, "TranslationCache", "invalidating all cache items");
+        InvalidateAll();
+        return;
+    }
+
+    unsigned removed;
+
+    if (site != nullptr)
+        removed = InvalidateSite(request, vary, site);
+    else {
+        auto *tag = FindInvalidateTag(request, vary);
+        removed = tag != nullptr
+            ? tag->Invalidate(request, vary)
+            : 0;
+    }
 
-    gcc_unused
-    unsigned removed = site != nullptr
-        ? InvalidateSite(request, vary, site)
-        : (vary.Contains(TranslationCommand::HOST)
-           ? InvalidateHost(request, vary)
-           : cache.RemoveAllMatch(tcache_invalidate_match, &data));
     LogConcat(4, "TranslationCache", "invalidated ", removed, " cache items");
 }
 
@@ -1153,6 +1402,8 @@ tcache_store(TranslateCacheRequest &tcr, const TranslateResponse &response)
 
     auto item = NewFromPool<TranslateCacheItem>(pool_new_slice(tcr.tcache->pool, "tcache_item",
                                                                &tcr.tcache->slice_pool),
+                                                *tcr.tcache,
+                                                tcr.tcache->generation++,
                                                 tcr.tcache->cache.SteadyNow(),
                                                 max_age);
 
@@ -1244,8 +1495,7 @@ tcache_store(TranslateCacheRequest &tcr, const TranslateResponse &response)
         }
     }
 
-    if (response.VaryContains(TranslationCommand::HOST))
-        tcache_add_per_host(*tcr.tcache, item);
+    tcr.tcache->AddTags(*item, key);
 
     if (response.site != nullptr)
         tcache_add_per_site(*tcr.tcache, item);
@@ -1442,14 +1692,15 @@ tcache_validate_mtime(const TranslateResponse &response,
 bool
 TranslateCacheItem::Validate() const noexcept
 {
-    return tcache_validate_mtime(response, GetKey());
+    return generation >= tcache.flush_generation &&
+        tcache_validate_mtime(response, GetKey());
 }
 
 void
 TranslateCacheItem::Destroy() noexcept
 {
-    if (per_host != nullptr)
-        per_host->Erase(*this);
+    for (auto *i = tags; i != nullptr; i = i->next)
+        i->tag.Erase(*i);
 
     if (per_site != nullptr)
         per_site->Erase(*this);
@@ -1466,13 +1717,16 @@ TranslateCacheItem::Destroy() noexcept
 inline
 tcache::tcache(struct pool &_pool, EventLoop &event_loop,
                TranslationService &_next, unsigned max_size,
+               Event::Duration _sweep_budget,
                bool handshake_cacheable)
     :pool(pool_new_libc(&_pool, "translate_cache")),
      slice_pool(4096, 32768),
      cache(event_loop, 65521, max_size),
-     per_host(PerHostSet::bucket_traits(per_host_buckets, N_BUCKETS)),
+     per_tag(PerTagSet::bucket_traits(per_tag_buckets, N_BUCKETS * 4)),
      per_site(PerSiteSet::bucket_traits(per_site_buckets, N_BUCKETS)),
-     next(_next), active(handshake_cacheable)
+     next(_next), active(handshake_cacheable),
+     sweep_event(event_loop, BIND_THIS_METHOD(OnSweep)),
+     sweep_budget(_sweep_budget)
 {
     assert(max_size > 0);
 }
@@ -1480,9 +1734,10 @@ tcache::tcache(struct pool &_pool, EventLoop &event_loop,
 TranslationCache::TranslationCache(struct pool &pool, EventLoop &event_loop,
                                    TranslationService &next,
                                    unsigned max_size,
+                                   Event::Duration sweep_budget,
                                    bool handshake_cacheable)
     :cache(new tcache(pool, event_loop, next, max_size,
-                      handshake_cacheable))
+                      sweep_budget, handshake_cacheable))
 {
 }
 
@@ -33,6 +33,7 @@
 #pragma once
 
 #include "Service.hxx"
+#include "event/Chrono.hxx"
 #include "util/Compiler.h"
 
 #include <memory>
@@ -54,12 +55,15 @@ class TranslationCache final : public TranslationService {
 
 public:
     /**
+     * @param sweep_budget the maximum duration of one step of the
+     * incremental sweep after a wildcard invalidation
      * @param handshake_cacheable if false, then all requests are
      * deemed uncacheable until the first response is received
      */
     TranslationCache(struct pool &pool, EventLoop &event_loop,
                      TranslationService &next,
-                     unsigned max_size, bool handshake_cacheable=true);
+                     unsigned max_size, Event::Duration sweep_budget,
+                     bool handshake_cacheable=true);
 
     ~TranslationCache() noexcept;
 
@@ -33,6 +33,7 @@
 #include "ua_classification.hxx"
 #include "regex.hxx"
 #include "system/Error.hxx"
+#include "util/Cache.hxx"
 #include "util/StringStrip.hxx"
 #include "util/CharUtil.hxx"
 #include "util/ScopeExit.hxx"
@@ -40,10 +41,12 @@
 #include <stdexcept>
 #include <forward_list>
 #include <string>
+#include <vector>
 
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 
 struct UserAgentClass {
@@ -53,10 +56,43 @@ struct UserAgentClass {
 
 typedef std::forward_list<UserAgentClass> UserAgentClassList;
 
-static UserAgentClassList *ua_classes;
+struct UserAgentClassification {
+    UserAgentClassList classes;
+
+    /**
+     * All #classes, indexed by the "(*MARK)" names in #combined.
+     */
+    std::vector<const UserAgentClass *> by_index;
+
+    /**
+     * All regular expressions combined into one alternation which
+     * reports the index of the first matching class with "(*MARK)".
+     * Undefined if that could not be built; #classes is then
+     * matched one by one.
+     */
+    UniqueRegex combined;
+
+    /**
+     * User-Agent strings longer than this are not cached.
+     */
+    static constexpr size_t MAX_CACHED_LENGTH = 512;
+
+    /**
+     * Recently seen User-Agent strings and their classes (nullptr if
+     * none matched).
+     */
+    Cache<std::string, const UserAgentClass *, 1024, 1021> cache;
+
+    void Combine(const std::string &pattern) noexcept;
+
+    gcc_pure
+    const UserAgentClass *Match(const char *user_agent) const noexcept;
+};
+
+static UserAgentClassification *ua_classification;
 
 static bool
-parse_line(UserAgentClass &cls, char *line)
+parse_line(UserAgentClass &cls, char *line, std::string &pattern)
 {
     if (*line == 'm')
         ++line;
@@ -93,13 +129,82 @@ parse_line(UserAgentClass &cls, char *line)
     cls.regex.Compile(r, false, false);
 
     cls.name = name;
+    pattern = r;
     return true;
 }
 
+/**
+ * Does this regular expression refer to group numbers or to the
+ * match start position, or does it contain a verb like "(*COMMIT)",
+ * "(*PRUNE)", "(*SKIP)" or "(*MARK)"?  These would change their
+ * meaning inside the combined pattern: the backtracking verbs would
+ * abort the other alternatives, and a mark would replace the class
+ * index.
+ */
+gcc_pure
+static bool
+IsPositionDependent(const char *pattern) noexcept
+{
+    for (const char *p = pattern; *p != 0; ++p) {
+        if (*p == '\\') {
+            ++p;
+            if (IsDigitASCII(*p) || *p == 'g' || *p == 'k' || *p == 'G')
+                return true;
+            if (*p == 0)
+                break;
+        } else if (p[0] == '(' && p[1] == '?' && p[2] == 'P' && p[3] == '=')
+            return true;
+        else if (p[0] == '(' && p[1] == '*')
+            /* any verb (including "(*THEN)", "(*ACCEPT)" and the
+               start-of-pattern options like "(*UTF8)") */
+            return true;
+    }
+
+    return false;
+}
+
+void
+UserAgentClassification::Combine(const std::string &pattern) noexcept
+{
+    try {
+        combined.Compile(pattern.c_str(), false, false);
+    } catch (...) {
+        /* too complex for one pattern; fall back to matching the
+           classes one by one */
+    }
+}
+
+const UserAgentClass *
+UserAgentClassification::Match(const char *user_agent) const noexcept
+{
+    if (combined.IsDefined()) {
+        const char *mark = combined.MatchMark(user_agent);
+        if (mark == nullptr)
+            return nullptr;
+
+        const unsigned long i = strtoul(mark, nullptr, 10);
+        assert(i < by_index.size());
+        return by_index[i];
+    }
+
+    for (const auto &i : classes)
+        if (i.regex.Match(user_agent))
+            return &i;
+
+    return nullptr;
+}
+
 static void
-ua_classification_init(UserAgentClassList &list, FILE *file)
+ua_classification_init(UserAgentClassification &uac, FILE *file)
 {
-    auto tail = ua_classes->before_begin();
+    auto tail = uac.classes.before_begin();
+
+    /* each alternative is anchored at the start and scans forward
+       by itself, so the first class in the file wins (just like
+       when matching them one by one), not the one which matches
+       earliest in the string */
+    std::string combined = "^(?:";
+    bool can_combine = true;
 
     char line[1024];
     while (fgets(line, sizeof(line), file) != nullptr) {
@@ -109,10 +214,28 @@ ua_classification_init(UserAgentClassList &list, FILE *file)
             continue;
 
         UserAgentClass cls;
-        parse_line(cls, p);
+        std::string pattern;
+        parse_line(cls, p, pattern);
 
-        tail = list.emplace_after(tail, std::move(cls));
+        if (IsPositionDependent(pattern.c_str()))
+            can_combine = false;
+
+        if (!uac.by_index.empty())
+            combined.push_back('|');
+        combined += ".*?(?:";
+        combined += pattern;
+        combined += ")(*MARK:";
+        combined += std::to_string(uac.by_index.size());
+        combined.push_back(')');
+
+        tail = uac.classes.emplace_after(tail, std::move(cls));
+        uac.by_index.push_back(&*tail);
     }
+
+    combined.push_back(')');
+
+    if (can_combine && !uac.by_index.empty())
+        uac.Combine(combined);
 }
 
 void
@@ -127,9 +250,9 @@ ua_classification_init(const char *path)
 
     AtScopeExit(file) { fclose(file); };
 
-    ua_classes = new UserAgentClassList();
+    ua_classification = new UserAgentClassification();
     try {
-        ua_classification_init(*ua_classes, file);
+        ua_classification_init(*ua_classification, file);
     } catch (...) {
         ua_classification_deinit();
         throw;
@@ -139,25 +262,49 @@ ua_classification_init(const char *path)
 void
 ua_classification_deinit()
 {
-    if (ua_classes == nullptr)
+    if (ua_classification == nullptr)
         return;
 
-    delete ua_classes;
-    ua_classes = nullptr;
+    delete ua_classification;
+    ua_classification = nullptr;
+}
+
+const char *
+ua_classification_lookup_uncached(const char *user_agent)
+{
+    assert(user_agent != nullptr);
+
+    if (ua_classification == nullptr)
+        return nullptr;
+
+    const auto *cls = ua_classification->Match(user_agent);
+    return cls != nullptr ? cls->name.c_str() : nullptr;
 }
 
-gcc_pure
 const char *
 ua_classification_lookup(const char *user_agent)
 {
     assert(user_agent != nullptr);
 
-    if (ua_classes == nullptr)
+    if (ua_classification == nullptr)
         return nullptr;
 
-    for (const auto &i : *ua_classes)
-        if (i.regex.Match(user_agent))
-            return i.name.c_str();
+    auto &uac = *ua_classification;
 
-    return nullptr;
+    const size_t length = strlen(user_agent);
+    if (length > uac.MAX_CACHED_LENGTH)
+        return ua_classification_lookup_uncached(user_agent);
+
+    std::string key(user_agent, length);
+
+    const UserAgentClass *const*cached = uac.cache.Get(key);
+    const UserAgentClass *cls;
+    if (cached != nullptr) {
+        cls = *cached;
+    } else {
+        cls = uac.Match(user_agent);
+        uac.cache.Put(std::move(key), cls);
+    }
+
+    return cls != nullptr ? cls->name.c_str() : nullptr;
 }
@@ -44,8 +44,20 @@ ua_classification_init(const char *path);
 void
 ua_classification_deinit();
 
-gcc_pure
+/**
+ * Determine the class of the given User-Agent string.  Recent
+ * results are cached.  This function is not thread-safe.
+ *
+ * @return the class name or nullptr if no class matches
+ */
 const char *
 ua_classification_lookup(const char *user_agent);
 
+/**
+ * Like ua_classification_lookup(), but bypass the cache.
+ */
+gcc_pure
+const char *
+ua_classification_lookup_uncached(const char *user_agent);
+
 #endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "uring_glue.hxx"
+#include "io/uring/Manager.hxx"
+
+#include <stdexcept>
+
+#include <assert.h>
+
+static Uring::Manager *uring_manager;
+
+void
+uring_glue_init(EventLoop &event_loop)
+{
+    assert(uring_manager == nullptr);
+
+    auto *manager = new Uring::Manager(event_loop);
+
+    if (!manager->HasFeature(IORING_FEAT_RW_CUR_POS)) {
+        /* FileIstream relies on reads at the current file
+           position (Linux 5.6) */
+        delete manager;
+        throw std::runtime_error("io_uring lacks IORING_FEAT_RW_CUR_POS");
+    }
+
+    uring_manager = manager;
+}
+
+void
+uring_glue_deinit() noexcept
+{
+    delete uring_manager;
+    uring_manager = nullptr;
+}
+
+Uring::Queue *
+uring_glue_get() noexcept
+{
+    return uring_manager;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The global io_uring instance which is used for file I/O.
+ */
+
+#ifndef BENG_PROXY_URING_GLUE_HXX
+#define BENG_PROXY_URING_GLUE_HXX
+
+#include "util/Compiler.h"
+
+class EventLoop;
+namespace Uring { class Queue; }
+
+/**
+ * Global initialization.  Must be called in each process which
+ * shall use io_uring (i.e. after fork()).
+ *
+ * Throws on error, e.g. if the kernel does not support io_uring.
+ */
+void
+uring_glue_init(EventLoop &event_loop);
+
+/**
+ * Global deinitialization.  Waits for pending operations to
+ * complete.  May be called even if uring_glue_init() was not.
+ */
+void
+uring_glue_deinit() noexcept;
+
+/**
+ * @return the global io_uring instance or nullptr if it was not
+ * initialized
+ */
+gcc_pure
+Uring::Queue *
+uring_glue_get() noexcept;
+
+#endif
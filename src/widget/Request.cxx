@@ -48,6 +48,7 @@
 #include "http/HeaderWriter.hxx"
 #include "bp/ForwardHeaders.hxx"
 #include "bp/Global.hxx"
+#include "bp/YamlSubstCache.hxx"
 #include "translation/Transformation.hxx"
 #include "resource_tag.hxx"
 #include "uri/Extract.hxx"
@@ -171,7 +172,7 @@ private:
      */
     void ProcessResponse(http_status_t status,
                          StringMap &headers, UnusedIstreamPtr body,
-                         unsigned options);
+                         unsigned options, const char *source_tag);
 
     void CssProcessResponse(http_status_t status,
                             StringMap &headers, UnusedIstreamPtr body,
@@ -326,7 +327,7 @@ WidgetRequest::DispatchError(std::exception_ptr ep)
 void
 WidgetRequest::ProcessResponse(http_status_t status,
                                StringMap &headers, UnusedIstreamPtr body,
-                               unsigned options)
+                               unsigned options, const char *source_tag)
 {
     if (!body) {
         /* this should not happen, but we're ignoring this formal
@@ -345,13 +346,14 @@ WidgetRequest::ProcessResponse(http_status_t status,
     if (lookup_id != nullptr)
         processor_lookup_widget(pool, std::move(body),
                                 widget, lookup_id,
-                                env, options,
+                                env, options, source_tag,
                                 *lookup_handler,
                                 cancel_ptr);
     else
         DispatchResponse(status, processor_header_forward(pool, headers),
                          processor_process(pool, std::move(body),
-                                           widget, env, options));
+                                           widget, env, options,
+                                           source_tag));
 }
 
 static bool
@@ -447,9 +449,14 @@ WidgetRequest::SubstResponse(http_status_t status,
 {
     try {
         InvokeResponse(status, std::move(headers),
-                       NewYamlSubstIstream(pool, std::move(body),
-                                           subst_alt_syntax,
-                                           prefix, yaml_file, yaml_map_path));
+                       global_yaml_subst_cache != nullptr
+                       ? global_yaml_subst_cache->NewIstream(pool, std::move(body),
+                                                             subst_alt_syntax,
+                                                             prefix, yaml_file,
+                                                             yaml_map_path)
+                       : NewYamlSubstIstream(pool, std::move(body),
+                                             subst_alt_syntax,
+                                             prefix, yaml_file, yaml_map_path));
     } catch (...) {
         DispatchError(std::current_exception());
     }
@@ -471,13 +478,17 @@ WidgetRequest::TransformResponse(http_status_t status,
     }
 
     switch (t.type) {
-    case Transformation::Type::PROCESS:
-        /* processor responses cannot be cached */
+    case Transformation::Type::PROCESS: {
+        /* the template may be cached by the processor, but processor
+           responses cannot be cached */
+        const char *source_tag = resource_tag_append_etag(&pool, resource_tag,
+                                                          headers);
         resource_tag = nullptr;
 
         ProcessResponse(status, headers, std::move(body),
-                        t.u.processor.options);
+                        t.u.processor.options, source_tag);
         break;
+    }
 
     case Transformation::Type::PROCESS_CSS:
         /* processor responses cannot be cached */
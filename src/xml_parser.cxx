@@ -33,6 +33,7 @@
 #include "xml_parser.hxx"
 #include "pool/pool.hxx"
 #include "html_chars.hxx"
+#include "CharScan.hxx"
 #include "expansible_buffer.hxx"
 #include "istream/Sink.hxx"
 #include "istream/UnusedPtr.hxx"
@@ -186,6 +187,29 @@ private:
     }
 };
 
+/**
+ * Append a lower-case copy of the name characters [src, src_end) to
+ * the given buffer and advance #src.
+ *
+ * @return false if the buffer overflowed; it has then been filled
+ * up, and #src points to the first character which did not fit
+ */
+template<size_t max>
+static bool
+AppendName(char (&dest)[max], size_t &length,
+           const char *&src, const char *src_end) noexcept
+{
+    size_t n = src_end - src;
+    const bool fits = n <= max - length;
+    if (!fits)
+        n = max - length;
+
+    for (size_t i = 0; i < n; ++i)
+        dest[length++] = ToLowerASCII(*src++);
+
+    return fits;
+}
+
 inline size_t
 XmlParser::Feed(const char *start, size_t length) noexcept
 {
@@ -258,13 +282,13 @@ XmlParser::Feed(const char *start, size_t length) noexcept
             /* copy element name */
             while (buffer < end) {
                 if (is_html_name_char(*buffer)) {
-                    if (tag_name_length == sizeof(tag_name)) {
+                    p = FindNonHtmlNameChar(buffer, end);
+                    if (!AppendName(tag_name, tag_name_length,
+                                    buffer, p)) {
                         /* name buffer overflowing */
                         state = State::NONE;
                         break;
                     }
-
-                    tag_name[tag_name_length++] = ToLowerASCII(*buffer++);
                 } else if (*buffer == '/' && tag_name_length == 0) {
                     tag.type = XmlParserTagType::CLOSE;
                     ++buffer;
@@ -298,7 +322,7 @@ XmlParser::Feed(const char *start, size_t length) noexcept
         case State::ELEMENT_TAG:
             do {
                 if (IsWhitespaceOrNull(*buffer)) {
-                    ++buffer;
+                    buffer = SkipWhitespaceOrNull(buffer + 1, end);
                 } else if (*buffer == '/' && tag.type == XmlParserTagType::OPEN) {
                     tag.type = XmlParserTagType::SHORT;
                     state = State::SHORT;
@@ -357,13 +381,13 @@ XmlParser::Feed(const char *start, size_t length) noexcept
             /* copy attribute name */
             do {
                 if (is_html_name_char(*buffer)) {
-                    if (attr_name_length == sizeof(attr_name)) {
+                    p = FindNonHtmlNameChar(buffer, end);
+                    if (!AppendName(attr_name, attr_name_length,
+                                    buffer, p)) {
                         /* name buffer overflowing */
                         state = State::ELEMENT_TAG;
                         break;
                     }
-
-                    attr_name[attr_name_length++] = ToLowerASCII(*buffer++);
                 } else {
                     state = State::AFTER_ATTR_NAME;
                     break;
@@ -444,12 +468,13 @@ XmlParser::Feed(const char *start, size_t length) noexcept
             /* wait till the value is finished */
             do {
                 if (!IsWhitespaceOrNull(*buffer) && *buffer != '>') {
-                    if (!attr_value.Write(buffer, 1)) {
+                    p = FindHtmlUnquotedValueEnd(buffer, end);
+                    if (!attr_value.Write(buffer, p - buffer)) {
                         state = State::ELEMENT_TAG;
                         break;
                     }
 
-                    ++buffer;
+                    buffer = p;
                 } else {
                     attr.value_end = attr.end =
                         position + (off_t)(buffer - start);
@@ -537,7 +562,6 @@ XmlParser::Feed(const char *start, size_t length) noexcept
         case State::CDATA_SECTION:
             /* copy CDATA section contents */
 
-            /* XXX this loop can be optimized with memchr() */
             p = buffer;
             while (buffer < end) {
                 if (*buffer == ']' && cdend_match < 2) {
@@ -586,7 +610,11 @@ XmlParser::Feed(const char *start, size_t length) noexcept
                         p = buffer;
                     }
 
-                    ++buffer;
+                    /* skip to the next ']' */
+                    buffer = (const char *)memchr(buffer + 1, ']',
+                                                  end - buffer - 1);
+                    if (buffer == nullptr)
+                        buffer = end;
                 }
             }
 
@@ -0,0 +1,254 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for #FileIstream: read a file many times with several
+ * concurrent streams and print the throughput.  With "--uring", the
+ * reads are submitted to io_uring; compare with the same invocation
+ * without this option.
+ */
+
+#include "istream/FileIstream.hxx"
+#include "istream/Handler.hxx"
+#include "istream/Pointer.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "fb_pool.hxx"
+#include "PInstance.hxx"
+#include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
+#include "event/DeferEvent.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+
+#ifdef HAVE_URING
+#include "uring_glue.hxx"
+#endif
+
+#include <chrono>
+#include <forward_list>
+
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Usage {};
+
+struct Benchmark {
+    EventLoop &event_loop;
+    struct pool &root_pool;
+
+    const char *const path;
+
+    /**
+     * The number of files which still need to be opened.
+     */
+    unsigned remaining;
+
+    unsigned n_running = 0;
+
+    uint64_t n_bytes = 0;
+
+    bool failed = false;
+
+    Benchmark(EventLoop &_event_loop, struct pool &_root_pool,
+              const char *_path, unsigned _count) noexcept
+        :event_loop(_event_loop), root_pool(_root_pool),
+         path(_path), remaining(_count) {}
+
+    void OnSinkFinished() noexcept {
+        if (--n_running == 0)
+            event_loop.Break();
+    }
+};
+
+/**
+ * Reads one file after another, and discards the data.  Like a
+ * socket which is always writable, it requests more data as soon as
+ * it has consumed the previous chunk.
+ */
+class BenchmarkSink final : IstreamHandler {
+    Benchmark &benchmark;
+
+    DeferEvent defer_read;
+
+    PoolPtr pool;
+
+    IstreamPointer input;
+
+public:
+    explicit BenchmarkSink(Benchmark &_benchmark) noexcept
+        :benchmark(_benchmark),
+         defer_read(benchmark.event_loop, BIND_THIS_METHOD(OnDeferredRead)),
+         input(nullptr)
+    {
+        ++benchmark.n_running;
+    }
+
+    void Start() noexcept {
+        if (OpenNext())
+            defer_read.Schedule();
+        else
+            benchmark.OnSinkFinished();
+    }
+
+private:
+    bool OpenNext() noexcept {
+        pool.reset();
+
+        if (benchmark.remaining == 0 || benchmark.failed)
+            return false;
+
+        --benchmark.remaining;
+
+        pool = pool_new_linear(&benchmark.root_pool, "BenchmarkSink", 1024);
+
+        try {
+            struct stat st;
+            input.Set(UnusedIstreamPtr(istream_file_stat_new(benchmark.event_loop,
+                                                             *pool,
+                                                             benchmark.path,
+                                                             st)),
+                      *this);
+        } catch (...) {
+            PrintException(std::current_exception());
+            benchmark.failed = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    void OnDeferredRead() noexcept {
+        input.Read();
+    }
+
+    void Next() noexcept {
+        input.Clear();
+
+        if (OpenNext())
+            defer_read.Schedule();
+        else
+            benchmark.OnSinkFinished();
+    }
+
+    /* virtual methods from class IstreamHandler */
+
+    size_t OnData(const void *, size_t length) noexcept override {
+        benchmark.n_bytes += length;
+        defer_read.Schedule();
+        return length;
+    }
+
+    void OnEof() noexcept override {
+        Next();
+    }
+
+    void OnError(std::exception_ptr ep) noexcept override {
+        PrintException(ep);
+        benchmark.failed = true;
+        Next();
+    }
+};
+
+int
+main(int argc, char **argv)
+try {
+    ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+    bool use_uring = false;
+    if (!args.empty() && strcmp(args.front(), "--uring") == 0) {
+        args.shift();
+        use_uring = true;
+    }
+
+    if (args.empty())
+        throw Usage();
+
+    const char *const path = args.shift();
+    const unsigned n_parallel = args.empty() ? 16 : strtoul(args.shift(), nullptr, 10);
+    const unsigned count = args.empty() ? 1024 : strtoul(args.shift(), nullptr, 10);
+
+    if (!args.empty() || n_parallel == 0)
+        throw Usage();
+
+    const ScopeFbPoolInit fb_pool_init;
+    PInstance instance;
+
+    if (use_uring) {
+#ifdef HAVE_URING
+        uring_glue_init(instance.event_loop);
+#else
+        fprintf(stderr, "io_uring support is disabled\n");
+        return EXIT_FAILURE;
+#endif
+    }
+
+    Benchmark benchmark(instance.event_loop, instance.root_pool,
+                        path, count);
+
+    std::forward_list<BenchmarkSink> sinks;
+    for (unsigned i = 0; i < n_parallel; ++i)
+        sinks.emplace_front(benchmark);
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    for (auto &i : sinks)
+        i.Start();
+
+    if (benchmark.n_running > 0)
+        instance.event_loop.Dispatch();
+
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start_time;
+
+    sinks.clear();
+
+#ifdef HAVE_URING
+    uring_glue_deinit();
+#endif
+
+    printf("%s: %llu bytes in %.3f s = %.1f MB/s\n",
+           use_uring ? "io_uring" : "read",
+           (unsigned long long)benchmark.n_bytes,
+           duration.count(),
+           benchmark.n_bytes / duration.count() / (1024 * 1024));
+
+    return benchmark.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+} catch (Usage) {
+    fprintf(stderr, "usage: %s [--uring] PATH [PARALLEL [COUNT]]\n", argv[0]);
+    return EXIT_FAILURE;
+} catch (...) {
+    PrintException(std::current_exception());
+    return EXIT_FAILURE;
+}
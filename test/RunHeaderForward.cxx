@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for #StringMap: parse the request headers of typical
+ * browser requests and forward them with the default settings, like
+ * a request passing through beng-proxy would.
+ */
+
+#include "bp/ForwardHeaders.hxx"
+#include "http/HeaderParser.hxx"
+#include "pool/RootPool.hxx"
+#include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
+#include "strmap.hxx"
+#include "util/StringView.hxx"
+
+#include <chrono>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr const char *requests[] = {
+    /* Firefox */
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:70.0) Gecko/20100101 Firefox/70.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: de,en-US;q=0.7,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/\r\n"
+    "DNT: 1\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: beng_proxy_session=0123456789abcdef; _ga=GA1.2.123456789.1572000000\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Cache-Control: max-age=0\r\n",
+
+    /* Chrome */
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/78.0.3904.70 Safari/537.36\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Referer: https://www.example.com/foo/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: de-DE,de;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+    "Cookie: beng_proxy_session=0123456789abcdef; consent=yes\r\n"
+    "If-None-Match: \"5d8a1b2c-1f3e\"\r\n"
+    "If-Modified-Since: Tue, 24 Sep 2019 13:37:00 GMT\r\n",
+
+    /* XMLHttpRequest */
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/13.0.2 Safari/605.1.15\r\n"
+    "Accept: application/json, text/javascript, */*; q=0.01\r\n"
+    "Accept-Language: en-us\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Content-Type: application/x-www-form-urlencoded; charset=UTF-8\r\n"
+    "Content-Length: 42\r\n"
+    "X-Requested-With: XMLHttpRequest\r\n"
+    "Origin: https://www.example.com\r\n"
+    "Referer: https://www.example.com/form\r\n"
+    "Cookie: beng_proxy_session=0123456789abcdef\r\n"
+    "Connection: keep-alive\r\n",
+};
+
+static void
+ParseHeaders(struct pool &pool, StringMap &headers, const char *p) noexcept
+{
+    while (true) {
+        const char *eol = strchr(p, '\n');
+        if (eol == nullptr)
+            break;
+
+        StringView line(p, eol);
+        if (line.size > 0 && line.data[line.size - 1] == '\r')
+            --line.size;
+
+        header_parse_line(pool, headers, line);
+        p = eol + 1;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const unsigned count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    if (count == 0) {
+        fprintf(stderr, "usage: %s [COUNT]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const auto settings = HeaderForwardSettings::MakeDefaultRequest();
+
+    RootPool root_pool;
+
+    size_t n_forwarded = 0;
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < count; ++i) {
+        for (const char *request : requests) {
+            const auto pool = pool_new_linear(root_pool, "request", 8192);
+
+            StringMap headers(pool);
+            ParseHeaders(pool, headers, request);
+
+            const auto forwarded =
+                forward_request_headers(pool, headers,
+                                        "192.168.0.2", "192.168.0.3",
+                                        false, false, false, false, false,
+                                        settings,
+                                        "beng_proxy_session", nullptr,
+                                        "www.example.com", "/");
+
+            for (const auto &h : forwarded) {
+                (void)h;
+                ++n_forwarded;
+            }
+        }
+    }
+
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start_time;
+
+    const double n = double(std::size(requests)) * count;
+    printf("%.0f requests (%zu headers forwarded) in %.3f s = %.0f requests/s\n",
+           n, n_forwarded, duration.count(), n / duration.count());
+
+    return EXIT_SUCCESS;
+}
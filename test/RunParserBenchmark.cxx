@@ -0,0 +1,235 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Micro-benchmark for #XmlParser and #CssParser: parse a document
+ * (e.g. one of the inputs used with run_processor or run_css_parser)
+ * many times with each available CharScan implementation and print
+ * the throughput.
+ */
+
+#include "xml_parser.hxx"
+#include "css_parser.hxx"
+#include "CharScan.hxx"
+#include "istream/istream_memory.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "fb_pool.hxx"
+#include "PInstance.hxx"
+#include "pool/pool.hxx"
+#include "pool/Ptr.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+
+#include <chrono>
+#include <string>
+#include <system_error>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Usage {};
+
+static bool should_exit;
+
+class BenchmarkXmlParserHandler final : public XmlParserHandler {
+public:
+    /* virtual methods from class XmlParserHandler */
+    bool OnXmlTagStart(const XmlParserTag &) noexcept override {
+        /* parse all attributes */
+        return true;
+    }
+
+    bool OnXmlTagFinished(const XmlParserTag &) noexcept override {
+        return true;
+    }
+
+    void OnXmlAttributeFinished(const XmlParserAttribute &) noexcept override {}
+
+    size_t OnXmlCdata(const char *, size_t length, bool, off_t) noexcept override {
+        return length;
+    }
+
+    void OnXmlEof(off_t) noexcept override {
+        should_exit = true;
+    }
+
+    void OnXmlError(std::exception_ptr ep) noexcept override {
+        PrintException(ep);
+        exit(EXIT_FAILURE);
+    }
+};
+
+static void
+css_value_nop(const CssParserValue *, void *)
+{
+}
+
+static void
+css_property_keyword_nop(const char *, StringView, off_t, off_t, void *)
+{
+}
+
+static void
+css_eof(void *, off_t)
+{
+    should_exit = true;
+}
+
+static void
+css_error(std::exception_ptr ep, void *)
+{
+    PrintException(ep);
+    exit(EXIT_FAILURE);
+}
+
+static constexpr CssParserHandler css_handler = {
+    .class_name = css_value_nop,
+    .xml_id = css_value_nop,
+    .block = nullptr,
+    .property_keyword = css_property_keyword_nop,
+    .url = css_value_nop,
+    .import = css_value_nop,
+    .eof = css_eof,
+    .error = css_error,
+};
+
+static std::string
+LoadFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        throw std::system_error(errno, std::system_category(), path);
+
+    std::string result;
+    char buffer[65536];
+    size_t nbytes;
+    while ((nbytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        result.append(buffer, nbytes);
+
+    fclose(file);
+    return result;
+}
+
+static void
+ParseXml(struct pool &parent_pool, const std::string &data)
+{
+    const auto pool = pool_new_linear(&parent_pool, "xml", 8192);
+    BenchmarkXmlParserHandler handler;
+
+    should_exit = false;
+    auto *parser = parser_new(*pool,
+                              istream_memory_new(*pool, data.data(),
+                                                 data.size()),
+                              handler);
+    while (!should_exit)
+        parser_read(parser);
+}
+
+static void
+ParseCss(struct pool &parent_pool, const std::string &data)
+{
+    const auto pool = pool_new_linear(&parent_pool, "css", 8192);
+
+    should_exit = false;
+    auto *parser = css_parser_new(*pool,
+                                  istream_memory_new(*pool, data.data(),
+                                                     data.size()),
+                                  false, css_handler, nullptr);
+    while (!should_exit)
+        css_parser_read(parser);
+}
+
+int
+main(int argc, char **argv)
+try {
+    ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+    if (args.size < 2)
+        throw Usage();
+
+    const char *const mode = args.shift();
+    bool css;
+    if (strcmp(mode, "xml") == 0)
+        css = false;
+    else if (strcmp(mode, "css") == 0)
+        css = true;
+    else
+        throw Usage();
+
+    const char *const path = args.shift();
+    const unsigned count = args.empty() ? 1000 : strtoul(args.shift(), nullptr, 10);
+
+    if (!args.empty() || count == 0)
+        throw Usage();
+
+    const auto data = LoadFile(path);
+
+    const ScopeFbPoolInit fb_pool_init;
+    PInstance instance;
+
+    const auto default_impl = GetCharScanImpl();
+
+    for (auto impl : {CharScanImpl::SCALAR, CharScanImpl::SSE2,
+                      CharScanImpl::AVX2}) {
+        if (!SetCharScanImpl(impl))
+            continue;
+
+        const auto start_time = std::chrono::steady_clock::now();
+
+        for (unsigned i = 0; i < count; ++i) {
+            if (css)
+                ParseCss(instance.root_pool, data);
+            else
+                ParseXml(instance.root_pool, data);
+        }
+
+        const std::chrono::duration<double> duration =
+            std::chrono::steady_clock::now() - start_time;
+
+        const double n_bytes = double(data.size()) * count;
+        printf("%s %s%s: %.0f bytes in %.3f s = %.1f MB/s\n",
+               mode, GetCharScanImplName(impl),
+               impl == default_impl ? " (default)" : "",
+               n_bytes, duration.count(),
+               n_bytes / duration.count() / (1024 * 1024));
+    }
+
+    return EXIT_SUCCESS;
+} catch (Usage) {
+    fprintf(stderr, "usage: %s xml|css PATH [COUNT]\n", argv[0]);
+    return EXIT_FAILURE;
+} catch (...) {
+    PrintException(std::current_exception());
+    return EXIT_FAILURE;
+}
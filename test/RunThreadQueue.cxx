@@ -0,0 +1,170 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for #ThreadQueue: keep a number of jobs in flight with a
+ * varying number of worker threads and print the number of jobs per
+ * second.
+ */
+
+#include "thread_queue.hxx"
+#include "thread_worker.hxx"
+#include "thread_job.hxx"
+#include "event/Loop.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+
+#include <chrono>
+#include <list>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Usage {};
+
+struct Benchmark {
+    EventLoop event_loop;
+
+    ThreadQueue *queue;
+
+    /**
+     * The number of jobs which still need to be started.
+     */
+    unsigned remaining;
+
+    /**
+     * The number of jobs currently in the queue.
+     */
+    unsigned running = 0;
+};
+
+class BenchmarkJob final : public ThreadJob {
+    Benchmark &benchmark;
+
+    const unsigned work;
+
+    unsigned result = 0;
+
+public:
+    BenchmarkJob(Benchmark &_benchmark, unsigned _work) noexcept
+        :benchmark(_benchmark), work(_work) {}
+
+    void Start() noexcept {
+        --benchmark.remaining;
+        ++benchmark.running;
+        thread_queue_add(*benchmark.queue, *this);
+    }
+
+    /* virtual methods from class ThreadJob */
+    void Run() noexcept override {
+        /* simulate some CPU work, e.g. encrypting a TLS record */
+        unsigned x = result;
+        for (unsigned i = 0; i < work; ++i)
+            x = x * 1103515245 + 12345;
+        result = x;
+    }
+
+    void Done() noexcept override {
+        --benchmark.running;
+
+        if (benchmark.remaining > 0)
+            Start();
+        else if (benchmark.running == 0)
+            benchmark.event_loop.Break();
+    }
+};
+
+static double
+RunBenchmark(unsigned n_threads, unsigned n_parallel,
+             unsigned n_jobs, unsigned work)
+{
+    Benchmark benchmark;
+    benchmark.queue = thread_queue_new(benchmark.event_loop, n_threads);
+    benchmark.remaining = n_jobs;
+
+    std::vector<struct thread_worker> workers(n_threads);
+    for (unsigned i = 0; i < n_threads; ++i)
+        thread_worker_create(workers[i], *benchmark.queue, i);
+
+    std::list<BenchmarkJob> jobs;
+    for (unsigned i = 0; i < n_parallel; ++i)
+        jobs.emplace_back(benchmark, work);
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    for (auto &i : jobs)
+        if (benchmark.remaining > 0)
+            i.Start();
+
+    benchmark.event_loop.Dispatch();
+
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start_time;
+
+    thread_queue_stop(*benchmark.queue);
+    for (auto &i : workers)
+        thread_worker_join(i);
+    thread_queue_free(benchmark.queue);
+
+    return n_jobs / duration.count();
+}
+
+int
+main(int argc, char **argv)
+try {
+    ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+    const unsigned n_jobs = args.empty()
+        ? 1000000 : strtoul(args.shift(), nullptr, 10);
+    const unsigned work = args.empty()
+        ? 1000 : strtoul(args.shift(), nullptr, 10);
+    const unsigned n_parallel = args.empty()
+        ? 256 : strtoul(args.shift(), nullptr, 10);
+
+    if (!args.empty() || n_jobs == 0 || n_parallel == 0)
+        throw Usage();
+
+    for (unsigned n_threads : {1, 2, 4, 8, 16}) {
+        const double rate = RunBenchmark(n_threads, n_parallel,
+                                         n_jobs, work);
+        printf("%u threads: %.0f jobs/s\n", n_threads, rate);
+    }
+
+    return EXIT_SUCCESS;
+} catch (Usage) {
+    fprintf(stderr, "usage: %s [JOBS [WORK [PARALLEL]]]\n", argv[0]);
+    return EXIT_FAILURE;
+} catch (...) {
+    PrintException(std::current_exception());
+    return EXIT_FAILURE;
+}
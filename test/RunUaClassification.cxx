@@ -0,0 +1,130 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark for ua_classification_lookup(): classify each line of a
+ * User-Agent corpus (e.g. extracted from an access log) many times,
+ * with and without the result cache.
+ */
+
+#include "ua_classification.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+
+#include <chrono>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Usage {};
+
+static std::vector<std::string>
+LoadLines(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+        throw std::system_error(errno, std::system_category(), path);
+
+    std::vector<std::string> result;
+    char line[8192];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        size_t length = strlen(line);
+        while (length > 0 && (line[length - 1] == '\n' ||
+                              line[length - 1] == '\r'))
+            --length;
+
+        if (length > 0)
+            result.emplace_back(line, length);
+    }
+
+    fclose(file);
+    return result;
+}
+
+template<typename F>
+static void
+Run(const char *label, const std::vector<std::string> &corpus,
+    unsigned count, F &&f)
+{
+    size_t n_matches = 0;
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < count; ++i)
+        for (const auto &ua : corpus)
+            if (f(ua.c_str()) != nullptr)
+                ++n_matches;
+
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start_time;
+
+    const double n = double(corpus.size()) * count;
+    printf("%s: %.0f lookups (%zu matches) in %.3f s = %.0f lookups/s\n",
+           label, n, n_matches, duration.count(), n / duration.count());
+}
+
+int
+main(int argc, char **argv)
+try {
+    ConstBuffer<const char *> args(argv + 1, argc - 1);
+
+    if (args.size < 2)
+        throw Usage();
+
+    const char *const classes_path = args.shift();
+    const char *const corpus_path = args.shift();
+    const unsigned count = args.empty() ? 100 : strtoul(args.shift(), nullptr, 10);
+
+    if (!args.empty() || count == 0)
+        throw Usage();
+
+    const auto corpus = LoadLines(corpus_path);
+
+    ua_classification_init(classes_path);
+
+    Run("uncached", corpus, count, ua_classification_lookup_uncached);
+    Run("cached", corpus, count, ua_classification_lookup);
+
+    ua_classification_deinit();
+    return EXIT_SUCCESS;
+} catch (Usage) {
+    fprintf(stderr, "usage: %s CLASSES CORPUS [COUNT]\n", argv[0]);
+    return EXIT_FAILURE;
+} catch (...) {
+    PrintException(std::current_exception());
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "TestPool.hxx"
+#include "http_cache_disk.hxx"
+#include "http_cache_document.hxx"
+#include "http_cache_info.hxx"
+#include "strmap.hxx"
+#include "thread_pool.hxx"
+#include "event/Loop.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+class TempDirectory {
+    char path[64];
+
+public:
+    TempDirectory() noexcept {
+        strcpy(path, "/tmp/TestHttpCacheDisk.XXXXXX");
+        if (mkdtemp(path) == nullptr)
+            abort();
+    }
+
+    ~TempDirectory() noexcept {
+        char sub[sizeof(path) + 4];
+        for (unsigned i = 0; i < 256; ++i) {
+            snprintf(sub, sizeof(sub), "%s/%02x", path, i);
+            rmdir(sub);
+        }
+
+        rmdir(path);
+    }
+
+    operator const char *() const noexcept {
+        return path;
+    }
+};
+
+struct Instance {
+    EventLoop event_loop;
+
+    ~Instance() noexcept {
+        thread_pool_stop();
+        thread_pool_join();
+        thread_pool_deinit();
+    }
+};
+
+/**
+ * Wait until all files have been written by the worker thread.
+ */
+static void
+Wait(EventLoop &event_loop, HttpCacheDisk &cache) noexcept
+{
+    while (cache.IsWriting())
+        event_loop.LoopOnce();
+}
+
+static void
+Put(EventLoop &event_loop, HttpCacheDisk &cache, struct pool &pool,
+    const char *key, const char *etag, size_t body_size=16,
+    std::chrono::system_clock::duration max_age=std::chrono::hours(1),
+    const char *language="de")
+{
+    HttpCacheResponseInfo info;
+    info.expires = std::chrono::system_clock::now() + max_age;
+    info.last_modified = nullptr;
+    info.etag = etag;
+    info.vary = "accept-language";
+
+    StringMap request_headers(pool);
+    request_headers.Add("accept-language", language);
+
+    StringMap response_headers(pool);
+    response_headers.Add("content-type", "text/plain");
+
+    const HttpCacheDocument document(pool, info, request_headers,
+                                     HTTP_STATUS_OK, response_headers);
+
+    static char body[65536];
+    assert(body_size <= sizeof(body));
+    memset(body, 'x', body_size);
+
+    cache.Put(key, document, ConstBuffer<void>(body, body_size));
+    Wait(event_loop, cache);
+}
+
+static const char *
+GetETag(HttpCacheDisk &cache, struct pool &pool, const char *key,
+        const char *language="de")
+{
+    StringMap request_headers(pool);
+    request_headers.Add("accept-language", language);
+
+    auto item = cache.Get(pool, key, request_headers,
+                          std::chrono::system_clock::now());
+    if (!item)
+        return nullptr;
+
+    EXPECT_EQ(item.document->status, HTTP_STATUS_OK);
+    EXPECT_STREQ(item.document->response_headers.Get("content-type"),
+                 "text/plain");
+
+    /* verify that the body can be read from the file */
+    char buffer[16];
+    EXPECT_LE(item.body_size, off_t(sizeof(buffer)));
+    EXPECT_EQ(pread(item.fd.Get(), buffer, sizeof(buffer),
+                    item.body_offset), item.body_size);
+    EXPECT_EQ(buffer[0], 'x');
+
+    return item.document->info.etag;
+}
+
+TEST(HttpCacheDisk, Basic)
+{
+    Instance instance;
+    TestPool pool;
+    TempDirectory path;
+    HttpCacheDisk cache(instance.event_loop, path, 1024 * 1024);
+
+    ASSERT_EQ(GetETag(cache, pool, "foo"), nullptr);
+
+    Put(instance.event_loop, cache, pool, "foo", "\"a\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo"), "\"a\"");
+    ASSERT_EQ(GetETag(cache, pool, "foo", "en"), nullptr);
+    ASSERT_EQ(GetETag(cache, pool, "bar"), nullptr);
+
+    /* replace */
+    Put(instance.event_loop, cache, pool, "foo", "\"b\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo"), "\"b\"");
+
+    cache.Remove("foo");
+    ASSERT_EQ(GetETag(cache, pool, "foo"), nullptr);
+
+    /* expired */
+    Put(instance.event_loop, cache, pool, "foo", "\"c\"", 16,
+        -std::chrono::seconds(1));
+    ASSERT_EQ(GetETag(cache, pool, "foo"), nullptr);
+
+    cache.Flush();
+}
+
+TEST(HttpCacheDisk, Restart)
+{
+    Instance instance;
+    TestPool pool;
+    TempDirectory path;
+
+    {
+        HttpCacheDisk cache(instance.event_loop, path, 1024 * 1024);
+        Put(instance.event_loop, cache, pool, "foo", "\"a\"");
+    }
+
+    HttpCacheDisk cache(instance.event_loop, path, 1024 * 1024);
+    ASSERT_STREQ(GetETag(cache, pool, "foo"), "\"a\"");
+
+    cache.Flush();
+    ASSERT_EQ(GetETag(cache, pool, "foo"), nullptr);
+}
+
+TEST(HttpCacheDisk, Evict)
+{
+    Instance instance;
+    TestPool pool;
+    TempDirectory path;
+    HttpCacheDisk cache(instance.event_loop, path, 1024 * 1024);
+
+    char key[32];
+    for (unsigned i = 0; i < 64; ++i) {
+        sprintf(key, "key%u", i);
+        Put(instance.event_loop, cache, pool, key, "\"x\"", 60000);
+    }
+
+    /* the oldest items have been evicted */
+    StringMap request_headers(pool);
+    request_headers.Add("accept-language", "de");
+    ASSERT_FALSE(cache.Get(pool, "key0", request_headers,
+                           std::chrono::system_clock::now()));
+    ASSERT_TRUE(cache.Get(pool, "key63", request_headers,
+                          std::chrono::system_clock::now()));
+
+    /* objects larger than 1/16 of the cache are rejected */
+    Put(instance.event_loop, cache, pool, "huge", "\"huge\"", 65536);
+    ASSERT_FALSE(cache.Get(pool, "huge", request_headers,
+                           std::chrono::system_clock::now()));
+
+    cache.Flush();
+}
+
+TEST(HttpCacheDisk, Vary)
+{
+    Instance instance;
+    TestPool pool;
+    TempDirectory path;
+    HttpCacheDisk cache(instance.event_loop, path, 1024 * 1024);
+
+    /* each variant gets its own file */
+    Put(instance.event_loop, cache, pool, "foo", "\"de\"", 16,
+        std::chrono::hours(1), "de");
+    Put(instance.event_loop, cache, pool, "foo", "\"en\"", 16,
+        std::chrono::hours(1), "en");
+
+    ASSERT_STREQ(GetETag(cache, pool, "foo", "de"), "\"de\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo", "en"), "\"en\"");
+    ASSERT_EQ(GetETag(cache, pool, "foo", "fr"), nullptr);
+
+    /* removing the key makes all variants unreachable */
+    cache.Remove("foo");
+    ASSERT_EQ(GetETag(cache, pool, "foo", "de"), nullptr);
+    ASSERT_EQ(GetETag(cache, pool, "foo", "en"), nullptr);
+
+    cache.Flush();
+}
+
+TEST(HttpCacheDisk, SharedSize)
+{
+    Instance instance;
+    TestPool pool;
+    TempDirectory path;
+    HttpCacheDisk cache(instance.event_loop, path, 1024 * 1024);
+
+    /* another worker process fills most of the cache */
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        char key[32];
+        for (unsigned i = 0; i < 16; ++i) {
+            sprintf(key, "child%u", i);
+            Put(instance.event_loop, cache, pool, key, "\"x\"", 60000);
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), EXIT_SUCCESS);
+
+    ASSERT_GE(cache.GetSize(), 16 * 60000);
+    ASSERT_STREQ(GetETag(cache, pool, "child0"), "\"x\"");
+
+    /* the limit applies to the sum of both processes: this process
+       has to evict its own files to stay below it */
+    char key[32];
+    for (unsigned i = 0; i < 16; ++i) {
+        sprintf(key, "parent%u", i);
+        Put(instance.event_loop, cache, pool, key, "\"y\"", 60000);
+        ASSERT_LE(cache.GetSize(), 1024 * 1024);
+    }
+
+    ASSERT_STREQ(GetETag(cache, pool, "parent15"), "\"y\"");
+
+    cache.Flush();
+    ASSERT_EQ(cache.GetSize(), 0);
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TestPool.hxx"
+#include "http_cache_shared.hxx"
+#include "http_cache_document.hxx"
+#include "http_cache_info.hxx"
+#include "strmap.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void
+Put(HttpCacheShared &cache, struct pool &pool, const char *key,
+    const char *vary, const StringMap &request_headers,
+    const char *etag, size_t body_size=16)
+{
+    HttpCacheResponseInfo info;
+    info.expires = std::chrono::system_clock::now() + std::chrono::hours(1);
+    info.last_modified = nullptr;
+    info.etag = etag;
+    info.vary = vary;
+
+    StringMap response_headers(pool);
+    response_headers.Add("content-type", "text/plain");
+    if (etag != nullptr)
+        response_headers.Add("etag", etag);
+
+    static char body[65536];
+    assert(body_size <= sizeof(body));
+
+    cache.Put(pool, key, info, request_headers,
+              HTTP_STATUS_OK, response_headers,
+              ConstBuffer<void>(body, body_size));
+}
+
+static const char *
+GetETag(HttpCacheShared &cache, struct pool &pool, const char *key,
+        const StringMap &request_headers)
+{
+    auto *item = cache.Get(key, request_headers,
+                           std::chrono::system_clock::now());
+    if (item == nullptr)
+        return nullptr;
+
+    const auto *document = HttpCacheShared::MakeDocument(pool, *item);
+    cache.Unref(*item);
+
+    EXPECT_EQ(document->status, HTTP_STATUS_OK);
+    EXPECT_STREQ(document->response_headers.Get("content-type"),
+                 "text/plain");
+    return document->info.etag;
+}
+
+TEST(HttpCacheShared, Basic)
+{
+    TestPool pool;
+    HttpCacheShared cache(1024 * 1024);
+
+    StringMap request_headers(pool);
+
+    ASSERT_EQ(GetETag(cache, pool, "foo", request_headers), nullptr);
+
+    Put(cache, pool, "foo", nullptr, request_headers, "\"a\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo", request_headers), "\"a\"");
+    ASSERT_EQ(GetETag(cache, pool, "bar", request_headers), nullptr);
+
+    /* replace */
+    Put(cache, pool, "foo", nullptr, request_headers, "\"b\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo", request_headers), "\"b\"");
+
+    cache.Remove("foo", request_headers);
+    ASSERT_EQ(GetETag(cache, pool, "foo", request_headers), nullptr);
+
+    Put(cache, pool, "foo", nullptr, request_headers, "\"c\"");
+    cache.Flush();
+    ASSERT_EQ(GetETag(cache, pool, "foo", request_headers), nullptr);
+
+    ASSERT_FALSE(cache.IsAbandoned());
+}
+
+TEST(HttpCacheShared, Vary)
+{
+    TestPool pool;
+    HttpCacheShared cache(1024 * 1024);
+
+    StringMap de(pool);
+    de.Add("accept-language", "de");
+
+    StringMap en(pool);
+    en.Add("accept-language", "en");
+
+    Put(cache, pool, "foo", "accept-language", de, "\"de\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo", de), "\"de\"");
+    ASSERT_EQ(GetETag(cache, pool, "foo", en), nullptr);
+
+    Put(cache, pool, "foo", "accept-language", en, "\"en\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo", de), "\"de\"");
+    ASSERT_STREQ(GetETag(cache, pool, "foo", en), "\"en\"");
+
+    cache.Remove("foo", en);
+    ASSERT_STREQ(GetETag(cache, pool, "foo", de), "\"de\"");
+    ASSERT_EQ(GetETag(cache, pool, "foo", en), nullptr);
+}
+
+TEST(HttpCacheShared, Evict)
+{
+    TestPool pool;
+    HttpCacheShared cache(1024 * 1024);
+
+    StringMap request_headers(pool);
+
+    /* the first item is referenced and must not be evicted */
+    Put(cache, pool, "locked", nullptr, request_headers, "\"locked\"");
+    auto *locked = cache.Get("locked", request_headers,
+                             std::chrono::system_clock::now());
+    ASSERT_NE(locked, nullptr);
+
+    char key[32];
+    for (unsigned i = 0; i < 64; ++i) {
+        sprintf(key, "key%u", i);
+        Put(cache, pool, key, nullptr, request_headers, "\"x\"", 60000);
+    }
+
+    /* the oldest items have been evicted */
+    ASSERT_EQ(GetETag(cache, pool, "key0", request_headers), nullptr);
+    ASSERT_STREQ(GetETag(cache, pool, "key63", request_headers), "\"x\"");
+
+    cache.Unref(*locked);
+    ASSERT_STREQ(GetETag(cache, pool, "locked", request_headers),
+                 "\"locked\"");
+
+    /* objects larger than 1/16 of the cache are rejected */
+    Put(cache, pool, "huge", nullptr, request_headers, "\"huge\"", 65536);
+    ASSERT_EQ(GetETag(cache, pool, "huge", request_headers), nullptr);
+}
+
+/**
+ * Fork a "worker" which obtains a reference to the given item and
+ * exits without releasing it, as if it had been killed.
+ *
+ * @return the process id of the (already exited) worker
+ */
+static pid_t
+LeakReference(HttpCacheShared &cache, const char *key,
+              const StringMap &request_headers)
+{
+    const pid_t pid = fork();
+    if (pid == 0) {
+        cache.Ref();
+        auto *item = cache.Get(key, request_headers,
+                               std::chrono::system_clock::now());
+        _exit(item != nullptr ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status;
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), EXIT_SUCCESS);
+    return pid;
+}
+
+TEST(HttpCacheShared, RemoveWorker)
+{
+    TestPool pool;
+    HttpCacheShared cache(1024 * 1024);
+
+    StringMap request_headers(pool);
+
+    Put(cache, pool, "leaked", nullptr, request_headers, "\"leaked\"");
+    const pid_t pid = LeakReference(cache, "leaked", request_headers);
+
+    /* the leaked reference protects the item from eviction */
+    char key[32];
+    for (unsigned i = 0; i < 64; ++i) {
+        sprintf(key, "key%u", i);
+        Put(cache, pool, key, nullptr, request_headers, "\"x\"", 60000);
+    }
+
+    ASSERT_EQ(GetETag(cache, pool, "key0", request_headers), nullptr);
+    ASSERT_STREQ(GetETag(cache, pool, "leaked", request_headers),
+                 "\"leaked\"");
+
+    /* after the dead worker's references have been released, the
+       item can be evicted */
+    cache.RemoveWorker(pid);
+
+    for (unsigned i = 0; i < 64; ++i) {
+        sprintf(key, "key%u", i);
+        Put(cache, pool, key, nullptr, request_headers, "\"y\"", 60000);
+    }
+
+    ASSERT_EQ(GetETag(cache, pool, "leaked", request_headers), nullptr);
+
+    /* a removed item which is still referenced by a dead worker is
+       freed, too */
+    Put(cache, pool, "removed", nullptr, request_headers, "\"removed\"");
+    const pid_t pid2 = LeakReference(cache, "removed", request_headers);
+    cache.Remove("removed", request_headers);
+    ASSERT_EQ(GetETag(cache, pool, "removed", request_headers), nullptr);
+    cache.RemoveWorker(pid2);
+
+    ASSERT_FALSE(cache.IsAbandoned());
+}
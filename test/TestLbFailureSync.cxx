@@ -0,0 +1,191 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lb/FailureSync.hxx"
+#include "net/FailureManager.hxx"
+#include "net/AllocatedSocketAddress.hxx"
+#include "net/Resolver.hxx"
+#include "net/AddressInfo.hxx"
+
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+using std::chrono::seconds;
+
+/**
+ * One beng-lb process: its #FailureManager and the #LbFailureSync
+ * instance which publishes and applies changes.
+ */
+struct Process {
+    FailureManager failure_manager;
+    LbFailureSync sync{failure_manager};
+
+    typedef std::vector<std::pair<AllocatedSocketAddress, unsigned>> Messages;
+
+    Messages Scan(Expiry now) noexcept {
+        Messages messages;
+        sync.Scan(now, [&messages](SocketAddress address, unsigned flags){
+                messages.emplace_back(address, flags);
+            });
+        return messages;
+    }
+
+    /**
+     * Publish all changes to the given peer.
+     *
+     * @return the number of messages
+     */
+    std::size_t SendTo(Process &peer, Expiry now) noexcept {
+        const auto messages = Scan(now);
+        for (const auto &i : messages)
+            peer.sync.Apply(now, i.first, i.second);
+        return messages.size();
+    }
+
+    FailureStatus Get(Expiry now, SocketAddress address) const noexcept {
+        return failure_manager.Get(now, address);
+    }
+};
+
+class LbFailureSyncTest : public ::testing::Test {
+protected:
+    const AddressInfoList address_info = Resolve("192.168.0.1", 80, nullptr);
+    const SocketAddress address = address_info.front();
+
+    const std::chrono::steady_clock::time_point t0 =
+        std::chrono::steady_clock::now();
+
+    Process a, b;
+};
+
+TEST_F(LbFailureSyncTest, Connect)
+{
+    a.failure_manager.Make(address).Set(t0, FailureStatus::CONNECT,
+                                        LbFailureSync::CONNECT_DURATION);
+
+    ASSERT_EQ(a.SendTo(b, t0), 1u);
+    ASSERT_EQ(b.Get(t0, address), FailureStatus::CONNECT);
+
+    /* the applied state is not published again */
+    ASSERT_EQ(b.SendTo(a, t0), 0u);
+    ASSERT_EQ(a.SendTo(b, t0), 0u);
+
+    /* the failure expires in both processes at the same time,
+       without another message */
+    const Expiry t1 = t0 + LbFailureSync::CONNECT_DURATION - seconds(1);
+    const Expiry t2 = t0 + LbFailureSync::CONNECT_DURATION + seconds(1);
+    ASSERT_EQ(a.Get(t1, address), FailureStatus::CONNECT);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::CONNECT);
+    ASSERT_EQ(a.Get(t2, address), FailureStatus::OK);
+    ASSERT_EQ(b.Get(t2, address), FailureStatus::OK);
+
+    /* the expiry is published once, and then both processes agree */
+    ASSERT_EQ(a.SendTo(b, t2), 1u);
+    ASSERT_EQ(b.SendTo(a, t2), 0u);
+    ASSERT_EQ(a.SendTo(b, t2), 0u);
+    ASSERT_EQ(a.Get(t2, address), FailureStatus::OK);
+    ASSERT_EQ(b.Get(t2, address), FailureStatus::OK);
+}
+
+TEST_F(LbFailureSyncTest, ConnectRecovered)
+{
+    a.failure_manager.Make(address).Set(t0, FailureStatus::CONNECT,
+                                        seconds(3600));
+    ASSERT_EQ(a.SendTo(b, t0), 1u);
+    ASSERT_EQ(b.Get(t0, address), FailureStatus::CONNECT);
+
+    /* the peer's recovery is applied before the failure expires */
+    const Expiry t1 = t0 + seconds(5);
+    a.failure_manager.Make(address).Unset(FailureStatus::CONNECT);
+    ASSERT_EQ(a.SendTo(b, t1), 1u);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::OK);
+    ASSERT_EQ(b.SendTo(a, t1), 0u);
+}
+
+TEST_F(LbFailureSyncTest, ConnectExpiredLocally)
+{
+    a.failure_manager.Make(address).Set(t0, FailureStatus::CONNECT,
+                                        seconds(10));
+    ASSERT_EQ(a.SendTo(b, t0), 1u);
+
+    /* the failure expires in the process which has set it; this
+       change is published and clears the peer's copy, which would
+       have lasted longer */
+    const Expiry t1 = t0 + seconds(11);
+    ASSERT_EQ(a.Get(t1, address), FailureStatus::OK);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::CONNECT);
+    ASSERT_EQ(a.SendTo(b, t1), 1u);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::OK);
+}
+
+TEST_F(LbFailureSyncTest, Monitor)
+{
+    a.failure_manager.Make(address).Set(t0, FailureStatus::MONITOR,
+                                        seconds(0));
+    ASSERT_EQ(a.SendTo(b, t0), 1u);
+    ASSERT_EQ(b.Get(t0, address), FailureStatus::MONITOR);
+
+    /* a monitor failure does not expire */
+    const Expiry t1 = t0 + seconds(86400);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::MONITOR);
+    ASSERT_EQ(a.SendTo(b, t1), 0u);
+
+    a.failure_manager.Make(address).Unset(FailureStatus::MONITOR);
+    ASSERT_EQ(a.SendTo(b, t1), 1u);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::OK);
+}
+
+TEST_F(LbFailureSyncTest, Fade)
+{
+    a.failure_manager.Make(address).SetFade(t0, seconds(3600));
+    ASSERT_EQ(a.SendTo(b, t0), 1u);
+    ASSERT_EQ(b.Get(t0, address), FailureStatus::FADE);
+
+    const Expiry t1 = t0 + LbFailureSync::FADE_DURATION + seconds(1);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::OK);
+    ASSERT_EQ(a.Get(t1, address), FailureStatus::FADE);
+}
+
+TEST_F(LbFailureSyncTest, FadeLonger)
+{
+    /* a longer local fade (e.g. from a FADE_NODE control packet) is
+       not shortened by a peer's fade */
+    b.failure_manager.Make(address).SetFade(t0, seconds(3600));
+
+    a.failure_manager.Make(address).SetFade(t0, seconds(60));
+    ASSERT_EQ(a.SendTo(b, t0), 1u);
+
+    const Expiry t1 = t0 + LbFailureSync::FADE_DURATION + seconds(1);
+    ASSERT_EQ(b.Get(t1, address), FailureStatus::FADE);
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lb/PipeRelay.hxx"
+#include "pipe_stock.hxx"
+#include "TestPool.hxx"
+#include "event/Loop.hxx"
+#include "event/net/BufferedSocket.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+/**
+ * A destination for PipeRelay::Flush() which moves at most #limit
+ * bytes per call into a socket.
+ */
+struct Destination {
+    UniqueSocketDescriptor socket, peer;
+
+    size_t limit = SIZE_MAX;
+
+    Destination() {
+        if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_STREAM, 0,
+                                                      socket, peer))
+            throw MakeErrno("socketpair() failed");
+
+        socket.SetNonBlocking();
+        peer.SetNonBlocking();
+    }
+
+    ssize_t WriteFrom(int fd, FdType, size_t length) noexcept {
+        ssize_t nbytes = splice(fd, nullptr, socket.Get(), nullptr,
+                                std::min(length, limit),
+                                SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (nbytes < 0 && errno == EAGAIN)
+            return WRITE_BLOCKING;
+        return nbytes < 0 ? ssize_t(WRITE_ERRNO) : nbytes;
+    }
+
+    std::string ReadAll() {
+        std::string result;
+        char buffer[4096];
+        ssize_t nbytes;
+        while ((nbytes = peer.Read(buffer, sizeof(buffer))) > 0)
+            result.append(buffer, nbytes);
+        return result;
+    }
+};
+
+struct Source {
+    UniqueSocketDescriptor socket, peer;
+
+    Source() {
+        if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_STREAM, 0,
+                                                      socket, peer))
+            throw MakeErrno("socketpair() failed");
+
+        socket.SetNonBlocking();
+    }
+
+    void Write(const char *data) {
+        const size_t length = strlen(data);
+        if (peer.Write(data, length) != ssize_t(length))
+            throw MakeErrno("send() failed");
+    }
+};
+
+static StockStats
+GetStats(const PipeStock &stock) noexcept
+{
+    StockStats stats{0, 0};
+    stock.AddStats(stats);
+    return stats;
+}
+
+TEST(PipeRelay, Relay)
+{
+    EventLoop event_loop;
+    PipeStock stock(event_loop);
+    TestPool pool;
+    Source src;
+    Destination dest;
+
+    PipeRelay relay(&stock);
+    ASSERT_TRUE(relay.IsEmpty());
+
+    src.Write("foo");
+    ASSERT_EQ(relay.Splice(pool, src.socket, 65536), 3);
+    ASSERT_FALSE(relay.IsEmpty());
+    ASSERT_EQ(GetStats(stock).busy, 1u);
+
+    ASSERT_EQ(relay.Flush(dest), 3);
+    ASSERT_TRUE(relay.IsEmpty());
+    ASSERT_EQ(dest.ReadAll(), "foo");
+
+    /* the empty pipe has been returned to the stock */
+    ASSERT_EQ(GetStats(stock).busy, 0u);
+    ASSERT_EQ(GetStats(stock).idle, 1u);
+
+    /* the next splice() reuses it */
+    src.Write("bar");
+    ASSERT_EQ(relay.Splice(pool, src.socket, 65536), 3);
+    ASSERT_EQ(GetStats(stock).busy, 1u);
+    ASSERT_EQ(GetStats(stock).idle, 0u);
+    ASSERT_EQ(relay.Flush(dest), 3);
+    ASSERT_EQ(dest.ReadAll(), "bar");
+    ASSERT_EQ(GetStats(stock).busy, 0u);
+    ASSERT_EQ(GetStats(stock).idle, 1u);
+}
+
+TEST(PipeRelay, PartialFlush)
+{
+    EventLoop event_loop;
+    PipeStock stock(event_loop);
+    TestPool pool;
+    Source src;
+    Destination dest;
+
+    PipeRelay relay(&stock);
+
+    src.Write("foobar");
+    ASSERT_EQ(relay.Splice(pool, src.socket, 65536), 6);
+
+    dest.limit = 4;
+    ASSERT_EQ(relay.Flush(dest), 4);
+
+    /* data is left in the pipe, which must be kept */
+    ASSERT_FALSE(relay.IsEmpty());
+    ASSERT_EQ(GetStats(stock).busy, 1u);
+
+    ASSERT_EQ(relay.Flush(dest), 2);
+    ASSERT_TRUE(relay.IsEmpty());
+    ASSERT_EQ(dest.ReadAll(), "foobar");
+    ASSERT_EQ(GetStats(stock).busy, 0u);
+    ASSERT_EQ(GetStats(stock).idle, 1u);
+}
+
+TEST(PipeRelay, SpliceEmpty)
+{
+    EventLoop event_loop;
+    PipeStock stock(event_loop);
+    TestPool pool;
+    Source src;
+
+    PipeRelay relay(&stock);
+
+    /* the source socket is empty: the pipe is not held */
+    ASSERT_EQ(relay.Splice(pool, src.socket, 65536), -1);
+    ASSERT_EQ(errno, EAGAIN);
+    ASSERT_TRUE(relay.IsEmpty());
+    ASSERT_EQ(GetStats(stock).busy, 0u);
+    ASSERT_EQ(GetStats(stock).idle, 1u);
+
+    /* end of file: the pipe is not held */
+    src.peer.Close();
+    ASSERT_EQ(relay.Splice(pool, src.socket, 65536), 0);
+    ASSERT_TRUE(relay.IsEmpty());
+    ASSERT_EQ(GetStats(stock).busy, 0u);
+    ASSERT_EQ(GetStats(stock).idle, 1u);
+}
+
+TEST(PipeRelay, DestroyNotEmpty)
+{
+    EventLoop event_loop;
+    PipeStock stock(event_loop);
+    TestPool pool;
+    Source src;
+
+    {
+        PipeRelay relay(&stock);
+
+        src.Write("foo");
+        ASSERT_EQ(relay.Splice(pool, src.socket, 65536), 3);
+        ASSERT_EQ(GetStats(stock).busy, 1u);
+    }
+
+    /* a pipe which still contains data must not be reused */
+    ASSERT_EQ(GetStats(stock).busy, 0u);
+    ASSERT_EQ(GetStats(stock).idle, 0u);
+}
+
+TEST(PipeRelay, NoStock)
+{
+    TestPool pool;
+    Source src;
+    Destination dest;
+
+    PipeRelay relay(nullptr);
+
+    src.Write("foo");
+    ASSERT_EQ(relay.Splice(pool, src.socket, 65536), 3);
+    ASSERT_EQ(relay.Flush(dest), 3);
+    ASSERT_TRUE(relay.IsEmpty());
+    ASSERT_EQ(dest.ReadAll(), "foo");
+}
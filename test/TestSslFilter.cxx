@@ -0,0 +1,288 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tests for SslFilter with kernel TLS offload enabled, on a socket
+ * where the kernel refuses to take over (AF_LOCAL has no "tls" ULP).
+ * The client side is a plain OpenSSL object on the raw socket.
+ */
+
+#include "ssl/Filter.hxx"
+#include "ssl/Init.hxx"
+#include "ssl/Key.hxx"
+#include "ssl/Dummy.hxx"
+#include "ssl/Error.hxx"
+#include "ssl/Unique.hxx"
+#include "fs/FilteredSocket.hxx"
+#include "fs/ThreadSocketFilter.hxx"
+#include "thread_pool.hxx"
+#include "fb_pool.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <poll.h>
+#include <string.h>
+
+class Server final : BufferedSocketHandler {
+    FilteredSocket socket;
+
+public:
+    std::string received;
+
+    std::exception_ptr error;
+
+    bool handshake_complete = false;
+
+    Server(EventLoop &event_loop, UniqueSocketDescriptor &&fd,
+           UniqueSSL &&ssl)
+        :socket(event_loop)
+    {
+        auto *f = ssl_filter_new(std::move(ssl), true);
+        SocketFilterPtr filter(new ThreadSocketFilter(event_loop,
+                                                      thread_pool_get_queue(event_loop),
+                                                      &ssl_filter_get_handler(*f)));
+
+        socket.Init(fd.Release(), FdType::FD_SOCKET,
+                    Event::Duration(-1), Event::Duration(-1),
+                    std::move(filter), *this);
+        socket.SetHandshakeCallback(BIND_THIS_METHOD(OnHandshake));
+        socket.ScheduleReadNoTimeout(false);
+    }
+
+    ~Server() noexcept {
+        Close();
+    }
+
+    bool IsOutputOffloaded() const noexcept {
+        return !socket.HasFilteredOutput();
+    }
+
+    bool Write(const char *data) noexcept {
+        const size_t length = strlen(data);
+        return socket.Write(data, length) == ssize_t(length);
+    }
+
+private:
+    void Close() noexcept {
+        if (socket.IsValid() && socket.IsConnected()) {
+            socket.Close();
+            socket.Destroy();
+        }
+    }
+
+    void OnHandshake() noexcept {
+        handshake_complete = true;
+    }
+
+    /* virtual methods from class BufferedSocketHandler */
+    BufferedResult OnBufferedData() override {
+        auto r = socket.ReadBuffer();
+        received.append((const char *)r.data, r.size);
+        socket.DisposeConsumed(r.size);
+        return BufferedResult::OK;
+    }
+
+    bool OnBufferedClosed() noexcept override {
+        Close();
+        return false;
+    }
+
+    bool OnBufferedWrite() override {
+        socket.UnscheduleWrite();
+        return true;
+    }
+
+    void OnBufferedError(std::exception_ptr e) noexcept override {
+        error = std::move(e);
+        Close();
+    }
+};
+
+/**
+ * Restrict the protocol to what kTLS supports: TLS 1.2 with AES-GCM.
+ * Otherwise SslFilter would not even attempt to offload.
+ */
+static UniqueSSL_CTX
+MakeContext(const SSL_METHOD *method)
+{
+    UniqueSSL_CTX ctx(SSL_CTX_new(method));
+    if (!ctx)
+        throw SslError("SSL_CTX_new() failed");
+
+    SSL_CTX_set_max_proto_version(ctx.get(), TLS1_2_VERSION);
+    if (SSL_CTX_set_cipher_list(ctx.get(),
+                                "ECDHE-RSA-AES128-GCM-SHA256") != 1)
+        throw SslError("SSL_CTX_set_cipher_list() failed");
+
+    return ctx;
+}
+
+/**
+ * @return true if the client operation has succeeded, false if it
+ * needs to be retried
+ */
+static bool
+CheckClientResult(SSL &ssl, int result)
+{
+    if (result > 0)
+        return true;
+
+    switch (SSL_get_error(&ssl, result)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        return false;
+
+    default:
+        throw SslError("client error");
+    }
+}
+
+/**
+ * Run the event loop (and give the worker threads some time) until
+ * the given condition becomes true.
+ */
+template<typename P>
+static bool
+Pump(EventLoop &event_loop, SocketDescriptor client_socket, P &&predicate)
+{
+    for (unsigned i = 0; i < 1000; ++i) {
+        if (predicate())
+            return true;
+
+        event_loop.LoopOnceNonBlock();
+
+        struct pollfd pfd = {client_socket.Get(), POLLIN, 0};
+        poll(&pfd, 1, 10);
+    }
+
+    return predicate();
+}
+
+static void
+ClientRead(SSL &ssl, std::string &dest)
+{
+    char buffer[256];
+    int nbytes = SSL_read(&ssl, buffer, sizeof(buffer));
+    if (CheckClientResult(ssl, nbytes))
+        dest.append(buffer, nbytes);
+}
+
+/**
+ * The kernel refuses to take over encryption: output which was
+ * submitted while the offload was pending, and all later output,
+ * must be encrypted by OpenSSL.
+ */
+TEST(SslFilter, KtlsUnavailable)
+{
+    const ScopeSslGlobalInit ssl_init;
+    const ScopeFbPoolInit fb_pool_init;
+    EventLoop event_loop;
+
+    AtScopeExit() {
+        thread_pool_stop();
+        thread_pool_join();
+        thread_pool_deinit();
+    };
+
+    const auto key = GenerateRsaKey();
+    const auto cert = MakeSelfSignedDummyCert(*key, "localhost");
+
+    const auto server_ctx = MakeContext(TLS_server_method());
+    SSL_CTX_use_certificate(server_ctx.get(), cert.get());
+    SSL_CTX_use_PrivateKey(server_ctx.get(), key.get());
+
+    const auto client_ctx = MakeContext(TLS_client_method());
+
+    UniqueSocketDescriptor client_socket, server_socket;
+    if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_STREAM, 0,
+                                                  client_socket,
+                                                  server_socket))
+        throw MakeErrno("socketpair() failed");
+
+    client_socket.SetNonBlocking();
+
+    UniqueSSL server_ssl(SSL_new(server_ctx.get()));
+    SSL_set_accept_state(server_ssl.get());
+
+    UniqueSSL client(SSL_new(client_ctx.get()));
+    SSL_set_fd(client.get(), client_socket.Get());
+    SSL_set_connect_state(client.get());
+
+    {
+        Server server(event_loop, std::move(server_socket),
+                      std::move(server_ssl));
+
+        ASSERT_TRUE(Pump(event_loop, client_socket, [&](){
+                    return CheckClientResult(*client,
+                                             SSL_do_handshake(client.get())) &&
+                        server.handshake_complete;
+                }));
+        ASSERT_EQ(SSL_version(client.get()), TLS1_2_VERSION);
+
+        /* submitted while the offload is still pending */
+        ASSERT_TRUE(server.Write("hello"));
+
+        std::string response;
+        ASSERT_TRUE(Pump(event_loop, client_socket, [&](){
+                    ClientRead(*client, response);
+                    return response.size() >= 5;
+                }));
+        EXPECT_EQ(response, "hello");
+        EXPECT_FALSE(server.IsOutputOffloaded());
+
+        /* after the fallback */
+        ASSERT_TRUE(server.Write(" world"));
+        ASSERT_TRUE(Pump(event_loop, client_socket, [&](){
+                    ClientRead(*client, response);
+                    return response.size() >= 11;
+                }));
+        EXPECT_EQ(response, "hello world");
+
+        /* input is not affected */
+        ASSERT_EQ(SSL_write(client.get(), "ping", 4), 4);
+        ASSERT_TRUE(Pump(event_loop, client_socket, [&](){
+                    return server.received.size() >= 4;
+                }));
+        EXPECT_EQ(server.received, "ping");
+
+        EXPECT_FALSE(server.error);
+    }
+
+    /* let postponed destruction finish */
+    event_loop.LoopOnceNonBlock();
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ssl/TicketKeys.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Create a #SslTicketKeys object with the given secret (via a
+ * temporary file).
+ */
+static SslTicketKeys
+MakeKeys(const char *secret)
+{
+    char path[] = "/tmp/TestSslTicketKeys.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        throw std::runtime_error("mkstemp() failed");
+
+    const size_t length = strlen(secret);
+    const bool success = write(fd, secret, length) == ssize_t(length);
+    close(fd);
+
+    if (!success) {
+        unlink(path);
+        throw std::runtime_error("write() failed");
+    }
+
+    try {
+        SslTicketKeys keys(path);
+        unlink(path);
+        return keys;
+    } catch (...) {
+        unlink(path);
+        throw;
+    }
+}
+
+static constexpr char secret1[] = "0123456789abcdef0123456789abcdef";
+static constexpr char secret2[] = "fedcba9876543210fedcba9876543210";
+
+TEST(SslTicketKeys, TooSmall)
+{
+    ASSERT_THROW(MakeKeys("0123456789"), std::runtime_error);
+}
+
+TEST(SslTicketKeys, Derive)
+{
+    const auto keys = MakeKeys(secret1);
+
+    const auto a = keys.Derive(1000), b = keys.Derive(1000);
+    ASSERT_EQ(memcmp(&a, &b, sizeof(a)), 0);
+
+    const auto c = keys.Derive(1001);
+    ASSERT_NE(memcmp(a.name, c.name, sizeof(a.name)), 0);
+    ASSERT_NE(memcmp(a.aes_key, c.aes_key, sizeof(a.aes_key)), 0);
+
+    /* a different secret yields different keys */
+    const auto other = MakeKeys(secret2);
+    const auto d = other.Derive(1000);
+    ASSERT_NE(memcmp(a.name, d.name, sizeof(a.name)), 0);
+    ASSERT_NE(memcmp(a.aes_key, d.aes_key, sizeof(a.aes_key)), 0);
+}
+
+/**
+ * The previous, the current and the next period are accepted; all
+ * others are rejected.
+ */
+TEST(SslTicketKeys, Window)
+{
+    const auto keys = MakeKeys(secret1);
+
+    static constexpr uint64_t now = 1000;
+
+    for (int offset = -4; offset <= 4; ++offset) {
+        const auto key = keys.Derive(now + offset);
+
+        SslTicketKeys::Key found;
+        bool current;
+        const bool accepted = keys.Find(key.name, now, found, current);
+
+        if (offset >= -1 && offset <= 1) {
+            ASSERT_TRUE(accepted) << "offset=" << offset;
+            ASSERT_EQ(current, offset == 0);
+            ASSERT_EQ(memcmp(&found, &key, sizeof(key)), 0);
+        } else
+            ASSERT_FALSE(accepted) << "offset=" << offset;
+    }
+}
+
+TEST(SslTicketKeys, WrongSecret)
+{
+    const auto keys = MakeKeys(secret1), other = MakeKeys(secret2);
+
+    static constexpr uint64_t now = 1000;
+    const auto key = other.Derive(now);
+
+    SslTicketKeys::Key found;
+    bool current;
+    ASSERT_FALSE(keys.Find(key.name, now, found, current));
+}
+
+/**
+ * Period 0 has no previous period.
+ */
+TEST(SslTicketKeys, FirstPeriod)
+{
+    const auto keys = MakeKeys(secret1);
+
+    SslTicketKeys::Key found;
+    bool current;
+
+    ASSERT_TRUE(keys.Find(keys.Derive(0).name, 0, found, current));
+    ASSERT_TRUE(current);
+
+    ASSERT_TRUE(keys.Find(keys.Derive(1).name, 0, found, current));
+    ASSERT_FALSE(current);
+
+    ASSERT_FALSE(keys.Find(keys.Derive(2).name, 0, found, current));
+}
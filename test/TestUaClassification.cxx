@@ -0,0 +1,221 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ua_classification.hxx"
+#include "regex.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct TestClass {
+    const char *pattern;
+    const char *name;
+};
+
+/**
+ * Load the given classes with ua_classification_init() (via a
+ * temporary file), and compile them for ClassifySequential().
+ */
+class ScopeUaClassification {
+    std::vector<std::pair<UniqueRegex, const char *>> classes;
+
+public:
+    template<size_t N>
+    explicit ScopeUaClassification(const TestClass (&_classes)[N]) {
+        char path[] = "/tmp/TestUaClassification.XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0)
+            throw std::runtime_error("mkstemp() failed");
+
+        FILE *file = fdopen(fd, "w");
+        fprintf(file, "# test classes\n\n");
+        for (const auto &i : _classes) {
+            fprintf(file, "m~%s~ %s\n", i.pattern, i.name);
+
+            classes.emplace_back();
+            classes.back().first.Compile(i.pattern, false, false);
+            classes.back().second = i.name;
+        }
+        fclose(file);
+
+        try {
+            ua_classification_init(path);
+        } catch (...) {
+            unlink(path);
+            throw;
+        }
+
+        unlink(path);
+    }
+
+    ~ScopeUaClassification() noexcept {
+        ua_classification_deinit();
+    }
+
+    ScopeUaClassification(const ScopeUaClassification &) = delete;
+    ScopeUaClassification &operator=(const ScopeUaClassification &) = delete;
+
+    /**
+     * The reference implementation: match the classes one by one,
+     * in the order of the file.
+     */
+    const char *ClassifySequential(const char *user_agent) const {
+        for (const auto &i : classes)
+            if (i.first.Match(user_agent))
+                return i.second;
+
+        return nullptr;
+    }
+
+    /**
+     * Verify that the cached and the uncached lookups agree with
+     * ClassifySequential(), and return the class name.
+     */
+    std::string Check(const char *user_agent) const {
+        const char *expected = ClassifySequential(user_agent);
+
+        /* twice: miss and hit */
+        for (unsigned i = 0; i < 2; ++i) {
+            const char *cached = ua_classification_lookup(user_agent);
+            EXPECT_EQ(ToString(cached), ToString(expected))
+                << "cached lookup of '" << user_agent << "'";
+        }
+
+        const char *uncached = ua_classification_lookup_uncached(user_agent);
+        EXPECT_EQ(ToString(uncached), ToString(expected))
+            << "uncached lookup of '" << user_agent << "'";
+
+        return ToString(expected);
+    }
+
+private:
+    static std::string ToString(const char *s) {
+        return s != nullptr ? s : "(null)";
+    }
+};
+
+static constexpr const char *user_agents[] = {
+    "Mozilla/5.0 (iPhone; CPU iPhone OS 12_0 like Mac OS X) Mobile Safari/604.1",
+    "Mozilla/5.0 (Macintosh) Safari/605.1.15",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:68.0) Gecko/20100101 Firefox/68.0",
+    "Mozilla/5.0 (X11; Linux x86_64) Chrome/76.0 Safari/537.36",
+    "Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)",
+    "Safari Mobile",
+    "Mobile",
+    "Opera/9.80",
+    "xac",
+    "xab",
+    "",
+};
+
+/**
+ * Overlapping classes: many User-Agent strings match more than one
+ * class, and the first one in the file must win, not the one
+ * matching earliest in the string.
+ */
+static constexpr TestClass overlapping[] = {
+    { "Googlebot", "bot" },
+    { "Mobile.*Safari", "mobile" },
+    { "Safari", "safari" },
+    { "Mobile", "mobilegeneric" },
+    { "(?i)firefox", "firefox" },
+    { "^Mozilla/5\\.0 \\(X11", "x11" },
+    { "Chrome|Chromium", "chrome" },
+};
+
+TEST(UaClassification, Overlapping)
+{
+    const ScopeUaClassification uac(overlapping);
+
+    for (const char *i : user_agents)
+        uac.Check(i);
+
+    ASSERT_EQ(uac.Check(user_agents[0]), "mobile");
+    ASSERT_EQ(uac.Check(user_agents[1]), "safari");
+    ASSERT_EQ(uac.Check(user_agents[2]), "firefox");
+    ASSERT_EQ(uac.Check(user_agents[3]), "safari");
+    ASSERT_EQ(uac.Check(user_agents[4]), "bot");
+    ASSERT_EQ(uac.Check("Safari Mobile"), "safari");
+    ASSERT_EQ(uac.Check("Mobile"), "mobilegeneric");
+    ASSERT_EQ(uac.Check("Opera/9.80"), "(null)");
+}
+
+/**
+ * Backtracking control verbs must not leak into the combined
+ * pattern; such classes are matched one by one.
+ */
+static constexpr TestClass verbs[] = {
+    { "a(*COMMIT)b", "commit" },
+    { "a(*PRUNE)b", "prune" },
+    { "a(*SKIP)b", "skip" },
+    { "x(*MARK:0)y", "mark" },
+    { "ac", "ac" },
+    { "Mobile", "mobile" },
+};
+
+TEST(UaClassification, Verbs)
+{
+    const ScopeUaClassification uac(verbs);
+
+    for (const char *i : user_agents)
+        uac.Check(i);
+
+    ASSERT_EQ(uac.Check("xac"), "ac");
+    ASSERT_EQ(uac.Check("xab"), "commit");
+    ASSERT_EQ(uac.Check("xy Mobile"), "mark");
+    ASSERT_EQ(uac.Check("Mobile"), "mobile");
+}
+
+/**
+ * A back reference also prevents combining.  Classes are compiled
+ * with PCRE_NO_AUTO_CAPTURE, so only named groups can be referenced.
+ */
+static constexpr TestClass backref[] = {
+    { "(?<c>a)\\k<c>", "double" },
+    { "a", "single" },
+};
+
+TEST(UaClassification, BackReference)
+{
+    const ScopeUaClassification uac(backref);
+
+    ASSERT_EQ(uac.Check("xaa"), "double");
+    ASSERT_EQ(uac.Check("xa"), "single");
+    ASSERT_EQ(uac.Check("x"), "(null)");
+}
@@ -30,20 +30,77 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+/*
+ * Parse HTTP headers from stdin and dump them.  With a COUNT
+ * argument, parse the input COUNT times with header_parse_lines()
+ * and print the throughput instead.
+ */
+
 #include "pool/RootPool.hxx"
+#include "pool/Ptr.hxx"
+#include "pool/pool.hxx"
 #include "http/HeaderParser.hxx"
 #include "GrowingBuffer.hxx"
 #include "strmap.hxx"
+#include "util/StringView.hxx"
+
+#include <chrono>
+#include <string>
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+static void
+Benchmark(struct pool &parent_pool, StringView src, unsigned count)
+{
+    size_t n_headers = 0;
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < count; ++i) {
+        const auto pool = pool_new_linear(&parent_pool, "headers", 8192);
+        StringMap headers(pool);
+
+        size_t consumed;
+        header_parse_lines(pool, headers, src, consumed);
 
-int main(int argc gcc_unused, char **argv gcc_unused) {
+        for (const auto &h : headers) {
+            (void)h;
+            ++n_headers;
+        }
+    }
+
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start_time;
+
+    const double n_bytes = double(src.size) * count;
+    printf("%u blocks (%zu headers) in %.3f s = %.0f blocks/s, %.1f MB/s\n",
+           count, n_headers, duration.count(), count / duration.count(),
+           n_bytes / duration.count() / (1024 * 1024));
+}
+
+int main(int argc, char **argv) {
     char buffer[16];
     ssize_t nbytes;
 
     RootPool pool;
 
+    if (argc > 1) {
+        const unsigned count = strtoul(argv[1], nullptr, 10);
+        if (argc > 2 || count == 0) {
+            fprintf(stderr, "usage: %s [COUNT] <HEADERS\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        std::string input;
+        while ((nbytes = read(0, buffer, sizeof(buffer))) > 0)
+            input.append(buffer, nbytes);
+
+        Benchmark(pool, {input.data(), input.size()}, count);
+        return EXIT_SUCCESS;
+    }
+
     GrowingBuffer gb;
 
     /* read input from stdin */
@@ -150,7 +150,7 @@ Connection::Connection(Instance &_instance,
                                            nullptr,
                                            nullptr,
                                            address,
-                                           true,
+                                           true, false,
                                            *this)),
      timer(instance.event_loop, BIND_THIS_METHOD(OnTimer)) {}
 
@@ -35,6 +35,7 @@
 #include "PInstance.hxx"
 #include "fb_pool.hxx"
 #include "bp/XmlProcessor.hxx"
+#include "bp/Global.hxx"
 #include "penv.hxx"
 #include "widget/Inline.hxx"
 #include "widget/Widget.hxx"
@@ -51,6 +52,7 @@
  */
 
 TranslationService *global_translation_service;
+ProcessorCache *global_processor_cache;
 
 UnusedIstreamPtr
 embed_inline_widget(struct pool &pool,
@@ -125,7 +127,7 @@ try {
                           UnusedIstreamPtr(istream_file_new(instance.event_loop,
                                                             instance.root_pool,
                                                             "/dev/stdin", (off_t)-1)),
-                          widget, env, PROCESSOR_CONTAINER);
+                          widget, env, PROCESSOR_CONTAINER, nullptr);
 
     StdioSink sink(std::move(result));
     sink.LoopRead();
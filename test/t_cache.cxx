@@ -84,6 +84,142 @@ my_match(const CacheItem *item, void *ctx)
     return i->match == match;
 }
 
+/**
+ * With #CachePolicy::SLRU, an item which has been hit survives
+ * newer items which have not.
+ */
+static void
+TestSegmentedLru(PInstance &instance)
+{
+    auto *cache = new Cache(instance.event_loop, 1024, 4, CachePolicy::SLRU);
+
+    cache->Put("a", *my_cache_item_new(instance.root_pool, 0, 0));
+    cache->Put("b", *my_cache_item_new(instance.root_pool, 0, 1));
+    cache->Put("c", *my_cache_item_new(instance.root_pool, 0, 2));
+    cache->Put("d", *my_cache_item_new(instance.root_pool, 0, 3));
+
+    /* promote "a" to the protected segment */
+    assert(cache->Get("a") != nullptr);
+
+    /* this evicts "b", the oldest item on probation */
+    cache->Put("e", *my_cache_item_new(instance.root_pool, 0, 4));
+
+    assert(cache->Get("a") != nullptr);
+    assert(cache->Get("b") == nullptr);
+    assert(cache->Get("e") != nullptr);
+
+    assert(cache->GetCounters().evictions == 1);
+
+    delete cache;
+}
+
+/**
+ * With #CachePolicy::TINY_LFU, a new item is only admitted if its
+ * key is more popular than the one it would replace.
+ */
+static void
+TestTinyLfu(PInstance &instance)
+{
+    auto *cache = new Cache(instance.event_loop, 1024, 4,
+                            CachePolicy::TINY_LFU);
+
+    static const char *const keys[] = { "a", "b", "c", "d" };
+    for (const char *key : keys)
+        assert(cache->Put(key, *my_cache_item_new(instance.root_pool, 0, 0)));
+
+    for (unsigned i = 0; i < 2; ++i)
+        for (const char *key : keys)
+            assert(cache->Get(key) != nullptr);
+
+    /* a key which has been requested only once is rejected */
+    assert(cache->Get("e") == nullptr);
+    assert(!cache->Put("e", *my_cache_item_new(instance.root_pool, 0, 1)));
+    assert(cache->GetCounters().rejections == 1);
+
+    for (const char *key : keys)
+        assert(cache->Get(key) != nullptr);
+
+    /* after more requests, it is admitted */
+    assert(cache->Get("e") == nullptr);
+    assert(cache->Get("e") == nullptr);
+    assert(cache->Get("e") == nullptr);
+    assert(cache->Put("e", *my_cache_item_new(instance.root_pool, 0, 1)));
+    assert(cache->Get("e") != nullptr);
+
+    assert(cache->GetCounters().admissions == 5);
+    assert(cache->GetCounters().evictions == 1);
+
+    delete cache;
+}
+
+/**
+ * Cache::Grow() evicts other items to make room for the additional
+ * size.
+ */
+static void
+TestGrow(PInstance &instance)
+{
+    auto *cache = new Cache(instance.event_loop, 1024, 4);
+
+    cache->Put("a", *my_cache_item_new(instance.root_pool, 0, 0));
+    cache->Put("b", *my_cache_item_new(instance.root_pool, 0, 1));
+    cache->Put("c", *my_cache_item_new(instance.root_pool, 0, 2));
+
+    auto *c = cache->Get("c");
+    assert(c != nullptr);
+
+    /* this evicts "a" */
+    assert(cache->Grow(*c, 2));
+    assert(c->GetSize() == 3);
+    assert(cache->Get("a") == nullptr);
+    assert(cache->Get("b") != nullptr);
+
+    /* larger than the whole cache */
+    assert(!cache->Grow(*c, 2));
+    assert(c->GetSize() == 3);
+    assert(cache->Get("c") == c);
+
+    /* this evicts "b" */
+    cache->Put("d", *my_cache_item_new(instance.root_pool, 0, 3));
+    assert(cache->Get("b") == nullptr);
+    assert(cache->Get("c") != nullptr);
+    assert(cache->Get("d") != nullptr);
+
+    delete cache;
+}
+
+/**
+ * An item which is demoted from the protected segment while a sweep
+ * is traversing that segment is still visited.
+ */
+static void
+TestSweepDemoted(PInstance &instance)
+{
+    auto *cache = new Cache(instance.event_loop, 1024, 4, CachePolicy::SLRU);
+
+    cache->Put("a", *my_cache_item_new(instance.root_pool, 1, 0));
+    cache->Put("b", *my_cache_item_new(instance.root_pool, 0, 1));
+
+    /* promote "a" to the protected segment */
+    assert(cache->Get("a") != nullptr);
+
+    /* visit "b"; the cursor moves on to "a" */
+    unsigned n_removed = 0;
+    cache->StartSweep();
+    assert(!cache->SweepStep(1, my_match, match_to_ptr(1), n_removed));
+    assert(n_removed == 0);
+
+    /* promote "b", which demotes "a" behind the cursor */
+    assert(cache->Get("b") != nullptr);
+
+    while (!cache->SweepStep(1, my_match, match_to_ptr(1), n_removed)) {}
+    assert(n_removed == 1);
+    assert(cache->Get("a") == nullptr);
+    assert(cache->Get("b") != nullptr);
+
+    delete cache;
+}
+
 int main(int argc gcc_unused, char **argv gcc_unused) {
     MyCacheItem *i;
 
@@ -168,4 +304,9 @@ int main(int argc gcc_unused, char **argv gcc_unused) {
     /* cleanup */
 
     delete cache;
+
+    TestSegmentedLru(instance);
+    TestTinyLfu(instance);
+    TestGrow(instance);
+    TestSweepDemoted(instance);
 }
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CharScan.hxx"
+#include "html_chars.hxx"
+#include "css_syntax.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+template<typename F>
+static const char *
+Reference(const char *p, const char *end, F &&f)
+{
+    while (p < end && !f(*p))
+        ++p;
+    return p;
+}
+
+static void
+Check(const char *p, const char *end)
+{
+    ASSERT_EQ(FindNonHtmlNameChar(p, end),
+              Reference(p, end, [](char ch){ return !is_html_name_char(ch); }));
+    ASSERT_EQ(SkipWhitespaceOrNull(p, end),
+              Reference(p, end, [](char ch){ return !IsWhitespaceOrNull(ch); }));
+    ASSERT_EQ(FindHtmlUnquotedValueEnd(p, end),
+              Reference(p, end, [](char ch){
+                  return IsWhitespaceOrNull(ch) || ch == '>';
+              }));
+    ASSERT_EQ(FindNonCssNameChar(p, end),
+              Reference(p, end, [](char ch){ return !is_css_nmchar(ch); }));
+    ASSERT_EQ(FindAnyOf(p, end, "};'\"("),
+              Reference(p, end, [](char ch){
+                  return ch != 0 && strchr("};'\"(", ch) != nullptr;
+              }));
+}
+
+/**
+ * Check runs of one character class followed by each possible byte
+ * value, at all lengths around the vector sizes.
+ */
+static void
+CheckAllBytes(const char *run_chars)
+{
+    const size_t n_run_chars = strlen(run_chars);
+
+    char buffer[80];
+    for (size_t length = 0; length < sizeof(buffer) - 1; ++length) {
+        for (size_t i = 0; i < length; ++i)
+            buffer[i] = run_chars[i % n_run_chars];
+
+        for (unsigned ch = 0; ch < 256; ++ch) {
+            buffer[length] = (char)ch;
+            Check(buffer, buffer + length + 1);
+            Check(buffer, buffer + length);
+        }
+    }
+}
+
+static void
+CheckImpl(CharScanImpl impl)
+{
+    if (!SetCharScanImpl(impl))
+        return;
+
+    CheckAllBytes("abcXYZ:_-.019");
+    CheckAllBytes(" \t\r\n");
+    CheckAllBytes("abc\\-_\xc3\xa4" "09");
+    CheckAllBytes("xyz=+/");
+
+    /* pseudo-random data */
+    static constexpr char alphabet[] = "aZ09:_-./ \t\n>};'\"(\\\x80\xff<";
+    char buffer[256];
+    unsigned seed = 42;
+    for (unsigned round = 0; round < 1000; ++round) {
+        for (auto &ch : buffer) {
+            seed = seed * 1103515245 + 12345;
+            ch = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+
+        for (size_t start = 0; start < 40; ++start)
+            Check(buffer + start, buffer + sizeof(buffer));
+    }
+}
+
+TEST(CharScan, Scalar)
+{
+    CheckImpl(CharScanImpl::SCALAR);
+}
+
+TEST(CharScan, SSE2)
+{
+    CheckImpl(CharScanImpl::SSE2);
+}
+
+TEST(CharScan, AVX2)
+{
+    CheckImpl(CharScanImpl::AVX2);
+}
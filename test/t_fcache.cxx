@@ -55,6 +55,7 @@ TestCancelBlocking()
 
         BlockingResourceLoader resource_loader;
         FilterCache *fcache = filter_cache_new(root_pool, 65536,
+                                               CachePolicy::LRU,
                                                event_loop, resource_loader);
 
         ~Context() noexcept {
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TestPool.hxx"
+#include "http/HeaderParser.hxx"
+#include "strmap.hxx"
+#include "util/StringStrip.hxx"
+#include "util/StringView.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include <string.h>
+
+static std::string
+ToString(const StringMap &map)
+{
+    std::string result;
+
+    for (const auto &i : map) {
+        result += i.key;
+        result += '=';
+        result += i.value;
+        result += ';';
+    }
+
+    return result;
+}
+
+/**
+ * The line-by-line algorithm which was used before
+ * header_parse_lines(); this serves as the reference for the
+ * randomized tests.
+ */
+static HeaderParserResult
+ReferenceParse(struct pool &pool, StringMap &headers,
+               StringView src, size_t &consumed_r,
+               size_t max_line_length=SIZE_MAX)
+{
+    const char *start = src.begin(), *end;
+    while ((end = (const char *)memchr(start, '\n',
+                                       src.end() - start)) != nullptr) {
+        const char *const next = end + 1;
+        end = StripRight(start, end);
+
+        if (size_t(end - start) > max_line_length) {
+            consumed_r = start - src.begin();
+            return HeaderParserResult::LINE_TOO_LONG;
+        }
+
+        if (end == start) {
+            consumed_r = next - src.begin();
+            return HeaderParserResult::END;
+        }
+
+        header_parse_line(pool, headers, {start, end});
+        start = next;
+    }
+
+    consumed_r = start - src.begin();
+    return HeaderParserResult::MORE;
+}
+
+TEST(HeaderParserTest, Basic)
+{
+    TestPool pool;
+    StringMap headers(pool);
+
+    const char *src =
+        "Host: www.example.com\r\n"
+        "Content-Type:text/html\r\n"
+        "X-Empty:\r\n"
+        "X-Spaces:   foo bar  \r\n"
+        "no colon\r\n"
+        ": no name\r\n"
+        "Accept: */*\n"
+        "\r\n"
+        "body";
+
+    size_t consumed;
+    ASSERT_EQ(header_parse_lines(pool, headers, src, consumed),
+              HeaderParserResult::END);
+    ASSERT_EQ(consumed, strlen(src) - 4);
+    ASSERT_EQ(ToString(headers),
+              "accept=*/*;content-type=text/html;host=www.example.com;"
+              "x-empty=;x-spaces=foo bar;");
+}
+
+TEST(HeaderParserTest, Incomplete)
+{
+    TestPool pool;
+    StringMap headers(pool);
+
+    size_t consumed;
+    ASSERT_EQ(header_parse_lines(pool, headers,
+                                 "Host: example.com\r\nAccept: te",
+                                 consumed),
+              HeaderParserResult::MORE);
+    ASSERT_EQ(consumed, 19u);
+    ASSERT_EQ(ToString(headers), "host=example.com;");
+
+    /* no colon, no newline */
+    ASSERT_EQ(header_parse_lines(pool, headers, "Accept", consumed),
+              HeaderParserResult::MORE);
+    ASSERT_EQ(consumed, 0u);
+
+    ASSERT_EQ(header_parse_lines(pool, headers, "", consumed),
+              HeaderParserResult::MORE);
+    ASSERT_EQ(consumed, 0u);
+}
+
+TEST(HeaderParserTest, LineTooLong)
+{
+    TestPool pool;
+    StringMap headers(pool);
+
+    const std::string src = "Host: example.com\r\nX-Foo: " +
+        std::string(100, 'x') + "\r\n\r\n";
+
+    size_t consumed;
+    ASSERT_EQ(header_parse_lines(pool, headers, {src.data(), src.size()},
+                                 consumed, 64),
+              HeaderParserResult::LINE_TOO_LONG);
+    ASSERT_EQ(consumed, 19u);
+
+    /* trailing whitespace is not counted */
+    StringMap headers2(pool);
+    ASSERT_EQ(header_parse_lines(pool, headers2,
+                                 "X-Foo: 12345678  \r\n\r\n",
+                                 consumed, 15),
+              HeaderParserResult::END);
+    ASSERT_EQ(ToString(headers2), "x-foo=12345678;");
+}
+
+/**
+ * Generate random header blocks which are biased towards the
+ * characters the parser cares about.
+ */
+static std::string
+RandomHeaders(std::mt19937 &rng)
+{
+    static constexpr char alphabet[] =
+        "::::\n\n\r\r    \t\tAaZz-_09";
+
+    std::string result;
+    const unsigned length = rng() % 256;
+    for (unsigned i = 0; i < length; ++i) {
+        switch (rng() % 8) {
+        case 0:
+            /* any byte, including null and non-ASCII */
+            result.push_back(char(rng()));
+            break;
+
+        case 1:
+            result += "\r\n";
+            break;
+
+        case 2:
+            /* long run of name characters, to exercise the vector
+               code */
+            result.append(rng() % 40, 'a' + rng() % 26);
+            break;
+
+        default:
+            result.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+            break;
+        }
+    }
+
+    return result;
+}
+
+TEST(HeaderParserTest, Fuzz)
+{
+    std::mt19937 rng(42);
+
+    for (unsigned i = 0; i < 20000; ++i) {
+        const auto src = RandomHeaders(rng);
+        const size_t max_line_length = rng() % 2 ? SIZE_MAX : rng() % 64;
+
+        TestPool pool;
+        StringMap expected_headers(pool), headers(pool);
+
+        size_t expected_consumed, consumed;
+        const auto expected =
+            ReferenceParse(pool, expected_headers, {src.data(), src.size()},
+                           expected_consumed, max_line_length);
+        const auto result =
+            header_parse_lines(pool, headers, {src.data(), src.size()},
+                               consumed, max_line_length);
+
+        ASSERT_EQ(result, expected);
+        ASSERT_EQ(consumed, expected_consumed);
+        ASSERT_EQ(ToString(headers), ToString(expected_headers));
+    }
+}
+
+/**
+ * Feed random header blocks in random fragments, like they arrive
+ * from a socket, and compare with parsing everything at once.
+ */
+TEST(HeaderParserTest, FuzzFragmented)
+{
+    std::mt19937 rng(1234);
+
+    for (unsigned i = 0; i < 5000; ++i) {
+        const auto src = RandomHeaders(rng) + "\r\n\r\n";
+
+        TestPool pool;
+        StringMap expected_headers(pool), headers(pool);
+
+        size_t expected_consumed;
+        ASSERT_EQ(header_parse_lines(pool, expected_headers,
+                                     {src.data(), src.size()},
+                                     expected_consumed),
+                  HeaderParserResult::END);
+
+        size_t position = 0, available = 0;
+        HeaderParserResult result = HeaderParserResult::MORE;
+        while (result == HeaderParserResult::MORE) {
+            ASSERT_LT(available, src.size());
+            available = std::min<size_t>(src.size(),
+                                         available + 1 + rng() % 32);
+
+            size_t consumed;
+            result = header_parse_lines(pool, headers,
+                                        {src.data() + position,
+                                         available - position},
+                                        consumed);
+            position += consumed;
+        }
+
+        ASSERT_EQ(result, HeaderParserResult::END);
+        ASSERT_EQ(position, expected_consumed);
+        ASSERT_EQ(ToString(headers), ToString(expected_headers));
+    }
+}
@@ -0,0 +1,482 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tests for the HTTP/2 client (http2_client.cxx).  The server side
+ * is scripted with a libnghttp2 server session on a raw socket.
+ */
+
+#include "http2_client.hxx"
+#include "http_client.hxx"
+#include "http/Headers.hxx"
+#include "HttpResponseHandler.hxx"
+#include "lease.hxx"
+#include "strmap.hxx"
+#include "PInstance.hxx"
+#include "pool/pool.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/Sink.hxx"
+#include "fb_pool.hxx"
+#include "fs/FilteredSocket.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/Cancellable.hxx"
+#include "util/Exception.hxx"
+#include "util/PrintException.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <nghttp2/nghttp2.h>
+
+#include <string>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A HTTP/2 server which sends and receives frames on the raw server
+ * socket.  Requests are handled by the #on_request callback.
+ */
+class Server {
+    UniqueSocketDescriptor fd;
+
+    nghttp2_session *session;
+
+public:
+    enum class Mode {
+        /**
+         * Respond with "200 OK" and the body "foo".
+         */
+        RESPOND,
+
+        /**
+         * Reset the stream with REFUSED_STREAM.
+         */
+        REFUSE,
+    } mode = Mode::RESPOND;
+
+    unsigned n_requests = 0;
+
+    explicit Server(UniqueSocketDescriptor &&_fd);
+
+    ~Server() noexcept {
+        nghttp2_session_del(session);
+    }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    void SendGoaway() {
+        nghttp2_submit_goaway(session, NGHTTP2_FLAG_NONE,
+                              nghttp2_session_get_last_proc_stream_id(session),
+                              NGHTTP2_NO_ERROR, nullptr, 0);
+    }
+
+    void Pump();
+
+private:
+    void OnRequest(int32_t stream_id) noexcept;
+
+    static ssize_t SendCallback(nghttp2_session *, const uint8_t *data,
+                                size_t length, int, void *user_data) noexcept {
+        auto &s = *(Server *)user_data;
+        ssize_t nbytes = s.fd.Write(data, length);
+        if (nbytes < 0)
+            return errno == EAGAIN
+                ? NGHTTP2_ERR_WOULDBLOCK
+                : NGHTTP2_ERR_CALLBACK_FAILURE;
+
+        return nbytes;
+    }
+
+    static int OnFrameRecvCallback(nghttp2_session *,
+                                   const nghttp2_frame *frame,
+                                   void *user_data) noexcept {
+        auto &s = *(Server *)user_data;
+        if (frame->hd.type == NGHTTP2_HEADERS &&
+            frame->headers.cat == NGHTTP2_HCAT_REQUEST &&
+            (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0)
+            s.OnRequest(frame->hd.stream_id);
+        return 0;
+    }
+
+    static ssize_t ReadBodyCallback(nghttp2_session *, int32_t,
+                                    uint8_t *buf, size_t length,
+                                    uint32_t *data_flags,
+                                    nghttp2_data_source *,
+                                    void *) noexcept {
+        static constexpr char body[] = "foo";
+        size_t n = std::min(length, sizeof(body) - 1);
+        memcpy(buf, body, n);
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return n;
+    }
+};
+
+Server::Server(UniqueSocketDescriptor &&_fd)
+    :fd(std::move(_fd))
+{
+    fd.SetNonBlocking();
+
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_send_callback(callbacks, SendCallback);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                         OnFrameRecvCallback);
+
+    int rv = nghttp2_session_server_new(&session, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rv != 0)
+        throw FormatRuntimeError("nghttp2_session_server_new() failed: %s",
+                                 nghttp2_strerror(rv));
+
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, nullptr, 0);
+}
+
+void
+Server::OnRequest(int32_t stream_id) noexcept
+{
+    ++n_requests;
+
+    switch (mode) {
+    case Mode::RESPOND:
+        {
+            static constexpr char status_name[] = ":status";
+            static constexpr char status_value[] = "200";
+            const nghttp2_nv nva[] = {
+                {
+                    (uint8_t *)const_cast<char *>(status_name),
+                    (uint8_t *)const_cast<char *>(status_value),
+                    sizeof(status_name) - 1, sizeof(status_value) - 1,
+                    NGHTTP2_NV_FLAG_NONE,
+                },
+            };
+
+            nghttp2_data_provider provider;
+            provider.source.ptr = nullptr;
+            provider.read_callback = ReadBodyCallback;
+
+            nghttp2_submit_response(session, stream_id, nva, 1, &provider);
+        }
+        break;
+
+    case Mode::REFUSE:
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id,
+                                  NGHTTP2_REFUSED_STREAM);
+        break;
+    }
+}
+
+void
+Server::Pump()
+{
+    struct pollfd pfd = {
+        .fd = fd.Get(),
+        .events = POLLIN,
+        .revents = 0,
+    };
+
+    if (poll(&pfd, 1, 10) > 0) {
+        uint8_t buffer[4096];
+        ssize_t nbytes = fd.Read(buffer, sizeof(buffer));
+        if (nbytes > 0) {
+            ssize_t consumed = nghttp2_session_mem_recv(session, buffer,
+                                                        nbytes);
+            if (consumed < 0)
+                throw FormatRuntimeError("nghttp2_session_mem_recv() failed: %s",
+                                         nghttp2_strerror(consumed));
+        } else if (nbytes < 0 && errno != EAGAIN)
+            throw MakeErrno("Failed to read");
+    }
+
+    int rv = nghttp2_session_send(session);
+    if (rv != 0)
+        throw FormatRuntimeError("nghttp2_session_send() failed: %s",
+                                 nghttp2_strerror(rv));
+}
+
+/**
+ * The client side: owns the socket and the #Http2ClientConnection.
+ */
+class Connection final : Http2ClientConnectionHandler {
+    FilteredSocket socket;
+
+    Http2ClientConnection *connection;
+
+public:
+    bool faded = false;
+
+    Connection(EventLoop &event_loop, UniqueSocketDescriptor &&fd)
+        :socket(event_loop)
+    {
+        socket.InitDummy(fd.Release(), FdType::FD_SOCKET);
+        connection = http2_client_connection_new(socket, "test", *this);
+    }
+
+    ~Connection() noexcept {
+        http2_client_connection_free(connection);
+
+        if (socket.IsValid() && socket.IsConnected()) {
+            socket.Close();
+            socket.Destroy();
+        }
+    }
+
+    auto &GetEventLoop() noexcept {
+        return socket.GetEventLoop();
+    }
+
+    bool IsUsable() const noexcept {
+        return http2_client_connection_is_usable(*connection);
+    }
+
+    Http2ClientConnection &Get() noexcept {
+        return *connection;
+    }
+
+private:
+    /* virtual methods from class Http2ClientConnectionHandler */
+    void OnHttp2ClientFade() noexcept override {
+        faded = true;
+    }
+};
+
+class Request final : Lease, HttpResponseHandler, IstreamSink {
+    CancellablePointer cancel_ptr;
+
+public:
+    std::exception_ptr error;
+    std::string body;
+    http_status_t status{};
+
+    bool eof = false;
+    bool released = false, reuse = false;
+
+    void Send(struct pool &pool, Connection &connection) {
+        http2_client_request(pool, connection.Get(), *this,
+                             HTTP_METHOD_GET, "/", HttpHeaders(pool),
+                             nullptr, *this, cancel_ptr);
+    }
+
+    bool IsDone() const noexcept {
+        return (error || eof) && released;
+    }
+
+    void WaitDone(Connection &connection, Server &server) {
+        for (unsigned i = 0; i < 1000 && !IsDone(); ++i) {
+            connection.GetEventLoop().LoopOnceNonBlock();
+            server.Pump();
+        }
+
+        if (!IsDone())
+            throw std::runtime_error("Timeout");
+    }
+
+    void ExpectResponse() const {
+        if (error)
+            std::rethrow_exception(error);
+
+        if (status != HTTP_STATUS_OK)
+            throw FormatRuntimeError("Got status %d, expected 200",
+                                     int(status));
+
+        if (body != "foo")
+            throw FormatRuntimeError("Got response body '%s', expected 'foo'",
+                                     body.c_str());
+    }
+
+    void ExpectRefused() const {
+        if (!error)
+            throw std::runtime_error("REFUSED error expected");
+
+        try {
+            FindRetrowNested<HttpClientError>(error);
+        } catch (const HttpClientError &e) {
+            if (e.GetCode() == HttpClientErrorCode::REFUSED)
+                return;
+        }
+
+        std::rethrow_exception(error);
+    }
+
+private:
+    /* virtual methods from class Lease */
+    void ReleaseLease(bool _reuse) noexcept override {
+        released = true;
+        reuse = _reuse;
+    }
+
+    /* virtual methods from class HttpResponseHandler */
+    void OnHttpResponse(http_status_t _status, StringMap &&,
+                        UnusedIstreamPtr _body) noexcept override {
+        status = _status;
+
+        IstreamSink::SetInput(std::move(_body));
+        input.Read();
+    }
+
+    void OnHttpError(std::exception_ptr ep) noexcept override {
+        error = std::move(ep);
+    }
+
+    /* virtual methods from class IstreamHandler */
+    size_t OnData(const void *data, size_t length) noexcept override {
+        body.append((const char *)data, length);
+        return length;
+    }
+
+    void OnEof() noexcept override {
+        IstreamSink::ClearInput();
+        eof = true;
+    }
+
+    void OnError(std::exception_ptr ep) noexcept override {
+        IstreamSink::ClearInput();
+        error = std::move(ep);
+    }
+};
+
+struct Context {
+    UniqueSocketDescriptor client_socket, server_socket;
+
+    Context() {
+        if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_STREAM, 0,
+                                                      client_socket,
+                                                      server_socket))
+            throw MakeErrno("socketpair() failed");
+    }
+};
+
+/**
+ * SETTINGS are exchanged, and one stream is answered.
+ */
+static void
+TestSimple(struct pool &pool, EventLoop &event_loop)
+{
+    Context c;
+    Server server(std::move(c.server_socket));
+    Connection connection(event_loop, std::move(c.client_socket));
+
+    Request request;
+    request.Send(pool, connection);
+    request.WaitDone(connection, server);
+    request.ExpectResponse();
+
+    if (!request.reuse)
+        throw std::runtime_error("Stream lease not reusable");
+
+    if (!connection.IsUsable())
+        throw std::runtime_error("Connection not usable");
+}
+
+/**
+ * GOAWAY makes the connection unusable for new streams.
+ */
+static void
+TestGoaway(struct pool &pool, EventLoop &event_loop)
+{
+    Context c;
+    Server server(std::move(c.server_socket));
+    Connection connection(event_loop, std::move(c.client_socket));
+
+    Request request;
+    request.Send(pool, connection);
+    request.WaitDone(connection, server);
+    request.ExpectResponse();
+
+    server.SendGoaway();
+
+    for (unsigned i = 0; i < 1000 && !connection.faded; ++i) {
+        server.Pump();
+        event_loop.LoopOnceNonBlock();
+    }
+
+    if (!connection.faded)
+        throw std::runtime_error("No fade after GOAWAY");
+
+    if (connection.IsUsable())
+        throw std::runtime_error("Connection still usable after GOAWAY");
+}
+
+/**
+ * REFUSED_STREAM is reported as HttpClientErrorCode::REFUSED, which
+ * makes the caller retry the request; the retry succeeds.
+ */
+static void
+TestRefusedStream(struct pool &pool, EventLoop &event_loop)
+{
+    Context c;
+    Server server(std::move(c.server_socket));
+    Connection connection(event_loop, std::move(c.client_socket));
+
+    server.mode = Server::Mode::REFUSE;
+
+    Request refused;
+    refused.Send(pool, connection);
+    refused.WaitDone(connection, server);
+    refused.ExpectRefused();
+
+    /* retry */
+    server.mode = Server::Mode::RESPOND;
+
+    Request retry;
+    retry.Send(pool, connection);
+    retry.WaitDone(connection, server);
+    retry.ExpectResponse();
+
+    if (server.n_requests != 2)
+        throw FormatRuntimeError("Server got %u requests, expected 2",
+                                 server.n_requests);
+}
+
+int
+main(int argc, char **argv) noexcept
+try {
+    (void)argc;
+    (void)argv;
+
+    const ScopeFbPoolInit fb_pool_init;
+    PInstance instance;
+
+    {
+        auto pool = pool_new_libc(instance.root_pool, "test");
+        TestSimple(pool, instance.event_loop);
+        TestGoaway(pool, instance.event_loop);
+        TestRefusedStream(pool, instance.event_loop);
+    }
+
+    instance.event_loop.Dispatch();
+} catch (...) {
+    PrintException(std::current_exception());
+    return EXIT_FAILURE;
+}
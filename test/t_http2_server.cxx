@@ -0,0 +1,516 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tests for the HTTP/2 server (Http2Connection.cxx).  The client
+ * side is scripted with a libnghttp2 client session on a raw socket.
+ */
+
+#include "http_server/http_server.hxx"
+#include "http_server/Request.hxx"
+#include "http_server/Handler.hxx"
+#include "http/Headers.hxx"
+#include "PInstance.hxx"
+#include "pool/pool.hxx"
+#include "pool/Holder.hxx"
+#include "istream/UnusedPtr.hxx"
+#include "istream/istream_string.hxx"
+#include "fb_pool.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/Cancellable.hxx"
+#include "util/PrintException.hxx"
+#include "util/RuntimeError.hxx"
+
+#include <nghttp2/nghttp2.h>
+
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+class Server final : PoolHolder, HttpServerConnectionHandler {
+    HttpServerConnection *connection = nullptr;
+
+    std::function<void(HttpServerRequest &request,
+                       CancellablePointer &cancel_ptr)> request_handler;
+
+public:
+    /**
+     * The client side of the socket pair.
+     */
+    UniqueSocketDescriptor client_socket;
+
+    /**
+     * The number of LogHttpRequest() calls, and how many of them saw
+     * a HttpServerRequest::handler_data which does not belong to the
+     * request.
+     */
+    unsigned n_logged = 0, n_mismatched = 0;
+
+    Server(struct pool &_pool, EventLoop &event_loop, bool http2);
+
+    ~Server() noexcept {
+        if (connection != nullptr)
+            http_server_connection_close(connection);
+    }
+
+    bool IsConnected() const noexcept {
+        return connection != nullptr;
+    }
+
+    template<typename T>
+    void SetRequestHandler(T &&handler) noexcept {
+        request_handler = std::forward<T>(handler);
+    }
+
+private:
+    /* virtual methods from class HttpServerConnectionHandler */
+    void RequestHeadersFinished(HttpServerRequest &request) noexcept override {
+        request.handler_data = p_strdup(request.pool, request.uri);
+    }
+
+    void HandleHttpRequest(HttpServerRequest &request,
+                           CancellablePointer &cancel_ptr) noexcept override {
+        request_handler(request, cancel_ptr);
+    }
+
+    void LogHttpRequest(HttpServerRequest &request,
+                        http_status_t, int64_t,
+                        uint64_t, uint64_t) noexcept override {
+        ++n_logged;
+
+        if (request.handler_data == nullptr ||
+            strcmp((const char *)request.handler_data, request.uri) != 0)
+            ++n_mismatched;
+    }
+
+    void HttpConnectionError(std::exception_ptr) noexcept override {
+        connection = nullptr;
+    }
+
+    void HttpConnectionClosed() noexcept override {
+        connection = nullptr;
+    }
+};
+
+Server::Server(struct pool &_pool, EventLoop &event_loop, bool http2)
+    :PoolHolder(pool_new_libc(&_pool, "server"))
+{
+    UniqueSocketDescriptor server_socket;
+    if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_STREAM, 0,
+                                                  client_socket, server_socket))
+        throw MakeErrno("socketpair() failed");
+
+    client_socket.SetNonBlocking();
+
+    connection = http_server_connection_new(pool, event_loop,
+                                            std::move(server_socket),
+                                            FdType::FD_SOCKET,
+                                            nullptr,
+                                            nullptr, nullptr,
+                                            true, http2, *this);
+}
+
+/**
+ * A HTTP/2 client which sends and receives frames on the raw client
+ * socket.
+ */
+class Client {
+    EventLoop &event_loop;
+
+    SocketDescriptor fd;
+
+    nghttp2_session *session;
+
+public:
+    bool settings_received = false;
+
+    int32_t stream_id = -1;
+
+    /**
+     * The response of #stream_id.
+     */
+    unsigned status = 0;
+    std::string body;
+
+    bool stream_closed = false;
+    uint32_t stream_error_code = 0;
+
+    Client(EventLoop &_event_loop, SocketDescriptor _fd);
+
+    ~Client() noexcept {
+        nghttp2_session_del(session);
+    }
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    void SendGet(const char *path);
+
+    void SendRstStream() {
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id,
+                                  NGHTTP2_CANCEL);
+    }
+
+    /**
+     * Exchange data until the given condition becomes true.
+     */
+    template<typename P>
+    void WaitFor(P &&predicate) {
+        for (unsigned i = 0; i < 1000; ++i) {
+            if (predicate())
+                return;
+
+            Pump();
+        }
+
+        throw std::runtime_error("Timeout");
+    }
+
+private:
+    void Pump();
+
+    static ssize_t SendCallback(nghttp2_session *, const uint8_t *data,
+                                size_t length, int, void *user_data) noexcept {
+        auto &c = *(Client *)user_data;
+        ssize_t nbytes = c.fd.Write(data, length);
+        if (nbytes < 0)
+            return errno == EAGAIN
+                ? NGHTTP2_ERR_WOULDBLOCK
+                : NGHTTP2_ERR_CALLBACK_FAILURE;
+
+        return nbytes;
+    }
+
+    static int OnFrameRecvCallback(nghttp2_session *,
+                                   const nghttp2_frame *frame,
+                                   void *user_data) noexcept {
+        auto &c = *(Client *)user_data;
+        if (frame->hd.type == NGHTTP2_SETTINGS)
+            c.settings_received = true;
+        return 0;
+    }
+
+    static int OnHeaderCallback(nghttp2_session *,
+                                const nghttp2_frame *frame,
+                                const uint8_t *name, size_t namelen,
+                                const uint8_t *value, size_t valuelen,
+                                uint8_t, void *user_data) noexcept {
+        auto &c = *(Client *)user_data;
+        if (frame->hd.stream_id == c.stream_id &&
+            namelen == 7 && memcmp(name, ":status", 7) == 0)
+            c.status = atoi(std::string((const char *)value,
+                                        valuelen).c_str());
+        return 0;
+    }
+
+    static int OnDataChunkRecvCallback(nghttp2_session *, uint8_t,
+                                       int32_t stream_id,
+                                       const uint8_t *data, size_t len,
+                                       void *user_data) noexcept {
+        auto &c = *(Client *)user_data;
+        if (stream_id == c.stream_id)
+            c.body.append((const char *)data, len);
+        return 0;
+    }
+
+    static int OnStreamCloseCallback(nghttp2_session *, int32_t stream_id,
+                                     uint32_t error_code,
+                                     void *user_data) noexcept {
+        auto &c = *(Client *)user_data;
+        if (stream_id == c.stream_id) {
+            c.stream_closed = true;
+            c.stream_error_code = error_code;
+        }
+        return 0;
+    }
+};
+
+Client::Client(EventLoop &_event_loop, SocketDescriptor _fd)
+    :event_loop(_event_loop), fd(_fd)
+{
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_send_callback(callbacks, SendCallback);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                         OnFrameRecvCallback);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks,
+                                                     OnHeaderCallback);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                              OnDataChunkRecvCallback);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                           OnStreamCloseCallback);
+
+    int rv = nghttp2_session_client_new(&session, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rv != 0)
+        throw FormatRuntimeError("nghttp2_session_client_new() failed: %s",
+                                 nghttp2_strerror(rv));
+
+    /* this sends the connection preface */
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, nullptr, 0);
+}
+
+static nghttp2_nv
+MakeNv(const char *name, const char *value) noexcept
+{
+    return {
+        (uint8_t *)const_cast<char *>(name),
+        (uint8_t *)const_cast<char *>(value),
+        strlen(name), strlen(value),
+        NGHTTP2_NV_FLAG_NONE,
+    };
+}
+
+void
+Client::SendGet(const char *path)
+{
+    const nghttp2_nv nva[] = {
+        MakeNv(":method", "GET"),
+        MakeNv(":scheme", "http"),
+        MakeNv(":authority", "localhost"),
+        MakeNv(":path", path),
+    };
+
+    stream_id = nghttp2_submit_request(session, nullptr,
+                                       nva, std::size(nva),
+                                       nullptr, nullptr);
+    if (stream_id < 0)
+        throw FormatRuntimeError("nghttp2_submit_request() failed: %s",
+                                 nghttp2_strerror(stream_id));
+
+    status = 0;
+    body.clear();
+    stream_closed = false;
+    stream_error_code = 0;
+}
+
+void
+Client::Pump()
+{
+    int rv = nghttp2_session_send(session);
+    if (rv != 0)
+        throw FormatRuntimeError("nghttp2_session_send() failed: %s",
+                                 nghttp2_strerror(rv));
+
+    event_loop.LoopOnceNonBlock();
+
+    struct pollfd pfd = {
+        .fd = fd.Get(),
+        .events = POLLIN,
+        .revents = 0,
+    };
+
+    if (poll(&pfd, 1, 10) <= 0)
+        return;
+
+    uint8_t buffer[4096];
+    ssize_t nbytes = fd.Read(buffer, sizeof(buffer));
+    if (nbytes < 0) {
+        if (errno == EAGAIN)
+            return;
+
+        throw MakeErrno("Failed to read");
+    }
+
+    if (nbytes == 0)
+        throw std::runtime_error("Server closed the connection");
+
+    ssize_t consumed = nghttp2_session_mem_recv(session, buffer, nbytes);
+    if (consumed < 0)
+        throw FormatRuntimeError("nghttp2_session_mem_recv() failed: %s",
+                                 nghttp2_strerror(consumed));
+}
+
+/**
+ * The connection preface is accepted, and one request/response is
+ * exchanged.
+ */
+static void
+TestSimple(struct pool &pool, EventLoop &event_loop)
+{
+    Server server(pool, event_loop, true);
+    server.SetRequestHandler([](HttpServerRequest &request, CancellablePointer &) noexcept {
+        http_server_response(&request, HTTP_STATUS_OK, HttpHeaders(request.pool),
+                             istream_string_new(request.pool, "foo"));
+    });
+
+    Client client(event_loop, server.client_socket);
+    client.WaitFor([&client]{ return client.settings_received; });
+
+    client.SendGet("/");
+    client.WaitFor([&client]{ return client.stream_closed; });
+
+    if (client.stream_error_code != NGHTTP2_NO_ERROR)
+        throw FormatRuntimeError("Stream error %u",
+                                 unsigned(client.stream_error_code));
+
+    if (client.status != 200)
+        throw FormatRuntimeError("Got status %u, expected 200",
+                                 client.status);
+
+    if (client.body != "foo")
+        throw FormatRuntimeError("Got response body '%s', expected 'foo'",
+                                 client.body.c_str());
+
+    /* the connection remains usable for another stream */
+    client.SendGet("/again");
+    client.WaitFor([&client]{ return client.stream_closed; });
+
+    if (client.status != 200 || client.body != "foo")
+        throw std::runtime_error("Second request failed");
+}
+
+/**
+ * Two concurrent streams on one connection: each request keeps its
+ * own HttpServerRequest::handler_data until it is logged.
+ */
+static void
+TestConcurrentStreams(struct pool &pool, EventLoop &event_loop)
+{
+    std::vector<HttpServerRequest *> pending;
+
+    Server server(pool, event_loop, true);
+    server.SetRequestHandler([&pending](HttpServerRequest &request, CancellablePointer &) noexcept {
+        /* respond later, after both requests have arrived */
+        pending.push_back(&request);
+    });
+
+    Client client(event_loop, server.client_socket);
+    client.SendGet("/a");
+    client.SendGet("/b");
+    client.WaitFor([&pending]{ return pending.size() == 2; });
+
+    /* respond in reverse order */
+    for (auto i = pending.rbegin(); i != pending.rend(); ++i) {
+        auto &request = **i;
+        http_server_response(&request, HTTP_STATUS_OK,
+                             HttpHeaders(request.pool),
+                             istream_string_new(request.pool, "foo"));
+    }
+
+    client.WaitFor([&server]{ return server.n_logged == 2; });
+
+    if (server.n_mismatched > 0)
+        throw std::runtime_error("Request data was shared between streams");
+}
+
+/**
+ * RST_STREAM from the client cancels the request handler.
+ */
+static void
+TestCancel(struct pool &pool, EventLoop &event_loop)
+{
+    struct PendingRequest final : Cancellable {
+        bool received = false, canceled = false;
+
+        void Cancel() noexcept override {
+            canceled = true;
+        }
+    } pending;
+
+    Server server(pool, event_loop, true);
+    server.SetRequestHandler([&pending](HttpServerRequest &, CancellablePointer &cancel_ptr) noexcept {
+        /* never respond */
+        pending.received = true;
+        cancel_ptr = pending;
+    });
+
+    Client client(event_loop, server.client_socket);
+    client.SendGet("/");
+    client.WaitFor([&pending]{ return pending.received; });
+
+    client.SendRstStream();
+    client.WaitFor([&pending]{ return pending.canceled; });
+
+    if (!server.IsConnected())
+        throw std::runtime_error("Connection closed after RST_STREAM");
+}
+
+/**
+ * Without the "http2" option, the connection preface is not
+ * accepted.
+ */
+static void
+TestDisabled(struct pool &pool, EventLoop &event_loop)
+{
+    bool handled = false;
+
+    Server server(pool, event_loop, false);
+    server.SetRequestHandler([&handled](HttpServerRequest &request, CancellablePointer &) noexcept {
+        handled = true;
+        http_server_response(&request, HTTP_STATUS_OK, HttpHeaders(request.pool),
+                             istream_string_new(request.pool, "foo"));
+    });
+
+    static constexpr char preface[] = NGHTTP2_CLIENT_MAGIC;
+    if (server.client_socket.Write(preface, sizeof(preface) - 1) < 0)
+        throw MakeErrno("Failed to write");
+
+    for (unsigned i = 0; i < 100 && server.IsConnected(); ++i)
+        event_loop.LoopOnceNonBlock();
+
+    char buffer[256];
+    ssize_t nbytes = server.client_socket.Read(buffer, sizeof(buffer) - 1);
+    if (nbytes > 0) {
+        buffer[nbytes] = 0;
+        if (memcmp(buffer, "HTTP/1.1 ", 9) != 0)
+            throw FormatRuntimeError("Unexpected response: %s", buffer);
+    }
+
+    if (handled)
+        throw std::runtime_error("HTTP/2 request was handled");
+}
+
+int
+main(int argc, char **argv) noexcept
+try {
+    (void)argc;
+    (void)argv;
+
+    const ScopeFbPoolInit fb_pool_init;
+    PInstance instance;
+
+    TestSimple(instance.root_pool, instance.event_loop);
+    TestConcurrentStreams(instance.root_pool, instance.event_loop);
+    TestCancel(instance.root_pool, instance.event_loop);
+    TestDisabled(instance.root_pool, instance.event_loop);
+} catch (...) {
+    PrintException(std::current_exception());
+    return EXIT_FAILURE;
+}
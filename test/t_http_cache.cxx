@@ -45,6 +45,7 @@
 #include "istream/UnusedPtr.hxx"
 #include "istream/istream.hxx"
 #include "istream/istream_string.hxx"
+#include "istream/sink_null.hxx"
 #include "util/Cancellable.hxx"
 #include "util/PrintException.hxx"
 #include "util/Compiler.h"
@@ -128,6 +129,44 @@ static Request requests[] = {
       "expires: " EXPIRES "\n",
       "foo",
     },
+
+    /* two "Vary" variants with the same validators */
+    { "/vary", "x-foo: a\n",
+      "date: " DATE "\n"
+      "last-modified: " STAMP1 "\n"
+      "expires: " EXPIRES "\n"
+      "vary: x-foo\n",
+      "identity body a",
+    },
+    { "/vary", "x-foo: b\n",
+      "date: " DATE "\n"
+      "last-modified: " STAMP1 "\n"
+      "expires: " EXPIRES "\n"
+      "vary: x-foo\n",
+      "identity body b",
+    },
+    { "/vary", "x-foo: a\naccept-encoding: gzip\n",
+      "last-modified: " STAMP1 "\n"
+      "vary: x-foo\n",
+      "identity body a",
+    },
+    { "/vary", "x-foo: b\naccept-encoding: gzip\n",
+      "last-modified: " STAMP1 "\n"
+      "content-encoding: gzip\n",
+      "gzip b",
+    },
+    { "/vary", "x-foo: b\naccept-encoding: gzip\n",
+      "last-modified: " STAMP1 "\n"
+      "vary: x-foo\n",
+      "identity body b",
+    },
+
+    /* a "Range" request for variant "b"; only used for
+       http_cache_put_encoded() */
+    { "/vary", "x-foo: b\nrange: bytes=0-3\n",
+      nullptr,
+      nullptr,
+    },
 };
 
 static HttpCache *cache;
@@ -276,6 +315,32 @@ Context::OnHttpError(std::exception_ptr ep) noexcept
     FAIL();
 }
 
+/**
+ * Pretend the response for the given request has been compressed by
+ * the caller, and pass the compressed body to
+ * http_cache_put_encoded().
+ */
+static void
+run_put_encoded(PInstance &instance, unsigned num, http_status_t status,
+                const char *encoded_body)
+{
+    const Request *request = &requests[num];
+    auto pool = pool_new_linear(instance.root_pool, "t_http_cache", 8192);
+    const auto uwa = MakeHttpAddress(request->uri).Host("foo");
+    const ResourceAddress address(uwa);
+
+    StringMap &headers = *parse_request_headers(pool, *request);
+
+    auto body = http_cache_put_encoded(*cache, pool, address, headers,
+                                       status, nullptr, STAMP1, "gzip",
+                                       istream_string_new(pool,
+                                                          encoded_body));
+    sink_null_new(pool, std::move(body));
+
+    for (unsigned i = 0; i < 16; ++i)
+        instance.event_loop.LoopOnceNonBlock();
+}
+
 static void
 run_cache_test(struct pool *root_pool, unsigned num, bool cached)
 {
@@ -316,7 +381,8 @@ TEST(HttpCache, Basic)
 
     MyResourceLoader resource_loader;
 
-    cache = http_cache_new(instance.root_pool, 1024 * 1024,
+    cache = http_cache_new(instance.root_pool, 1024 * 1024, CachePolicy::LRU,
+                           0, nullptr, 0,
                            instance.event_loop, resource_loader);
 
     /* request one resource, cold and warm cache */
@@ -348,3 +414,59 @@ TEST(HttpCache, Basic)
 
     http_cache_close(cache);
 }
+
+/**
+ * Store an encoded variant of one "Vary" variant and verify that it
+ * is served only to requests which select this variant, even though
+ * the other variant has the same validators.
+ */
+TEST(HttpCache, EncodedVary)
+{
+    const ScopeFbPoolInit fb_pool_init;
+    PInstance instance;
+
+    MyResourceLoader resource_loader;
+
+    cache = http_cache_new(instance.root_pool, 1024 * 1024, CachePolicy::LRU,
+                           0, nullptr, 0,
+                           instance.event_loop, resource_loader);
+
+    run_cache_test(instance.root_pool, 4, false);
+    run_cache_test(instance.root_pool, 5, false);
+
+    run_put_encoded(instance, 5, HTTP_STATUS_OK, "gzip b");
+
+    /* variant "a" has no encoded body */
+    run_cache_test(instance.root_pool, 6, true);
+
+    /* variant "b" is served encoded */
+    run_cache_test(instance.root_pool, 7, true);
+
+    http_cache_close(cache);
+}
+
+/**
+ * A partial response (status 206 or a "Range" request) must not be
+ * stored as the encoded variant of the whole resource.
+ */
+TEST(HttpCache, EncodedPartial)
+{
+    const ScopeFbPoolInit fb_pool_init;
+    PInstance instance;
+
+    MyResourceLoader resource_loader;
+
+    cache = http_cache_new(instance.root_pool, 1024 * 1024, CachePolicy::LRU,
+                           0, nullptr, 0,
+                           instance.event_loop, resource_loader);
+
+    run_cache_test(instance.root_pool, 5, false);
+
+    run_put_encoded(instance, 5, HTTP_STATUS_PARTIAL_CONTENT, "gzip b");
+    run_put_encoded(instance, 9, HTTP_STATUS_OK, "gzip b");
+
+    /* variant "b" is still served without encoding */
+    run_cache_test(instance.root_pool, 8, true);
+
+    http_cache_close(cache);
+}
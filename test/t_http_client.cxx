@@ -38,14 +38,20 @@
 
 #include "t_client.hxx"
 #include "http_client.hxx"
+#include "http_pipeline.hxx"
 #include "http/Headers.hxx"
 #include "system/SetupProcess.hxx"
 #include "io/FileDescriptor.hxx"
 #include "net/SocketDescriptor.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
 #include "fs/FilteredSocket.hxx"
 #include "direct.hxx"
 #include "fb_pool.hxx"
 #include "istream/UnusedPtr.hxx"
+#include "istream/Sink.hxx"
+#include "util/Exception.hxx"
+
+#include <string>
 
 #include <sys/socket.h>
 #include <sys/wait.h>
@@ -242,6 +248,413 @@ test_no_keepalive(Context<Connection> &c)
     assert(c.body_error == nullptr);
 }
 
+/*
+ * HTTP/1.1 pipelining
+ *
+ * The server side is scripted: the test reads the request heads from
+ * the raw socket and writes canned responses.
+ *
+ */
+
+/**
+ * One request on a #PipelineContext.
+ */
+struct PipelineRequest final : Lease, HttpResponseHandler, IstreamSink {
+    HttpHeaders headers;
+
+    CancellablePointer cancel_ptr;
+
+    std::exception_ptr error;
+    std::string body;
+    http_status_t status{};
+
+    bool response = false, eof = false;
+    bool released = false, reuse = false;
+
+    explicit PipelineRequest(struct pool &pool) noexcept
+        :headers(pool) {}
+
+    bool IsDone() const noexcept {
+        return (error || eof) && released;
+    }
+
+    bool IsRefused() const noexcept {
+        try {
+            FindRetrowNested<HttpClientError>(error);
+        } catch (const HttpClientError &e) {
+            return e.GetCode() == HttpClientErrorCode::REFUSED;
+        }
+
+        return false;
+    }
+
+    /* virtual methods from class Lease */
+    void ReleaseLease(bool _reuse) noexcept override {
+        assert(!released);
+
+        released = true;
+        reuse = _reuse;
+    }
+
+    /* virtual methods from class HttpResponseHandler */
+    void OnHttpResponse(http_status_t _status, StringMap &&,
+                        UnusedIstreamPtr _body) noexcept override {
+        response = true;
+        status = _status;
+
+        if (_body) {
+            IstreamSink::SetInput(std::move(_body));
+            input.Read();
+        } else
+            eof = true;
+    }
+
+    void OnHttpError(std::exception_ptr ep) noexcept override {
+        error = std::move(ep);
+    }
+
+    /* virtual methods from class IstreamHandler */
+    size_t OnData(const void *data, size_t length) noexcept override {
+        body.append((const char *)data, length);
+        return length;
+    }
+
+    void OnEof() noexcept override {
+        IstreamSink::ClearInput();
+        eof = true;
+    }
+
+    void OnError(std::exception_ptr ep) noexcept override {
+        IstreamSink::ClearInput();
+        error = std::move(ep);
+    }
+};
+
+struct PipelineContext final : PInstance, HttpPipelineHandler {
+    PoolPtr pool;
+
+    UniqueSocketDescriptor server;
+
+    FilteredSocket socket;
+
+    HttpPipeline *pipeline;
+
+    bool faded = false;
+
+    PipelineContext()
+        :pool(pool_new_libc(root_pool, "pipeline")),
+         socket(event_loop)
+    {
+        UniqueSocketDescriptor client;
+        if (!UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL, SOCK_STREAM, 0,
+                                                      client, server)) {
+            perror("socketpair() failed");
+            exit(EXIT_FAILURE);
+        }
+
+        client.SetNonBlocking();
+        socket.InitDummy(client.Release(), FdType::FD_SOCKET);
+        pipeline = http_pipeline_new(socket, "localhost", *this);
+    }
+
+    ~PipelineContext() noexcept {
+        http_pipeline_free(pipeline);
+
+        if (socket.IsValid() && socket.IsConnected()) {
+            socket.Close();
+            socket.Destroy();
+        }
+    }
+
+    void Send(PipelineRequest &request,
+              http_method_t method, const char *uri) {
+        http_pipeline_request(*pool, *pipeline, request,
+                              method, uri, request.headers,
+                              request, request.cancel_ptr);
+    }
+
+    /**
+     * Read the given number of request heads from the server
+     * socket.
+     */
+    std::string ReceiveHeads(unsigned n) {
+        std::string result;
+
+        while (n > 0) {
+            char buffer[4096];
+            ssize_t nbytes = server.Read(buffer, sizeof(buffer));
+            assert(nbytes > 0);
+
+            for (const char *p = buffer, *end = buffer + nbytes;
+                 (p = (const char *)memmem(p, end - p, "\r\n\r\n", 4)) != nullptr;
+                 p += 4) {
+                assert(n > 0);
+                --n;
+            }
+
+            result.append(buffer, nbytes);
+        }
+
+        return result;
+    }
+
+    void Respond(const char *response) {
+        ssize_t nbytes = server.Write(response, strlen(response));
+        assert(nbytes == ssize_t(strlen(response)));
+        (void)nbytes;
+    }
+
+    void Wait(const PipelineRequest &request) {
+        while (!request.IsDone())
+            event_loop.LoopOnce();
+    }
+
+    /* virtual methods from class HttpPipelineHandler */
+    void OnHttpPipelineFade() noexcept override {
+        faded = true;
+    }
+};
+
+/**
+ * Several request heads are sent before the first response has
+ * arrived, and the responses are delivered in order.
+ */
+static void
+test_pipeline_ordered()
+{
+    PipelineContext c;
+
+    PipelineRequest r1(c.pool), r2(c.pool), r3(c.pool);
+    c.Send(r1, HTTP_METHOD_GET, "/1");
+    c.Send(r2, HTTP_METHOD_GET, "/2");
+    c.Send(r3, HTTP_METHOD_GET, "/3");
+
+    const auto heads = c.ReceiveHeads(3);
+    const auto p1 = heads.find("GET /1 "), p2 = heads.find("GET /2 "),
+        p3 = heads.find("GET /3 ");
+    assert(p1 == 0);
+    assert(p2 != heads.npos && p2 > p1);
+    assert(p3 != heads.npos && p3 > p2);
+
+    c.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nA"
+              "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nBB"
+              "HTTP/1.1 404 Not Found\r\nContent-Length: 3\r\n\r\nCCC");
+
+    c.Wait(r1);
+    c.Wait(r2);
+    c.Wait(r3);
+
+    assert(r1.error == nullptr && r1.status == HTTP_STATUS_OK);
+    assert(r1.body == "A");
+    assert(r1.reuse);
+    assert(r2.error == nullptr && r2.status == HTTP_STATUS_OK);
+    assert(r2.body == "BB");
+    assert(r2.reuse);
+    assert(r3.error == nullptr && r3.status == HTTP_STATUS_NOT_FOUND);
+    assert(r3.body == "CCC");
+    assert(r3.reuse);
+
+    assert(!c.faded);
+    assert(http_pipeline_is_reusable(*c.pipeline));
+}
+
+/**
+ * A HEAD response has no body even though it announces a
+ * "Content-Length"; the next response must be parsed right after
+ * its header.
+ */
+static void
+test_pipeline_head()
+{
+    PipelineContext c;
+
+    PipelineRequest r1(c.pool), r2(c.pool), r3(c.pool);
+    c.Send(r1, HTTP_METHOD_GET, "/1");
+    c.Send(r2, HTTP_METHOD_HEAD, "/2");
+    c.Send(r3, HTTP_METHOD_GET, "/3");
+
+    c.ReceiveHeads(3);
+    c.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nA"
+              "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n"
+              "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nC");
+
+    c.Wait(r1);
+    c.Wait(r2);
+    c.Wait(r3);
+
+    assert(r1.error == nullptr && r1.body == "A");
+    assert(r2.error == nullptr && r2.status == HTTP_STATUS_OK);
+    assert(r2.body.empty());
+    assert(r2.reuse);
+    assert(r3.error == nullptr && r3.body == "C");
+    assert(r3.reuse);
+    assert(!c.faded);
+}
+
+/**
+ * The server disables keep-alive in the first response; the other
+ * requests fail with HttpClientErrorCode::REFUSED.
+ */
+static void
+test_pipeline_connection_close()
+{
+    PipelineContext c;
+
+    PipelineRequest r1(c.pool), r2(c.pool), r3(c.pool);
+    c.Send(r1, HTTP_METHOD_GET, "/1");
+    c.Send(r2, HTTP_METHOD_GET, "/2");
+    c.Send(r3, HTTP_METHOD_GET, "/3");
+
+    c.ReceiveHeads(3);
+    c.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n"
+              "Connection: close\r\n\r\nA");
+    c.server.Close();
+
+    c.Wait(r1);
+    c.Wait(r2);
+    c.Wait(r3);
+
+    assert(r1.error == nullptr && r1.body == "A");
+    assert(!r1.reuse);
+    assert(!r2.response && r2.IsRefused());
+    assert(!r3.response && r3.IsRefused());
+    assert(c.faded);
+    assert(!http_pipeline_is_usable(*c.pipeline));
+}
+
+/**
+ * A request is canceled after its head has been sent.  The server
+ * will respond to it anyway; that response is discarded, and the
+ * requests before and after it are still answered on the same
+ * connection.
+ */
+static void
+test_pipeline_cancel_sent()
+{
+    PipelineContext c;
+
+    PipelineRequest r1(c.pool), r2(c.pool), r3(c.pool);
+    c.Send(r1, HTTP_METHOD_GET, "/1");
+    c.Send(r2, HTTP_METHOD_GET, "/2");
+    c.Send(r3, HTTP_METHOD_GET, "/3");
+
+    c.ReceiveHeads(3);
+
+    /* let the HttpClient for the first request start */
+    c.event_loop.LoopOnceNonBlock();
+
+    r2.cancel_ptr.Cancel();
+    assert(r2.released);
+    assert(r2.reuse);
+    assert(!c.faded);
+    assert(http_pipeline_is_usable(*c.pipeline));
+
+    c.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nA"
+              "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nBB"
+              "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nCCC");
+
+    c.Wait(r1);
+    c.Wait(r3);
+
+    assert(r1.error == nullptr && r1.body == "A");
+    assert(r1.reuse);
+    assert(!r2.response && r2.error == nullptr);
+    assert(r3.error == nullptr && r3.body == "CCC");
+    assert(r3.reuse);
+    assert(!c.faded);
+    assert(http_pipeline_is_reusable(*c.pipeline));
+}
+
+/**
+ * The pipeline is freed while the response to a canceled request is
+ * still being awaited.
+ */
+static void
+test_pipeline_cancel_free()
+{
+    PipelineContext c;
+
+    PipelineRequest r1(c.pool), r2(c.pool);
+    c.Send(r1, HTTP_METHOD_GET, "/1");
+    c.Send(r2, HTTP_METHOD_GET, "/2");
+
+    c.ReceiveHeads(2);
+
+    /* let the HttpClient for the first request start */
+    c.event_loop.LoopOnceNonBlock();
+
+    r2.cancel_ptr.Cancel();
+    assert(r2.released);
+
+    c.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nA");
+    c.Wait(r1);
+
+    assert(r1.error == nullptr && r1.body == "A");
+    assert(r1.reuse);
+
+    /* no lease is held anymore; ~PipelineContext() frees the
+       pipeline, which must abort the pending response */
+    assert(!http_pipeline_is_reusable(*c.pipeline));
+}
+
+/**
+ * The server closes the connection after the first response; the
+ * unanswered requests are refused and can be replayed unmodified on
+ * another connection.
+ */
+static void
+test_pipeline_refused_replay()
+{
+    PipelineContext c1;
+
+    PipelineRequest r1(c1.pool), r2(c1.pool), r3(c1.pool);
+    r2.headers.Write("x-foo", "bar");
+
+    c1.Send(r1, HTTP_METHOD_GET, "/1");
+    c1.Send(r2, HTTP_METHOD_GET, "/2");
+    c1.Send(r3, HTTP_METHOD_HEAD, "/3");
+
+    const auto heads = c1.ReceiveHeads(3);
+    c1.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nA");
+    c1.server.Close();
+
+    c1.Wait(r1);
+    c1.Wait(r2);
+    c1.Wait(r3);
+
+    assert(r1.error == nullptr && r1.body == "A");
+    assert(r2.IsRefused());
+    assert(r3.IsRefused());
+
+    /* replay the refused requests on a new connection */
+
+    PipelineContext c2;
+
+    PipelineRequest r2b(c1.pool), r3b(c1.pool);
+    r2b.headers = std::move(r2.headers);
+    r3b.headers = std::move(r3.headers);
+
+    c2.Send(r2b, HTTP_METHOD_GET, "/2");
+    c2.Send(r3b, HTTP_METHOD_HEAD, "/3");
+
+    /* the replayed heads are exactly the unanswered part of the
+       first pipeline */
+    const auto replayed = c2.ReceiveHeads(2);
+    assert(heads.size() > replayed.size());
+    assert(heads.compare(heads.size() - replayed.size(), replayed.size(),
+                         replayed) == 0);
+    assert(replayed.find("x-foo: bar\r\n") != replayed.npos);
+
+    c2.Respond("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\nB"
+               "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n");
+
+    c2.Wait(r2b);
+    c2.Wait(r3b);
+
+    assert(r2b.error == nullptr && r2b.body == "B");
+    assert(r3b.error == nullptr && r3b.body.empty());
+}
+
 /*
  * main
  *
@@ -258,4 +671,11 @@ int main(int argc, char **argv) {
 
     run_all_tests<Connection>();
     run_test<Connection>(test_no_keepalive);
+
+    test_pipeline_ordered();
+    test_pipeline_head();
+    test_pipeline_connection_close();
+    test_pipeline_cancel_sent();
+    test_pipeline_cancel_free();
+    test_pipeline_refused_replay();
 }
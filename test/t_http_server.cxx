@@ -198,6 +198,10 @@ public:
             event_loop.LoopOnce();
     }
 
+    bool HasResponseError() const noexcept {
+        return response_error != nullptr;
+    }
+
     void RethrowResponseError() const {
         if (response_error)
             std::rethrow_exception(response_error);
@@ -265,7 +269,7 @@ Server::Server(struct pool &_pool, EventLoop &event_loop)
                                             FdType::FD_SOCKET,
                                             nullptr,
                                             nullptr, nullptr,
-                                            true, *this);
+                                            true, false, *this);
 
     client_fs.InitDummy(client_socket.Release(), FdType::FD_SOCKET);
 }
@@ -382,6 +386,62 @@ TestDiscardedHugeRequestBody(Server &server)
     client.ExpectResponse(server, HTTP_STATUS_OK, "foo");
 }
 
+/**
+ * Send a request with one header line of the given length (not
+ * counting the CRLF).
+ */
+static void
+SendLongHeader(Client &client, Server &server, size_t line_length)
+{
+    static constexpr char name[] = "x-long";
+
+    const std::string value(line_length - (sizeof(name) - 1) - 2, 'x');
+
+    HttpHeaders headers(server.GetPool());
+    headers.Write(name, value.c_str());
+
+    client.SendRequest(server, HTTP_METHOD_GET, "/", std::move(headers),
+                       nullptr);
+}
+
+/**
+ * A header line of 8191 bytes is accepted.
+ */
+static void
+TestLongHeader(Server &server)
+{
+    server.SetRequestHandler([](HttpServerRequest &request, CancellablePointer &) noexcept {
+        http_server_response(&request, HTTP_STATUS_OK, HttpHeaders(request.pool),
+                             istream_string_new(request.pool, "foo"));
+    });
+
+    Client client;
+    SendLongHeader(client, server, 8191);
+    client.ExpectResponse(server, HTTP_STATUS_OK, "foo");
+}
+
+/**
+ * A header line of 8192 bytes is rejected, and the server closes the
+ * connection.
+ */
+static void
+TestTooLongHeader(Server &server)
+{
+    server.SetRequestHandler([](HttpServerRequest &, CancellablePointer &) noexcept {
+        /* must not be reached */
+        abort();
+    });
+
+    Client client;
+    SendLongHeader(client, server, 8192);
+    client.WaitDone(server);
+
+    if (client.HasResponseError())
+        return;
+
+    throw std::runtime_error("Request with 8192 byte header line was accepted");
+}
+
 int
 main(int argc, char **argv) noexcept
 try {
@@ -398,6 +458,15 @@ try {
         TestMirror(server);
         TestDiscardTinyRequestBody(server);
         TestDiscardedHugeRequestBody(server);
+        TestLongHeader(server);
+
+        server.CloseClientSocket();
+        instance.event_loop.Dispatch();
+    }
+
+    {
+        Server server(instance.root_pool, instance.event_loop);
+        TestTooLongHeader(server);
 
         server.CloseClientSocket();
         instance.event_loop.Dispatch();
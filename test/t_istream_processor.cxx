@@ -116,7 +116,8 @@ public:
                             nullptr);
         session_put(session);
 
-        return processor_process(pool, std::move(input), *widget, env, PROCESSOR_CONTAINER);
+        return processor_process(pool, std::move(input), *widget, env,
+                                 PROCESSOR_CONTAINER, nullptr);
     }
 };
 
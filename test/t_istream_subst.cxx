@@ -35,6 +35,7 @@
 #include "istream/istream_string.hxx"
 #include "istream/istream.hxx"
 #include "istream/UnusedPtr.hxx"
+#include "pool/Ptr.hxx"
 #include "util/StringView.hxx"
 
 class IstreamSubstTestTraits {
@@ -62,3 +63,39 @@ public:
 
 INSTANTIATE_TYPED_TEST_CASE_P(Subst, IstreamFilterTest,
                               IstreamSubstTestTraits);
+
+/**
+ * Overlapping words: a shorter word must be held back while a longer
+ * one which started earlier may still match.
+ */
+class IstreamSubstOverlapTestTraits {
+public:
+    static constexpr const char *expected_result = "a2e 1 u5rs x1e";
+
+    static constexpr bool call_available = true;
+    static constexpr bool got_data_assert = true;
+    static constexpr bool enable_blocking = true;
+    static constexpr bool enable_abort_istream = true;
+
+    UnusedIstreamPtr CreateInput(struct pool &pool) const noexcept {
+        return istream_string_new(pool, "abce abcd ushers xabcde");
+    }
+
+    UnusedIstreamPtr CreateTest(EventLoop &, struct pool &pool,
+                                UnusedIstreamPtr input) const noexcept {
+        SubstTree tree;
+        tree.Add(pool, "abcd", "1");
+        tree.Add(pool, "bc", "2");
+        tree.Add(pool, "cde", "3");
+        tree.Add(pool, "he", "4");
+        tree.Add(pool, "she", "5");
+        tree.Add(pool, "hers", "6");
+        tree.Compile(pool);
+
+        return istream_subst_new_shared(pool, std::move(input), tree,
+                                        PoolPtr(pool));
+    }
+};
+
+INSTANTIATE_TYPED_TEST_CASE_P(SubstOverlap, IstreamFilterTest,
+                              IstreamSubstOverlapTestTraits);
@@ -0,0 +1,290 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lb/Resolver.hxx"
+#include "event/Loop.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/ToString.hxx"
+#include "util/Cancellable.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A minimal DNS server on a local UDP port which knows a few
+ * hard-coded names and counts the queries it receives.
+ */
+class StubDnsServer {
+    UniqueSocketDescriptor fd;
+    SocketEvent event;
+
+public:
+    unsigned n_queries = 0;
+
+    explicit StubDnsServer(EventLoop &event_loop)
+        :event(event_loop, BIND_THIS_METHOD(OnSocketReady)) {
+        if (!fd.Create(AF_INET, SOCK_DGRAM, 0) ||
+            !fd.Bind(IPv4Address(127, 0, 0, 1, 0)))
+            throw std::runtime_error("Failed to create DNS socket");
+
+        event.Open(fd);
+        event.ScheduleRead();
+    }
+
+    ~StubDnsServer() noexcept {
+        event.Cancel();
+    }
+
+    /**
+     * Returns the "servers" parameter for #LbResolver.
+     */
+    std::string GetServers() const {
+        return "127.0.0.1:" + std::to_string(fd.GetLocalAddress().GetPort());
+    }
+
+private:
+    void OnSocketReady(unsigned) noexcept {
+        uint8_t buffer[512];
+        StaticSocketAddress address;
+        const auto nbytes = fd.Read(buffer, sizeof(buffer), address);
+        if (nbytes < 12)
+            return;
+
+        ++n_queries;
+
+        /* parse the question */
+        std::string name;
+        size_t position = 12;
+        while (position < size_t(nbytes) && buffer[position] != 0) {
+            const size_t length = buffer[position++];
+            if (!name.empty())
+                name.push_back('.');
+            name.append((const char *)buffer + position, length);
+            position += length;
+        }
+
+        position += 1 + 4;
+        if (position > size_t(nbytes))
+            return;
+
+        const unsigned type = (buffer[position - 4] << 8) | buffer[position - 3];
+
+        /* build the response: header and question are copied */
+        uint8_t response[512];
+        memcpy(response, buffer, position);
+        response[2] = 0x81; /* QR, RD */
+        response[3] = 0x80; /* RA, NOERROR */
+        response[6] = response[7] = 0; /* ANCOUNT */
+        response[8] = response[9] = 0; /* NSCOUNT */
+        response[10] = response[11] = 0; /* ARCOUNT */
+
+        size_t length = position;
+
+        static constexpr uint8_t a_record[] = {
+            0xc0, 12, /* name: pointer to the question */
+            0, 1, 0, 1, /* type A, class IN */
+            0, 0, 0, 60, /* TTL */
+            0, 4, 192, 0, 2, 1,
+        };
+
+        static constexpr uint8_t aaaa_record[] = {
+            0xc0, 12,
+            0, 28, 0, 1, /* type AAAA, class IN */
+            0, 0, 0, 60,
+            0, 16, 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+            0, 0, 0, 0, 0, 0, 0, 1,
+        };
+
+        if (name == "www.example.com" && type == 1) {
+            memcpy(response + length, a_record, sizeof(a_record));
+            length += sizeof(a_record);
+            response[7] = 1;
+        } else if (name == "v6.example.com" && type == 28) {
+            memcpy(response + length, aaaa_record, sizeof(aaaa_record));
+            length += sizeof(aaaa_record);
+            response[7] = 1;
+        } else if (name != "www.example.com" && name != "v6.example.com") {
+            response[3] |= 3; /* NXDOMAIN */
+        }
+
+        fd.Write(response, length, address);
+    }
+};
+
+class MyResolverHandler final : public LbResolverHandler {
+    EventLoop &event_loop;
+
+public:
+    std::string address;
+    std::exception_ptr error;
+    bool done = false;
+
+    explicit MyResolverHandler(EventLoop &_event_loop) noexcept
+        :event_loop(_event_loop) {}
+
+    void OnResolverSuccess(SocketAddress _address) noexcept override {
+        char buffer[256];
+        if (ToString(buffer, sizeof(buffer), _address))
+            address = buffer;
+        done = true;
+        event_loop.Break();
+    }
+
+    void OnResolverError(std::exception_ptr ep) noexcept override {
+        error = ep;
+        done = true;
+        event_loop.Break();
+    }
+};
+
+struct ResolverContext {
+    EventLoop event_loop;
+    StubDnsServer server{event_loop};
+    LbResolver resolver{event_loop, server.GetServers().c_str()};
+
+    void Resolve(MyResolverHandler &handler, const char *name,
+                 unsigned port=80) noexcept {
+        CancellablePointer cancel_ptr;
+        resolver.Resolve(name, port, handler, cancel_ptr);
+        if (!handler.done)
+            event_loop.Dispatch();
+    }
+};
+
+TEST(LbResolver, Numeric)
+{
+    ResolverContext c;
+
+    MyResolverHandler handler(c.event_loop);
+    c.Resolve(handler, "192.0.2.7", 8080);
+    ASSERT_TRUE(handler.done);
+    ASSERT_FALSE(handler.error);
+    ASSERT_EQ(handler.address, "192.0.2.7:8080");
+    ASSERT_EQ(c.server.n_queries, 0u);
+}
+
+TEST(LbResolver, Cache)
+{
+    ResolverContext c;
+
+    MyResolverHandler handler1(c.event_loop);
+    c.Resolve(handler1, "www.example.com");
+    ASSERT_TRUE(handler1.done);
+    ASSERT_FALSE(handler1.error);
+    ASSERT_EQ(handler1.address, "192.0.2.1:80");
+    ASSERT_EQ(c.server.n_queries, 1u);
+
+    /* the second lookup is served from the cache, synchronously */
+    MyResolverHandler handler2(c.event_loop);
+    CancellablePointer cancel_ptr;
+    c.resolver.Resolve("www.example.com", 443, handler2, cancel_ptr);
+    ASSERT_TRUE(handler2.done);
+    ASSERT_EQ(handler2.address, "192.0.2.1:443");
+    ASSERT_EQ(c.server.n_queries, 1u);
+}
+
+TEST(LbResolver, Coalesce)
+{
+    ResolverContext c;
+
+    MyResolverHandler handler1(c.event_loop), handler2(c.event_loop);
+    CancellablePointer cancel_ptr1, cancel_ptr2;
+    c.resolver.Resolve("www.example.com", 80, handler1, cancel_ptr1);
+    c.resolver.Resolve("www.example.com", 81, handler2, cancel_ptr2);
+    ASSERT_FALSE(handler1.done);
+    ASSERT_FALSE(handler2.done);
+
+    c.event_loop.Dispatch();
+
+    ASSERT_TRUE(handler1.done);
+    ASSERT_TRUE(handler2.done);
+    ASSERT_EQ(handler1.address, "192.0.2.1:80");
+    ASSERT_EQ(handler2.address, "192.0.2.1:81");
+    ASSERT_EQ(c.server.n_queries, 1u);
+}
+
+TEST(LbResolver, IPv6Fallback)
+{
+    ResolverContext c;
+
+    MyResolverHandler handler(c.event_loop);
+    c.Resolve(handler, "v6.example.com");
+    ASSERT_TRUE(handler.done);
+    ASSERT_FALSE(handler.error);
+    ASSERT_EQ(handler.address, "[2001:db8::1]:80");
+    ASSERT_EQ(c.server.n_queries, 2u);
+}
+
+TEST(LbResolver, Negative)
+{
+    ResolverContext c;
+
+    MyResolverHandler handler1(c.event_loop);
+    c.Resolve(handler1, "nx.example.com");
+    ASSERT_TRUE(handler1.done);
+    ASSERT_TRUE(handler1.error);
+
+    /* the error is cached */
+    const unsigned n_queries = c.server.n_queries;
+    MyResolverHandler handler2(c.event_loop);
+    CancellablePointer cancel_ptr;
+    c.resolver.Resolve("nx.example.com", 80, handler2, cancel_ptr);
+    ASSERT_TRUE(handler2.done);
+    ASSERT_TRUE(handler2.error);
+    ASSERT_EQ(c.server.n_queries, n_queries);
+}
+
+TEST(LbResolver, Cancel)
+{
+    ResolverContext c;
+
+    MyResolverHandler handler1(c.event_loop);
+    CancellablePointer cancel_ptr;
+    c.resolver.Resolve("www.example.com", 80, handler1, cancel_ptr);
+    cancel_ptr.Cancel();
+
+    /* the query continues and fills the cache */
+    MyResolverHandler handler2(c.event_loop);
+    c.Resolve(handler2, "www.example.com");
+    ASSERT_FALSE(handler1.done);
+    ASSERT_TRUE(handler2.done);
+    ASSERT_EQ(handler2.address, "192.0.2.1:80");
+    ASSERT_EQ(c.server.n_queries, 1u);
+}
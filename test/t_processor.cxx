@@ -32,6 +32,8 @@
 
 #include "FailingResourceLoader.hxx"
 #include "bp/XmlProcessor.hxx"
+#include "bp/ProcessorCache.hxx"
+#include "bp/Global.hxx"
 #include "penv.hxx"
 #include "PInstance.hxx"
 #include "widget/Inline.hxx"
@@ -42,7 +44,9 @@
 #include "istream/istream.hxx"
 #include "istream/BlockIstream.hxx"
 #include "istream/istream_string.hxx"
+#include "istream/StringSink.hxx"
 #include "pool/pool.hxx"
+#include "AllocatorPtr.hxx"
 #include "util/Cancellable.hxx"
 #include "util/PrintException.hxx"
 
@@ -60,6 +64,7 @@
  */
 
 TranslationService *global_translation_service;
+ProcessorCache *global_processor_cache;
 
 UnusedIstreamPtr
 embed_inline_widget(struct pool &pool,
@@ -92,13 +97,15 @@ rewrite_widget_uri(gcc_unused struct pool &pool,
                    gcc_unused struct processor_env &env,
                    gcc_unused TranslationService &service,
                    gcc_unused Widget &widget,
-                   gcc_unused StringView value,
+                   StringView value,
                    gcc_unused RewriteUriMode mode,
                    gcc_unused bool stateful,
                    gcc_unused const char *view,
                    gcc_unused const struct escape_class *escape) noexcept
 {
-    return nullptr;
+    return istream_string_new(pool,
+                              AllocatorPtr(pool).Concat("/rewritten/",
+                                                        value));
 }
 
 /*
@@ -155,10 +162,128 @@ TEST(Processor, Abort)
     MyWidgetLookupHandler handler;
     processor_lookup_widget(*pool, istream_block_new(*pool),
                             widget, "foo", env, PROCESSOR_CONTAINER,
-                            handler, cancel_ptr);
+                            nullptr, handler, cancel_ptr);
 
     cancel_ptr.Cancel();
 
     pool.reset();
     pool_commit();
 }
+
+struct StringSinkCtx {
+    std::string value;
+    bool finished = false;
+};
+
+static void
+sink_string_callback(std::string &&value, std::exception_ptr, void *_ctx)
+{
+    auto &ctx = *(StringSinkCtx *)_ctx;
+
+    ctx.value = std::move(value);
+    ctx.finished = true;
+}
+
+static std::string
+Process(PInstance &instance, const char *source, unsigned options,
+        const char *source_tag)
+{
+    auto pool = pool_new_libc(instance.root_pool, "test");
+
+    Widget widget(*pool, &root_widget_class);
+
+    SessionId session_id;
+    session_id.Generate();
+
+    FailingResourceLoader resource_loader;
+    struct processor_env env(instance.event_loop,
+                             resource_loader, resource_loader,
+                             nullptr, nullptr,
+                             "localhost:8080",
+                             "localhost:8080",
+                             "/beng.html",
+                             "http://localhost:8080/beng.html",
+                             "/beng.html",
+                             nullptr,
+                             "bp_session", session_id, "foo",
+                             nullptr);
+
+    StringSinkCtx ctx;
+    CancellablePointer cancel_ptr;
+    auto &sink = NewStringSink(*pool,
+                               processor_process(*pool,
+                                                 istream_string_new(*pool,
+                                                                    source),
+                                                 widget, env, options,
+                                                 source_tag),
+                               sink_string_callback, &ctx, cancel_ptr);
+
+    while (!ctx.finished) {
+        ReadStringSink(sink);
+        instance.event_loop.LoopOnceNonBlock();
+    }
+
+    pool.reset();
+    pool_commit();
+
+    return std::move(ctx.value);
+}
+
+/**
+ * Process the same template twice with the same source tag: the
+ * second run replays the compiled template from the #ProcessorCache,
+ * and its output must be identical to a fresh parse.
+ */
+TEST(Processor, CompiledTemplate)
+{
+    static constexpr const char *source =
+        "<html><head><title>foo</title></head><body>\n"
+        "<a href=\"relative.html\">a</a>\n"
+        "<a href=\"page.html#fragment\">b</a>\n"
+        "<a href=\"#top\">c</a>\n"
+        "<img src=\"/image.png\" c:mode=\"direct\"/>\n"
+        "<form action=\"\"><input name=\"x\"/></form>\n"
+        "<c:widget id=\"w1\" type=\"foo\"/>\n"
+        "<p>text between widgets</p>\n"
+        "<c:widget id=\"w2\" type=\"bar\">"
+        "<path-info value=\"/x\"/>"
+        "<param name=\"a\" value=\"b\"/>"
+        "</c:widget>\n"
+        "<a href=\"other.html\" c:base=\"widget\" c:mode=\"partial\">d</a>\n"
+        "</body></html>\n";
+
+    static constexpr unsigned options = PROCESSOR_REWRITE_URL |
+        PROCESSOR_FOCUS_WIDGET | PROCESSOR_CONTAINER;
+
+    static constexpr const char *source_tag = "/tmp/foo.html|etag=\"1\"";
+
+    PInstance instance;
+    ProcessorCache cache(instance.root_pool, instance.event_loop,
+                         1024 * 1024);
+    global_processor_cache = &cache;
+    global_translation_service = (TranslationService *)(size_t)1;
+
+    /* without a source tag, the template is not compiled */
+    const auto expected = Process(instance, source, options, nullptr);
+    EXPECT_NE(expected.find("/rewritten/relative.html"), expected.npos);
+    EXPECT_NE(expected.find("/rewritten/page.html#fragment"), expected.npos);
+    EXPECT_NE(expected.find("href=\"#top\""), expected.npos);
+    EXPECT_EQ(expected.find("c:widget"), expected.npos);
+    EXPECT_EQ(expected.find("c:mode"), expected.npos);
+
+    /* the first run with a source tag parses and compiles the
+       template */
+    const auto first = Process(instance, source, options, source_tag);
+    EXPECT_EQ(first, expected);
+
+    char key[256];
+    snprintf(key, sizeof(key), "%s|processor=%x", source_tag, options);
+    ASSERT_NE(cache.Get(key), nullptr);
+
+    /* the second run replays the compiled template */
+    const auto second = Process(instance, source, options, source_tag);
+    EXPECT_EQ(second, first);
+
+    global_translation_service = nullptr;
+    global_processor_cache = nullptr;
+}
@@ -252,6 +252,71 @@ TEST(RubberTest, Shrink)
     r.Remove(c);
 }
 
+TEST(RubberTest, CompressStep)
+{
+    size_t total = 4 * 1024 * 1024;
+
+    Rubber r(total);
+
+    total = r.GetMaxSize();
+
+    const size_t size = total / 8;
+
+    unsigned ids[8];
+    for (auto &id : ids) {
+        id = AddFillRubber(r, size);
+        ASSERT_GT(id, 0u);
+    }
+
+    ASSERT_EQ(r.GetFragmentation(), 0.);
+
+    /* punch holes */
+
+    r.Remove(ids[0]);
+    r.Remove(ids[2]);
+    r.Remove(ids[3]);
+    r.Remove(ids[5]);
+
+    ASSERT_EQ(r.GetNettoSize(), total / 2);
+    ASSERT_EQ(r.GetBruttoSize(), total);
+    ASSERT_EQ(r.GetFragmentation(), 0.5);
+
+    /* each step moves at most one object */
+
+    ASSERT_FALSE(r.CompressStep(1));
+    ASSERT_TRUE(CheckRubber(r, ids[1], size));
+    ASSERT_EQ(r.GetBruttoSize(), total);
+
+    /* remove the object where the previous step stopped */
+
+    r.Remove(ids[1]);
+
+    unsigned n_steps = 0;
+    while (!r.CompressStep(1))
+        ++n_steps;
+
+    ASSERT_LE(n_steps, 3u);
+
+    ASSERT_EQ(r.GetNettoSize(), total * 3 / 8);
+    ASSERT_EQ(r.GetBruttoSize(), total * 3 / 8);
+    ASSERT_EQ(r.GetFragmentation(), 0.);
+
+    ASSERT_TRUE(CheckRubber(r, ids[4], size));
+    ASSERT_TRUE(CheckRubber(r, ids[6], size));
+    ASSERT_TRUE(CheckRubber(r, ids[7], size));
+
+    /* the holes are gone, so new allocations are appended */
+
+    unsigned id = AddFillRubber(r, size);
+    ASSERT_GT(id, 0u);
+    ASSERT_EQ(r.GetBruttoSize(), total / 2);
+
+    r.Remove(id);
+    r.Remove(ids[4]);
+    r.Remove(ids[6]);
+    r.Remove(ids[7]);
+}
+
 /**
  * Fill the allocation table, see if the allocator fails
  * eventually even though there's memory available.
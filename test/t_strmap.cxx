@@ -0,0 +1,421 @@
+/*
+ * Copyright 2007-2019 Content Management AG
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TestPool.hxx"
+#include "strmap.hxx"
+
+#include <gtest/gtest.h>
+
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+
+#include <string.h>
+
+static std::string
+ToString(const StringMap &map)
+{
+    std::string result;
+
+    for (const auto &i : map) {
+        result += i.key;
+        result += '=';
+        result += i.value;
+        result += ';';
+    }
+
+    return result;
+}
+
+static std::string
+ToString(const std::multimap<std::string, std::string> &map)
+{
+    std::string result;
+
+    for (const auto &i : map) {
+        result += i.first;
+        result += '=';
+        result += i.second;
+        result += ';';
+    }
+
+    return result;
+}
+
+static bool
+IsSorted(const StringMap &map)
+{
+    const char *previous = nullptr;
+    for (const auto &i : map) {
+        if (previous != nullptr && strcmp(previous, i.key) > 0)
+            return false;
+
+        previous = i.key;
+    }
+
+    return true;
+}
+
+/**
+ * Keys which are interned ("accept", "content-type", "host") mixed
+ * with keys which are not, some of which sort between interned keys
+ * or share a prefix with them.
+ */
+static constexpr const char *test_keys[] = {
+    "a",
+    "accept",
+    "accept-",
+    "accept-encoding",
+    "content-type",
+    "content-typex",
+    "content",
+    "host",
+    "hosta",
+    "x-foo",
+    "x-cm4all-view",
+    "zzz",
+};
+
+TEST(StringMap, Empty)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    ASSERT_TRUE(map.IsEmpty());
+    ASSERT_EQ(map.begin(), map.end());
+    ASSERT_EQ(map.Get("host"), nullptr);
+    ASSERT_EQ(map.Get("x-foo"), nullptr);
+    ASSERT_EQ(map.Remove("host"), nullptr);
+}
+
+TEST(StringMap, Add)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    map.Add("x-foo", "1");
+    map.Add("host", "2");
+    map.Add("content-typex", "3");
+    map.Add("accept", "4");
+    map.Add("content-type", "5");
+    map.Add("a", "6");
+    map.Add("host", "7");
+    map.Add("zzz", "8");
+    map.Add("x-foo", "9");
+
+    ASSERT_FALSE(map.IsEmpty());
+    ASSERT_TRUE(IsSorted(map));
+    ASSERT_EQ(ToString(map),
+              "a=6;accept=4;content-type=5;content-typex=3;"
+              "host=2;host=7;x-foo=1;x-foo=9;zzz=8;");
+
+    /* Get() returns the first value of duplicate keys */
+    ASSERT_STREQ(map.Get("host"), "2");
+    ASSERT_STREQ(map.Get("x-foo"), "1");
+    ASSERT_STREQ(map.Get("content-type"), "5");
+    ASSERT_STREQ(map.Get("content-typex"), "3");
+    ASSERT_EQ(map.Get("content"), nullptr);
+    ASSERT_EQ(map.Get("accept-encoding"), nullptr);
+    ASSERT_TRUE(map.Contains("a"));
+    ASSERT_FALSE(map.Contains("b"));
+}
+
+TEST(StringMap, Set)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    ASSERT_EQ(map.Set("host", "a"), nullptr);
+    ASSERT_EQ(map.Set("x-foo", "b"), nullptr);
+    ASSERT_STREQ(map.Set("host", "c"), "a");
+    ASSERT_STREQ(map.Set("x-foo", "d"), "b");
+    ASSERT_EQ(ToString(map), "host=c;x-foo=d;");
+
+    /* with duplicates, the last value is replaced */
+    map.Add("host", "e");
+    ASSERT_STREQ(map.Set("host", "f"), "e");
+    ASSERT_EQ(ToString(map), "host=c;host=f;x-foo=d;");
+}
+
+TEST(StringMap, Remove)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    map.Add("host", "1");
+    map.Add("x-foo", "2");
+    map.Add("host", "3");
+    map.Add("x-foo", "4");
+    map.Add("accept", "5");
+
+    /* Remove() removes the first value */
+    ASSERT_STREQ(map.Remove("host"), "1");
+    ASSERT_STREQ(map.Remove("x-foo"), "2");
+    ASSERT_EQ(map.Remove("content-type"), nullptr);
+    ASSERT_EQ(map.Remove("x-bar"), nullptr);
+    ASSERT_EQ(ToString(map), "accept=5;host=3;x-foo=4;");
+
+    ASSERT_STREQ(map.Remove("host"), "3");
+    ASSERT_STREQ(map.Remove("x-foo"), "4");
+    ASSERT_STREQ(map.Remove("accept"), "5");
+    ASSERT_TRUE(map.IsEmpty());
+}
+
+TEST(StringMap, RemoveAll)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    map.Add("host", "1");
+    map.Add("x-foo", "2");
+    map.Add("host", "3");
+    map.Add("x-foo", "4");
+    map.Add("accept", "5");
+    map.Add("zzz", "6");
+
+    map.RemoveAll("host");
+    ASSERT_EQ(ToString(map), "accept=5;x-foo=2;x-foo=4;zzz=6;");
+
+    map.RemoveAll("x-foo");
+    ASSERT_EQ(ToString(map), "accept=5;zzz=6;");
+
+    map.RemoveAll("x-bar");
+    map.RemoveAll("content-type");
+    ASSERT_EQ(ToString(map), "accept=5;zzz=6;");
+}
+
+TEST(StringMap, SecureSet)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    map.Add("host", "1");
+    map.Add("x-foo", "2");
+    map.Add("host", "3");
+    map.Add("x-foo", "4");
+    map.Add("host", "5");
+
+    /* replace the first value and remove the others */
+    map.SecureSet("host", "a");
+    ASSERT_EQ(ToString(map), "host=a;x-foo=2;x-foo=4;");
+
+    map.SecureSet("x-foo", "b");
+    ASSERT_EQ(ToString(map), "host=a;x-foo=b;");
+
+    /* nullptr removes all */
+    map.SecureSet("host", nullptr);
+    ASSERT_EQ(ToString(map), "x-foo=b;");
+
+    /* add a new key */
+    map.SecureSet("accept", "c");
+    map.SecureSet("x-bar", "d");
+    ASSERT_EQ(ToString(map), "accept=c;x-bar=d;x-foo=b;");
+
+    /* nullptr for a missing key does nothing */
+    map.SecureSet("content-type", nullptr);
+    map.SecureSet("x-baz", nullptr);
+    ASSERT_EQ(ToString(map), "accept=c;x-bar=d;x-foo=b;");
+}
+
+TEST(StringMap, EqualRange)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    map.Add("host", "1");
+    map.Add("x-foo", "2");
+    map.Add("hosta", "3");
+    map.Add("host", "4");
+    map.Add("x-foo", "5");
+
+    auto r = map.EqualRange("host");
+    ASSERT_EQ(std::distance(r.first, r.second), 2);
+    ASSERT_STREQ(r.first[0].value, "1");
+    ASSERT_STREQ(r.first[1].value, "4");
+
+    r = map.EqualRange("x-foo");
+    ASSERT_EQ(std::distance(r.first, r.second), 2);
+    ASSERT_STREQ(r.first[0].value, "2");
+    ASSERT_STREQ(r.first[1].value, "5");
+
+    r = map.EqualRange("hosta");
+    ASSERT_EQ(std::distance(r.first, r.second), 1);
+    ASSERT_STREQ(r.first->value, "3");
+
+    /* missing keys yield an empty range at the insertion point */
+    r = map.EqualRange("accept");
+    ASSERT_EQ(r.first, r.second);
+    ASSERT_EQ(r.first, map.begin());
+
+    r = map.EqualRange("zzz");
+    ASSERT_EQ(r.first, r.second);
+    ASSERT_EQ(r.first, map.end());
+}
+
+TEST(StringMap, Merge)
+{
+    TestPool pool;
+    StringMap a(pool), b(pool);
+
+    a.Add("host", "1");
+    a.Add("x-foo", "2");
+    a.Add("zzz", "3");
+
+    b.Add("accept", "4");
+    b.Add("host", "5");
+    b.Add("x-bar", "6");
+    b.Add("x-foo", "7");
+
+    a.Merge(std::move(b));
+    ASSERT_TRUE(b.IsEmpty());
+    ASSERT_TRUE(IsSorted(a));
+
+    /* values from #src come after existing values with the same
+       key */
+    ASSERT_EQ(ToString(a),
+              "accept=4;host=1;host=5;x-bar=6;x-foo=2;x-foo=7;zzz=3;");
+}
+
+TEST(StringMap, Copy)
+{
+    TestPool pool;
+    StringMap map(pool);
+
+    char value[] = "foo";
+    map.Add("host", value);
+    map.Add("x-foo", "bar");
+    map.Add("accept", "baz");
+
+    StringMap deep(pool, map);
+    StringMap shallow(ShallowCopy(), pool, map);
+
+    ASSERT_EQ(ToString(deep), ToString(map));
+    ASSERT_EQ(ToString(shallow), ToString(map));
+
+    /* the deep copy has its own strings, the shallow copy shares
+       them */
+    ASSERT_NE(deep.Get("host"), map.Get("host"));
+    ASSERT_EQ(shallow.Get("host"), map.Get("host"));
+
+    value[0] = 'g';
+    ASSERT_STREQ(deep.Get("host"), "foo");
+    ASSERT_STREQ(shallow.Get("host"), "goo");
+
+    /* the copies are independent of the original */
+    map.Add("content-type", "text/plain");
+    deep.Remove("x-foo");
+    shallow.Add("zzz", "1");
+
+    ASSERT_EQ(ToString(map),
+              "accept=baz;content-type=text/plain;host=goo;x-foo=bar;");
+    ASSERT_EQ(ToString(deep), "accept=baz;host=foo;");
+    ASSERT_EQ(ToString(shallow), "accept=baz;host=goo;x-foo=bar;zzz=1;");
+
+    /* the interned tokens are copied, too */
+    ASSERT_STREQ(deep.Get("accept"), "baz");
+    ASSERT_EQ(shallow.Get("content-type"), nullptr);
+}
+
+/**
+ * Compare random sequences of operations with std::multimap (which
+ * keeps duplicate keys in insertion order, too).
+ */
+TEST(StringMap, Random)
+{
+    TestPool pool;
+    std::mt19937 rng(42);
+
+    static constexpr const char *values[] = {
+        "1", "2", "3", "4", "5", "6", "7", "8",
+    };
+
+    for (unsigned round = 0; round < 100; ++round) {
+        StringMap map(pool);
+        std::multimap<std::string, std::string> expected;
+
+        for (unsigned i = 0; i < 64; ++i) {
+            const char *key = test_keys[rng() % std::size(test_keys)];
+            const char *value = values[rng() % std::size(values)];
+
+            switch (rng() % 4) {
+            case 0:
+            case 1:
+                map.Add(key, value);
+                expected.emplace(key, value);
+                break;
+
+            case 2:
+                {
+                    const char *old = map.Remove(key);
+                    auto e = expected.find(key);
+                    if (e == expected.end()) {
+                        ASSERT_EQ(old, nullptr);
+                    } else {
+                        ASSERT_NE(old, nullptr);
+                        ASSERT_EQ(e->second, old);
+                        expected.erase(e);
+                    }
+                }
+                break;
+
+            case 3:
+                map.SecureSet(key, value);
+                {
+                    auto r = expected.equal_range(key);
+                    if (r.first == r.second)
+                        expected.emplace(key, value);
+                    else {
+                        r.first->second = value;
+                        expected.erase(std::next(r.first), r.second);
+                    }
+                }
+                break;
+            }
+
+            ASSERT_TRUE(IsSorted(map));
+            ASSERT_EQ(ToString(map), ToString(expected));
+        }
+
+        for (const char *key : test_keys) {
+            auto e = expected.find(key);
+            if (e == expected.end())
+                ASSERT_EQ(map.Get(key), nullptr);
+            else
+                ASSERT_EQ(e->second, map.Get(key));
+
+            const auto r = map.EqualRange(key);
+            ASSERT_EQ(size_t(std::distance(r.first, r.second)),
+                      expected.count(key));
+        }
+    }
+}
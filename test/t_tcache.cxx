@@ -67,7 +67,8 @@ struct Instance : PInstance {
     TranslationCache cache;
 
     Instance()
-        :cache(root_pool, event_loop, ts, 1024) {}
+        :cache(root_pool, event_loop, ts, 1024,
+                std::chrono::milliseconds(1)) {}
 };
 
 const TranslateResponse *next_response, *expected_response;
@@ -808,6 +809,55 @@ TEST(TranslationCache, InvalidateUri)
                       my_translate_handler, nullptr, cancel_ptr);
 }
 
+TEST(TranslationCache, InvalidateAll)
+{
+    Instance instance;
+    struct pool *pool = instance.root_pool;
+    auto &cache = instance.cache;
+
+    CancellablePointer cancel_ptr;
+
+    /* feed the cache */
+
+    const auto request1 = MakeRequest("/invalidate/all1");
+    const auto response1 = MakeResponse().File("/var/www/invalidate/all1");
+    next_response = expected_response = &response1;
+    cache.SendRequest(*pool, request1,
+                      my_translate_handler, nullptr, cancel_ptr);
+
+    const auto request2 = MakeRequest("/invalidate/all2");
+    const auto response2 = MakeResponse().File("/var/www/invalidate/all2");
+    next_response = expected_response = &response2;
+    cache.SendRequest(*pool, request2,
+                      my_translate_handler, nullptr, cancel_ptr);
+
+    next_response = nullptr;
+    expected_response = &response1;
+    cache.SendRequest(*pool, request1,
+                      my_translate_handler, nullptr, cancel_ptr);
+
+    /* invalidate all cache items; they are removed later, but they
+       must not be used anymore */
+
+    cache.Invalidate(MakeRequest(nullptr), nullptr, nullptr);
+
+    next_response = expected_response = nullptr;
+    cache.SendRequest(*pool, request1,
+                      my_translate_handler, nullptr, cancel_ptr);
+    cache.SendRequest(*pool, request2,
+                      my_translate_handler, nullptr, cancel_ptr);
+
+    /* new items are not affected */
+
+    next_response = expected_response = &response1;
+    cache.SendRequest(*pool, request1,
+                      my_translate_handler, nullptr, cancel_ptr);
+
+    next_response = nullptr;
+    cache.SendRequest(*pool, request1,
+                      my_translate_handler, nullptr, cancel_ptr);
+}
+
 TEST(TranslationCache, Regex)
 {
     Instance instance;
@@ -93,7 +93,8 @@ UnusedIstreamPtr
 processor_process(gcc_unused struct pool &pool, UnusedIstreamPtr istream,
                   gcc_unused Widget &widget,
                   gcc_unused struct processor_env &env,
-                  gcc_unused unsigned options)
+                  gcc_unused unsigned options,
+                  gcc_unused const char *source_tag)
 {
     return istream;
 }
@@ -105,6 +106,7 @@ processor_lookup_widget(gcc_unused struct pool &pool,
                         gcc_unused const char *id,
                         gcc_unused struct processor_env &env,
                         gcc_unused unsigned options,
+                        gcc_unused const char *source_tag,
                         WidgetLookupHandler &handler,
                         gcc_unused CancellablePointer &cancel_ptr)
 {